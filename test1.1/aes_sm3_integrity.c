@@ -45,6 +45,11 @@
 #include <unistd.h>
 #endif
 #include <sched.h>
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO) && defined(__linux__)
+#include <sys/auxv.h>
+#endif
+
+#include "aes_sm3_integrity.h"
 
 // ============================================================================
 // SM3算法常量和函数
@@ -319,16 +324,9 @@ static inline void fast_compress_block(const uint8_t* input, uint8_t* output, ui
 #endif
 }
 
-// 核心算法：使用超快速压缩，SM3最终哈希（极限优化版）
-void aes_sm3_integrity_256bit(const uint8_t* input, uint8_t* output) {
-    // 极限优化策略：进一步减少SM3压缩轮数
-    // 4KB -> 256B -> 256bit
-    // 只需4个SM3块，而不是8个或64个！
-    
-    // 第一阶段：4KB -> 256字节（超快速压缩，16:1压缩比）
-    // 每128字节压缩到8字节，总共32组
-    uint8_t compressed[256];
-    
+// 第一阶段：4KB -> 256字节（超快速压缩，16:1压缩比）
+// 每128字节压缩到8字节，总共32组
+static inline void xor_fold_4kb(const uint8_t* input, uint8_t* compressed) {
 #if defined(__ARM_FEATURE_CRYPTO) && defined(__aarch64__)
     // NEON极限优化：2路展开并行处理
     for (int i = 0; i < 32; i += 2) {
@@ -417,6 +415,79 @@ void aes_sm3_integrity_256bit(const uint8_t* input, uint8_t* output) {
                  block[103] ^ block[111] ^ block[119] ^ block[127];
     }
 #endif
+}
+
+// ============================================================================
+// ARMv8.2 SHA3扩展内核（EOR3，另用 NEON 的 BSL）
+// 三输入异或 EOR3 把折叠的8路异或从7条指令减到4条，把SM3的 FF0/GG0、P0/P1
+// 与消息扩展中的三输入异或各减为1条；FF1/GG1 用按位选择（BSL）各1-2条；
+// 32位循环移位用 SHL+SRI 两条。XAR 只能对64位通道做异或后移位，SM3的
+// 移位都在32位字上，故不使用。BCAX 计算 a ^ (b & ~c)，写 GG1 需要
+// BCAX(F, F^G, E) 两条，多数函数 FF1 同样不短于 BSL，故也不使用。
+// 编译时不要求 +sha3（目标属性只作用于这几个函数），运行时按 HWCAP_SHA3 选择；
+// 设置环境变量 AES_SM3_NO_SHA3 可强制回退到 NEON 版本做对比。
+// 折叠结果与上面的 NEON 版本逐位一致（每组16字节异或后同样只保留低8字节）。
+// ============================================================================
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO) && defined(__linux__)
+#define AES_SM3_SHA3_KERNELS 1
+
+#ifndef HWCAP_SHA3
+#define HWCAP_SHA3 (1 << 17)
+#endif
+
+static int sha3_kernels_enabled(void) {
+    static volatile int enabled = -1;
+    if (enabled < 0) {
+        enabled = (getauxval(AT_HWCAP) & HWCAP_SHA3) != 0 && getenv("AES_SM3_NO_SHA3") == NULL;
+    }
+    return enabled;
+}
+
+__attribute__((target("+sha3")))
+static void xor_fold_4kb_sha3(const uint8_t* input, uint8_t* compressed) {
+    for (int i = 0; i < 32; i++) {
+        const uint8_t* block = input + i * 128;
+        uint8x16_t x012 = veor3q_u8(vld1q_u8(block), vld1q_u8(block + 16), vld1q_u8(block + 32));
+        uint8x16_t x345 = veor3q_u8(vld1q_u8(block + 48), vld1q_u8(block + 64), vld1q_u8(block + 80));
+        uint8x16_t x67 = veorq_u8(vld1q_u8(block + 96), vld1q_u8(block + 112));
+        vst1_u8(compressed + i * 8, vget_low_u8(veor3q_u8(x012, x345, x67)));
+    }
+}
+#endif
+
+static inline void fold_page(const uint8_t* input, uint8_t* compressed) {
+#ifdef AES_SM3_SHA3_KERNELS
+    if (sha3_kernels_enabled()) {
+        xor_fold_4kb_sha3(input, compressed);
+        return;
+    }
+#endif
+    xor_fold_4kb(input, compressed);
+}
+
+const char* aes_sm3_integrity_kernel(void) {
+#ifdef AES_SM3_SHA3_KERNELS
+    if (sha3_kernels_enabled()) {
+        return "neon-sha3";
+    }
+#endif
+#if defined(__ARM_FEATURE_CRYPTO) && defined(__aarch64__)
+    return "neon";
+#else
+    return "generic";
+#endif
+}
+
+// 核心算法：使用超快速压缩，SM3最终哈希（极限优化版）
+// words 为输出的32位字数（8或4），调用处为常量，展开后只写出所需的字
+static inline __attribute__((always_inline))
+void integrity_page(const uint8_t* input, uint8_t* output, int words) {
+    // 极限优化策略：进一步减少SM3压缩轮数
+    // 4KB -> 256B -> 256bit
+    // 只需4个SM3块，而不是8个或64个！
+    uint8_t compressed[256];
+    fold_page(input, compressed);
     
     // 第二阶段：使用SM3对256字节压缩结果进行哈希
     uint32_t sm3_state[8];
@@ -450,25 +521,316 @@ void aes_sm3_integrity_256bit(const uint8_t* input, uint8_t* output) {
         sm3_compress_hw(sm3_state, sm3_block);
     }
     
-    // 输出256位哈希值
+    // 输出哈希值（128位即前4个字）
     uint32_t* out32 = (uint32_t*)output;
-    out32[0] = __builtin_bswap32(sm3_state[0]);
-    out32[1] = __builtin_bswap32(sm3_state[1]);
-    out32[2] = __builtin_bswap32(sm3_state[2]);
-    out32[3] = __builtin_bswap32(sm3_state[3]);
-    out32[4] = __builtin_bswap32(sm3_state[4]);
-    out32[5] = __builtin_bswap32(sm3_state[5]);
-    out32[6] = __builtin_bswap32(sm3_state[6]);
-    out32[7] = __builtin_bswap32(sm3_state[7]);
+    for (int j = 0; j < words; j++) {
+        out32[j] = __builtin_bswap32(sm3_state[j]);
+    }
+}
+
+void aes_sm3_integrity_256bit(const uint8_t* input, uint8_t* output) {
+    integrity_page(input, output, 8);
 }
 
-// 128位输出版本
+// 128位输出版本：直接写出前128位，不经32字节临时缓冲区
 void aes_sm3_integrity_128bit(const uint8_t* input, uint8_t* output) {
-    uint8_t full_hash[32];
-    aes_sm3_integrity_256bit(input, full_hash);
+    integrity_page(input, output, 4);
+}
+
+// ============================================================================
+// 多缓冲区（multi-buffer）批量接口
+// 4个独立页的SM3阶段放入4个32位SIMD通道同时计算：标量版本的依赖链
+// 串行执行64轮，4路通道把同样的指令数摊到4个页上。
+// 使用GCC向量扩展，ARMv8上编译为NEON，x86上编译为SSE2。
+// ============================================================================
+
+typedef uint32_t sm3_v4_t __attribute__((vector_size(16)));
+
+#define ROTL_X4(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static inline sm3_v4_t P0_x4(sm3_v4_t x) {
+    return x ^ ROTL_X4(x, 9) ^ ROTL_X4(x, 17);
+}
+
+static inline sm3_v4_t P1_x4(sm3_v4_t x) {
+    return x ^ ROTL_X4(x, 15) ^ ROTL_X4(x, 23);
+}
+
+// 与sm3_compress_hw逐位一致的4路版本
+static inline void sm3_compress_x4(sm3_v4_t* state, const sm3_v4_t* block) {
+    sm3_v4_t W[68];
+    
+    for (int j = 0; j < 16; j++) {
+        W[j] = block[j];
+    }
+    for (int j = 16; j < 68; j++) {
+        W[j] = P1_x4(W[j-16] ^ W[j-9] ^ ROTL_X4(W[j-3], 15)) ^
+               ROTL_X4(W[j-13], 7) ^ W[j-6];
+    }
+    
+    sm3_v4_t A = state[0], B = state[1], C = state[2], D = state[3];
+    sm3_v4_t E = state[4], F = state[5], G = state[6], H = state[7];
+    
+    for (int j = 0; j < 16; j++) {
+        sm3_v4_t rot_a = ROTL_X4(A, 12);
+        sm3_v4_t SS1 = rot_a + E + (SM3_Tj[j] << (j % 32));
+        SS1 = ROTL_X4(SS1, 7);
+        sm3_v4_t SS2 = SS1 ^ rot_a;
+        sm3_v4_t TT1 = (A ^ B ^ C) + D + SS2 + (W[j] ^ W[j+4]);
+        sm3_v4_t TT2 = (E ^ F ^ G) + H + SS1 + W[j];
+        D = C; C = ROTL_X4(B, 9); B = A; A = TT1;
+        H = G; G = ROTL_X4(F, 19); F = E; E = P0_x4(TT2);
+    }
     
-    // 截取前128位
-    memcpy(output, full_hash, 16);
+    for (int j = 16; j < 64; j++) {
+        sm3_v4_t rot_a = ROTL_X4(A, 12);
+        sm3_v4_t SS1 = rot_a + E + (SM3_Tj[j] << (j % 32));
+        SS1 = ROTL_X4(SS1, 7);
+        sm3_v4_t SS2 = SS1 ^ rot_a;
+        sm3_v4_t TT1 = ((A & B) | (A & C) | (B & C)) + D + SS2 + (W[j] ^ W[j+4]);
+        sm3_v4_t TT2 = ((E & F) | (~E & G)) + H + SS1 + W[j];
+        D = C; C = ROTL_X4(B, 9); B = A; A = TT1;
+        H = G; G = ROTL_X4(F, 19); F = E; E = P0_x4(TT2);
+    }
+    
+    state[0] ^= A; state[1] ^= B; state[2] ^= C; state[3] ^= D;
+    state[4] ^= E; state[5] ^= F; state[6] ^= G; state[7] ^= H;
+}
+
+static inline uint32_t load_be32(const uint8_t* p) {
+    uint32_t w;
+    memcpy(&w, p, 4);
+    return __builtin_bswap32(w);
+}
+
+// 4个页一组：各自XOR折叠后，按通道转置进入4路SM3。
+// digest_bytes 在调用处为常量（16/32），各展开一份，输出逐字直接写入
+static inline __attribute__((always_inline))
+void aes_sm3_integrity_x4(const uint8_t* const* inputs, uint8_t* const* outputs,
+                          int digest_bytes) {
+    uint8_t compressed[4][256];
+    xor_fold_4kb(inputs[0], compressed[0]);
+    xor_fold_4kb(inputs[1], compressed[1]);
+    xor_fold_4kb(inputs[2], compressed[2]);
+    xor_fold_4kb(inputs[3], compressed[3]);
+    
+    sm3_v4_t state[8];
+    for (int j = 0; j < 8; j++) {
+        state[j] = (sm3_v4_t){ SM3_IV[j], SM3_IV[j], SM3_IV[j], SM3_IV[j] };
+    }
+    
+    for (int i = 0; i < 4; i++) {
+        sm3_v4_t block[16];
+        for (int j = 0; j < 16; j++) {
+            int off = i * 64 + j * 4;
+            block[j] = (sm3_v4_t){ load_be32(compressed[0] + off), load_be32(compressed[1] + off),
+                                   load_be32(compressed[2] + off), load_be32(compressed[3] + off) };
+        }
+        sm3_compress_x4(state, block);
+    }
+    
+    for (int lane = 0; lane < 4; lane++) {
+        for (int j = 0; j < digest_bytes / 4; j++) {
+            uint32_t w = __builtin_bswap32(state[j][lane]);
+            memcpy(outputs[lane] + j * 4, &w, 4);
+        }
+    }
+}
+
+static void aes_sm3_integrity_x4_256(const uint8_t* const* inputs, uint8_t* const* outputs) {
+    aes_sm3_integrity_x4(inputs, outputs, 32);
+}
+
+static void aes_sm3_integrity_x4_128(const uint8_t* const* inputs, uint8_t* const* outputs) {
+    aes_sm3_integrity_x4(inputs, outputs, 16);
+}
+
+#ifdef AES_SM3_SHA3_KERNELS
+#define ROTL_N(x, n) vsriq_n_u32(vshlq_n_u32((x), (n)), (x), 32 - (n))
+
+// 与sm3_compress_x4逐位一致，布尔函数与三输入异或使用 EOR3 / BSL
+__attribute__((target("+sha3")))
+static void sm3_compress_x4_sha3(uint32x4_t* state, const uint32x4_t* block) {
+    uint32x4_t W[68];
+
+    for (int j = 0; j < 16; j++) {
+        W[j] = block[j];
+    }
+    for (int j = 16; j < 68; j++) {
+        uint32x4_t x = veor3q_u32(W[j-16], W[j-9], ROTL_N(W[j-3], 15));
+        x = veor3q_u32(x, ROTL_N(x, 15), ROTL_N(x, 23));                // P1
+        W[j] = veor3q_u32(x, ROTL_N(W[j-13], 7), W[j-6]);
+    }
+
+    uint32x4_t A = state[0], B = state[1], C = state[2], D = state[3];
+    uint32x4_t E = state[4], F = state[5], G = state[6], H = state[7];
+
+    for (int j = 0; j < 64; j++) {
+        uint32x4_t rot_a = ROTL_N(A, 12);
+        uint32x4_t SS1 = vaddq_u32(vaddq_u32(rot_a, E), vdupq_n_u32(SM3_Tj[j] << (j % 32)));
+        SS1 = ROTL_N(SS1, 7);
+        uint32x4_t SS2 = veorq_u32(SS1, rot_a);
+        uint32x4_t ff, gg;
+        if (j < 16) {
+            ff = veor3q_u32(A, B, C);
+            gg = veor3q_u32(E, F, G);
+        } else {
+            ff = vbslq_u32(veorq_u32(A, B), C, B);     // 多数函数：A==B 时取 B，否则取 C
+            gg = vbslq_u32(E, F, G);
+        }
+        uint32x4_t TT1 = vaddq_u32(vaddq_u32(ff, D), vaddq_u32(SS2, veorq_u32(W[j], W[j+4])));
+        uint32x4_t TT2 = vaddq_u32(vaddq_u32(gg, H), vaddq_u32(SS1, W[j]));
+        D = C; C = ROTL_N(B, 9); B = A; A = TT1;
+        H = G; G = ROTL_N(F, 19); F = E;
+        E = veor3q_u32(TT2, ROTL_N(TT2, 9), ROTL_N(TT2, 17));          // P0
+    }
+
+    state[0] = veorq_u32(state[0], A); state[1] = veorq_u32(state[1], B);
+    state[2] = veorq_u32(state[2], C); state[3] = veorq_u32(state[3], D);
+    state[4] = veorq_u32(state[4], E); state[5] = veorq_u32(state[5], F);
+    state[6] = veorq_u32(state[6], G); state[7] = veorq_u32(state[7], H);
+}
+
+static inline __attribute__((always_inline, target("+sha3")))
+void aes_sm3_integrity_x4_sha3(const uint8_t* const* inputs, uint8_t* const* outputs,
+                               int digest_bytes) {
+    uint8_t compressed[4][256];
+    for (int k = 0; k < 4; k++) {
+        xor_fold_4kb_sha3(inputs[k], compressed[k]);
+    }
+
+    uint32x4_t state[8];
+    for (int j = 0; j < 8; j++) {
+        state[j] = vdupq_n_u32(SM3_IV[j]);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        uint32x4_t block[16];
+        for (int j = 0; j < 16; j++) {
+            int off = i * 64 + j * 4;
+            uint32_t lanes[4] = { load_be32(compressed[0] + off), load_be32(compressed[1] + off),
+                                  load_be32(compressed[2] + off), load_be32(compressed[3] + off) };
+            block[j] = vld1q_u32(lanes);
+        }
+        sm3_compress_x4_sha3(state, block);
+    }
+
+    for (int j = 0; j < digest_bytes / 4; j++) {
+        uint32_t lanes[4];
+        vst1q_u32(lanes, state[j]);
+        for (int lane = 0; lane < 4; lane++) {
+            uint32_t w = __builtin_bswap32(lanes[lane]);
+            memcpy(outputs[lane] + j * 4, &w, 4);
+        }
+    }
+}
+
+__attribute__((target("+sha3")))
+static void aes_sm3_integrity_x4_sha3_256(const uint8_t* const* inputs, uint8_t* const* outputs) {
+    aes_sm3_integrity_x4_sha3(inputs, outputs, 32);
+}
+
+__attribute__((target("+sha3")))
+static void aes_sm3_integrity_x4_sha3_128(const uint8_t* const* inputs, uint8_t* const* outputs) {
+    aes_sm3_integrity_x4_sha3(inputs, outputs, 16);
+}
+#endif
+
+// 多缓冲区批量接口：inputs[i]指向第i个4KB页，摘要写入outputs[i]
+void aes_sm3_integrity_mb(const uint8_t* const* inputs, uint8_t* const* outputs,
+                          int count, int output_size) {
+    int i = 0;
+    if (output_size == 128) {
+#ifdef AES_SM3_SHA3_KERNELS
+        if (sha3_kernels_enabled()) {
+            for (; i + 4 <= count; i += 4) {
+                aes_sm3_integrity_x4_sha3_128(inputs + i, outputs + i);
+            }
+        }
+#endif
+        for (; i + 4 <= count; i += 4) {
+            aes_sm3_integrity_x4_128(inputs + i, outputs + i);
+        }
+        // 尾部不足4个页走标量路径
+        for (; i < count; i++) {
+            aes_sm3_integrity_128bit(inputs[i], outputs[i]);
+        }
+        return;
+    }
+#ifdef AES_SM3_SHA3_KERNELS
+    if (sha3_kernels_enabled()) {
+        for (; i + 4 <= count; i += 4) {
+            aes_sm3_integrity_x4_sha3_256(inputs + i, outputs + i);
+        }
+    }
+#endif
+    for (; i + 4 <= count; i += 4) {
+        aes_sm3_integrity_x4_256(inputs + i, outputs + i);
+    }
+    for (; i < count; i++) {
+        aes_sm3_integrity_256bit(inputs[i], outputs[i]);
+    }
+}
+
+int aes_sm3_integrity_verify_mb(const uint8_t* const* inputs, const uint8_t* const* expected,
+                                uint8_t* ok, int count, int output_size) {
+    int digest_bytes = output_size / 8;
+    int mismatches = 0;
+    uint8_t digests[4][32];
+    uint8_t* outputs[4] = { digests[0], digests[1], digests[2], digests[3] };
+    for (int i = 0; i < count; i += 4) {
+        int n = count - i < 4 ? count - i : 4;
+        aes_sm3_integrity_mb(inputs + i, outputs, n, output_size);
+        for (int k = 0; k < n; k++) {
+            ok[i + k] = memcmp(digests[k], expected[i + k], digest_bytes) == 0;
+            mismatches += !ok[i + k];
+        }
+    }
+    return mismatches;
+}
+
+// ============================================================================
+// 128位紧密输出接口
+// 摘要按16字节紧密排列（output + i*16），不需要输出指针数组，
+// 也没有按摘要长度的分支；去重与缓存索引只用128位标签时使用。
+// ============================================================================
+
+void aes_sm3_integrity_mb_128(const uint8_t* const* inputs, uint8_t* output, int count) {
+    int i = 0;
+#ifdef AES_SM3_SHA3_KERNELS
+    if (sha3_kernels_enabled()) {
+        for (; i + 4 <= count; i += 4) {
+            uint8_t* outputs[4] = { output + i * 16, output + i * 16 + 16,
+                                    output + i * 16 + 32, output + i * 16 + 48 };
+            aes_sm3_integrity_x4_sha3_128(inputs + i, outputs);
+        }
+    }
+#endif
+    for (; i + 4 <= count; i += 4) {
+        uint8_t* outputs[4] = { output + i * 16, output + i * 16 + 16,
+                                output + i * 16 + 32, output + i * 16 + 48 };
+        aes_sm3_integrity_x4_128(inputs + i, outputs);
+    }
+    for (; i < count; i++) {
+        aes_sm3_integrity_128bit(inputs[i], output + i * 16);
+    }
+}
+
+int aes_sm3_integrity_verify_mb_128(const uint8_t* const* inputs, const uint8_t* expected,
+                                    uint8_t* ok, int count) {
+    int mismatches = 0;
+    uint64_t digests[8];
+    for (int i = 0; i < count; i += 4) {
+        int n = count - i < 4 ? count - i : 4;
+        aes_sm3_integrity_mb_128(inputs + i, (uint8_t*)digests, n);
+        for (int k = 0; k < n; k++) {
+            uint64_t e[2];
+            memcpy(e, expected + (size_t)(i + k) * 16, 16);
+            ok[i + k] = ((digests[2 * k] ^ e[0]) | (digests[2 * k + 1] ^ e[1])) == 0;
+            mismatches += !ok[i + k];
+        }
+    }
+    return mismatches;
 }
 
 // ============================================================================
@@ -714,6 +1076,76 @@ void sm3_4kb(const uint8_t* input, uint8_t* output) {
     out32[7] = __builtin_bswap32(state[7]);
 }
 
+// 任意长度消息摘要：与sm3_4kb相同的压缩函数 + MD填充（0x80 | 0 | 64位比特长度）
+// 用于清单根摘要、检查点校验等非4KB场景；支持流式输入
+static inline void sm3_compress_bytes(uint32_t* state, const uint8_t* data) {
+    uint32_t block[16];
+    for (int j = 0; j < 16; j++) {
+        uint32_t w;
+        memcpy(&w, data + j * 4, 4);
+        block[j] = __builtin_bswap32(w);
+    }
+    sm3_compress_hw(state, block);
+}
+
+void sm3_init(sm3_ctx_t* ctx) {
+    memcpy(ctx->state, SM3_IV, sizeof(SM3_IV));
+    ctx->total = 0;
+    ctx->buf_len = 0;
+}
+
+void sm3_update(sm3_ctx_t* ctx, const uint8_t* data, size_t len) {
+    ctx->total += len;
+    if (ctx->buf_len > 0) {
+        size_t take = 64 - ctx->buf_len;
+        if (take > len) take = len;
+        memcpy(ctx->buf + ctx->buf_len, data, take);
+        ctx->buf_len += take;
+        data += take;
+        len -= take;
+        if (ctx->buf_len < 64) {
+            return;
+        }
+        sm3_compress_bytes(ctx->state, ctx->buf);
+        ctx->buf_len = 0;
+    }
+    while (len >= 64) {
+        sm3_compress_bytes(ctx->state, data);
+        data += 64;
+        len -= 64;
+    }
+    memcpy(ctx->buf, data, len);
+    ctx->buf_len = len;
+}
+
+void sm3_final(sm3_ctx_t* ctx, uint8_t* output) {
+    uint64_t bits = ctx->total * 8;
+    size_t rem = ctx->buf_len;
+    ctx->buf[rem++] = 0x80;
+    if (rem > 56) {
+        memset(ctx->buf + rem, 0, 64 - rem);
+        sm3_compress_bytes(ctx->state, ctx->buf);
+        rem = 0;
+    }
+    memset(ctx->buf + rem, 0, 56 - rem);
+    for (int j = 0; j < 8; j++) {
+        ctx->buf[63 - j] = (uint8_t)(bits >> (j * 8));
+    }
+    sm3_compress_bytes(ctx->state, ctx->buf);
+    
+    for (int j = 0; j < 8; j++) {
+        uint32_t w = __builtin_bswap32(ctx->state[j]);
+        memcpy(output + j * 4, &w, 4);
+    }
+}
+
+void sm3_hash(const uint8_t* data, size_t len, uint8_t* output) {
+    sm3_ctx_t ctx;
+    sm3_init(&ctx);
+    sm3_update(&ctx, data, len);
+    sm3_final(&ctx, output);
+}
+
 // ============================================================================
 // 多线程并行处理
 // ============================================================================
@@ -742,14 +1174,20 @@ void* thread_worker(void* arg) {
     int end_block = (data->thread_id == data->num_threads - 1) ? 
                    data->block_count : start_block + blocks_per_thread;
     
-    for (int i = start_block; i < end_block; i++) {
-        const uint8_t* block_start = data->input + i * 4096;
-        uint8_t* output_start = data->output + i * (data->output_size / 8);
-        
-        if (data->output_size == 256) {
-            aes_sm3_integrity_256bit(block_start, output_start);
-        } else {
-            aes_sm3_integrity_128bit(block_start, output_start);
+    if (data->output_size == 128) {
+        // 128位：按组走紧密输出的多缓冲区接口
+        enum { GROUP = 64 };
+        const uint8_t* inputs[GROUP];
+        for (int i = start_block; i < end_block; i += GROUP) {
+            int n = end_block - i < GROUP ? end_block - i : GROUP;
+            for (int k = 0; k < n; k++) {
+                inputs[k] = data->input + (size_t)(i + k) * 4096;
+            }
+            aes_sm3_integrity_mb_128(inputs, data->output + (size_t)i * 16, n);
+        }
+    } else {
+        for (int i = start_block; i < end_block; i++) {
+            aes_sm3_integrity_256bit(data->input + (size_t)i * 4096, data->output + (size_t)i * 32);
         }
     }
     
@@ -790,6 +1228,11 @@ void aes_sm3_parallel(const uint8_t* input, uint8_t* output, int block_count,
     free(thread_data);
 }
 
+void aes_sm3_parallel_128(const uint8_t* input, uint8_t* output, int block_count,
+                          int num_threads) {
+    aes_sm3_parallel(input, output, block_count, num_threads, 128);
+}
+
 // ============================================================================
 // 性能测试
 // ============================================================================
@@ -969,9 +1412,10 @@ void performance_benchmark() {
 }
 
 // ============================================================================
-// 主函数
+// 主函数（作为库链接时以 -DAES_SM3_NO_MAIN 去掉）
 // ============================================================================
 
+#ifndef AES_SM3_NO_MAIN
 int main() {
     printf("\n");
     printf("╔══════════════════════════════════════════════════════════╗\n");
@@ -997,4 +1441,4 @@ int main() {
     
     return 0;
 }
-
+#endif // AES_SM3_NO_MAIN
@@ -0,0 +1,69 @@
+/*
+ * 面向4KB消息长度的高性能完整性校验算法 - 公共接口
+ *
+ * 核心实现位于 aes_sm3_integrity.c。作为库链接时使用 -DAES_SM3_NO_MAIN
+ * 编译核心文件，去掉其中的性能测试主函数。
+ */
+
+#ifndef AES_SM3_INTEGRITY_H
+#define AES_SM3_INTEGRITY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 单页(4KB)完整性校验
+void aes_sm3_integrity_256bit(const uint8_t* input, uint8_t* output);
+void aes_sm3_integrity_128bit(const uint8_t* input, uint8_t* output);
+
+// 多缓冲区批量接口：inputs[i]指向第i个4KB页，摘要写入outputs[i]
+// （output_size: 128 或 256）。每4页一组在SIMD通道中并行计算SM3阶段。
+void aes_sm3_integrity_mb(const uint8_t* const* inputs, uint8_t* const* outputs,
+                          int count, int output_size);
+
+// 批量校验：计算 inputs[i] 的摘要并与 expected[i] 比较，ok[i] 置1（一致）或0，
+// 返回不一致的页数
+int aes_sm3_integrity_verify_mb(const uint8_t* const* inputs, const uint8_t* const* expected,
+                                uint8_t* ok, int count, int output_size);
+
+// 128位紧密输出：第i页的摘要写入 output + i*16（或与 expected + i*16 比较），
+// 不需要输出指针数组；去重/缓存索引等只用128位标签的场景使用
+void aes_sm3_integrity_mb_128(const uint8_t* const* inputs, uint8_t* output, int count);
+int aes_sm3_integrity_verify_mb_128(const uint8_t* const* inputs, const uint8_t* expected,
+                                    uint8_t* ok, int count);
+
+// 当前使用的内核："neon-sha3"（ARMv8.2 SHA3扩展，运行时检测）、"neon" 或 "generic"
+const char* aes_sm3_integrity_kernel(void);
+
+// 对比算法
+void sha256_4kb(const uint8_t* input, uint8_t* output);
+void sm3_4kb(const uint8_t* input, uint8_t* output);
+
+// 任意长度消息摘要（本库SM3压缩函数 + MD填充，32字节输出）
+typedef struct {
+    uint32_t state[8];
+    uint64_t total;
+    uint8_t buf[64];
+    size_t buf_len;
+} sm3_ctx_t;
+
+void sm3_init(sm3_ctx_t* ctx);
+void sm3_update(sm3_ctx_t* ctx, const uint8_t* data, size_t len);
+void sm3_final(sm3_ctx_t* ctx, uint8_t* output);
+void sm3_hash(const uint8_t* data, size_t len, uint8_t* output);
+
+// 多线程并行处理（output_size: 128 或 256）
+void aes_sm3_parallel(const uint8_t* input, uint8_t* output, int block_count,
+                      int num_threads, int output_size);
+// 128位紧密输出（output 为 block_count*16 字节）
+void aes_sm3_parallel_128(const uint8_t* input, uint8_t* output, int block_count,
+                          int num_threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // AES_SM3_INTEGRITY_H
@@ -0,0 +1,565 @@
+/*
+ * 可边收边验的流式编码（Bao 风格）
+ *
+ * 树的父节点按先序存放（n 页共 n-1 个父节点），编码时按先序遍历直接输出；
+ * 跳过一个 c 页的子树即跳过 c-1 个父节点。
+ *
+ * 解码器为推模式状态机：摘要栈保存待接收节点（页区间 + 期望摘要），
+ * 父节点收到即校验并把与区间相交的子节点压栈；叶节点先进入批校验窗口，
+ * 窗口满或本次 feed 结束时用 aes_sm3_integrity_verify_mb 一次校验后按序交付。
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_bao.h"
+#include "sm3_checkpoint.h"
+
+#define READ_CHUNK  1024    // 建树时每次读取并批量计算的页数
+#define ENC_CHUNK   256     // 编码时顺序预读的页数
+#define BATCH       16      // 解码批校验窗口（页）
+#define MAX_STACK   130     // 每层最多压入两个子节点，深度不超过64层
+
+struct sm3_bao_tree {
+    uint64_t size;
+    uint64_t pages;         // 至少1页（空对象视为一个长度为0的页）
+    uint8_t* leaves;        // pages * 32
+    uint8_t* pairs;         // (pages-1) * 64，先序
+    uint8_t root[32];
+};
+
+// n >= 2 页的子树，左侧取小于 n 的最大2的幂页
+static inline uint64_t left_pages(uint64_t n) {
+    return 1ull << (63 - __builtin_clzll(n - 1));
+}
+
+static inline uint64_t page_len(uint64_t size, uint64_t page) {
+    uint64_t rest = size - page * SM3_PAGE_SIZE;
+    return rest < SM3_PAGE_SIZE ? rest : SM3_PAGE_SIZE;
+}
+
+static inline uint64_t object_pages(uint64_t size) {
+    uint64_t n = sm3_pages_for_size(size);
+    return n ? n : 1;
+}
+
+// 区间对应的页 [first, last]；空区间或越界时取包含 offset 的页（至少一页）
+static void range_pages(uint64_t size, uint64_t offset, uint64_t len,
+                        uint64_t* first, uint64_t* last) {
+    uint64_t pages = object_pages(size);
+    uint64_t end = len > size - (offset < size ? offset : size) ? size : offset + len;
+    *first = offset / SM3_PAGE_SIZE < pages ? offset / SM3_PAGE_SIZE : pages - 1;
+    *last = end > offset ? (end - 1) / SM3_PAGE_SIZE : *first;
+    if (*last < *first) *last = *first;
+    if (*last >= pages) *last = pages - 1;
+}
+
+static inline int overlaps(uint64_t start, uint64_t count, uint64_t first, uint64_t last) {
+    return start <= last && start + count > first;
+}
+
+static void bind_length(const uint8_t* top, uint64_t size, uint8_t* root) {
+    uint8_t buf[40];
+    memcpy(buf, top, 32);
+    for (int i = 0; i < 8; i++) buf[32 + i] = (uint8_t)(size >> (8 * i));
+    sm3_hash(buf, sizeof(buf), root);
+}
+
+// ============================================================================
+// 建树
+// ============================================================================
+
+static void build_node(sm3_bao_tree_t* t, uint64_t start, uint64_t count, uint64_t* next,
+                       uint8_t* out) {
+    if (count == 1) {
+        memcpy(out, t->leaves + start * 32, 32);
+        return;
+    }
+    uint8_t* pair = t->pairs + (*next)++ * SM3_BAO_PAIR_SIZE;
+    uint64_t l = left_pages(count);
+    build_node(t, start, l, next, pair);
+    build_node(t, start + l, count - l, next, pair + 32);
+    sm3_hash(pair, SM3_BAO_PAIR_SIZE, out);
+}
+
+static sm3_bao_tree_t* tree_alloc(uint64_t size) {
+    sm3_bao_tree_t* t = calloc(1, sizeof(*t));
+    if (!t) {
+        return NULL;
+    }
+    t->size = size;
+    t->pages = object_pages(size);
+    t->leaves = malloc(t->pages * 32);
+    t->pairs = malloc(t->pages > 1 ? (t->pages - 1) * SM3_BAO_PAIR_SIZE : 1);
+    if (!t->leaves || !t->pairs) {
+        sm3_bao_tree_free(t);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return t;
+}
+
+static void tree_finish(sm3_bao_tree_t* t) {
+    uint8_t top[32];
+    uint64_t next = 0;
+    build_node(t, 0, t->pages, &next, top);
+    bind_length(top, t->size, t->root);
+}
+
+int sm3_bao_tree_build(sm3_bao_tree_t** out, int fd, sm3_pool_t* pool) {
+    *out = NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+    uint64_t size = (uint64_t)st.st_size;
+    sm3_bao_tree_t* t = tree_alloc(size);
+    uint8_t* buf = aligned_alloc(SM3_PAGE_SIZE, (size_t)READ_CHUNK * SM3_PAGE_SIZE);
+    if (!t || !buf) {
+        sm3_bao_tree_free(t);
+        free(buf);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (uint64_t p = 0; p < t->pages; p += READ_CHUNK) {
+        uint64_t n = t->pages - p < READ_CHUNK ? t->pages - p : READ_CHUNK;
+        uint64_t got;
+        if (sm3_read_pages(fd, buf, p, n, size, &got) != 0) {
+            sm3_bao_tree_free(t);
+            free(buf);
+            return -1;
+        }
+        // 计算本块摘要的同时让内核预读下一块
+        if (p + n < t->pages) {
+            posix_fadvise(fd, (off_t)((p + n) * SM3_PAGE_SIZE),
+                          (off_t)READ_CHUNK * SM3_PAGE_SIZE, POSIX_FADV_WILLNEED);
+        }
+        sm3_pool_hash_pages(pool, buf, n, t->leaves + p * 32, 32);
+    }
+    free(buf);
+    tree_finish(t);
+    *out = t;
+    return 0;
+}
+
+int sm3_bao_tree_from_manifest(sm3_bao_tree_t** out, const sm3_manifest_t* m) {
+    *out = NULL;
+    if (m->hdr->digest_size != 32 || m->hdr->page_count != sm3_pages_for_size(m->hdr->file_size)) {
+        errno = EINVAL;
+        return -1;
+    }
+    sm3_bao_tree_t* t = tree_alloc(m->hdr->file_size);
+    if (!t) {
+        return -1;
+    }
+    if (m->hdr->page_count) {
+        memcpy(t->leaves, m->digests, t->pages * 32);
+    } else {
+        static const uint8_t zero_page[SM3_PAGE_SIZE];
+        aes_sm3_integrity_256bit(zero_page, t->leaves);
+    }
+    tree_finish(t);
+    *out = t;
+    return 0;
+}
+
+void sm3_bao_tree_free(sm3_bao_tree_t* t) {
+    if (!t) {
+        return;
+    }
+    free(t->leaves);
+    free(t->pairs);
+    free(t);
+}
+
+uint64_t sm3_bao_tree_size(const sm3_bao_tree_t* t) {
+    return t->size;
+}
+
+void sm3_bao_tree_root(const sm3_bao_tree_t* t, uint8_t root[32]) {
+    memcpy(root, t->root, 32);
+}
+
+// ============================================================================
+// 编码
+// ============================================================================
+
+static uint64_t encoded_node(const sm3_bao_tree_t* t, uint64_t start, uint64_t count,
+                             uint64_t first, uint64_t last) {
+    if (!overlaps(start, count, first, last)) {
+        return 0;
+    }
+    if (count == 1) {
+        return page_len(t->size, start);
+    }
+    uint64_t l = left_pages(count);
+    return SM3_BAO_PAIR_SIZE + encoded_node(t, start, l, first, last) +
+           encoded_node(t, start + l, count - l, first, last);
+}
+
+uint64_t sm3_bao_encoded_size(const sm3_bao_tree_t* t, uint64_t offset, uint64_t len) {
+    uint64_t first, last;
+    range_pages(t->size, offset, len, &first, &last);
+    return SM3_BAO_HEADER_SIZE + encoded_node(t, 0, t->pages, first, last);
+}
+
+typedef struct {
+    const sm3_bao_tree_t* tree;
+    int fd;
+    uint8_t* buf;           // 顺序预读窗口
+    uint64_t buf_first;
+    uint64_t buf_count;
+    uint64_t last;
+    sm3_bao_write_fn write_fn;
+    void* ctx;
+} encoder_t;
+
+// 先序遍历中叶节点按页号递增出现，按块顺序读取即可
+static const uint8_t* encoder_page(encoder_t* e, uint64_t page) {
+    if (page < e->buf_first || page >= e->buf_first + e->buf_count) {
+        uint64_t n = e->last + 1 - page < ENC_CHUNK ? e->last + 1 - page : ENC_CHUNK;
+        uint64_t got;
+        if (sm3_read_pages(e->fd, e->buf, page, n, e->tree->size, &got) != 0) {
+            return NULL;
+        }
+        e->buf_first = page;
+        e->buf_count = n;
+        if (page + n <= e->last) {
+            posix_fadvise(e->fd, (off_t)((page + n) * SM3_PAGE_SIZE),
+                          (off_t)ENC_CHUNK * SM3_PAGE_SIZE, POSIX_FADV_WILLNEED);
+        }
+    }
+    return e->buf + (page - e->buf_first) * SM3_PAGE_SIZE;
+}
+
+static int encode_node(encoder_t* e, uint64_t start, uint64_t count, uint64_t idx,
+                       uint64_t first, uint64_t last) {
+    if (!overlaps(start, count, first, last)) {
+        return 0;
+    }
+    if (count == 1) {
+        const uint8_t* page = encoder_page(e, start);
+        if (!page) {
+            return -1;
+        }
+        return e->write_fn(e->ctx, page, page_len(e->tree->size, start)) == 0 ? 0 : -1;
+    }
+    if (e->write_fn(e->ctx, e->tree->pairs + idx * SM3_BAO_PAIR_SIZE, SM3_BAO_PAIR_SIZE) != 0) {
+        return -1;
+    }
+    uint64_t l = left_pages(count);
+    if (encode_node(e, start, l, idx + 1, first, last) != 0) {
+        return -1;
+    }
+    return encode_node(e, start + l, count - l, idx + l, first, last);
+}
+
+int sm3_bao_encode(const sm3_bao_tree_t* t, int fd, uint64_t offset, uint64_t len,
+                   sm3_bao_write_fn write_fn, void* ctx) {
+    uint64_t first, last;
+    range_pages(t->size, offset, len, &first, &last);
+    encoder_t e = { t, fd, NULL, 0, 0, last, write_fn, ctx };
+    e.buf = aligned_alloc(SM3_PAGE_SIZE, (size_t)ENC_CHUNK * SM3_PAGE_SIZE);
+    if (!e.buf) {
+        errno = ENOMEM;
+        return -1;
+    }
+    uint8_t header[SM3_BAO_HEADER_SIZE];
+    for (int i = 0; i < 8; i++) header[i] = (uint8_t)(t->size >> (8 * i));
+    int rc = write_fn(ctx, header, sizeof(header)) == 0 ? 0 : -1;
+    if (rc == 0) {
+        rc = encode_node(&e, 0, t->pages, 0, first, last);
+    }
+    if (rc != 0 && errno == 0) {
+        errno = ECANCELED;
+    }
+    free(e.buf);
+    return rc;
+}
+
+// ============================================================================
+// 解码
+// ============================================================================
+
+enum { NEED_HEADER, NEED_PAIR, NEED_LEAF, DONE };
+
+typedef struct {
+    uint8_t hash[32];
+    uint64_t start;
+    uint64_t count;
+} node_t;
+
+struct sm3_bao_decoder {
+    uint8_t root[32];
+    uint64_t offset;
+    uint64_t len;
+    uint64_t size;
+    uint64_t first;
+    uint64_t last;
+    int state;
+    int failed;
+
+    node_t stack[MAX_STACK];
+    int depth;
+    node_t cur;                 // 正在接收的节点
+    int cur_root;               // 当前节点为根（需绑定长度后比对根摘要）
+
+    uint8_t in[SM3_BAO_PAIR_SIZE];
+    uint8_t* dst;               // 当前接收目标
+    size_t need;
+    size_t have;
+
+    // 批校验窗口
+    uint8_t* batch;
+    uint8_t expected[BATCH][32];
+    uint64_t batch_page[BATCH];
+    int batch_count;
+
+    sm3_bao_out_fn out_fn;
+    void* ctx;
+    uint64_t t0;
+    sm3_bao_decoder_stats_t stats;
+};
+
+int sm3_bao_decoder_init(sm3_bao_decoder_t** out, const uint8_t root[32],
+                         uint64_t offset, uint64_t len, sm3_bao_out_fn out_fn, void* ctx) {
+    *out = NULL;
+    sm3_bao_decoder_t* d = calloc(1, sizeof(*d));
+    if (!d) {
+        return -1;
+    }
+    d->batch = aligned_alloc(SM3_PAGE_SIZE, (size_t)BATCH * SM3_PAGE_SIZE);
+    if (!d->batch) {
+        free(d);
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(d->root, root, 32);
+    d->offset = offset;
+    d->len = len;
+    d->out_fn = out_fn;
+    d->ctx = ctx;
+    d->state = NEED_HEADER;
+    d->dst = d->in;
+    d->need = SM3_BAO_HEADER_SIZE;
+    d->t0 = sm3_now_ns();
+    *out = d;
+    return 0;
+}
+
+void sm3_bao_decoder_free(sm3_bao_decoder_t* d) {
+    if (d) {
+        free(d->batch);
+        free(d);
+    }
+}
+
+uint64_t sm3_bao_decoder_size(const sm3_bao_decoder_t* d) {
+    return d->size;
+}
+
+const sm3_bao_decoder_stats_t* sm3_bao_decoder_stats(const sm3_bao_decoder_t* d) {
+    return &d->stats;
+}
+
+static int fail(sm3_bao_decoder_t* d, int err) {
+    d->failed = err;
+    errno = err;
+    return -1;
+}
+
+// 交付一页中落在请求区间内的部分
+static int deliver(sm3_bao_decoder_t* d, uint64_t page, const uint8_t* data) {
+    uint64_t lo = page * SM3_PAGE_SIZE, hi = lo + page_len(d->size, page);
+    uint64_t want_hi = d->len > d->size - (d->offset < d->size ? d->offset : d->size)
+                       ? d->size : d->offset + d->len;
+    if (lo < d->offset) lo = d->offset;
+    if (hi > want_hi) hi = want_hi;
+    if (lo >= hi) {
+        return 0;
+    }
+    if (d->stats.bytes_out == 0) {
+        d->stats.first_out_ns = sm3_now_ns() - d->t0;
+    }
+    d->stats.bytes_out += hi - lo;
+    if (d->out_fn(d->ctx, lo, data + (lo - page * SM3_PAGE_SIZE), hi - lo) != 0) {
+        return fail(d, ECANCELED);
+    }
+    return 0;
+}
+
+static int flush_batch(sm3_bao_decoder_t* d) {
+    int n = d->batch_count;
+    if (n == 0) {
+        return 0;
+    }
+    if (n < 0 || n > BATCH) {
+        return fail(d, EINVAL);     // 批次计数被破坏，不能当作已交付
+    }
+    const uint8_t* inputs[BATCH];
+    const uint8_t* expected[BATCH];
+    uint8_t ok[BATCH];
+    for (int i = 0; i < n; i++) {
+        inputs[i] = d->batch + (size_t)i * SM3_PAGE_SIZE;
+        expected[i] = d->expected[i];
+    }
+    aes_sm3_integrity_verify_mb(inputs, expected, ok, n, 256);
+    d->batch_count = 0;
+    d->stats.batches++;
+    // 按序交付到第一个校验失败的页为止
+    for (int i = 0; i < n; i++) {
+        if (!ok[i]) {
+            return fail(d, EBADMSG);
+        }
+        d->stats.pages_verified++;
+        if (deliver(d, d->batch_page[i], inputs[i]) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void push(sm3_bao_decoder_t* d, const uint8_t* hash, uint64_t start, uint64_t count) {
+    if (overlaps(start, count, d->first, d->last)) {
+        node_t* n = &d->stack[d->depth++];
+        memcpy(n->hash, hash, 32);
+        n->start = start;
+        n->count = count;
+    }
+}
+
+// 取下一个待接收节点，设置接收目标
+static int next_node(sm3_bao_decoder_t* d) {
+    if (d->depth == 0) {
+        d->state = DONE;
+        d->need = 0;
+        return 0;
+    }
+    d->cur = d->stack[--d->depth];
+    d->cur_root = 0;
+    d->have = 0;
+    if (d->cur.count > 1) {
+        d->state = NEED_PAIR;
+        d->dst = d->in;
+        d->need = SM3_BAO_PAIR_SIZE;
+        return 0;
+    }
+    if (d->batch_count == BATCH && flush_batch(d) != 0) {
+        return -1;
+    }
+    d->state = NEED_LEAF;
+    d->dst = d->batch + (size_t)d->batch_count * SM3_PAGE_SIZE;
+    d->need = page_len(d->size, d->cur.start);
+    memset(d->dst + d->need, 0, SM3_PAGE_SIZE - d->need);
+    return 0;
+}
+
+static int check_node(sm3_bao_decoder_t* d, const uint8_t* hash) {
+    uint8_t bound[32];
+    if (d->cur_root) {
+        bind_length(hash, d->size, bound);
+        hash = bound;
+    }
+    return memcmp(hash, d->cur_root ? d->root : d->cur.hash, 32) == 0;
+}
+
+static int item_done(sm3_bao_decoder_t* d) {
+    if (d->state == NEED_HEADER) {
+        d->size = 0;
+        for (int i = 0; i < 8; i++) d->size |= (uint64_t)d->in[i] << (8 * i);
+        range_pages(d->size, d->offset, d->len, &d->first, &d->last);
+        uint8_t none[32] = { 0 };
+        d->depth = 0;
+        push(d, none, 0, object_pages(d->size));
+        if (next_node(d) != 0) {
+            return -1;
+        }
+        d->cur_root = 1;
+        return 0;
+    }
+    if (d->state == NEED_PAIR) {
+        uint8_t h[32];
+        sm3_hash(d->in, SM3_BAO_PAIR_SIZE, h);
+        if (!check_node(d, h)) {
+            return fail(d, EBADMSG);
+        }
+        d->stats.nodes_verified++;
+        uint64_t l = left_pages(d->cur.count);
+        push(d, d->in + 32, d->cur.start + l, d->cur.count - l);
+        push(d, d->in, d->cur.start, l);
+        return next_node(d);
+    }
+    // 叶节点：单页对象的根直接校验，其余进入批校验窗口
+    if (d->cur_root) {
+        uint8_t h[32];
+        aes_sm3_integrity_256bit(d->dst, h);
+        if (!check_node(d, h)) {
+            return fail(d, EBADMSG);
+        }
+        d->stats.pages_verified++;
+        if (deliver(d, d->cur.start, d->dst) != 0) {
+            return -1;
+        }
+    } else {
+        memcpy(d->expected[d->batch_count], d->cur.hash, 32);
+        d->batch_page[d->batch_count] = d->cur.start;
+        d->batch_count++;
+    }
+    return next_node(d);
+}
+
+int sm3_bao_decoder_feed(sm3_bao_decoder_t* d, const void* data, size_t len) {
+    if (d->failed) {
+        errno = d->failed;
+        return -1;
+    }
+    const uint8_t* p = data;
+    d->stats.bytes_in += len;
+    while (len > 0) {
+        if (d->state == DONE) {
+            return fail(d, EINVAL);     // 编码结束后仍有数据
+        }
+        size_t n = d->need - d->have < len ? d->need - d->have : len;
+        memcpy(d->dst + d->have, p, n);
+        d->have += n;
+        p += n;
+        len -= n;
+        // 长度为0的页（空对象）不消耗输入，循环内统一处理
+        while (d->have == d->need && d->state != DONE) {
+            if (item_done(d) != 0) {
+                return -1;
+            }
+        }
+    }
+    while (d->state == NEED_LEAF && d->need == 0) {
+        if (item_done(d) != 0) {
+            return -1;
+        }
+    }
+    // 本次输入处理完即交付窗口内的页，避免慢速流上的交付延迟；
+    // 正在接收的页移到窗口首位
+    if (flush_batch(d) != 0) {
+        return -1;
+    }
+    if (d->state == NEED_LEAF && d->dst != d->batch) {
+        memmove(d->batch, d->dst, SM3_PAGE_SIZE);
+        d->dst = d->batch;
+    }
+    return 0;
+}
+
+int sm3_bao_decoder_finish(sm3_bao_decoder_t* d) {
+    if (sm3_bao_decoder_feed(d, NULL, 0) != 0) {
+        return -1;
+    }
+    if (d->state != DONE) {
+        return fail(d, EPIPE);
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * 可边收边验的流式编码（Bao 风格）
+ *
+ * 对象按4KB页切分，叶节点 = 页摘要（aes_sm3_integrity_256bit，末页补零），
+ * 父节点 = sm3_hash(左子摘要 || 右子摘要)。n 页的子树左侧取小于 n 的
+ * 最大2的幂页，右侧为其余页。根摘要 = sm3_hash(顶层节点摘要 || 长度LE64)，
+ * 把对象长度一并绑定。
+ *
+ * 编码流 = 8字节长度(LE) + 按先序排列的节点：父节点输出其两个子摘要（64字节），
+ * 叶节点输出页数据（末页按实际长度）。接收方只需持有根摘要：每个父节点
+ * 由上层已校验的摘要验证，每页由其父节点验证，收到即可交付，内存占用与
+ * 对象大小无关（摘要栈深度不超过64层 + 一个批校验窗口）。
+ *
+ * 区间切片：只输出与 [offset, offset+len) 相交的子树（路径上的父节点仍全部
+ * 输出），解码方按同一区间参数解码，只交付区间内的字节。
+ *
+ * 叶节点摘要与 256 位页摘要清单一致，已有清单时编码无需重新读取计算。
+ */
+
+#ifndef SM3_BAO_H
+#define SM3_BAO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sm3_manifest.h"
+#include "sm3_pool.h"
+
+#define SM3_BAO_HEADER_SIZE 8
+#define SM3_BAO_PAIR_SIZE   64
+#define SM3_BAO_ALL         UINT64_MAX  // 区间长度：直到对象末尾
+
+// ============================================================================
+// 编码
+// ============================================================================
+
+typedef struct sm3_bao_tree sm3_bao_tree_t;
+
+// 写出编码数据；返回 0 继续，非0 中止
+typedef int (*sm3_bao_write_fn)(void* ctx, const void* data, size_t len);
+
+// 读取 fd 全部内容计算树（经线程池批量计算页摘要，pool 可为 NULL）
+int sm3_bao_tree_build(sm3_bao_tree_t** out, int fd, sm3_pool_t* pool);
+// 由 256 位清单构造树（不读取数据）
+int sm3_bao_tree_from_manifest(sm3_bao_tree_t** out, const sm3_manifest_t* manifest);
+void sm3_bao_tree_free(sm3_bao_tree_t* tree);
+
+uint64_t sm3_bao_tree_size(const sm3_bao_tree_t* tree);
+void sm3_bao_tree_root(const sm3_bao_tree_t* tree, uint8_t root[32]);
+
+// 区间 [offset, offset+len) 的编码长度（len 可为 SM3_BAO_ALL）
+uint64_t sm3_bao_encoded_size(const sm3_bao_tree_t* tree, uint64_t offset, uint64_t len);
+// 从 fd 读取数据页，输出区间编码
+int sm3_bao_encode(const sm3_bao_tree_t* tree, int fd, uint64_t offset, uint64_t len,
+                   sm3_bao_write_fn write_fn, void* ctx);
+
+// ============================================================================
+// 解码
+// ============================================================================
+
+typedef struct sm3_bao_decoder sm3_bao_decoder_t;
+
+// 交付已校验的数据：offset 为对象内偏移；返回 0 继续，非0 中止
+typedef int (*sm3_bao_out_fn)(void* ctx, uint64_t offset, const void* data, size_t len);
+
+typedef struct {
+    uint64_t bytes_in;          // 已接收的编码字节
+    uint64_t bytes_out;         // 已交付的数据字节
+    uint64_t pages_verified;
+    uint64_t nodes_verified;
+    uint64_t batches;           // 批量页校验次数
+    uint64_t first_out_ns;      // 自 init 起到交付首字节的耗时
+} sm3_bao_decoder_stats_t;
+
+int sm3_bao_decoder_init(sm3_bao_decoder_t** out, const uint8_t root[32],
+                         uint64_t offset, uint64_t len, sm3_bao_out_fn out_fn, void* ctx);
+// 送入任意长度的编码数据。校验失败返回 -1/EBADMSG，编码格式错误返回 -1/EINVAL，
+// 此后该解码器不再接受数据
+int sm3_bao_decoder_feed(sm3_bao_decoder_t* dec, const void* data, size_t len);
+// 输入结束：交付剩余数据，编码不完整时返回 -1/EPIPE
+int sm3_bao_decoder_finish(sm3_bao_decoder_t* dec);
+// 解码得到的对象长度（收到头部之前为 0）
+uint64_t sm3_bao_decoder_size(const sm3_bao_decoder_t* dec);
+const sm3_bao_decoder_stats_t* sm3_bao_decoder_stats(const sm3_bao_decoder_t* dec);
+void sm3_bao_decoder_free(sm3_bao_decoder_t* dec);
+
+#endif // SM3_BAO_H
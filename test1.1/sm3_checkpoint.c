@@ -0,0 +1,356 @@
+/*
+ * 长时间扫描任务的检查点与断点续扫
+ *
+ * 文件格式（主机字节序）：
+ *   头部(80字节) | 区间表(count×16字节) | 不一致页表(count×8字节) | SM3(前述全部内容)
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+
+#define SM3_CKPT_MAGIC   "SM3CKPT1"
+#define SM3_CKPT_VERSION 1
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t job_type;
+    uint32_t digest_size;
+    uint32_t reserved;
+    uint64_t data_size;
+    uint64_t data_ino;
+    int64_t  data_mtime_ns;
+    uint64_t pages_total;
+    uint64_t range_count;
+    uint64_t bad_count;
+    uint64_t reserved2;
+} sm3_ckpt_header_t;
+
+uint64_t sm3_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// ============================================================================
+// 区间集合
+// ============================================================================
+
+void sm3_range_set_init(sm3_range_set_t* set) {
+    set->ranges = NULL;
+    set->count = 0;
+    set->cap = 0;
+}
+
+void sm3_range_set_free(sm3_range_set_t* set) {
+    free(set->ranges);
+    sm3_range_set_init(set);
+}
+
+int sm3_range_set_add(sm3_range_set_t* set, uint64_t start, uint64_t end) {
+    if (start >= end) {
+        return 0;
+    }
+
+    // 找到第一个 end >= start 的区间（可与新区间相邻或重叠）
+    size_t i = 0;
+    while (i < set->count && set->ranges[i].end < start) {
+        i++;
+    }
+
+    // 合并所有与 [start, end) 重叠或相邻的区间
+    size_t j = i;
+    while (j < set->count && set->ranges[j].start <= end) {
+        if (set->ranges[j].start < start) start = set->ranges[j].start;
+        if (set->ranges[j].end > end) end = set->ranges[j].end;
+        j++;
+    }
+
+    if (j > i) {
+        // 用合并结果替换 [i, j)
+        set->ranges[i].start = start;
+        set->ranges[i].end = end;
+        memmove(&set->ranges[i + 1], &set->ranges[j], (set->count - j) * sizeof(sm3_range_t));
+        set->count -= (j - i - 1);
+        return 0;
+    }
+
+    if (set->count == set->cap) {
+        size_t new_cap = set->cap ? set->cap * 2 : 16;
+        sm3_range_t* r = realloc(set->ranges, new_cap * sizeof(sm3_range_t));
+        if (!r) {
+            return -1;
+        }
+        set->ranges = r;
+        set->cap = new_cap;
+    }
+    memmove(&set->ranges[i + 1], &set->ranges[i], (set->count - i) * sizeof(sm3_range_t));
+    set->ranges[i].start = start;
+    set->ranges[i].end = end;
+    set->count++;
+    return 0;
+}
+
+uint64_t sm3_range_set_total(const sm3_range_set_t* set) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < set->count; i++) {
+        total += set->ranges[i].end - set->ranges[i].start;
+    }
+    return total;
+}
+
+int sm3_range_set_find_gap(const sm3_range_set_t* set, uint64_t from, uint64_t limit,
+                           uint64_t* gap_start, uint64_t* gap_end) {
+    uint64_t pos = from;
+    for (size_t i = 0; i < set->count && pos < limit; i++) {
+        const sm3_range_t* r = &set->ranges[i];
+        if (r->end <= pos) {
+            continue;
+        }
+        if (r->start > pos) {
+            *gap_start = pos;
+            *gap_end = r->start < limit ? r->start : limit;
+            return 1;
+        }
+        pos = r->end;
+    }
+    if (pos < limit) {
+        *gap_start = pos;
+        *gap_end = limit;
+        return 1;
+    }
+    return 0;
+}
+
+// ============================================================================
+// 检查点读写
+// ============================================================================
+
+void sm3_checkpoint_init(sm3_checkpoint_t* cp) {
+    memset(cp, 0, sizeof(*cp));
+    sm3_range_set_init(&cp->done);
+}
+
+void sm3_checkpoint_free(sm3_checkpoint_t* cp) {
+    sm3_range_set_free(&cp->done);
+    free(cp->bad_pages);
+    sm3_checkpoint_init(cp);
+}
+
+int sm3_checkpoint_add_bad(sm3_checkpoint_t* cp, uint64_t page) {
+    if (cp->bad_count == cp->bad_cap) {
+        size_t new_cap = cp->bad_cap ? cp->bad_cap * 2 : 64;
+        uint64_t* p = realloc(cp->bad_pages, new_cap * sizeof(uint64_t));
+        if (!p) {
+            return -1;
+        }
+        cp->bad_pages = p;
+        cp->bad_cap = new_cap;
+    }
+    cp->bad_pages[cp->bad_count++] = page;
+    return 0;
+}
+
+static int write_all(int fd, const void* buf, size_t len) {
+    const uint8_t* p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void fsync_parent_dir(const char* path) {
+    char* copy = strdup(path);
+    if (!copy) {
+        return;
+    }
+    int dfd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+    if (dfd >= 0) {
+        fsync(dfd);
+        close(dfd);
+    }
+    free(copy);
+}
+
+long sm3_checkpoint_save(const char* path, const sm3_checkpoint_t* cp) {
+    sm3_ckpt_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SM3_CKPT_MAGIC, 8);
+    hdr.version = SM3_CKPT_VERSION;
+    hdr.job_type = cp->job_type;
+    hdr.digest_size = cp->digest_size;
+    hdr.data_size = cp->data_size;
+    hdr.data_ino = cp->data_ino;
+    hdr.data_mtime_ns = cp->data_mtime_ns;
+    hdr.pages_total = cp->pages_total;
+    hdr.range_count = cp->done.count;
+    hdr.bad_count = cp->bad_count;
+
+    // 序列化到一块连续缓冲区，一次写入、一次同步
+    size_t body = sizeof(hdr) + cp->done.count * sizeof(sm3_range_t) +
+                  cp->bad_count * sizeof(uint64_t);
+    uint8_t* buf = malloc(body + 32);
+    if (!buf) {
+        return -1;
+    }
+    uint8_t* p = buf;
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    memcpy(p, cp->done.ranges, cp->done.count * sizeof(sm3_range_t));
+    p += cp->done.count * sizeof(sm3_range_t);
+    memcpy(p, cp->bad_pages, cp->bad_count * sizeof(uint64_t));
+    sm3_hash(buf, body, buf + body);
+
+    size_t plen = strlen(path);
+    char* tmp = malloc(plen + 5);
+    if (!tmp) {
+        free(buf);
+        return -1;
+    }
+    memcpy(tmp, path, plen);
+    memcpy(tmp + plen, ".tmp", 5);
+
+    long result = -1;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        if (write_all(fd, buf, body + 32) == 0 && fdatasync(fd) == 0) {
+            result = (long)(body + 32);
+        }
+        close(fd);
+        if (result >= 0 && rename(tmp, path) != 0) {
+            result = -1;
+        }
+        if (result < 0) {
+            unlink(tmp);
+        } else {
+            fsync_parent_dir(path);
+        }
+    }
+
+    free(tmp);
+    free(buf);
+    return result;
+}
+
+int sm3_checkpoint_load(const char* path, sm3_checkpoint_t* cp) {
+    sm3_checkpoint_init(cp);
+
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return errno == ENOENT ? 1 : -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < (long)(sizeof(sm3_ckpt_header_t) + 32)) {
+        fclose(f);
+        return -1;
+    }
+
+    uint8_t* buf = malloc((size_t)size);
+    if (!buf || fread(buf, 1, (size_t)size, f) != (size_t)size) {
+        free(buf);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    sm3_ckpt_header_t hdr;
+    memcpy(&hdr, buf, sizeof(hdr));
+    size_t body = (size_t)size - 32;
+    uint8_t digest[32];
+    sm3_hash(buf, body, digest);
+    if (memcmp(hdr.magic, SM3_CKPT_MAGIC, 8) != 0 || hdr.version != SM3_CKPT_VERSION ||
+        memcmp(digest, buf + body, 32) != 0 ||
+        body != sizeof(hdr) + hdr.range_count * sizeof(sm3_range_t) +
+                hdr.bad_count * sizeof(uint64_t)) {
+        free(buf);
+        return -1;
+    }
+
+    cp->job_type = hdr.job_type;
+    cp->digest_size = hdr.digest_size;
+    cp->data_size = hdr.data_size;
+    cp->data_ino = hdr.data_ino;
+    cp->data_mtime_ns = hdr.data_mtime_ns;
+    cp->pages_total = hdr.pages_total;
+
+    const uint8_t* p = buf + sizeof(hdr);
+    for (uint64_t i = 0; i < hdr.range_count; i++) {
+        sm3_range_t r;
+        memcpy(&r, p, sizeof(r));
+        p += sizeof(r);
+        if (sm3_range_set_add(&cp->done, r.start, r.end) != 0) {
+            goto fail;
+        }
+    }
+    for (uint64_t i = 0; i < hdr.bad_count; i++) {
+        uint64_t page;
+        memcpy(&page, p, sizeof(page));
+        p += sizeof(page);
+        if (sm3_checkpoint_add_bad(cp, page) != 0) {
+            goto fail;
+        }
+    }
+    free(buf);
+    return 0;
+
+fail:
+    free(buf);
+    sm3_checkpoint_free(cp);
+    return -1;
+}
+
+int sm3_checkpoint_remove(const char* path) {
+    if (unlink(path) != 0 && errno != ENOENT) {
+        return -1;
+    }
+    return 0;
+}
+
+// ============================================================================
+// 检查点节拍
+// ============================================================================
+
+void sm3_ckpt_timer_init(sm3_ckpt_timer_t* t, uint64_t interval_pages, uint32_t interval_ms) {
+    memset(t, 0, sizeof(*t));
+    t->interval_pages = interval_pages;
+    t->interval_ns = (uint64_t)interval_ms * 1000000ull;
+    t->last_ns = sm3_now_ns();
+}
+
+int sm3_ckpt_timer_due(const sm3_ckpt_timer_t* t, uint64_t pages_done) {
+    if (t->interval_pages && pages_done - t->last_pages >= t->interval_pages) {
+        return 1;
+    }
+    if (t->interval_ns && sm3_now_ns() - t->last_ns >= t->interval_ns) {
+        return 1;
+    }
+    return 0;
+}
+
+void sm3_ckpt_timer_mark(sm3_ckpt_timer_t* t, uint64_t pages_done, uint64_t cost_ns, long bytes) {
+    t->last_pages = pages_done;
+    t->last_ns = sm3_now_ns();
+    t->writes++;
+    t->total_ns += cost_ns;
+    if (bytes > 0) {
+        t->total_bytes += (uint64_t)bytes;
+    }
+}
@@ -0,0 +1,82 @@
+/*
+ * 长时间扫描任务的检查点与断点续扫
+ *
+ * 检查点记录已完成的页区间和任务的部分状态（校验任务的不一致页列表），
+ * 采用"写临时文件 + fdatasync + rename"原子替换。写入按页数/时间间隔
+ * 批量触发，单次检查点的同步开销摊薄到整个间隔内的所有页。
+ */
+
+#ifndef SM3_CHECKPOINT_H
+#define SM3_CHECKPOINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 任务类型
+#define SM3_JOB_HASH    1   // 生成清单
+#define SM3_JOB_VERIFY  2   // 按清单校验
+
+// 页区间 [start, end)
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+} sm3_range_t;
+
+// 有序、合并后的区间集合
+typedef struct {
+    sm3_range_t* ranges;
+    size_t count;
+    size_t cap;
+} sm3_range_set_t;
+
+void sm3_range_set_init(sm3_range_set_t* set);
+void sm3_range_set_free(sm3_range_set_t* set);
+int sm3_range_set_add(sm3_range_set_t* set, uint64_t start, uint64_t end);
+uint64_t sm3_range_set_total(const sm3_range_set_t* set);
+// 在 [from, limit) 中查找第一个未覆盖区间，找到返回1
+int sm3_range_set_find_gap(const sm3_range_set_t* set, uint64_t from, uint64_t limit,
+                           uint64_t* gap_start, uint64_t* gap_end);
+
+typedef struct {
+    uint32_t job_type;
+    uint32_t digest_size;
+    // 数据文件身份（大小/inode/mtime），任一变化则检查点作废
+    uint64_t data_size;
+    uint64_t data_ino;
+    int64_t  data_mtime_ns;
+    uint64_t pages_total;
+    sm3_range_set_t done;       // 已完成页区间
+    uint64_t* bad_pages;        // 校验任务：已发现的不一致页
+    size_t bad_count;
+    size_t bad_cap;
+} sm3_checkpoint_t;
+
+void sm3_checkpoint_init(sm3_checkpoint_t* cp);
+void sm3_checkpoint_free(sm3_checkpoint_t* cp);
+int sm3_checkpoint_add_bad(sm3_checkpoint_t* cp, uint64_t page);
+
+// 返回 0 成功，1 文件不存在，-1 读取失败或校验和不符
+int sm3_checkpoint_load(const char* path, sm3_checkpoint_t* cp);
+// 原子保存；返回写入字节数，失败返回 -1
+long sm3_checkpoint_save(const char* path, const sm3_checkpoint_t* cp);
+int sm3_checkpoint_remove(const char* path);
+
+// 检查点节拍：每 interval_pages 页或 interval_ms 毫秒触发一次（0表示不按该维度触发）
+typedef struct {
+    uint64_t interval_pages;
+    uint64_t interval_ns;
+    uint64_t last_pages;
+    uint64_t last_ns;
+    // 开销统计
+    uint64_t writes;
+    uint64_t total_ns;
+    uint64_t total_bytes;
+} sm3_ckpt_timer_t;
+
+void sm3_ckpt_timer_init(sm3_ckpt_timer_t* t, uint64_t interval_pages, uint32_t interval_ms);
+int sm3_ckpt_timer_due(const sm3_ckpt_timer_t* t, uint64_t pages_done);
+void sm3_ckpt_timer_mark(sm3_ckpt_timer_t* t, uint64_t pages_done, uint64_t cost_ns, long bytes);
+
+uint64_t sm3_now_ns(void);
+
+#endif // SM3_CHECKPOINT_H
@@ -0,0 +1,315 @@
+/*
+ * 确定性页语料生成
+ *
+ * 每页的类型、是否重复、重复源以及页内随机流都由 (seed, 页号) 经 splitmix64
+ * 混合得到，互不依赖。重复页的源页号小于自身，源页若也是重复页则继续
+ * 回溯，直到一个非重复页，因此任意一页都能独立生成。
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sm3_corpus.h"
+
+#define WRITE_CHUNK 256     // 写文件时每批生成的页数（1MB）
+
+static const char* const kind_names[SM3_CORPUS_KINDS] = {
+    "zero", "uniform", "random", "text", "compressed",
+};
+
+// 文本页词表（按常见程度排列，前面的词出现更频繁）
+static const char* const words[] = {
+    "the", "of", "and", "to", "a", "in", "is", "that", "for", "it", "as", "was", "with",
+    "be", "by", "on", "not", "he", "this", "are", "or", "his", "from", "at", "which",
+    "but", "have", "an", "had", "they", "you", "were", "their", "one", "all", "we",
+    "can", "her", "has", "there", "been", "if", "more", "when", "will", "would", "who",
+    "so", "no", "data", "page", "block", "write", "read", "cache", "server", "request",
+    "error", "value", "index", "table", "record", "update", "storage", "integrity",
+};
+#define WORD_COUNT (sizeof(words) / sizeof(words[0]))
+
+static uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// 第 index 页的第 salt 个独立随机数
+static uint64_t page_hash(const sm3_corpus_opts_t* opts, uint64_t index, uint64_t salt) {
+    return mix64(opts->seed ^ mix64(index * 8 + salt));
+}
+
+static double unit(uint64_t h) {
+    return (double)(h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t rng_next(uint64_t* x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+void sm3_corpus_opts_default(sm3_corpus_opts_t* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->weight[SM3_CORPUS_RANDOM] = 1;
+    opts->seed = 1;
+}
+
+const char* sm3_corpus_kind_name(int kind) {
+    return kind >= 0 && kind < SM3_CORPUS_KINDS ? kind_names[kind] : "?";
+}
+
+int sm3_corpus_parse(sm3_corpus_opts_t* opts, const char* spec) {
+    sm3_corpus_opts_t o = *opts;
+    int weights_seen = 0;
+    char* copy = strdup(spec);
+    if (!copy) {
+        return -1;
+    }
+    int rc = 0;
+    char* save = NULL;
+    for (char* tok = strtok_r(copy, ",", &save); tok && rc == 0; tok = strtok_r(NULL, ",", &save)) {
+        char* eq = strchr(tok, '=');
+        char* end;
+        if (!eq || eq[1] == '\0') {
+            rc = -1;
+            break;
+        }
+        *eq = '\0';
+        const char* val = eq + 1;
+        if (strcmp(tok, "seed") == 0) {
+            o.seed = strtoull(val, &end, 0);
+            rc = *end ? -1 : 0;
+            continue;
+        }
+        double v = strtod(val, &end);
+        if (*end || v < 0) {
+            rc = -1;
+        } else if (strcmp(tok, "dup") == 0) {
+            o.dup_pct = v;
+            rc = v < 100 ? 0 : -1;
+        } else {
+            int k = 0;
+            while (k < SM3_CORPUS_KINDS && strcmp(tok, kind_names[k]) != 0) k++;
+            if (k == SM3_CORPUS_KINDS) {
+                rc = -1;
+            } else {
+                if (!weights_seen) {
+                    memset(o.weight, 0, sizeof(o.weight));
+                    weights_seen = 1;
+                }
+                o.weight[k] = v;
+            }
+        }
+    }
+    free(copy);
+    double total = 0;
+    for (int k = 0; k < SM3_CORPUS_KINDS; k++) total += o.weight[k];
+    if (rc != 0 || total <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    *opts = o;
+    return 0;
+}
+
+void sm3_corpus_format(const sm3_corpus_opts_t* opts, char* buf, size_t len) {
+    size_t n = 0;
+    buf[0] = '\0';
+    for (int k = 0; k < SM3_CORPUS_KINDS && n < len; k++) {
+        if (opts->weight[k] > 0) {
+            n += (size_t)snprintf(buf + n, len - n, "%s=%g,", kind_names[k], opts->weight[k]);
+        }
+    }
+    if (n < len) {
+        snprintf(buf + n, len - n, "dup=%g,seed=%llu", opts->dup_pct,
+                 (unsigned long long)opts->seed);
+    }
+}
+
+static int pick_kind(const sm3_corpus_opts_t* opts, uint64_t index) {
+    double total = 0;
+    for (int k = 0; k < SM3_CORPUS_KINDS; k++) total += opts->weight[k];
+    double u = unit(page_hash(opts, index, 0)) * total;
+    int last = SM3_CORPUS_RANDOM;
+    for (int k = 0; k < SM3_CORPUS_KINDS; k++) {
+        if (opts->weight[k] <= 0) continue;
+        if (u < opts->weight[k]) return k;
+        u -= opts->weight[k];
+        last = k;
+    }
+    return last;    // 浮点舍入落在末尾
+}
+
+static int page_is_dup(const sm3_corpus_opts_t* opts, uint64_t index) {
+    return index > 0 && opts->dup_pct > 0 && unit(page_hash(opts, index, 1)) * 100 < opts->dup_pct;
+}
+
+// 回溯到内容的来源页（非重复页）
+static uint64_t resolve_source(const sm3_corpus_opts_t* opts, uint64_t index) {
+    while (page_is_dup(opts, index)) {
+        index = page_hash(opts, index, 2) % index;
+    }
+    return index;
+}
+
+int sm3_corpus_page_kind(const sm3_corpus_opts_t* opts, uint64_t index, int* is_dup) {
+    if (is_dup) {
+        *is_dup = page_is_dup(opts, index);
+    }
+    return pick_kind(opts, resolve_source(opts, index));
+}
+
+static void gen_text(uint8_t* page, uint64_t* rng) {
+    size_t pos = 0;
+    int sentence_start = 1;
+    while (pos < SM3_CORPUS_PAGE_SIZE) {
+        uint64_t r = rng_next(rng);
+        // 平方分布偏向词表前部，近似自然文本的词频
+        uint64_t a = r & 0xffff, idx = (a * a >> 16) * WORD_COUNT >> 16;
+        const char* w = words[idx];
+        size_t wl = strlen(w);
+        for (size_t i = 0; i < wl && pos < SM3_CORPUS_PAGE_SIZE; i++) {
+            char c = w[i];
+            page[pos++] = (uint8_t)(sentence_start && i == 0 ? c - 'a' + 'A' : c);
+        }
+        sentence_start = 0;
+        if (pos >= SM3_CORPUS_PAGE_SIZE) break;
+        uint32_t p = (uint32_t)(r >> 32) % 100;
+        if (p < 6) {
+            page[pos++] = '.';
+            sentence_start = 1;
+        } else if (p < 10) {
+            page[pos++] = ',';
+        }
+        if (pos < SM3_CORPUS_PAGE_SIZE) {
+            page[pos++] = sentence_start && p < 2 ? '\n' : ' ';
+        }
+    }
+}
+
+static void gen_compressed(uint8_t* page, uint64_t* rng) {
+    for (size_t i = 0; i < SM3_CORPUS_PAGE_SIZE / 8; i++) {
+        ((uint64_t*)page)[i] = rng_next(rng);
+    }
+    // 每512字节一个块头（固定标记 + 块序号 + 长度），并插入少量短距离回引用
+    for (uint32_t blk = 0; blk < SM3_CORPUS_PAGE_SIZE / 512; blk++) {
+        uint8_t* h = page + blk * 512;
+        h[0] = 0x1f;
+        h[1] = 0x8b;
+        h[2] = (uint8_t)blk;
+        h[3] = 0x02;
+        h[4] = 0x00;
+        h[5] = 0x02;
+        for (int k = 0; k < 3; k++) {
+            uint64_t r = rng_next(rng);
+            size_t len = 4 + (r & 15);
+            size_t dst = 64 + (size_t)((r >> 8) % (512 - 64 - len));
+            size_t dist = 8 + (size_t)((r >> 24) % (dst - 8));
+            memmove(h + dst, h + dst - dist, len);
+        }
+    }
+}
+
+static void gen_unique(const sm3_corpus_opts_t* opts, uint64_t index, uint8_t* page) {
+    uint64_t rng = page_hash(opts, index, 3) | 1;
+    switch (pick_kind(opts, index)) {
+    case SM3_CORPUS_ZERO:
+        memset(page, 0, SM3_CORPUS_PAGE_SIZE);
+        break;
+    case SM3_CORPUS_UNIFORM:
+        memset(page, (int)(rng % 255) + 1, SM3_CORPUS_PAGE_SIZE);
+        break;
+    case SM3_CORPUS_TEXT:
+        gen_text(page, &rng);
+        break;
+    case SM3_CORPUS_COMPRESSED:
+        gen_compressed(page, &rng);
+        break;
+    default:
+        for (size_t i = 0; i < SM3_CORPUS_PAGE_SIZE / 8; i++) {
+            ((uint64_t*)page)[i] = rng_next(&rng);
+        }
+        break;
+    }
+}
+
+void sm3_corpus_page(const sm3_corpus_opts_t* opts, uint64_t index, uint8_t* page) {
+    gen_unique(opts, resolve_source(opts, index), page);
+}
+
+typedef struct {
+    const sm3_corpus_opts_t* opts;
+    uint64_t first;
+    uint8_t* pages;
+} fill_ctx_t;
+
+static void fill_range(void* arg, size_t begin, size_t end) {
+    fill_ctx_t* c = arg;
+    for (size_t i = begin; i < end; i++) {
+        sm3_corpus_page(c->opts, c->first + i, c->pages + i * SM3_CORPUS_PAGE_SIZE);
+    }
+}
+
+static void count_range(const sm3_corpus_opts_t* opts, uint64_t first, uint64_t count,
+                        sm3_corpus_stats_t* stats) {
+    for (uint64_t i = first; i < first + count; i++) {
+        int dup;
+        stats->kind_pages[sm3_corpus_page_kind(opts, i, &dup)]++;
+        stats->dup_pages += (uint64_t)dup;
+    }
+    stats->pages += count;
+}
+
+void sm3_corpus_fill(const sm3_corpus_opts_t* opts, sm3_pool_t* pool, uint64_t first,
+                     uint64_t count, uint8_t* pages, sm3_corpus_stats_t* stats) {
+    fill_ctx_t c = { opts, first, pages };
+    if (pool) {
+        sm3_pool_run(pool, fill_range, &c, (size_t)count, 16);
+    } else {
+        fill_range(&c, 0, (size_t)count);
+    }
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+        count_range(opts, first, count, stats);
+    }
+}
+
+int sm3_corpus_write(const sm3_corpus_opts_t* opts, sm3_pool_t* pool, int fd, uint64_t count,
+                     sm3_corpus_stats_t* stats) {
+    uint8_t* buf = malloc((size_t)WRITE_CHUNK * SM3_CORPUS_PAGE_SIZE);
+    if (!buf) {
+        return -1;
+    }
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    for (uint64_t p = 0; p < count; p += WRITE_CHUNK) {
+        uint64_t n = count - p < WRITE_CHUNK ? count - p : WRITE_CHUNK;
+        sm3_corpus_fill(opts, pool, p, n, buf, NULL);
+        if (stats) {
+            count_range(opts, p, n, stats);
+        }
+        size_t len = (size_t)n * SM3_CORPUS_PAGE_SIZE, done = 0;
+        while (done < len) {
+            ssize_t w = pwrite(fd, buf + done, len - done,
+                               (off_t)(p * SM3_CORPUS_PAGE_SIZE + done));
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                int e = w < 0 ? errno : EIO;
+                free(buf);
+                errno = e;
+                return -1;
+            }
+            done += (size_t)w;
+        }
+    }
+    free(buf);
+    return 0;
+}
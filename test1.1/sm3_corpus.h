@@ -0,0 +1,75 @@
+/*
+ * 确定性页语料生成
+ *
+ * 基准测试原先统一使用 i % 256 填充的数据，掩盖了零页、单值页等数据相关的
+ * 快速路径以及缓存行为。本模块按配置的比例生成多种类型的4KB页：
+ *   - zero        全零页
+ *   - uniform     单字节值填充页
+ *   - random      均匀随机字节
+ *   - text        ASCII 文本（单词 + 空格/标点/换行，熵约4~5位/字节）
+ *   - compressed  压缩数据形态：高熵字节流，夹杂块头与少量短重复
+ * 另可指定重复页比例（dup）：重复页逐字节复制编号更小的某一页，用于去重测试。
+ *
+ * 第 i 页的内容只由 (seed, i) 决定，与线程数、生成顺序无关，因此可经线程池
+ * 并行生成，也可单独生成任意一页；同一配置在不同机器、不同次运行中得到
+ * 完全相同的语料。
+ *
+ * 配置串格式: "zero=10,uniform=5,random=40,text=30,compressed=15,dup=20,seed=1"
+ * 各类型为相对权重（未出现的为0），dup 为重复页百分比。
+ */
+
+#ifndef SM3_CORPUS_H
+#define SM3_CORPUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sm3_pool.h"
+
+#define SM3_CORPUS_PAGE_SIZE 4096
+
+enum {
+    SM3_CORPUS_ZERO = 0,
+    SM3_CORPUS_UNIFORM,
+    SM3_CORPUS_RANDOM,
+    SM3_CORPUS_TEXT,
+    SM3_CORPUS_COMPRESSED,
+    SM3_CORPUS_KINDS
+};
+
+typedef struct {
+    double weight[SM3_CORPUS_KINDS];    // 各类型相对权重
+    double dup_pct;                     // 重复页百分比 [0, 100)
+    uint64_t seed;
+} sm3_corpus_opts_t;
+
+typedef struct {
+    uint64_t pages;
+    uint64_t kind_pages[SM3_CORPUS_KINDS];  // 按类型计（重复页计入其源页类型）
+    uint64_t dup_pages;
+} sm3_corpus_stats_t;
+
+// 默认：全部为随机页，无重复，seed = 1
+void sm3_corpus_opts_default(sm3_corpus_opts_t* opts);
+// 解析配置串（在默认值基础上覆盖；出现任一类型权重时其余类型权重清零）。
+// 格式错误返回 -1/EINVAL
+int sm3_corpus_parse(sm3_corpus_opts_t* opts, const char* spec);
+// 把配置格式化为配置串
+void sm3_corpus_format(const sm3_corpus_opts_t* opts, char* buf, size_t len);
+const char* sm3_corpus_kind_name(int kind);
+
+// 第 index 页的类型与是否为重复页（不生成数据）
+int sm3_corpus_page_kind(const sm3_corpus_opts_t* opts, uint64_t index, int* is_dup);
+// 生成第 index 页
+void sm3_corpus_page(const sm3_corpus_opts_t* opts, uint64_t index, uint8_t* page);
+
+// 生成第 [first, first+count) 页到 pages（经线程池并行，pool 可为 NULL）；
+// stats 可为 NULL
+void sm3_corpus_fill(const sm3_corpus_opts_t* opts, sm3_pool_t* pool, uint64_t first,
+                     uint64_t count, uint8_t* pages, sm3_corpus_stats_t* stats);
+
+// 把 count 页语料写入 fd（从偏移0起），返回 0 成功，-1 出错
+int sm3_corpus_write(const sm3_corpus_opts_t* opts, sm3_pool_t* pool, int fd, uint64_t count,
+                     sm3_corpus_stats_t* stats);
+
+#endif // SM3_CORPUS_H
@@ -0,0 +1,612 @@
+/*
+ * 重复率分析
+ *
+ * 计数阶段每个切块记录 2^MAX_PB 个前缀桶的计数（切块计数表），确定分区位数后
+ * 原地合并为各分区的计数，再按切块顺序累加为各切块在各分区内的写入位置。
+ * 分区阶段各切块只写自己的区间，无需加锁；外存模式下每个分区一块写缓冲，
+ * 满后以 pwrite 写入溢出文件中该切块的区间。
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sm3_checkpoint.h"
+#include "sm3_dedup.h"
+#include "sm3_manifest.h"
+#include "sm3_pool.h"
+
+#define MAX_PB      12                  // 分区位数上限（外存模式每个分区一块写缓冲）
+#define MIN_PB      8
+#define CHUNK       (1u << 22)          // 每个切块的摘要数
+#define SPILL_BUF   (1u << 16)          // 外存模式写缓冲总量下限（每分区）
+
+typedef struct {
+    const uint8_t* digests;
+    uint64_t count;
+} chunk_t;
+
+typedef struct {
+    int ds;
+    int pb;
+    uint32_t parts;
+    chunk_t* chunks;
+    size_t nchunks;
+    uint64_t* table;                    // nchunks × 2^MAX_PB：计数，之后为写入位置（记录序号）
+    uint64_t* base;                     // parts+1：各分区起始记录序号
+    uint8_t* mem;                       // 内存模式：全部记录
+    int fd;                             // 外存模式：溢出文件
+    size_t buf_records;                 // 外存模式：每分区写缓冲的记录数
+    int top;
+    pthread_mutex_t lock;
+    sm3_dedup_result_t* res;
+    sm3_dedup_top_t* heap;              // 全局前N（最小堆）
+    int heap_n;
+    int error;
+} job_t;
+
+static inline uint64_t key_of(const uint8_t* d) {
+    uint64_t k;
+    memcpy(&k, d, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    k = __builtin_bswap64(k);           // 大端解释，使整数序与字节序一致
+#endif
+    return k;
+}
+
+static void set_error(job_t* job, int err) {
+    pthread_mutex_lock(&job->lock);
+    if (!job->error) job->error = err;
+    pthread_mutex_unlock(&job->lock);
+}
+
+// ============================================================================
+// 计数与分区
+// ============================================================================
+
+static void count_chunks(void* ctx, size_t begin, size_t end) {
+    job_t* job = ctx;
+    for (size_t c = begin; c < end; c++) {
+        uint64_t* h = job->table + (c << MAX_PB);
+        const uint8_t* d = job->chunks[c].digests;
+        for (uint64_t i = 0; i < job->chunks[c].count; i++, d += job->ds) {
+            h[key_of(d) >> (64 - MAX_PB)]++;
+        }
+    }
+}
+
+static int pwrite_all(int fd, const uint8_t* buf, size_t len, uint64_t off) {
+    while (len) {
+        ssize_t n = pwrite(fd, buf, len, (off_t)off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+        off += (uint64_t)n;
+    }
+    return 0;
+}
+
+static int pread_all(int fd, uint8_t* buf, size_t len, uint64_t off) {
+    while (len) {
+        ssize_t n = pread(fd, buf, len, (off_t)off);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            if (n == 0) errno = EIO;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+        off += (uint64_t)n;
+    }
+    return 0;
+}
+
+static void scatter_chunks(void* ctx, size_t begin, size_t end) {
+    job_t* job = ctx;
+    const int ds = job->ds;
+    const int shift = 64 - job->pb;
+    uint8_t* buf = NULL;
+    size_t* fill = NULL;
+    if (!job->mem) {
+        buf = malloc((size_t)job->parts * job->buf_records * (size_t)ds);
+        fill = calloc(job->parts, sizeof(size_t));
+        if (!buf || !fill) {
+            set_error(job, ENOMEM);
+            free(buf);
+            free(fill);
+            return;
+        }
+    }
+    for (size_t c = begin; c < end; c++) {
+        uint64_t* cur = job->table + (c << MAX_PB);
+        const uint8_t* d = job->chunks[c].digests;
+        uint64_t n = job->chunks[c].count;
+        if (job->mem) {
+            for (uint64_t i = 0; i < n; i++, d += ds) {
+                uint32_t p = (uint32_t)(key_of(d) >> shift);
+                memcpy(job->mem + cur[p]++ * (uint64_t)ds, d, (size_t)ds);
+            }
+            continue;
+        }
+        int failed = 0;
+        for (uint64_t i = 0; i < n && !failed; i++, d += ds) {
+            uint32_t p = (uint32_t)(key_of(d) >> shift);
+            uint8_t* pb = buf + (size_t)p * job->buf_records * (size_t)ds;
+            memcpy(pb + fill[p] * (size_t)ds, d, (size_t)ds);
+            if (++fill[p] == job->buf_records) {
+                failed = pwrite_all(job->fd, pb, fill[p] * (size_t)ds, cur[p] * (uint64_t)ds) != 0;
+                cur[p] += fill[p];
+                fill[p] = 0;
+            }
+        }
+        for (uint32_t p = 0; p < job->parts && !failed; p++) {
+            if (!fill[p]) continue;
+            uint8_t* pb = buf + (size_t)p * job->buf_records * (size_t)ds;
+            failed = pwrite_all(job->fd, pb, fill[p] * (size_t)ds, cur[p] * (uint64_t)ds) != 0;
+            cur[p] += fill[p];
+            fill[p] = 0;
+        }
+        if (failed) {
+            set_error(job, errno);
+            break;
+        }
+    }
+    free(buf);
+    free(fill);
+}
+
+// ============================================================================
+// 分区内排序与统计
+// ============================================================================
+
+// 按 keys 升序重排 keys/idx（tk/ti 为同样大小的临时空间）
+static void radix_sort(uint64_t* keys, uint32_t* idx, uint64_t* tk, uint32_t* ti, size_t n) {
+    static __thread size_t hist[8][256];
+    memset(hist, 0, sizeof(hist));
+    for (size_t i = 0; i < n; i++) {
+        uint64_t k = keys[i];
+        for (int b = 0; b < 8; b++) hist[b][(k >> (8 * b)) & 0xff]++;
+    }
+    uint64_t* src_k = keys;
+    uint32_t* src_i = idx;
+    uint64_t* dst_k = tk;
+    uint32_t* dst_i = ti;
+    for (int b = 0; b < 8; b++) {
+        int shift = 8 * b;
+        if (hist[b][(src_k[0] >> shift) & 0xff] == n) {
+            continue;                   // 该字节全部相同（如分区前缀所在字节）
+        }
+        size_t off[256], sum = 0;
+        for (int v = 0; v < 256; v++) {
+            off[v] = sum;
+            sum += hist[b][v];
+        }
+        for (size_t i = 0; i < n; i++) {
+            size_t pos = off[(src_k[i] >> shift) & 0xff]++;
+            dst_k[pos] = src_k[i];
+            dst_i[pos] = src_i[i];
+        }
+        uint64_t* tk2 = src_k; src_k = dst_k; dst_k = tk2;
+        uint32_t* ti2 = src_i; src_i = dst_i; dst_i = ti2;
+    }
+    if (src_k != keys) {
+        memcpy(keys, src_k, n * sizeof(*keys));
+        memcpy(idx, src_i, n * sizeof(*idx));
+    }
+}
+
+static __thread const uint8_t* t_recs;
+static __thread int t_ds;
+
+static int cmp_full(const void* a, const void* b) {
+    return memcmp(t_recs + (size_t)*(const uint32_t*)a * t_ds,
+                  t_recs + (size_t)*(const uint32_t*)b * t_ds, (size_t)t_ds);
+}
+
+// a 排在 b 之后（次数更少，或次数相同而摘要更大）
+static int top_worse(const sm3_dedup_top_t* a, const sm3_dedup_top_t* b) {
+    if (a->count != b->count) return a->count < b->count;
+    return memcmp(a->digest, b->digest, 32) > 0;
+}
+
+static void heap_down(sm3_dedup_top_t* h, int n, int i) {
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < n && top_worse(&h[l], &h[m])) m = l;
+        if (r < n && top_worse(&h[r], &h[m])) m = r;
+        if (m == i) return;
+        sm3_dedup_top_t t = h[i]; h[i] = h[m]; h[m] = t;
+        i = m;
+    }
+}
+
+static void heap_push(sm3_dedup_top_t* h, int* n, int cap, const sm3_dedup_top_t* e) {
+    if (*n < cap) {
+        int i = (*n)++;
+        h[i] = *e;
+        while (i > 0 && top_worse(&h[i], &h[(i - 1) / 2])) {
+            sm3_dedup_top_t t = h[i]; h[i] = h[(i - 1) / 2]; h[(i - 1) / 2] = t;
+            i = (i - 1) / 2;
+        }
+    } else if (cap > 0 && top_worse(&h[0], e)) {
+        h[0] = *e;
+        heap_down(h, *n, 0);
+    }
+}
+
+static int hist_bucket(uint64_t count) {
+    if (count <= 1) return 0;
+    int b = 64 - __builtin_clzll(count - 1);
+    return b < SM3_DEDUP_HIST_BUCKETS ? b : SM3_DEDUP_HIST_BUCKETS - 1;
+}
+
+typedef struct {
+    uint64_t unique;
+    uint64_t duplicated;
+    uint64_t hist_digests[SM3_DEDUP_HIST_BUCKETS];
+    uint64_t hist_pages[SM3_DEDUP_HIST_BUCKETS];
+    sm3_dedup_top_t* heap;
+    int heap_n;
+} part_stats_t;
+
+static void count_group(job_t* job, part_stats_t* s, const uint8_t* digest, uint64_t count) {
+    int b = hist_bucket(count);
+    s->unique++;
+    s->hist_digests[b]++;
+    s->hist_pages[b] += count;
+    if (count < 2) {
+        return;
+    }
+    s->duplicated++;
+    if (job->top > 0) {
+        sm3_dedup_top_t e;
+        memset(&e, 0, sizeof(e));
+        memcpy(e.digest, digest, (size_t)job->ds);
+        e.count = count;
+        heap_push(s->heap, &s->heap_n, job->top, &e);
+    }
+}
+
+static int analyze_part(job_t* job, uint32_t p, part_stats_t* s) {
+    const int ds = job->ds;
+    size_t n = (size_t)(job->base[p + 1] - job->base[p]);
+    if (n == 0) {
+        return 0;
+    }
+    uint8_t* loaded = NULL;
+    const uint8_t* recs;
+    if (job->mem) {
+        recs = job->mem + job->base[p] * (uint64_t)ds;
+    } else {
+        loaded = malloc(n * (size_t)ds);
+        if (!loaded || pread_all(job->fd, loaded, n * (size_t)ds, job->base[p] * (uint64_t)ds) != 0) {
+            int err = loaded ? errno : ENOMEM;
+            free(loaded);
+            errno = err;
+            return -1;
+        }
+        recs = loaded;
+    }
+    uint64_t* keys = malloc(2 * n * sizeof(uint64_t));
+    uint32_t* idx = malloc(2 * n * sizeof(uint32_t));
+    if (!keys || !idx) {
+        free(keys);
+        free(idx);
+        free(loaded);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = key_of(recs + i * (size_t)ds);
+        idx[i] = (uint32_t)i;
+    }
+    radix_sort(keys, idx, keys + n, idx + n, n);
+
+    t_recs = recs;
+    t_ds = ds;
+    for (size_t i = 0; i < n;) {
+        size_t j = i + 1;
+        while (j < n && keys[j] == keys[i]) j++;
+        if (j - i > 1) {
+            // 前缀相同：按完整摘要分组（绝大多数为真正的重复）
+            qsort(idx + i, j - i, sizeof(uint32_t), cmp_full);
+            size_t g = i;
+            for (size_t k = i + 1; k <= j; k++) {
+                if (k == j || cmp_full(&idx[g], &idx[k]) != 0) {
+                    count_group(job, s, recs + (size_t)idx[g] * ds, k - g);
+                    g = k;
+                }
+            }
+        } else {
+            count_group(job, s, recs + (size_t)idx[i] * ds, 1);
+        }
+        i = j;
+    }
+    free(keys);
+    free(idx);
+    free(loaded);
+    return 0;
+}
+
+static void analyze_parts(void* ctx, size_t begin, size_t end) {
+    job_t* job = ctx;
+    part_stats_t s;
+    memset(&s, 0, sizeof(s));
+    if (job->top > 0) {
+        s.heap = malloc((size_t)job->top * sizeof(sm3_dedup_top_t));
+        if (!s.heap) {
+            set_error(job, ENOMEM);
+            return;
+        }
+    }
+    for (size_t p = begin; p < end; p++) {
+        if (analyze_part(job, (uint32_t)p, &s) != 0) {
+            set_error(job, errno);
+            break;
+        }
+    }
+    pthread_mutex_lock(&job->lock);
+    sm3_dedup_result_t* r = job->res;
+    r->unique += s.unique;
+    r->duplicated += s.duplicated;
+    for (int b = 0; b < SM3_DEDUP_HIST_BUCKETS; b++) {
+        r->hist_digests[b] += s.hist_digests[b];
+        r->hist_pages[b] += s.hist_pages[b];
+    }
+    for (int i = 0; i < s.heap_n; i++) heap_push(job->heap, &job->heap_n, job->top, &s.heap[i]);
+    pthread_mutex_unlock(&job->lock);
+    free(s.heap);
+}
+
+static int cmp_top(const void* a, const void* b) {
+    const sm3_dedup_top_t* x = a;
+    const sm3_dedup_top_t* y = b;
+    return top_worse(x, y) ? 1 : top_worse(y, x) ? -1 : 0;
+}
+
+// ============================================================================
+// 分析
+// ============================================================================
+
+void sm3_dedup_opts_default(sm3_dedup_opts_t* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->top = 10;
+}
+
+// 分区位数为 pb 时最大分区的记录数
+static uint64_t max_part(const uint64_t* bins, int pb) {
+    uint64_t best = 0;
+    uint32_t width = 1u << (MAX_PB - pb);
+    for (uint32_t p = 0; p < (1u << pb); p++) {
+        uint64_t s = 0;
+        for (uint32_t k = 0; k < width; k++) s += bins[p * width + k];
+        if (s > best) best = s;
+    }
+    return best;
+}
+
+static int open_spill(const char* dir) {
+    if (!dir) dir = getenv("TMPDIR");
+    if (!dir || !*dir) dir = "/tmp";
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/sm3_dedup.XXXXXX", dir);
+    int fd = mkstemp(path);
+    if (fd >= 0) {
+        unlink(path);
+    }
+    return fd;
+}
+
+static int analyze(const chunk_t* srcs, int nsrc, int ds, const sm3_dedup_opts_t* opts,
+                   sm3_dedup_result_t* result) {
+    memset(result, 0, sizeof(*result));
+    if (ds != 16 && ds != 32) {
+        errno = EINVAL;
+        return -1;
+    }
+    result->digest_size = ds;
+    uint64_t t0 = sm3_now_ns();
+
+    sm3_dedup_opts_t def;
+    if (!opts) {
+        sm3_dedup_opts_default(&def);
+        opts = &def;
+    }
+    uint64_t mem_limit = opts->mem_limit;
+    if (mem_limit == 0) {
+        long pages = sysconf(_SC_PHYS_PAGES);
+        mem_limit = pages > 0 ? (uint64_t)pages * (uint64_t)sysconf(_SC_PAGESIZE) / 2 : (1ull << 30);
+    }
+
+    job_t job;
+    memset(&job, 0, sizeof(job));
+    job.ds = ds;
+    job.fd = -1;
+    job.top = opts->top > 0 ? opts->top : 0;
+    job.res = result;
+    pthread_mutex_init(&job.lock, NULL);
+
+    // 切块
+    uint64_t total = 0;
+    for (int i = 0; i < nsrc; i++) {
+        job.nchunks += (size_t)((srcs[i].count + CHUNK - 1) / CHUNK);
+        total += srcs[i].count;
+    }
+    result->pages = total;
+    job.chunks = calloc(job.nchunks ? job.nchunks : 1, sizeof(chunk_t));
+    job.table = calloc((job.nchunks ? job.nchunks : 1) << MAX_PB, sizeof(uint64_t));
+    job.heap = job.top ? malloc((size_t)job.top * sizeof(sm3_dedup_top_t)) : NULL;
+    sm3_pool_t* pool = sm3_pool_create(opts->num_threads);
+    int rc = -1;
+    if (!job.chunks || !job.table || (job.top && !job.heap) || !pool) {
+        errno = ENOMEM;
+        goto out;
+    }
+    size_t c = 0;
+    for (int i = 0; i < nsrc; i++) {
+        for (uint64_t off = 0; off < srcs[i].count; off += CHUNK) {
+            job.chunks[c].digests = srcs[i].digests + off * (uint64_t)ds;
+            job.chunks[c].count = srcs[i].count - off < CHUNK ? srcs[i].count - off : CHUNK;
+            c++;
+        }
+    }
+
+    // 计数，选择内存或外存模式与分区位数
+    sm3_pool_run(pool, count_chunks, &job, job.nchunks, 1);
+    uint64_t bins[1u << MAX_PB];
+    memset(bins, 0, sizeof(bins));
+    for (size_t k = 0; k < job.nchunks; k++) {
+        for (uint32_t b = 0; b < (1u << MAX_PB); b++) bins[b] += job.table[(k << MAX_PB) + b];
+    }
+    uint64_t threads = (uint64_t)sm3_pool_threads(pool);
+    const uint64_t per_rec = 2 * (sizeof(uint64_t) + sizeof(uint32_t));   // 排序用键与下标（含临时空间）
+    job.pb = MIN_PB;
+    if (total * (uint64_t)ds + threads * max_part(bins, MIN_PB) * per_rec > mem_limit) {
+        while (job.pb < MAX_PB &&
+               threads * max_part(bins, job.pb) * (per_rec + (uint64_t)ds) > mem_limit) {
+            job.pb++;
+        }
+        job.fd = open_spill(opts->tmp_dir);
+        if (job.fd < 0) {
+            goto out;
+        }
+    } else if (total) {
+        job.mem = malloc(total * (uint64_t)ds);
+        if (!job.mem) {
+            errno = ENOMEM;
+            goto out;
+        }
+    }
+    job.parts = 1u << job.pb;
+    result->partitions = job.parts;
+
+    // 切块计数表原地合并为分区计数，再累加为写入位置
+    int shift = MAX_PB - job.pb;
+    job.base = calloc((size_t)job.parts + 1, sizeof(uint64_t));
+    if (!job.base) {
+        errno = ENOMEM;
+        goto out;
+    }
+    for (size_t k = 0; k < job.nchunks; k++) {
+        uint64_t* h = job.table + (k << MAX_PB);
+        for (uint32_t p = 0; p < job.parts; p++) {
+            uint64_t s = 0;
+            for (uint32_t b = p << shift; b < (p + 1) << shift; b++) s += h[b];
+            h[p] = s;
+        }
+    }
+    for (uint32_t p = 0; p < job.parts; p++) {
+        uint64_t off = job.base[p];
+        for (size_t k = 0; k < job.nchunks; k++) {
+            uint64_t n = job.table[(k << MAX_PB) + p];
+            job.table[(k << MAX_PB) + p] = off;
+            off += n;
+        }
+        job.base[p + 1] = off;
+    }
+    if (job.fd >= 0) {
+        uint64_t per_part = mem_limit / (4 * threads * job.parts * (uint64_t)ds);
+        if (per_part * ds < SPILL_BUF / 16) per_part = SPILL_BUF / 16 / (uint64_t)ds;
+        if (per_part * ds > SPILL_BUF) per_part = SPILL_BUF / (uint64_t)ds;
+        job.buf_records = (size_t)per_part;
+        result->spill_bytes = total * (uint64_t)ds;
+    }
+    sm3_pool_run(pool, scatter_chunks, &job, job.nchunks, 1);
+    if (job.error) {
+        errno = job.error;
+        goto out;
+    }
+    uint64_t t1 = sm3_now_ns();
+    result->partition_ns = t1 - t0;
+
+    // 分区内排序与统计
+    sm3_pool_run(pool, analyze_parts, &job, job.parts, 1);
+    if (job.error) {
+        errno = job.error;
+        goto out;
+    }
+    qsort(job.heap, (size_t)job.heap_n, sizeof(sm3_dedup_top_t), cmp_top);
+    result->top = job.heap;
+    result->top_count = job.heap_n;
+    job.heap = NULL;
+    uint64_t t2 = sm3_now_ns();
+    result->sort_ns = t2 - t1;
+    result->elapsed_ns = t2 - t0;
+    rc = 0;
+
+out:
+    {
+        int err = errno;
+        sm3_pool_destroy(pool);
+        if (job.fd >= 0) close(job.fd);
+        free(job.mem);
+        free(job.base);
+        free(job.table);
+        free(job.chunks);
+        free(job.heap);
+        pthread_mutex_destroy(&job.lock);
+        errno = err;
+    }
+    return rc;
+}
+
+int sm3_dedup_analyze_digests(const uint8_t* digests, uint64_t count, int digest_size,
+                              const sm3_dedup_opts_t* opts, sm3_dedup_result_t* result) {
+    chunk_t src = { digests, count };
+    return analyze(&src, 1, digest_size, opts, result);
+}
+
+int sm3_dedup_analyze(const char* const* manifest_paths, int count,
+                      const sm3_dedup_opts_t* opts, sm3_dedup_result_t* result) {
+    if (count <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    sm3_manifest_t* m = calloc((size_t)count, sizeof(sm3_manifest_t));
+    chunk_t* srcs = calloc((size_t)count, sizeof(chunk_t));
+    if (!m || !srcs) {
+        free(m);
+        free(srcs);
+        errno = ENOMEM;
+        return -1;
+    }
+    int opened = 0, rc = -1, ds = 0;
+    for (; opened < count; opened++) {
+        if (sm3_manifest_open(&m[opened], manifest_paths[opened], 0) != 0) {
+            goto out;
+        }
+        int d = (int)m[opened].hdr->digest_size;
+        if (ds && d != ds) {
+            opened++;
+            errno = EINVAL;
+            goto out;
+        }
+        ds = d;
+        srcs[opened].digests = m[opened].digests;
+        srcs[opened].count = m[opened].hdr->page_count;
+    }
+    rc = analyze(srcs, count, ds, opts, result);
+
+out:
+    {
+        int err = errno;
+        for (int i = 0; i < opened; i++) sm3_manifest_close(&m[i]);
+        free(m);
+        free(srcs);
+        errno = err;
+    }
+    return rc;
+}
+
+void sm3_dedup_result_free(sm3_dedup_result_t* result) {
+    free(result->top);
+    result->top = NULL;
+    result->top_count = 0;
+}
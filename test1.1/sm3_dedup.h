@@ -0,0 +1,69 @@
+/*
+ * 重复率分析（离线，面向大规模清单）
+ *
+ * 对一个或多个页级清单（sm3_manifest.h）中的全部摘要统计重复情况，用于在卷上
+ * 启用去重之前评估收益。摘要本身近似均匀分布，按摘要前缀分区即可均衡：
+ *   1. 计数：并行统计每个切块各前缀分区的摘要数
+ *   2. 分区：按计数得到的确切位置把摘要并行散列到各分区。总量在内存上限内时
+ *      分区在内存中；否则写入一个临时溢出文件（各分区占确定的区间），
+ *      之后每次只载入一个分区
+ *   3. 分区内对64位摘要前缀做 LSD 基数排序（8位一趟，值全相同的字节跳过），
+ *      前缀相同的连续段再按完整摘要比较，统计每个不同摘要的出现次数
+ * 各分区由线程池并行处理。
+ *
+ * 重复次数分布按2的幂分桶：桶0为只出现1次的摘要，桶 b (b>=1) 为出现次数在
+ * (2^(b-1), 2^b] 内的摘要（桶1即恰好2次）。
+ */
+
+#ifndef SM3_DEDUP_H
+#define SM3_DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SM3_DEDUP_HIST_BUCKETS 40
+
+typedef struct {
+    int num_threads;            // <= 0 时取在线CPU数
+    uint64_t mem_limit;         // 字节，0 取物理内存的一半
+    const char* tmp_dir;        // 溢出文件目录，NULL 取 $TMPDIR 或 /tmp
+    int top;                    // 报告出现次数最多的前N个摘要
+} sm3_dedup_opts_t;
+
+typedef struct {
+    uint8_t digest[32];
+    uint64_t count;
+} sm3_dedup_top_t;
+
+typedef struct {
+    int digest_size;
+    uint64_t pages;
+    uint64_t unique;            // 不同摘要数
+    uint64_t duplicated;        // 出现不止一次的不同摘要数
+    uint64_t hist_digests[SM3_DEDUP_HIST_BUCKETS];
+    uint64_t hist_pages[SM3_DEDUP_HIST_BUCKETS];
+    sm3_dedup_top_t* top;       // 按出现次数降序（次数相同按摘要升序）
+    int top_count;
+    uint32_t partitions;
+    uint64_t spill_bytes;       // 0 表示全部在内存中完成
+    uint64_t partition_ns;      // 计数与分区
+    uint64_t sort_ns;           // 分区内排序与统计
+    uint64_t elapsed_ns;
+} sm3_dedup_result_t;
+
+void sm3_dedup_opts_default(sm3_dedup_opts_t* opts);
+
+// 分析多个清单（摘要长度须一致，否则 EINVAL）
+int sm3_dedup_analyze(const char* const* manifest_paths, int count,
+                      const sm3_dedup_opts_t* opts, sm3_dedup_result_t* result);
+// 分析内存中紧密排列的摘要
+int sm3_dedup_analyze_digests(const uint8_t* digests, uint64_t count, int digest_size,
+                              const sm3_dedup_opts_t* opts, sm3_dedup_result_t* result);
+void sm3_dedup_result_free(sm3_dedup_result_t* result);
+
+// 可去除的页占比：1 - 不同摘要数 / 总页数
+static inline double sm3_dedup_ratio(const sm3_dedup_result_t* r) {
+    return r->pages ? 1.0 - (double)r->unique / (double)r->pages : 0.0;
+}
+
+#endif // SM3_DEDUP_H
@@ -0,0 +1,426 @@
+/*
+ * sm3_io_bench - 存储引擎读写路径的端到端完整性开销测试
+ *
+ * 模拟一个分片存储引擎：每个工作线程负责 page % 线程数 == 线程号 的页，
+ * 每次提交 queue_depth 个操作（读写混合）作为一批：
+ *   - 读：引擎缓存命中（按 -H 概率）直接返回；未命中的页 pread 后，
+ *         整批各4KB子页一次调用 aes_sm3_integrity_verify_mb 校验
+ *   - 写：整批各4KB子页一次调用 aes_sm3_integrity_mb 打标签，标签写入
+ *         mmap 清单，数据 pwrite 写出
+ * 同一批操作同时完成，单个操作的延迟记为整批耗时。
+ * 相同的操作序列分别在完整性关闭/开启下各运行一次，报告 ops/s、
+ * 吞吐量与延迟分位数，以及开启完整性带来的开销。
+ *
+ * 用法:
+ *   sm3_io_bench [-s 工作集MB] [-p 页大小] [-r 读比例%] [-H 缓存命中率%] [-q 队列深度]
+ *                [-t 线程] [-n 操作数] [-D] [-d 目录] [-c 语料配置]
+ *   -D  O_DIRECT 绕过内核页缓存（工作集小于内存时模拟冷读）
+ *   -c  工作集与写入数据按语料配置生成（见 sm3_corpus.h），默认为随机数据
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+#include "sm3_corpus.h"
+#include "sm3_manifest.h"
+
+#define VERIFY_GROUP 64     // 单次批量接口调用的最大子页数
+
+typedef struct {
+    uint64_t ws_mb;
+    uint32_t page_size;
+    int read_pct;
+    int hit_pct;
+    int queue_depth;
+    int threads;
+    uint64_t ops;
+    int direct;
+    const char* dir;
+    const sm3_corpus_opts_t* corpus;    // NULL 表示随机数据
+} io_cfg_t;
+
+typedef struct {
+    const io_cfg_t* cfg;
+    int id;
+    int fd;
+    int integrity;
+    sm3_manifest_t* manifest;
+    uint64_t pages;             // 引擎页数
+
+    uint64_t* read_ns;
+    uint64_t* write_ns;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t misses;
+    uint64_t failures;
+    int error;
+} io_worker_t;
+
+typedef struct {
+    uint64_t elapsed_ns;
+    uint64_t* read_ns;
+    uint64_t* write_ns;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t misses;
+    uint64_t failures;
+} io_result_t;
+
+static uint64_t rng_next(uint64_t* x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+static int pio_full(int fd, uint8_t* buf, size_t len, off_t off, int is_read) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = is_read ? pread(fd, buf + done, len - done, off + (off_t)done)
+                            : pwrite(fd, buf + done, len - done, off + (off_t)done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+// 对 n 个子页批量打标签或校验，返回校验失败数
+static uint64_t integrity_batch(io_worker_t* w, uint8_t** data, uint64_t* sub, int n,
+                                int verify) {
+    const uint8_t* inputs[VERIFY_GROUP];
+    const uint8_t* expected[VERIFY_GROUP];
+    uint8_t* outputs[VERIFY_GROUP];
+    uint8_t ok[VERIFY_GROUP];
+    uint64_t bad = 0;
+    for (int i = 0; i < n; i += VERIFY_GROUP) {
+        int k = n - i < VERIFY_GROUP ? n - i : VERIFY_GROUP;
+        for (int j = 0; j < k; j++) {
+            inputs[j] = data[i + j];
+            outputs[j] = sm3_manifest_digest(w->manifest, sub[i + j]);
+            expected[j] = outputs[j];
+        }
+        if (verify) {
+            bad += (uint64_t)aes_sm3_integrity_verify_mb(inputs, expected, ok, k, 256);
+        } else {
+            aes_sm3_integrity_mb(inputs, outputs, k, 256);
+        }
+    }
+    return bad;
+}
+
+static void* io_worker(void* arg) {
+    io_worker_t* w = arg;
+    const io_cfg_t* cfg = w->cfg;
+    int qd = cfg->queue_depth;
+    uint32_t spp = cfg->page_size / SM3_PAGE_SIZE;     // 每个引擎页的4KB子页数
+    uint64_t owned = (w->pages - (uint64_t)w->id + (uint64_t)cfg->threads - 1) / (uint64_t)cfg->threads;
+    uint64_t ops = cfg->ops / (uint64_t)cfg->threads;
+
+    uint8_t* bufs = aligned_alloc(SM3_PAGE_SIZE, (size_t)qd * cfg->page_size);
+    uint8_t* cached = aligned_alloc(SM3_PAGE_SIZE, cfg->page_size);
+    uint8_t** sub_data = malloc((size_t)qd * spp * sizeof(uint8_t*));
+    uint64_t* sub_page = malloc((size_t)qd * spp * sizeof(uint64_t));
+    uint64_t* op_page = malloc((size_t)qd * sizeof(uint64_t));
+    uint8_t* op_read = malloc((size_t)qd);
+    uint8_t* op_miss = malloc((size_t)qd);
+    if (!bufs || !cached || !sub_data || !sub_page || !op_page || !op_read || !op_miss) {
+        w->error = ENOMEM;
+        goto out;
+    }
+    if (cfg->corpus) {
+        sm3_corpus_fill(cfg->corpus, NULL, (uint64_t)w->id * qd * spp, (uint64_t)qd * spp, bufs, NULL);
+    } else {
+        uint64_t fill = 0x9e3779b97f4a7c15ull ^ (uint64_t)w->id;
+        for (size_t i = 0; i < (size_t)qd * cfg->page_size / 8; i++) {
+            ((uint64_t*)bufs)[i] = rng_next(&fill);
+        }
+    }
+    memset(cached, 0x5a, cfg->page_size);
+
+    uint64_t rng = 0x2545f4914f6cdd1dull + (uint64_t)w->id * 7919;
+    for (uint64_t done = 0; done < ops && !w->error; done += (uint64_t)qd) {
+        int n = ops - done < (uint64_t)qd ? (int)(ops - done) : qd;
+        for (int i = 0; i < n; i++) {
+            op_read[i] = (int)(rng_next(&rng) % 100) < cfg->read_pct;
+            op_miss[i] = !op_read[i] || (int)(rng_next(&rng) % 100) >= cfg->hit_pct;
+            op_page[i] = (rng_next(&rng) % owned) * (uint64_t)cfg->threads + (uint64_t)w->id;
+        }
+
+        uint64_t t0 = sm3_now_ns();
+        int nsub_r = 0, nsub_w = 0;
+        // 写：先整批打标签，再写出
+        for (int i = 0; i < n; i++) {
+            if (op_read[i]) continue;
+            uint8_t* b = bufs + (size_t)i * cfg->page_size;
+            memcpy(b, &op_page[i], 8);
+            memcpy(b + 8, &done, 8);
+            for (uint32_t s = 0; s < spp; s++) {
+                sub_data[nsub_w] = b + (size_t)s * SM3_PAGE_SIZE;
+                sub_page[nsub_w++] = op_page[i] * spp + s;
+            }
+        }
+        if (w->integrity && nsub_w) {
+            integrity_batch(w, sub_data, sub_page, nsub_w, 0);
+        }
+        // 批内先完成写再读，读到同批写入的页时数据与标签一致
+        for (int i = 0; i < n && !w->error; i++) {
+            if (!op_read[i] && pio_full(w->fd, bufs + (size_t)i * cfg->page_size, cfg->page_size,
+                                        (off_t)(op_page[i] * cfg->page_size), 0) != 0) {
+                w->error = errno;
+            }
+        }
+        for (int i = 0; i < n && !w->error; i++) {
+            uint8_t* b = bufs + (size_t)i * cfg->page_size;
+            off_t off = (off_t)(op_page[i] * cfg->page_size);
+            if (!op_read[i]) {
+                continue;
+            } else if (op_miss[i]) {
+                if (pio_full(w->fd, b, cfg->page_size, off, 1) != 0) w->error = errno;
+                w->misses++;
+            } else {
+                memcpy(b, cached, cfg->page_size);      // 引擎缓存命中：已校验，直接返回
+            }
+        }
+        // 读：未命中的页整批校验
+        if (w->integrity) {
+            for (int i = 0; i < n; i++) {
+                if (!op_read[i] || !op_miss[i]) continue;
+                for (uint32_t s = 0; s < spp; s++) {
+                    sub_data[nsub_r] = bufs + (size_t)i * cfg->page_size + (size_t)s * SM3_PAGE_SIZE;
+                    sub_page[nsub_r++] = op_page[i] * spp + s;
+                }
+            }
+            if (nsub_r) {
+                w->failures += integrity_batch(w, sub_data, sub_page, nsub_r, 1);
+            }
+        }
+        uint64_t dt = sm3_now_ns() - t0;
+        for (int i = 0; i < n; i++) {
+            if (op_read[i]) w->read_ns[w->reads++] = dt; else w->write_ns[w->writes++] = dt;
+        }
+    }
+
+out:
+    free(bufs);
+    free(cached);
+    free(sub_data);
+    free(sub_page);
+    free(op_page);
+    free(op_read);
+    free(op_miss);
+    return NULL;
+}
+
+static int run_mode(const io_cfg_t* cfg, const char* data_path, sm3_manifest_t* m,
+                    int integrity, io_result_t* r) {
+    int fd = open(data_path, O_RDWR | O_CLOEXEC | (cfg->direct ? O_DIRECT : 0));
+    if (fd < 0) {
+        return -1;
+    }
+    uint64_t per = cfg->ops / (uint64_t)cfg->threads + (uint64_t)cfg->queue_depth;
+    io_worker_t* w = calloc((size_t)cfg->threads, sizeof(io_worker_t));
+    pthread_t* tids = calloc((size_t)cfg->threads, sizeof(pthread_t));
+    memset(r, 0, sizeof(*r));
+    r->read_ns = malloc(cfg->ops * sizeof(uint64_t) + 8);
+    r->write_ns = malloc(cfg->ops * sizeof(uint64_t) + 8);
+    int rc = w && tids && r->read_ns && r->write_ns ? 0 : -1;
+    for (int i = 0; rc == 0 && i < cfg->threads; i++) {
+        w[i] = (io_worker_t){ cfg, i, fd, integrity, m, cfg->ws_mb * 1024 * 1024 / cfg->page_size,
+                              malloc(per * 8), malloc(per * 8), 0, 0, 0, 0, 0 };
+        if (!w[i].read_ns || !w[i].write_ns) rc = -1;
+    }
+
+    uint64_t t0 = sm3_now_ns();
+    int started = 0;
+    for (; rc == 0 && started < cfg->threads; started++) {
+        if (pthread_create(&tids[started], NULL, io_worker, &w[started]) != 0) rc = -1;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    r->elapsed_ns = sm3_now_ns() - t0;
+
+    for (int i = 0; w && i < cfg->threads; i++) {
+        if (rc == 0) {
+            if (w[i].error) {
+                errno = w[i].error;
+                rc = -1;
+            }
+            memcpy(r->read_ns + r->reads, w[i].read_ns, w[i].reads * 8);
+            memcpy(r->write_ns + r->writes, w[i].write_ns, w[i].writes * 8);
+            r->reads += w[i].reads;
+            r->writes += w[i].writes;
+            r->misses += w[i].misses;
+            r->failures += w[i].failures;
+        }
+        free(w[i].read_ns);
+        free(w[i].write_ns);
+    }
+    free(w);
+    free(tids);
+    close(fd);
+    return rc;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double pct_us(const uint64_t* ns, uint64_t n, double p) {
+    return n ? ns[(uint64_t)(p * (double)(n - 1))] / 1000.0 : 0.0;
+}
+
+static void print_row(const char* name, const io_cfg_t* cfg, io_result_t* r) {
+    qsort(r->read_ns, r->reads, 8, cmp_u64);
+    qsort(r->write_ns, r->writes, 8, cmp_u64);
+    double secs = r->elapsed_ns / 1e9;
+    double ops = (double)(r->reads + r->writes);
+    printf("%-10s %10.0f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, ops / secs,
+           ops * cfg->page_size / (1024.0 * 1024.0) / secs,
+           pct_us(r->read_ns, r->reads, 0.5), pct_us(r->read_ns, r->reads, 0.99),
+           pct_us(r->read_ns, r->reads, 0.999), pct_us(r->write_ns, r->writes, 0.5),
+           pct_us(r->write_ns, r->writes, 0.99), pct_us(r->write_ns, r->writes, 0.999));
+}
+
+int main(int argc, char** argv) {
+    io_cfg_t cfg = { 256, 4096, 70, 0, 8, 1, 200000, 0, "/tmp", NULL };
+    sm3_corpus_opts_t corpus;
+    sm3_corpus_opts_default(&corpus);
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:r:H:q:t:n:Dd:c:")) != -1) {
+        switch (opt) {
+        case 's': cfg.ws_mb = strtoull(optarg, NULL, 10); break;
+        case 'p': cfg.page_size = (uint32_t)atoi(optarg); break;
+        case 'r': cfg.read_pct = atoi(optarg); break;
+        case 'H': cfg.hit_pct = atoi(optarg); break;
+        case 'q': cfg.queue_depth = atoi(optarg); break;
+        case 't': cfg.threads = atoi(optarg); break;
+        case 'n': cfg.ops = strtoull(optarg, NULL, 10); break;
+        case 'D': cfg.direct = 1; break;
+        case 'd': cfg.dir = optarg; break;
+        case 'c':
+            if (sm3_corpus_parse(&corpus, optarg) != 0) {
+                fprintf(stderr, "语料配置无效: %s\n", optarg);
+                return 2;
+            }
+            cfg.corpus = &corpus;
+            break;
+        default:
+            fprintf(stderr, "用法: %s [-s 工作集MB] [-p 页大小] [-r 读%%] [-H 命中率%%] "
+                            "[-q 队列深度] [-t 线程] [-n 操作数] [-D] [-d 目录] "
+                            "[-c 语料配置]\n", argv[0]);
+            return 2;
+        }
+    }
+    uint64_t pages = cfg.ws_mb * 1024 * 1024 / (cfg.page_size ? cfg.page_size : 1);
+    if (cfg.page_size == 0 || cfg.page_size % SM3_PAGE_SIZE != 0 || cfg.queue_depth <= 0 ||
+        cfg.threads <= 0 || pages < (uint64_t)cfg.threads || cfg.ops < (uint64_t)cfg.threads) {
+        fprintf(stderr, "参数无效（页大小须为4096的倍数）\n");
+        return 2;
+    }
+
+    char data_path[512], manifest_path[520];
+    snprintf(data_path, sizeof(data_path), "%s/sm3_io_bench.%d", cfg.dir, getpid());
+    snprintf(manifest_path, sizeof(manifest_path), "%s.manifest", data_path);
+
+    // 准备工作集
+    int fd = open(data_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    enum { FILL = 1 << 20 };
+    uint8_t* fill = malloc(FILL);
+    if (fd < 0 || !fill) {
+        fprintf(stderr, "创建测试文件失败: %s\n", strerror(errno));
+        return 1;
+    }
+    uint64_t seed = 88172645463325252ull;
+    for (uint64_t mb = 0; mb < cfg.ws_mb; mb++) {
+        if (cfg.corpus) {
+            sm3_corpus_fill(cfg.corpus, NULL, mb * (FILL / SM3_PAGE_SIZE), FILL / SM3_PAGE_SIZE,
+                            fill, NULL);
+        } else {
+            for (size_t i = 0; i < FILL / 8; i++) ((uint64_t*)fill)[i] = rng_next(&seed);
+        }
+        if (pwrite(fd, fill, FILL, (off_t)(mb * FILL)) != FILL) {
+            fprintf(stderr, "写入测试数据失败\n");
+            return 1;
+        }
+    }
+    fsync(fd);
+    close(fd);
+    free(fill);
+
+    sm3_scan_opts_t sopts;
+    sm3_scan_opts_default(&sopts);
+    sopts.num_threads = cfg.threads;
+    sm3_scan_stats_t sstats;
+    sm3_manifest_t m;
+
+    long ram_pages = sysconf(_SC_PHYS_PAGES);
+    double ram_mb = ram_pages > 0 ? (double)ram_pages * sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0) : 0;
+    printf("配置: 工作集 %llu MB (内存的 %.1f%%), 页大小 %u, 读 %d%%, 缓存命中 %d%%, "
+           "队列深度 %d, 线程 %d, %llu次操作%s\n",
+           (unsigned long long)cfg.ws_mb, ram_mb > 0 ? cfg.ws_mb * 100.0 / ram_mb : 0.0,
+           cfg.page_size, cfg.read_pct, cfg.hit_pct, cfg.queue_depth, cfg.threads,
+           (unsigned long long)cfg.ops, cfg.direct ? ", O_DIRECT" : "");
+    if (cfg.corpus) {
+        char spec[256];
+        sm3_corpus_format(cfg.corpus, spec, sizeof(spec));
+        printf("语料: %s\n", spec);
+    }
+
+    io_result_t off = { 0 }, on = { 0 };
+    int rc = 0;
+    if (run_mode(&cfg, data_path, NULL, 0, &off) != 0) {
+        fprintf(stderr, "完整性关闭模式运行失败: %s\n", strerror(errno));
+        rc = 1;
+    }
+    // 关闭模式的写入改变了数据，重新生成标签后再运行开启模式（不计时）
+    if (rc == 0 && (sm3_manifest_build(data_path, manifest_path, &sopts, &sstats) != 0 ||
+                    sm3_manifest_open(&m, manifest_path, 1) != 0)) {
+        fprintf(stderr, "生成标签失败: %s\n", strerror(errno));
+        rc = 1;
+    }
+    if (rc == 0) {
+        if (run_mode(&cfg, data_path, &m, 1, &on) != 0) {
+            fprintf(stderr, "完整性开启模式运行失败: %s\n", strerror(errno));
+            rc = 1;
+        }
+        sm3_manifest_close(&m);
+    }
+
+    if (rc == 0) {
+        printf("\n%-10s %10s %9s %9s %9s %9s %9s %9s %9s\n", "", "ops/s", "MB/s",
+               "读P50us", "读P99us", "读P999us", "写P50us", "写P99us", "写P999us");
+        print_row("完整性关闭", &cfg, &off);
+        print_row("完整性开启", &cfg, &on);
+        double ops_off = (off.reads + off.writes) / (off.elapsed_ns / 1e9);
+        double ops_on = (on.reads + on.writes) / (on.elapsed_ns / 1e9);
+        printf("\n开销: ops/s %+.1f%%, 读P99 %+.1f us, 写P99 %+.1f us; "
+               "未命中读 %llu次, 校验失败 %llu页\n",
+               (ops_on / ops_off - 1) * 100,
+               pct_us(on.read_ns, on.reads, 0.99) - pct_us(off.read_ns, off.reads, 0.99),
+               pct_us(on.write_ns, on.writes, 0.99) - pct_us(off.write_ns, off.writes, 0.99),
+               (unsigned long long)on.misses, (unsigned long long)on.failures);
+        if (on.failures) {
+            rc = 1;
+        }
+    }
+    free(off.read_ns);
+    free(off.write_ns);
+    free(on.read_ns);
+    free(on.write_ns);
+    unlink(data_path);
+    unlink(manifest_path);
+    return rc;
+}
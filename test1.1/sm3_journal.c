@@ -0,0 +1,574 @@
+/*
+ * 摘要日志（group commit）
+ *
+ * 追加线程在锁内分配代号并把记录复制进当前批缓冲区；提交线程交换
+ * 双缓冲后在锁外写出并同步，期间追加线程继续写入另一缓冲区。
+ * 同一时刻只有一个批次在提交，代号按提交顺序单调持久。
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+#include "sm3_journal.h"
+
+#define JOURNAL_VERSION 1
+#define BATCH_MAGIC     0x314a4253u     // "SBJ1"
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t digest_size;
+    uint64_t base_gen;          // 代号 <= base_gen 的记录已同步到清单
+    uint8_t  reserved[40];
+} journal_header_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t first_gen;
+    uint8_t  check[16];         // sm3_hash(批次头前16字节 || 记录) 的前16字节
+} batch_header_t;
+
+// 记录：页号(8) + 代号(8) + 摘要(digest_size)
+#define REC_HEAD 16
+
+struct sm3_journal {
+    int fd;
+    char* path;
+    sm3_manifest_t* manifest;
+    sm3_journal_opts_t opts;
+    int digest_size;
+    size_t rec_size;
+    uint64_t base_gen;
+    uint64_t file_size;
+
+    pthread_t committer;
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // 有待提交记录 / 请求立即提交 / 关闭
+    pthread_cond_t done;        // 一批提交完成
+    uint8_t* buf[2];            // 批次头 + 记录
+    int active;
+    uint32_t count;             // 当前缓冲区记录数
+    uint64_t first_ns;          // 当前缓冲区首条记录的追加时间
+    uint64_t last_gen;          // 已分配的最大代号
+    uint64_t durable_gen;       // 已提交的最大代号
+    int committing;
+    int flush_req;
+    int shutdown;
+    int error;                  // 提交失败时的 errno，之后所有等待返回失败
+
+    sm3_journal_stats_t stats;
+};
+
+void sm3_journal_opts_default(sm3_journal_opts_t* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->commit_interval_us = 2000;
+    opts->max_batch = 4096;
+}
+
+static void batch_check(const uint8_t* batch, size_t rec_bytes, uint8_t* out) {
+    uint8_t digest[32];
+    sm3_ctx_t ctx;
+    sm3_init(&ctx);
+    sm3_update(&ctx, batch, 16);
+    sm3_update(&ctx, batch + sizeof(batch_header_t), rec_bytes);
+    sm3_final(&ctx, digest);
+    memcpy(out, digest, 16);
+}
+
+// 以临时文件 + rename 原子写入只有头部的空日志
+static int write_empty(const char* path, int digest_size, uint64_t base_gen) {
+    journal_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SM3_JOURNAL_MAGIC, 8);
+    hdr.version = JOURNAL_VERSION;
+    hdr.digest_size = (uint32_t)digest_size;
+    hdr.base_gen = base_gen;
+
+    size_t plen = strlen(path);
+    char* tmp = malloc(plen + 5);
+    if (!tmp) {
+        return -1;
+    }
+    memcpy(tmp, path, plen);
+    memcpy(tmp + plen, ".tmp", 5);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int rc = -1;
+    if (fd >= 0) {
+        if (write(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr) && fdatasync(fd) == 0 &&
+            rename(tmp, path) == 0) {
+            rc = 0;
+        }
+        int err = errno;
+        close(fd);
+        if (rc != 0) {
+            unlink(tmp);
+            errno = err;
+        }
+    }
+    free(tmp);
+    return rc;
+}
+
+// ============================================================================
+// 提交线程
+// ============================================================================
+
+static void deadline_after(struct timespec* ts, uint64_t start_ns, uint32_t us) {
+    uint64_t ns = start_ns + (uint64_t)us * 1000;
+    ts->tv_sec = (time_t)(ns / 1000000000ull);
+    ts->tv_nsec = (long)(ns % 1000000000ull);
+}
+
+static int commit_batch(sm3_journal_t* j, uint8_t* batch, uint32_t n, uint64_t first_gen) {
+    batch_header_t* bh = (batch_header_t*)batch;
+    bh->magic = BATCH_MAGIC;
+    bh->count = n;
+    bh->first_gen = first_gen;
+    size_t rec_bytes = (size_t)n * j->rec_size;
+    batch_check(batch, rec_bytes, bh->check);
+
+    size_t len = sizeof(batch_header_t) + rec_bytes;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t w = pwrite(j->fd, batch + done, len - done, (off_t)(j->file_size + done));
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += (size_t)w;
+    }
+    return fdatasync(j->fd);
+}
+
+static void* committer_main(void* arg) {
+    sm3_journal_t* j = arg;
+    pthread_mutex_lock(&j->lock);
+    for (;;) {
+        while (!j->shutdown && !j->error && j->count == 0) {
+            pthread_cond_wait(&j->work, &j->lock);
+        }
+        if (j->error || (j->shutdown && j->count == 0)) {
+            break;
+        }
+        // 攒批：等到提交间隔到期、批满、有人请求立即提交或关闭
+        if (j->opts.commit_interval_us) {
+            struct timespec ts;
+            deadline_after(&ts, j->first_ns, j->opts.commit_interval_us);
+            while (!j->shutdown && !j->flush_req && j->count < j->opts.max_batch) {
+                if (pthread_cond_timedwait(&j->work, &j->lock, &ts) == ETIMEDOUT) {
+                    break;
+                }
+            }
+        }
+
+        uint8_t* batch = j->buf[j->active];
+        uint32_t n = j->count;
+        uint64_t first_gen = j->last_gen - n + 1;
+        j->active ^= 1;
+        j->count = 0;
+        j->flush_req = 0;
+        j->committing = 1;
+        pthread_cond_broadcast(&j->done);   // 唤醒因缓冲区满而等待的追加线程
+        pthread_mutex_unlock(&j->lock);
+
+        uint64_t t0 = sm3_now_ns();
+        int rc = commit_batch(j, batch, n, first_gen);
+        int err = errno;
+        uint64_t dt = sm3_now_ns() - t0;
+
+        pthread_mutex_lock(&j->lock);
+        j->committing = 0;
+        if (rc != 0) {
+            j->error = err ? err : EIO;
+        } else {
+            j->durable_gen = first_gen + n - 1;
+            j->file_size += sizeof(batch_header_t) + (size_t)n * j->rec_size;
+            j->stats.commits++;
+            j->stats.commit_ns += dt;
+            if (n > j->stats.max_batch) j->stats.max_batch = n;
+        }
+        pthread_cond_broadcast(&j->done);
+    }
+    pthread_cond_broadcast(&j->done);
+    pthread_mutex_unlock(&j->lock);
+    return NULL;
+}
+
+// ============================================================================
+// 重放
+// ============================================================================
+
+typedef struct {
+    const uint8_t* data;
+    const uint64_t* batch_off;
+    uint8_t* batch_ok;
+    size_t rec_size;
+} check_job_t;
+
+static void check_chunk(void* ctx, size_t begin, size_t end) {
+    check_job_t* job = ctx;
+    for (size_t i = begin; i < end; i++) {
+        const uint8_t* b = job->data + job->batch_off[i];
+        const batch_header_t* bh = (const batch_header_t*)b;
+        uint8_t check[16];
+        batch_check(b, (size_t)bh->count * job->rec_size, check);
+        job->batch_ok[i] = memcmp(check, bh->check, 16) == 0;
+    }
+}
+
+// 按页号分区并行应用：记录先按分区分桶（桶内保持日志顺序），同一页的记录
+// 落在同一分区，按日志顺序应用，后写者胜出
+typedef struct {
+    const uint8_t* const* recs;
+    const size_t* part_start;   // 第 p 个分区的记录为 recs[part_start[p] .. part_start[p+1])
+    sm3_manifest_t* manifest;
+    int digest_size;
+} apply_job_t;
+
+static void apply_chunk(void* ctx, size_t begin, size_t end) {
+    apply_job_t* job = ctx;
+    for (size_t i = job->part_start[begin]; i < job->part_start[end]; i++) {
+        uint64_t page;
+        memcpy(&page, job->recs[i], 8);
+        memcpy(sm3_manifest_digest(job->manifest, page), job->recs[i] + REC_HEAD,
+               (size_t)job->digest_size);
+    }
+}
+
+static int replay(sm3_journal_t* j) {
+    uint64_t t0 = sm3_now_ns();
+    struct stat st;
+    if (fstat(j->fd, &st) != 0) {
+        return -1;
+    }
+    uint64_t size = (uint64_t)st.st_size;
+    uint8_t* data = malloc(size ? size : 1);
+    if (!data) {
+        return -1;
+    }
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = pread(j->fd, data + got, size - got, (off_t)got);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            free(data);
+            errno = n < 0 ? errno : EIO;
+            return -1;
+        }
+        got += (size_t)n;
+    }
+
+    journal_header_t hdr;
+    memcpy(&hdr, data, size < sizeof(hdr) ? size : sizeof(hdr));
+    if (size < sizeof(hdr) || memcmp(hdr.magic, SM3_JOURNAL_MAGIC, 8) != 0 ||
+        hdr.version != JOURNAL_VERSION || (int)hdr.digest_size != j->digest_size) {
+        free(data);
+        errno = EINVAL;
+        return -1;
+    }
+    j->base_gen = hdr.base_gen;
+
+    // 顺序遍历批次头确定各批位置，再并行校验批次摘要
+    size_t nb = 0, cap = 0;
+    uint64_t* batch_off = NULL;
+    uint64_t off = sizeof(hdr), expect_gen = 0;
+    while (off + sizeof(batch_header_t) <= size) {
+        const batch_header_t* bh = (const batch_header_t*)(data + off);
+        uint64_t len = sizeof(batch_header_t) + (uint64_t)bh->count * j->rec_size;
+        if (bh->magic != BATCH_MAGIC || bh->count == 0 || off + len > size ||
+            (expect_gen && bh->first_gen != expect_gen)) {
+            break;
+        }
+        if (nb == cap) {
+            cap = cap ? cap * 2 : 64;
+            uint64_t* grown = realloc(batch_off, cap * sizeof(uint64_t));
+            if (!grown) {
+                free(batch_off);
+                free(data);
+                return -1;
+            }
+            batch_off = grown;
+        }
+        batch_off[nb++] = off;
+        expect_gen = bh->first_gen + bh->count;
+        off += len;
+    }
+
+    uint8_t* batch_ok = malloc(nb ? nb : 1);
+    if (!batch_ok) {
+        free(batch_off);
+        free(data);
+        return -1;
+    }
+    check_job_t cj = { data, batch_off, batch_ok, j->rec_size };
+    sm3_pool_run(j->opts.pool, check_chunk, &cj, nb, 16);
+
+    // 第一个摘要不符的批次之后全部丢弃
+    size_t valid = 0, nrec = 0;
+    uint64_t end = sizeof(hdr), max_page = 0, last_gen = j->base_gen;
+    while (valid < nb && batch_ok[valid]) {
+        const batch_header_t* bh = (const batch_header_t*)(data + batch_off[valid]);
+        for (uint32_t r = 0; r < bh->count; r++) {
+            uint64_t page;
+            memcpy(&page, data + batch_off[valid] + sizeof(*bh) + (size_t)r * j->rec_size, 8);
+            if (page + 1 > max_page) max_page = page + 1;
+        }
+        nrec += bh->count;
+        end = batch_off[valid] + sizeof(*bh) + (uint64_t)bh->count * j->rec_size;
+        if (bh->first_gen + bh->count - 1 > last_gen) last_gen = bh->first_gen + bh->count - 1;
+        valid++;
+    }
+
+    size_t parts = (size_t)sm3_pool_threads(j->opts.pool) * 4;
+    const uint8_t** recs = malloc((nrec ? nrec : 1) * sizeof(uint8_t*));
+    size_t* part_start = calloc(parts + 1, sizeof(size_t));
+    int rc = recs && part_start ? 0 : -1;
+    if (rc == 0 && max_page > j->manifest->hdr->page_count &&
+        sm3_manifest_resize(j->manifest, max_page * SM3_PAGE_SIZE) != 0) {
+        rc = -1;
+    }
+    if (rc == 0 && nrec) {
+        // 计数排序：先统计各分区的记录数，再按日志顺序放入各自的桶；
+        // 基线之前的记录已在清单中，不再应用
+        for (int pass = 0; pass < 2; pass++) {
+            for (size_t b = 0; b < valid; b++) {
+                const batch_header_t* bh = (const batch_header_t*)(data + batch_off[b]);
+                for (uint32_t r = 0; r < bh->count; r++) {
+                    const uint8_t* rec = data + batch_off[b] + sizeof(*bh) + (size_t)r * j->rec_size;
+                    uint64_t page, gen;
+                    memcpy(&page, rec, 8);
+                    memcpy(&gen, rec + 8, 8);
+                    if (gen <= j->base_gen) {
+                        continue;
+                    }
+                    if (pass == 0) {
+                        part_start[page % parts + 1]++;
+                    } else {
+                        recs[part_start[page % parts]++] = rec;
+                        if (j->opts.on_replay) j->opts.on_replay(page, j->opts.replay_ctx);
+                    }
+                }
+            }
+            if (pass == 0) {
+                // 前缀和：part_start[p] 为第 p 个桶的起点（第二遍填充时作写入位置）
+                for (size_t p = 1; p <= parts; p++) part_start[p] += part_start[p - 1];
+            } else {
+                // 填充后 part_start[p] 移到了桶尾，右移一位恢复为起点
+                memmove(part_start + 1, part_start, parts * sizeof(size_t));
+                part_start[0] = 0;
+            }
+        }
+        apply_job_t aj = { recs, part_start, j->manifest, j->digest_size };
+        sm3_pool_run(j->opts.pool, apply_chunk, &aj, parts, 1);
+    }
+    // 截断写了一半的尾部批次，之后的追加紧接在有效内容之后
+    if (rc == 0 && end < size) {
+        if (ftruncate(j->fd, (off_t)end) != 0 || fdatasync(j->fd) != 0) {
+            rc = -1;
+        }
+        j->stats.truncated_bytes = size - end;
+    }
+    if (rc == 0) {
+        j->file_size = end;
+        j->last_gen = j->durable_gen = last_gen;
+        j->stats.replayed = nrec;
+        j->stats.replay_ns = sm3_now_ns() - t0;
+    }
+    free(part_start);
+    free(recs);
+    free(batch_ok);
+    free(batch_off);
+    free(data);
+    return rc;
+}
+
+// ============================================================================
+// 打开/关闭
+// ============================================================================
+
+int sm3_journal_open(sm3_journal_t** out, const char* path, sm3_manifest_t* manifest,
+                     const sm3_journal_opts_t* opts) {
+    *out = NULL;
+    if (!manifest->writable) {
+        errno = EINVAL;
+        return -1;
+    }
+    sm3_journal_t* j = calloc(1, sizeof(*j));
+    if (!j) {
+        return -1;
+    }
+    j->fd = -1;
+    j->manifest = manifest;
+    j->opts = *opts;
+    if (j->opts.max_batch == 0) j->opts.max_batch = 1;
+    j->digest_size = (int)manifest->hdr->digest_size;
+    j->rec_size = REC_HEAD + (size_t)j->digest_size;
+    j->path = strdup(path);
+    size_t buf_size = sizeof(batch_header_t) + (size_t)j->opts.max_batch * j->rec_size;
+    j->buf[0] = malloc(buf_size);
+    j->buf[1] = malloc(buf_size);
+    if (!j->path || !j->buf[0] || !j->buf[1]) {
+        goto fail;
+    }
+    if (access(path, F_OK) != 0 && write_empty(path, j->digest_size, 0) != 0) {
+        goto fail;
+    }
+    j->fd = open(path, O_RDWR | O_CLOEXEC);
+    if (j->fd < 0 || replay(j) != 0) {
+        goto fail;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&j->work, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&j->done, NULL);
+    pthread_mutex_init(&j->lock, NULL);
+    if (pthread_create(&j->committer, NULL, committer_main, j) != 0) {
+        pthread_cond_destroy(&j->work);
+        pthread_cond_destroy(&j->done);
+        pthread_mutex_destroy(&j->lock);
+        errno = EAGAIN;
+        goto fail;
+    }
+    *out = j;
+    return 0;
+
+fail:
+    {
+        int err = errno ? errno : ENOMEM;
+        if (j->fd >= 0) close(j->fd);
+        free(j->buf[0]);
+        free(j->buf[1]);
+        free(j->path);
+        free(j);
+        errno = err;
+    }
+    return -1;
+}
+
+int sm3_journal_close(sm3_journal_t* j) {
+    int rc = sm3_journal_sync(j);
+    pthread_mutex_lock(&j->lock);
+    j->shutdown = 1;
+    pthread_cond_signal(&j->work);
+    pthread_mutex_unlock(&j->lock);
+    pthread_join(j->committer, NULL);
+
+    if (close(j->fd) != 0) rc = -1;
+    pthread_cond_destroy(&j->work);
+    pthread_cond_destroy(&j->done);
+    pthread_mutex_destroy(&j->lock);
+    free(j->buf[0]);
+    free(j->buf[1]);
+    free(j->path);
+    free(j);
+    return rc;
+}
+
+// ============================================================================
+// 追加与提交
+// ============================================================================
+
+uint64_t sm3_journal_append(sm3_journal_t* j, uint64_t page, const uint8_t* digest) {
+    pthread_mutex_lock(&j->lock);
+    // 当前缓冲区已满：等提交线程换出
+    while (!j->error && j->count == j->opts.max_batch) {
+        pthread_cond_signal(&j->work);
+        pthread_cond_wait(&j->done, &j->lock);
+    }
+    if (j->error) {
+        errno = j->error;
+        pthread_mutex_unlock(&j->lock);
+        return 0;
+    }
+    uint64_t gen = ++j->last_gen;
+    uint8_t* rec = j->buf[j->active] + sizeof(batch_header_t) + (size_t)j->count * j->rec_size;
+    memcpy(rec, &page, 8);
+    memcpy(rec + 8, &gen, 8);
+    memcpy(rec + REC_HEAD, digest, (size_t)j->digest_size);
+    if (j->count++ == 0) {
+        j->first_ns = sm3_now_ns();
+        pthread_cond_signal(&j->work);
+    } else if (j->count == j->opts.max_batch) {
+        pthread_cond_signal(&j->work);
+    }
+    j->stats.appended++;
+    pthread_mutex_unlock(&j->lock);
+    return gen;
+}
+
+int sm3_journal_wait(sm3_journal_t* j, uint64_t gen) {
+    pthread_mutex_lock(&j->lock);
+    while (!j->error && j->durable_gen < gen) {
+        pthread_cond_wait(&j->done, &j->lock);
+    }
+    int err = j->durable_gen >= gen ? 0 : j->error;
+    pthread_mutex_unlock(&j->lock);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+int sm3_journal_put(sm3_journal_t* j, uint64_t page, const uint8_t* digest) {
+    uint64_t gen = sm3_journal_append(j, page, digest);
+    return gen ? sm3_journal_wait(j, gen) : -1;
+}
+
+int sm3_journal_sync(sm3_journal_t* j) {
+    pthread_mutex_lock(&j->lock);
+    uint64_t target = j->last_gen;
+    if (j->durable_gen < target) {
+        j->flush_req = 1;
+        pthread_cond_signal(&j->work);
+    }
+    pthread_mutex_unlock(&j->lock);
+    return sm3_journal_wait(j, target);
+}
+
+int sm3_journal_compact(sm3_journal_t* j) {
+    if (sm3_journal_sync(j) != 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&j->lock);
+    while (j->committing) {
+        pthread_cond_wait(&j->done, &j->lock);
+    }
+    // 先让清单持久，再以新基准代号替换日志；两步之间崩溃时旧日志仍可完整重放
+    int rc = -1;
+    if (sm3_manifest_sync(j->manifest) == 0 &&
+        write_empty(j->path, j->digest_size, j->durable_gen) == 0) {
+        int fd = open(j->path, O_RDWR | O_CLOEXEC);
+        if (fd >= 0) {
+            close(j->fd);
+            j->fd = fd;
+            j->base_gen = j->durable_gen;
+            j->file_size = sizeof(journal_header_t);
+            j->stats.compactions++;
+            rc = 0;
+        }
+    }
+    pthread_mutex_unlock(&j->lock);
+    return rc;
+}
+
+void sm3_journal_stats(sm3_journal_t* j, sm3_journal_stats_t* stats) {
+    pthread_mutex_lock(&j->lock);
+    *stats = j->stats;
+    stats->journal_bytes = j->file_size;
+    pthread_mutex_unlock(&j->lock);
+}
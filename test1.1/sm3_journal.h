@@ -0,0 +1,77 @@
+/*
+ * 摘要日志（group commit）
+ *
+ * 页摘要写入 mmap 清单后，若每次都 msync/fsync 清单才算持久，
+ * 随机分布的脏页会让写入吞吐量大幅下降。摘要日志把每次摘要更新记为
+ * 一条 (页号, 代号, 摘要) 记录追加到日志文件，由后台提交线程把一段
+ * 时间内（commit_interval_us）各线程追加的记录合成一批，一次 write +
+ * 一次 fdatasync 提交，多个等待者共享同一次同步。
+ *
+ * 用法：调用方先更新清单中的摘要（mmap，不同步），再追加日志记录；
+ * 需要持久时等待该记录提交。打开时重放日志中代号大于基准代号的记录，
+ * 恢复崩溃前未同步到清单的摘要。压缩（compact）同步清单后以新的基准
+ * 代号原子替换为空日志。
+ *
+ * 日志文件 = 64字节头部 + 若干批次；批次 = 32字节批次头 + count 条记录，
+ * 批次头含整批内容的摘要，重放遇到不完整或摘要不符的批次即视为日志末尾
+ * （崩溃时写了一半的批次）并截断。
+ */
+
+#ifndef SM3_JOURNAL_H
+#define SM3_JOURNAL_H
+
+#include <stdint.h>
+
+#include "sm3_manifest.h"
+#include "sm3_pool.h"
+
+#define SM3_JOURNAL_MAGIC       "SM3JNL01"
+#define SM3_JOURNAL_SUFFIX      ".jnl"
+
+typedef struct sm3_journal sm3_journal_t;
+
+typedef struct {
+    uint32_t commit_interval_us;    // 首条记录到达后最多等待多久提交（0 立即提交）
+    uint32_t max_batch;             // 单批最多记录数，攒满立即提交
+    sm3_pool_t* pool;               // 重放用线程池；NULL 时单线程重放
+    // 重放时对每条应用到清单的记录按日志顺序调用（单线程），可为 NULL
+    void (*on_replay)(uint64_t page, void* ctx);
+    void* replay_ctx;
+} sm3_journal_opts_t;
+
+typedef struct {
+    uint64_t appended;              // 本次打开后追加的记录数
+    uint64_t commits;               // 提交批次数（= fdatasync 次数）
+    uint64_t max_batch;             // 最大批次记录数
+    uint64_t commit_ns;             // 提交（write + fdatasync）总耗时
+    uint64_t replayed;              // 打开时重放的记录数
+    uint64_t replay_ns;
+    uint64_t truncated_bytes;       // 重放时截断的不完整尾部
+    uint64_t compactions;
+    uint64_t journal_bytes;         // 当前日志文件大小
+} sm3_journal_stats_t;
+
+void sm3_journal_opts_default(sm3_journal_opts_t* opts);
+
+// 打开（不存在则新建）日志并重放到 manifest；manifest 须以可写方式打开，
+// 页数不足时按记录中的最大页号扩展
+int sm3_journal_open(sm3_journal_t** out, const char* path, sm3_manifest_t* manifest,
+                     const sm3_journal_opts_t* opts);
+// 提交已追加的记录并关闭（不压缩）
+int sm3_journal_close(sm3_journal_t* j);
+
+// 追加一条记录，返回其代号（不等待提交）；提交线程出错后返回 0/errno
+uint64_t sm3_journal_append(sm3_journal_t* j, uint64_t page, const uint8_t* digest);
+// 等待代号 gen 及之前的记录全部提交
+int sm3_journal_wait(sm3_journal_t* j, uint64_t gen);
+// 追加并等待提交
+int sm3_journal_put(sm3_journal_t* j, uint64_t page, const uint8_t* digest);
+// 提交此前追加的全部记录
+int sm3_journal_sync(sm3_journal_t* j);
+
+// 同步清单并清空日志。调用方须保证期间不再修改清单、不追加记录
+int sm3_journal_compact(sm3_journal_t* j);
+
+void sm3_journal_stats(sm3_journal_t* j, sm3_journal_stats_t* stats);
+
+#endif // SM3_JOURNAL_H
@@ -0,0 +1,412 @@
+/*
+ * sm3_kbench - 在指定页语料上测试各摘要内核
+ *
+ * 按 -c 配置串生成确定性语料（见 sm3_corpus.h），对每个内核循环处理全部页，
+ * 报告 MB/s 与每页耗时。语料大小超过末级缓存时可反映内存带宽与缓存行为；
+ * -K 额外按页类型分别计时，用于观察零页、单值页等数据相关的差异。
+ * -o 只把语料写入文件，供 sm3_io_bench、sm3_replay -f 等工具使用。
+ *
+ * 基线比较：每个测量项重复测量 -s 次（每次 -r 轮取平均每页耗时），
+ * -S 把样本保存为基线（合并到已有基线文件，同名项替换），-B 与基线比较：
+ * 对每个 内核/页数/线程数/语料 测量项做 Mann-Whitney U 检验，给出耗时变化的
+ * Hodges-Lehmann 估计与置信区间（-C 置信度），p < 1-置信度 且变化幅度不小于
+ * -m 百分比时判为显著回归/改进。存在显著回归时退出码为 1。
+ *
+ * 内核：
+ *   256bit / 128bit   单页接口
+ *   mb256 / mb128     多缓冲区批量接口（每次64页）
+ *   mb128d            128位紧密输出的批量接口（摘要按计时顺序每16字节连续写入）
+ *   verify256         批量校验接口
+ *   verify128d        128位紧密期望摘要的批量校验接口
+ *   sha256 / sm3      对比算法
+ *   crc32c            CRC32C（过载降级时的预检级别，见 sm3_overload.h）
+ *   parallel          aes_sm3_parallel（-t 线程，每次调用创建线程）
+ *   pool              sm3_pool_hash_pages（-t 线程的常驻线程池）
+ *   parallel128 / pool128  以上两者的128位紧密输出版本
+ *
+ * -T 把 pool 内核的运行记录为时间线（Chrome trace-event JSON，见 sm3_trace.h），
+ * 用于观察各工作线程的切块分布、唤醒延迟与落后线程。
+ *
+ * 用法:
+ *   sm3_kbench [-c 语料配置] [-n 页数] [-r 轮数] [-t 线程] [-k 内核,...] [-K] [-o 输出文件]
+ *              [-s 样本数] [-S 保存基线] [-B 比较基线] [-C 置信度] [-m 最小变化%] [-T 追踪文件]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+#include "sm3_corpus.h"
+#include "sm3_overload.h"
+#include "sm3_stats.h"
+#include "sm3_trace.h"
+
+#define PAGE  SM3_CORPUS_PAGE_SIZE
+#define GROUP 64
+
+typedef struct {
+    const char* name;
+    int bits;
+    int mode;
+} kernel_t;
+
+enum { K_SINGLE, K_MB, K_VERIFY, K_MB128, K_VERIFY128, K_SHA256, K_SM3, K_CRC, K_PARALLEL, K_POOL };
+
+static const kernel_t kernels[] = {
+    { "256bit", 256, K_SINGLE },
+    { "128bit", 128, K_SINGLE },
+    { "mb256", 256, K_MB },
+    { "mb128", 128, K_MB },
+    { "mb128d", 128, K_MB128 },
+    { "verify256", 256, K_VERIFY },
+    { "verify128d", 128, K_VERIFY128 },
+    { "sha256", 256, K_SHA256 },
+    { "sm3", 256, K_SM3 },
+    { "crc32c", 32, K_CRC },
+    { "parallel", 256, K_PARALLEL },
+    { "pool", 256, K_POOL },
+    { "parallel128", 128, K_PARALLEL },
+    { "pool128", 128, K_POOL },
+};
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+typedef struct {
+    uint8_t* pages;
+    uint8_t* digests;           // 每页32字节
+    uint32_t* index;            // 参与计时的页号
+    uint64_t count;
+    int threads;
+    sm3_pool_t* pool;
+} bench_t;
+
+typedef struct {
+    int samples;
+    double confidence;
+    double min_effect;          // 判为显著的最小变化（百分比）
+    const sm3_baseline_t* base; // NULL 表示不比较
+    sm3_baseline_t* save;       // NULL 表示不保存
+    int regressions;
+    int improvements;
+} report_t;
+
+static volatile uint8_t sink;
+
+// 处理 index[0..count) 一轮
+static void run_once(const kernel_t* k, bench_t* b) {
+    const uint8_t* inputs[GROUP];
+    const uint8_t* expected[GROUP];
+    uint8_t* outputs[GROUP];
+    uint8_t ok[GROUP];
+    switch (k->mode) {
+    case K_SINGLE:
+    case K_SHA256:
+    case K_SM3:
+    case K_CRC:
+        for (uint64_t i = 0; i < b->count; i++) {
+            const uint8_t* in = b->pages + (size_t)b->index[i] * PAGE;
+            uint8_t* out = b->digests + (size_t)b->index[i] * 32;
+            if (k->mode == K_SHA256) {
+                sha256_4kb(in, out);
+            } else if (k->mode == K_SM3) {
+                sm3_4kb(in, out);
+            } else if (k->mode == K_CRC) {
+                uint32_t crc = sm3_crc32c(0, in, PAGE);
+                memcpy(out, &crc, sizeof(crc));
+            } else if (k->bits == 256) {
+                aes_sm3_integrity_256bit(in, out);
+            } else {
+                aes_sm3_integrity_128bit(in, out);
+            }
+        }
+        break;
+    case K_MB:
+    case K_VERIFY:
+        for (uint64_t i = 0; i < b->count; i += GROUP) {
+            int n = b->count - i < GROUP ? (int)(b->count - i) : GROUP;
+            for (int j = 0; j < n; j++) {
+                inputs[j] = b->pages + (size_t)b->index[i + j] * PAGE;
+                outputs[j] = b->digests + (size_t)b->index[i + j] * 32;
+                expected[j] = outputs[j];
+            }
+            if (k->mode == K_MB) {
+                aes_sm3_integrity_mb(inputs, outputs, n, k->bits);
+            } else {
+                sink ^= (uint8_t)aes_sm3_integrity_verify_mb(inputs, expected, ok, n, k->bits);
+            }
+        }
+        break;
+    case K_MB128:
+    case K_VERIFY128:
+        // 第 i 个计时页的摘要位于 digests + i*16
+        for (uint64_t i = 0; i < b->count; i += GROUP) {
+            int n = b->count - i < GROUP ? (int)(b->count - i) : GROUP;
+            for (int j = 0; j < n; j++) {
+                inputs[j] = b->pages + (size_t)b->index[i + j] * PAGE;
+            }
+            if (k->mode == K_MB128) {
+                aes_sm3_integrity_mb_128(inputs, b->digests + i * 16, n);
+            } else {
+                sink ^= (uint8_t)aes_sm3_integrity_verify_mb_128(inputs, b->digests + i * 16, ok, n);
+            }
+        }
+        break;
+    case K_PARALLEL:
+        // 并行接口只接受连续页：计时集合为全部页时使用
+        if (k->bits == 128) {
+            aes_sm3_parallel_128(b->pages, b->digests, (int)b->count, b->threads);
+        } else {
+            aes_sm3_parallel(b->pages, b->digests, (int)b->count, b->threads, k->bits);
+        }
+        break;
+    case K_POOL:
+        if (k->bits == 128) {
+            sm3_pool_hash_pages_128(b->pool, b->pages, (size_t)b->count, b->digests);
+        } else {
+            sm3_pool_hash_pages(b->pool, b->pages, (size_t)b->count, b->digests, k->bits / 8);
+        }
+        break;
+    }
+    sink ^= b->digests[0];
+}
+
+static double bench_kernel(const kernel_t* k, bench_t* b, int rounds) {
+    if (k->mode == K_VERIFY || k->mode == K_VERIFY128) {
+        kernel_t mb = { k->name, k->bits, k->mode == K_VERIFY ? K_MB : K_MB128 };
+        run_once(&mb, b);           // 先生成期望摘要
+    }
+    run_once(k, b);                 // 预热
+    uint64_t t0 = sm3_now_ns();
+    for (int r = 0; r < rounds; r++) {
+        run_once(k, b);
+    }
+    return (double)(sm3_now_ns() - t0) / ((double)rounds * (double)b->count);
+}
+
+static int selected(const char* list, const char* name) {
+    if (!list) return 1;
+    size_t n = strlen(name);
+    for (const char* p = list; (p = strstr(p, name)) != NULL; p += n) {
+        if ((p == list || p[-1] == ',') && (p[n] == '\0' || p[n] == ',')) return 1;
+    }
+    return 0;
+}
+
+// 重复测量一个测量项并输出一行结果（含与基线的比较）
+static int measure(const kernel_t* k, bench_t* b, int rounds, const char* label, const char* key,
+                   report_t* rep) {
+    double* ns = malloc((size_t)rep->samples * sizeof(double));
+    if (!ns) {
+        return -1;
+    }
+    for (int s = 0; s < rep->samples; s++) {
+        ns[s] = bench_kernel(k, b, rounds);
+    }
+    double med = sm3_median(ns, (size_t)rep->samples);
+    printf("%-16s %10.1f %10.1f", label, PAGE / med * 1e9 / (1024.0 * 1024.0), med);
+
+    const sm3_baseline_entry_t* e = rep->base ? sm3_baseline_find(rep->base, key) : NULL;
+    sm3_mwu_t t;
+    if (rep->base && !e) {
+        printf("  基线中无此项");
+    } else if (e && sm3_mann_whitney(e->samples, e->count, ns, (size_t)rep->samples,
+                                     rep->confidence, &t) == 0) {
+        double base_med = sm3_median(e->samples, e->count);
+        double pct = t.shift / base_med * 100;
+        int sig = t.p < 1 - rep->confidence && fabs(pct) >= rep->min_effect &&
+                  (t.ci_low > 0 || t.ci_high < 0);
+        const char* verdict = !sig ? "无显著差异" : pct > 0 ? "回归" : "改进";
+        if (sig && pct > 0) rep->regressions++;
+        if (sig && pct < 0) rep->improvements++;
+        printf(" %10.1f %+7.2f%% [%+6.2f%%, %+6.2f%%] %8.4f%s  %s", base_med, pct,
+               t.ci_low / base_med * 100, t.ci_high / base_med * 100, t.p, t.exact ? "*" : " ",
+               verdict);
+    }
+    printf("\n");
+    int rc = rep->save ? sm3_baseline_add(rep->save, key, ns, (size_t)rep->samples) : 0;
+    free(ns);
+    return rc;
+}
+
+int main(int argc, char** argv) {
+    sm3_corpus_opts_t corpus;
+    sm3_corpus_opts_default(&corpus);
+    uint64_t pages = 4096;
+    int rounds = 20, threads = 1, per_kind = 0;
+    const char* klist = NULL;
+    const char* out_path = NULL;
+    const char* save_path = NULL;
+    const char* base_path = NULL;
+    const char* trace_path = NULL;
+    report_t rep = { 0, 0.95, 0, NULL, NULL, 0, 0 };
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:r:t:k:Ko:s:S:B:C:m:T:")) != -1) {
+        switch (opt) {
+        case 'c':
+            if (sm3_corpus_parse(&corpus, optarg) != 0) {
+                fprintf(stderr, "语料配置无效: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'n': pages = strtoull(optarg, NULL, 10); break;
+        case 'r': rounds = atoi(optarg); break;
+        case 't': threads = atoi(optarg); break;
+        case 'k': klist = optarg; break;
+        case 'K': per_kind = 1; break;
+        case 'o': out_path = optarg; break;
+        case 's': rep.samples = atoi(optarg); break;
+        case 'S': save_path = optarg; break;
+        case 'B': base_path = optarg; break;
+        case 'C': rep.confidence = atof(optarg); break;
+        case 'm': rep.min_effect = atof(optarg); break;
+        case 'T': trace_path = optarg; break;
+        default:
+            fprintf(stderr, "用法: %s [-c 语料配置] [-n 页数] [-r 轮数] [-t 线程] "
+                            "[-k 内核,...] [-K] [-o 输出文件] [-s 样本数] [-S 保存基线] "
+                            "[-B 比较基线] [-C 置信度] [-m 最小变化%%] [-T 追踪文件]\n", argv[0]);
+            return 2;
+        }
+    }
+    // 保存或比较基线时默认取10个样本，单次测量无法做显著性检验
+    if (rep.samples == 0) {
+        rep.samples = save_path || base_path ? 10 : 1;
+    }
+    if (pages == 0 || pages > UINT32_MAX || rounds <= 0 || threads <= 0 || rep.samples <= 0 ||
+        rep.confidence <= 0 || rep.confidence >= 1 || rep.min_effect < 0) {
+        fprintf(stderr, "参数无效\n");
+        return 2;
+    }
+    sm3_baseline_t base, save;
+    sm3_baseline_init(&base);
+    sm3_baseline_init(&save);
+    if (base_path) {
+        if (sm3_baseline_load(&base, base_path) != 0) {
+            fprintf(stderr, "读取基线失败: %s: %s\n", base_path, strerror(errno));
+            return 2;
+        }
+        rep.base = &base;
+    }
+    if (save_path) {
+        // 合并到已有基线文件，便于分多次运行记录不同线程数/页数
+        if (sm3_baseline_load(&save, save_path) != 0 && errno != ENOENT) {
+            fprintf(stderr, "读取基线失败: %s: %s\n", save_path, strerror(errno));
+            return 2;
+        }
+        rep.save = &save;
+    }
+
+    char spec[256];
+    sm3_corpus_format(&corpus, spec, sizeof(spec));
+    sm3_pool_t* pool = sm3_pool_create(threads);
+    sm3_corpus_stats_t stats;
+
+    if (out_path) {
+        int fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0 || sm3_corpus_write(&corpus, pool, fd, pages, &stats) != 0 || fsync(fd) != 0) {
+            fprintf(stderr, "写入语料失败: %s\n", strerror(errno));
+            return 1;
+        }
+        close(fd);
+        sm3_pool_destroy(pool);
+        printf("已写入 %llu 页语料到 %s (%s)\n", (unsigned long long)pages, out_path, spec);
+        return 0;
+    }
+
+    bench_t b;
+    b.pages = aligned_alloc(PAGE, (size_t)pages * PAGE);
+    b.digests = malloc((size_t)pages * 32);
+    b.index = malloc((size_t)pages * sizeof(uint32_t));
+    b.threads = threads;
+    if (!b.pages || !b.digests || !b.index) {
+        fprintf(stderr, "内存不足\n");
+        return 1;
+    }
+    uint64_t t0 = sm3_now_ns();
+    sm3_corpus_fill(&corpus, pool, 0, pages, b.pages, &stats);
+    uint64_t gen_ns = sm3_now_ns() - t0;
+    b.pool = pool;
+
+    printf("内核: %s\n", aes_sm3_integrity_kernel());
+    printf("语料: %s\n", spec);
+    printf("  %llu 页 (%.1f MB)，生成耗时 %.1f ms，重复页 %llu (%.1f%%)\n",
+           (unsigned long long)pages, pages * (double)PAGE / (1024.0 * 1024.0), gen_ns / 1e6,
+           (unsigned long long)stats.dup_pages, stats.dup_pages * 100.0 / (double)pages);
+    printf("  类型分布:");
+    for (int k = 0; k < SM3_CORPUS_KINDS; k++) {
+        printf(" %s %.1f%%", sm3_corpus_kind_name(k), stats.kind_pages[k] * 100.0 / (double)pages);
+    }
+    printf("\n%-16s %10s %10s", "内核", "MB/s", "ns/页");
+    if (rep.base) {
+        printf(" %10s %8s %18s %9s  (%d样本, 置信度 %.0f%%, *为精确p值)", "基线ns/页", "变化",
+               "置信区间", "p", rep.samples, rep.confidence * 100);
+    } else if (rep.samples > 1) {
+        printf("  (%d样本中位数)", rep.samples);
+    }
+    printf("\n");
+
+    // 测量项名称：内核[:页类型]/p页数/t线程数/语料配置
+    char key[SM3_BASELINE_NAME_MAX], label[64];
+    int rc = 0;
+    for (size_t ki = 0; ki < KERNEL_COUNT && rc == 0; ki++) {
+        const kernel_t* k = &kernels[ki];
+        if (!selected(klist, k->name)) continue;
+        b.count = pages;
+        for (uint64_t i = 0; i < pages; i++) b.index[i] = (uint32_t)i;
+        snprintf(key, sizeof(key), "%s/p%llu/t%d/%s", k->name, (unsigned long long)pages,
+                 threads, spec);
+        if (trace_path && k->mode == K_POOL) {
+            sm3_trace_thread_name("kbench");
+            sm3_trace_start(NULL);
+        }
+        rc = measure(k, &b, rounds, k->name, key, &rep);
+        if (trace_path && k->mode == K_POOL) {
+            sm3_trace_stop();
+        }
+
+        if (!per_kind || k->mode == K_PARALLEL || k->mode == K_POOL) continue;
+        for (int kind = 0; kind < SM3_CORPUS_KINDS && rc == 0; kind++) {
+            b.count = 0;
+            for (uint64_t i = 0; i < pages; i++) {
+                if (sm3_corpus_page_kind(&corpus, i, NULL) == kind) b.index[b.count++] = (uint32_t)i;
+            }
+            if (b.count == 0) continue;
+            snprintf(key, sizeof(key), "%s:%s/p%llu/t%d/%s", k->name, sm3_corpus_kind_name(kind),
+                     (unsigned long long)pages, threads, spec);
+            snprintf(label, sizeof(label), "  %s (%llu页)", sm3_corpus_kind_name(kind),
+                     (unsigned long long)b.count);
+            rc = measure(k, &b, rounds, label, key, &rep);
+        }
+    }
+    if (rc != 0) {
+        fprintf(stderr, "记录样本失败: %s\n", strerror(errno));
+    } else if (save_path && sm3_baseline_save(&save, save_path) != 0) {
+        fprintf(stderr, "保存基线失败: %s: %s\n", save_path, strerror(errno));
+        rc = -1;
+    } else if (save_path) {
+        printf("\n基线已保存: %s (%zu 项)\n", save_path, save.count);
+    }
+    if (rep.base) {
+        printf("\n显著回归 %d 项，显著改进 %d 项\n", rep.regressions, rep.improvements);
+    }
+    sm3_trace_stats_t ts;
+    if (rc == 0 && trace_path && sm3_trace_write(trace_path, &ts) == 0) {
+        printf("\n时间线: %s (%u 线程, %llu 事件, 丢弃 %llu)\n", trace_path, ts.threads,
+               (unsigned long long)ts.events, (unsigned long long)ts.dropped);
+    } else if (rc == 0 && trace_path) {
+        fprintf(stderr, "写入追踪文件失败: %s\n", strerror(errno));
+        rc = -1;
+    }
+    sm3_pool_destroy(pool);
+    sm3_baseline_free(&base);
+    sm3_baseline_free(&save);
+    free(b.pages);
+    free(b.digests);
+    free(b.index);
+    return rc != 0 ? 2 : rep.regressions ? 1 : 0;
+}
@@ -0,0 +1,432 @@
+/*
+ * 页级摘要清单（manifest）与文件扫描任务
+ *
+ * 扫描以 chunk_pages 页为单位顺序读取数据文件，摘要直接写入 mmap 的清单。
+ * 启用检查点时，每隔 checkpoint_pages 页或 checkpoint_ms 毫秒：
+ *   1. msync 清单中已写入的摘要（生成任务）
+ *   2. 原子写入检查点（已完成区间 + 已发现的不一致页）
+ * 两次同步合并为一个批次，开销按间隔内的页数摊薄，并计入统计。
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+#include "sm3_manifest.h"
+#include "sm3_minhash.h"
+#include "sm3_trace.h"
+
+// ============================================================================
+// 清单文件
+// ============================================================================
+
+static int manifest_map(sm3_manifest_t* m, size_t size) {
+    int prot = PROT_READ | (m->writable ? PROT_WRITE : 0);
+    void* p = mmap(NULL, size, prot, MAP_SHARED, m->fd, 0);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+    m->base = p;
+    m->map_size = size;
+    m->hdr = (sm3_manifest_header_t*)m->base;
+    m->digests = m->base + SM3_MANIFEST_HEADER_SIZE;
+    return 0;
+}
+
+int sm3_manifest_create(sm3_manifest_t* m, const char* path, uint64_t file_size, int digest_size) {
+    memset(m, 0, sizeof(*m));
+    if (digest_size != 16 && digest_size != 32) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    m->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m->fd < 0) {
+        return -1;
+    }
+    m->writable = 1;
+
+    uint64_t pages = sm3_pages_for_size(file_size);
+    size_t size = SM3_MANIFEST_HEADER_SIZE + pages * (uint64_t)digest_size;
+    if (ftruncate(m->fd, (off_t)size) != 0 || manifest_map(m, size) != 0) {
+        close(m->fd);
+        m->fd = -1;
+        return -1;
+    }
+
+    memcpy(m->hdr->magic, SM3_MANIFEST_MAGIC, 8);
+    m->hdr->version = SM3_MANIFEST_VERSION;
+    m->hdr->page_size = SM3_PAGE_SIZE;
+    m->hdr->digest_size = (uint32_t)digest_size;
+    m->hdr->file_size = file_size;
+    m->hdr->page_count = pages;
+    return 0;
+}
+
+int sm3_manifest_open(sm3_manifest_t* m, const char* path, int writable) {
+    memset(m, 0, sizeof(*m));
+    m->fd = open(path, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (m->fd < 0) {
+        return -1;
+    }
+    m->writable = writable;
+
+    struct stat st;
+    if (fstat(m->fd, &st) != 0 || st.st_size < SM3_MANIFEST_HEADER_SIZE ||
+        manifest_map(m, (size_t)st.st_size) != 0) {
+        close(m->fd);
+        m->fd = -1;
+        errno = errno ? errno : EINVAL;
+        return -1;
+    }
+
+    // 页数必须与文件大小一致且不超出映射范围，调用方按 file_size 索引摘要；
+    // 用除法比较避免 page_count * digest_size 溢出
+    const sm3_manifest_header_t* h = m->hdr;
+    if (memcmp(h->magic, SM3_MANIFEST_MAGIC, 8) != 0 || h->page_size != SM3_PAGE_SIZE ||
+        (h->digest_size != 16 && h->digest_size != 32) ||
+        h->page_count != sm3_pages_for_size(h->file_size) ||
+        h->page_count > ((uint64_t)st.st_size - SM3_MANIFEST_HEADER_SIZE) / h->digest_size) {
+        sm3_manifest_close(m);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int sm3_manifest_resize(sm3_manifest_t* m, uint64_t file_size) {
+    uint32_t digest_size = m->hdr->digest_size;
+    uint64_t pages = sm3_pages_for_size(file_size);
+    size_t size = SM3_MANIFEST_HEADER_SIZE + pages * (uint64_t)digest_size;
+    if (size != m->map_size) {
+        munmap(m->base, m->map_size);
+        m->base = NULL;
+        if (ftruncate(m->fd, (off_t)size) != 0 || manifest_map(m, size) != 0) {
+            return -1;
+        }
+    }
+    m->hdr->file_size = file_size;
+    m->hdr->page_count = pages;
+    return 0;
+}
+
+int sm3_manifest_sync(sm3_manifest_t* m) {
+    if (!m->base || !m->writable) {
+        return 0;
+    }
+    return msync(m->base, m->map_size, MS_SYNC);
+}
+
+void sm3_manifest_close(sm3_manifest_t* m) {
+    if (m->base) {
+        munmap(m->base, m->map_size);
+    }
+    if (m->fd >= 0) {
+        close(m->fd);
+    }
+    memset(m, 0, sizeof(*m));
+    m->fd = -1;
+}
+
+void sm3_hash_pages(const uint8_t* pages, uint64_t count, uint8_t* digests,
+                    int digest_size, int num_threads) {
+    // 页数较少时线程创建开销大于收益，直接单线程计算
+    if (num_threads > 1 && count >= (uint64_t)num_threads * 16) {
+        aes_sm3_parallel(pages, digests, (int)count, num_threads, digest_size * 8);
+        return;
+    }
+    // 单线程时按组走多缓冲区接口
+    enum { GROUP = 16 };
+    const uint8_t* inputs[GROUP];
+    uint8_t* outputs[GROUP];
+    for (uint64_t i = 0; i < count; i += GROUP) {
+        int n = count - i < GROUP ? (int)(count - i) : GROUP;
+        for (int k = 0; k < n; k++) {
+            inputs[k] = pages + (i + k) * SM3_PAGE_SIZE;
+        }
+        if (digest_size == 16) {
+            aes_sm3_integrity_mb_128(inputs, digests + i * 16, n);   // 摘要本就紧密排列
+        } else {
+            for (int k = 0; k < n; k++) outputs[k] = digests + (i + k) * 32;
+            aes_sm3_integrity_mb(inputs, outputs, n, 256);
+        }
+    }
+}
+
+// ============================================================================
+// 扫描任务
+// ============================================================================
+
+void sm3_scan_opts_default(sm3_scan_opts_t* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->digest_bits = 256;
+    opts->num_threads = 1;
+    opts->chunk_pages = 1024;           // 4MB
+    opts->checkpoint_pages = 262144;    // 1GB
+    opts->checkpoint_ms = 30000;
+}
+
+int sm3_read_pages(int fd, uint8_t* buf, uint64_t first_page, uint64_t count,
+                   uint64_t file_size, uint64_t* bytes_read) {
+    uint64_t off = first_page * SM3_PAGE_SIZE;
+    uint64_t want = count * SM3_PAGE_SIZE;
+    if (off + want > file_size) {
+        want = file_size - off;
+    }
+
+    uint64_t got = 0;
+    uint64_t t0 = sm3_trace_clock();
+    while (got < want) {
+        ssize_t n = pread(fd, buf + got, want - got, (off_t)(off + got));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) {
+            break;  // 文件在扫描期间被截断
+        }
+        got += (uint64_t)n;
+    }
+    sm3_trace_span(SM3_TRACE_IO, "pread", t0, off, want);
+    // 末页补零
+    memset(buf + got, 0, count * SM3_PAGE_SIZE - got);
+    *bytes_read += got;
+    return 0;
+}
+
+static int64_t stat_mtime_ns(const struct stat* st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000ll + st->st_mtim.tv_nsec;
+}
+
+static int checkpoint_matches(const sm3_checkpoint_t* cp, uint32_t job, const struct stat* st,
+                              uint32_t digest_size) {
+    return cp->job_type == job &&
+           cp->digest_size == digest_size &&
+           cp->data_size == (uint64_t)st->st_size &&
+           cp->data_ino == (uint64_t)st->st_ino &&
+           cp->data_mtime_ns == stat_mtime_ns(st) &&
+           cp->pages_total == sm3_pages_for_size((uint64_t)st->st_size);
+}
+
+static int write_checkpoint(const sm3_scan_opts_t* opts, sm3_manifest_t* m,
+                            const sm3_checkpoint_t* cp, sm3_ckpt_timer_t* timer,
+                            uint64_t pages_done) {
+    uint64_t t0 = sm3_now_ns();
+    // 先落盘摘要，再提交检查点：检查点中记录的区间必须已持久化
+    if (sm3_manifest_sync(m) != 0) {
+        return -1;
+    }
+    long bytes = sm3_checkpoint_save(opts->checkpoint_path, cp);
+    if (bytes < 0) {
+        return -1;
+    }
+    sm3_ckpt_timer_mark(timer, pages_done, sm3_now_ns() - t0, bytes);
+    return 0;
+}
+
+static int run_scan(uint32_t job, const char* data_path, const char* manifest_path,
+                    const sm3_scan_opts_t* opts, sm3_scan_stats_t* stats,
+                    sm3_bad_page_fn on_bad, void* ctx) {
+    memset(stats, 0, sizeof(*stats));
+    uint64_t t_start = sm3_now_ns();
+
+    int fd = open(data_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    uint64_t file_size = (uint64_t)st.st_size;
+    uint64_t total = sm3_pages_for_size(file_size);
+    stats->pages_total = total;
+
+    sm3_manifest_t m;
+    sm3_checkpoint_t cp;
+    sm3_checkpoint_init(&cp);
+    int resumed = 0;
+
+    uint32_t digest_size;
+    if (job == SM3_JOB_HASH) {
+        digest_size = (uint32_t)opts->digest_bits / 8;
+        if (opts->checkpoint_path &&
+            sm3_checkpoint_load(opts->checkpoint_path, &cp) == 0 &&
+            checkpoint_matches(&cp, job, &st, digest_size) &&
+            sm3_manifest_open(&m, manifest_path, 1) == 0) {
+            if (m.hdr->file_size == file_size && m.hdr->digest_size == digest_size) {
+                resumed = 1;
+            } else {
+                sm3_manifest_close(&m);
+            }
+        }
+        if (!resumed) {
+            sm3_checkpoint_free(&cp);
+            if (sm3_manifest_create(&m, manifest_path, file_size, (int)digest_size) != 0) {
+                close(fd);
+                return -1;
+            }
+        }
+    } else {
+        if (sm3_manifest_open(&m, manifest_path, 0) != 0) {
+            close(fd);
+            return -1;
+        }
+        if (m.hdr->file_size != file_size) {
+            fprintf(stderr, "清单记录的文件大小(%llu)与数据文件(%llu)不一致\n",
+                    (unsigned long long)m.hdr->file_size, (unsigned long long)file_size);
+            sm3_manifest_close(&m);
+            close(fd);
+            errno = EINVAL;
+            return -1;
+        }
+        digest_size = m.hdr->digest_size;
+        if (opts->checkpoint_path &&
+            sm3_checkpoint_load(opts->checkpoint_path, &cp) == 0 &&
+            checkpoint_matches(&cp, job, &st, digest_size)) {
+            resumed = 1;
+            // 上次运行已发现的不一致页
+            for (size_t i = 0; i < cp.bad_count; i++) {
+                if (on_bad) on_bad(cp.bad_pages[i], ctx);
+            }
+        } else {
+            sm3_checkpoint_free(&cp);
+        }
+    }
+
+    if (!resumed) {
+        cp.job_type = job;
+        cp.digest_size = digest_size;
+        cp.data_size = file_size;
+        cp.data_ino = (uint64_t)st.st_ino;
+        cp.data_mtime_ns = stat_mtime_ns(&st);
+        cp.pages_total = total;
+    }
+    stats->resumed = resumed;
+    stats->pages_resumed = sm3_range_set_total(&cp.done);
+    stats->mismatches = cp.bad_count;
+
+    uint32_t chunk = opts->chunk_pages ? opts->chunk_pages : 1024;
+    uint8_t* buf = aligned_alloc(SM3_PAGE_SIZE, (size_t)chunk * SM3_PAGE_SIZE);
+    uint8_t* computed = malloc((size_t)chunk * digest_size);
+    int rc = 0;
+    if (!buf || !computed) {
+        rc = -1;
+        goto out;
+    }
+
+    sm3_ckpt_timer_t timer;
+    sm3_ckpt_timer_init(&timer, opts->checkpoint_pages, opts->checkpoint_ms);
+
+    uint64_t pos = 0, gap_start, gap_end;
+    while (rc == 0 && sm3_range_set_find_gap(&cp.done, pos, total, &gap_start, &gap_end)) {
+        for (uint64_t p = gap_start; p < gap_end; ) {
+            uint64_t n = gap_end - p < chunk ? gap_end - p : chunk;
+            if (opts->max_pages && stats->pages_done + n > opts->max_pages) {
+                n = opts->max_pages - stats->pages_done;
+            }
+            if (n == 0) {
+                rc = 1;     // 本次运行的页数预算已用完
+                break;
+            }
+
+            if (sm3_read_pages(fd, buf, p, n, file_size, &stats->bytes_read) != 0) {
+                rc = -1;
+                break;
+            }
+
+            if (job == SM3_JOB_HASH) {
+                sm3_hash_pages(buf, n, sm3_manifest_digest(&m, p), (int)digest_size,
+                               opts->num_threads);
+                if (opts->minhash) {
+                    sm3_minhash_update(opts->minhash, sm3_manifest_digest(&m, p), n, (int)digest_size);
+                }
+            } else {
+                sm3_hash_pages(buf, n, computed, (int)digest_size, opts->num_threads);
+                for (uint64_t i = 0; i < n; i++) {
+                    if (memcmp(computed + i * digest_size, sm3_manifest_digest(&m, p + i),
+                               digest_size) != 0) {
+                        stats->mismatches++;
+                        if (sm3_checkpoint_add_bad(&cp, p + i) != 0) {
+                            rc = -1;
+                            break;
+                        }
+                        if (on_bad) on_bad(p + i, ctx);
+                    }
+                }
+                if (rc != 0) {
+                    break;
+                }
+            }
+
+            // 记录失败时不能继续：否则检查点会把未记下的不一致页当作已完成
+            if (sm3_range_set_add(&cp.done, p, p + n) != 0) {
+                rc = -1;
+                break;
+            }
+            stats->pages_done += n;
+            p += n;
+
+            if (opts->checkpoint_path && sm3_ckpt_timer_due(&timer, stats->pages_done)) {
+                if (write_checkpoint(opts, &m, &cp, &timer, stats->pages_done) != 0) {
+                    rc = -1;
+                    break;
+                }
+            }
+        }
+        pos = gap_end;
+    }
+
+    if (rc == 1 && opts->checkpoint_path) {
+        if (write_checkpoint(opts, &m, &cp, &timer, stats->pages_done) != 0) {
+            rc = -1;
+        }
+    } else if (rc == 0) {
+        if (job == SM3_JOB_HASH && opts->minhash && resumed) {
+            // 续扫前已完成的页未经累积：由完整清单重新计算
+            sm3_minhash_init(opts->minhash, opts->minhash->k);
+            sm3_minhash_update(opts->minhash, m.digests, total, (int)digest_size);
+        }
+        if (sm3_manifest_sync(&m) != 0) {
+            rc = -1;
+        } else if (opts->checkpoint_path) {
+            sm3_checkpoint_remove(opts->checkpoint_path);
+        }
+        stats->complete = (rc == 0);
+    }
+
+    stats->checkpoints = timer.writes;
+    stats->checkpoint_ns = timer.total_ns;
+    stats->checkpoint_bytes = timer.total_bytes;
+
+out:
+    free(buf);
+    free(computed);
+    sm3_checkpoint_free(&cp);
+    sm3_manifest_close(&m);
+    close(fd);
+    stats->elapsed_ns = sm3_now_ns() - t_start;
+    return rc;
+}
+
+int sm3_manifest_build(const char* data_path, const char* manifest_path,
+                       const sm3_scan_opts_t* opts, sm3_scan_stats_t* stats) {
+    return run_scan(SM3_JOB_HASH, data_path, manifest_path, opts, stats, NULL, NULL);
+}
+
+int sm3_manifest_verify(const char* data_path, const char* manifest_path,
+                        const sm3_scan_opts_t* opts, sm3_scan_stats_t* stats,
+                        sm3_bad_page_fn on_bad, void* ctx) {
+    return run_scan(SM3_JOB_VERIFY, data_path, manifest_path, opts, stats, on_bad, ctx);
+}
@@ -0,0 +1,109 @@
+/*
+ * 页级摘要清单（manifest）与文件扫描任务
+ *
+ * 清单文件 = 64字节头部 + 每4KB页一个摘要（16或32字节，紧密排列），
+ * 通过 mmap 读写。末页不足4KB时补零后计算。
+ *
+ * 扫描任务（生成清单 / 按清单校验）支持周期性检查点与断点续扫，
+ * 见 sm3_checkpoint.h。
+ */
+
+#ifndef SM3_MANIFEST_H
+#define SM3_MANIFEST_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SM3_PAGE_SIZE           4096
+#define SM3_MANIFEST_MAGIC      "SM3MANI1"
+#define SM3_MANIFEST_VERSION    1
+#define SM3_MANIFEST_HEADER_SIZE 64
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t digest_size;   // 字节：16 或 32
+    uint32_t flags;
+    uint64_t file_size;     // 被校验数据的字节数
+    uint64_t page_count;
+    uint8_t  reserved[24];
+} sm3_manifest_header_t;
+
+typedef struct {
+    int fd;
+    int writable;
+    uint8_t* base;                  // mmap 起始地址
+    size_t map_size;
+    sm3_manifest_header_t* hdr;
+    uint8_t* digests;               // 指向第0页摘要
+} sm3_manifest_t;
+
+int sm3_manifest_create(sm3_manifest_t* m, const char* path, uint64_t file_size, int digest_size);
+int sm3_manifest_open(sm3_manifest_t* m, const char* path, int writable);
+// 按新的数据文件大小调整清单（页数增减），已有摘要保留
+int sm3_manifest_resize(sm3_manifest_t* m, uint64_t file_size);
+int sm3_manifest_sync(sm3_manifest_t* m);
+void sm3_manifest_close(sm3_manifest_t* m);
+
+static inline uint8_t* sm3_manifest_digest(const sm3_manifest_t* m, uint64_t page) {
+    return m->digests + page * m->hdr->digest_size;
+}
+
+static inline uint64_t sm3_pages_for_size(uint64_t size) {
+    return (size + SM3_PAGE_SIZE - 1) / SM3_PAGE_SIZE;
+}
+
+// 读取 [first_page, first_page+count) 页到 buf，超出文件末尾部分补零
+int sm3_read_pages(int fd, uint8_t* buf, uint64_t first_page, uint64_t count,
+                   uint64_t file_size, uint64_t* bytes_read);
+
+// 按 digest_size（16/32字节）计算一组连续页的摘要
+void sm3_hash_pages(const uint8_t* pages, uint64_t count, uint8_t* digests,
+                    int digest_size, int num_threads);
+
+// ============================================================================
+// 扫描任务
+// ============================================================================
+
+struct sm3_minhash;
+
+typedef struct {
+    int digest_bits;            // 128 或 256（生成清单时使用）
+    int num_threads;
+    uint32_t chunk_pages;       // 每次读取的页数
+    const char* checkpoint_path;  // NULL 表示不启用检查点
+    uint64_t checkpoint_pages;  // 每处理N页写一次检查点
+    uint32_t checkpoint_ms;     // 或每T毫秒写一次检查点
+    uint64_t max_pages;         // 本次运行最多处理的页数（0不限），用于分时段扫描
+    struct sm3_minhash* minhash;  // 非 NULL 时生成清单的同时累积 MinHash 签名（见 sm3_minhash.h），
+                                  // 须先 sm3_minhash_init；完成（stats.complete）时为全部页的签名
+} sm3_scan_opts_t;
+
+typedef struct {
+    uint64_t pages_total;
+    uint64_t pages_done;        // 本次运行处理的页数
+    uint64_t pages_resumed;     // 从检查点恢复、无需重算的页数
+    uint64_t mismatches;
+    uint64_t bytes_read;
+    uint64_t elapsed_ns;
+    uint64_t checkpoints;
+    uint64_t checkpoint_ns;     // 检查点（含清单同步）总耗时
+    uint64_t checkpoint_bytes;
+    int resumed;
+    int complete;
+} sm3_scan_stats_t;
+
+// 校验发现不一致页时的回调
+typedef void (*sm3_bad_page_fn)(uint64_t page, void* ctx);
+
+void sm3_scan_opts_default(sm3_scan_opts_t* opts);
+
+// 返回 0 完成，1 达到 max_pages 暂停（已写检查点），-1 出错
+int sm3_manifest_build(const char* data_path, const char* manifest_path,
+                       const sm3_scan_opts_t* opts, sm3_scan_stats_t* stats);
+int sm3_manifest_verify(const char* data_path, const char* manifest_path,
+                        const sm3_scan_opts_t* opts, sm3_scan_stats_t* stats,
+                        sm3_bad_page_fn on_bad, void* ctx);
+
+#endif // SM3_MANIFEST_H
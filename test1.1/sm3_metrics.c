@@ -0,0 +1,515 @@
+/*
+ * 运行指标：计数器、仪表与 HDR 延迟直方图
+ *
+ * 分片：线程首次记录时经 pthread_key 分配分片并以无锁单链表登记；分片内
+ * 的值只由所属线程以 relaxed load + store 更新，采集线程以 relaxed load 读取，
+ * 读到的可能是略旧的值但不会撕裂。直方图桶数组在分片内按需分配。
+ * 线程退出后分片保留，计数器保持单调。
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "sm3_metrics.h"
+
+#define SUB_BITS    5
+#define SUB         (1 << SUB_BITS)
+#define BUCKETS     ((65 - SUB_BITS) * SUB)     // 最高位为63时的末桶 + 1
+#define NAME_LEN    96
+#define HELP_LEN    160
+#define MAX_COLLECT 16
+#define REQ_MAX     4096
+
+enum { T_COUNTER, T_GAUGE, T_HISTOGRAM };
+
+typedef struct {
+    _Atomic uint64_t buckets[BUCKETS];
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+} hist_shard_t;
+
+typedef struct shard {
+    struct shard* next;
+    _Atomic uint64_t counters[SM3_METRICS_MAX_COUNTERS];
+    _Atomic(hist_shard_t*) hists[SM3_METRICS_MAX_HISTOGRAMS];
+} shard_t;
+
+typedef struct {
+    char name[NAME_LEN];
+    char help[HELP_LEN];
+    int type;
+    int id;                     // 该类型内的编号
+    double scale;
+} metric_def_t;
+
+struct sm3_metrics {
+    pthread_mutex_t lock;       // 注册、采集回调与导出
+    metric_def_t defs[SM3_METRICS_MAX_COUNTERS + SM3_METRICS_MAX_GAUGES +
+                      SM3_METRICS_MAX_HISTOGRAMS];
+    int ndefs;
+    int ncounters;
+    int ngauges;
+    int nhists;
+    _Atomic int64_t gauges[SM3_METRICS_MAX_GAUGES];
+    struct {
+        sm3_metrics_collect_fn fn;
+        void* ctx;
+    } collect[MAX_COLLECT];
+    int ncollect;
+
+    pthread_key_t key;
+    _Atomic(shard_t*) shards;
+
+    // HTTP 端点
+    int listen_fd;
+    int wake[2];
+    pthread_t server;
+    int serving;
+};
+
+// ============================================================================
+// 直方图分桶
+// ============================================================================
+
+static int bucket_index(uint64_t v) {
+    if (v < 2 * SUB) {
+        return (int)v;
+    }
+    int shift = 63 - __builtin_clzll(v) - SUB_BITS;
+    return (shift + 1) * SUB + (int)((v >> shift) - SUB);
+}
+
+// 桶内代表值（区间中点）
+static double bucket_value(int idx) {
+    if (idx < 2 * SUB) {
+        return idx;
+    }
+    int shift = idx / SUB - 1;
+    double low = (double)((uint64_t)(idx % SUB + SUB) << shift);
+    return low + ((double)(1ull << shift) - 1) / 2;
+}
+
+static inline void bump(_Atomic uint64_t* x, uint64_t d) {
+    atomic_store_explicit(x, atomic_load_explicit(x, memory_order_relaxed) + d,
+                          memory_order_relaxed);
+}
+
+// ============================================================================
+// 注册
+// ============================================================================
+
+sm3_metrics_t* sm3_metrics_create(void) {
+    sm3_metrics_t* m = calloc(1, sizeof(*m));
+    if (!m) {
+        return NULL;
+    }
+    if (pthread_key_create(&m->key, NULL) != 0) {
+        free(m);
+        return NULL;
+    }
+    pthread_mutex_init(&m->lock, NULL);
+    m->listen_fd = -1;
+    m->wake[0] = m->wake[1] = -1;
+    return m;
+}
+
+static int valid_name(const char* s) {
+    if (!s || !*s || strlen(s) >= NAME_LEN) return 0;
+    for (const char* p = s; *p; p++) {
+        int alpha = (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || *p == '_' || *p == ':';
+        if (!alpha && !(p != s && *p >= '0' && *p <= '9')) return 0;
+    }
+    return 1;
+}
+
+static int register_metric(sm3_metrics_t* m, const char* name, const char* help, int type,
+                           double scale) {
+    if (!m || !valid_name(name)) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&m->lock);
+    int id = -1;
+    for (int i = 0; i < m->ndefs; i++) {
+        if (strcmp(m->defs[i].name, name) == 0) {
+            id = m->defs[i].type == type ? m->defs[i].id : -1;
+            pthread_mutex_unlock(&m->lock);
+            if (id < 0) errno = EEXIST;
+            return id;
+        }
+    }
+    int* n = type == T_COUNTER ? &m->ncounters : type == T_GAUGE ? &m->ngauges : &m->nhists;
+    int cap = type == T_COUNTER ? SM3_METRICS_MAX_COUNTERS
+            : type == T_GAUGE ? SM3_METRICS_MAX_GAUGES : SM3_METRICS_MAX_HISTOGRAMS;
+    if (*n < cap) {
+        metric_def_t* d = &m->defs[m->ndefs++];
+        snprintf(d->name, sizeof(d->name), "%s", name);
+        snprintf(d->help, sizeof(d->help), "%s", help ? help : "");
+        d->type = type;
+        d->id = id = (*n)++;
+        d->scale = scale;
+    } else {
+        errno = ENOSPC;
+    }
+    pthread_mutex_unlock(&m->lock);
+    return id;
+}
+
+int sm3_metrics_counter(sm3_metrics_t* m, const char* name, const char* help) {
+    return register_metric(m, name, help, T_COUNTER, 1.0);
+}
+
+int sm3_metrics_gauge(sm3_metrics_t* m, const char* name, const char* help) {
+    return register_metric(m, name, help, T_GAUGE, 1.0);
+}
+
+int sm3_metrics_histogram(sm3_metrics_t* m, const char* name, const char* help, double scale) {
+    return register_metric(m, name, help, T_HISTOGRAM, scale > 0 ? scale : 1.0);
+}
+
+int sm3_metrics_on_collect(sm3_metrics_t* m, sm3_metrics_collect_fn fn, void* ctx) {
+    pthread_mutex_lock(&m->lock);
+    int rc = -1;
+    if (m->ncollect < MAX_COLLECT) {
+        m->collect[m->ncollect].fn = fn;
+        m->collect[m->ncollect].ctx = ctx;
+        m->ncollect++;
+        rc = 0;
+    } else {
+        errno = ENOSPC;
+    }
+    pthread_mutex_unlock(&m->lock);
+    return rc;
+}
+
+void sm3_metrics_remove_collect(sm3_metrics_t* m, sm3_metrics_collect_fn fn, void* ctx) {
+    pthread_mutex_lock(&m->lock);
+    for (int i = 0; i < m->ncollect; i++) {
+        if (m->collect[i].fn == fn && m->collect[i].ctx == ctx) {
+            memmove(&m->collect[i], &m->collect[i + 1],
+                    (size_t)(m->ncollect - i - 1) * sizeof(m->collect[0]));
+            m->ncollect--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&m->lock);
+}
+
+// ============================================================================
+// 记录
+// ============================================================================
+
+static shard_t* thread_shard(sm3_metrics_t* m) {
+    shard_t* s = pthread_getspecific(m->key);
+    if (s) {
+        return s;
+    }
+    s = calloc(1, sizeof(*s));
+    if (!s) {
+        return NULL;
+    }
+    shard_t* head = atomic_load(&m->shards);
+    do {
+        s->next = head;
+    } while (!atomic_compare_exchange_weak(&m->shards, &head, s));
+    pthread_setspecific(m->key, s);
+    return s;
+}
+
+void sm3_metrics_add(sm3_metrics_t* m, int counter, uint64_t delta) {
+    if (!m || counter < 0 || counter >= SM3_METRICS_MAX_COUNTERS) return;
+    shard_t* s = thread_shard(m);
+    if (s) bump(&s->counters[counter], delta);
+}
+
+void sm3_metrics_set(sm3_metrics_t* m, int gauge, int64_t value) {
+    if (!m || gauge < 0 || gauge >= SM3_METRICS_MAX_GAUGES) return;
+    atomic_store_explicit(&m->gauges[gauge], value, memory_order_relaxed);
+}
+
+void sm3_metrics_record(sm3_metrics_t* m, int histogram, uint64_t value) {
+    if (!m || histogram < 0 || histogram >= SM3_METRICS_MAX_HISTOGRAMS) return;
+    shard_t* s = thread_shard(m);
+    if (!s) return;
+    hist_shard_t* h = atomic_load_explicit(&s->hists[histogram], memory_order_relaxed);
+    if (!h) {
+        h = calloc(1, sizeof(*h));
+        if (!h) return;
+        atomic_store_explicit(&s->hists[histogram], h, memory_order_release);
+    }
+    bump(&h->buckets[bucket_index(value)], 1);
+    bump(&h->sum, value);
+    if (value > atomic_load_explicit(&h->max, memory_order_relaxed)) {
+        atomic_store_explicit(&h->max, value, memory_order_relaxed);
+    }
+}
+
+// ============================================================================
+// 读取
+// ============================================================================
+
+uint64_t sm3_metrics_counter_value(sm3_metrics_t* m, int counter) {
+    if (!m || counter < 0 || counter >= SM3_METRICS_MAX_COUNTERS) return 0;
+    uint64_t v = 0;
+    for (shard_t* s = atomic_load(&m->shards); s; s = s->next) {
+        v += atomic_load_explicit(&s->counters[counter], memory_order_relaxed);
+    }
+    return v;
+}
+
+int64_t sm3_metrics_gauge_value(sm3_metrics_t* m, int gauge) {
+    if (!m || gauge < 0 || gauge >= SM3_METRICS_MAX_GAUGES) return 0;
+    return atomic_load_explicit(&m->gauges[gauge], memory_order_relaxed);
+}
+
+static double bucket_quantile(const uint64_t* b, uint64_t total, double q, uint64_t max) {
+    uint64_t target = (uint64_t)(q * (double)total + 0.999999);
+    if (target == 0) target = 1;
+    uint64_t acc = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        acc += b[i];
+        if (acc >= target) {
+            double v = bucket_value(i);
+            return v < (double)max ? v : (double)max;
+        }
+    }
+    return (double)max;
+}
+
+static int merge_hist(sm3_metrics_t* m, int histogram, double scale, sm3_hist_summary_t* out) {
+    uint64_t* b = calloc(BUCKETS, sizeof(uint64_t));
+    if (!b) {
+        return -1;
+    }
+    uint64_t sum = 0, max = 0, count = 0;
+    for (shard_t* s = atomic_load(&m->shards); s; s = s->next) {
+        hist_shard_t* h = atomic_load_explicit(&s->hists[histogram], memory_order_acquire);
+        if (!h) continue;
+        for (int i = 0; i < BUCKETS; i++) {
+            uint64_t c = atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+            b[i] += c;
+            count += c;
+        }
+        sum += atomic_load_explicit(&h->sum, memory_order_relaxed);
+        uint64_t hm = atomic_load_explicit(&h->max, memory_order_relaxed);
+        if (hm > max) max = hm;
+    }
+    out->count = count;
+    out->sum = (double)sum * scale;
+    out->max = (double)max * scale;
+    out->p50 = count ? bucket_quantile(b, count, 0.50, max) * scale : 0;
+    out->p90 = count ? bucket_quantile(b, count, 0.90, max) * scale : 0;
+    out->p99 = count ? bucket_quantile(b, count, 0.99, max) * scale : 0;
+    out->p999 = count ? bucket_quantile(b, count, 0.999, max) * scale : 0;
+    free(b);
+    return 0;
+}
+
+int sm3_metrics_hist_summary(sm3_metrics_t* m, int histogram, sm3_hist_summary_t* out) {
+    if (!m || histogram < 0 || histogram >= SM3_METRICS_MAX_HISTOGRAMS) {
+        errno = EINVAL;
+        return -1;
+    }
+    double scale = 1.0;
+    pthread_mutex_lock(&m->lock);
+    for (int i = 0; i < m->ndefs; i++) {
+        if (m->defs[i].type == T_HISTOGRAM && m->defs[i].id == histogram) scale = m->defs[i].scale;
+    }
+    pthread_mutex_unlock(&m->lock);
+    return merge_hist(m, histogram, scale, out);
+}
+
+long sm3_metrics_format(sm3_metrics_t* m, char** out) {
+    char* buf = NULL;
+    size_t len = 0;
+    FILE* f = open_memstream(&buf, &len);
+    if (!f) {
+        return -1;
+    }
+    pthread_mutex_lock(&m->lock);
+    for (int i = 0; i < m->ncollect; i++) {
+        m->collect[i].fn(m, m->collect[i].ctx);
+    }
+    int rc = 0;
+    for (int i = 0; i < m->ndefs && rc == 0; i++) {
+        const metric_def_t* d = &m->defs[i];
+        if (d->help[0]) fprintf(f, "# HELP %s %s\n", d->name, d->help);
+        if (d->type == T_COUNTER) {
+            fprintf(f, "# TYPE %s counter\n%s %llu\n", d->name, d->name,
+                    (unsigned long long)sm3_metrics_counter_value(m, d->id));
+        } else if (d->type == T_GAUGE) {
+            fprintf(f, "# TYPE %s gauge\n%s %lld\n", d->name, d->name,
+                    (long long)sm3_metrics_gauge_value(m, d->id));
+        } else {
+            sm3_hist_summary_t h;
+            if (merge_hist(m, d->id, d->scale, &h) != 0) {
+                rc = -1;
+                break;
+            }
+            fprintf(f, "# TYPE %s summary\n", d->name);
+            fprintf(f, "%s{quantile=\"0.5\"} %.9g\n", d->name, h.p50);
+            fprintf(f, "%s{quantile=\"0.9\"} %.9g\n", d->name, h.p90);
+            fprintf(f, "%s{quantile=\"0.99\"} %.9g\n", d->name, h.p99);
+            fprintf(f, "%s{quantile=\"0.999\"} %.9g\n", d->name, h.p999);
+            fprintf(f, "%s_sum %.9g\n%s_count %llu\n", d->name, h.sum, d->name,
+                    (unsigned long long)h.count);
+            fprintf(f, "# TYPE %s_max gauge\n%s_max %.9g\n", d->name, d->name, h.max);
+        }
+    }
+    pthread_mutex_unlock(&m->lock);
+    if (fclose(f) != 0) rc = -1;
+    if (rc != 0) {
+        free(buf);
+        return -1;
+    }
+    *out = buf;
+    return (long)len;
+}
+
+// ============================================================================
+// HTTP 端点
+// ============================================================================
+
+static int write_all(int fd, const char* p, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void handle_client(sm3_metrics_t* m, int fd) {
+    struct timeval tv = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char req[REQ_MAX + 1];
+    size_t got = 0;
+    while (got < REQ_MAX) {
+        ssize_t n = recv(fd, req + got, REQ_MAX - got, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+        req[got] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+    }
+    req[got] = '\0';
+
+    char head[160];
+    char* body = NULL;
+    long blen = 0;
+    const char* status = "200 OK";
+    if (strncmp(req, "GET ", 4) != 0) {
+        status = "405 Method Not Allowed";
+    } else if (strncmp(req + 4, "/metrics", 8) != 0 ||
+               (req[12] != ' ' && req[12] != '?')) {
+        status = "404 Not Found";
+    } else if ((blen = sm3_metrics_format(m, &body)) < 0) {
+        status = "500 Internal Server Error";
+        blen = 0;
+    }
+    int hl = snprintf(head, sizeof(head),
+                      "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                      "Content-Length: %ld\r\nConnection: close\r\n\r\n", status, blen);
+    if (write_all(fd, head, (size_t)hl) == 0 && blen > 0) {
+        write_all(fd, body, (size_t)blen);
+    }
+    free(body);
+}
+
+static void* serve_main(void* arg) {
+    sm3_metrics_t* m = arg;
+    struct pollfd pfd[2] = { { m->listen_fd, POLLIN, 0 }, { m->wake[0], POLLIN, 0 } };
+    for (;;) {
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (pfd[1].revents) {
+            break;
+        }
+        if (pfd[0].revents & POLLIN) {
+            int fd = accept4(m->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                handle_client(m, fd);
+                close(fd);
+            }
+        }
+    }
+    return NULL;
+}
+
+int sm3_metrics_serve(sm3_metrics_t* m, int port) {
+    if (m->serving || port < 0 || port > 65535) {
+        errno = m->serving ? EBUSY : EINVAL;
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t alen = sizeof(addr);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0 ||
+        getsockname(fd, (struct sockaddr*)&addr, &alen) != 0 || pipe2(m->wake, O_CLOEXEC) != 0) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        return -1;
+    }
+    m->listen_fd = fd;
+    if (pthread_create(&m->server, NULL, serve_main, m) != 0) {
+        close(fd);
+        close(m->wake[0]);
+        close(m->wake[1]);
+        m->listen_fd = m->wake[0] = m->wake[1] = -1;
+        errno = EAGAIN;
+        return -1;
+    }
+    m->serving = 1;
+    return ntohs(addr.sin_port);
+}
+
+void sm3_metrics_destroy(sm3_metrics_t* m) {
+    if (!m) {
+        return;
+    }
+    if (m->serving) {
+        char c = 1;
+        ssize_t w = write(m->wake[1], &c, 1);
+        (void)w;
+        pthread_join(m->server, NULL);
+        close(m->listen_fd);
+        close(m->wake[0]);
+        close(m->wake[1]);
+    }
+    shard_t* s = atomic_load(&m->shards);
+    while (s) {
+        shard_t* next = s->next;
+        for (int i = 0; i < SM3_METRICS_MAX_HISTOGRAMS; i++) free(atomic_load(&s->hists[i]));
+        free(s);
+        s = next;
+    }
+    pthread_key_delete(m->key);
+    pthread_mutex_destroy(&m->lock);
+    free(m);
+}
@@ -0,0 +1,76 @@
+/*
+ * 运行指标：计数器、仪表与 HDR 延迟直方图
+ *
+ * 摘要计算作为常驻服务或嵌入存储引擎运行时的运维指标。
+ *   - 计数器与直方图按线程分片：每个线程首次记录时分配自己的分片，
+ *     之后只由该线程写入（无锁、无原子读改写指令），采集时合并全部分片
+ *   - 仪表（如队列深度）为单个原子值
+ *   - 直方图为对数-线性分桶（HDR）：小于64的值精确记录，其余值相对误差
+ *     不超过 1/64，覆盖完整的 uint64 范围
+ *
+ * 导出：
+ *   - sm3_metrics_format 生成 Prometheus 文本格式；直方图导出为 summary
+ *     （P50/P90/P99/P99.9 分位数、_sum、_count）及 <名称>_max 仪表
+ *   - sm3_metrics_serve 在 127.0.0.1 上启动 HTTP 端点，GET /metrics 返回上述文本
+ *   - C 接口直接读取计数值与直方图分位数
+ *
+ * 指标可在任意时刻注册（同名同类型重复注册返回已有编号）。
+ * 采集前依次调用已登记的采集回调，用于更新只在采集时才需要计算的仪表。
+ */
+
+#ifndef SM3_METRICS_H
+#define SM3_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SM3_METRICS_MAX_COUNTERS    64
+#define SM3_METRICS_MAX_GAUGES      32
+#define SM3_METRICS_MAX_HISTOGRAMS  16
+
+typedef struct sm3_metrics sm3_metrics_t;
+
+typedef struct {
+    uint64_t count;
+    double sum;                 // 已乘以 scale
+    double max;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+} sm3_hist_summary_t;
+
+// 采集前调用（可在其中调用 sm3_metrics_set 等）
+typedef void (*sm3_metrics_collect_fn)(sm3_metrics_t* m, void* ctx);
+
+sm3_metrics_t* sm3_metrics_create(void);
+// 停止 HTTP 端点并释放；须在所有记录线程不再使用之后调用
+void sm3_metrics_destroy(sm3_metrics_t* m);
+
+// 注册指标，返回编号；名称须符合 Prometheus 命名规则。超出容量或
+// 同名不同类型返回 -1
+int sm3_metrics_counter(sm3_metrics_t* m, const char* name, const char* help);
+int sm3_metrics_gauge(sm3_metrics_t* m, const char* name, const char* help);
+// scale：导出时乘以的系数（如记录纳秒、以秒导出时为 1e-9）
+int sm3_metrics_histogram(sm3_metrics_t* m, const char* name, const char* help, double scale);
+int sm3_metrics_on_collect(sm3_metrics_t* m, sm3_metrics_collect_fn fn, void* ctx);
+void sm3_metrics_remove_collect(sm3_metrics_t* m, sm3_metrics_collect_fn fn, void* ctx);
+
+// 记录（m 为 NULL 或编号为负时忽略）
+void sm3_metrics_add(sm3_metrics_t* m, int counter, uint64_t delta);
+void sm3_metrics_set(sm3_metrics_t* m, int gauge, int64_t value);
+void sm3_metrics_record(sm3_metrics_t* m, int histogram, uint64_t value);
+
+// 读取合并后的值（不触发采集回调）
+uint64_t sm3_metrics_counter_value(sm3_metrics_t* m, int counter);
+int64_t sm3_metrics_gauge_value(sm3_metrics_t* m, int gauge);
+int sm3_metrics_hist_summary(sm3_metrics_t* m, int histogram, sm3_hist_summary_t* out);
+
+// 生成 Prometheus 文本（调用方 free），返回长度，失败返回 -1
+long sm3_metrics_format(sm3_metrics_t* m, char** out);
+
+// 在 127.0.0.1:port 上提供 GET /metrics（port 为 0 时自动选择），
+// 返回实际端口，失败返回 -1
+int sm3_metrics_serve(sm3_metrics_t* m, int port);
+
+#endif // SM3_METRICS_H
@@ -0,0 +1,448 @@
+/*
+ * 由页摘要计算 MinHash 签名与 LSH 候选对检索
+ *
+ * 累积按批进行：先取出一批摘要的前64位，再对每组4个哈希函数遍历整批，
+ * 4个当前最小值保持在寄存器中。
+ * LSH 索引为一张开链哈希表，键为 (段号, 段内值) 的64位混合，链上比较
+ * 原始签名段，键冲突不会产生错误候选。
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sm3_manifest.h"
+#include "sm3_minhash.h"
+
+#define BATCH   1024                // 每批摘要数
+
+static uint64_t g_salt[SM3_MINHASH_MAX_K];
+static uint64_t g_mul[SM3_MINHASH_MAX_K];
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+
+static uint64_t splitmix64(uint64_t* s) {
+    uint64_t z = (*s += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// 哈希函数参数固定，不同进程、不同机器生成的签名可直接比较
+static void params_init(void) {
+    uint64_t s = 0x534D334D494E4832ull;     // "SM3MINH2"
+    for (int i = 0; i < SM3_MINHASH_MAX_K; i++) {
+        g_salt[i] = splitmix64(&s);
+        g_mul[i] = splitmix64(&s) | 1;
+    }
+}
+
+int sm3_minhash_init(sm3_minhash_t* mh, int k) {
+    if (k < 4 || k > SM3_MINHASH_MAX_K || k % 4) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_once(&g_once, params_init);
+    mh->k = k;
+    mh->pages = 0;
+    memset(mh->mins, 0xff, sizeof(mh->mins));
+    return 0;
+}
+
+static void update_batch(sm3_minhash_t* mh, const uint64_t* x, int n) {
+    for (int i = 0; i < mh->k; i += 4) {
+        uint64_t mn[4];
+        memcpy(mn, &mh->mins[i], sizeof(mn));
+        for (int j = 0; j < n; j++) {
+            for (int l = 0; l < 4; l++) {
+                uint64_t v = (x[j] ^ g_salt[i + l]) * g_mul[i + l];
+                v ^= v >> 32;
+                mn[l] = v < mn[l] ? v : mn[l];
+            }
+        }
+        memcpy(&mh->mins[i], mn, sizeof(mn));
+    }
+}
+
+void sm3_minhash_update(sm3_minhash_t* mh, const uint8_t* digests, uint64_t count, int digest_size) {
+    uint64_t x[BATCH];
+    for (uint64_t i = 0; i < count; i += BATCH) {
+        int n = count - i < BATCH ? (int)(count - i) : BATCH;
+        const uint8_t* d = digests + i * (uint64_t)digest_size;
+        for (int j = 0; j < n; j++, d += digest_size) memcpy(&x[j], d, 8);
+        update_batch(mh, x, n);
+    }
+    mh->pages += count;
+}
+
+void sm3_minhash_merge(sm3_minhash_t* mh, const sm3_minhash_t* other) {
+    for (int i = 0; i < mh->k; i++) {
+        if (other->mins[i] < mh->mins[i]) mh->mins[i] = other->mins[i];
+    }
+    mh->pages += other->pages;
+}
+
+double sm3_minhash_similarity(const sm3_minhash_t* a, const sm3_minhash_t* b) {
+    if (a->k != b->k || !a->pages || !b->pages) {
+        return 0.0;
+    }
+    int eq = 0;
+    for (int i = 0; i < a->k; i++) eq += a->mins[i] == b->mins[i];
+    return (double)eq / a->k;
+}
+
+size_t sm3_minhash_packed_size(int k, int bits) {
+    return ((size_t)k * (size_t)bits + 7) / 8;
+}
+
+void sm3_minhash_pack(const sm3_minhash_t* mh, int bits, uint8_t* out) {
+    memset(out, 0, sm3_minhash_packed_size(mh->k, bits));
+    size_t pos = 0;
+    for (int i = 0; i < mh->k; i++) {
+        uint32_t v = (uint32_t)mh->mins[i] & ((1u << bits) - 1);
+        for (int b = 0; b < bits; b++, pos++) {
+            out[pos >> 3] |= (uint8_t)(((v >> b) & 1) << (pos & 7));
+        }
+    }
+}
+
+static uint32_t unpack(const uint8_t* p, int i, int bits) {
+    size_t pos = (size_t)i * (size_t)bits;
+    uint32_t v = 0;
+    for (int b = 0; b < bits; b++, pos++) v |= (uint32_t)((p[pos >> 3] >> (pos & 7)) & 1) << b;
+    return v;
+}
+
+double sm3_minhash_similarity_packed(const uint8_t* a, const uint8_t* b, int k, int bits) {
+    int eq = 0;
+    for (int i = 0; i < k; i++) eq += unpack(a, i, bits) == unpack(b, i, bits);
+    // 低 bits 位偶然相等的概率约为 2^-bits
+    double c = 1.0 / (double)(1u << bits);
+    double j = ((double)eq / k - c) / (1.0 - c);
+    return j < 0.0 ? 0.0 : j > 1.0 ? 1.0 : j;
+}
+
+// ============================================================================
+// 签名文件
+// ============================================================================
+
+// 签名文件各字段固定为小端，不同字节序的机器之间可直接交换
+static void put_le(uint8_t* p, uint64_t v, int n) {
+    for (int i = 0; i < n; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint64_t get_le(const uint8_t* p, int n) {
+    uint64_t v = 0;
+    for (int i = 0; i < n; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+#define SIG_HEADER  24
+
+// 写临时文件 + fdatasync + rename 原子替换，崩溃时不会留下截断的签名
+int sm3_minhash_save(const sm3_minhash_t* mh, const char* path) {
+    size_t len = SIG_HEADER + (size_t)mh->k * 8;
+    uint8_t* buf = calloc(1, len);
+    size_t plen = strlen(path);
+    char* tmp = malloc(plen + 5);
+    if (!buf || !tmp) {
+        free(buf);
+        free(tmp);
+        return -1;
+    }
+    memcpy(buf, SM3_MINHASH_MAGIC, 8);
+    put_le(buf + 8, (uint64_t)mh->k, 4);
+    put_le(buf + 16, mh->pages, 8);
+    for (int i = 0; i < mh->k; i++) put_le(buf + SIG_HEADER + (size_t)i * 8, mh->mins[i], 8);
+    memcpy(tmp, path, plen);
+    memcpy(tmp + plen, ".tmp", 5);
+
+    int rc = -1;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = write(fd, buf + done, len - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += (size_t)n;
+        }
+        if (done == len && fdatasync(fd) == 0) {
+            rc = 0;
+        }
+        close(fd);
+        if (rc == 0 && rename(tmp, path) != 0) {
+            rc = -1;
+        }
+        if (rc != 0) {
+            unlink(tmp);
+        } else {
+            char* dir = strdup(path);
+            int dfd = dir ? open(dirname(dir), O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+            if (dfd >= 0) {
+                fsync(dfd);
+                close(dfd);
+            }
+            free(dir);
+        }
+    }
+    free(tmp);
+    free(buf);
+    return rc;
+}
+
+int sm3_minhash_load(sm3_minhash_t* mh, const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return -1;
+    }
+    uint8_t h[SIG_HEADER], v[8];
+    int ok = fread(h, sizeof(h), 1, f) == 1 && memcmp(h, SM3_MINHASH_MAGIC, 8) == 0 &&
+             sm3_minhash_init(mh, (int)get_le(h + 8, 4)) == 0;
+    for (int i = 0; ok && i < mh->k; i++) {
+        ok = fread(v, 8, 1, f) == 1;
+        mh->mins[i] = get_le(v, 8);
+    }
+    fclose(f);
+    if (!ok) {
+        errno = EINVAL;
+        return -1;
+    }
+    mh->pages = get_le(h + 16, 8);
+    return 0;
+}
+
+int sm3_minhash_from_manifest(sm3_minhash_t* mh, int k, const char* manifest_path) {
+    if (sm3_minhash_init(mh, k) != 0) {
+        return -1;
+    }
+    sm3_manifest_t m;
+    if (sm3_manifest_open(&m, manifest_path, 0) != 0) {
+        return -1;
+    }
+    sm3_minhash_update(mh, m.digests, m.hdr->page_count, (int)m.hdr->digest_size);
+    sm3_manifest_close(&m);
+    return 0;
+}
+
+// ============================================================================
+// LSH 索引
+// ============================================================================
+
+#define NIL UINT32_MAX
+
+typedef struct {
+    uint64_t key;
+    uint32_t id;
+    uint32_t band;
+    uint32_t next;
+} entry_t;
+
+struct sm3_lsh {
+    int k;
+    int bands;
+    int rows;
+    sm3_minhash_t* sigs;
+    size_t count;
+    size_t cap;
+    entry_t* entries;
+    size_t nentries;
+    uint32_t* heads;
+    size_t nheads;                  // 2的幂
+};
+
+static uint64_t band_key(const uint64_t* v, int rows, int band) {
+    uint64_t h = 0x6C62272E07BB0142ull ^ (uint64_t)band;
+    for (int r = 0; r < rows; r++) {
+        h = (h ^ v[r]) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+sm3_lsh_t* sm3_lsh_create(int k, int bands) {
+    if (k < 4 || k > SM3_MINHASH_MAX_K || bands <= 0 || k % bands) {
+        errno = EINVAL;
+        return NULL;
+    }
+    sm3_lsh_t* lsh = calloc(1, sizeof(*lsh));
+    if (!lsh) {
+        return NULL;
+    }
+    lsh->k = k;
+    lsh->bands = bands;
+    lsh->rows = k / bands;
+    return lsh;
+}
+
+void sm3_lsh_destroy(sm3_lsh_t* lsh) {
+    if (!lsh) {
+        return;
+    }
+    free(lsh->sigs);
+    free(lsh->entries);
+    free(lsh->heads);
+    free(lsh);
+}
+
+size_t sm3_lsh_size(const sm3_lsh_t* lsh) {
+    return lsh->count;
+}
+
+static int rehash(sm3_lsh_t* lsh, size_t nheads) {
+    uint32_t* heads = malloc(nheads * sizeof(uint32_t));
+    if (!heads) {
+        return -1;
+    }
+    memset(heads, 0xff, nheads * sizeof(uint32_t));
+    for (size_t i = 0; i < lsh->nentries; i++) {
+        size_t b = lsh->entries[i].key & (nheads - 1);
+        lsh->entries[i].next = heads[b];
+        heads[b] = (uint32_t)i;
+    }
+    free(lsh->heads);
+    lsh->heads = heads;
+    lsh->nheads = nheads;
+    return 0;
+}
+
+int sm3_lsh_add(sm3_lsh_t* lsh, const sm3_minhash_t* mh) {
+    if (mh->k != lsh->k) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (lsh->count == lsh->cap) {
+        size_t cap = lsh->cap ? lsh->cap * 2 : 64;
+        sm3_minhash_t* sigs = realloc(lsh->sigs, cap * sizeof(sm3_minhash_t));
+        entry_t* entries = sigs ? realloc(lsh->entries, cap * (size_t)lsh->bands * sizeof(entry_t)) : NULL;
+        if (sigs) lsh->sigs = sigs;
+        if (!entries) {
+            errno = ENOMEM;
+            return -1;
+        }
+        lsh->entries = entries;
+        lsh->cap = cap;
+    }
+    if (lsh->nentries + (size_t)lsh->bands > lsh->nheads / 2 &&
+        rehash(lsh, lsh->nheads ? lsh->nheads * 2 : 256) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    uint32_t id = (uint32_t)lsh->count++;
+    lsh->sigs[id] = *mh;
+    for (int b = 0; b < lsh->bands; b++) {
+        entry_t* e = &lsh->entries[lsh->nentries];
+        e->key = band_key(&mh->mins[b * lsh->rows], lsh->rows, b);
+        e->id = id;
+        e->band = (uint32_t)b;
+        size_t h = e->key & (lsh->nheads - 1);
+        e->next = lsh->heads[h];
+        lsh->heads[h] = (uint32_t)lsh->nentries++;
+    }
+    return (int)id;
+}
+
+// 条目 e 的段与签名 v 的第 band 段是否相同
+static int same_band(const sm3_lsh_t* lsh, const entry_t* e, uint64_t key, int band, const uint64_t* v) {
+    return e->key == key && e->band == (uint32_t)band &&
+           memcmp(&lsh->sigs[e->id].mins[band * lsh->rows], v, (size_t)lsh->rows * sizeof(uint64_t)) == 0;
+}
+
+static int cmp_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+size_t sm3_lsh_query(const sm3_lsh_t* lsh, const sm3_minhash_t* mh, uint32_t* ids, size_t max) {
+    if (mh->k != lsh->k || !lsh->nheads) {
+        return 0;
+    }
+    size_t n = 0, cap = 0;
+    uint32_t* found = NULL;
+    for (int b = 0; b < lsh->bands; b++) {
+        const uint64_t* v = &mh->mins[b * lsh->rows];
+        uint64_t key = band_key(v, lsh->rows, b);
+        for (uint32_t i = lsh->heads[key & (lsh->nheads - 1)]; i != NIL; i = lsh->entries[i].next) {
+            if (!same_band(lsh, &lsh->entries[i], key, b, v)) continue;
+            if (n == cap) {
+                cap = cap ? cap * 2 : 64;
+                uint32_t* p = realloc(found, cap * sizeof(uint32_t));
+                if (!p) {
+                    free(found);
+                    return 0;
+                }
+                found = p;
+            }
+            found[n++] = lsh->entries[i].id;
+        }
+    }
+    qsort(found, n, sizeof(uint32_t), cmp_u32);
+    size_t u = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i == 0 || found[i] != found[i - 1]) {
+            if (u < max) ids[u] = found[i];
+            u++;
+        }
+    }
+    free(found);
+    return u;
+}
+
+static int cmp_pair_ids(const void* a, const void* b) {
+    const sm3_lsh_pair_t* x = a;
+    const sm3_lsh_pair_t* y = b;
+    if (x->a != y->a) return x->a < y->a ? -1 : 1;
+    return x->b < y->b ? -1 : x->b > y->b;
+}
+
+static int cmp_pair_sim(const void* a, const void* b) {
+    const sm3_lsh_pair_t* x = a;
+    const sm3_lsh_pair_t* y = b;
+    if (x->similarity != y->similarity) return x->similarity > y->similarity ? -1 : 1;
+    return cmp_pair_ids(a, b);
+}
+
+int sm3_lsh_pairs(const sm3_lsh_t* lsh, double threshold, sm3_lsh_pair_t** pairs, size_t* count) {
+    size_t n = 0, cap = 0;
+    sm3_lsh_pair_t* out = NULL;
+    for (size_t i = 0; i < lsh->nentries; i++) {
+        const entry_t* e = &lsh->entries[i];
+        const uint64_t* v = &lsh->sigs[e->id].mins[e->band * (uint32_t)lsh->rows];
+        // 只与先加入的条目配对（链上排在其后）
+        for (uint32_t j = e->next; j != NIL; j = lsh->entries[j].next) {
+            if (!same_band(lsh, &lsh->entries[j], e->key, (int)e->band, v)) continue;
+            if (n == cap) {
+                cap = cap ? cap * 2 : 256;
+                sm3_lsh_pair_t* p = realloc(out, cap * sizeof(*p));
+                if (!p) {
+                    free(out);
+                    errno = ENOMEM;
+                    return -1;
+                }
+                out = p;
+            }
+            out[n].a = lsh->entries[j].id;
+            out[n].b = e->id;
+            n++;
+        }
+    }
+    qsort(out, n, sizeof(*out), cmp_pair_ids);
+    size_t u = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0 && out[i].a == out[i - 1].a && out[i].b == out[i - 1].b) continue;
+        double s = sm3_minhash_similarity(&lsh->sigs[out[i].a], &lsh->sigs[out[i].b]);
+        if (s < threshold) continue;
+        out[u] = out[i];
+        out[u].similarity = s;
+        u++;
+    }
+    qsort(out, u, sizeof(*out), cmp_pair_sim);
+    *pairs = out;
+    *count = u;
+    return 0;
+}
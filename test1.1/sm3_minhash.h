@@ -0,0 +1,78 @@
+/*
+ * 由页摘要计算 MinHash 签名与 LSH 候选对检索
+ *
+ * 把一个镜像/数据集看作其页摘要的集合，两个集合的 Jaccard 相似度
+ * |A∩B| / |A∪B| 即相同页所占比例。页摘要本身已近似均匀分布，MinHash 不再
+ * 读取页数据：第 i 个哈希函数取 h_i(x) = mix(x ^ s_i)（x 为摘要前64位，
+ * mix 为64位乘法与移位构成的双射），签名为各 h_i 在全部页上的最小值。
+ * 键与哈希值都取64位：虚拟机镜像规模（约10^8页）下32位会有大量不同页
+ * 偶然相同，使相似度估计偏高。每页的 k 个哈希值与当前签名逐元素取最小，
+ * 生成清单时可随分块同步累积（sm3_scan_opts_t.minhash），几乎不增加开销。
+ *
+ * 两个签名相同位置值相等的比例是 Jaccard 相似度的无偏估计，标准差约
+ * sqrt(J(1-J)/k)。存储时可只保留每个值的低 b 位（b-bit MinHash），
+ * 偶然相等的概率约为 2^-b，估计时扣除。
+ *
+ * LSH：签名分为 bands 段，每段 rows = k/bands 个值；任一段完全相同的两个
+ * 签名成为候选对。相似度为 J 的两个集合成为候选的概率为 1-(1-J^rows)^bands，
+ * 阈值约在 (1/bands)^(1/rows) 附近。
+ */
+
+#ifndef SM3_MINHASH_H
+#define SM3_MINHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SM3_MINHASH_MAX_K   256
+#define SM3_MINHASH_MAGIC   "SM3MINH2"
+
+typedef struct sm3_minhash {
+    int k;                          // 哈希函数个数（4的倍数，不超过 SM3_MINHASH_MAX_K）
+    uint64_t pages;                 // 已累积的页数
+    uint64_t mins[SM3_MINHASH_MAX_K];
+} sm3_minhash_t;
+
+// k 取 4 的倍数，范围 [4, SM3_MINHASH_MAX_K]，否则返回 -1（EINVAL）
+int sm3_minhash_init(sm3_minhash_t* mh, int k);
+// 累积 count 个紧密排列的摘要（digest_size: 16 或 32 字节）
+void sm3_minhash_update(sm3_minhash_t* mh, const uint8_t* digests, uint64_t count, int digest_size);
+// 并入另一个签名（k 相同）：等价于两者页集合的并集
+void sm3_minhash_merge(sm3_minhash_t* mh, const sm3_minhash_t* other);
+double sm3_minhash_similarity(const sm3_minhash_t* a, const sm3_minhash_t* b);
+
+// b-bit 签名：每个值保留低 bits 位（1..16），紧密打包，占 (k*bits+7)/8 字节
+size_t sm3_minhash_packed_size(int k, int bits);
+void sm3_minhash_pack(const sm3_minhash_t* mh, int bits, uint8_t* out);
+double sm3_minhash_similarity_packed(const uint8_t* a, const uint8_t* b, int k, int bits);
+
+// 签名文件：8字节魔数 + k(u32) + 保留(u32) + 页数(u64) + k 个u64，均为小端；
+// 保存经临时文件原子替换
+int sm3_minhash_save(const sm3_minhash_t* mh, const char* path);
+int sm3_minhash_load(sm3_minhash_t* mh, const char* path);
+// 由已有清单计算签名
+int sm3_minhash_from_manifest(sm3_minhash_t* mh, int k, const char* manifest_path);
+
+// ============================================================================
+// LSH 索引
+// ============================================================================
+
+typedef struct sm3_lsh sm3_lsh_t;
+
+typedef struct {
+    uint32_t a, b;                  // 条目编号，a < b
+    double similarity;              // 签名估计的 Jaccard 相似度
+} sm3_lsh_pair_t;
+
+// bands 须整除 k
+sm3_lsh_t* sm3_lsh_create(int k, int bands);
+void sm3_lsh_destroy(sm3_lsh_t* lsh);
+// 加入签名（复制保存），返回条目编号（从0递增）；失败返回 -1
+int sm3_lsh_add(sm3_lsh_t* lsh, const sm3_minhash_t* mh);
+size_t sm3_lsh_size(const sm3_lsh_t* lsh);
+// 与 mh 至少有一段相同的条目，编号升序写入 ids（最多 max 个），返回总数
+size_t sm3_lsh_query(const sm3_lsh_t* lsh, const sm3_minhash_t* mh, uint32_t* ids, size_t max);
+// 全部候选对中估计相似度不低于 threshold 的，按相似度降序；*pairs 由调用方 free
+int sm3_lsh_pairs(const sm3_lsh_t* lsh, double threshold, sm3_lsh_pair_t** pairs, size_t* count);
+
+#endif // SM3_MINHASH_H
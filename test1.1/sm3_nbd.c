@@ -0,0 +1,1271 @@
+/*
+ * 带页级完整性标签的 NBD 块设备服务端
+ *
+ * 执行线程按"段"处理一批请求：相邻的同类请求（读 / 写 / 刷新）为一段，
+ * 段内各请求涉及的页去重排序后存放在批缓冲区中，同一请求的页在缓冲区内
+ * 连续，回复数据可直接从缓冲区发送。
+ *
+ * 写段的新标签先追加到摘要日志并提交，之后才写数据、更新 mmap 标签文件，
+ * 因此任何已可能落盘的数据页在日志中都有记录。打开时重放日志，再逐页核对
+ * 日志涉及的页：数据与标签不符的页（写入未落盘或写了一半）按现有数据重建
+ * 标签。这些页在崩溃前都有未经 FLUSH 的写入，块设备语义下其内容本就不确定。
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+#include "sm3_journal.h"
+#include "sm3_manifest.h"
+#include "sm3_nbd.h"
+#include "sm3_pool.h"
+#include "sm3_store.h"
+
+#define NBD_MAGIC               0x4e42444d41474943ull   // "NBDMAGIC"
+#define NBD_OPTS_MAGIC          0x49484156454f5054ull   // "IHAVEOPT"
+#define NBD_REP_MAGIC           0x0003e889045565a9ull
+#define NBD_REQUEST_MAGIC       0x25609513u
+#define NBD_REPLY_MAGIC         0x67446698u
+
+#define NBD_FLAG_FIXED_NEWSTYLE (1 << 0)
+#define NBD_FLAG_NO_ZEROES      (1 << 1)
+
+#define NBD_FLAG_HAS_FLAGS      (1 << 0)
+#define NBD_FLAG_READ_ONLY      (1 << 1)
+#define NBD_FLAG_SEND_FLUSH     (1 << 2)
+#define NBD_FLAG_SEND_FUA       (1 << 3)
+#define NBD_FLAG_SEND_WRITE_ZEROES (1 << 6)
+
+#define NBD_OPT_EXPORT_NAME     1
+#define NBD_OPT_ABORT           2
+#define NBD_OPT_LIST            3
+#define NBD_OPT_INFO            6
+#define NBD_OPT_GO              7
+
+#define NBD_REP_ACK             1
+#define NBD_REP_SERVER          2
+#define NBD_REP_INFO            3
+#define NBD_REP_ERR_UNSUP       0x80000001u
+#define NBD_REP_ERR_INVALID     0x80000003u
+
+#define NBD_INFO_EXPORT         0
+#define NBD_INFO_BLOCK_SIZE     3
+
+#define NBD_EPERM               1
+#define NBD_EIO                 5
+#define NBD_ENOMEM              12
+#define NBD_EINVAL              22
+#define NBD_ENOSPC              28
+
+#define MAX_OPTION_LEN          4096
+#define BATCH_BYTES             (64u << 20)     // 一批请求的数据总量上限
+#define MB_GROUP                64              // 单次批量接口调用的最大页数
+#define POOL_GRAIN              16
+#define RECOVER_PAGES           4096            // 恢复时每次核对的页数
+#define JOURNAL_COMPACT_BYTES   (64u << 20)     // FLUSH 时日志超过该大小即压缩
+
+typedef struct {
+    uint16_t flags;
+    uint16_t type;
+    uint64_t handle;
+    uint64_t offset;
+    uint32_t length;
+    uint32_t error;             // 非0时不执行，直接回复该错误
+    uint8_t* data;              // 写入数据
+} nbd_req_t;
+
+struct sm3_nbd {
+    sm3_nbd_opts_t opts;
+    int fd;
+    uint64_t size;
+    int digest_size;
+    sm3_manifest_t tags;
+    int have_tags;
+    sm3_journal_t* journal;     // 可写且启用完整性时
+    uint8_t* journaled;         // 位图：上次压缩后日志中已有提交记录的页
+    sm3_pool_t* pool;
+    sm3_nbd_stats_t stats;
+    volatile sig_atomic_t* stop;
+
+    // 段缓冲区：去重后的页号（升序）及其数据、标签、校验结果
+    uint64_t* pages;
+    uint8_t* buf;
+    uint8_t* tagbuf;
+    uint8_t* ok;
+    uint8_t* need;              // 写段：需要先读出原页
+    uint32_t* idx;
+    size_t np;                  // 当前段的页数
+    size_t cap;
+};
+
+// ============================================================================
+// 字节序与套接字读写
+// ============================================================================
+
+static void put16(uint8_t* p, uint16_t v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+static void put32(uint8_t* p, uint32_t v) { put16(p, (uint16_t)(v >> 16)); put16(p + 2, (uint16_t)v); }
+static void put64(uint8_t* p, uint64_t v) { put32(p, (uint32_t)(v >> 32)); put32(p + 4, (uint32_t)v); }
+static uint16_t get16(const uint8_t* p) { return (uint16_t)(p[0] << 8 | p[1]); }
+static uint32_t get32(const uint8_t* p) { return (uint32_t)get16(p) << 16 | get16(p + 2); }
+static uint64_t get64(const uint8_t* p) { return (uint64_t)get32(p) << 32 | get32(p + 4); }
+
+static int read_full(int fd, void* buf, size_t len) {
+    uint8_t* p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = ECONNRESET;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int send_iov(int fd, struct iovec* iov, int cnt) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    while (cnt > 0) {
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)cnt;
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+static int send_full(int fd, const void* buf, size_t len) {
+    struct iovec iov = { (void*)buf, len };
+    return send_iov(fd, &iov, 1);
+}
+
+// ============================================================================
+// 段执行
+// ============================================================================
+
+static int ensure_cap(sm3_nbd_t* nbd, size_t n) {
+    if (n <= nbd->cap) {
+        return 0;
+    }
+    size_t cap = nbd->cap ? nbd->cap : 256;
+    while (cap < n) cap *= 2;
+    uint64_t* pages = realloc(nbd->pages, cap * sizeof(uint64_t));
+    if (pages) nbd->pages = pages;
+    uint32_t* idx = realloc(nbd->idx, cap * sizeof(uint32_t));
+    if (idx) nbd->idx = idx;
+    uint8_t* ok = realloc(nbd->ok, cap);
+    if (ok) nbd->ok = ok;
+    uint8_t* need = realloc(nbd->need, cap);
+    if (need) nbd->need = need;
+    uint8_t* tagbuf = realloc(nbd->tagbuf, cap * 32);
+    if (tagbuf) nbd->tagbuf = tagbuf;
+    uint8_t* buf = aligned_alloc(SM3_PAGE_SIZE, cap * SM3_PAGE_SIZE);
+    if (!pages || !idx || !ok || !need || !tagbuf || !buf) {
+        free(buf);
+        return -1;
+    }
+    free(nbd->buf);
+    nbd->buf = buf;
+    nbd->cap = cap;
+    return 0;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// 段内请求涉及的页去重排序，返回页数
+static size_t collect_pages(sm3_nbd_t* nbd, nbd_req_t** reqs, int n, int* err) {
+    size_t total = 0;
+    for (int i = 0; i < n; i++) {
+        if (reqs[i]->error || !reqs[i]->length) continue;
+        total += (reqs[i]->offset + reqs[i]->length - 1) / SM3_PAGE_SIZE - reqs[i]->offset / SM3_PAGE_SIZE + 1;
+    }
+    nbd->np = 0;
+    if (ensure_cap(nbd, total) != 0) {
+        *err = NBD_ENOMEM;
+        return 0;
+    }
+    size_t np = 0;
+    for (int i = 0; i < n; i++) {
+        if (reqs[i]->error || !reqs[i]->length) continue;
+        uint64_t last = (reqs[i]->offset + reqs[i]->length - 1) / SM3_PAGE_SIZE;
+        for (uint64_t p = reqs[i]->offset / SM3_PAGE_SIZE; p <= last; p++) nbd->pages[np++] = p;
+    }
+    qsort(nbd->pages, np, sizeof(uint64_t), cmp_u64);
+    size_t k = 0;
+    for (size_t i = 0; i < np; i++) {
+        if (k == 0 || nbd->pages[i] != nbd->pages[k - 1]) nbd->pages[k++] = nbd->pages[i];
+    }
+    *err = 0;
+    nbd->np = k;
+    return k;
+}
+
+static size_t page_index(const sm3_nbd_t* nbd, size_t np, uint64_t page) {
+    const uint64_t* p = bsearch(&page, nbd->pages, np, sizeof(uint64_t), cmp_u64);
+    return (size_t)(p - nbd->pages);
+}
+
+// 读出 nbd->idx[0..n) 所指的页（相邻页合并为一次读取）
+static int read_indexed(sm3_nbd_t* nbd, size_t n) {
+    uint64_t t0 = sm3_now_ns();
+    for (size_t i = 0; i < n; ) {
+        size_t j = i + 1;
+        while (j < n && nbd->idx[j] == nbd->idx[j - 1] + 1 &&
+               nbd->pages[nbd->idx[j]] == nbd->pages[nbd->idx[j - 1]] + 1) {
+            j++;
+        }
+        uint64_t bytes;
+        if (sm3_read_pages(nbd->fd, nbd->buf + (size_t)nbd->idx[i] * SM3_PAGE_SIZE,
+                           nbd->pages[nbd->idx[i]], j - i, nbd->size, &bytes) != 0) {
+            return -1;
+        }
+        i = j;
+    }
+    nbd->stats.io_ns += sm3_now_ns() - t0;
+    return 0;
+}
+
+typedef struct {
+    sm3_nbd_t* nbd;
+    int bits;
+} page_job_t;
+
+// 校验 idx[begin..end) 所指的页
+static void verify_chunk(void* ctx, size_t begin, size_t end) {
+    page_job_t* job = ctx;
+    sm3_nbd_t* nbd = job->nbd;
+    for (size_t b = begin; b < end; b += MB_GROUP) {
+        int m = (int)(end - b < MB_GROUP ? end - b : MB_GROUP);
+        const uint8_t* in[MB_GROUP];
+        const uint8_t* exp[MB_GROUP];
+        uint8_t ok[MB_GROUP];
+        for (int j = 0; j < m; j++) {
+            uint32_t k = nbd->idx[b + j];
+            in[j] = nbd->buf + (size_t)k * SM3_PAGE_SIZE;
+            exp[j] = sm3_manifest_digest(&nbd->tags, nbd->pages[k]);
+        }
+        aes_sm3_integrity_verify_mb(in, exp, ok, m, job->bits);
+        for (int j = 0; j < m; j++) nbd->ok[nbd->idx[b + j]] = ok[j];
+    }
+}
+
+static void tag_chunk(void* ctx, size_t begin, size_t end) {
+    page_job_t* job = ctx;
+    sm3_nbd_t* nbd = job->nbd;
+    for (size_t b = begin; b < end; b += MB_GROUP) {
+        int m = (int)(end - b < MB_GROUP ? end - b : MB_GROUP);
+        const uint8_t* in[MB_GROUP];
+        uint8_t* out[MB_GROUP];
+        for (int j = 0; j < m; j++) {
+            in[j] = nbd->buf + (b + j) * SM3_PAGE_SIZE;
+            out[j] = nbd->tagbuf + (b + j) * (size_t)nbd->digest_size;
+        }
+        aes_sm3_integrity_mb(in, out, m, job->bits);
+    }
+}
+
+// 校验 idx[0..n)，返回不一致的页数
+static size_t verify_indexed(sm3_nbd_t* nbd, size_t n) {
+    if (!nbd->have_tags) {
+        for (size_t i = 0; i < n; i++) nbd->ok[nbd->idx[i]] = 1;
+        return 0;
+    }
+    uint64_t t0 = sm3_now_ns();
+    page_job_t job = { nbd, nbd->digest_size * 8 };
+    sm3_pool_run(nbd->pool, verify_chunk, &job, n, POOL_GRAIN);
+    size_t bad = 0;
+    for (size_t i = 0; i < n; i++) bad += !nbd->ok[nbd->idx[i]];
+    nbd->stats.verify_ns += sm3_now_ns() - t0;
+    nbd->stats.verified_pages += n;
+    nbd->stats.verify_failures += bad;
+    return bad;
+}
+
+static int range_ok(const sm3_nbd_t* nbd, size_t np, const nbd_req_t* r) {
+    if (!r->length) {
+        return 1;
+    }
+    size_t first = page_index(nbd, np, r->offset / SM3_PAGE_SIZE);
+    size_t last = first + (r->offset + r->length - 1) / SM3_PAGE_SIZE - r->offset / SM3_PAGE_SIZE;
+    for (size_t k = first; k <= last; k++) {
+        if (!nbd->ok[k]) return 0;
+    }
+    return 1;
+}
+
+static void exec_reads(sm3_nbd_t* nbd, nbd_req_t** reqs, int n) {
+    int err;
+    size_t np = collect_pages(nbd, reqs, n, &err);
+    for (size_t i = 0; i < np; i++) nbd->idx[i] = (uint32_t)i;
+    if (!err && read_indexed(nbd, np) != 0) {
+        err = NBD_EIO;
+    }
+    if (!err) {
+        verify_indexed(nbd, np);
+    }
+    for (int i = 0; i < n; i++) {
+        nbd_req_t* r = reqs[i];
+        if (r->error) continue;
+        r->error = err ? (uint32_t)err : range_ok(nbd, np, r) ? 0 : NBD_EIO;
+        nbd->stats.reads++;
+        nbd->stats.read_bytes += r->length;
+    }
+}
+
+// 数据已落盘时调用：日志压缩进标签文件后，各页都需重新记录
+static int compact_journal(sm3_nbd_t* nbd) {
+    if (sm3_journal_compact(nbd->journal) != 0) {
+        return -1;
+    }
+    memset(nbd->journaled, 0, (size_t)((nbd->tags.hdr->page_count + 7) / 8));
+    return 0;
+}
+
+// 标签已在写数据前经日志提交，这里只需让数据落盘；日志较大时压缩进标签文件
+static int sync_all(sm3_nbd_t* nbd) {
+    uint64_t t0 = sm3_now_ns();
+    int rc = fdatasync(nbd->fd);
+    if (rc == 0 && nbd->journal) {
+        sm3_journal_stats_t js;
+        sm3_journal_stats(nbd->journal, &js);
+        if (js.journal_bytes > JOURNAL_COMPACT_BYTES) {
+            rc = compact_journal(nbd);
+        }
+    }
+    nbd->stats.sync_ns += sm3_now_ns() - t0;
+    return rc;
+}
+
+// 写段：返回 1 表示读-改-写时发现原页校验失败，调用方改为逐个请求执行
+static int exec_writes(sm3_nbd_t* nbd, nbd_req_t** reqs, int n) {
+    int err;
+    size_t np = collect_pages(nbd, reqs, n, &err);
+    if (err) {
+        for (int i = 0; i < n; i++) {
+            if (!reqs[i]->error) reqs[i]->error = (uint32_t)err;
+        }
+        return 0;
+    }
+
+    // 被某个请求整页覆盖的页不必读出原内容（文件末尾的不完整页覆盖到文件末尾即可）
+    memset(nbd->need, 1, np);
+    for (int i = 0; i < n; i++) {
+        nbd_req_t* r = reqs[i];
+        if (r->error || !r->length) continue;
+        uint64_t end = r->offset + r->length;
+        for (uint64_t p = (r->offset + SM3_PAGE_SIZE - 1) / SM3_PAGE_SIZE; p * SM3_PAGE_SIZE < end; p++) {
+            uint64_t pend = (p + 1) * SM3_PAGE_SIZE < nbd->size ? (p + 1) * SM3_PAGE_SIZE : nbd->size;
+            if (end >= pend) nbd->need[page_index(nbd, np, p)] = 0;
+        }
+    }
+    size_t nr = 0;
+    for (size_t k = 0; k < np; k++) {
+        if (nbd->need[k]) {
+            nbd->idx[nr++] = (uint32_t)k;
+        } else {
+            memset(nbd->buf + k * SM3_PAGE_SIZE, 0, SM3_PAGE_SIZE);
+        }
+    }
+    if (nr) {
+        if (read_indexed(nbd, nr) != 0) {
+            for (int i = 0; i < n; i++) {
+                if (!reqs[i]->error) reqs[i]->error = NBD_EIO;
+            }
+            return 0;
+        }
+        nbd->stats.rmw_pages += nr;
+        if (verify_indexed(nbd, nr) > 0) {
+            if (n > 1) {
+                return 1;
+            }
+            reqs[0]->error = NBD_EIO;   // 原页已损坏，不改写
+            return 0;
+        }
+    }
+
+    // 按到达顺序应用写入
+    for (int i = 0; i < n; i++) {
+        nbd_req_t* r = reqs[i];
+        if (r->error || !r->length) continue;
+        uint8_t* dst = nbd->buf + page_index(nbd, np, r->offset / SM3_PAGE_SIZE) * SM3_PAGE_SIZE +
+                       r->offset % SM3_PAGE_SIZE;
+        if (r->type == SM3_NBD_CMD_WRITE) {
+            memcpy(dst, r->data, r->length);
+        } else {
+            memset(dst, 0, r->length);
+        }
+    }
+
+    if (nbd->have_tags) {
+        uint64_t t0 = sm3_now_ns();
+        page_job_t job = { nbd, nbd->digest_size * 8 };
+        sm3_pool_run(nbd->pool, tag_chunk, &job, np, POOL_GRAIN);
+        nbd->stats.tag_ns += sm3_now_ns() - t0;
+        nbd->stats.tagged_pages += np;
+    }
+
+    // 新标签先经日志提交：之后任何时刻落盘的数据页在日志中都有对应记录。
+    // 已有提交记录的页恢复时总会被核对，本次记录不必等待提交
+    int rc = 0;
+    if (nbd->journal) {
+        uint64_t t0 = sm3_now_ns();
+        int wait = 0;
+        for (size_t k = 0; k < np && rc == 0; k++) {
+            uint64_t p = nbd->pages[k];
+            wait |= !(nbd->journaled[p / 8] & (1u << (p % 8)));
+            if (!sm3_journal_append(nbd->journal, p, nbd->tagbuf + k * (size_t)nbd->digest_size)) {
+                rc = -1;
+            }
+        }
+        if (rc == 0 && wait) {
+            if (sm3_journal_sync(nbd->journal) != 0) {
+                rc = -1;
+            }
+            for (size_t k = 0; k < np && rc == 0; k++) {
+                nbd->journaled[nbd->pages[k] / 8] |= (uint8_t)(1u << (nbd->pages[k] % 8));
+            }
+        }
+        nbd->stats.sync_ns += sm3_now_ns() - t0;
+    }
+
+    // 再写数据（相邻页合并，末页截断到导出大小），最后更新标签文件
+    uint64_t t0 = sm3_now_ns();
+    for (size_t i = 0; i < np && rc == 0; ) {
+        size_t j = i + 1;
+        while (j < np && nbd->pages[j] == nbd->pages[j - 1] + 1) j++;
+        uint64_t off = nbd->pages[i] * SM3_PAGE_SIZE;
+        uint64_t len = (j - i) * SM3_PAGE_SIZE;
+        if (off + len > nbd->size) len = nbd->size - off;
+        const uint8_t* p = nbd->buf + i * SM3_PAGE_SIZE;
+        while (len > 0) {
+            ssize_t w = pwrite(nbd->fd, p, len, (off_t)off);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                rc = -1;
+                break;
+            }
+            p += w;
+            off += (uint64_t)w;
+            len -= (uint64_t)w;
+        }
+        i = j;
+    }
+    nbd->stats.io_ns += sm3_now_ns() - t0;
+    if (rc == 0 && nbd->have_tags) {
+        for (size_t k = 0; k < np; k++) {
+            memcpy(sm3_manifest_digest(&nbd->tags, nbd->pages[k]),
+                   nbd->tagbuf + k * (size_t)nbd->digest_size, (size_t)nbd->digest_size);
+        }
+    }
+
+    int fua = 0;
+    for (int i = 0; i < n; i++) {
+        nbd_req_t* r = reqs[i];
+        if (r->error) continue;
+        fua |= r->flags & SM3_NBD_CMD_FLAG_FUA;
+        nbd->stats.writes++;
+        nbd->stats.write_bytes += r->length;
+    }
+    if (rc == 0 && fua && sync_all(nbd) != 0) {
+        rc = -1;
+    }
+    for (int i = 0; rc != 0 && i < n; i++) {
+        if (!reqs[i]->error) reqs[i]->error = NBD_EIO;
+    }
+    return 0;
+}
+
+static int send_reply(int fd, const nbd_req_t* r, const uint8_t* data) {
+    uint8_t hdr[16];
+    put32(hdr, NBD_REPLY_MAGIC);
+    put32(hdr + 4, r->error);
+    put64(hdr + 8, r->handle);
+    struct iovec iov[2] = { { hdr, sizeof(hdr) }, { (void*)data, r->length } };
+    int with_data = r->type == SM3_NBD_CMD_READ && !r->error && r->length;
+    return send_iov(fd, iov, with_data ? 2 : 1);
+}
+
+static int kind_of(const nbd_req_t* r) {
+    if (r->error) return -1;
+    return r->type == SM3_NBD_CMD_WRITE_ZEROES ? SM3_NBD_CMD_WRITE : r->type;
+}
+
+static int exec_batch(sm3_nbd_t* nbd, int fd, nbd_req_t** reqs, int n) {
+    nbd->stats.batches++;
+    nbd->stats.batch_requests += (uint64_t)n;
+    for (int i = 0; i < n; ) {
+        int kind = kind_of(reqs[i]), j = i + 1;
+        while (j < n && kind_of(reqs[j]) == kind) j++;
+        if (kind == SM3_NBD_CMD_READ) {
+            exec_reads(nbd, reqs + i, j - i);
+        } else if (kind == SM3_NBD_CMD_WRITE) {
+            if (exec_writes(nbd, reqs + i, j - i) == 1) {
+                for (int k = i; k < j; k++) exec_writes(nbd, reqs + k, 1);
+            }
+        } else if (kind == SM3_NBD_CMD_FLUSH) {
+            uint32_t e = sync_all(nbd) == 0 ? 0 : NBD_EIO;
+            for (int k = i; k < j; k++) reqs[k]->error = e;
+            nbd->stats.flushes += (uint64_t)(j - i);
+        }
+        for (int k = i; k < j; k++) {
+            nbd_req_t* r = reqs[k];
+            const uint8_t* data = NULL;
+            nbd->stats.errors += r->error != 0;
+            if (r->type == SM3_NBD_CMD_READ && !r->error && r->length) {
+                // 同一请求的页在段缓冲区内连续
+                data = nbd->buf + page_index(nbd, nbd->np, r->offset / SM3_PAGE_SIZE) * SM3_PAGE_SIZE +
+                       r->offset % SM3_PAGE_SIZE;
+            }
+            if (send_reply(fd, r, data) != 0) {
+                return -1;
+            }
+        }
+        i = j;
+    }
+    return 0;
+}
+
+// ============================================================================
+// 崩溃恢复
+// ============================================================================
+
+typedef struct {
+    uint64_t* pages;
+    size_t n, cap;
+    int failed;
+} page_list_t;
+
+static void note_replayed(uint64_t page, void* ctx) {
+    page_list_t* l = ctx;
+    if (l->n == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 1024;
+        uint64_t* p = realloc(l->pages, cap * sizeof(uint64_t));
+        if (!p) {
+            l->failed = 1;
+            return;
+        }
+        l->pages = p;
+        l->cap = cap;
+    }
+    l->pages[l->n++] = page;
+}
+
+// 核对日志涉及的页，数据与标签不符时按数据重建标签；随后同步数据并压缩日志
+static int recover_pages(sm3_nbd_t* nbd, uint64_t* pages, size_t n) {
+    qsort(pages, n, sizeof(uint64_t), cmp_u64);
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (k == 0 || pages[i] != pages[k - 1]) pages[k++] = pages[i];
+    }
+    page_job_t job = { nbd, nbd->digest_size * 8 };
+    for (size_t b = 0; b < k; b += RECOVER_PAGES) {
+        size_t m = k - b < RECOVER_PAGES ? k - b : RECOVER_PAGES;
+        if (ensure_cap(nbd, m) != 0) {
+            return -1;
+        }
+        memcpy(nbd->pages, pages + b, m * sizeof(uint64_t));
+        for (size_t i = 0; i < m; i++) nbd->idx[i] = (uint32_t)i;
+        if (read_indexed(nbd, m) != 0) {
+            return -1;
+        }
+        sm3_pool_run(nbd->pool, tag_chunk, &job, m, POOL_GRAIN);
+        for (size_t i = 0; i < m; i++) {
+            uint8_t* tag = sm3_manifest_digest(&nbd->tags, nbd->pages[i]);
+            const uint8_t* now = nbd->tagbuf + i * (size_t)nbd->digest_size;
+            if (memcmp(tag, now, (size_t)nbd->digest_size) != 0) {
+                memcpy(tag, now, (size_t)nbd->digest_size);
+                nbd->stats.recovered_pages++;
+            }
+        }
+    }
+    nbd->np = 0;
+    // 核对时读到的可能是尚未落盘的页缓存：数据先落盘，标签才能随日志压缩定下来
+    if (fdatasync(nbd->fd) != 0) {
+        return -1;
+    }
+    return compact_journal(nbd);
+}
+
+// ============================================================================
+// 打开与关闭
+// ============================================================================
+
+void sm3_nbd_opts_default(sm3_nbd_opts_t* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->integrity = 1;
+    opts->digest_bits = 256;
+    opts->queue_depth = 64;
+}
+
+static int open_tags(sm3_nbd_t* nbd, const char* path, uint64_t file_size) {
+    size_t len = strlen(path);
+    char* tpath = malloc(len + sizeof(SM3_STORE_TAGS_SUFFIX));
+    if (!tpath) {
+        return -1;
+    }
+    memcpy(tpath, path, len);
+    memcpy(tpath + len, SM3_STORE_TAGS_SUFFIX, sizeof(SM3_STORE_TAGS_SUFFIX));
+    size_t jlen = len + sizeof(SM3_STORE_TAGS_SUFFIX) + sizeof(SM3_JOURNAL_SUFFIX);
+    char* jpath = malloc(jlen);
+    if (!jpath) {
+        free(tpath);
+        return -1;
+    }
+    snprintf(jpath, jlen, "%s%s", tpath, SM3_JOURNAL_SUFFIX);
+    int rc = 0;
+    if (access(tpath, F_OK) != 0) {
+        // 没有标签文件：为现有内容生成标签，遗留的日志属于旧标签文件
+        unlink(jpath);
+        if (file_size == 0) {
+            rc = sm3_manifest_create(&nbd->tags, tpath, 0, nbd->opts.digest_bits == 128 ? 16 : 32);
+            if (rc == 0) sm3_manifest_close(&nbd->tags);
+        } else {
+            sm3_scan_opts_t sopts;
+            sm3_scan_stats_t st;
+            sm3_scan_opts_default(&sopts);
+            sopts.digest_bits = nbd->opts.digest_bits;
+            sopts.num_threads = nbd->opts.num_threads > 0 ? nbd->opts.num_threads
+                                                          : (int)sysconf(_SC_NPROCESSORS_ONLN);
+            rc = sm3_manifest_build(path, tpath, &sopts, &st);
+        }
+    }
+    if (rc == 0) {
+        rc = sm3_manifest_open(&nbd->tags, tpath, !nbd->opts.read_only);
+    }
+    free(tpath);
+    if (rc != 0) {
+        free(jpath);
+        return -1;
+    }
+    nbd->have_tags = 1;
+    nbd->digest_size = (int)nbd->tags.hdr->digest_size;
+    if (nbd->tags.hdr->file_size != file_size) {
+        free(jpath);
+        errno = EINVAL;         // 标签与后备文件不对应
+        return -1;
+    }
+    if (nbd->opts.read_only) {
+        free(jpath);            // 只读时不写标签，也不重放日志
+        return 0;
+    }
+
+    page_list_t replayed = { NULL, 0, 0, 0 };
+    sm3_journal_opts_t jopts;
+    sm3_journal_opts_default(&jopts);
+    jopts.pool = nbd->pool;
+    jopts.on_replay = note_replayed;
+    jopts.replay_ctx = &replayed;
+    rc = sm3_journal_open(&nbd->journal, jpath, &nbd->tags, &jopts);
+    free(jpath);
+    // 位图按导出大小分配，打开时扩展出的页同样覆盖
+    if (rc == 0 && !(nbd->journaled = calloc(sm3_pages_for_size(nbd->size) / 8 + 1, 1))) {
+        rc = -1;
+    }
+    if (rc == 0 && replayed.failed) {
+        errno = ENOMEM;
+        rc = -1;
+    }
+    if (rc == 0 && replayed.n) {
+        rc = recover_pages(nbd, replayed.pages, replayed.n);
+    }
+    free(replayed.pages);
+    return rc;
+}
+
+sm3_nbd_t* sm3_nbd_open(const char* path, const sm3_nbd_opts_t* opts) {
+    sm3_nbd_t* nbd = calloc(1, sizeof(*nbd));
+    if (!nbd) {
+        return NULL;
+    }
+    sm3_nbd_opts_default(&nbd->opts);
+    if (opts) nbd->opts = *opts;
+    if (nbd->opts.queue_depth == 0) nbd->opts.queue_depth = 1;
+    nbd->tags.fd = -1;
+    nbd->digest_size = nbd->opts.digest_bits == 128 ? 16 : 32;
+    nbd->fd = open(path, nbd->opts.read_only ? O_RDONLY | O_CLOEXEC : O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+    if (nbd->fd < 0 || fstat(nbd->fd, &st) != 0) {
+        goto fail;
+    }
+    uint64_t fsize = (uint64_t)st.st_size;
+    nbd->size = nbd->opts.size > fsize && !nbd->opts.read_only ? nbd->opts.size : fsize;
+    nbd->pool = sm3_pool_create(nbd->opts.num_threads);
+    if (!nbd->pool) {
+        goto fail;
+    }
+    if (nbd->opts.integrity && open_tags(nbd, path, fsize) != 0) {
+        goto fail;
+    }
+    if (nbd->size > fsize) {
+        if (ftruncate(nbd->fd, (off_t)nbd->size) != 0) {
+            goto fail;
+        }
+        if (nbd->have_tags) {
+            // 扩展出的页均为全零页
+            uint64_t old = nbd->tags.hdr->page_count;
+            static const uint8_t zero_page[SM3_PAGE_SIZE];
+            uint8_t zero_tag[32];
+            if (nbd->digest_size == 32) {
+                aes_sm3_integrity_256bit(zero_page, zero_tag);
+            } else {
+                aes_sm3_integrity_128bit(zero_page, zero_tag);
+            }
+            if (sm3_manifest_resize(&nbd->tags, nbd->size) != 0) {
+                goto fail;
+            }
+            for (uint64_t p = old; p < nbd->tags.hdr->page_count; p++) {
+                memcpy(sm3_manifest_digest(&nbd->tags, p), zero_tag, (size_t)nbd->digest_size);
+            }
+        }
+    }
+    return nbd;
+
+fail:
+    {
+        int err = errno;
+        sm3_nbd_close(nbd);
+        errno = err;
+    }
+    return NULL;
+}
+
+void sm3_nbd_close(sm3_nbd_t* nbd) {
+    if (!nbd) {
+        return;
+    }
+    if (nbd->journal) {
+        // 正常关闭：数据落盘后把日志压缩进标签文件，下次打开无需恢复
+        if (fdatasync(nbd->fd) == 0) {
+            sm3_journal_compact(nbd->journal);
+        }
+        sm3_journal_close(nbd->journal);
+    }
+    free(nbd->journaled);
+    if (nbd->have_tags) {
+        sm3_manifest_sync(&nbd->tags);
+        sm3_manifest_close(&nbd->tags);
+    }
+    if (nbd->fd >= 0) close(nbd->fd);
+    sm3_pool_destroy(nbd->pool);
+    free(nbd->pages);
+    free(nbd->buf);
+    free(nbd->tagbuf);
+    free(nbd->ok);
+    free(nbd->need);
+    free(nbd->idx);
+    free(nbd);
+}
+
+uint64_t sm3_nbd_size(const sm3_nbd_t* nbd) {
+    return nbd->size;
+}
+
+void sm3_nbd_stats(const sm3_nbd_t* nbd, sm3_nbd_stats_t* out) {
+    *out = nbd->stats;
+}
+
+// ============================================================================
+// 连接：接收线程 + 执行线程
+// ============================================================================
+
+typedef struct {
+    sm3_nbd_t* nbd;
+    int fd;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    nbd_req_t** ring;
+    uint32_t cap, head, count;
+    int done;                   // 接收线程已退出
+    int failed;                 // 协议错误
+} nbd_conn_t;
+
+static uint32_t check_request(const sm3_nbd_t* nbd, const nbd_req_t* r) {
+    switch (r->type) {
+    case SM3_NBD_CMD_READ:
+    case SM3_NBD_CMD_WRITE:
+    case SM3_NBD_CMD_WRITE_ZEROES:
+        if (r->type != SM3_NBD_CMD_READ && nbd->opts.read_only) {
+            return NBD_EPERM;
+        }
+        if (r->length > SM3_NBD_MAX_REQUEST) {
+            return NBD_EINVAL;
+        }
+        if (r->offset > nbd->size || r->length > nbd->size - r->offset) {
+            return r->type == SM3_NBD_CMD_READ ? NBD_EINVAL : NBD_ENOSPC;
+        }
+        return 0;
+    case SM3_NBD_CMD_FLUSH:
+        return 0;
+    default:
+        return NBD_EINVAL;
+    }
+}
+
+static void* recv_main(void* arg) {
+    nbd_conn_t* c = arg;
+    uint8_t hdr[28];
+    for (;;) {
+        if (read_full(c->fd, hdr, sizeof(hdr)) != 0) {
+            break;
+        }
+        if (get32(hdr) != NBD_REQUEST_MAGIC) {
+            c->failed = 1;
+            break;
+        }
+        nbd_req_t* r = calloc(1, sizeof(*r));
+        if (!r) {
+            c->failed = 1;
+            break;
+        }
+        r->flags = get16(hdr + 4);
+        r->type = get16(hdr + 6);
+        r->handle = get64(hdr + 8);
+        r->offset = get64(hdr + 16);
+        r->length = get32(hdr + 24);
+        if (r->type == SM3_NBD_CMD_DISC) {
+            free(r);
+            break;
+        }
+        r->error = check_request(c->nbd, r);
+        if (r->type == SM3_NBD_CMD_WRITE) {
+            // 写入数据总要读走；无法执行的请求丢弃数据
+            if (!r->error && !(r->data = malloc(r->length ? r->length : 1))) {
+                r->error = NBD_ENOMEM;
+            }
+            int rc = 0;
+            if (r->data) {
+                rc = read_full(c->fd, r->data, r->length);
+            } else {
+                uint8_t sink[4096];
+                for (uint32_t left = r->length; rc == 0 && left > 0; ) {
+                    uint32_t k = left < sizeof(sink) ? left : (uint32_t)sizeof(sink);
+                    rc = read_full(c->fd, sink, k);
+                    left -= k;
+                }
+            }
+            if (rc != 0) {
+                free(r->data);
+                free(r);
+                break;
+            }
+        }
+        pthread_mutex_lock(&c->lock);
+        while (c->count == c->cap) pthread_cond_wait(&c->not_full, &c->lock);
+        c->ring[(c->head + c->count) % c->cap] = r;
+        c->count++;
+        pthread_cond_signal(&c->not_empty);
+        pthread_mutex_unlock(&c->lock);
+    }
+    pthread_mutex_lock(&c->lock);
+    c->done = 1;
+    pthread_cond_signal(&c->not_empty);
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+// 选项协商；返回 1 进入传输阶段，0 客户端放弃，-1 出错
+static int negotiate(sm3_nbd_t* nbd, int fd) {
+    uint8_t buf[18];
+    put64(buf, NBD_MAGIC);
+    put64(buf + 8, NBD_OPTS_MAGIC);
+    put16(buf + 16, NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES);
+    if (send_full(fd, buf, 18) != 0 || read_full(fd, buf, 4) != 0) {
+        return -1;
+    }
+    int no_zeroes = get32(buf) & NBD_FLAG_NO_ZEROES;
+    uint16_t tflags = NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH | NBD_FLAG_SEND_FUA |
+                      NBD_FLAG_SEND_WRITE_ZEROES | (nbd->opts.read_only ? NBD_FLAG_READ_ONLY : 0);
+    uint8_t data[MAX_OPTION_LEN];
+    for (;;) {
+        uint8_t oh[16];
+        if (read_full(fd, oh, 16) != 0 || get64(oh) != NBD_OPTS_MAGIC) {
+            return -1;
+        }
+        uint32_t opt = get32(oh + 8), len = get32(oh + 12);
+        if (len > MAX_OPTION_LEN || read_full(fd, data, len) != 0) {
+            return -1;
+        }
+        if (opt == NBD_OPT_EXPORT_NAME) {
+            uint8_t rep[10 + 124];
+            memset(rep, 0, sizeof(rep));
+            put64(rep, nbd->size);
+            put16(rep + 8, tflags);
+            return send_full(fd, rep, no_zeroes ? 10 : sizeof(rep)) == 0 ? 1 : -1;
+        }
+
+        // 其余选项逐条回复：魔数 + 选项 + 类型 + 长度 + 数据
+        uint8_t rep[3][20 + 18];
+        uint32_t types[3];
+        uint32_t lens[3];
+        int nrep = 0;
+        int enter = 0;
+        if (opt == NBD_OPT_ABORT) {
+            types[nrep] = NBD_REP_ACK;
+            lens[nrep++] = 0;
+        } else if (opt == NBD_OPT_LIST) {
+            types[nrep] = NBD_REP_SERVER;      // 唯一的导出，名称为空
+            put32(rep[nrep] + 20, 0);
+            lens[nrep++] = 4;
+            types[nrep] = NBD_REP_ACK;
+            lens[nrep++] = 0;
+        } else if (opt == NBD_OPT_INFO || opt == NBD_OPT_GO) {
+            if (len < 6 || get32(data) > len - 6) {
+                types[nrep] = NBD_REP_ERR_INVALID;
+                lens[nrep++] = 0;
+            } else {
+                types[nrep] = NBD_REP_INFO;
+                put16(rep[nrep] + 20, NBD_INFO_EXPORT);
+                put64(rep[nrep] + 22, nbd->size);
+                put16(rep[nrep] + 30, tflags);
+                lens[nrep++] = 12;
+                types[nrep] = NBD_REP_INFO;
+                put16(rep[nrep] + 20, NBD_INFO_BLOCK_SIZE);
+                put32(rep[nrep] + 22, 1);
+                put32(rep[nrep] + 26, SM3_PAGE_SIZE);
+                put32(rep[nrep] + 30, SM3_NBD_MAX_REQUEST);
+                lens[nrep++] = 14;
+                types[nrep] = NBD_REP_ACK;
+                lens[nrep++] = 0;
+                enter = opt == NBD_OPT_GO;
+            }
+        } else {
+            types[nrep] = NBD_REP_ERR_UNSUP;
+            lens[nrep++] = 0;
+        }
+        for (int i = 0; i < nrep; i++) {
+            put64(rep[i], NBD_REP_MAGIC);
+            put32(rep[i] + 8, opt);
+            put32(rep[i] + 12, types[i]);
+            put32(rep[i] + 16, lens[i]);
+            if (send_full(fd, rep[i], 20 + lens[i]) != 0) {
+                return -1;
+            }
+        }
+        if (opt == NBD_OPT_ABORT) {
+            return 0;
+        }
+        if (enter) {
+            return 1;
+        }
+    }
+}
+
+int sm3_nbd_serve_fd(sm3_nbd_t* nbd, int fd) {
+    int rc = negotiate(nbd, fd);
+    if (rc <= 0) {
+        return rc;
+    }
+    nbd->stats.connections++;
+    nbd_conn_t c;
+    memset(&c, 0, sizeof(c));
+    c.nbd = nbd;
+    c.fd = fd;
+    c.cap = nbd->opts.queue_depth;
+    c.ring = calloc(c.cap, sizeof(nbd_req_t*));
+    nbd_req_t** batch = calloc(c.cap, sizeof(nbd_req_t*));
+    pthread_t tid;
+    pthread_mutex_init(&c.lock, NULL);
+    pthread_cond_init(&c.not_empty, NULL);
+    pthread_cond_init(&c.not_full, NULL);
+    if (!c.ring || !batch || pthread_create(&tid, NULL, recv_main, &c) != 0) {
+        free(c.ring);
+        free(batch);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    rc = 0;
+    for (;;) {
+        pthread_mutex_lock(&c.lock);
+        while (c.count == 0 && !c.done) {
+            if (!nbd->stop) {
+                pthread_cond_wait(&c.not_empty, &c.lock);
+                continue;
+            }
+            // 由 sm3_nbd_serve 调用时定期检查停止标志
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += 1;
+            pthread_cond_timedwait(&c.not_empty, &c.lock, &ts);
+            if (*nbd->stop) break;
+        }
+        // 取出已到达的请求，数据总量不超过 BATCH_BYTES（至少一个）
+        int n = 0;
+        uint64_t bytes = 0;
+        while (c.count > 0) {
+            nbd_req_t* r = c.ring[c.head];
+            if (n > 0 && bytes + r->length > BATCH_BYTES) break;
+            bytes += r->length;
+            batch[n++] = r;
+            c.head = (c.head + 1) % c.cap;
+            c.count--;
+        }
+        int finished = n == 0;
+        pthread_cond_signal(&c.not_full);
+        pthread_mutex_unlock(&c.lock);
+        if (finished) {
+            break;
+        }
+        int ok = rc == 0 && exec_batch(nbd, fd, batch, n) == 0;
+        for (int i = 0; i < n; i++) {
+            free(batch[i]->data);
+            free(batch[i]);
+        }
+        if (!ok && rc == 0) {
+            rc = -1;
+            shutdown(fd, SHUT_RDWR);    // 回复失败：让接收线程退出，丢弃其后的请求
+        }
+    }
+    if (!c.done) {
+        shutdown(fd, SHUT_RDWR);
+    }
+    // 接收线程可能阻塞在已满的队列上
+    pthread_mutex_lock(&c.lock);
+    while (!c.done) {
+        while (c.count > 0) {
+            free(c.ring[c.head]->data);
+            free(c.ring[c.head]);
+            c.head = (c.head + 1) % c.cap;
+            c.count--;
+        }
+        pthread_cond_signal(&c.not_full);
+        pthread_mutex_unlock(&c.lock);
+        sched_yield();
+        pthread_mutex_lock(&c.lock);
+    }
+    pthread_mutex_unlock(&c.lock);
+    pthread_join(tid, NULL);
+    while (c.count > 0) {
+        free(c.ring[c.head]->data);
+        free(c.ring[c.head]);
+        c.head = (c.head + 1) % c.cap;
+        c.count--;
+    }
+    if (c.failed && rc == 0) {
+        errno = EPROTO;
+        rc = -1;
+    }
+    pthread_cond_destroy(&c.not_full);
+    pthread_cond_destroy(&c.not_empty);
+    pthread_mutex_destroy(&c.lock);
+    free(batch);
+    free(c.ring);
+    return rc;
+}
+
+// ============================================================================
+// 监听与连接
+// ============================================================================
+
+static int unix_addr(const char* path, struct sockaddr_un* sa) {
+    memset(sa, 0, sizeof(*sa));
+    sa->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sa->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(sa->sun_path, path);
+    return 0;
+}
+
+// "主机:端口" 或 Unix 套接字路径；listening 非0时绑定并监听，否则连接
+static int open_socket(const char* addr, int listening) {
+    if (strchr(addr, '/')) {
+        struct sockaddr_un sa;
+        if (unix_addr(addr, &sa) != 0) {
+            return -1;
+        }
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (listening) unlink(addr);
+        int rc = listening ? bind(fd, (struct sockaddr*)&sa, sizeof(sa)) || listen(fd, 16)
+                           : connect(fd, (struct sockaddr*)&sa, sizeof(sa));
+        if (rc != 0) {
+            int e = errno;
+            close(fd);
+            errno = e;
+            return -1;
+        }
+        return fd;
+    }
+    const char* colon = strrchr(addr, ':');
+    if (!colon) {
+        errno = EINVAL;
+        return -1;
+    }
+    char host[256];
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - addr), addr);
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    if (getaddrinfo(*host ? host : NULL, colon + 1, &hints, &res) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        int rc = listening ? bind(fd, ai->ai_addr, ai->ai_addrlen) || listen(fd, 16)
+                           : connect(fd, ai->ai_addr, ai->ai_addrlen);
+        if (rc != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+int sm3_nbd_listen(const char* addr) {
+    return open_socket(addr, 1);
+}
+
+int sm3_nbd_serve(sm3_nbd_t* nbd, int listen_fd, volatile sig_atomic_t* stop) {
+    nbd->stop = stop;
+    while (!*stop) {
+        struct pollfd pfd = { listen_fd, POLLIN, 0 };
+        int n = poll(&pfd, 1, 1000);
+        if (n < 0 && errno != EINTR) {
+            nbd->stop = NULL;
+            return -1;
+        }
+        if (n <= 0) {
+            continue;
+        }
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sm3_nbd_serve_fd(nbd, fd);
+        close(fd);
+    }
+    nbd->stop = NULL;
+    return 0;
+}
+
+// ============================================================================
+// 客户端
+// ============================================================================
+
+int sm3_nbd_connect(const char* addr) {
+    return open_socket(addr, 0);
+}
+
+int sm3_nbd_handshake(int fd, uint64_t* size, uint16_t* flags) {
+    uint8_t buf[32];
+    if (read_full(fd, buf, 18) != 0) {
+        return -1;
+    }
+    if (get64(buf) != NBD_MAGIC || get64(buf + 8) != NBD_OPTS_MAGIC ||
+        !(get16(buf + 16) & NBD_FLAG_FIXED_NEWSTYLE)) {
+        errno = EPROTO;
+        return -1;
+    }
+    uint16_t hflags = get16(buf + 16);
+    put32(buf, NBD_FLAG_FIXED_NEWSTYLE | (hflags & NBD_FLAG_NO_ZEROES));
+    // NBD_OPT_GO：名称为空，不请求额外信息
+    put64(buf + 4, NBD_OPTS_MAGIC);
+    put32(buf + 12, NBD_OPT_GO);
+    put32(buf + 16, 6);
+    put32(buf + 20, 0);
+    put16(buf + 24, 0);
+    if (send_full(fd, buf, 26) != 0) {
+        return -1;
+    }
+    for (;;) {
+        uint8_t rh[20], data[MAX_OPTION_LEN];
+        if (read_full(fd, rh, 20) != 0) {
+            return -1;
+        }
+        uint32_t type = get32(rh + 12), len = get32(rh + 16);
+        if (get64(rh) != NBD_REP_MAGIC || len > MAX_OPTION_LEN || read_full(fd, data, len) != 0) {
+            errno = EPROTO;
+            return -1;
+        }
+        if (type & 0x80000000u) {
+            errno = ENOTSUP;
+            return -1;
+        }
+        if (type == NBD_REP_INFO && len >= 12 && get16(data) == NBD_INFO_EXPORT) {
+            *size = get64(data + 2);
+            *flags = get16(data + 10);
+        }
+        if (type == NBD_REP_ACK) {
+            return 0;
+        }
+    }
+}
+
+int sm3_nbd_request(int fd, uint16_t type, uint16_t flags, uint64_t handle,
+                    uint64_t offset, uint32_t length, const void* data) {
+    uint8_t hdr[28];
+    put32(hdr, NBD_REQUEST_MAGIC);
+    put16(hdr + 4, flags);
+    put16(hdr + 6, type);
+    put64(hdr + 8, handle);
+    put64(hdr + 16, offset);
+    put32(hdr + 24, length);
+    struct iovec iov[2] = { { hdr, sizeof(hdr) }, { (void*)data, length } };
+    return send_iov(fd, iov, type == SM3_NBD_CMD_WRITE && length ? 2 : 1);
+}
+
+int sm3_nbd_reply(int fd, uint64_t* handle, uint32_t* error) {
+    uint8_t hdr[16];
+    if (read_full(fd, hdr, sizeof(hdr)) != 0) {
+        return -1;
+    }
+    if (get32(hdr) != NBD_REPLY_MAGIC) {
+        errno = EPROTO;
+        return -1;
+    }
+    *error = get32(hdr + 4);
+    *handle = get64(hdr + 8);
+    return 0;
+}
+
+int sm3_nbd_recv_data(int fd, void* buf, uint32_t length) {
+    return read_full(fd, buf, length);
+}
@@ -0,0 +1,105 @@
+/*
+ * 带页级完整性标签的 NBD 块设备服务端
+ *
+ * 把一个后备文件以 NBD 协议（fixed newstyle 握手，简单回复）导出，
+ * 内核 nbd 或 qemu/nbd-client 连接后即可在其上建立任意文件系统：
+ *   - 写：按4KB页打标签（多缓冲区批量接口），先写数据再更新标签
+ *   - 读：整页读出后批量校验，不一致时该请求返回 EIO
+ *   - 标签存于 "<后备文件>.tags"（清单格式，mmap），与 sm3_store 的标签文件
+ *     布局相同，可直接用 sm3_scan verify 离线校验
+ *   - 非整页的写入先读出并校验原页（读-改-写）
+ *   - 新标签先经摘要日志（sm3_journal.h，"<后备文件>.tags.jnl"）提交再写数据；
+ *     FLUSH（及带 FUA 的写）只需 fdatasync 数据，日志较大时压缩进标签文件
+ *   - 异常退出后再次打开时重放日志，日志涉及的页中数据与标签不符的（写入未
+ *     落盘或只写了一半）按现有数据重建标签，不会在之后的读取中永久报 EIO；
+ *     只读打开不重放，应先以读写方式打开一次完成恢复
+ *
+ * 流水线：接收线程持续读取请求（含写入数据）放入队列，执行线程每次取出
+ * 队列中已有的全部请求作为一批：相邻的读（或写）请求合并，涉及的页去重后
+ * 一次读出/打标签，经线程池并行校验或计算，再按请求顺序逐个回复。
+ * 同一批内的请求按到达顺序生效（重叠写入以后到的为准）。
+ *
+ * 关闭完整性（integrity = 0）时走相同的流水线但不打标签、不校验，
+ * 作为对比基线。一个服务端同一时刻服务一个连接。
+ */
+
+#ifndef SM3_NBD_H
+#define SM3_NBD_H
+
+#include <signal.h>
+#include <stdint.h>
+
+// 协议常量（见 NBD 协议文档）
+#define SM3_NBD_CMD_READ            0
+#define SM3_NBD_CMD_WRITE           1
+#define SM3_NBD_CMD_DISC            2
+#define SM3_NBD_CMD_FLUSH           3
+#define SM3_NBD_CMD_WRITE_ZEROES    6
+#define SM3_NBD_CMD_FLAG_FUA        (1 << 0)
+
+#define SM3_NBD_MAX_REQUEST         (32u << 20)     // 单个请求的最大长度
+
+typedef struct {
+    int integrity;              // 0：不打标签、不校验的普通服务端
+    int digest_bits;            // 新建标签文件时使用：128 或 256
+    int num_threads;            // 打标签/校验线程数，<= 0 取在线CPU数
+    uint32_t queue_depth;       // 接收线程最多预读的请求数
+    uint64_t size;              // 导出大小：大于后备文件时扩展（不缩小）；0 取文件大小
+    int read_only;
+} sm3_nbd_opts_t;
+
+typedef struct {
+    uint64_t connections;
+    uint64_t reads;
+    uint64_t writes;            // 含 WRITE_ZEROES
+    uint64_t flushes;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t errors;            // 返回错误的请求数
+    uint64_t batches;
+    uint64_t batch_requests;    // 各批请求数之和（除以 batches 为平均批大小）
+    uint64_t verified_pages;
+    uint64_t verify_failures;
+    uint64_t tagged_pages;
+    uint64_t rmw_pages;         // 读-改-写的页数
+    uint64_t recovered_pages;   // 打开时按数据重建标签的页数（上次异常退出）
+    uint64_t io_ns;             // 数据 pread/pwrite 耗时
+    uint64_t verify_ns;
+    uint64_t tag_ns;
+    uint64_t sync_ns;           // 含标签日志提交
+} sm3_nbd_stats_t;
+
+typedef struct sm3_nbd sm3_nbd_t;
+
+void sm3_nbd_opts_default(sm3_nbd_opts_t* opts);
+
+// 打开后备文件（不存在时创建）。启用完整性且没有标签文件时先为现有内容
+// 生成标签；已有标签文件与后备文件大小不符时返回 NULL（EINVAL）
+sm3_nbd_t* sm3_nbd_open(const char* path, const sm3_nbd_opts_t* opts);
+void sm3_nbd_close(sm3_nbd_t* nbd);
+uint64_t sm3_nbd_size(const sm3_nbd_t* nbd);
+void sm3_nbd_stats(const sm3_nbd_t* nbd, sm3_nbd_stats_t* out);
+
+// 服务一个已建立的连接（握手 + 传输），客户端断开后返回；协议错误返回 -1
+int sm3_nbd_serve_fd(sm3_nbd_t* nbd, int fd);
+
+// 监听地址："主机:端口"（TCP）或含 '/' 的路径（Unix 套接字，已存在时先删除）
+int sm3_nbd_listen(const char* addr);
+// 逐个接受连接并服务，直到 *stop 非0
+int sm3_nbd_serve(sm3_nbd_t* nbd, int listen_fd, volatile sig_atomic_t* stop);
+
+// ============================================================================
+// 客户端（测试与基准用）
+// ============================================================================
+
+int sm3_nbd_connect(const char* addr);
+// NBD_OPT_GO 握手，取得导出大小与传输标志
+int sm3_nbd_handshake(int fd, uint64_t* size, uint16_t* flags);
+// 发送请求；写入类请求随后发送 length 字节数据
+int sm3_nbd_request(int fd, uint16_t type, uint16_t flags, uint64_t handle,
+                    uint64_t offset, uint32_t length, const void* data);
+// 读取一个回复头；读请求成功（*error == 0）时随后用 sm3_nbd_recv_data 读取数据
+int sm3_nbd_reply(int fd, uint64_t* handle, uint32_t* error);
+int sm3_nbd_recv_data(int fd, void* buf, uint32_t length);
+
+#endif // SM3_NBD_H
@@ -0,0 +1,476 @@
+/*
+ * sm3_nbd_server - 带页级完整性标签的 NBD 服务端及其开销测试
+ *
+ * 用法:
+ *   sm3_nbd_server serve <后备文件> [-l 地址] [-s 大小MB] [-t 线程] [-b 128|256] [-q 队列深度] [-P] [-R]
+ *   sm3_nbd_server bench [-s 工作集MB] [-z 请求KB] [-r 读%] [-q 队列深度] [-n 请求数]
+ *                        [-t 线程] [-u] [-T] [-d 目录]
+ *
+ * serve: 地址为 "主机:端口"（默认 127.0.0.1:10809）或 Unix 套接字路径；
+ *        -P 不打标签（普通服务端），-R 只读导出。例如
+ *          sm3_nbd_server serve disk.img -s 1024 -l /run/sm3nbd.sock
+ *          nbd-client -unix /run/sm3nbd.sock /dev/nbd0 -b 4096
+ *        SIGINT/SIGTERM 时断开当前连接、同步标签后退出。
+ *
+ * bench: 在进程内启动服务端，客户端保持 -q 个请求在途（发送与接收各一个线程），
+ *        相同的请求序列分别对普通服务端和完整性服务端各运行一次，报告 ops/s、
+ *        吞吐量与延迟分位数，以及打标签/校验带来的开销。-u 时请求偏移只按512字节
+ *        对齐（触发读-改-写），-T 经回环 TCP 而非 Unix 套接字连接。
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "sm3_checkpoint.h"
+#include "sm3_journal.h"
+#include "sm3_manifest.h"
+#include "sm3_nbd.h"
+#include "sm3_store.h"
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "用法:\n"
+            "  %s serve <后备文件> [-l 地址] [-s 大小MB] [-t 线程] [-b 128|256] [-q 队列深度] [-P] [-R]\n"
+            "  %s bench [-s 工作集MB] [-z 请求KB] [-r 读%%] [-q 队列深度] [-n 请求数] [-t 线程] [-u] [-T] [-d 目录]\n",
+            prog, prog);
+}
+
+static void print_server_stats(const sm3_nbd_stats_t* s) {
+    printf("请求: 读 %llu (%.1f MB), 写 %llu (%.1f MB), 刷新 %llu, 出错 %llu; 平均批大小 %.1f\n",
+           (unsigned long long)s->reads, s->read_bytes / (1024.0 * 1024.0),
+           (unsigned long long)s->writes, s->write_bytes / (1024.0 * 1024.0),
+           (unsigned long long)s->flushes, (unsigned long long)s->errors,
+           s->batches ? (double)s->batch_requests / s->batches : 0.0);
+    printf("校验 %llu 页 (失败 %llu, %.1f 毫秒), 打标签 %llu 页 (%.1f 毫秒), 读-改-写 %llu 页, "
+           "数据读写 %.1f 毫秒, 同步 %.1f 毫秒\n",
+           (unsigned long long)s->verified_pages, (unsigned long long)s->verify_failures,
+           s->verify_ns / 1e6, (unsigned long long)s->tagged_pages, s->tag_ns / 1e6,
+           (unsigned long long)s->rmw_pages, s->io_ns / 1e6, s->sync_ns / 1e6);
+}
+
+// ============================================================================
+// serve
+// ============================================================================
+
+static volatile sig_atomic_t stop_flag;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop_flag = 1;
+}
+
+static int run_serve(int argc, char** argv) {
+    sm3_nbd_opts_t opts;
+    sm3_nbd_opts_default(&opts);
+    const char* addr = "127.0.0.1:10809";
+    int opt;
+    optind = 3;
+    while ((opt = getopt(argc, argv, "l:s:t:b:q:PR")) != -1) {
+        switch (opt) {
+        case 'l': addr = optarg; break;
+        case 's': opts.size = strtoull(optarg, NULL, 10) << 20; break;
+        case 't': opts.num_threads = atoi(optarg); break;
+        case 'b': opts.digest_bits = atoi(optarg); break;
+        case 'q': opts.queue_depth = (uint32_t)atoi(optarg); break;
+        case 'P': opts.integrity = 0; break;
+        case 'R': opts.read_only = 1; break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (opts.digest_bits != 128 && opts.digest_bits != 256) {
+        fprintf(stderr, "摘要长度必须为128或256\n");
+        return 2;
+    }
+    sm3_nbd_t* nbd = sm3_nbd_open(argv[2], &opts);
+    if (!nbd) {
+        fprintf(stderr, "无法打开后备文件 %s: %s\n", argv[2], strerror(errno));
+        return 2;
+    }
+    int lfd = sm3_nbd_listen(addr);
+    if (lfd < 0) {
+        fprintf(stderr, "无法监听 %s: %s\n", addr, strerror(errno));
+        sm3_nbd_close(nbd);
+        return 2;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("导出 %s (%.1f MB, %s) 于 %s\n", argv[2], sm3_nbd_size(nbd) / (1024.0 * 1024.0),
+           opts.integrity ? "完整性标签" : "无标签", addr);
+    fflush(stdout);
+    int rc = sm3_nbd_serve(nbd, lfd, &stop_flag);
+    close(lfd);
+    if (strchr(addr, '/')) unlink(addr);
+    sm3_nbd_stats_t st;
+    sm3_nbd_stats(nbd, &st);
+    printf("连接 %llu 次\n", (unsigned long long)st.connections);
+    print_server_stats(&st);
+    sm3_nbd_close(nbd);
+    return rc == 0 ? 0 : 2;
+}
+
+// ============================================================================
+// bench
+// ============================================================================
+
+typedef struct {
+    uint64_t ws_mb;
+    uint32_t req_kb;
+    int read_pct;
+    uint32_t queue_depth;
+    uint64_t ops;
+    int threads;
+    int unaligned;
+    int tcp;
+    const char* dir;
+} bench_cfg_t;
+
+typedef struct {
+    uint8_t is_read;
+    uint64_t offset;
+} bench_op_t;
+
+typedef struct {
+    const bench_cfg_t* cfg;
+    const bench_op_t* ops;
+    int fd;
+    sem_t slots;
+    uint64_t* sent_ns;
+    uint64_t* lat_ns;
+    const uint8_t* wdata;
+    uint64_t errors;
+    int failed;
+} bench_client_t;
+
+typedef struct {
+    sm3_nbd_t* nbd;
+    int listen_fd;
+    int rc;
+} bench_server_t;
+
+static uint64_t rng_next(uint64_t* x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+static void* server_main(void* arg) {
+    bench_server_t* s = arg;
+    int fd = accept4(s->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    s->rc = fd < 0 ? -1 : sm3_nbd_serve_fd(s->nbd, fd);
+    if (fd >= 0) close(fd);
+    return NULL;
+}
+
+static void* sender_main(void* arg) {
+    bench_client_t* c = arg;
+    uint32_t len = c->cfg->req_kb * 1024;
+    for (uint64_t i = 0; i < c->cfg->ops && !c->failed; i++) {
+        while (sem_wait(&c->slots) != 0 && errno == EINTR) {}
+        c->sent_ns[i] = sm3_now_ns();
+        const bench_op_t* op = &c->ops[i];
+        if (sm3_nbd_request(c->fd, op->is_read ? SM3_NBD_CMD_READ : SM3_NBD_CMD_WRITE, 0, i,
+                            op->offset, len, op->is_read ? NULL : c->wdata + (i % 64) * 512) != 0) {
+            c->failed = 1;
+        }
+    }
+    return NULL;
+}
+
+static void* receiver_main(void* arg) {
+    bench_client_t* c = arg;
+    uint32_t len = c->cfg->req_kb * 1024;
+    uint8_t* buf = malloc(len);
+    for (uint64_t i = 0; i < c->cfg->ops && buf; i++) {
+        uint64_t handle;
+        uint32_t error;
+        if (sm3_nbd_reply(c->fd, &handle, &error) != 0 || handle >= c->cfg->ops) {
+            c->failed = 1;
+            sem_post(&c->slots);
+            break;
+        }
+        if (c->ops[handle].is_read && !error && sm3_nbd_recv_data(c->fd, buf, len) != 0) {
+            c->failed = 1;
+            sem_post(&c->slots);
+            break;
+        }
+        c->errors += error != 0;
+        c->lat_ns[handle] = sm3_now_ns() - c->sent_ns[handle];
+        sem_post(&c->slots);
+    }
+    free(buf);
+    return NULL;
+}
+
+typedef struct {
+    uint64_t elapsed_ns;
+    uint64_t* read_ns;
+    uint64_t* write_ns;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t errors;
+    sm3_nbd_stats_t server;
+} bench_result_t;
+
+static int run_mode(const bench_cfg_t* cfg, const char* data_path, const bench_op_t* ops,
+                    const uint8_t* wdata, int integrity, bench_result_t* res) {
+    char tags[600], sock[600], addr[640];
+    snprintf(tags, sizeof(tags), "%s%s", data_path, SM3_STORE_TAGS_SUFFIX);
+    unlink(tags);
+    strcat(tags, SM3_JOURNAL_SUFFIX);
+    unlink(tags);
+    sm3_nbd_opts_t opts;
+    sm3_nbd_opts_default(&opts);
+    opts.integrity = integrity;
+    opts.num_threads = cfg->threads;
+    opts.queue_depth = cfg->queue_depth;
+    sm3_nbd_t* nbd = sm3_nbd_open(data_path, &opts);     // 完整性模式在此生成初始标签（不计时）
+    if (!nbd) {
+        return -1;
+    }
+    snprintf(sock, sizeof(sock), "%s.sock", data_path);
+    int lfd = sm3_nbd_listen(cfg->tcp ? "127.0.0.1:0" : sock);
+    if (lfd >= 0 && cfg->tcp) {
+        struct sockaddr_in sa;
+        socklen_t alen = sizeof(sa);
+        getsockname(lfd, (struct sockaddr*)&sa, &alen);
+        snprintf(addr, sizeof(addr), "127.0.0.1:%u", ntohs(sa.sin_port));
+    } else {
+        snprintf(addr, sizeof(addr), "%s", sock);
+    }
+    bench_server_t srv = { nbd, lfd, 0 };
+    pthread_t stid, tx, rx;
+    if (lfd < 0 || pthread_create(&stid, NULL, server_main, &srv) != 0) {
+        if (lfd >= 0) close(lfd);
+        sm3_nbd_close(nbd);
+        return -1;
+    }
+
+    bench_client_t c;
+    memset(&c, 0, sizeof(c));
+    c.cfg = cfg;
+    c.ops = ops;
+    c.wdata = wdata;
+    c.fd = sm3_nbd_connect(addr);
+    c.sent_ns = calloc(cfg->ops, sizeof(uint64_t));
+    c.lat_ns = calloc(cfg->ops, sizeof(uint64_t));
+    sem_init(&c.slots, 0, cfg->queue_depth);
+    uint64_t size;
+    uint16_t flags;
+    int rc = c.fd >= 0 && c.sent_ns && c.lat_ns && sm3_nbd_handshake(c.fd, &size, &flags) == 0 ? 0 : -1;
+    if (rc == 0) {
+        uint64_t t0 = sm3_now_ns();
+        pthread_create(&rx, NULL, receiver_main, &c);
+        pthread_create(&tx, NULL, sender_main, &c);
+        pthread_join(tx, NULL);
+        pthread_join(rx, NULL);
+        res->elapsed_ns = sm3_now_ns() - t0;
+        // FLUSH 后断开
+        uint64_t handle;
+        uint32_t error;
+        if (c.failed || sm3_nbd_request(c.fd, SM3_NBD_CMD_FLUSH, 0, 0, 0, 0, NULL) != 0 ||
+            sm3_nbd_reply(c.fd, &handle, &error) != 0 || error != 0) {
+            rc = -1;
+        }
+        sm3_nbd_request(c.fd, SM3_NBD_CMD_DISC, 0, 0, 0, 0, NULL);
+    }
+    if (c.fd >= 0) {
+        shutdown(c.fd, SHUT_WR);
+    } else {
+        shutdown(lfd, SHUT_RDWR);
+    }
+    pthread_join(stid, NULL);
+    if (c.fd >= 0) close(c.fd);
+    close(lfd);
+    if (!cfg->tcp) unlink(sock);
+    sem_destroy(&c.slots);
+    sm3_nbd_stats(nbd, &res->server);
+    sm3_nbd_close(nbd);
+
+    res->read_ns = malloc(cfg->ops * sizeof(uint64_t));
+    res->write_ns = malloc(cfg->ops * sizeof(uint64_t));
+    if (rc == 0 && res->read_ns && res->write_ns) {
+        for (uint64_t i = 0; i < cfg->ops; i++) {
+            if (ops[i].is_read) {
+                res->read_ns[res->reads++] = c.lat_ns[i];
+            } else {
+                res->write_ns[res->writes++] = c.lat_ns[i];
+            }
+        }
+        res->errors = c.errors;
+    }
+    free(c.sent_ns);
+    free(c.lat_ns);
+    return rc == 0 && srv.rc == 0 && res->read_ns && res->write_ns ? 0 : -1;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double pct_us(const uint64_t* ns, uint64_t n, double p) {
+    return n ? ns[(uint64_t)(p * (double)(n - 1))] / 1000.0 : 0.0;
+}
+
+static void print_row(const char* name, const bench_cfg_t* cfg, bench_result_t* r) {
+    qsort(r->read_ns, r->reads, 8, cmp_u64);
+    qsort(r->write_ns, r->writes, 8, cmp_u64);
+    double secs = r->elapsed_ns / 1e9;
+    double ops = (double)(r->reads + r->writes);
+    printf("%-10s %10.0f %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, ops / secs,
+           ops * cfg->req_kb / 1024.0 / secs,
+           pct_us(r->read_ns, r->reads, 0.5), pct_us(r->read_ns, r->reads, 0.99),
+           pct_us(r->write_ns, r->writes, 0.5), pct_us(r->write_ns, r->writes, 0.99));
+}
+
+static int run_bench(int argc, char** argv) {
+    bench_cfg_t cfg = { 64, 4, 70, 32, 50000, 0, 0, 0, "/tmp" };
+    int opt;
+    optind = 2;
+    while ((opt = getopt(argc, argv, "s:z:r:q:n:t:uTd:")) != -1) {
+        switch (opt) {
+        case 's': cfg.ws_mb = strtoull(optarg, NULL, 10); break;
+        case 'z': cfg.req_kb = (uint32_t)atoi(optarg); break;
+        case 'r': cfg.read_pct = atoi(optarg); break;
+        case 'q': cfg.queue_depth = (uint32_t)atoi(optarg); break;
+        case 'n': cfg.ops = strtoull(optarg, NULL, 10); break;
+        case 't': cfg.threads = atoi(optarg); break;
+        case 'u': cfg.unaligned = 1; break;
+        case 'T': cfg.tcp = 1; break;
+        case 'd': cfg.dir = optarg; break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    uint64_t ws = cfg.ws_mb << 20;
+    uint32_t len = cfg.req_kb * 1024;
+    if (cfg.req_kb == 0 || len > SM3_NBD_MAX_REQUEST || ws < 2ull * len || cfg.queue_depth == 0 ||
+        cfg.ops == 0) {
+        fprintf(stderr, "参数无效\n");
+        return 2;
+    }
+
+    // 请求序列与写入数据（两种模式相同）
+    uint64_t seed = 88172645463325252ull;
+    bench_op_t* ops = malloc(cfg.ops * sizeof(bench_op_t));
+    uint8_t* wdata = malloc((size_t)len + 64 * 512);
+    enum { FILL = 1 << 20 };
+    uint8_t* fill = malloc(FILL);
+    if (!ops || !wdata || !fill) {
+        fprintf(stderr, "内存不足\n");
+        return 1;
+    }
+    uint64_t align = cfg.unaligned ? 512 : SM3_PAGE_SIZE;
+    for (uint64_t i = 0; i < cfg.ops; i++) {
+        ops[i].is_read = (int)(rng_next(&seed) % 100) < cfg.read_pct;
+        ops[i].offset = rng_next(&seed) % ((ws - len) / align + 1) * align;
+    }
+    for (size_t i = 0; i < ((size_t)len + 64 * 512) / 8; i++) ((uint64_t*)wdata)[i] = rng_next(&seed);
+
+    char data_path[512];
+    snprintf(data_path, sizeof(data_path), "%s/sm3_nbd_bench.%d", cfg.dir, getpid());
+    bench_result_t res[2];
+    memset(res, 0, sizeof(res));
+    int rc = 0;
+    printf("配置: 工作集 %llu MB, 请求 %u KB%s, 读 %d%%, 队列深度 %u, %llu个请求, %s\n",
+           (unsigned long long)cfg.ws_mb, cfg.req_kb, cfg.unaligned ? " (512字节对齐)" : "",
+           cfg.read_pct, cfg.queue_depth, (unsigned long long)cfg.ops,
+           cfg.tcp ? "回环 TCP" : "Unix 套接字");
+    for (int mode = 0; mode < 2 && rc == 0; mode++) {
+        // 每种模式从相同的初始数据开始
+        int fd = open(data_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        uint64_t s2 = 0x9E3779B97F4A7C15ull;
+        for (uint64_t mb = 0; fd >= 0 && mb < cfg.ws_mb; mb++) {
+            for (size_t i = 0; i < FILL / 8; i++) ((uint64_t*)fill)[i] = rng_next(&s2);
+            if (pwrite(fd, fill, FILL, (off_t)(mb * FILL)) != FILL) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        if (fd < 0) {
+            fprintf(stderr, "创建测试文件失败: %s\n", strerror(errno));
+            rc = 1;
+            break;
+        }
+        fsync(fd);
+        close(fd);
+        if (run_mode(&cfg, data_path, ops, wdata, mode, &res[mode]) != 0) {
+            fprintf(stderr, "%s服务端运行失败: %s\n", mode ? "完整性" : "普通", strerror(errno));
+            rc = 1;
+        }
+    }
+
+    // 完整性模式结束后，标签应与数据一致
+    char tags[600];
+    snprintf(tags, sizeof(tags), "%s%s", data_path, SM3_STORE_TAGS_SUFFIX);
+    sm3_scan_opts_t sopts;
+    sm3_scan_opts_default(&sopts);
+    sm3_scan_stats_t sst;
+    if (rc == 0 && (sm3_manifest_verify(data_path, tags, &sopts, &sst, NULL, NULL) != 0 ||
+                    sst.mismatches != 0)) {
+        fprintf(stderr, "✗ 运行结束后数据与标签不一致\n");
+        rc = 1;
+    }
+    unlink(tags);
+    strcat(tags, SM3_JOURNAL_SUFFIX);
+    unlink(tags);
+    unlink(data_path);
+
+    if (rc == 0) {
+        printf("\n%-10s %10s %9s %9s %9s %9s %9s\n", "", "ops/s", "MB/s",
+               "读P50us", "读P99us", "写P50us", "写P99us");
+        print_row("普通", &cfg, &res[0]);
+        print_row("完整性", &cfg, &res[1]);
+        double ops_off = (res[0].reads + res[0].writes) / (res[0].elapsed_ns / 1e9);
+        double ops_on = (res[1].reads + res[1].writes) / (res[1].elapsed_ns / 1e9);
+        printf("\n开销: ops/s %+.1f%%, 读P99 %+.1f us, 写P99 %+.1f us; 请求出错 %llu/%llu\n",
+               (ops_on / ops_off - 1) * 100,
+               pct_us(res[1].read_ns, res[1].reads, 0.99) - pct_us(res[0].read_ns, res[0].reads, 0.99),
+               pct_us(res[1].write_ns, res[1].writes, 0.99) - pct_us(res[0].write_ns, res[0].writes, 0.99),
+               (unsigned long long)res[0].errors, (unsigned long long)res[1].errors);
+        printf("\n完整性服务端:\n");
+        print_server_stats(&res[1].server);
+        if (res[0].errors || res[1].errors) {
+            rc = 1;
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        free(res[i].read_ns);
+        free(res[i].write_ns);
+    }
+    free(ops);
+    free(wdata);
+    free(fill);
+    return rc;
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 3 && strcmp(argv[1], "serve") == 0) {
+        return run_serve(argc, argv);
+    }
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        return run_bench(argc, argv);
+    }
+    usage(argv[0]);
+    return 2;
+}
@@ -0,0 +1,388 @@
+/*
+ * 过载自适应校验级别
+ *
+ * 级别状态每个类别一份，由一把锁保护：observe 只做几次比较，verify 只在取级别
+ * 和累加统计时持锁，校验计算本身不持锁。
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+#include "sm3_overload.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#define EWMA_SHIFT  3               // 延迟 EWMA 权重 1/8
+#define GROUP       64              // 批量校验每组页数
+
+typedef struct {
+    sm3_overload_class_t cfg;
+    sm3_overload_stats_t stats;
+    uint64_t over_since;            // 过载条件开始成立的时刻（0 表示未成立）
+    uint64_t calm_since;            // 恢复条件开始成立的时刻
+    uint64_t sample_phase;          // 抽样位置，逐请求轮转
+} class_state_t;
+
+struct sm3_overload {
+    int classes;
+    pthread_mutex_t lock;
+    class_state_t* cls;
+};
+
+static const char* const level_names[SM3_LEVELS] = { "full", "xor", "crc", "sampled" };
+
+const char* sm3_level_name(int level) {
+    return level >= 0 && level < SM3_LEVELS ? level_names[level] : "?";
+}
+
+// ============================================================================
+// CRC32C
+// ============================================================================
+
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_table_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+        crc_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            uint32_t c = crc_table[t - 1][i];
+            crc_table[t][i] = (c >> 8) ^ crc_table[0][c & 0xff];
+        }
+    }
+}
+
+// 通用实现：每次处理8字节（slicing-by-8）
+static uint32_t crc32c_generic(uint32_t crc, const uint8_t* p, size_t len) {
+    pthread_once(&crc_once, crc_table_init);
+    while (len && ((uintptr_t)p & 7)) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xff];
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        v ^= crc;
+        crc = crc_table[7][v & 0xff] ^ crc_table[6][(v >> 8) & 0xff] ^
+              crc_table[5][(v >> 16) & 0xff] ^ crc_table[4][(v >> 24) & 0xff] ^
+              crc_table[3][(v >> 32) & 0xff] ^ crc_table[2][(v >> 40) & 0xff] ^
+              crc_table[1][(v >> 48) & 0xff] ^ crc_table[0][v >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t* p, size_t len) {
+    uint64_t c = crc;
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)c;
+    while (len--) crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+
+static int crc32c_hw_enabled(void) {
+    static int enabled = -1;
+    if (enabled < 0) {
+        __builtin_cpu_init();
+        enabled = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+    }
+    return enabled;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t* p, size_t len) {
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) crc = __crc32cb(crc, *p++);
+    return crc;
+}
+
+static int crc32c_hw_enabled(void) {
+    return 1;
+}
+#else
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t* p, size_t len) {
+    return crc32c_generic(crc, p, len);
+}
+
+static int crc32c_hw_enabled(void) {
+    return 0;
+}
+#endif
+
+uint32_t sm3_crc32c(uint32_t crc, const void* data, size_t len) {
+    crc = ~crc;
+    crc = crc32c_hw_enabled() ? crc32c_hw(crc, data, len) : crc32c_generic(crc, data, len);
+    return ~crc;
+}
+
+// ============================================================================
+// 分级校验
+// ============================================================================
+
+void sm3_level_tag(const uint8_t* page, sm3_level_tag_t* tag) {
+    sm3_4kb(page, tag->full);
+    aes_sm3_integrity_256bit(page, tag->xor_sm3);
+    tag->crc = sm3_crc32c(0, page, 4096);
+}
+
+// XOR-SM3 校验 pages[idx[k]]，k < n
+static int verify_xor(const uint8_t* const* pages, const sm3_level_tag_t* const* tags,
+                      uint8_t* ok, const int* idx, int n) {
+    const uint8_t* in[GROUP];
+    const uint8_t* exp[GROUP];
+    uint8_t res[GROUP];
+    int bad = 0;
+    for (int i = 0; i < n; i += GROUP) {
+        int m = n - i < GROUP ? n - i : GROUP;
+        for (int k = 0; k < m; k++) {
+            in[k] = pages[idx[i + k]];
+            exp[k] = tags[idx[i + k]]->xor_sm3;
+        }
+        bad += aes_sm3_integrity_verify_mb(in, exp, res, m, 256);
+        for (int k = 0; k < m; k++) ok[idx[i + k]] = res[k];
+    }
+    return bad;
+}
+
+static int verify_level(int level, uint32_t every, uint64_t phase,
+                        const uint8_t* const* pages, const sm3_level_tag_t* const* tags,
+                        uint8_t* ok, int count, sm3_level_result_t* result) {
+    if (level < 0 || level >= SM3_LEVELS || count < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (every == 0) every = 1;
+    int bad = 0;
+    uint32_t verified = 0;
+    switch (level) {
+    case SM3_LEVEL_FULL:
+        for (int i = 0; i < count; i++) {
+            uint8_t d[32];
+            sm3_4kb(pages[i], d);
+            ok[i] = memcmp(d, tags[i]->full, 32) == 0;
+            bad += !ok[i];
+        }
+        verified = (uint32_t)count;
+        break;
+    case SM3_LEVEL_CRC:
+        for (int i = 0; i < count; i++) {
+            ok[i] = sm3_crc32c(0, pages[i], 4096) == tags[i]->crc;
+            bad += !ok[i];
+        }
+        verified = (uint32_t)count;
+        break;
+    case SM3_LEVEL_XOR:
+    case SM3_LEVEL_SAMPLED: {
+        int idx[GROUP];
+        for (int i = 0; i < count; i += GROUP) {
+            int m = count - i < GROUP ? count - i : GROUP;
+            int n = 0;
+            for (int k = 0; k < m; k++) {
+                int p = i + k;
+                if (level == SM3_LEVEL_XOR || (phase + (uint64_t)p) % every == 0) {
+                    idx[n++] = p;
+                } else {
+                    ok[p] = 1;
+                }
+            }
+            bad += verify_xor(pages, tags, ok, idx, n);
+            verified += (uint32_t)n;
+        }
+        break;
+    }
+    }
+    if (result) {
+        result->level = level;
+        result->verified = verified;
+        result->mismatches = (uint32_t)bad;
+    }
+    return bad;
+}
+
+int sm3_level_verify(int level, uint32_t sample_every, const uint8_t* const* pages,
+                     const sm3_level_tag_t* const* tags, uint8_t* ok, int count,
+                     sm3_level_result_t* result) {
+    return verify_level(level, sample_every, 0, pages, tags, ok, count, result);
+}
+
+// ============================================================================
+// 级别调整
+// ============================================================================
+
+void sm3_overload_class_default(sm3_overload_class_t* cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->queue_high = 32;
+    cfg->queue_low = 8;
+    cfg->recover_ratio = 0.5;
+    cfg->degrade_hold_ns = 50000000ull;         // 50ms
+    cfg->recover_hold_ns = 500000000ull;        // 500ms
+    cfg->min_level = SM3_LEVEL_FULL;
+    cfg->max_level = SM3_LEVEL_SAMPLED;
+    cfg->sample_every = 8;
+}
+
+sm3_overload_t* sm3_overload_create(int classes, const sm3_overload_class_t* cfg) {
+    if (classes <= 0 || !cfg) {
+        errno = EINVAL;
+        return NULL;
+    }
+    for (int c = 0; c < classes; c++) {
+        const sm3_overload_class_t* k = &cfg[c];
+        if (k->min_level < 0 || k->max_level >= SM3_LEVELS || k->min_level > k->max_level ||
+            k->queue_low > k->queue_high) {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+    sm3_overload_t* ov = calloc(1, sizeof(*ov));
+    if (!ov) {
+        return NULL;
+    }
+    ov->cls = calloc((size_t)classes, sizeof(class_state_t));
+    if (!ov->cls) {
+        free(ov);
+        return NULL;
+    }
+    ov->classes = classes;
+    for (int c = 0; c < classes; c++) {
+        ov->cls[c].cfg = cfg[c];
+        if (ov->cls[c].cfg.sample_every == 0) ov->cls[c].cfg.sample_every = 1;
+        ov->cls[c].stats.level = cfg[c].min_level;
+    }
+    pthread_mutex_init(&ov->lock, NULL);
+    return ov;
+}
+
+void sm3_overload_destroy(sm3_overload_t* ov) {
+    if (!ov) {
+        return;
+    }
+    pthread_mutex_destroy(&ov->lock);
+    free(ov->cls);
+    free(ov);
+}
+
+void sm3_overload_observe_at(sm3_overload_t* ov, int cls, uint32_t queue_depth,
+                             uint64_t latency_ns, uint64_t now_ns) {
+    if (cls < 0 || cls >= ov->classes) {
+        return;
+    }
+    if (now_ns == 0) now_ns = 1;    // 0 用作"条件未成立"
+    pthread_mutex_lock(&ov->lock);
+    class_state_t* s = &ov->cls[cls];
+    const sm3_overload_class_t* cfg = &s->cfg;
+    uint64_t ewma = s->stats.ewma_ns;
+    if (ewma == 0) {
+        ewma = latency_ns;
+    } else if (latency_ns >= ewma) {
+        ewma += (latency_ns - ewma) >> EWMA_SHIFT;
+    } else {
+        ewma -= (ewma - latency_ns) >> EWMA_SHIFT;
+    }
+    s->stats.ewma_ns = ewma;
+
+    int over = queue_depth >= cfg->queue_high || (cfg->slo_ns && ewma > cfg->slo_ns);
+    int calm = queue_depth <= cfg->queue_low &&
+               (!cfg->slo_ns || (double)ewma < (double)cfg->slo_ns * cfg->recover_ratio);
+    if (over) {
+        s->calm_since = 0;
+        if (!s->over_since) s->over_since = now_ns;
+        if (now_ns - s->over_since >= cfg->degrade_hold_ns && s->stats.level < cfg->max_level) {
+            s->stats.level++;
+            s->stats.degrades++;
+            s->over_since = now_ns;     // 再降一级需要再持续一个周期
+        }
+    } else if (calm) {
+        s->over_since = 0;
+        if (!s->calm_since) s->calm_since = now_ns;
+        if (now_ns - s->calm_since >= cfg->recover_hold_ns && s->stats.level > cfg->min_level) {
+            s->stats.level--;
+            s->stats.recoveries++;
+            s->calm_since = now_ns;
+        }
+    } else {
+        s->over_since = s->calm_since = 0;
+    }
+    pthread_mutex_unlock(&ov->lock);
+}
+
+void sm3_overload_observe(sm3_overload_t* ov, int cls, uint32_t queue_depth, uint64_t latency_ns) {
+    sm3_overload_observe_at(ov, cls, queue_depth, latency_ns, sm3_now_ns());
+}
+
+int sm3_overload_level(sm3_overload_t* ov, int cls) {
+    if (cls < 0 || cls >= ov->classes) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&ov->lock);
+    int level = ov->cls[cls].stats.level;
+    pthread_mutex_unlock(&ov->lock);
+    return level;
+}
+
+int sm3_overload_verify(sm3_overload_t* ov, int cls, const uint8_t* const* pages,
+                        const sm3_level_tag_t* const* tags, uint8_t* ok, int count,
+                        sm3_level_result_t* result) {
+    if (cls < 0 || cls >= ov->classes || count < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&ov->lock);
+    class_state_t* s = &ov->cls[cls];
+    int level = s->stats.level;
+    uint32_t every = s->cfg.sample_every;
+    uint64_t phase = s->sample_phase;
+    s->sample_phase += (uint64_t)count;
+    pthread_mutex_unlock(&ov->lock);
+
+    sm3_level_result_t r;
+    int bad = verify_level(level, every, phase, pages, tags, ok, count, &r);
+
+    pthread_mutex_lock(&ov->lock);
+    s->stats.pages[level] += (uint64_t)count;
+    s->stats.verified[level] += r.verified;
+    pthread_mutex_unlock(&ov->lock);
+    if (result) {
+        *result = r;
+    }
+    return bad;
+}
+
+void sm3_overload_stats(sm3_overload_t* ov, int cls, sm3_overload_stats_t* out) {
+    memset(out, 0, sizeof(*out));
+    if (cls < 0 || cls >= ov->classes) {
+        return;
+    }
+    pthread_mutex_lock(&ov->lock);
+    *out = ov->cls[cls].stats;
+    pthread_mutex_unlock(&ov->lock);
+}
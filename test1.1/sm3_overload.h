@@ -0,0 +1,101 @@
+/*
+ * 过载自适应校验级别
+ *
+ * 服务饱和时宁可降低校验强度，也不让请求无限排队。每个请求类别有当前校验级别，
+ * 由压力信号（队列深度、延迟 EWMA 相对 SLO）驱动：
+ *   - 过载（队列深度 >= queue_high，或延迟 EWMA > slo_ns）持续 degrade_hold_ns，
+ *     降一级，直到该类别允许的最低级别 max_level
+ *   - 恢复（队列深度 <= queue_low，且延迟 EWMA < slo_ns × recover_ratio）持续
+ *     recover_hold_ns，升一级，直到 min_level
+ *   - 介于两者之间时保持不变（滞回，避免来回切换）
+ *
+ * 级别（由强到弱）：
+ *   SM3_LEVEL_FULL     标准 SM3 覆盖整页（sm3_4kb）
+ *   SM3_LEVEL_XOR      XOR 折叠 + SM3（aes_sm3_integrity_mb）
+ *   SM3_LEVEL_CRC      CRC32C 预检（只能发现意外损坏）
+ *   SM3_LEVEL_SAMPLED  每 sample_every 页按 XOR-SM3 校验1页，其余页不校验
+ *
+ * 各级别的参考值写入时一次生成（sm3_level_tag），校验结果记录实际使用的级别
+ * 与实际校验的页数，调用方可据此对降级期间读出的数据安排事后补校验。
+ */
+
+#ifndef SM3_OVERLOAD_H
+#define SM3_OVERLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    SM3_LEVEL_FULL = 0,
+    SM3_LEVEL_XOR,
+    SM3_LEVEL_CRC,
+    SM3_LEVEL_SAMPLED,
+    SM3_LEVELS
+};
+
+// 一页在各级别下的参考值
+typedef struct {
+    uint8_t full[32];           // sm3_4kb
+    uint8_t xor_sm3[32];        // aes_sm3_integrity_256bit
+    uint32_t crc;               // CRC32C
+} sm3_level_tag_t;
+
+typedef struct {
+    uint32_t queue_high;
+    uint32_t queue_low;
+    uint64_t slo_ns;            // 0 表示不看延迟
+    double recover_ratio;
+    uint64_t degrade_hold_ns;
+    uint64_t recover_hold_ns;
+    int min_level;              // 最强（恢复的终点）
+    int max_level;              // 最弱（如关键类别设为 SM3_LEVEL_XOR）
+    uint32_t sample_every;      // SM3_LEVEL_SAMPLED 的抽样间隔
+} sm3_overload_class_t;
+
+typedef struct {
+    int level;                  // 本次使用的级别
+    uint32_t verified;          // 实际校验的页数
+    uint32_t mismatches;
+} sm3_level_result_t;
+
+typedef struct {
+    int level;
+    uint64_t ewma_ns;
+    uint64_t degrades;
+    uint64_t recoveries;
+    uint64_t pages[SM3_LEVELS];     // 各级别下经手的页数
+    uint64_t verified[SM3_LEVELS];  // 各级别下实际校验的页数
+} sm3_overload_stats_t;
+
+typedef struct sm3_overload sm3_overload_t;
+
+// CRC32C（Castagnoli），crc 为前一段的结果（首段传0）；x86 SSE4.2 / ARMv8 CRC 指令可用时使用
+uint32_t sm3_crc32c(uint32_t crc, const void* data, size_t len);
+
+// 生成一页全部级别的参考值
+void sm3_level_tag(const uint8_t* page, sm3_level_tag_t* tag);
+const char* sm3_level_name(int level);
+
+void sm3_overload_class_default(sm3_overload_class_t* cfg);
+// cfg 为 classes 个类别的配置
+sm3_overload_t* sm3_overload_create(int classes, const sm3_overload_class_t* cfg);
+void sm3_overload_destroy(sm3_overload_t* ov);
+
+// 每个请求完成时报告当时的队列深度与请求延迟（_at 使用给定时刻，便于回放与测试）
+void sm3_overload_observe(sm3_overload_t* ov, int cls, uint32_t queue_depth, uint64_t latency_ns);
+void sm3_overload_observe_at(sm3_overload_t* ov, int cls, uint32_t queue_depth,
+                             uint64_t latency_ns, uint64_t now_ns);
+int sm3_overload_level(sm3_overload_t* ov, int cls);
+
+// 按类别当前级别校验 count 页：ok[i] 置1（一致或未抽中）或0；返回不一致的页数
+int sm3_overload_verify(sm3_overload_t* ov, int cls, const uint8_t* const* pages,
+                        const sm3_level_tag_t* const* tags, uint8_t* ok, int count,
+                        sm3_level_result_t* result);
+// 按指定级别校验（不更新统计）
+int sm3_level_verify(int level, uint32_t sample_every, const uint8_t* const* pages,
+                     const sm3_level_tag_t* const* tags, uint8_t* ok, int count,
+                     sm3_level_result_t* result);
+
+void sm3_overload_stats(sm3_overload_t* ov, int cls, sm3_overload_stats_t* out);
+
+#endif // SM3_OVERLOAD_H
@@ -0,0 +1,242 @@
+/*
+ * 常驻工作线程池
+ *
+ * 任务分发：run 发布 (fn, ctx, count, grain) 并递增 generation；
+ * 工作线程与调用线程用原子计数器 next 抢占切块，busy 计数归零后返回。
+ * 开启追踪时（sm3_trace.h）按抽样记录作业、切块与等待区间。
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+#include "sm3_pool.h"
+#include "sm3_trace.h"
+
+struct sm3_pool {
+    int num_threads;                // 含调用线程
+    pthread_t* threads;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    pthread_mutex_t run_lock;       // 串行化并发的 run
+    uint64_t generation;
+    int shutdown;
+    int busy;                       // 仍在处理当前任务的工作线程数
+    // 当前任务
+    sm3_pool_fn fn;
+    void* ctx;
+    size_t count;
+    size_t grain;
+    atomic_size_t next;
+    int traced;                     // 当前作业是否记录追踪事件
+    uint64_t publish_ns;
+    atomic_int started;             // 已启动的工作线程数（用于线程命名）
+    atomic_uint_fast64_t busy_ns;
+};
+
+static void run_chunks(sm3_pool_t* p) {
+    uint64_t t_busy = sm3_now_ns();
+    for (;;) {
+        size_t begin = atomic_fetch_add(&p->next, p->grain);
+        if (begin >= p->count) {
+            break;
+        }
+        size_t end = begin + p->grain < p->count ? begin + p->grain : p->count;
+        uint64_t t0 = p->traced ? sm3_trace_clock() : 0;
+        p->fn(p->ctx, begin, end);
+        sm3_trace_span(SM3_TRACE_TASK, "chunk", t0, begin, end);
+    }
+    atomic_fetch_add_explicit(&p->busy_ns, sm3_now_ns() - t_busy, memory_order_relaxed);
+}
+
+static void* pool_worker(void* arg) {
+    sm3_pool_t* p = arg;
+    uint64_t seen = 0;
+    char name[32];
+    snprintf(name, sizeof(name), "sm3_pool-%d", atomic_fetch_add(&p->started, 1) + 1);
+    sm3_trace_thread_name(name);
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->shutdown && p->generation == seen) {
+            pthread_cond_wait(&p->wake, &p->lock);
+        }
+        if (p->shutdown) {
+            break;
+        }
+        seen = p->generation;
+        pthread_mutex_unlock(&p->lock);
+
+        // 作业发布到本线程开始领取之间的唤醒延迟
+        sm3_trace_span(SM3_TRACE_IDLE, "wake", p->traced ? p->publish_ns : 0, 0, 0);
+        run_chunks(p);
+
+        pthread_mutex_lock(&p->lock);
+        if (--p->busy == 0) {
+            pthread_cond_signal(&p->idle);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+sm3_pool_t* sm3_pool_create(int num_threads) {
+    if (num_threads <= 0) {
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (num_threads <= 0) num_threads = 1;
+    }
+    sm3_pool_t* p = calloc(1, sizeof(*p));
+    if (!p) {
+        return NULL;
+    }
+    p->num_threads = num_threads;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_mutex_init(&p->run_lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    pthread_cond_init(&p->idle, NULL);
+
+    if (num_threads > 1) {
+        p->threads = calloc((size_t)num_threads - 1, sizeof(pthread_t));
+        if (!p->threads) {
+            free(p);
+            return NULL;
+        }
+        for (int i = 0; i < num_threads - 1; i++) {
+            if (pthread_create(&p->threads[i], NULL, pool_worker, p) != 0) {
+                p->num_threads = i + 1;     // 仅使用已创建的线程
+                break;
+            }
+        }
+    }
+    return p;
+}
+
+void sm3_pool_destroy(sm3_pool_t* p) {
+    if (!p) {
+        return;
+    }
+    pthread_mutex_lock(&p->lock);
+    p->shutdown = 1;
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    for (int i = 0; i < p->num_threads - 1; i++) {
+        pthread_join(p->threads[i], NULL);
+    }
+    free(p->threads);
+    pthread_mutex_destroy(&p->lock);
+    pthread_mutex_destroy(&p->run_lock);
+    pthread_cond_destroy(&p->wake);
+    pthread_cond_destroy(&p->idle);
+    free(p);
+}
+
+int sm3_pool_threads(const sm3_pool_t* p) {
+    return p ? p->num_threads : 1;
+}
+
+uint64_t sm3_pool_busy_ns(const sm3_pool_t* p) {
+    return p ? atomic_load_explicit(&p->busy_ns, memory_order_relaxed) : 0;
+}
+
+void sm3_pool_run(sm3_pool_t* p, sm3_pool_fn fn, void* ctx, size_t count, size_t grain) {
+    if (count == 0) {
+        return;
+    }
+    if (grain == 0) grain = 1;
+    // 单线程或只有一块时直接在调用线程执行
+    if (!p || p->num_threads == 1 || count <= grain) {
+        uint64_t t0 = sm3_trace_sample_job() ? sm3_trace_clock() : 0;
+        uint64_t t_busy = p ? sm3_now_ns() : 0;
+        fn(ctx, 0, count);
+        if (p) {
+            atomic_fetch_add_explicit(&p->busy_ns, sm3_now_ns() - t_busy, memory_order_relaxed);
+        }
+        sm3_trace_span(SM3_TRACE_TASK, "chunk", t0, 0, count);
+        return;
+    }
+
+    pthread_mutex_lock(&p->run_lock);
+    int traced = sm3_trace_sample_job();
+    uint64_t t_job = traced ? sm3_trace_clock() : 0;
+    pthread_mutex_lock(&p->lock);
+    p->traced = traced;
+    p->publish_ns = t_job;
+    p->fn = fn;
+    p->ctx = ctx;
+    p->count = count;
+    p->grain = grain;
+    atomic_store(&p->next, 0);
+    p->busy = p->num_threads - 1;
+    p->generation++;
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+
+    run_chunks(p);
+
+    // 调用线程已无切块可领，等待落后的工作线程
+    uint64_t t_wait = traced ? sm3_trace_clock() : 0;
+    pthread_mutex_lock(&p->lock);
+    while (p->busy > 0) {
+        pthread_cond_wait(&p->idle, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+    sm3_trace_span(SM3_TRACE_IDLE, "wait", t_wait, 0, 0);
+    sm3_trace_span(SM3_TRACE_JOB, "job", t_job, count, grain);
+    pthread_mutex_unlock(&p->run_lock);
+}
+
+// ============================================================================
+// 页摘要
+// ============================================================================
+
+typedef struct {
+    const uint8_t* pages;
+    uint8_t* digests;
+    int digest_size;
+} hash_job_t;
+
+static void hash_chunk_128(void* ctx, size_t begin, size_t end) {
+    hash_job_t* job = ctx;
+    enum { GROUP = 16 };
+    const uint8_t* inputs[GROUP];
+    for (size_t i = begin; i < end; i += GROUP) {
+        int n = end - i < GROUP ? (int)(end - i) : GROUP;
+        for (int k = 0; k < n; k++) {
+            inputs[k] = job->pages + (i + k) * 4096;
+        }
+        aes_sm3_integrity_mb_128(inputs, job->digests + i * 16, n);
+    }
+}
+
+static void hash_chunk(void* ctx, size_t begin, size_t end) {
+    hash_job_t* job = ctx;
+    enum { GROUP = 16 };
+    const uint8_t* inputs[GROUP];
+    uint8_t* outputs[GROUP];
+    for (size_t i = begin; i < end; i += GROUP) {
+        int n = end - i < GROUP ? (int)(end - i) : GROUP;
+        for (int k = 0; k < n; k++) {
+            inputs[k] = job->pages + (i + k) * 4096;
+            outputs[k] = job->digests + (i + k) * (size_t)job->digest_size;
+        }
+        aes_sm3_integrity_mb(inputs, outputs, n, job->digest_size * 8);
+    }
+}
+
+void sm3_pool_hash_pages(sm3_pool_t* pool, const uint8_t* pages, size_t count,
+                         uint8_t* digests, int digest_size) {
+    hash_job_t job = { pages, digests, digest_size };
+    sm3_pool_run(pool, digest_size == 16 ? hash_chunk_128 : hash_chunk, &job, count, 64);
+}
+
+void sm3_pool_hash_pages_128(sm3_pool_t* pool, const uint8_t* pages, size_t count,
+                             uint8_t* digests) {
+    hash_job_t job = { pages, digests, 16 };
+    sm3_pool_run(pool, hash_chunk_128, &job, count, 64);
+}
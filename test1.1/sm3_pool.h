@@ -0,0 +1,42 @@
+/*
+ * 常驻工作线程池
+ *
+ * aes_sm3_parallel 每次调用都创建/销毁线程，适合一次性大批量计算；
+ * 页存储、服务端等需要反复提交中小批量任务的场景改用常驻线程池，
+ * 避免线程创建开销。
+ *
+ * sm3_pool_run 为阻塞式并行for：把 [0, count) 按 grain 切块分给工作线程，
+ * 调用线程自身也参与计算，全部完成后返回。同一线程池同一时刻只执行
+ * 一个 run（内部串行化）。
+ */
+
+#ifndef SM3_POOL_H
+#define SM3_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct sm3_pool sm3_pool_t;
+
+// 处理 [begin, end) 区间
+typedef void (*sm3_pool_fn)(void* ctx, size_t begin, size_t end);
+
+// num_threads <= 0 时取在线CPU数；num_threads == 1 时不创建线程
+sm3_pool_t* sm3_pool_create(int num_threads);
+void sm3_pool_destroy(sm3_pool_t* pool);
+int sm3_pool_threads(const sm3_pool_t* pool);
+
+void sm3_pool_run(sm3_pool_t* pool, sm3_pool_fn fn, void* ctx, size_t count, size_t grain);
+
+// 累计忙碌时间：各线程（含调用线程）执行切块的时间之和；
+// 除以 线程数 × 墙钟时间 即为利用率
+uint64_t sm3_pool_busy_ns(const sm3_pool_t* pool);
+
+// 用线程池计算一组连续页的摘要（digest_size: 16 或 32 字节）
+void sm3_pool_hash_pages(sm3_pool_t* pool, const uint8_t* pages, size_t count,
+                         uint8_t* digests, int digest_size);
+// 128位摘要按16字节紧密写入 digests（digest_size 为16时上面的接口也走这一路径）
+void sm3_pool_hash_pages_128(sm3_pool_t* pool, const uint8_t* pages, size_t count,
+                             uint8_t* digests);
+
+#endif // SM3_POOL_H
@@ -0,0 +1,836 @@
+/*
+ * libsm3_preload.so - 为无法修改的程序生成旁路页摘要清单
+ *
+ * 用法:
+ *   LD_PRELOAD=/path/to/libsm3_preload.so 程序 参数...
+ *
+ * 拦截 write / pwrite / pwrite64 / writev，以及改变fd指向的调用：
+ * open / openat / creat / fopen、dup / dup2 / dup3 / fcntl（F_DUPFD、F_SETFL），
+ * 和会关闭fd的 close / close_range / closefrom / fclose。应用线程只做两件事：
+ *   1. 首次写某个fd时判断是否为普通文件，是则另开一个只读私有fd备用。
+ *      fd 表的记录随上述调用维护：dup 出的fd与原fd共用同一记录（共享偏移与
+ *      O_APPEND 标志），关闭时记录的引用减一；新打开的fd编号上残留的记录
+ *      （原fd经未拦截的途径关闭）被丢弃，写入路径不核对fd指向
+ *   2. 每次写入后把 (文件, 偏移, 长度) 放入无锁队列（有界MPMC环形队列）。
+ *      write/writev 的偏移在写入前读取；同一记录上有其他线程同时写入时偏移
+ *      不可靠，改为整文件重算。O_APPEND 的fd不读偏移，追加部分由文件变长
+ *      时的末尾区间覆盖
+ * 写入线程在使用记录期间持有该fd编号的使用计数，关闭方清除记录后等计数
+ * 归零再交给后台线程释放，写入与关闭并发时不会访问已释放的记录。
+ * fork 出的子进程清空继承的记录与队列，首次写入时启动自己的后台线程。
+ * 后台线程从队列取事件，累积每个文件的脏页区间，攒够一批或空闲时
+ * 用私有fd读回脏页，经多缓冲区接口计算摘要，写入旁路清单
+ * "<文件路径><后缀>"（格式同 sm3_manifest.h）。关闭文件时补齐并同步清单。
+ *
+ * 队列满时不阻塞应用：该文件被标记为溢出，关闭时整文件重算。
+ * 已存在且大小与文件一致的旁路清单被增量更新，否则整文件重算。
+ *
+ * 环境变量:
+ *   SM3_PRELOAD_SUFFIX   旁路清单后缀（默认 .sm3m）
+ *   SM3_PRELOAD_PREFIX   只跟踪路径以此开头的文件（默认全部普通文件）
+ *   SM3_PRELOAD_BITS     摘要长度 128 或 256（默认256）
+ *   SM3_PRELOAD_VERBOSE  非空时退出前打印统计
+ *
+ * 限制：glibc 内部的写操作（stdio 的 fwrite/fflush/fclose 刷出的数据）不经过
+ * PLT，不会被拦截；通过 mmap 写入的数据同样看不到。这类文件需要用
+ * sm3_scan hash 生成清单。fork 前后父子进程共享的fd各自跟踪，两个进程
+ * 同时写同一fd时不能发现彼此的并发写入。
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+#include "sm3_manifest.h"
+
+#define PRELOAD_API __attribute__((visibility("default")))
+
+#define MAX_FDS         65536
+#define QUEUE_SIZE      65536       // 2的幂
+#define FLUSH_PAGES     256         // 单个文件脏页达到此数即刷新
+#define READ_PAGES      64
+#define IDLE_SLEEP_NS   1000000
+
+#define EV_WRITE 1
+#define EV_CLOSE 2
+#define EV_APPEND 3
+
+// ============================================================================
+// 被跟踪的文件
+// ============================================================================
+
+typedef struct tracked_file {
+    int fd;                         // 私有只读fd，后台线程读回脏页用
+    char* sidecar;
+    uint64_t initial_size;          // 首次写入前的大小
+    atomic_int refs;                // 指向该记录的应用fd数
+    atomic_int append;              // 应用fd带 O_APPEND（F_SETFL 时更新）
+    atomic_int writers;             // 正在经 write/writev 写入的线程数
+    atomic_int overflow;            // 有事件因队列满而丢失，或偏移不可靠
+    // 以下仅由后台线程访问
+    int opened;
+    int listed;                     // 已在活动文件链表中
+    int full;                       // 需要整文件重算
+    sm3_manifest_t manifest;
+    sm3_range_set_t dirty;
+    uint64_t dirty_pages;
+    struct tracked_file* next;      // 后台线程的活动文件链表
+} tracked_file_t;
+
+#define FD_IGNORED ((tracked_file_t*)1)
+
+static _Atomic(tracked_file_t*) fd_table[MAX_FDS];
+static atomic_int fd_users[MAX_FDS];    // 正在使用该fd记录的应用线程数
+
+// ============================================================================
+// 无锁队列（Vyukov 有界MPMC队列）
+// ============================================================================
+
+typedef struct {
+    atomic_size_t seq;
+    int type;
+    tracked_file_t* file;
+    uint64_t offset;
+    uint64_t len;
+} event_t;
+
+static event_t queue[QUEUE_SIZE];
+static atomic_size_t enqueue_pos;
+static atomic_size_t dequeue_pos;
+
+static int queue_push(int type, tracked_file_t* f, uint64_t offset, uint64_t len) {
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        event_t* e = &queue[pos & (QUEUE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                e->type = type;
+                e->file = f;
+                e->offset = offset;
+                e->len = len;
+                atomic_store_explicit(&e->seq, pos + 1, memory_order_release);
+                return 1;
+            }
+        } else if (dif < 0) {
+            return 0;   // 队列满
+        } else {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+// 仅后台线程调用（单消费者）
+static int queue_pop(event_t* out) {
+    size_t pos = atomic_load_explicit(&dequeue_pos, memory_order_relaxed);
+    event_t* e = &queue[pos & (QUEUE_SIZE - 1)];
+    size_t seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+    if ((intptr_t)seq - (intptr_t)(pos + 1) < 0) {
+        return 0;
+    }
+    out->type = e->type;
+    out->file = e->file;
+    out->offset = e->offset;
+    out->len = e->len;
+    atomic_store_explicit(&dequeue_pos, pos + 1, memory_order_relaxed);
+    atomic_store_explicit(&e->seq, pos + QUEUE_SIZE, memory_order_release);
+    return 1;
+}
+
+// ============================================================================
+// 全局状态
+// ============================================================================
+
+static ssize_t (*real_write)(int, const void*, size_t);
+static ssize_t (*real_pwrite)(int, const void*, size_t, off_t);
+static ssize_t (*real_pwrite64)(int, const void*, size_t, off64_t);
+static ssize_t (*real_writev)(int, const struct iovec*, int);
+static int (*real_close)(int);
+static int (*real_open)(const char*, int, ...);
+static int (*real_open64)(const char*, int, ...);
+static int (*real_openat)(int, const char*, int, ...);
+static int (*real_openat64)(int, const char*, int, ...);
+static int (*real_creat)(const char*, mode_t);
+static FILE* (*real_fopen)(const char*, const char*);
+static FILE* (*real_fopen64)(const char*, const char*);
+static int (*real_dup)(int);
+static int (*real_dup2)(int, int);
+static int (*real_dup3)(int, int, int);
+static int (*real_close_range)(unsigned int, unsigned int, int);
+static void (*real_closefrom)(int);
+static int (*real_fclose)(FILE*);
+static int (*real_fcntl)(int, int, ...);
+static int (*real_fcntl64)(int, int, ...);
+
+static const char* suffix = ".sm3m";
+static const char* prefix;
+static int digest_size = 32;
+static int verbose;
+
+static atomic_int active;           // 跟踪已启用
+static atomic_int started;          // 本进程的后台线程：0 未启动，1 启动中，2 运行中，3 启动失败
+static atomic_int stopping;
+static pthread_t worker;
+static __thread int in_worker;      // 后台线程自身的 I/O 不拦截
+
+static atomic_uint_fast64_t stat_events;
+static atomic_uint_fast64_t stat_dropped;
+static uint64_t stat_pages;
+static uint64_t stat_files;
+
+static void resolve_symbols(void) {
+    if (real_write) {
+        return;
+    }
+    real_pwrite = dlsym(RTLD_NEXT, "pwrite");
+    real_pwrite64 = dlsym(RTLD_NEXT, "pwrite64");
+    real_writev = dlsym(RTLD_NEXT, "writev");
+    real_close = dlsym(RTLD_NEXT, "close");
+    real_open = dlsym(RTLD_NEXT, "open");
+    real_open64 = dlsym(RTLD_NEXT, "open64");
+    real_openat = dlsym(RTLD_NEXT, "openat");
+    real_openat64 = dlsym(RTLD_NEXT, "openat64");
+    real_creat = dlsym(RTLD_NEXT, "creat");
+    real_fopen = dlsym(RTLD_NEXT, "fopen");
+    real_fopen64 = dlsym(RTLD_NEXT, "fopen64");
+    real_dup = dlsym(RTLD_NEXT, "dup");
+    real_dup2 = dlsym(RTLD_NEXT, "dup2");
+    real_dup3 = dlsym(RTLD_NEXT, "dup3");
+    real_close_range = dlsym(RTLD_NEXT, "close_range");
+    real_closefrom = dlsym(RTLD_NEXT, "closefrom");
+    real_fclose = dlsym(RTLD_NEXT, "fclose");
+    real_fcntl = dlsym(RTLD_NEXT, "fcntl");
+    real_fcntl64 = dlsym(RTLD_NEXT, "fcntl64");
+    if (!real_fcntl64) real_fcntl64 = real_fcntl;
+    real_write = dlsym(RTLD_NEXT, "write");
+}
+
+// ============================================================================
+// 后台线程
+// ============================================================================
+
+static int open_sidecar(tracked_file_t* f) {
+    f->opened = 1;
+    sm3_manifest_t* m = &f->manifest;
+    if (sm3_manifest_open(m, f->sidecar, 1) == 0) {
+        if (m->hdr->file_size == f->initial_size && (int)m->hdr->digest_size == digest_size) {
+            return 0;   // 与文件一致，增量更新
+        }
+        sm3_manifest_close(m);
+    }
+    f->full = 1;
+    return sm3_manifest_create(m, f->sidecar, f->initial_size, digest_size);
+}
+
+static void flush_file(tracked_file_t* f) {
+    if (!f->opened && open_sidecar(f) != 0) {
+        f->manifest.fd = -1;
+    }
+    if (!f->manifest.base) {
+        return;     // 旁路清单无法创建
+    }
+
+    struct stat st;
+    if (fstat(f->fd, &st) != 0) {
+        return;
+    }
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t total = sm3_pages_for_size(size);
+    uint64_t old_size = f->manifest.hdr->file_size;
+    if (sm3_manifest_resize(&f->manifest, size) != 0) {
+        return;
+    }
+    // 文件变长：原末页及新增部分（包括越过末尾写入留下的空洞）都需计算
+    if (size > old_size && sm3_range_set_add(&f->dirty, old_size / SM3_PAGE_SIZE, total) != 0) {
+        f->full = 1;
+    }
+    if (f->full || atomic_exchange(&f->overflow, 0)) {
+        f->full = sm3_range_set_add(&f->dirty, 0, total) != 0;
+    }
+
+    // 读回失败的页连同其后未处理的区间留作脏页，下次刷新重试
+    static uint8_t buf[READ_PAGES * SM3_PAGE_SIZE] __attribute__((aligned(64)));
+    uint64_t bytes = 0;
+    sm3_range_set_t* d = &f->dirty;
+    sm3_range_set_t keep;
+    sm3_range_set_init(&keep);
+    uint64_t kept = 0;
+    int failed = 0;
+    for (size_t i = 0; i < d->count; i++) {
+        uint64_t p = d->ranges[i].start;
+        uint64_t end = d->ranges[i].end < total ? d->ranges[i].end : total;
+        while (!failed && p < end) {
+            uint64_t n = end - p < READ_PAGES ? end - p : READ_PAGES;
+            if (sm3_read_pages(f->fd, buf, p, n, size, &bytes) != 0) {
+                failed = 1;
+                break;
+            }
+            sm3_hash_pages(buf, n, sm3_manifest_digest(&f->manifest, p), digest_size, 1);
+            stat_pages += n;
+            p += n;
+        }
+        if (failed && p < end) {
+            if (sm3_range_set_add(&keep, p, end) != 0) {
+                f->full = 1;
+            }
+            kept += end - p;
+        }
+    }
+    sm3_range_set_free(d);
+    *d = keep;
+    f->dirty_pages = kept;
+}
+
+static void close_file(tracked_file_t* f) {
+    flush_file(f);
+    sm3_manifest_sync(&f->manifest);
+    sm3_manifest_close(&f->manifest);
+    sm3_range_set_free(&f->dirty);
+    real_close(f->fd);
+    free(f->sidecar);
+    free(f);
+    stat_files++;
+}
+
+static void* worker_main(void* arg) {
+    (void)arg;
+    in_worker = 1;
+    tracked_file_t* live = NULL;
+    event_t ev;
+    for (;;) {
+        int got = 0;
+        while (queue_pop(&ev)) {
+            got = 1;
+            tracked_file_t* f = ev.file;
+            if (ev.type != EV_CLOSE) {
+                if (!f->listed) {
+                    f->listed = 1;
+                    f->next = live;
+                    live = f;
+                }
+                if (ev.type == EV_WRITE) {
+                    uint64_t first = ev.offset / SM3_PAGE_SIZE;
+                    uint64_t last = (ev.offset + ev.len + SM3_PAGE_SIZE - 1) / SM3_PAGE_SIZE;
+                    if (sm3_range_set_add(&f->dirty, first, last) != 0) {
+                        f->full = 1;
+                    }
+                    f->dirty_pages += last - first;
+                } else {
+                    // 追加：刷新时按文件变长的部分计算，这里只计入刷新阈值
+                    f->dirty_pages += (ev.len + SM3_PAGE_SIZE - 1) / SM3_PAGE_SIZE;
+                }
+                if (f->dirty_pages >= FLUSH_PAGES) {
+                    flush_file(f);
+                }
+            } else {
+                for (tracked_file_t** pp = &live; *pp; pp = &(*pp)->next) {
+                    if (*pp == f) {
+                        *pp = f->next;
+                        break;
+                    }
+                }
+                close_file(f);
+            }
+        }
+        if (got) {
+            continue;
+        }
+        // 队列空闲：刷新所有脏文件，使清单尽快跟上
+        for (tracked_file_t* f = live; f; f = f->next) {
+            if (f->dirty_pages || f->full || atomic_load(&f->overflow)) {
+                flush_file(f);
+            }
+        }
+        if (atomic_load(&stopping)) {
+            // 进程退出：未关闭的文件也补齐并同步清单
+            while (live) {
+                tracked_file_t* f = live;
+                live = f->next;
+                close_file(f);
+            }
+            break;
+        }
+        struct timespec ts = { 0, IDLE_SLEEP_NS };
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+// ============================================================================
+// 应用线程侧
+// ============================================================================
+
+static int ends_with(const char* s, const char* tail) {
+    size_t a = strlen(s), b = strlen(tail);
+    return a >= b && strcmp(s + a - b, tail) == 0;
+}
+
+// 本进程的后台线程在首个被跟踪的文件出现时启动（fork 出的子进程同样如此）
+static int start_worker(void) {
+    int s = 0;
+    if (atomic_compare_exchange_strong(&started, &s, 1)) {
+        s = pthread_create(&worker, NULL, worker_main, NULL) == 0 ? 2 : 3;
+        atomic_store(&started, s);
+    }
+    while (s == 1) {
+        sched_yield();
+        s = atomic_load(&started);
+    }
+    return s == 2;
+}
+
+// 首次写入时判断fd是否需要跟踪
+static tracked_file_t* classify(int fd) {
+    struct stat st;
+    char link[64], path[PATH_MAX];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    ssize_t len;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        (len = readlink(link, path, sizeof(path) - 1)) <= 0) {
+        return FD_IGNORED;
+    }
+    path[len] = 0;
+    if (path[0] != '/' || ends_with(path, suffix) || (prefix && strncmp(path, prefix, strlen(prefix)) != 0)) {
+        return FD_IGNORED;
+    }
+
+    tracked_file_t* f = calloc(1, sizeof(*f));
+    size_t slen = (size_t)len + strlen(suffix) + 1;
+    char* sidecar = malloc(slen);
+    // 应用的fd可能只写，经 /proc 重新以只读方式打开同一个文件
+    int priv = real_open(link, O_RDONLY | O_CLOEXEC);
+    if (!f || !sidecar || priv < 0 || !start_worker()) {
+        free(f);
+        free(sidecar);
+        if (priv >= 0) real_close(priv);
+        return FD_IGNORED;
+    }
+    snprintf(sidecar, slen, "%s%s", path, suffix);
+    f->fd = priv;
+    f->sidecar = sidecar;
+    f->initial_size = (uint64_t)st.st_size;
+    atomic_init(&f->refs, 1);
+    int fl = real_fcntl(fd, F_GETFL);
+    atomic_init(&f->append, fl >= 0 && (fl & O_APPEND));
+    f->manifest.fd = -1;
+    sm3_range_set_init(&f->dirty);
+    return f;
+}
+
+static void destroy_unqueued(tracked_file_t* f) {
+    real_close(f->fd);
+    free(f->sidecar);
+    free(f);
+}
+
+// 关闭事件不能丢：队列满时让出CPU等待后台线程腾出空间
+static void push_close(tracked_file_t* f) {
+    while (!queue_push(EV_CLOSE, f, 0, 0)) {
+        sched_yield();
+    }
+}
+
+// fd 即将关闭、被替换或刚被重新分配：丢弃其记录。正在经该fd写入的线程
+// 仍在使用记录，等其结束后再释放引用
+static void forget_fd(int fd) {
+    if (in_worker || fd < 0 || fd >= MAX_FDS || !atomic_load(&active)) {
+        return;
+    }
+    if (!atomic_load_explicit(&fd_table[fd], memory_order_relaxed)) {
+        return;
+    }
+    tracked_file_t* f = atomic_exchange(&fd_table[fd], NULL);
+    if (!f || f == FD_IGNORED) {
+        return;
+    }
+    while (atomic_load(&fd_users[fd]) != 0) {
+        sched_yield();
+    }
+    if (atomic_fetch_sub(&f->refs, 1) == 1) {
+        push_close(f);
+    }
+}
+
+// 取得fd的记录并持有使用计数，返回非NULL时须配对调用 release
+static tracked_file_t* acquire(int fd) {
+    if (in_worker || fd < 0 || fd >= MAX_FDS || !atomic_load_explicit(&active, memory_order_relaxed)) {
+        return NULL;
+    }
+    if (atomic_load_explicit(&fd_table[fd], memory_order_acquire) == FD_IGNORED) {
+        return NULL;
+    }
+    // 先登记再读表：forget_fd 要么看到登记而等待，要么已清除表项
+    atomic_fetch_add(&fd_users[fd], 1);
+    tracked_file_t* f = atomic_load(&fd_table[fd]);
+    if (!f) {
+        tracked_file_t* created = classify(fd);
+        if (atomic_compare_exchange_strong(&fd_table[fd], &f, created)) {
+            f = created;
+        } else if (created != FD_IGNORED) {
+            // 其他线程抢先完成了判定
+            destroy_unqueued(created);
+        }
+    }
+    if (f == FD_IGNORED) {
+        atomic_fetch_sub(&fd_users[fd], 1);
+        return NULL;
+    }
+    return f;
+}
+
+static void release(tracked_file_t* f, int fd) {
+    if (f) {
+        atomic_fetch_sub_explicit(&fd_users[fd], 1, memory_order_release);
+    }
+}
+
+// dup 成功：newfd 与 oldfd 共用同一记录
+static void link_fd(int oldfd, int newfd) {
+    forget_fd(newfd);
+    if (newfd < 0 || newfd >= MAX_FDS) {
+        return;
+    }
+    tracked_file_t* f = acquire(oldfd);
+    if (!f) {
+        return;
+    }
+    atomic_fetch_add(&f->refs, 1);
+    tracked_file_t* expected = NULL;
+    if (!atomic_compare_exchange_strong(&fd_table[newfd], &expected, f)) {
+        atomic_fetch_sub(&f->refs, 1);  // 其他线程已经由 newfd 写入并判定
+    }
+    release(f, oldfd);
+}
+
+static void note_write(tracked_file_t* f, int64_t offset, ssize_t n) {
+    if (!f || n <= 0) {
+        return;
+    }
+    atomic_fetch_add_explicit(&stat_events, 1, memory_order_relaxed);
+    // O_APPEND 下 pwrite 同样写到文件末尾，给定的偏移无意义
+    int type = atomic_load_explicit(&f->append, memory_order_relaxed) ? EV_APPEND : EV_WRITE;
+    if (!queue_push(type, f, (uint64_t)offset, (uint64_t)n)) {
+        atomic_store(&f->overflow, 1);
+        atomic_fetch_add_explicit(&stat_dropped, 1, memory_order_relaxed);
+    }
+}
+
+// write/writev 写入前读取当前偏移。偏移在读取与写入之间可能被其他线程的
+// 写入改变，此时两者的写入区间重叠，至少一方能看到对方，整文件重算。
+// 偏移由内核维护（lseek、mmap、readv 等也会改变它），不在用户态推算
+static int64_t begin_write(tracked_file_t* f, int fd, int* append) {
+    *append = f && atomic_load_explicit(&f->append, memory_order_relaxed);
+    if (!f || *append) {
+        return 0;
+    }
+    if (atomic_fetch_add(&f->writers, 1) != 0) {
+        atomic_store(&f->overflow, 1);
+    }
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos < 0) {
+        atomic_store(&f->overflow, 1);
+    }
+    return (int64_t)pos;
+}
+
+static void end_write(tracked_file_t* f, int fd, int append, int64_t pos, ssize_t n) {
+    if (!f) {
+        return;
+    }
+    if (!append && atomic_fetch_sub(&f->writers, 1) != 1) {
+        atomic_store(&f->overflow, 1);
+    }
+    if (pos >= 0) {
+        note_write(f, pos, n);
+    }
+    release(f, fd);
+}
+
+PRELOAD_API ssize_t write(int fd, const void* buf, size_t count) {
+    resolve_symbols();
+    tracked_file_t* f = acquire(fd);
+    int append;
+    int64_t pos = begin_write(f, fd, &append);
+    ssize_t n = real_write(fd, buf, count);
+    end_write(f, fd, append, pos, n);
+    return n;
+}
+
+PRELOAD_API ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    resolve_symbols();
+    tracked_file_t* f = acquire(fd);
+    ssize_t n = real_pwrite(fd, buf, count, offset);
+    note_write(f, offset, n);
+    release(f, fd);
+    return n;
+}
+
+PRELOAD_API ssize_t pwrite64(int fd, const void* buf, size_t count, off64_t offset) {
+    resolve_symbols();
+    tracked_file_t* f = acquire(fd);
+    ssize_t n = real_pwrite64(fd, buf, count, offset);
+    note_write(f, offset, n);
+    release(f, fd);
+    return n;
+}
+
+PRELOAD_API ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
+    resolve_symbols();
+    tracked_file_t* f = acquire(fd);
+    int append;
+    int64_t pos = begin_write(f, fd, &append);
+    ssize_t n = real_writev(fd, iov, iovcnt);
+    end_write(f, fd, append, pos, n);
+    return n;
+}
+
+// 新分配的fd编号上可能残留经未拦截途径关闭的fd的记录
+static mode_t open_mode(int flags, va_list ap) {
+    return (flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE ? (mode_t)va_arg(ap, int) : 0;
+}
+
+PRELOAD_API int open(const char* path, int flags, ...) {
+    resolve_symbols();
+    va_list ap;
+    va_start(ap, flags);
+    mode_t mode = open_mode(flags, ap);
+    va_end(ap);
+    int fd = real_open(path, flags, mode);
+    forget_fd(fd);
+    return fd;
+}
+
+PRELOAD_API int open64(const char* path, int flags, ...) {
+    resolve_symbols();
+    va_list ap;
+    va_start(ap, flags);
+    mode_t mode = open_mode(flags, ap);
+    va_end(ap);
+    int fd = real_open64(path, flags, mode);
+    forget_fd(fd);
+    return fd;
+}
+
+PRELOAD_API int openat(int dirfd, const char* path, int flags, ...) {
+    resolve_symbols();
+    va_list ap;
+    va_start(ap, flags);
+    mode_t mode = open_mode(flags, ap);
+    va_end(ap);
+    int fd = real_openat(dirfd, path, flags, mode);
+    forget_fd(fd);
+    return fd;
+}
+
+PRELOAD_API int openat64(int dirfd, const char* path, int flags, ...) {
+    resolve_symbols();
+    va_list ap;
+    va_start(ap, flags);
+    mode_t mode = open_mode(flags, ap);
+    va_end(ap);
+    int fd = real_openat64(dirfd, path, flags, mode);
+    forget_fd(fd);
+    return fd;
+}
+
+PRELOAD_API int creat(const char* path, mode_t mode) {
+    resolve_symbols();
+    int fd = real_creat(path, mode);
+    forget_fd(fd);
+    return fd;
+}
+
+// glibc 的 fopen 在内部打开文件，不经过上面的 open
+PRELOAD_API FILE* fopen(const char* path, const char* mode) {
+    resolve_symbols();
+    FILE* fp = real_fopen(path, mode);
+    if (fp) forget_fd(fileno(fp));
+    return fp;
+}
+
+PRELOAD_API FILE* fopen64(const char* path, const char* mode) {
+    resolve_symbols();
+    FILE* fp = real_fopen64(path, mode);
+    if (fp) forget_fd(fileno(fp));
+    return fp;
+}
+
+PRELOAD_API int dup(int oldfd) {
+    resolve_symbols();
+    int r = real_dup(oldfd);
+    if (r >= 0) {
+        link_fd(oldfd, r);
+    }
+    return r;
+}
+
+// dup2/dup3 成功时先隐式关闭 newfd
+PRELOAD_API int dup2(int oldfd, int newfd) {
+    resolve_symbols();
+    int r = real_dup2(oldfd, newfd);
+    if (r >= 0 && oldfd != newfd) {
+        link_fd(oldfd, newfd);
+    }
+    return r;
+}
+
+PRELOAD_API int dup3(int oldfd, int newfd, int flags) {
+    resolve_symbols();
+    int r = real_dup3(oldfd, newfd, flags);
+    if (r >= 0) {
+        link_fd(oldfd, newfd);
+    }
+    return r;
+}
+
+// fcntl 的第三个参数按调用约定以指针宽度转发；F_DUPFD 系列复制fd，
+// F_SETFL 可能改变 O_APPEND
+static void after_fcntl(int fd, int cmd, void* arg, int r) {
+    if (r < 0 || in_worker) {
+        return;
+    }
+    if (cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC) {
+        link_fd(fd, r);
+    } else if (cmd == F_SETFL && fd >= 0 && fd < MAX_FDS) {
+        tracked_file_t* f = acquire(fd);
+        if (f) {
+            atomic_store(&f->append, ((int)(intptr_t)arg & O_APPEND) != 0);
+            release(f, fd);
+        }
+    }
+}
+
+PRELOAD_API int fcntl(int fd, int cmd, ...) {
+    resolve_symbols();
+    va_list ap;
+    va_start(ap, cmd);
+    void* arg = va_arg(ap, void*);
+    va_end(ap);
+    int r = real_fcntl(fd, cmd, arg);
+    after_fcntl(fd, cmd, arg, r);
+    return r;
+}
+
+PRELOAD_API int fcntl64(int fd, int cmd, ...) {
+    resolve_symbols();
+    va_list ap;
+    va_start(ap, cmd);
+    void* arg = va_arg(ap, void*);
+    va_end(ap);
+    int r = real_fcntl64(fd, cmd, arg);
+    after_fcntl(fd, cmd, arg, r);
+    return r;
+}
+
+PRELOAD_API int close(int fd) {
+    resolve_symbols();
+    forget_fd(fd);
+    return real_close(fd);
+}
+
+PRELOAD_API int close_range(unsigned int first, unsigned int last, int flags) {
+    resolve_symbols();
+    if (!(flags & CLOSE_RANGE_CLOEXEC)) {
+        for (unsigned int fd = first; fd <= last && fd < MAX_FDS; fd++) {
+            forget_fd((int)fd);
+        }
+    }
+    return real_close_range(first, last, flags);
+}
+
+PRELOAD_API void closefrom(int lowfd) {
+    resolve_symbols();
+    for (int fd = lowfd < 0 ? 0 : lowfd; fd < MAX_FDS; fd++) {
+        forget_fd(fd);
+    }
+    real_closefrom(lowfd);
+}
+
+// stdio 的关闭在 glibc 内部调用 close，不经过上面的拦截
+PRELOAD_API int fclose(FILE* stream) {
+    resolve_symbols();
+    forget_fd(fileno(stream));
+    return real_fclose(stream);
+}
+
+// ============================================================================
+// 初始化与退出
+// ============================================================================
+
+// 子进程只有调用 fork 的线程：父进程的后台线程与正在写入的线程都不存在。
+// 丢弃队列中父进程的事件和继承的记录（记录仍由父进程处理，子进程只关闭
+// 其私有fd），子进程的写入从头判定并由子进程自己的后台线程处理
+static void atfork_child(void) {
+    size_t head = atomic_load(&dequeue_pos);
+    size_t tail = atomic_load(&enqueue_pos);
+    for (size_t pos = head; pos != tail; pos++) {
+        atomic_store(&queue[pos & (QUEUE_SIZE - 1)].seq, pos + QUEUE_SIZE);
+    }
+    atomic_store(&dequeue_pos, tail);
+    for (int fd = 0; fd < MAX_FDS; fd++) {
+        if (atomic_load_explicit(&fd_users[fd], memory_order_relaxed)) {
+            atomic_store(&fd_users[fd], 0);
+        }
+        tracked_file_t* f = atomic_load_explicit(&fd_table[fd], memory_order_relaxed);
+        if (!f) {
+            continue;
+        }
+        atomic_store(&fd_table[fd], NULL);
+        if (f != FD_IGNORED && atomic_fetch_sub(&f->refs, 1) == 1) {
+            real_close(f->fd);
+        }
+    }
+    atomic_store(&stat_events, 0);
+    atomic_store(&stat_dropped, 0);
+    stat_pages = 0;
+    stat_files = 0;
+    atomic_store(&started, 0);
+}
+
+__attribute__((constructor)) static void preload_init(void) {
+    resolve_symbols();
+    const char* v;
+    if ((v = getenv("SM3_PRELOAD_SUFFIX")) && *v) suffix = v;
+    if ((v = getenv("SM3_PRELOAD_PREFIX")) && *v) prefix = v;
+    if ((v = getenv("SM3_PRELOAD_BITS")) && atoi(v) == 128) digest_size = 16;
+    verbose = (v = getenv("SM3_PRELOAD_VERBOSE")) && *v;
+
+    for (size_t i = 0; i < QUEUE_SIZE; i++) {
+        atomic_init(&queue[i].seq, i);
+    }
+    if (pthread_atfork(NULL, NULL, atfork_child) == 0) {
+        atomic_store(&active, 1);
+    }
+}
+
+__attribute__((destructor)) static void preload_fini(void) {
+    if (!atomic_exchange(&active, 0) || atomic_load(&started) != 2) {
+        return;
+    }
+    atomic_store(&stopping, 1);
+    pthread_join(worker, NULL);
+    if (verbose && atomic_load(&stat_events)) {
+        fprintf(stderr, "[sm3_preload] 写事件 %llu, 溢出 %llu, 文件 %llu, 计算页 %llu\n",
+                (unsigned long long)atomic_load(&stat_events),
+                (unsigned long long)atomic_load(&stat_dropped),
+                (unsigned long long)stat_files, (unsigned long long)stat_pages);
+    }
+}
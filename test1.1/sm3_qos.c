@@ -0,0 +1,326 @@
+/*
+ * 带服务质量的工作线程池
+ *
+ * 所有待领取切块的请求挂在两处：截止时间类在一个无序链表中（领取时线性查找
+ * 截止时间最早者，同时在队的请求数不多），批量类按租户各一个先进先出队列。
+ * 工作线程每领取一个切块都在锁内重新选择，切块执行期间不持锁。
+ * 请求的切块全部领取后出队，全部完成后唤醒提交线程。
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+#include "sm3_qos.h"
+
+#define VT_SCALE    65536           // 虚拟时间：每页 VT_SCALE / 权重
+
+typedef struct job {
+    struct job* next;
+    sm3_qos_req_t req;
+    int cls;
+    size_t issued;                  // 已领取的单元
+    size_t done;                    // 已完成的单元
+    uint64_t submit_ns;
+    int finished;
+    pthread_cond_t cond;
+} job_t;
+
+typedef struct {
+    char name[32];
+    uint32_t weight;
+    uint64_t vtime;
+    job_t* head;
+    job_t* tail;
+} tenant_t;
+
+struct sm3_qos {
+    int num_threads;
+    pthread_t* threads;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int shutdown;
+    job_t* deadline;                // 截止时间类待领取请求
+    tenant_t tenants[SM3_QOS_MAX_TENANTS];
+    int ntenants;
+    uint64_t vclock;                // 最近一次被服务的租户的虚拟时间
+    sm3_qos_stats_t stats;
+    sm3_metrics_t* metrics;
+    int m_latency[SM3_QOS_CLASSES];
+    int m_missed;
+    int m_queued;
+};
+
+static const char* const latency_names[SM3_QOS_CLASSES] = {
+    "sm3_qos_deadline_latency_seconds", "sm3_qos_bulk_latency_seconds"
+};
+
+// 选择下一个领取切块的请求；调用方持锁
+static job_t* pick(sm3_qos_t* q) {
+    job_t* best = NULL;
+    for (job_t* j = q->deadline; j; j = j->next) {
+        if (!best || j->req.deadline_ns < best->req.deadline_ns) best = j;
+    }
+    if (best) {
+        return best;
+    }
+    tenant_t* tb = NULL;
+    for (int i = 0; i < q->ntenants; i++) {
+        tenant_t* t = &q->tenants[i];
+        if (t->head && (!tb || t->vtime < tb->vtime)) tb = t;
+    }
+    return tb ? tb->head : NULL;
+}
+
+// 领取 j 的下一个切块，全部领取后出队；调用方持锁
+static void claim(sm3_qos_t* q, job_t* j, size_t* begin, size_t* end) {
+    *begin = j->issued;
+    *end = j->issued + j->req.grain < j->req.count ? j->issued + j->req.grain : j->req.count;
+    j->issued = *end;
+    size_t n = *end - *begin;
+    q->stats.tenant_pages[j->req.tenant] += n;
+    tenant_t* t = &q->tenants[j->req.tenant];
+    if (j->cls == SM3_QOS_BULK) {
+        q->vclock = t->vtime;
+        t->vtime += (uint64_t)n * VT_SCALE / t->weight;
+    }
+    if (j->issued < j->req.count) {
+        return;
+    }
+    if (j->cls == SM3_QOS_BULK) {
+        t->head = j->next;
+        if (!t->head) t->tail = NULL;
+    } else {
+        job_t** pp = &q->deadline;
+        while (*pp != j) pp = &(*pp)->next;
+        *pp = j->next;
+    }
+    q->stats.queued--;
+    sm3_metrics_set(q->metrics, q->m_queued, q->stats.queued);
+}
+
+// 请求全部完成；调用方持锁
+static void complete(sm3_qos_t* q, job_t* j) {
+    uint64_t now = sm3_now_ns();
+    uint64_t lat = now - j->submit_ns;
+    sm3_qos_class_stats_t* cs = &q->stats.cls[j->cls];
+    cs->requests++;
+    cs->pages += j->req.count;
+    cs->latency_ns += lat;
+    if (lat > cs->max_latency_ns) cs->max_latency_ns = lat;
+    sm3_metrics_record(q->metrics, q->m_latency[j->cls], lat);
+    if (j->cls == SM3_QOS_DEADLINE && now > j->req.deadline_ns) {
+        cs->missed++;
+        sm3_metrics_add(q->metrics, q->m_missed, 1);
+    }
+    j->finished = 1;
+    pthread_cond_signal(&j->cond);
+}
+
+static void* qos_worker(void* arg) {
+    sm3_qos_t* q = arg;
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        job_t* j;
+        while (!q->shutdown && (j = pick(q)) == NULL) {
+            pthread_cond_wait(&q->wake, &q->lock);
+        }
+        if (q->shutdown) {
+            break;
+        }
+        size_t begin, end;
+        claim(q, j, &begin, &end);
+        pthread_mutex_unlock(&q->lock);
+
+        j->req.fn(j->req.ctx, begin, end);
+
+        pthread_mutex_lock(&q->lock);
+        j->done += end - begin;
+        if (j->done == j->req.count) {
+            complete(q, j);
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+sm3_qos_t* sm3_qos_create(int num_threads, sm3_metrics_t* metrics) {
+    if (num_threads <= 0) {
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (num_threads <= 0) num_threads = 1;
+    }
+    sm3_qos_t* q = calloc(1, sizeof(*q));
+    if (!q) {
+        return NULL;
+    }
+    q->threads = calloc((size_t)num_threads, sizeof(pthread_t));
+    if (!q->threads) {
+        free(q);
+        return NULL;
+    }
+    q->metrics = metrics;
+    q->m_missed = q->m_queued = -1;
+    for (int c = 0; c < SM3_QOS_CLASSES; c++) q->m_latency[c] = -1;
+    if (metrics) {
+        q->m_latency[SM3_QOS_DEADLINE] = sm3_metrics_histogram(metrics, latency_names[0],
+            "Deadline-class request latency from submit to completion", 1e-9);
+        q->m_latency[SM3_QOS_BULK] = sm3_metrics_histogram(metrics, latency_names[1],
+            "Bulk-class request latency from submit to completion", 1e-9);
+        q->m_missed = sm3_metrics_counter(metrics, "sm3_qos_deadline_missed_total",
+                                          "Deadline-class requests completed after their deadline");
+        q->m_queued = sm3_metrics_gauge(metrics, "sm3_qos_queued_requests",
+                                        "Requests with chunks not yet claimed");
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->wake, NULL);
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&q->threads[i], NULL, qos_worker, q) != 0) {
+            if (i == 0) {
+                pthread_mutex_destroy(&q->lock);
+                pthread_cond_destroy(&q->wake);
+                free(q->threads);
+                free(q);
+                return NULL;
+            }
+            num_threads = i;        // 仅使用已创建的线程
+            break;
+        }
+    }
+    q->num_threads = num_threads;
+    return q;
+}
+
+void sm3_qos_destroy(sm3_qos_t* q) {
+    if (!q) {
+        return;
+    }
+    pthread_mutex_lock(&q->lock);
+    q->shutdown = 1;
+    pthread_cond_broadcast(&q->wake);
+    pthread_mutex_unlock(&q->lock);
+    for (int i = 0; i < q->num_threads; i++) {
+        pthread_join(q->threads[i], NULL);
+    }
+    free(q->threads);
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->wake);
+    free(q);
+}
+
+int sm3_qos_threads(const sm3_qos_t* q) {
+    return q->num_threads;
+}
+
+int sm3_qos_tenant(sm3_qos_t* q, const char* name, uint32_t weight) {
+    if (weight == 0) weight = 1;
+    pthread_mutex_lock(&q->lock);
+    int id = -1;
+    for (int i = 0; i < q->ntenants; i++) {
+        if (strcmp(q->tenants[i].name, name) == 0) {
+            id = i;
+            break;
+        }
+    }
+    if (id < 0 && q->ntenants < SM3_QOS_MAX_TENANTS) {
+        id = q->ntenants++;
+        snprintf(q->tenants[id].name, sizeof(q->tenants[id].name), "%s", name);
+        q->tenants[id].vtime = q->vclock;
+    }
+    if (id >= 0) {
+        q->tenants[id].weight = weight;
+    } else {
+        errno = ENOSPC;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return id;
+}
+
+int sm3_qos_run(sm3_qos_t* q, const sm3_qos_req_t* req) {
+    if (!q || !req->fn || req->tenant < 0 || req->tenant >= q->ntenants) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (req->count == 0) {
+        return 0;
+    }
+    job_t j;
+    memset(&j, 0, sizeof(j));
+    j.req = *req;
+    if (j.req.grain == 0) j.req.grain = 1;
+    j.cls = req->deadline_ns ? SM3_QOS_DEADLINE : SM3_QOS_BULK;
+    pthread_cond_init(&j.cond, NULL);
+
+    pthread_mutex_lock(&q->lock);
+    j.submit_ns = sm3_now_ns();
+    if (j.cls == SM3_QOS_DEADLINE) {
+        j.next = q->deadline;
+        q->deadline = &j;
+    } else {
+        tenant_t* t = &q->tenants[req->tenant];
+        if (!t->head) {
+            // 从空闲变为活跃：不保留空闲期间的额度
+            if (t->vtime < q->vclock) t->vtime = q->vclock;
+            t->head = &j;
+        } else {
+            t->tail->next = &j;
+        }
+        t->tail = &j;
+    }
+    q->stats.queued++;
+    sm3_metrics_set(q->metrics, q->m_queued, q->stats.queued);
+    pthread_cond_broadcast(&q->wake);
+    while (!j.finished) {
+        pthread_cond_wait(&j.cond, &q->lock);
+    }
+    pthread_mutex_unlock(&q->lock);
+    pthread_cond_destroy(&j.cond);
+    return 0;
+}
+
+void sm3_qos_stats(sm3_qos_t* q, sm3_qos_stats_t* out) {
+    pthread_mutex_lock(&q->lock);
+    *out = q->stats;
+    pthread_mutex_unlock(&q->lock);
+}
+
+// ============================================================================
+// 页摘要
+// ============================================================================
+
+typedef struct {
+    const uint8_t* pages;
+    uint8_t* digests;
+    int digest_size;
+} hash_job_t;
+
+static void hash_chunk(void* ctx, size_t begin, size_t end) {
+    hash_job_t* job = ctx;
+    enum { GROUP = 16 };
+    const uint8_t* inputs[GROUP];
+    uint8_t* outputs[GROUP];
+    for (size_t i = begin; i < end; i += GROUP) {
+        int n = end - i < GROUP ? (int)(end - i) : GROUP;
+        for (int k = 0; k < n; k++) {
+            inputs[k] = job->pages + (i + k) * 4096;
+            outputs[k] = job->digests + (i + k) * (size_t)job->digest_size;
+        }
+        aes_sm3_integrity_mb(inputs, outputs, n, job->digest_size * 8);
+    }
+}
+
+int sm3_qos_hash_pages(sm3_qos_t* q, const sm3_qos_req_t* req, const uint8_t* pages,
+                       size_t count, uint8_t* digests, int digest_size) {
+    hash_job_t job = { pages, digests, digest_size };
+    sm3_qos_req_t r = *req;
+    r.fn = hash_chunk;
+    r.ctx = &job;
+    r.count = count;
+    if (r.grain == 0) r.grain = 64;
+    return sm3_qos_run(q, &r);
+}
@@ -0,0 +1,79 @@
+/*
+ * 带服务质量的工作线程池
+ *
+ * sm3_pool 同一时刻只执行一个作业，后到的作业排队等待（先到先服务）：一个租户的
+ * 大批量扫描会让另一个租户的单页校验等到扫描结束。本线程池以切块为单位调度，
+ * 每个工作线程每次领取一个切块前重新选择作业：
+ *   - 截止时间类（deadline_ns 非0）：最早截止时间优先（EDF），严格优先于批量类
+ *   - 批量类：按租户加权公平排队（WFQ）。每个租户有虚拟时间，执行 n 页后前进
+ *     n / 权重，总是选虚拟时间最小的租户；租户从空闲变为活跃时虚拟时间
+ *     追平到当前最小值，空闲期间不积累额度。同一租户的作业先到先服务
+ * 因此批量作业在切块边界即可被抢占，截止时间类请求的排队时间不超过一个切块。
+ *
+ * sm3_qos_run 为阻塞调用，可由多个线程并发提交；切块全部在工作线程中执行。
+ * 每类请求统计完成数、延迟（提交到完成）与错过截止时间的次数，指定指标集时
+ * 另导出分类延迟直方图（见 sm3_metrics.h）。
+ */
+
+#ifndef SM3_QOS_H
+#define SM3_QOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sm3_metrics.h"
+#include "sm3_pool.h"
+
+#define SM3_QOS_MAX_TENANTS 64
+
+// 请求类别
+enum {
+    SM3_QOS_DEADLINE = 0,
+    SM3_QOS_BULK,
+    SM3_QOS_CLASSES
+};
+
+typedef struct sm3_qos sm3_qos_t;
+
+typedef struct {
+    sm3_pool_fn fn;
+    void* ctx;
+    size_t count;
+    size_t grain;           // 切块大小，也是可被抢占的粒度；0 取1
+    int tenant;             // sm3_qos_tenant 返回的编号
+    uint64_t deadline_ns;   // 非0时为截止时间类：绝对时刻（sm3_now_ns 时钟）
+} sm3_qos_req_t;
+
+typedef struct {
+    uint64_t requests;      // 已完成
+    uint64_t pages;         // 已完成的单元数（count 之和）
+    uint64_t latency_ns;    // 提交到完成的总耗时
+    uint64_t max_latency_ns;
+    uint64_t missed;        // 完成时已过截止时间（仅截止时间类）
+} sm3_qos_class_stats_t;
+
+typedef struct {
+    sm3_qos_class_stats_t cls[SM3_QOS_CLASSES];
+    uint64_t tenant_pages[SM3_QOS_MAX_TENANTS];    // 各租户已执行的单元数
+    uint32_t queued;        // 尚有切块未领取的请求数
+} sm3_qos_stats_t;
+
+// num_threads <= 0 时取在线CPU数；metrics 可为 NULL
+sm3_qos_t* sm3_qos_create(int num_threads, sm3_metrics_t* metrics);
+// 须在所有 sm3_qos_run 返回之后调用
+void sm3_qos_destroy(sm3_qos_t* q);
+int sm3_qos_threads(const sm3_qos_t* q);
+
+// 登记租户（同名返回已有编号并更新权重），weight 为 0 时取1；满时返回 -1
+int sm3_qos_tenant(sm3_qos_t* q, const char* name, uint32_t weight);
+
+// 执行请求，全部切块完成后返回；参数无效返回 -1（EINVAL）
+int sm3_qos_run(sm3_qos_t* q, const sm3_qos_req_t* req);
+
+// 以 req 的租户与截止时间计算一组连续页的摘要（req 的 fn/ctx/count 被忽略）
+int sm3_qos_hash_pages(sm3_qos_t* q, const sm3_qos_req_t* req, const uint8_t* pages,
+                       size_t count, uint8_t* digests, int digest_size);
+
+void sm3_qos_stats(sm3_qos_t* q, sm3_qos_stats_t* out);
+
+#endif // SM3_QOS_H
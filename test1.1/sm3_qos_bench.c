@@ -0,0 +1,271 @@
+/*
+ * sm3_qos_bench - 混合负载下的服务质量测试
+ *
+ * 同一组工作线程上同时运行：
+ *   - 两个批量租户：scrub（权重1）与 backup（权重 -W）各一个线程，
+ *     不停提交大批量页摘要（每批 -s 页）
+ *   - 在线租户：每 -i 微秒提交一次小批量校验（-o 页），截止时间为提交后 -b 微秒
+ * 先用 sm3_pool（作业先到先服务）运行 -d 秒，再用 sm3_qos（截止时间类 EDF +
+ * 批量类加权公平）运行同样时长，对比在线请求的延迟分布、错过截止时间的次数
+ * 与批量租户之间的吞吐量分配。
+ *
+ * 用法:
+ *   sm3_qos_bench [-t 线程] [-d 秒] [-s 批量页] [-o 在线页] [-i 间隔us] [-b 截止us]
+ *                 [-g 切块页] [-W backup权重] [-m]
+ *   -m  结束后输出 sm3_qos 的分类延迟指标（Prometheus 文本）
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+#include "sm3_metrics.h"
+#include "sm3_pool.h"
+#include "sm3_qos.h"
+
+#define PAGE 4096
+
+typedef struct {
+    int threads;
+    double seconds;
+    uint32_t bulk_pages;
+    uint32_t online_pages;
+    uint32_t interval_us;
+    uint32_t budget_us;
+    uint32_t grain;
+    uint32_t weight;
+} qos_cfg_t;
+
+typedef struct {
+    const uint8_t* pages;
+    uint8_t* digests;
+} hash_ctx_t;
+
+static void hash_chunk(void* ctx, size_t begin, size_t end) {
+    hash_ctx_t* h = ctx;
+    enum { GROUP = 16 };
+    const uint8_t* inputs[GROUP];
+    uint8_t* outputs[GROUP];
+    for (size_t i = begin; i < end; i += GROUP) {
+        int n = end - i < GROUP ? (int)(end - i) : GROUP;
+        for (int k = 0; k < n; k++) {
+            inputs[k] = h->pages + (i + k) * PAGE;
+            outputs[k] = h->digests + (i + k) * 32;
+        }
+        aes_sm3_integrity_mb(inputs, outputs, n, 256);
+    }
+}
+
+typedef struct {
+    const qos_cfg_t* cfg;
+    sm3_pool_t* pool;           // 二者之一
+    sm3_qos_t* qos;
+    int tenant;
+    const uint8_t* data;
+    atomic_int* stop;
+    uint64_t pages;             // 批量：完成的页数
+    uint64_t* lat_ns;           // 在线：各请求延迟
+    uint64_t nlat;
+    uint64_t cap;
+    uint64_t missed;
+} load_t;
+
+static void submit(load_t* l, size_t count, uint64_t deadline_ns, uint8_t* digests) {
+    hash_ctx_t h = { l->data, digests };
+    if (l->qos) {
+        sm3_qos_req_t req = { hash_chunk, &h, count, l->cfg->grain, l->tenant, deadline_ns };
+        sm3_qos_run(l->qos, &req);
+    } else {
+        sm3_pool_run(l->pool, hash_chunk, &h, count, l->cfg->grain);
+    }
+}
+
+static void* bulk_main(void* arg) {
+    load_t* l = arg;
+    uint8_t* digests = malloc((size_t)l->cfg->bulk_pages * 32);
+    while (digests && !atomic_load(l->stop)) {
+        submit(l, l->cfg->bulk_pages, 0, digests);
+        l->pages += l->cfg->bulk_pages;
+    }
+    free(digests);
+    return NULL;
+}
+
+static void* online_main(void* arg) {
+    load_t* l = arg;
+    uint8_t* digests = malloc((size_t)l->cfg->online_pages * 32);
+    uint64_t next = sm3_now_ns();
+    while (digests && !atomic_load(l->stop) && l->nlat < l->cap) {
+        uint64_t t0 = sm3_now_ns();
+        submit(l, l->cfg->online_pages, t0 + l->cfg->budget_us * 1000ull, digests);
+        uint64_t lat = sm3_now_ns() - t0;
+        l->lat_ns[l->nlat++] = lat;
+        if (lat > l->cfg->budget_us * 1000ull) l->missed++;
+        next += l->cfg->interval_us * 1000ull;
+        uint64_t now = sm3_now_ns();
+        if (next > now) {
+            struct timespec ts = { (time_t)((next - now) / 1000000000ull),
+                                   (long)((next - now) % 1000000000ull) };
+            nanosleep(&ts, NULL);
+        } else {
+            next = now;             // 落后时不补发
+        }
+    }
+    free(digests);
+    return NULL;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_latency(const char* name, uint64_t* ns, uint64_t n) {
+    if (n == 0) {
+        printf("  %-6s -\n", name);
+        return;
+    }
+    qsort(ns, n, sizeof(uint64_t), cmp_u64);
+    double sum = 0;
+    for (uint64_t i = 0; i < n; i++) sum += (double)ns[i];
+    printf("  %-6s %7llu次  平均 %9.2f  P50 %9.2f  P99 %9.2f  P99.9 %9.2f  最大 %9.2f us\n",
+           name, (unsigned long long)n, sum / (double)n / 1000, ns[(n - 1) / 2] / 1000.0,
+           ns[(n - 1) * 99 / 100] / 1000.0, ns[(n - 1) * 999 / 1000] / 1000.0, ns[n - 1] / 1000.0);
+}
+
+// 运行一轮混合负载，返回 0 成功
+static int run_mix(const qos_cfg_t* cfg, const char* title, sm3_pool_t* pool, sm3_qos_t* qos,
+                   const uint8_t* data, const int* tenants) {
+    atomic_int stop = 0;
+    uint64_t cap = (uint64_t)(cfg->seconds * 1e6 / cfg->interval_us) + 16;
+    load_t loads[3];
+    for (int i = 0; i < 3; i++) {
+        loads[i] = (load_t){ cfg, pool, qos, tenants[i], data, &stop, 0, NULL, 0, 0, 0 };
+    }
+    loads[2].lat_ns = malloc(cap * sizeof(uint64_t));
+    loads[2].cap = cap;
+    if (!loads[2].lat_ns) {
+        return -1;
+    }
+    pthread_t th[3];
+    uint64_t t0 = sm3_now_ns();
+    for (int i = 0; i < 3; i++) {
+        pthread_create(&th[i], NULL, i < 2 ? bulk_main : online_main, &loads[i]);
+    }
+    struct timespec ts = { (time_t)cfg->seconds,
+                           (long)((cfg->seconds - (double)(time_t)cfg->seconds) * 1e9) };
+    nanosleep(&ts, NULL);
+    atomic_store(&stop, 1);
+    for (int i = 0; i < 3; i++) {
+        pthread_join(th[i], NULL);
+    }
+    double secs = (double)(sm3_now_ns() - t0) / 1e9;
+
+    printf("\n%s:\n", title);
+    print_latency("在线", loads[2].lat_ns, loads[2].nlat);
+    printf("  错过截止时间 %llu/%llu 次 (%.1f%%)\n", (unsigned long long)loads[2].missed,
+           (unsigned long long)loads[2].nlat,
+           loads[2].nlat ? loads[2].missed * 100.0 / (double)loads[2].nlat : 0.0);
+    uint64_t total = loads[0].pages + loads[1].pages;
+    const char* names[2] = { "scrub", "backup" };
+    for (int i = 0; i < 2; i++) {
+        printf("  批量 %-6s %8.1f MB/s  占比 %5.1f%%\n", names[i],
+               loads[i].pages * (double)PAGE / (1024.0 * 1024.0) / secs,
+               total ? loads[i].pages * 100.0 / (double)total : 0.0);
+    }
+    free(loads[2].lat_ns);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    qos_cfg_t cfg = { 2, 2.0, 4096, 64, 1000, 2000, 16, 3 };
+    int dump_metrics = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:d:s:o:i:b:g:W:m")) != -1) {
+        switch (opt) {
+        case 't': cfg.threads = atoi(optarg); break;
+        case 'd': cfg.seconds = atof(optarg); break;
+        case 's': cfg.bulk_pages = (uint32_t)atoi(optarg); break;
+        case 'o': cfg.online_pages = (uint32_t)atoi(optarg); break;
+        case 'i': cfg.interval_us = (uint32_t)atoi(optarg); break;
+        case 'b': cfg.budget_us = (uint32_t)atoi(optarg); break;
+        case 'g': cfg.grain = (uint32_t)atoi(optarg); break;
+        case 'W': cfg.weight = (uint32_t)atoi(optarg); break;
+        case 'm': dump_metrics = 1; break;
+        default:
+            fprintf(stderr, "用法: %s [-t 线程] [-d 秒] [-s 批量页] [-o 在线页] [-i 间隔us] "
+                            "[-b 截止us] [-g 切块页] [-W backup权重] [-m]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (cfg.threads <= 0 || cfg.seconds <= 0 || cfg.bulk_pages == 0 || cfg.online_pages == 0 ||
+        cfg.interval_us == 0 || cfg.grain == 0 || cfg.weight == 0) {
+        fprintf(stderr, "参数无效\n");
+        return 2;
+    }
+
+    uint32_t max_pages = cfg.bulk_pages > cfg.online_pages ? cfg.bulk_pages : cfg.online_pages;
+    uint8_t* data = malloc((size_t)max_pages * PAGE);
+    if (!data) {
+        fprintf(stderr, "内存不足\n");
+        return 1;
+    }
+    uint64_t seed = 88172645463325252ull;
+    for (size_t i = 0; i < (size_t)max_pages * PAGE / 8; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        ((uint64_t*)data)[i] = seed;
+    }
+
+    printf("配置: %d 线程, 每轮 %.1f 秒, 批量 %u 页/次 (scrub 权重1, backup 权重%u), "
+           "在线 %u 页/次 每 %u us, 截止 %u us, 切块 %u 页\n",
+           cfg.threads, cfg.seconds, cfg.bulk_pages, cfg.weight, cfg.online_pages,
+           cfg.interval_us, cfg.budget_us, cfg.grain);
+
+    // sm3_pool 的线程数含参与计算的调用线程，两种方式的并行度相同
+    sm3_pool_t* pool = sm3_pool_create(cfg.threads);
+    int none[3] = { 0, 0, 0 };
+    int rc = pool && run_mix(&cfg, "先到先服务 (sm3_pool)", pool, NULL, data, none) == 0 ? 0 : 1;
+    sm3_pool_destroy(pool);
+
+    sm3_metrics_t* metrics = dump_metrics ? sm3_metrics_create() : NULL;
+    sm3_qos_t* qos = rc == 0 ? sm3_qos_create(cfg.threads, metrics) : NULL;
+    if (qos) {
+        int tenants[3] = { sm3_qos_tenant(qos, "scrub", 1), sm3_qos_tenant(qos, "backup", cfg.weight),
+                           sm3_qos_tenant(qos, "online", 1) };
+        rc = run_mix(&cfg, "服务质量调度 (sm3_qos)", NULL, qos, data, tenants) == 0 ? 0 : 1;
+        sm3_qos_stats_t st;
+        sm3_qos_stats(qos, &st);
+        for (int c = 0; c < SM3_QOS_CLASSES; c++) {
+            const sm3_qos_class_stats_t* cs = &st.cls[c];
+            printf("  %s类: %llu 个请求, 平均延迟 %.2f us, 最大 %.2f us, 错过截止时间 %llu\n",
+                   c == SM3_QOS_DEADLINE ? "截止时间" : "批量", (unsigned long long)cs->requests,
+                   cs->requests ? cs->latency_ns / (double)cs->requests / 1000 : 0.0,
+                   cs->max_latency_ns / 1000.0, (unsigned long long)cs->missed);
+        }
+        sm3_qos_destroy(qos);
+    } else {
+        rc = 1;
+    }
+    if (rc == 0 && metrics) {
+        char* text;
+        if (sm3_metrics_format(metrics, &text) >= 0) {
+            printf("\n运行指标:\n%s", text);
+            free(text);
+        }
+    }
+    sm3_metrics_destroy(metrics);
+    free(data);
+    if (rc != 0) {
+        fprintf(stderr, "测试失败\n");
+    }
+    return rc;
+}
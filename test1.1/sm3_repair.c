@@ -0,0 +1,456 @@
+/*
+ * 从镜像自动修复校验失败的页
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+#include "sm3_manifest.h"
+#include "sm3_nbd.h"
+#include "sm3_repair.h"
+
+#define MB_GROUP        64
+#define NBD_PREFIX      "nbd:"
+#define NBD_WINDOW      32          // 在途 NBD 读请求上限
+
+struct sm3_repair {
+    sm3_repair_opts_t opts;
+    int file_fd;                // 镜像为文件时
+    char* nbd_addr;             // 镜像为 NBD 导出时
+    int nbd_fd;                 // 断开后为 -1，下一批重新连接
+    uint64_t nbd_size;
+    uint64_t next_handle;
+    uint64_t pace_ns;           // 下一次镜像读取最早的开始时间
+    sm3_repair_stats_t stats;
+};
+
+void sm3_repair_opts_default(sm3_repair_opts_t* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->batch_pages = 256;
+    opts->sync = 1;
+}
+
+static int nbd_reconnect(sm3_repair_t* r) {
+    if (r->nbd_fd >= 0) {
+        return 0;
+    }
+    uint16_t flags;
+    int fd = sm3_nbd_connect(r->nbd_addr);
+    if (fd < 0) {
+        return -1;
+    }
+    if (sm3_nbd_handshake(fd, &r->nbd_size, &flags) != 0) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        return -1;
+    }
+    r->nbd_fd = fd;
+    return 0;
+}
+
+sm3_repair_t* sm3_repair_open(const char* mirror, const sm3_repair_opts_t* opts) {
+    sm3_repair_t* r = calloc(1, sizeof(*r));
+    if (!r) {
+        return NULL;
+    }
+    sm3_repair_opts_default(&r->opts);
+    if (opts) r->opts = *opts;
+    // 一批的一个区间作为一个 NBD 请求
+    uint32_t max_batch = SM3_NBD_MAX_REQUEST / SM3_PAGE_SIZE;
+    if (r->opts.batch_pages == 0) r->opts.batch_pages = 1;
+    if (r->opts.batch_pages > max_batch) r->opts.batch_pages = max_batch;
+    r->file_fd = r->nbd_fd = -1;
+
+    if (strncmp(mirror, NBD_PREFIX, strlen(NBD_PREFIX)) == 0) {
+        r->nbd_addr = strdup(mirror + strlen(NBD_PREFIX));
+        if (!r->nbd_addr || nbd_reconnect(r) != 0) {
+            sm3_repair_close(r);
+            return NULL;
+        }
+    } else {
+        r->file_fd = open(mirror, O_RDONLY | O_CLOEXEC);
+        if (r->file_fd < 0) {
+            sm3_repair_close(r);
+            return NULL;
+        }
+    }
+    return r;
+}
+
+void sm3_repair_close(sm3_repair_t* r) {
+    if (!r) {
+        return;
+    }
+    int e = errno;
+    if (r->file_fd >= 0) close(r->file_fd);
+    if (r->nbd_fd >= 0) {
+        sm3_nbd_request(r->nbd_fd, SM3_NBD_CMD_DISC, 0, 0, 0, 0, NULL);
+        close(r->nbd_fd);
+    }
+    free(r->nbd_addr);
+    free(r);
+    errno = e;
+}
+
+const sm3_repair_stats_t* sm3_repair_stats(const sm3_repair_t* r) {
+    return &r->stats;
+}
+
+// ============================================================================
+// 镜像读取
+// ============================================================================
+
+// 按带宽上限匀速：每次读取前等到上一次读取"应结束"的时刻
+static void pace(sm3_repair_t* r, uint64_t bytes) {
+    if (r->opts.max_mbps <= 0) {
+        return;
+    }
+    uint64_t now = sm3_now_ns();
+    if (r->pace_ns > now) {
+        uint64_t d = r->pace_ns - now;
+        struct timespec ts = { (time_t)(d / 1000000000ull), (long)(d % 1000000000ull) };
+        nanosleep(&ts, NULL);
+        r->stats.throttle_ns += d;
+    } else {
+        r->pace_ns = now;
+    }
+    r->pace_ns += (uint64_t)((double)bytes / (r->opts.max_mbps * 1024 * 1024) * 1e9);
+}
+
+static int pread_all(int fd, uint8_t* buf, size_t len, uint64_t off, size_t* got) {
+    *got = 0;
+    while (*got < len) {
+        ssize_t n = pread(fd, buf + *got, len - *got, (off_t)(off + *got));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        *got += (size_t)n;
+    }
+    return 0;
+}
+
+typedef struct {
+    uint64_t page;              // 区间首页
+    uint32_t first;             // 在本批中的下标
+    uint32_t count;
+    int ok;
+} run_t;
+
+// 读取本批的各个区间，超出镜像末尾的部分补零（由校验判定）
+static void fetch_runs(sm3_repair_t* r, run_t* runs, uint32_t nruns, uint8_t* data) {
+    uint64_t t0 = sm3_now_ns();
+    if (r->file_fd >= 0) {
+        for (uint32_t i = 0; i < nruns; i++) {
+            size_t len = (size_t)runs[i].count * SM3_PAGE_SIZE, got;
+            uint8_t* dst = data + (size_t)runs[i].first * SM3_PAGE_SIZE;
+            pace(r, len);
+            runs[i].ok = pread_all(r->file_fd, dst, len, runs[i].page * SM3_PAGE_SIZE, &got) == 0;
+            memset(dst + got, 0, len - got);
+            r->stats.fetched_bytes += got;
+        }
+        r->stats.fetch_ns += sm3_now_ns() - t0;
+        return;
+    }
+
+    // NBD：边发边收，在途读请求不超过 NBD_WINDOW 个。一次发出全部请求时，
+    // 回复可能填满服务端队列与套接字缓冲区，双方都阻塞在发送上
+    if (nbd_reconnect(r) != 0) {
+        return;
+    }
+    uint32_t limit = 0;
+    while (limit < nruns && runs[limit].page * SM3_PAGE_SIZE < r->nbd_size) {
+        limit++;                                // 区间有序，之后的都越界
+    }
+    uint64_t base = r->next_handle;
+    r->next_handle += nruns;
+    uint32_t sent = 0, received = 0;
+    int broken = 0;
+    while (received < limit && !broken) {
+        while (sent < limit && sent - received < NBD_WINDOW) {
+            uint64_t off = runs[sent].page * SM3_PAGE_SIZE;
+            uint64_t len = (uint64_t)runs[sent].count * SM3_PAGE_SIZE;
+            if (off + len > r->nbd_size) len = r->nbd_size - off;
+            pace(r, len);
+            if (sm3_nbd_request(r->nbd_fd, SM3_NBD_CMD_READ, 0, base + sent, off, (uint32_t)len, NULL) != 0) {
+                broken = 1;
+                break;
+            }
+            sent++;
+        }
+        uint64_t handle;
+        uint32_t error;
+        if (broken || sm3_nbd_reply(r->nbd_fd, &handle, &error) != 0 || handle - base >= sent) {
+            broken = 1;
+            break;
+        }
+        received++;
+        run_t* run = &runs[handle - base];
+        if (error) {
+            continue;                           // 副本读取失败（如副本自身校验失败）
+        }
+        uint64_t off = run->page * SM3_PAGE_SIZE;
+        size_t len = (size_t)run->count * SM3_PAGE_SIZE;
+        size_t valid = off + len > r->nbd_size ? (size_t)(r->nbd_size - off) : len;
+        uint8_t* dst = data + (size_t)run->first * SM3_PAGE_SIZE;
+        if (sm3_nbd_recv_data(r->nbd_fd, dst, (uint32_t)valid) != 0) {
+            broken = 1;
+            break;
+        }
+        memset(dst + valid, 0, len - valid);
+        run->ok = 1;
+        r->stats.fetched_bytes += valid;
+    }
+    if (broken) {
+        // 连接状态未知：已收到的区间仍可用，其余记为失败，下一批重连
+        close(r->nbd_fd);
+        r->nbd_fd = -1;
+    }
+    r->stats.fetch_ns += sm3_now_ns() - t0;
+}
+
+// ============================================================================
+// 修复
+// ============================================================================
+
+static uint64_t page_offset(const sm3_repair_target_t* t, uint64_t page) {
+    return t->offset ? t->offset(t->ctx, page) : page * SM3_PAGE_SIZE;
+}
+
+static size_t page_valid(const sm3_repair_target_t* t, uint64_t page) {
+    uint64_t off = page * SM3_PAGE_SIZE;
+    return t->size - off < SM3_PAGE_SIZE ? (size_t)(t->size - off) : SM3_PAGE_SIZE;
+}
+
+static void verify_pages(const uint8_t* data, const uint8_t* exp, int ds, const uint32_t* idx,
+                         uint32_t n, uint8_t* ok, int bits) {
+    for (uint32_t b = 0; b < n; b += MB_GROUP) {
+        int m = (int)(n - b < MB_GROUP ? n - b : MB_GROUP);
+        const uint8_t* in[MB_GROUP];
+        const uint8_t* e[MB_GROUP];
+        uint8_t res[MB_GROUP];
+        for (int j = 0; j < m; j++) {
+            in[j] = data + (size_t)idx[b + j] * SM3_PAGE_SIZE;
+            e[j] = exp + (size_t)idx[b + j] * ds;
+        }
+        aes_sm3_integrity_verify_mb(in, e, res, m, bits);
+        for (int j = 0; j < m; j++) ok[idx[b + j]] = res[j];
+    }
+}
+
+// pages 已排序去重，n <= batch_pages
+static int repair_batch(sm3_repair_t* r, const sm3_repair_target_t* t, const uint64_t* pages,
+                        uint32_t n, uint8_t* ok, uint8_t* data, uint8_t* exp,
+                        uint32_t* idx, run_t* runs) {
+    int ds = t->digest_bits / 8;
+    r->stats.batches++;
+    for (uint32_t k = 0; k < n; k++) {
+        const uint8_t* e = t->expected(t->ctx, pages[k]);
+        if (!e) {
+            return -1;
+        }
+        memcpy(exp + (size_t)k * ds, e, (size_t)ds);
+    }
+
+    // 重读本地页：其间已被改写为正确内容的页不再修复
+    for (uint32_t k = 0; k < n; k++) {
+        size_t got;
+        uint8_t* dst = data + (size_t)k * SM3_PAGE_SIZE;
+        if (pread_all(t->fd, dst, page_valid(t, pages[k]), page_offset(t, pages[k]), &got) != 0) {
+            return -1;
+        }
+        memset(dst + got, 0, SM3_PAGE_SIZE - got);
+        idx[k] = k;
+    }
+    verify_pages(data, exp, ds, idx, n, ok, t->digest_bits);
+
+    uint32_t nbad = 0, nruns = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        if (ok[k]) {
+            r->stats.already_ok++;
+            continue;
+        }
+        idx[nbad++] = k;
+        if (nruns > 0 && runs[nruns - 1].first + runs[nruns - 1].count == k &&
+            runs[nruns - 1].page + runs[nruns - 1].count == pages[k]) {
+            runs[nruns - 1].count++;
+        } else {
+            runs[nruns++] = (run_t){ pages[k], k, 1, 0 };
+        }
+    }
+    if (nbad == 0) {
+        return 0;
+    }
+
+    // 从镜像取回并按期望摘要校验
+    fetch_runs(r, runs, nruns, data);
+    uint32_t nfetched = 0;
+    for (uint32_t i = 0; i < nruns; i++) {
+        for (uint32_t j = 0; j < runs[i].count; j++) {
+            if (runs[i].ok) idx[nfetched++] = runs[i].first + j;
+            else r->stats.mirror_errors++;
+        }
+    }
+    verify_pages(data, exp, ds, idx, nfetched, ok, t->digest_bits);
+
+    // 写回校验通过的页，文件中连续的合并为一次写
+    uint64_t t0 = sm3_now_ns();
+    uint32_t written = 0;
+    for (uint32_t a = 0; a < nfetched; ) {
+        if (!ok[idx[a]]) {
+            r->stats.mirror_bad++;
+            a++;
+            continue;
+        }
+        uint32_t b = a + 1;
+        uint64_t off = page_offset(t, pages[idx[a]]);
+        size_t len = page_valid(t, pages[idx[a]]);
+        while (b < nfetched && ok[idx[b]] && idx[b] == idx[b - 1] + 1 && len == (size_t)(b - a) * SM3_PAGE_SIZE &&
+               page_offset(t, pages[idx[b]]) == off + len) {
+            len += page_valid(t, pages[idx[b]]);
+            b++;
+        }
+        const uint8_t* src = data + (size_t)idx[a] * SM3_PAGE_SIZE;
+        for (size_t done = 0; done < len; ) {
+            ssize_t w = pwrite(t->fd, src + done, len - done, (off_t)(off + done));
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0) return -1;
+            done += (size_t)w;
+        }
+        written += b - a;
+        a = b;
+    }
+    if (written > 0 && r->opts.sync && fdatasync(t->fd) != 0) {
+        return -1;
+    }
+    r->stats.write_ns += sm3_now_ns() - t0;
+    r->stats.repaired += written;
+    return 0;
+}
+
+typedef struct {
+    uint64_t page;
+    size_t index;
+} pick_t;
+
+static int cmp_pick(const void* a, const void* b) {
+    const pick_t* x = a;
+    const pick_t* y = b;
+    if (x->page != y->page) return x->page < y->page ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+int sm3_repair_pages(sm3_repair_t* r, const sm3_repair_target_t* target,
+                     const uint64_t* pages, size_t count, uint8_t* ok, uint8_t* const* bufs) {
+    if (target->digest_bits != 128 && target->digest_bits != 256) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (pages[i] >= sm3_pages_for_size(target->size)) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    if (ok) memset(ok, 0, count);
+    if (count == 0) {
+        return 0;
+    }
+
+    uint32_t bp = r->opts.batch_pages;
+    pick_t* picks = malloc(count * sizeof(pick_t));
+    uint64_t* uniq = malloc(count * sizeof(uint64_t));
+    uint8_t* data = aligned_alloc(SM3_PAGE_SIZE, (size_t)bp * SM3_PAGE_SIZE);
+    uint8_t* exp = malloc((size_t)bp * 32);
+    uint8_t* uok = malloc(bp);
+    uint32_t* idx = malloc(bp * sizeof(uint32_t));
+    run_t* runs = malloc(bp * sizeof(run_t));
+    int rc = picks && uniq && data && exp && uok && idx && runs ? 0 : -1;
+    if (rc != 0) {
+        errno = ENOMEM;
+    }
+
+    size_t nuniq = 0;
+    for (size_t i = 0; rc == 0 && i < count; i++) picks[i] = (pick_t){ pages[i], i };
+    if (rc == 0) {
+        qsort(picks, count, sizeof(pick_t), cmp_pick);
+        for (size_t i = 0; i < count; i++) {
+            if (nuniq == 0 || uniq[nuniq - 1] != picks[i].page) uniq[nuniq++] = picks[i].page;
+        }
+        r->stats.requested += nuniq;
+    }
+
+    size_t failed = 0, pi = 0;
+    for (size_t b = 0; rc == 0 && b < nuniq; b += bp) {
+        uint32_t n = (uint32_t)(nuniq - b < bp ? nuniq - b : bp);
+        if (repair_batch(r, target, uniq + b, n, uok, data, exp, idx, runs) != 0) {
+            rc = -1;
+            break;
+        }
+        // 结果分发给请求中的各个（可能重复的）下标
+        for (uint32_t k = 0; k < n; k++) {
+            if (!uok[k]) failed++;
+            for (; pi < count && picks[pi].page == uniq[b + k]; pi++) {
+                if (ok) ok[picks[pi].index] = uok[k];
+                if (bufs && bufs[picks[pi].index] && uok[k]) {
+                    memcpy(bufs[picks[pi].index], data + (size_t)k * SM3_PAGE_SIZE, SM3_PAGE_SIZE);
+                }
+            }
+        }
+    }
+    free(picks);
+    free(uniq);
+    free(data);
+    free(exp);
+    free(uok);
+    free(idx);
+    free(runs);
+    return rc == 0 ? (int)failed : -1;
+}
+
+// ============================================================================
+// 按清单修复
+// ============================================================================
+
+static const uint8_t* manifest_expected(void* ctx, uint64_t page) {
+    return sm3_manifest_digest(ctx, page);
+}
+
+int sm3_repair_file(sm3_repair_t* r, const char* data_path, const char* manifest_path,
+                    const uint64_t* pages, size_t count) {
+    sm3_manifest_t m;
+    if (sm3_manifest_open(&m, manifest_path, 0) != 0) {
+        return -1;
+    }
+    int fd = open(data_path, O_RDWR | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (uint64_t)st.st_size != m.hdr->file_size) {
+        int e = fd < 0 ? errno : EINVAL;
+        if (fd >= 0) close(fd);
+        sm3_manifest_close(&m);
+        errno = e;
+        return -1;
+    }
+    sm3_repair_target_t t = {
+        .fd = fd,
+        .size = m.hdr->file_size,
+        .digest_bits = (int)m.hdr->digest_size * 8,
+        .expected = manifest_expected,
+        .ctx = &m,
+    };
+    int rc = sm3_repair_pages(r, &t, pages, count, NULL, NULL);
+    int e = errno;
+    close(fd);
+    sm3_manifest_close(&m);
+    errno = e;
+    return rc;
+}
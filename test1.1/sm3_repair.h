@@ -0,0 +1,76 @@
+/*
+ * 从镜像自动修复校验失败的页
+ *
+ * 巡检或读路径发现不一致页后，从配置的镜像源取回同一逻辑页，按本地清单
+ * （或存储标签）校验通过后原地写回：
+ *   - 镜像源为普通文件（第 i 页位于偏移 i*4096，如副本数据文件或整盘镜像），
+ *     或 "nbd:<地址>"，经 NBD 协议从副本读取（如另一台机器上的 sm3_nbd_server）
+ *   - 待修复页去重排序后按批处理：先重读本地页并校验（已被改写为正确内容
+ *     的页不再修复），其余按逻辑页连续的区间从镜像读取，批量校验后写回，
+ *     每批写回后 fdatasync 一次
+ *   - 镜像读取按带宽上限匀速进行，修复不会挤占前台 I/O
+ *
+ * 写回是对齐的整页 pwrite，崩溃时可能只写入一部分；这样的页仍然校验失败，
+ * 下次发现时会再次修复，因此不需要额外的日志。镜像中的页同样校验失败时
+ * 不写回（计入 mirror_bad）。
+ *
+ * 修复对象不是线程安全的，多线程使用需由调用方串行化。
+ */
+
+#ifndef SM3_REPAIR_H
+#define SM3_REPAIR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct sm3_repair sm3_repair_t;
+
+typedef struct {
+    uint32_t batch_pages;       // 每批最多修复的页数
+    double max_mbps;            // 镜像读取带宽上限（MB/s，0不限）
+    int sync;                   // 每批写回后 fdatasync
+} sm3_repair_opts_t;
+
+typedef struct {
+    uint64_t requested;         // 请求修复的页数（去重后）
+    uint64_t repaired;
+    uint64_t already_ok;        // 重读时已与期望摘要一致
+    uint64_t mirror_bad;        // 镜像中的页也校验失败
+    uint64_t mirror_errors;     // 从镜像读取失败的页数
+    uint64_t batches;
+    uint64_t fetched_bytes;
+    uint64_t fetch_ns;
+    uint64_t write_ns;
+    uint64_t throttle_ns;       // 带宽限制等待的耗时
+} sm3_repair_stats_t;
+
+// 待修复的数据文件
+typedef struct {
+    int fd;                     // 读写打开
+    uint64_t size;              // 逻辑大小（字节）；最后一页不足4KB时只写回有效部分
+    int digest_bits;
+    // 逻辑页的期望摘要；返回的指针只需在下次调用前有效，NULL 表示出错
+    const uint8_t* (*expected)(void* ctx, uint64_t page);
+    // 逻辑页在数据文件中的偏移，NULL 表示 page * 4096
+    uint64_t (*offset)(void* ctx, uint64_t page);
+    void* ctx;
+} sm3_repair_target_t;
+
+void sm3_repair_opts_default(sm3_repair_opts_t* opts);
+
+// mirror 为文件路径或 "nbd:<主机:端口|套接字路径>"
+sm3_repair_t* sm3_repair_open(const char* mirror, const sm3_repair_opts_t* opts);
+void sm3_repair_close(sm3_repair_t* r);
+const sm3_repair_stats_t* sm3_repair_stats(const sm3_repair_t* r);
+
+// 修复 pages[0..count)（可重复、可无序）。ok 非 NULL 时 ok[i] 置为第 i 页
+// 是否已一致；bufs 非 NULL 时把一致的页内容拷到 bufs[i]（可为 NULL）。
+// 返回仍未修复的页数，本地读写出错返回 -1
+int sm3_repair_pages(sm3_repair_t* r, const sm3_repair_target_t* target,
+                     const uint64_t* pages, size_t count, uint8_t* ok, uint8_t* const* bufs);
+
+// 按清单修复数据文件
+int sm3_repair_file(sm3_repair_t* r, const char* data_path, const char* manifest_path,
+                    const uint64_t* pages, size_t count);
+
+#endif // SM3_REPAIR_H
@@ -0,0 +1,478 @@
+/*
+ * sm3_replay - 按访问轨迹回放的性能测试
+ *
+ * 读取生产环境采集的页访问轨迹，按轨迹驱动摘要计算与校验接口：
+ *   - 写操作：对覆盖的各4KB页调用 aes_sm3_integrity_mb 生成标签
+ *   - 读操作：对覆盖的各页调用 aes_sm3_integrity_verify_mb 校验标签
+ * 数据来自内存缓冲区（默认，只测计算开销）或 -f 指定的数据文件（含读取开销），
+ * 偏移超出数据范围时按数据大小取模。内存数据默认为随机字节，-c 按语料配置
+ * 生成（见 sm3_corpus.h）。回放前先为全部页生成标签（不计时）。
+ *
+ * 轨迹文件每行一条操作（# 开头为注释，字段以空白或逗号分隔）：
+ *   <时间戳(微秒)> <R|W> <偏移> <长度>
+ *
+ * 回放方式：
+ *   默认尽快回放；-p 按记录的时间节奏回放（-x 调整倍速），此时延迟从
+ *   计划时间起算，包含落后于计划时的排队时间。
+ * 多个回放线程（-t）按轨迹顺序轮流分配操作。
+ *
+ * 用法:
+ *   sm3_replay <轨迹文件> [-f 数据文件] [-M 内存数据MB] [-c 语料配置] [-t 线程] [-p] [-x 倍速]
+ *              [-b 128|256]
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+#include "sm3_corpus.h"
+#include "sm3_manifest.h"
+
+#define GROUP 64            // 单次批量接口调用的最大页数
+
+typedef struct {
+    uint64_t ts_ns;         // 相对第一条记录
+    uint64_t offset;
+    uint32_t size;
+    uint8_t is_write;
+} trace_op_t;
+
+typedef struct {
+    trace_op_t* ops;
+    size_t count;
+    int threads;
+    int paced;
+    double speed;
+    int digest_bits;
+    int data_fd;            // -1 表示内存数据
+    uint8_t* data;
+    uint64_t data_pages;
+    uint8_t* tags;          // data_pages * 32
+} replay_cfg_t;
+
+typedef struct {
+    const replay_cfg_t* cfg;
+    int id;
+    uint64_t start_ns;
+    uint64_t* read_ns;
+    uint64_t* write_ns;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t pages;
+    uint64_t bytes;
+    uint64_t failures;
+    uint64_t max_behind_ns;     // 按节奏回放时落后计划的最大时间
+    uint64_t cpu_ns;
+    int error;
+} replay_worker_t;
+
+// ============================================================================
+// 轨迹解析
+// ============================================================================
+
+static int parse_line(char* line, double* ts_us, int* is_write, uint64_t* off, uint64_t* size) {
+    for (char* p = line; *p; p++) {
+        if (*p == ',') *p = ' ';
+    }
+    char* p = line;
+    while (isspace((unsigned char)*p)) p++;
+    if (*p == '\0' || *p == '#') {
+        return 0;
+    }
+    char op[16];
+    unsigned long long o, s;
+    if (sscanf(p, "%lf %15s %llu %llu", ts_us, op, &o, &s) != 4) {
+        return -1;
+    }
+    char c = (char)toupper((unsigned char)op[0]);
+    if (c != 'R' && c != 'W') {
+        return -1;
+    }
+    *is_write = c == 'W';
+    *off = o;
+    *size = s;
+    return 1;
+}
+
+static int load_trace(const char* path, trace_op_t** out, size_t* count) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    size_t n = 0, cap = 4096, lineno = 0;
+    trace_op_t* ops = malloc(cap * sizeof(*ops));
+    char line[512];
+    double first = -1;
+    int rc = ops ? 0 : -1;
+    while (rc == 0 && fgets(line, sizeof(line), f)) {
+        lineno++;
+        double ts;
+        int is_write;
+        uint64_t off, size;
+        int r = parse_line(line, &ts, &is_write, &off, &size);
+        if (r == 0) continue;
+        if (r < 0 || size == 0 || size > UINT32_MAX) {
+            fprintf(stderr, "轨迹第%zu行格式错误\n", lineno);
+            errno = EINVAL;
+            rc = -1;
+            break;
+        }
+        if (first < 0) first = ts;
+        if (n == cap) {
+            cap *= 2;
+            trace_op_t* grown = realloc(ops, cap * sizeof(*ops));
+            if (!grown) {
+                rc = -1;
+                break;
+            }
+            ops = grown;
+        }
+        ops[n].ts_ns = ts > first ? (uint64_t)((ts - first) * 1000.0) : 0;
+        ops[n].offset = off;
+        ops[n].size = (uint32_t)size;
+        ops[n].is_write = (uint8_t)is_write;
+        n++;
+    }
+    fclose(f);
+    if (rc != 0 || n == 0) {
+        free(ops);
+        if (rc == 0) errno = ENODATA;
+        return -1;
+    }
+    *out = ops;
+    *count = n;
+    return 0;
+}
+
+// ============================================================================
+// 回放
+// ============================================================================
+
+static void sleep_until(uint64_t target_ns) {
+    uint64_t now = sm3_now_ns();
+    if (target_ns > now) {
+        struct timespec ts = { (time_t)((target_ns - now) / 1000000000ull),
+                               (long)((target_ns - now) % 1000000000ull) };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// 处理 [first, first+n) 页（已按数据页数取模后连续）
+static int process_pages(replay_worker_t* w, uint8_t* buf, uint64_t first, int n, int is_write) {
+    const replay_cfg_t* cfg = w->cfg;
+    const uint8_t* inputs[GROUP];
+    const uint8_t* expected[GROUP];
+    uint8_t* outputs[GROUP];
+    uint8_t ok[GROUP];
+    int digest_size = cfg->digest_bits / 8;
+    if (n <= 0 || n > GROUP) {
+        return 0;
+    }
+    if (cfg->data_fd >= 0) {
+        uint64_t got;
+        if (sm3_read_pages(cfg->data_fd, buf, first, (uint64_t)n, cfg->data_pages * SM3_PAGE_SIZE,
+                           &got) != 0) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        inputs[i] = cfg->data_fd >= 0 ? buf + (size_t)i * SM3_PAGE_SIZE
+                                      : cfg->data + (first + (uint64_t)i) * SM3_PAGE_SIZE;
+        outputs[i] = cfg->tags + (first + (uint64_t)i) * 32;
+        expected[i] = outputs[i];
+    }
+    if (is_write) {
+        // 数据内容不变，重算的标签与已有标签相同，多线程写同一页不影响正确性
+        uint8_t tmp[GROUP][32];
+        uint8_t* out[GROUP];
+        for (int i = 0; i < n; i++) out[i] = tmp[i];
+        aes_sm3_integrity_mb(inputs, out, n, cfg->digest_bits);
+        for (int i = 0; i < n; i++) memcpy(outputs[i], tmp[i], (size_t)digest_size);
+    } else {
+        w->failures += (uint64_t)aes_sm3_integrity_verify_mb(inputs, expected, ok, n,
+                                                             cfg->digest_bits);
+    }
+    w->pages += (uint64_t)n;
+    return 0;
+}
+
+static void* replay_worker(void* arg) {
+    replay_worker_t* w = arg;
+    const replay_cfg_t* cfg = w->cfg;
+    uint8_t* buf = NULL;
+    if (cfg->data_fd >= 0 && !(buf = aligned_alloc(SM3_PAGE_SIZE, (size_t)GROUP * SM3_PAGE_SIZE))) {
+        w->error = ENOMEM;
+        return NULL;
+    }
+    uint64_t cpu0 = thread_cpu_ns();
+    for (size_t i = (size_t)w->id; i < cfg->count && !w->error; i += (size_t)cfg->threads) {
+        const trace_op_t* op = &cfg->ops[i];
+        uint64_t sched = w->start_ns;
+        if (cfg->paced) {
+            sched += (uint64_t)((double)op->ts_ns / cfg->speed);
+            sleep_until(sched);
+        }
+        uint64_t t0 = sm3_now_ns();
+        if (cfg->paced && t0 > sched && t0 - sched > w->max_behind_ns) {
+            w->max_behind_ns = t0 - sched;
+        }
+
+        uint64_t page = op->offset / SM3_PAGE_SIZE;
+        uint64_t last = (op->offset + op->size - 1) / SM3_PAGE_SIZE;
+        for (uint64_t p = page; p <= last && !w->error;) {
+            // 取模后连续且不超过一组的页一起处理
+            uint64_t mp = p % cfg->data_pages;
+            uint64_t n = last - p + 1;
+            if (n > GROUP) n = GROUP;
+            if (n > cfg->data_pages - mp) n = cfg->data_pages - mp;
+            if (process_pages(w, buf, mp, (int)n, op->is_write) != 0) {
+                w->error = errno ? errno : EIO;
+            }
+            p += n;
+        }
+        uint64_t dt = sm3_now_ns() - (cfg->paced ? sched : t0);
+        if (op->is_write) w->write_ns[w->writes++] = dt; else w->read_ns[w->reads++] = dt;
+        w->bytes += op->size;
+    }
+    w->cpu_ns = thread_cpu_ns() - cpu0;
+    free(buf);
+    return NULL;
+}
+
+// ============================================================================
+// 报告
+// ============================================================================
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_latency(const char* name, uint64_t* ns, uint64_t n) {
+    if (n == 0) {
+        printf("  %-4s -\n", name);
+        return;
+    }
+    qsort(ns, n, sizeof(uint64_t), cmp_u64);
+    double sum = 0;
+    for (uint64_t i = 0; i < n; i++) sum += (double)ns[i];
+    printf("  %-4s %9llu次  平均 %9.2f  P50 %9.2f  P90 %9.2f  P99 %9.2f  P99.9 %9.2f  最大 %9.2f us\n",
+           name, (unsigned long long)n, sum / (double)n / 1000, ns[(n - 1) / 2] / 1000.0,
+           ns[(n - 1) * 90 / 100] / 1000.0, ns[(n - 1) * 99 / 100] / 1000.0,
+           ns[(n - 1) * 999 / 1000] / 1000.0, ns[n - 1] / 1000.0);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "用法: %s <轨迹文件> [-f 数据文件] [-M 内存数据MB] [-c 语料配置] "
+                        "[-t 线程] [-p] [-x 倍速] [-b 128|256]\n", argv[0]);
+        return 2;
+    }
+    replay_cfg_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.threads = 1;
+    cfg.speed = 1.0;
+    cfg.digest_bits = 256;
+    cfg.data_fd = -1;
+    const char* data_path = NULL;
+    uint64_t mem_mb = 0;
+    sm3_corpus_opts_t corpus;
+    sm3_corpus_opts_default(&corpus);
+    int use_corpus = 0;
+
+    int opt;
+    optind = 2;
+    while ((opt = getopt(argc, argv, "f:M:c:t:px:b:")) != -1) {
+        switch (opt) {
+        case 'f': data_path = optarg; break;
+        case 'M': mem_mb = strtoull(optarg, NULL, 10); break;
+        case 'c':
+            if (sm3_corpus_parse(&corpus, optarg) != 0) {
+                fprintf(stderr, "语料配置无效: %s\n", optarg);
+                return 2;
+            }
+            use_corpus = 1;
+            break;
+        case 't': cfg.threads = atoi(optarg); break;
+        case 'p': cfg.paced = 1; break;
+        case 'x': cfg.speed = atof(optarg); break;
+        case 'b': cfg.digest_bits = atoi(optarg); break;
+        default:
+            fprintf(stderr, "未知选项\n");
+            return 2;
+        }
+    }
+    if (cfg.threads <= 0 || cfg.speed <= 0 || (cfg.digest_bits != 128 && cfg.digest_bits != 256)) {
+        fprintf(stderr, "参数无效\n");
+        return 2;
+    }
+
+    if (load_trace(argv[1], &cfg.ops, &cfg.count) != 0) {
+        fprintf(stderr, "读取轨迹失败: %s\n", strerror(errno));
+        return 2;
+    }
+    uint64_t span = 0, trace_bytes = 0;
+    for (size_t i = 0; i < cfg.count; i++) {
+        uint64_t end = cfg.ops[i].offset + cfg.ops[i].size;
+        if (end > span) span = end;
+        trace_bytes += cfg.ops[i].size;
+    }
+
+    // 数据源：文件按其大小取模；内存默认覆盖轨迹范围，最多1GB
+    if (data_path) {
+        struct stat st;
+        cfg.data_fd = open(data_path, O_RDONLY | O_CLOEXEC);
+        if (cfg.data_fd < 0 || fstat(cfg.data_fd, &st) != 0 || st.st_size < SM3_PAGE_SIZE) {
+            fprintf(stderr, "数据文件无效: %s\n", data_path);
+            return 2;
+        }
+        cfg.data_pages = (uint64_t)st.st_size / SM3_PAGE_SIZE;
+    } else {
+        uint64_t bytes = mem_mb ? mem_mb << 20 : (span < (1ull << 30) ? span : 1ull << 30);
+        cfg.data_pages = sm3_pages_for_size(bytes);
+        cfg.data = aligned_alloc(SM3_PAGE_SIZE, cfg.data_pages * SM3_PAGE_SIZE);
+        if (!cfg.data) {
+            fprintf(stderr, "内存不足\n");
+            return 2;
+        }
+        if (use_corpus) {
+            sm3_pool_t* pool = sm3_pool_create(0);
+            sm3_corpus_fill(&corpus, pool, 0, cfg.data_pages, cfg.data, NULL);
+            sm3_pool_destroy(pool);
+        } else {
+            uint64_t x = 88172645463325252ull;
+            for (uint64_t i = 0; i < cfg.data_pages * SM3_PAGE_SIZE / 8; i++) {
+                x ^= x << 13;
+                x ^= x >> 7;
+                x ^= x << 17;
+                ((uint64_t*)cfg.data)[i] = x;
+            }
+        }
+    }
+    cfg.tags = malloc(cfg.data_pages * 32);
+    if (!cfg.tags) {
+        fprintf(stderr, "内存不足\n");
+        return 2;
+    }
+
+    // 预先生成全部标签（不计时）
+    {
+        replay_worker_t init;
+        memset(&init, 0, sizeof(init));
+        init.cfg = &cfg;
+        uint8_t* buf = aligned_alloc(SM3_PAGE_SIZE, (size_t)GROUP * SM3_PAGE_SIZE);
+        for (uint64_t p = 0; p < cfg.data_pages; p += GROUP) {
+            uint64_t n = cfg.data_pages - p < GROUP ? cfg.data_pages - p : GROUP;
+            if (process_pages(&init, buf, p, (int)n, 1) != 0) {
+                fprintf(stderr, "读取数据文件失败: %s\n", strerror(errno));
+                return 2;
+            }
+        }
+        free(buf);
+    }
+
+    replay_worker_t* w = calloc((size_t)cfg.threads, sizeof(*w));
+    pthread_t* tids = calloc((size_t)cfg.threads, sizeof(pthread_t));
+    uint64_t per = cfg.count / (size_t)cfg.threads + 1;
+    for (int i = 0; w && i < cfg.threads; i++) {
+        w[i].cfg = &cfg;
+        w[i].id = i;
+        w[i].read_ns = malloc(per * 8);
+        w[i].write_ns = malloc(per * 8);
+        if (!w[i].read_ns || !w[i].write_ns) {
+            fprintf(stderr, "内存不足\n");
+            return 2;
+        }
+    }
+    if (!w || !tids) {
+        fprintf(stderr, "内存不足\n");
+        return 2;
+    }
+
+    uint64_t start = sm3_now_ns() + 1000000;    // 各线程共同的起点
+    for (int i = 0; i < cfg.threads; i++) {
+        w[i].start_ns = start;
+        if (pthread_create(&tids[i], NULL, replay_worker, &w[i]) != 0) {
+            fprintf(stderr, "创建线程失败\n");
+            return 2;
+        }
+    }
+    for (int i = 0; i < cfg.threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    uint64_t elapsed = sm3_now_ns() - start;
+
+    // 汇总
+    uint64_t* read_ns = malloc((cfg.count + 1) * 8);
+    uint64_t* write_ns = malloc((cfg.count + 1) * 8);
+    uint64_t reads = 0, writes = 0, pages = 0, bytes = 0, failures = 0, cpu = 0, behind = 0;
+    int error = 0;
+    for (int i = 0; i < cfg.threads; i++) {
+        memcpy(read_ns + reads, w[i].read_ns, w[i].reads * 8);
+        memcpy(write_ns + writes, w[i].write_ns, w[i].writes * 8);
+        reads += w[i].reads;
+        writes += w[i].writes;
+        pages += w[i].pages;
+        bytes += w[i].bytes;
+        failures += w[i].failures;
+        cpu += w[i].cpu_ns;
+        if (w[i].max_behind_ns > behind) behind = w[i].max_behind_ns;
+        if (w[i].error) error = w[i].error;
+    }
+    if (error) {
+        fprintf(stderr, "回放失败: %s\n", strerror(error));
+        return 2;
+    }
+
+    double secs = elapsed / 1e9;
+    uint64_t ops = reads + writes;
+    printf("轨迹: %zu条操作 (读 %llu, 写 %llu), %.2f MB, 时长 %.3f秒\n", cfg.count,
+           (unsigned long long)reads, (unsigned long long)writes, trace_bytes / (1024.0 * 1024.0),
+           cfg.ops[cfg.count - 1].ts_ns / 1e9);
+    printf("回放: %s, %d线程, 数据源 %s (%llu页), %d位标签\n",
+           cfg.paced ? "按记录节奏" : "尽快", cfg.threads, data_path ? data_path : "内存",
+           (unsigned long long)cfg.data_pages, cfg.digest_bits);
+    if (cfg.paced) {
+        printf("  倍速 %.2f, 最大落后计划 %.3f毫秒\n", cfg.speed, behind / 1e6);
+    }
+    printf("\n耗时 %.3f秒, %.0f ops/s, %.2f MB/s, %llu页\n", secs, ops / secs,
+           bytes / (1024.0 * 1024.0) / secs, (unsigned long long)pages);
+    printf("延迟%s:\n", cfg.paced ? "（自计划时间起）" : "");
+    print_latency("读", read_ns, reads);
+    print_latency("写", write_ns, writes);
+    printf("CPU: 共 %.3f秒, 每操作 %.2f us, 每页 %.0f ns\n", cpu / 1e9,
+           ops ? cpu / 1e3 / (double)ops : 0.0, pages ? (double)cpu / (double)pages : 0.0);
+    if (failures) {
+        printf("✗ 校验失败 %llu页\n", (unsigned long long)failures);
+    }
+
+    for (int i = 0; i < cfg.threads; i++) {
+        free(w[i].read_ns);
+        free(w[i].write_ns);
+    }
+    free(w);
+    free(tids);
+    free(read_ns);
+    free(write_ns);
+    free(cfg.ops);
+    free(cfg.tags);
+    free(cfg.data);
+    if (cfg.data_fd >= 0) close(cfg.data_fd);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,363 @@
+/*
+ * 概率抽样校验
+ *
+ * 状态文件格式（主机字节序，mmap读写）：
+ *   头部(64字节) | 每页最近一次校验的周期号(uint32，0表示从未校验)
+ *
+ * 每周期流程：
+ *   1. 按权重抽取 budget 页（周期内去重），排序后顺序读取以减少寻道
+ *   2. 每 SAMPLE_BATCH 页调用一次 aes_sm3_integrity_verify_mb
+ *   3. 更新每页周期号与累计统计，msync 状态文件
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+#include "sm3_sample.h"
+
+#define SAMPLE_BATCH 64
+#define SAMPLE_HEADER_SIZE 64
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t page_count;
+    uint64_t round;
+    uint64_t total_sampled;
+    uint64_t total_mismatches;
+    uint64_t covered;
+    uint64_t reserved2;
+} sample_header_t;
+
+typedef struct {
+    int fd;
+    uint8_t* base;
+    size_t map_size;
+    sample_header_t* hdr;
+    uint32_t* last_round;
+} sample_state_t;
+
+void sm3_sample_opts_default(sm3_sample_opts_t* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->fraction = 0.001;
+    opts->weight = SM3_SAMPLE_AGE;
+    opts->candidates = 4;
+    opts->confidence = 0.99;
+}
+
+// ============================================================================
+// 置信上界
+// ============================================================================
+
+// P(X <= k)，X ~ B(n, p)
+static double binom_cdf(uint64_t k, uint64_t n, double p) {
+    double lp = log(p), lq = log1p(-p);
+    double ln_n = lgamma((double)n + 1);
+    double sum = 0;
+    for (uint64_t i = 0; i <= k; i++) {
+        sum += exp(ln_n - lgamma((double)i + 1) - lgamma((double)(n - i) + 1) +
+                   (double)i * lp + (double)(n - i) * lq);
+    }
+    return sum;
+}
+
+double sm3_sample_upper_bound(uint64_t n, uint64_t k, double confidence) {
+    if (n == 0 || k >= n) {
+        return 1.0;
+    }
+    double alpha = 1.0 - confidence;
+    if (k == 0) {
+        return 1.0 - pow(alpha, 1.0 / (double)n);
+    }
+
+    double p_hat = (double)k / (double)n;
+    if (k > 10000) {
+        // 损坏页很多时精确求和代价过高，改用 Wilson 区间
+        double zlo = 0, zhi = 10;
+        for (int i = 0; i < 60; i++) {
+            double z = (zlo + zhi) / 2;
+            if (0.5 * erfc(z / sqrt(2.0)) > alpha) zlo = z; else zhi = z;
+        }
+        double z = zlo, z2n = z * z / (double)n;
+        return (p_hat + z2n / 2 + z * sqrt(p_hat * (1 - p_hat) / (double)n + z2n / (4.0 * n))) /
+               (1 + z2n);
+    }
+
+    // Clopper-Pearson：CDF 随 p 单调递减，二分求 P(X<=k) = alpha
+    double lo = p_hat, hi = 1.0;
+    for (int i = 0; i < 60; i++) {
+        double mid = (lo + hi) / 2;
+        if (binom_cdf(k, n, mid) > alpha) lo = mid; else hi = mid;
+    }
+    return hi;
+}
+
+// ============================================================================
+// 状态文件
+// ============================================================================
+
+static int state_open(sample_state_t* s, const char* path, uint64_t pages) {
+    memset(s, 0, sizeof(*s));
+    s->map_size = SAMPLE_HEADER_SIZE + pages * sizeof(uint32_t);
+
+    if (!path) {
+        // 无状态文件：仅本周期内去重
+        s->fd = -1;
+        s->base = calloc(1, s->map_size);
+        if (!s->base) {
+            return -1;
+        }
+    } else {
+        s->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (s->fd < 0) {
+            return -1;
+        }
+        struct stat st;
+        sample_header_t hdr;
+        int valid = fstat(s->fd, &st) == 0 && (size_t)st.st_size == s->map_size &&
+                    pread(s->fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+                    memcmp(hdr.magic, SM3_SAMPLE_MAGIC, 8) == 0 &&
+                    hdr.version == SM3_SAMPLE_VERSION && hdr.page_count == pages;
+        if (!valid) {
+            // 新建或清单已变化：从头统计
+            if (ftruncate(s->fd, 0) != 0 || ftruncate(s->fd, (off_t)s->map_size) != 0) {
+                close(s->fd);
+                return -1;
+            }
+        }
+        void* p = mmap(NULL, s->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+        if (p == MAP_FAILED) {
+            close(s->fd);
+            return -1;
+        }
+        s->base = p;
+    }
+
+    s->hdr = (sample_header_t*)s->base;
+    s->last_round = (uint32_t*)(s->base + SAMPLE_HEADER_SIZE);
+    if (memcmp(s->hdr->magic, SM3_SAMPLE_MAGIC, 8) != 0) {
+        memcpy(s->hdr->magic, SM3_SAMPLE_MAGIC, 8);
+        s->hdr->version = SM3_SAMPLE_VERSION;
+        s->hdr->page_count = pages;
+    }
+    return 0;
+}
+
+static int state_close(sample_state_t* s) {
+    int rc = 0;
+    if (s->fd < 0) {
+        free(s->base);
+        return 0;
+    }
+    if (msync(s->base, s->map_size, MS_SYNC) != 0) {
+        rc = -1;
+    }
+    munmap(s->base, s->map_size);
+    close(s->fd);
+    return rc;
+}
+
+// ============================================================================
+// 抽样
+// ============================================================================
+
+static uint64_t splitmix64(uint64_t* x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+typedef struct {
+    uint64_t page;
+    uint32_t prev_round;        // 抽中前的周期号，出错时恢复
+} sample_pick_t;
+
+static int cmp_pick(const void* a, const void* b) {
+    uint64_t x = ((const sample_pick_t*)a)->page, y = ((const sample_pick_t*)b)->page;
+    return x < y ? -1 : x > y;
+}
+
+// 按权重抽取至多 budget 个本周期尚未抽中的页，结果按页号升序
+static uint64_t pick_pages(const sm3_sample_opts_t* opts, sample_state_t* s, uint64_t total,
+                           uint32_t round, uint64_t budget, sample_pick_t* out) {
+    uint64_t rng = opts->seed ? opts->seed : sm3_now_ns();
+    rng ^= (uint64_t)round * 0xd1b54a32d192ed03ull;
+    int k = opts->weight == SM3_SAMPLE_AGE && opts->candidates > 1 ? opts->candidates : 1;
+
+    uint64_t n = 0;
+    for (uint64_t tries = 0; n < budget && tries < budget * 8; tries++) {
+        uint64_t best = splitmix64(&rng) % total;
+        for (int c = 1; c < k; c++) {
+            // 周期号越小越久未校验，从未校验(0)的页最优先
+            uint64_t p = splitmix64(&rng) % total;
+            if (s->last_round[p] < s->last_round[best]) {
+                best = p;
+            }
+        }
+        if (s->last_round[best] == round) {
+            continue;   // 本周期已抽中
+        }
+        out[n].page = best;
+        out[n].prev_round = s->last_round[best];
+        s->last_round[best] = round;
+        n++;
+    }
+    // 预算接近总页数时随机抽取难以凑满，顺序补齐
+    for (uint64_t p = 0; n < budget && p < total; p++) {
+        if (s->last_round[p] != round) {
+            out[n].page = p;
+            out[n].prev_round = s->last_round[p];
+            s->last_round[p] = round;
+            n++;
+        }
+    }
+    qsort(out, n, sizeof(sample_pick_t), cmp_pick);
+    return n;
+}
+
+static void throttle(const sm3_sample_opts_t* opts, uint64_t bytes, uint64_t t_start) {
+    if (opts->max_mbps <= 0) {
+        return;
+    }
+    uint64_t target = (uint64_t)((double)bytes / (opts->max_mbps * 1024 * 1024) * 1e9);
+    uint64_t elapsed = sm3_now_ns() - t_start;
+    if (elapsed < target) {
+        uint64_t d = target - elapsed;
+        struct timespec ts = { (time_t)(d / 1000000000ull), (long)(d % 1000000000ull) };
+        nanosleep(&ts, NULL);
+    }
+}
+
+int sm3_sample_verify(const char* data_path, const char* manifest_path,
+                      const sm3_sample_opts_t* opts, sm3_sample_stats_t* stats,
+                      sm3_bad_page_fn on_bad, void* ctx) {
+    memset(stats, 0, sizeof(*stats));
+    uint64_t t_start = sm3_now_ns();
+
+    int fd = open(data_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    sm3_manifest_t m;
+    if (fstat(fd, &st) != 0 || sm3_manifest_open(&m, manifest_path, 0) != 0) {
+        close(fd);
+        return -1;
+    }
+    uint64_t file_size = (uint64_t)st.st_size;
+    uint64_t total = sm3_pages_for_size(file_size);
+    if (m.hdr->file_size != file_size || total == 0) {
+        sm3_manifest_close(&m);
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+    stats->pages_total = total;
+
+    sample_state_t s;
+    if (state_open(&s, opts->state_path, total) != 0) {
+        sm3_manifest_close(&m);
+        close(fd);
+        return -1;
+    }
+    uint32_t round = (uint32_t)(s.hdr->round + 1);
+
+    uint64_t budget = opts->budget_pages;
+    if (!budget) {
+        budget = (uint64_t)ceil(opts->fraction * (double)total);
+    }
+    if (budget == 0) budget = 1;
+    if (budget > total) budget = total;
+
+    sample_pick_t* picks = malloc(budget * sizeof(sample_pick_t));
+    uint8_t* buf = aligned_alloc(SM3_PAGE_SIZE, (size_t)SAMPLE_BATCH * SM3_PAGE_SIZE);
+    uint64_t n = 0;
+    int rc = 0;
+    if (!picks || !buf) {
+        rc = -1;
+        goto out;
+    }
+    n = pick_pages(opts, &s, total, round, budget, picks);
+
+    int digest_bits = (int)m.hdr->digest_size * 8;
+    const uint8_t* inputs[SAMPLE_BATCH];
+    const uint8_t* expected[SAMPLE_BATCH];
+    uint8_t ok[SAMPLE_BATCH];
+    for (uint64_t i = 0; i < n && rc == 0; i += SAMPLE_BATCH) {
+        int cnt = n - i < SAMPLE_BATCH ? (int)(n - i) : SAMPLE_BATCH;
+        for (int j = 0; j < cnt; j++) {
+            uint64_t p = picks[i + j].page;
+            inputs[j] = buf + (size_t)j * SM3_PAGE_SIZE;
+            expected[j] = sm3_manifest_digest(&m, p);
+            if (sm3_read_pages(fd, buf + (size_t)j * SM3_PAGE_SIZE, p, 1, file_size,
+                               &stats->bytes_read) != 0) {
+                rc = -1;
+                break;
+            }
+        }
+        if (rc != 0) {
+            break;
+        }
+        if (aes_sm3_integrity_verify_mb(inputs, expected, ok, cnt, digest_bits) > 0) {
+            for (int j = 0; j < cnt; j++) {
+                if (!ok[j]) {
+                    stats->mismatches++;
+                    if (on_bad) on_bad(picks[i + j].page, ctx);
+                }
+            }
+        }
+        stats->sampled += (uint64_t)cnt;
+        throttle(opts, stats->bytes_read, t_start);
+    }
+
+    if (rc != 0) {
+        // 本周期作废：恢复被标记页的周期号，累计统计不变
+        for (uint64_t i = 0; i < n; i++) {
+            s.last_round[picks[i].page] = picks[i].prev_round;
+        }
+    } else {
+        for (uint64_t i = 0; i < n; i++) {
+            if (picks[i].prev_round == 0) {
+                s.hdr->covered++;
+            }
+        }
+        s.hdr->round = round;
+        s.hdr->total_sampled += stats->sampled;
+        s.hdr->total_mismatches += stats->mismatches;
+    }
+
+    stats->round = s.hdr->round;
+    stats->total_sampled = s.hdr->total_sampled;
+    stats->total_mismatches = s.hdr->total_mismatches;
+    stats->covered = s.hdr->covered;
+    stats->coverage = (double)s.hdr->covered / (double)total;
+    double confidence = opts->confidence > 0 ? opts->confidence : 0.99;
+    stats->bound = sm3_sample_upper_bound(stats->sampled, stats->mismatches, confidence);
+    stats->total_bound = sm3_sample_upper_bound(stats->total_sampled, stats->total_mismatches,
+                                                confidence);
+
+out:
+    if (state_close(&s) != 0) {
+        rc = -1;
+    }
+    free(picks);
+    free(buf);
+    sm3_manifest_close(&m);
+    close(fd);
+    stats->elapsed_ns = sm3_now_ns() - t_start;
+    return rc;
+}
@@ -0,0 +1,69 @@
+/*
+ * 概率抽样校验
+ *
+ * 冷数据无法频繁全量巡检。每个周期（一次调用）按固定比例从数据文件中
+ * 抽取若干页，批量计算摘要并与清单比对，使持续校验只占用固定比例的带宽。
+ *
+ * 抽样状态保存在独立的状态文件中（mmap）：每页记录最近一次被校验的周期号，
+ * 另有累计抽样数、不一致数和覆盖页数。据此给出：
+ *   - 覆盖率：至少被校验过一次的页占比
+ *   - 置信上界：在给定置信度下，损坏页比例不超过的值（Clopper-Pearson）
+ *
+ * 加权方式：
+ *   - SM3_SAMPLE_UNIFORM  均匀随机
+ *   - SM3_SAMPLE_AGE      按"距上次校验的时间"加权：每次抽取 candidates 个
+ *                         候选页，取最久未校验的一页，覆盖率增长更快
+ */
+
+#ifndef SM3_SAMPLE_H
+#define SM3_SAMPLE_H
+
+#include <stdint.h>
+
+#include "sm3_manifest.h"
+
+#define SM3_SAMPLE_MAGIC    "SM3SMPL1"
+#define SM3_SAMPLE_VERSION  1
+
+#define SM3_SAMPLE_UNIFORM  0
+#define SM3_SAMPLE_AGE      1
+
+typedef struct {
+    double fraction;            // 每周期抽样页数占总页数的比例
+    uint64_t budget_pages;      // 或直接给出每周期页数（非0时优先）
+    int weight;                 // SM3_SAMPLE_UNIFORM / SM3_SAMPLE_AGE
+    int candidates;             // SM3_SAMPLE_AGE 每次抽取的候选页数
+    uint64_t seed;              // 0 表示按时间取种子
+    double max_mbps;            // 读取带宽上限（MB/s，0不限）
+    double confidence;          // 置信上界的置信度，如 0.99
+    const char* state_path;     // 抽样状态文件，NULL 表示只做单周期统计
+} sm3_sample_opts_t;
+
+typedef struct {
+    uint64_t pages_total;
+    uint64_t round;             // 当前周期号（从1开始）
+    // 本周期
+    uint64_t sampled;
+    uint64_t mismatches;
+    uint64_t bytes_read;
+    uint64_t elapsed_ns;
+    double bound;               // 本周期样本给出的损坏比例置信上界
+    // 累计（来自状态文件）
+    uint64_t total_sampled;
+    uint64_t total_mismatches;
+    uint64_t covered;           // 至少校验过一次的页数
+    double coverage;
+    double total_bound;         // 累计样本给出的置信上界
+} sm3_sample_stats_t;
+
+void sm3_sample_opts_default(sm3_sample_opts_t* opts);
+
+// 执行一个抽样周期；不一致页通过 on_bad 回调报告。返回 0 成功，-1 出错
+int sm3_sample_verify(const char* data_path, const char* manifest_path,
+                      const sm3_sample_opts_t* opts, sm3_sample_stats_t* stats,
+                      sm3_bad_page_fn on_bad, void* ctx);
+
+// n 个样本中有 k 个损坏时，损坏比例在置信度 confidence 下的单侧上界
+double sm3_sample_upper_bound(uint64_t n, uint64_t k, double confidence);
+
+#endif // SM3_SAMPLE_H
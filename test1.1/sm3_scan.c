@@ -0,0 +1,922 @@
+/*
+ * sm3_scan - 基于XOR-SM3页摘要的文件扫描工具
+ *
+ * 用法:
+ *   sm3_scan hash   <数据文件> <清单文件> [选项]   生成页级摘要清单
+ *   sm3_scan verify <数据文件> <清单文件> [选项]   按清单校验数据文件
+ *   sm3_scan tree   <目录> <树清单>   [选项]       并行扫描目录树，生成树清单
+ *   sm3_scan sample <数据文件> <清单文件> [选项]   抽样校验一个周期
+ *   sm3_scan encode <数据文件> <编码文件> [选项]   生成可边收边验的流式编码，输出根摘要
+ *   sm3_scan decode <编码文件|-> <输出文件> -r <根摘要> [选项]   边收边验解码
+ *   sm3_scan dedup  <清单文件>... [选项]            统计多个清单的摘要重复率
+ *   sm3_scan similar <签名文件|清单文件>... [选项]  按 MinHash 签名查找相似的镜像/数据集
+ *   sm3_scan watch  <目录> <树清单> [<目录> <树清单>]... [选项]  监视写事件，只重算被修改的文件
+ *   sm3_scan tar    <tar文件|-> <树清单> [选项]    不解包，单遍计算镜像层的流摘要与树清单
+ *
+ * 选项:
+ *   -b <128|256>   摘要长度（hash，默认256）
+ *   -t <线程数>    并行计算线程数（默认1）
+ *   -c <检查点>    启用检查点；进程中断后以相同参数重新运行即可续扫
+ *   -p <页数>      每处理N页写一次检查点（默认262144页=1GB）
+ *   -m <毫秒>      或每T毫秒写一次检查点（默认30000）
+ *   -n <页数>      本次运行最多处理N页后暂停（分时段扫描）
+ *   -H <签名文件>  hash：同时累积 MinHash 签名，完成后写入该文件
+ *   -K <个数>      MinHash 哈希函数个数（4的倍数，默认128）
+ *   -M <镜像>      verify：不一致页从镜像（文件或 nbd:<地址>）取回，校验后原地写回
+ *   -B <MB/s>      从镜像读取的带宽上限
+ *
+ * tree 选项:
+ *   -b/-t          同上（-t 默认为在线CPU数）
+ *   -L <字节>      小文件阈值，不超过该大小的文件批量进入多缓冲区（默认65536）
+ *   -s <字节>      跳过小于该大小的文件
+ *   -S <字节>      跳过大于该大小的文件
+ *   -i <旧树清单>  增量重建：元数据未变化的文件沿用旧摘要
+ *   -P <比例>      偏执模式：按比例抽样重算未变化文件（0~1）
+ *   -X             同时读写 user.sm3.digest 扩展属性
+ *
+ * sample 选项:
+ *   -s <状态文件>  跨周期的抽样状态（覆盖率、累计统计）
+ *   -f <比例>      每周期抽样页数占总页数的比例（默认0.001）
+ *   -n <页数>      或直接指定每周期页数
+ *   -w <uniform|age> 均匀抽样或优先抽取久未校验的页（默认age）
+ *   -r <MB/s>      读取带宽上限
+ *   -C <置信度>    置信上界的置信度（默认0.99）
+ *   -R <种子>      固定随机种子
+ *   -M <镜像> -B <MB/s>  同 verify：从镜像修复抽样发现的不一致页
+ *
+ * encode/decode 选项:
+ *   -o <偏移> -l <长度>  只编码/解码该字节区间（切片），解码时须与编码一致
+ *   -M <清单>      encode：由256位清单取页摘要，不再读取数据计算
+ *   -t <线程数>    encode：页摘要计算线程数
+ *   -r <根摘要>    decode：64个十六进制字符
+ *
+ * dedup 选项:
+ *   -t <线程数>    并行线程数（默认在线CPU数）
+ *   -M <MB>        内存上限，超过时分区溢出到临时文件（默认物理内存的一半）
+ *   -T <目录>      溢出文件目录（默认 $TMPDIR 或 /tmp）
+ *   -k <N>         列出出现次数最多的前N个摘要（默认10）
+ *
+ * similar 选项:
+ *   -j <阈值>      只列出估计 Jaccard 相似度不低于该值的对（默认0.5）
+ *   -B <段数>      LSH 段数，须整除 K（默认32）
+ *   -K <个数>      由清单计算签名时的哈希函数个数（默认128）
+ *   -b <位数>      另给出只保留低b位时的估计（b-bit MinHash，1~16）
+ *
+ * watch 选项:
+ *   -w <毫秒>      合并窗口（默认500）
+ *   -t <线程数>    重算线程数（默认在线CPU数）
+ *   -b <128|256>   树清单不存在时的摘要长度（默认256）
+ *   -I / -F        只用 inotify / 只用 fanotify（默认先试 fanotify）
+ *
+ * tar 选项:
+ *   -b <128|256>   页摘要长度（默认256）
+ *   -t <线程数>    页摘要线程数（默认在线CPU数）
+ *   -l             列出每个条目
+ *   gzip / zstd / xz 压缩的输入自动识别，调用对应的解压程序
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_bao.h"
+#include "sm3_checkpoint.h"
+#include "sm3_dedup.h"
+#include "sm3_manifest.h"
+#include "sm3_minhash.h"
+#include "sm3_repair.h"
+#include "sm3_sample.h"
+#include "sm3_tar.h"
+#include "sm3_tree.h"
+#include "sm3_watch.h"
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "用法:\n"
+            "  %s hash   <数据文件> <清单文件> [-b 128|256] [-t 线程] [-c 检查点] [-p 页] [-m 毫秒] [-n 页]\n"
+            "         [-H 签名文件] [-K 个数]\n"
+            "  %s verify <数据文件> <清单文件> [-t 线程] [-c 检查点] [-p 页] [-m 毫秒] [-n 页] [-M 镜像] [-B MB/s]\n"
+            "  %s tree   <目录> <树清单> [-b 128|256] [-t 线程] [-L 小文件阈值] [-s 最小] [-S 最大]\n"
+            "         [-i 旧树清单] [-P 比例] [-X]\n"
+            "  %s sample <数据文件> <清单文件> [-s 状态] [-f 比例] [-n 页] [-w uniform|age] [-r MB/s] [-C 置信度] [-R 种子]\n"
+            "         [-M 镜像] [-B MB/s]\n"
+            "  %s encode <数据文件> <编码文件> [-o 偏移] [-l 长度] [-M 清单] [-t 线程]\n"
+            "  %s decode <编码文件|-> <输出文件> -r 根摘要 [-o 偏移] [-l 长度]\n"
+            "  %s dedup  <清单文件>... [-t 线程] [-M 内存MB] [-T 临时目录] [-k N]\n"
+            "  %s similar <签名文件|清单文件>... [-j 阈值] [-B 段数] [-K 个数] [-b 位数]\n"
+            "  %s watch  <目录> <树清单> [<目录> <树清单>]... [-w 毫秒] [-t 线程] [-b 128|256] [-I|-F]\n"
+            "  %s tar    <tar文件|-> <树清单> [-b 128|256] [-t 线程] [-l]\n",
+            prog, prog, prog, prog, prog, prog, prog, prog, prog, prog);
+}
+
+static void print_bad_page(uint64_t page, void* ctx) {
+    (void)ctx;
+    printf("  不一致页: %llu (偏移 %llu)\n", (unsigned long long)page,
+           (unsigned long long)page * SM3_PAGE_SIZE);
+}
+
+// 收集不一致页，校验结束后统一从镜像修复
+typedef struct {
+    uint64_t* pages;
+    size_t count;
+    size_t cap;
+} bad_list_t;
+
+static void collect_bad_page(uint64_t page, void* ctx) {
+    bad_list_t* l = ctx;
+    print_bad_page(page, NULL);
+    if (l->count == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 64;
+        uint64_t* p = realloc(l->pages, cap * sizeof(uint64_t));
+        if (!p) return;
+        l->pages = p;
+        l->cap = cap;
+    }
+    l->pages[l->count++] = page;
+}
+
+// 返回仍未修复的页数，出错返回 -1
+static int repair_from_mirror(const char* mirror, double mbps, const char* data_path,
+                              const char* manifest_path, const bad_list_t* bad) {
+    sm3_repair_opts_t ropts;
+    sm3_repair_opts_default(&ropts);
+    ropts.max_mbps = mbps;
+    sm3_repair_t* r = sm3_repair_open(mirror, &ropts);
+    if (!r) {
+        fprintf(stderr, "无法打开镜像 %s: %s\n", mirror, strerror(errno));
+        return -1;
+    }
+    int left = sm3_repair_file(r, data_path, manifest_path, bad->pages, bad->count);
+    if (left < 0) {
+        fprintf(stderr, "修复失败: %s\n", strerror(errno));
+    } else {
+        const sm3_repair_stats_t* st = sm3_repair_stats(r);
+        printf("修复: %llu 页已从镜像写回, 重读已一致 %llu, 镜像也不一致 %llu, 镜像读取失败 %llu, "
+               "%llu 批, 取回 %.3fs, 写回 %.3fs, 限速等待 %.3fs\n",
+               (unsigned long long)st->repaired, (unsigned long long)st->already_ok,
+               (unsigned long long)st->mirror_bad, (unsigned long long)st->mirror_errors,
+               (unsigned long long)st->batches, st->fetch_ns / 1e9, st->write_ns / 1e9,
+               st->throttle_ns / 1e9);
+    }
+    sm3_repair_close(r);
+    return left;
+}
+
+static void print_stats(const sm3_scan_stats_t* s) {
+    double secs = s->elapsed_ns / 1e9;
+    double mb = s->bytes_read / (1024.0 * 1024.0);
+    printf("总页数: %llu, 本次处理: %llu, 续扫跳过: %llu%s\n",
+           (unsigned long long)s->pages_total, (unsigned long long)s->pages_done,
+           (unsigned long long)s->pages_resumed, s->resumed ? " (从检查点恢复)" : "");
+    printf("耗时: %.3f秒, 吞吐量: %.2f MB/s\n", secs, secs > 0 ? mb / secs : 0.0);
+    if (s->checkpoints) {
+        printf("检查点: %llu次, %llu字节, 耗时%.3f毫秒 (占总耗时%.2f%%)\n",
+               (unsigned long long)s->checkpoints, (unsigned long long)s->checkpoint_bytes,
+               s->checkpoint_ns / 1e6,
+               s->elapsed_ns ? 100.0 * s->checkpoint_ns / s->elapsed_ns : 0.0);
+    }
+}
+
+static int run_tree(int argc, char** argv) {
+    sm3_tree_opts_t opts;
+    sm3_tree_opts_default(&opts);
+
+    const char* previous_path = NULL;
+    sm3_tree_result_t previous;
+    int opt;
+    optind = 4;
+    while ((opt = getopt(argc, argv, "b:t:L:s:S:i:P:X")) != -1) {
+        switch (opt) {
+        case 'b': opts.digest_bits = atoi(optarg); break;
+        case 't': opts.num_threads = atoi(optarg); break;
+        case 'L': opts.small_max = strtoull(optarg, NULL, 10); break;
+        case 's': opts.min_size = strtoull(optarg, NULL, 10); break;
+        case 'S': opts.max_size = strtoull(optarg, NULL, 10); break;
+        case 'i': previous_path = optarg; break;
+        case 'P': opts.paranoid_ratio = atof(optarg); break;
+        case 'X': opts.use_xattr = 1; break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (opts.digest_bits != 128 && opts.digest_bits != 256) {
+        fprintf(stderr, "摘要长度必须为128或256\n");
+        return 2;
+    }
+    if (previous_path) {
+        if (sm3_tree_load(previous_path, &previous) != 0) {
+            fprintf(stderr, "无法读取旧树清单 %s: %s\n", previous_path, strerror(errno));
+            return 2;
+        }
+        opts.previous = &previous;
+    }
+    opts.paranoid_seed = (uint64_t)time(NULL);
+
+    sm3_tree_result_t result;
+    int failed = sm3_tree_scan(argv[2], &opts, &result) != 0 ||
+                 sm3_tree_write(argv[3], &result) != 0;
+    if (previous_path) {
+        sm3_tree_result_free(&previous);
+    }
+    if (failed) {
+        fprintf(stderr, "tree 失败: %s\n", strerror(errno));
+        sm3_tree_result_free(&result);
+        return 2;
+    }
+
+    double secs = result.elapsed_ns / 1e9;
+    printf("目录: %llu, 文件: %zu (小文件%llu, 大文件%llu), 跳过: %llu, 错误: %llu\n",
+           (unsigned long long)result.dirs, result.count,
+           (unsigned long long)result.small_files, (unsigned long long)result.large_files,
+           (unsigned long long)result.filtered, (unsigned long long)result.errors);
+    printf("数据: %.2f MB, %llu页, 多缓冲区批次: %llu\n", result.bytes / (1024.0 * 1024.0),
+           (unsigned long long)result.pages, (unsigned long long)result.batches);
+    printf("耗时: %.3f秒, %.0f 文件/秒, %.2f MB/s\n", secs,
+           secs > 0 ? result.count / secs : 0.0,
+           secs > 0 ? result.bytes / (1024.0 * 1024.0) / secs : 0.0);
+    if (previous_path || opts.use_xattr) {
+        printf("增量: 未变化 %llu (扩展属性 %llu), 变化/新增 %llu, 抽样重算 %llu, 静默损坏 %llu\n",
+               (unsigned long long)result.unchanged, (unsigned long long)result.xattr_hits,
+               (unsigned long long)result.changed, (unsigned long long)result.sampled,
+               (unsigned long long)result.corrupt);
+    }
+    for (size_t i = 0; i < result.count; i++) {
+        if (result.entries[i].flags & SM3_TREE_CORRUPT) {
+            printf("  ✗ 元数据未变但内容不符: %s\n", result.entries[i].path);
+        }
+    }
+    int rc = result.errors || result.corrupt ? 1 : 0;
+    sm3_tree_result_free(&result);
+    return rc;
+}
+
+static int run_sample(int argc, char** argv) {
+    sm3_sample_opts_t opts;
+    sm3_sample_opts_default(&opts);
+    const char* mirror = NULL;
+    double repair_mbps = 0;
+
+    int opt;
+    optind = 4;
+    while ((opt = getopt(argc, argv, "s:f:n:w:r:C:R:M:B:")) != -1) {
+        switch (opt) {
+        case 's': opts.state_path = optarg; break;
+        case 'f': opts.fraction = atof(optarg); break;
+        case 'n': opts.budget_pages = strtoull(optarg, NULL, 10); break;
+        case 'w': opts.weight = strcmp(optarg, "uniform") == 0 ? SM3_SAMPLE_UNIFORM : SM3_SAMPLE_AGE; break;
+        case 'r': opts.max_mbps = atof(optarg); break;
+        case 'C': opts.confidence = atof(optarg); break;
+        case 'R': opts.seed = strtoull(optarg, NULL, 10); break;
+        case 'M': mirror = optarg; break;
+        case 'B': repair_mbps = atof(optarg); break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (opts.confidence <= 0 || opts.confidence >= 1) {
+        fprintf(stderr, "置信度必须在(0,1)之间\n");
+        return 2;
+    }
+
+    sm3_sample_stats_t s;
+    bad_list_t bad = { NULL, 0, 0 };
+    if (sm3_sample_verify(argv[2], argv[3], &opts, &s, collect_bad_page, &bad) != 0) {
+        fprintf(stderr, "sample 失败: %s\n", strerror(errno));
+        free(bad.pages);
+        return 2;
+    }
+
+    double secs = s.elapsed_ns / 1e9;
+    printf("周期 %llu: 抽样 %llu/%llu页, 不一致 %llu, 耗时 %.3f秒, %.2f MB/s\n",
+           (unsigned long long)s.round, (unsigned long long)s.sampled,
+           (unsigned long long)s.pages_total, (unsigned long long)s.mismatches, secs,
+           secs > 0 ? s.bytes_read / (1024.0 * 1024.0) / secs : 0.0);
+    printf("本周期: 损坏比例 <= %.3g (置信度 %.2f%%)，约 %.0f 页\n", s.bound,
+           opts.confidence * 100, s.bound * (double)s.pages_total);
+    if (opts.state_path) {
+        printf("累计: 抽样 %llu, 不一致 %llu, 覆盖率 %.2f%% (%llu页), 损坏比例 <= %.3g\n",
+               (unsigned long long)s.total_sampled, (unsigned long long)s.total_mismatches,
+               s.coverage * 100, (unsigned long long)s.covered, s.total_bound);
+    }
+    int left = (int)s.mismatches;
+    if (mirror && bad.count > 0) {
+        left = repair_from_mirror(mirror, repair_mbps, argv[2], argv[3], &bad);
+    }
+    free(bad.pages);
+    return left < 0 ? 2 : left > 0 ? 1 : 0;
+}
+
+static int write_fd(void* ctx, const void* data, size_t len) {
+    int fd = *(int*)ctx;
+    const uint8_t* p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int run_encode(int argc, char** argv) {
+    uint64_t offset = 0, len = SM3_BAO_ALL;
+    const char* manifest_path = NULL;
+    int threads = 1;
+    int opt;
+    optind = 4;
+    while ((opt = getopt(argc, argv, "o:l:M:t:")) != -1) {
+        switch (opt) {
+        case 'o': offset = strtoull(optarg, NULL, 0); break;
+        case 'l': len = strtoull(optarg, NULL, 0); break;
+        case 'M': manifest_path = optarg; break;
+        case 't': threads = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    int in = open(argv[2], O_RDONLY | O_CLOEXEC);
+    int out = open(argv[3], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (in < 0 || out < 0) {
+        fprintf(stderr, "打开文件失败: %s\n", strerror(errno));
+        return 2;
+    }
+    uint64_t t0 = sm3_now_ns();
+    sm3_bao_tree_t* tree = NULL;
+    int rc;
+    if (manifest_path) {
+        sm3_manifest_t m;
+        rc = sm3_manifest_open(&m, manifest_path, 0);
+        if (rc == 0) {
+            rc = sm3_bao_tree_from_manifest(&tree, &m);
+            sm3_manifest_close(&m);
+        }
+    } else {
+        sm3_pool_t* pool = sm3_pool_create(threads);
+        rc = pool ? sm3_bao_tree_build(&tree, in, pool) : -1;
+        sm3_pool_destroy(pool);
+    }
+    uint64_t t1 = sm3_now_ns();
+    if (rc != 0 || sm3_bao_encode(tree, in, offset, len, write_fd, &out) != 0) {
+        fprintf(stderr, "encode 失败: %s\n", strerror(errno));
+        sm3_bao_tree_free(tree);
+        return 2;
+    }
+    uint64_t t2 = sm3_now_ns();
+    close(in);
+    if (close(out) != 0) {
+        fprintf(stderr, "写入编码文件失败: %s\n", strerror(errno));
+        return 2;
+    }
+
+    uint8_t root[32];
+    sm3_bao_tree_root(tree, root);
+    printf("根摘要: ");
+    for (int i = 0; i < 32; i++) printf("%02x", root[i]);
+    printf("\n对象 %llu 字节, 编码 %llu 字节, 建树 %.3f秒, 编码 %.3f秒\n",
+           (unsigned long long)sm3_bao_tree_size(tree),
+           (unsigned long long)sm3_bao_encoded_size(tree, offset, len),
+           (t1 - t0) / 1e9, (t2 - t1) / 1e9);
+    sm3_bao_tree_free(tree);
+    return 0;
+}
+
+typedef struct {
+    int fd;
+    uint64_t base;
+} decode_out_t;
+
+static int write_decoded(void* ctx, uint64_t offset, const void* data, size_t len) {
+    decode_out_t* o = ctx;
+    return pwrite(o->fd, data, len, (off_t)(offset - o->base)) == (ssize_t)len ? 0 : -1;
+}
+
+static int run_decode(int argc, char** argv) {
+    uint64_t offset = 0, len = SM3_BAO_ALL;
+    const char* root_hex = NULL;
+    int opt;
+    optind = 4;
+    while ((opt = getopt(argc, argv, "o:l:r:")) != -1) {
+        switch (opt) {
+        case 'o': offset = strtoull(optarg, NULL, 0); break;
+        case 'l': len = strtoull(optarg, NULL, 0); break;
+        case 'r': root_hex = optarg; break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    uint8_t root[32];
+    if (!root_hex || strlen(root_hex) != 64) {
+        fprintf(stderr, "需要 -r 指定64个十六进制字符的根摘要\n");
+        return 2;
+    }
+    for (int i = 0; i < 32; i++) {
+        unsigned v;
+        if (sscanf(root_hex + 2 * i, "%2x", &v) != 1) {
+            fprintf(stderr, "根摘要格式错误\n");
+            return 2;
+        }
+        root[i] = (uint8_t)v;
+    }
+
+    int in = strcmp(argv[2], "-") == 0 ? STDIN_FILENO : open(argv[2], O_RDONLY | O_CLOEXEC);
+    decode_out_t out = { open(argv[3], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644), offset };
+    sm3_bao_decoder_t* dec;
+    if (in < 0 || out.fd < 0 ||
+        sm3_bao_decoder_init(&dec, root, offset, len, write_decoded, &out) != 0) {
+        fprintf(stderr, "打开文件失败: %s\n", strerror(errno));
+        return 2;
+    }
+
+    enum { BUF = 1 << 20 };
+    uint8_t* buf = malloc(BUF);
+    int rc = buf ? 0 : -1;
+    uint64_t t0 = sm3_now_ns();
+    while (rc == 0) {
+        ssize_t n = read(in, buf, BUF);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            rc = n < 0 ? -1 : sm3_bao_decoder_finish(dec);
+            break;
+        }
+        rc = sm3_bao_decoder_feed(dec, buf, (size_t)n);
+    }
+    int err = errno;
+    uint64_t elapsed = sm3_now_ns() - t0;
+    const sm3_bao_decoder_stats_t* st = sm3_bao_decoder_stats(dec);
+    printf("对象 %llu 字节, 接收 %llu 字节, 交付 %llu 字节, 校验 %llu页/%llu节点, "
+           "首字节 %.3f毫秒, 总计 %.3f秒\n",
+           (unsigned long long)sm3_bao_decoder_size(dec), (unsigned long long)st->bytes_in,
+           (unsigned long long)st->bytes_out, (unsigned long long)st->pages_verified,
+           (unsigned long long)st->nodes_verified, st->first_out_ns / 1e6, elapsed / 1e9);
+    sm3_bao_decoder_free(dec);
+    free(buf);
+    if (in != STDIN_FILENO) close(in);
+    close(out.fd);
+    if (rc != 0) {
+        printf("✗ 解码失败: %s\n", strerror(err));
+        return err == EBADMSG ? 1 : 2;
+    }
+    printf("✓ 校验通过\n");
+    return 0;
+}
+
+static int run_dedup(int argc, char** argv) {
+    sm3_dedup_opts_t opts;
+    sm3_dedup_opts_default(&opts);
+    int opt;
+    optind = 2;
+    while ((opt = getopt(argc, argv, "t:M:T:k:")) != -1) {
+        switch (opt) {
+        case 't': opts.num_threads = atoi(optarg); break;
+        case 'M': opts.mem_limit = strtoull(optarg, NULL, 10) << 20; break;
+        case 'T': opts.tmp_dir = optarg; break;
+        case 'k': opts.top = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 2;
+    }
+    sm3_dedup_result_t r;
+    if (sm3_dedup_analyze((const char* const*)argv + optind, argc - optind, &opts, &r) != 0) {
+        fprintf(stderr, "dedup 失败: %s\n", strerror(errno));
+        return 2;
+    }
+
+    // 零页摘要：通常是出现次数最多的摘要
+    uint8_t zero[SM3_PAGE_SIZE], zero_digest[32];
+    memset(zero, 0, sizeof(zero));
+    if (r.digest_size == 16) {
+        aes_sm3_integrity_128bit(zero, zero_digest);
+    } else {
+        aes_sm3_integrity_256bit(zero, zero_digest);
+    }
+
+    double secs = r.elapsed_ns / 1e9;
+    double mb = (double)r.pages * r.digest_size / (1024.0 * 1024.0);
+    printf("清单: %d, 总页数: %llu, 摘要 %d 字节\n", argc - optind,
+           (unsigned long long)r.pages, r.digest_size);
+    printf("不同摘要: %llu, 可去重页: %llu, 重复率: %.2f%%, 出现多次的摘要: %llu\n",
+           (unsigned long long)r.unique, (unsigned long long)(r.pages - r.unique),
+           100.0 * sm3_dedup_ratio(&r), (unsigned long long)r.duplicated);
+    printf("耗时: %.3f秒 (分区 %.3f, 排序统计 %.3f), 摘要吞吐量: %.2f MB/s, 分区: %u",
+           secs, r.partition_ns / 1e9, r.sort_ns / 1e9, secs > 0 ? mb / secs : 0.0, r.partitions);
+    if (r.spill_bytes) {
+        printf(", 溢出: %.1f MB", r.spill_bytes / (1024.0 * 1024.0));
+    }
+    printf("\n\n重复次数分布:\n  出现次数                  摘要数           页数\n");
+    for (int b = 0; b < SM3_DEDUP_HIST_BUCKETS; b++) {
+        if (!r.hist_digests[b]) continue;
+        char range[32];
+        uint64_t lo = b <= 1 ? (uint64_t)b + 1 : (1ull << (b - 1)) + 1, hi = 1ull << b;
+        if (lo == hi || b == 0) {
+            snprintf(range, sizeof(range), "%llu", (unsigned long long)lo);
+        } else {
+            snprintf(range, sizeof(range), "%llu-%llu", (unsigned long long)lo, (unsigned long long)hi);
+        }
+        printf("  %-16s %14llu %14llu\n", range, (unsigned long long)r.hist_digests[b],
+               (unsigned long long)r.hist_pages[b]);
+    }
+    if (r.top_count) {
+        printf("\n出现次数最多的摘要:\n");
+    }
+    for (int i = 0; i < r.top_count; i++) {
+        printf("  ");
+        for (int k = 0; k < r.digest_size; k++) printf("%02x", r.top[i].digest[k]);
+        printf("  %12llu%s\n", (unsigned long long)r.top[i].count,
+               memcmp(r.top[i].digest, zero_digest, (size_t)r.digest_size) == 0 ? "  (零页)" : "");
+    }
+    sm3_dedup_result_free(&r);
+    return 0;
+}
+
+static int run_similar(int argc, char** argv) {
+    double threshold = 0.5;
+    int bands = 32, k = 128, bits = 0;
+    int opt;
+    optind = 2;
+    while ((opt = getopt(argc, argv, "j:B:K:b:")) != -1) {
+        switch (opt) {
+        case 'j': threshold = atof(optarg); break;
+        case 'B': bands = atoi(optarg); break;
+        case 'K': k = atoi(optarg); break;
+        case 'b': bits = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    int n = argc - optind;
+    if (n < 2 || bits < 0 || bits > 16) {
+        usage(argv[0]);
+        return 2;
+    }
+    sm3_minhash_t* sigs = malloc((size_t)n * sizeof(sm3_minhash_t));
+    if (!sigs) {
+        fprintf(stderr, "内存不足\n");
+        return 2;
+    }
+    // 签名文件直接读取，否则按清单计算
+    for (int i = 0; i < n; i++) {
+        const char* path = argv[optind + i];
+        if (sm3_minhash_load(&sigs[i], path) != 0 &&
+            sm3_minhash_from_manifest(&sigs[i], k, path) != 0) {
+            fprintf(stderr, "无法读取签名或清单 %s: %s\n", path, strerror(errno));
+            free(sigs);
+            return 2;
+        }
+        if (sigs[i].k != sigs[0].k) {
+            fprintf(stderr, "%s 的哈希函数个数(%d)与 %s 不同(%d)\n", path, sigs[i].k,
+                    argv[optind], sigs[0].k);
+            free(sigs);
+            return 2;
+        }
+    }
+    k = sigs[0].k;
+    sm3_lsh_t* lsh = sm3_lsh_create(k, bands);
+    if (!lsh) {
+        fprintf(stderr, "LSH 段数须整除哈希函数个数(%d)\n", k);
+        free(sigs);
+        return 2;
+    }
+    for (int i = 0; i < n; i++) sm3_lsh_add(lsh, &sigs[i]);
+    sm3_lsh_pair_t* pairs;
+    size_t count;
+    if (sm3_lsh_pairs(lsh, threshold, &pairs, &count) != 0) {
+        fprintf(stderr, "similar 失败: %s\n", strerror(errno));
+        sm3_lsh_destroy(lsh);
+        free(sigs);
+        return 2;
+    }
+    printf("%d 个签名, K=%d, %d 段×%d 行 (候选阈值约 %.2f), 相似度不低于 %.2f 的对: %zu\n",
+           n, k, bands, k / bands, pow(1.0 / bands, (double)bands / k), threshold, count);
+    uint8_t* pa = bits ? malloc(sm3_minhash_packed_size(k, bits)) : NULL;
+    uint8_t* pb = bits ? malloc(sm3_minhash_packed_size(k, bits)) : NULL;
+    for (size_t i = 0; i < count; i++) {
+        printf("  %.3f", pairs[i].similarity);
+        if (pa && pb) {
+            sm3_minhash_pack(&sigs[pairs[i].a], bits, pa);
+            sm3_minhash_pack(&sigs[pairs[i].b], bits, pb);
+            printf("  (%d位: %.3f)", bits, sm3_minhash_similarity_packed(pa, pb, k, bits));
+        }
+        printf("  %s  %s\n", argv[optind + pairs[i].a], argv[optind + pairs[i].b]);
+    }
+    free(pa);
+    free(pb);
+    free(pairs);
+    sm3_lsh_destroy(lsh);
+    free(sigs);
+    return 0;
+}
+
+static volatile sig_atomic_t watch_stop;
+
+static void on_watch_signal(int sig) {
+    (void)sig;
+    watch_stop = 1;
+}
+
+static int run_watch(int argc, char** argv) {
+    sm3_watch_opts_t opts;
+    sm3_watch_opts_default(&opts);
+    int npairs = 0;
+    while (2 + 2 * npairs + 1 < argc && argv[2 + 2 * npairs][0] != '-' &&
+           argv[3 + 2 * npairs][0] != '-') {
+        npairs++;
+    }
+    int opt;
+    optind = 2 + 2 * npairs;
+    while ((opt = getopt(argc, argv, "w:t:b:IF")) != -1) {
+        switch (opt) {
+        case 'w': opts.window_ms = (uint32_t)atoi(optarg); break;
+        case 't': opts.num_threads = atoi(optarg); break;
+        case 'b': opts.digest_bits = atoi(optarg); break;
+        case 'I': opts.backend = SM3_WATCH_INOTIFY; break;
+        case 'F': opts.backend = SM3_WATCH_FANOTIFY; break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (npairs == 0 || optind < argc) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (opts.digest_bits != 128 && opts.digest_bits != 256) {
+        fprintf(stderr, "摘要长度必须为128或256\n");
+        return 2;
+    }
+
+    sm3_watch_t** ws = calloc((size_t)npairs, sizeof(sm3_watch_t*));
+    sm3_watch_stats_t* last = calloc((size_t)npairs, sizeof(sm3_watch_stats_t));
+    struct pollfd* pfds = calloc((size_t)npairs, sizeof(struct pollfd));
+    int rc = ws && last && pfds ? 0 : 2;
+    for (int i = 0; rc == 0 && i < npairs; i++) {
+        const char* root = argv[2 + 2 * i];
+        ws[i] = sm3_watch_open(root, argv[3 + 2 * i], &opts);
+        if (!ws[i]) {
+            fprintf(stderr, "无法监视 %s: %s%s\n", root, strerror(errno),
+                    errno == EPERM ? "（fanotify 需要 CAP_SYS_ADMIN，可改用 -I）" : "");
+            rc = 2;
+            break;
+        }
+        const sm3_tree_result_t* t = sm3_watch_tree(ws[i]);
+        printf("监视 %s (%s): %zu 个文件, 初始扫描重算 %llu 个\n", root, sm3_watch_backend(ws[i]),
+               t->count, (unsigned long long)t->changed);
+        pfds[i].fd = sm3_watch_fd(ws[i]);
+        pfds[i].events = POLLIN;
+    }
+    fflush(stdout);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_watch_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (rc == 0 && !watch_stop) {
+        // 等待到最早到期的批次
+        int timeout = -1;
+        for (int i = 0; i < npairs; i++) {
+            int t = sm3_watch_next_timeout(ws[i]);
+            if (t >= 0 && (timeout < 0 || t < timeout)) timeout = t;
+        }
+        if (poll(pfds, (nfds_t)npairs, timeout) < 0 && errno != EINTR) {
+            rc = 2;
+            break;
+        }
+        for (int i = 0; i < npairs && rc == 0; i++) {
+            int n = sm3_watch_process(ws[i]);
+            if (n < 0) {
+                fprintf(stderr, "处理 %s 失败: %s\n", argv[2 + 2 * i], strerror(errno));
+                rc = 2;
+            }
+            if (n <= 0) continue;
+            sm3_watch_stats_t s;
+            sm3_watch_stats(ws[i], &s);
+            printf("%s: 重算 %llu 个文件 (%llu 个事件), 变化 %llu, 新增 %llu, 删除 %llu, "
+                   "读取失败 %llu, %.2f MB, 耗时 %.3f毫秒%s\n", argv[2 + 2 * i],
+                   (unsigned long long)(s.rehashed - last[i].rehashed),
+                   (unsigned long long)(s.events - last[i].events),
+                   (unsigned long long)(s.changed - last[i].changed),
+                   (unsigned long long)(s.added - last[i].added),
+                   (unsigned long long)(s.removed - last[i].removed),
+                   (unsigned long long)(s.errors - last[i].errors),
+                   (s.bytes - last[i].bytes) / (1024.0 * 1024.0),
+                   (s.hash_ns - last[i].hash_ns) / 1e6,
+                   s.rescans != last[i].rescans ? " (事件溢出，已整树增量重扫)" : "");
+            fflush(stdout);
+            last[i] = s;
+        }
+    }
+    // 退出前处理尚在窗口内的文件
+    for (int i = 0; ws && i < npairs; i++) {
+        if (!ws[i]) continue;
+        if (rc == 0 && sm3_watch_flush(ws[i]) < 0) {
+            fprintf(stderr, "处理 %s 失败: %s\n", argv[2 + 2 * i], strerror(errno));
+            rc = 2;
+        }
+        sm3_watch_close(ws[i]);
+    }
+    free(pfds);
+    free(last);
+    free(ws);
+    return rc;
+}
+
+static int run_tar(int argc, char** argv) {
+    sm3_tar_opts_t opts;
+    sm3_tar_opts_default(&opts);
+    int list = 0;
+    int opt;
+    optind = 4;
+    while ((opt = getopt(argc, argv, "b:t:l")) != -1) {
+        switch (opt) {
+        case 'b': opts.digest_bits = atoi(optarg); break;
+        case 't': opts.num_threads = atoi(optarg); break;
+        case 'l': list = 1; break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (opts.digest_bits != 128 && opts.digest_bits != 256) {
+        fprintf(stderr, "摘要长度必须为128或256\n");
+        return 2;
+    }
+
+    sm3_tar_result_t r;
+    if (sm3_tar_hash_file(argv[2], &opts, &r) != 0) {
+        fprintf(stderr, "tar 失败: %s%s\n", strerror(errno),
+                errno == EINVAL ? "（不是 tar 流或已截断）" : "");
+        return 2;
+    }
+    sm3_tree_result_t tree;
+    if (sm3_tar_to_tree(&r, &tree) != 0 || sm3_tree_write(argv[3], &tree) != 0) {
+        fprintf(stderr, "写入树清单失败: %s\n", strerror(errno));
+        sm3_tar_result_free(&r);
+        return 2;
+    }
+
+    if (list) {
+        for (size_t i = 0; i < r.count; i++) {
+            const sm3_tar_entry_t* e = &r.entries[i];
+            printf("  %c %10llu  %s", e->type ? e->type : '0', (unsigned long long)e->size, e->path);
+            if (e->link) printf(" -> %s", e->link);
+            printf("\n");
+        }
+    }
+    double secs = r.elapsed_ns / 1e9;
+    printf("流摘要: sm3:");
+    for (int i = 0; i < 32; i++) printf("%02x", r.stream_digest[i]);
+    printf("\n");
+    printf("条目: %zu (树清单 %zu 个文件), 页: %llu, 批次: %llu, 拷贝页: %llu\n", r.count, tree.count,
+           (unsigned long long)r.pages, (unsigned long long)r.batches,
+           (unsigned long long)r.copied_pages);
+    printf("流: %.2f MB (%s), 耗时: %.3f秒, %.2f MB/s, 等待输入 %.3f秒\n",
+           r.stream_bytes / (1024.0 * 1024.0), r.compression, secs,
+           secs > 0 ? r.stream_bytes / (1024.0 * 1024.0) / secs : 0.0, r.read_wait_ns / 1e9);
+    sm3_tree_result_free(&tree);
+    sm3_tar_result_free(&r);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 4 && strcmp(argv[1], "tar") == 0) {
+        return run_tar(argc, argv);
+    }
+    if (argc >= 4 && strcmp(argv[1], "watch") == 0) {
+        return run_watch(argc, argv);
+    }
+    if (argc >= 3 && strcmp(argv[1], "dedup") == 0) {
+        return run_dedup(argc, argv);
+    }
+    if (argc >= 3 && strcmp(argv[1], "similar") == 0) {
+        return run_similar(argc, argv);
+    }
+    if (argc < 4) {
+        usage(argv[0]);
+        return 2;
+    }
+    const char* cmd = argv[1];
+    if (strcmp(cmd, "tree") == 0) {
+        return run_tree(argc, argv);
+    }
+    if (strcmp(cmd, "sample") == 0) {
+        return run_sample(argc, argv);
+    }
+    if (strcmp(cmd, "encode") == 0) {
+        return run_encode(argc, argv);
+    }
+    if (strcmp(cmd, "decode") == 0) {
+        return run_decode(argc, argv);
+    }
+    const char* data_path = argv[2];
+    const char* manifest_path = argv[3];
+
+    sm3_scan_opts_t opts;
+    sm3_scan_opts_default(&opts);
+    const char* sig_path = NULL;
+    int minhash_k = 128;
+    sm3_minhash_t mh;
+    const char* mirror = NULL;
+    double repair_mbps = 0;
+
+    int opt;
+    optind = 4;
+    while ((opt = getopt(argc, argv, "b:t:c:p:m:n:H:K:M:B:")) != -1) {
+        switch (opt) {
+        case 'b': opts.digest_bits = atoi(optarg); break;
+        case 't': opts.num_threads = atoi(optarg); break;
+        case 'c': opts.checkpoint_path = optarg; break;
+        case 'p': opts.checkpoint_pages = strtoull(optarg, NULL, 10); break;
+        case 'm': opts.checkpoint_ms = (uint32_t)atoi(optarg); break;
+        case 'n': opts.max_pages = strtoull(optarg, NULL, 10); break;
+        case 'H': sig_path = optarg; break;
+        case 'K': minhash_k = atoi(optarg); break;
+        case 'M': mirror = optarg; break;
+        case 'B': repair_mbps = atof(optarg); break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (opts.digest_bits != 128 && opts.digest_bits != 256) {
+        fprintf(stderr, "摘要长度必须为128或256\n");
+        return 2;
+    }
+    if (sig_path) {
+        if (sm3_minhash_init(&mh, minhash_k) != 0) {
+            fprintf(stderr, "MinHash 哈希函数个数须为4的倍数且不超过%d\n", SM3_MINHASH_MAX_K);
+            return 2;
+        }
+        opts.minhash = &mh;
+    }
+
+    sm3_scan_stats_t stats;
+    bad_list_t bad = { NULL, 0, 0 };
+    int rc;
+    if (strcmp(cmd, "hash") == 0) {
+        rc = sm3_manifest_build(data_path, manifest_path, &opts, &stats);
+    } else if (strcmp(cmd, "verify") == 0) {
+        rc = sm3_manifest_verify(data_path, manifest_path, &opts, &stats, collect_bad_page, &bad);
+    } else {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (rc < 0) {
+        fprintf(stderr, "%s 失败: %s\n", cmd, strerror(errno));
+        free(bad.pages);
+        return 2;
+    }
+    print_stats(&stats);
+    int left = (int)stats.mismatches;
+    if (mirror && bad.count > 0) {
+        left = repair_from_mirror(mirror, repair_mbps, data_path, manifest_path, &bad);
+    }
+    free(bad.pages);
+    if (left < 0) {
+        return 2;
+    }
+    if (rc == 1) {
+        printf("已达到本次页数上限，进度已保存到检查点 %s\n",
+               opts.checkpoint_path ? opts.checkpoint_path : "(未启用)");
+        return 3;
+    }
+    if (sig_path && strcmp(cmd, "hash") == 0) {
+        if (sm3_minhash_save(&mh, sig_path) != 0) {
+            fprintf(stderr, "写入签名文件 %s 失败: %s\n", sig_path, strerror(errno));
+            return 2;
+        }
+        printf("MinHash 签名: %s (%d 个哈希函数)\n", sig_path, mh.k);
+    }
+    if (strcmp(cmd, "verify") == 0) {
+        if (left > 0) {
+            printf("✗ 校验失败: %llu页不一致\n", (unsigned long long)stats.mismatches);
+            return 1;
+        }
+        printf(stats.mismatches ? "✓ 不一致页已全部修复\n" : "✓ 校验通过\n");
+    }
+    return 0;
+}
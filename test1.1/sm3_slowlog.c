@@ -0,0 +1,295 @@
+/*
+ * 慢请求日志
+ *
+ * 环形缓冲区槽位带序号：记录第 n 条时序号先置为 2n+1，写完条目后以 release
+ * 语义置为 2n+2。读取方只接受序号为 2n+2 且拷贝前后不变的槽位。
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sm3_checkpoint.h"
+#include "sm3_slowlog.h"
+
+typedef struct {
+    atomic_uint_fast64_t seq;
+    sm3_slow_entry_t e;
+} slot_t;
+
+struct sm3_slowlog {
+    uint32_t capacity;
+    int flags;
+    atomic_uint_fast64_t threshold_ns;
+    atomic_uint_fast64_t next;
+    slot_t* slots;
+};
+
+static const char* const op_names[SM3_SLOW_OPS] = { "read", "write", "flush" };
+static const char* const stage_names[SM3_SLOW_STAGES] = { "stall", "io", "verify", "tag" };
+
+static __thread int32_t t_tid;
+
+static _Atomic(sm3_slowlog_t*) g_sig_log;
+static int g_sig_fd = 2;
+
+sm3_slowlog_t* sm3_slowlog_create(uint32_t capacity, uint64_t threshold_ns, int flags) {
+    if (capacity == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    sm3_slowlog_t* log = calloc(1, sizeof(*log));
+    if (!log) {
+        return NULL;
+    }
+    log->slots = calloc(capacity, sizeof(slot_t));
+    if (!log->slots) {
+        free(log);
+        return NULL;
+    }
+    log->capacity = capacity;
+    log->flags = flags;
+    atomic_store(&log->threshold_ns, threshold_ns);
+    return log;
+}
+
+void sm3_slowlog_destroy(sm3_slowlog_t* log) {
+    if (!log) {
+        return;
+    }
+    sm3_slowlog_t* expected = log;
+    atomic_compare_exchange_strong(&g_sig_log, &expected, NULL);
+    free(log->slots);
+    free(log);
+}
+
+void sm3_slowlog_set_threshold(sm3_slowlog_t* log, uint64_t threshold_ns) {
+    atomic_store_explicit(&log->threshold_ns, threshold_ns, memory_order_relaxed);
+}
+
+uint64_t sm3_slowlog_threshold(const sm3_slowlog_t* log) {
+    return atomic_load_explicit(&((sm3_slowlog_t*)log)->threshold_ns, memory_order_relaxed);
+}
+
+static void thread_faults(uint32_t* minflt, uint32_t* majflt) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+        *minflt = (uint32_t)ru.ru_minflt;
+        *majflt = (uint32_t)ru.ru_majflt;
+    } else {
+        *minflt = *majflt = 0;
+    }
+}
+
+uint64_t sm3_slowlog_begin(const sm3_slowlog_t* log, sm3_slow_req_t* req) {
+    req->cpu = sched_getcpu();
+    if (log->flags & SM3_SLOWLOG_FAULTS) {
+        thread_faults(&req->minflt, &req->majflt);
+    }
+    req->start_ns = sm3_now_ns();
+    return req->start_ns;
+}
+
+int sm3_slowlog_end(sm3_slowlog_t* log, const sm3_slow_req_t* req, sm3_slow_entry_t* e) {
+    uint64_t total = sm3_now_ns() - req->start_ns;
+    if (total < sm3_slowlog_threshold(log)) {
+        return 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    e->time_ns = now - total;
+    e->total_ns = total;
+    if (!t_tid) {
+        t_tid = (int32_t)syscall(SYS_gettid);
+    }
+    e->tid = t_tid;
+    e->cpu_start = req->cpu;
+    e->cpu_end = sched_getcpu();
+    e->minor_faults = e->major_faults = 0;
+    if (log->flags & SM3_SLOWLOG_FAULTS) {
+        uint32_t minflt, majflt;
+        thread_faults(&minflt, &majflt);
+        e->minor_faults = minflt - req->minflt;
+        e->major_faults = majflt - req->majflt;
+    }
+    sm3_slowlog_record(log, e);
+    return 1;
+}
+
+void sm3_slowlog_record(sm3_slowlog_t* log, const sm3_slow_entry_t* e) {
+    uint64_t n = atomic_fetch_add_explicit(&log->next, 1, memory_order_relaxed);
+    slot_t* s = &log->slots[n % log->capacity];
+    atomic_store_explicit(&s->seq, 2 * n + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    s->e = *e;
+    atomic_store_explicit(&s->seq, 2 * n + 2, memory_order_release);
+}
+
+uint64_t sm3_slowlog_count(const sm3_slowlog_t* log) {
+    return atomic_load(&((sm3_slowlog_t*)log)->next);
+}
+
+// 读取第 n 条；已被覆盖或正在写入时返回 0
+static int read_slot(const sm3_slowlog_t* log, uint64_t n, sm3_slow_entry_t* out) {
+    slot_t* s = &log->slots[n % log->capacity];
+    uint64_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+    if (seq != 2 * n + 2) {
+        return 0;
+    }
+    *out = s->e;
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&s->seq, memory_order_relaxed) == seq;
+}
+
+size_t sm3_slowlog_snapshot(const sm3_slowlog_t* log, sm3_slow_entry_t* out, size_t max) {
+    uint64_t end = sm3_slowlog_count(log);
+    uint64_t span = max < log->capacity ? max : log->capacity;
+    uint64_t begin = end > span ? end - span : 0;
+    size_t got = 0;
+    for (uint64_t n = begin; n < end; n++) {
+        if (read_slot(log, n, &out[got])) got++;
+    }
+    return got;
+}
+
+// ============================================================================
+// 文本输出（异步信号安全：只用 write 与手写的数字格式化）
+// ============================================================================
+
+typedef struct {
+    char buf[512];
+    size_t len;
+} line_t;
+
+static void put_str(line_t* l, const char* s) {
+    while (*s && l->len < sizeof(l->buf)) l->buf[l->len++] = *s++;
+}
+
+static void put_uint(line_t* l, uint64_t v, int width) {
+    char tmp[24];
+    int n = 0;
+    do {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v || n < width);
+    while (n > 0 && l->len < sizeof(l->buf)) l->buf[l->len++] = tmp[--n];
+}
+
+static void put_int(line_t* l, int64_t v) {
+    if (v < 0) {
+        put_str(l, "-");
+        v = -v;
+    }
+    put_uint(l, (uint64_t)v, 1);
+}
+
+// 纳秒以微秒输出，保留3位小数
+static void put_us(line_t* l, const char* key, uint64_t ns) {
+    put_str(l, key);
+    put_uint(l, ns / 1000, 1);
+    put_str(l, ".");
+    put_uint(l, ns % 1000, 3);
+}
+
+static int write_line(int fd, const line_t* l) {
+    size_t off = 0;
+    while (off < l->len) {
+        ssize_t n = write(fd, l->buf + off, l->len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        off += (size_t)n;
+    }
+    return 0;
+}
+
+int sm3_slowlog_dump(const sm3_slowlog_t* log, int fd) {
+    uint64_t end = sm3_slowlog_count(log);
+    uint64_t begin = end > log->capacity ? end - log->capacity : 0;
+    line_t l;
+    l.len = 0;
+    put_str(&l, "# slowlog: ");
+    put_uint(&l, end, 1);
+    put_str(&l, " recorded, threshold ");
+    put_us(&l, "", sm3_slowlog_threshold(log));
+    put_str(&l, " us\n");
+    if (write_line(fd, &l) != 0) {
+        return -1;
+    }
+    for (uint64_t n = begin; n < end; n++) {
+        sm3_slow_entry_t e;
+        if (!read_slot(log, n, &e)) continue;
+        l.len = 0;
+        put_uint(&l, e.time_ns / 1000000000ull, 1);
+        put_str(&l, ".");
+        put_uint(&l, e.time_ns % 1000000000ull / 1000, 6);
+        put_str(&l, " ");
+        put_str(&l, e.op < SM3_SLOW_OPS ? op_names[e.op] : "?");
+        put_str(&l, " page=");
+        put_uint(&l, e.page, 1);
+        put_str(&l, " pages=");
+        put_uint(&l, e.pages, 1);
+        put_us(&l, " total_us=", e.total_ns);
+        for (int i = 0; i < SM3_SLOW_STAGES; i++) {
+            if (!e.stage_ns[i]) continue;
+            put_str(&l, " ");
+            put_str(&l, stage_names[i]);
+            put_us(&l, "_us=", e.stage_ns[i]);
+        }
+        put_str(&l, " tid=");
+        put_int(&l, e.tid);
+        put_str(&l, " cpu=");
+        put_int(&l, e.cpu_start);
+        if (e.cpu_end != e.cpu_start) {
+            put_str(&l, "->");
+            put_int(&l, e.cpu_end);
+            put_str(&l, " migrated");
+        }
+        if (e.minor_faults || e.major_faults) {
+            put_str(&l, " faults=");
+            put_uint(&l, e.minor_faults, 1);
+            put_str(&l, "/");
+            put_uint(&l, e.major_faults, 1);
+        }
+        if (e.error) {
+            put_str(&l, " errno=");
+            put_int(&l, e.error);
+        }
+        put_str(&l, "\n");
+        if (write_line(fd, &l) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void dump_handler(int signo) {
+    (void)signo;
+    int saved = errno;
+    sm3_slowlog_t* log = atomic_load(&g_sig_log);
+    if (log) {
+        sm3_slowlog_dump(log, g_sig_fd);
+    }
+    errno = saved;
+}
+
+int sm3_slowlog_dump_on_signal(sm3_slowlog_t* log, int signo, int fd) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sa.sa_handler = log ? dump_handler : SIG_DFL;
+    g_sig_fd = fd;
+    atomic_store(&g_sig_log, log);
+    return sigaction(signo, &sa, NULL);
+}
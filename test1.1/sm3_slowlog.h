@@ -0,0 +1,94 @@
+/*
+ * 慢请求日志
+ *
+ * 平均值掩盖偶发的毫秒级长尾。耗时超过阈值的请求记录一条紧凑条目到环形缓冲区：
+ * 开始时刻、页数、各阶段耗时、执行线程、开始/结束时所在 CPU（不同即发生迁移），
+ * 以及可选的缺页次数。缓冲区写满后覆盖最旧的条目。
+ *
+ * 开销：未超过阈值的请求只有调用方的两次时钟读取与一次比较；条目只在慢路径上
+ * 填写。缺页统计需要请求前后各一次 getrusage，默认关闭（SM3_SLOWLOG_FAULTS）。
+ *
+ * 记录可来自多个线程：槽位以原子计数分配，每个槽位带序号（写入期间为奇数），
+ * 读取方跳过正在写入的槽位，记录与导出都不加锁，因此导出也可在信号处理函数中进行。
+ *
+ * 已接入：页存储（sm3_store_opts_t.slowlog）的读、写与刷新请求。
+ */
+
+#ifndef SM3_SLOWLOG_H
+#define SM3_SLOWLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SM3_SLOWLOG_FAULTS  0x1     // 记录请求期间的缺页次数
+
+// 请求类型
+enum {
+    SM3_SLOW_READ = 0,
+    SM3_SLOW_WRITE,
+    SM3_SLOW_FLUSH,
+    SM3_SLOW_OPS
+};
+
+// 阶段（批量内核中折叠与 SM3 压缩逐页交织执行，合并计为 verify / tag）
+enum {
+    SM3_SLOW_STALL = 0,     // 排队：写入等待写回缓冲区刷新（含其中的 tag 与 io）
+    SM3_SLOW_IO,            // 数据页 pread/pwritev
+    SM3_SLOW_VERIFY,        // 读路径标签校验
+    SM3_SLOW_TAG,           // 写回时标签计算
+    SM3_SLOW_STAGES
+};
+
+typedef struct {
+    uint64_t time_ns;       // 请求开始时刻（CLOCK_REALTIME）
+    uint64_t total_ns;
+    uint64_t stage_ns[SM3_SLOW_STAGES];
+    uint64_t page;          // 首页号
+    uint32_t pages;
+    uint32_t op;            // SM3_SLOW_READ 等
+    int32_t error;          // 失败时的 errno，成功为 0
+    int32_t tid;            // 执行请求的线程
+    int32_t cpu_start;      // -1 表示未知
+    int32_t cpu_end;
+    uint32_t minor_faults;  // 仅 SM3_SLOWLOG_FAULTS
+    uint32_t major_faults;
+} sm3_slow_entry_t;
+
+typedef struct sm3_slowlog sm3_slowlog_t;
+
+// 请求开始时的状态（由 sm3_slowlog_begin 填写）
+typedef struct {
+    uint64_t start_ns;
+    int32_t cpu;
+    uint32_t minflt;
+    uint32_t majflt;
+} sm3_slow_req_t;
+
+// capacity：环形缓冲区条目数；threshold_ns：记录阈值
+sm3_slowlog_t* sm3_slowlog_create(uint32_t capacity, uint64_t threshold_ns, int flags);
+void sm3_slowlog_destroy(sm3_slowlog_t* log);
+
+// 运行期间可调整阈值
+void sm3_slowlog_set_threshold(sm3_slowlog_t* log, uint64_t threshold_ns);
+uint64_t sm3_slowlog_threshold(const sm3_slowlog_t* log);
+
+// 请求开始；返回当前时间（CLOCK_MONOTONIC 纳秒）
+uint64_t sm3_slowlog_begin(const sm3_slowlog_t* log, sm3_slow_req_t* req);
+// 请求结束：超过阈值时补全 e 中的时刻、耗时、线程、CPU 与缺页字段并记录，
+// 返回 1；否则返回 0。调用方只需预先填写 op/page/pages/error/stage_ns
+int sm3_slowlog_end(sm3_slowlog_t* log, const sm3_slow_req_t* req, sm3_slow_entry_t* e);
+
+// 直接记录一条完整条目
+void sm3_slowlog_record(sm3_slowlog_t* log, const sm3_slow_entry_t* e);
+
+// 累计记录条数（含已被覆盖的）
+uint64_t sm3_slowlog_count(const sm3_slowlog_t* log);
+// 按时间顺序拷出缓冲区中现存的条目（最多 max 条，取最新的），返回条数
+size_t sm3_slowlog_snapshot(const sm3_slowlog_t* log, sm3_slow_entry_t* out, size_t max);
+
+// 以文本形式（每条一行）写出到 fd；只使用异步信号安全的函数
+int sm3_slowlog_dump(const sm3_slowlog_t* log, int fd);
+// 收到 signo 时把日志写出到 fd（同一进程只绑定一个日志，log 为 NULL 时解除）
+int sm3_slowlog_dump_on_signal(sm3_slowlog_t* log, int signo, int fd);
+
+#endif // SM3_SLOWLOG_H
@@ -0,0 +1,271 @@
+/*
+ * 基准结果的统计比较与基线文件
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sm3_stats.h"
+
+#define EXACT_MAX 20        // 精确分布适用的最大单组样本数
+
+typedef struct {
+    double v;
+    int group;              // 0: a, 1: b
+} ranked_t;
+
+static int cmp_ranked(const void* x, const void* y) {
+    double a = ((const ranked_t*)x)->v, b = ((const ranked_t*)y)->v;
+    return a < b ? -1 : a > b;
+}
+
+static int cmp_double(const void* x, const void* y) {
+    double a = *(const double*)x, b = *(const double*)y;
+    return a < b ? -1 : a > b;
+}
+
+double sm3_median(const double* v, size_t n) {
+    if (n == 0) return 0;
+    double* s = malloc(n * sizeof(double));
+    if (!s) return NAN;
+    memcpy(s, v, n * sizeof(double));
+    qsort(s, n, sizeof(double), cmp_double);
+    double m = n % 2 ? s[n / 2] : (s[n / 2 - 1] + s[n / 2]) / 2;
+    free(s);
+    return m;
+}
+
+// 标准正态上侧分位数：P(Z > z) = alpha
+static double normal_upper(double alpha) {
+    double lo = 0, hi = 10;
+    for (int i = 0; i < 60; i++) {
+        double z = (lo + hi) / 2;
+        if (0.5 * erfc(z / sqrt(2.0)) > alpha) lo = z; else hi = z;
+    }
+    return lo;
+}
+
+// 无结时 U 的精确分布：c(i, j, u) 为 i 个 a、j 个 b 的排列中 U = u 的个数。
+// 考虑最大元素：为 a 时它大于全部 j 个 b，c(i-1, j, u-j)；为 b 时 c(i, j-1, u)
+static double exact_p(size_t na, size_t nb, double u) {
+    size_t umax = na * nb;
+    size_t stride_j = umax + 1, stride_i = (nb + 1) * stride_j;
+    double* c = calloc((na + 1) * stride_i, sizeof(double));
+    if (!c) return NAN;
+    for (size_t i = 0; i <= na; i++) {
+        for (size_t j = 0; j <= nb; j++) {
+            double* cur = c + i * stride_i + j * stride_j;
+            if (i == 0 || j == 0) {
+                cur[0] = 1;
+                continue;
+            }
+            const double* a_top = c + (i - 1) * stride_i + j * stride_j;
+            const double* b_top = c + i * stride_i + (j - 1) * stride_j;
+            for (size_t k = 0; k <= i * j; k++) {
+                cur[k] = b_top[k] + (k >= j ? a_top[k - j] : 0);
+            }
+        }
+    }
+    const double* dist = c + na * stride_i + nb * stride_j;
+    double total = 0, le = 0, ge = 0;
+    for (size_t k = 0; k <= umax; k++) {
+        total += dist[k];
+        if ((double)k <= u) le += dist[k];
+        if ((double)k >= u) ge += dist[k];
+    }
+    free(c);
+    double p = 2 * (le < ge ? le : ge) / total;
+    return p < 1 ? p : 1;
+}
+
+int sm3_mann_whitney(const double* a, size_t na, const double* b, size_t nb,
+                     double confidence, sm3_mwu_t* out) {
+    if (na == 0 || nb == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t n = na + nb, m = na * nb;
+    ranked_t* r = malloc(n * sizeof(ranked_t));
+    double* diff = malloc(m * sizeof(double));
+    if (!r || !diff) {
+        free(r);
+        free(diff);
+        return -1;
+    }
+    for (size_t i = 0; i < na; i++) r[i] = (ranked_t){ a[i], 0 };
+    for (size_t j = 0; j < nb; j++) r[na + j] = (ranked_t){ b[j], 1 };
+    qsort(r, n, sizeof(ranked_t), cmp_ranked);
+
+    // 秩和（相同值取平均秩）与结校正项
+    double rank_a = 0, ties = 0;
+    for (size_t i = 0; i < n;) {
+        size_t j = i;
+        while (j < n && r[j].v == r[i].v) j++;
+        double t = (double)(j - i), avg = (double)(i + j + 1) / 2;
+        for (size_t k = i; k < j; k++) {
+            if (r[k].group == 0) rank_a += avg;
+        }
+        ties += t * t * t - t;
+        i = j;
+    }
+    free(r);
+
+    double dna = (double)na, dnb = (double)nb, dn = (double)n;
+    out->u = rank_a - dna * (dna + 1) / 2;
+    out->exact = ties == 0 && na <= EXACT_MAX && nb <= EXACT_MAX;
+    double mean = dna * dnb / 2;
+    if (out->exact) {
+        out->p = exact_p(na, nb, out->u);
+    } else {
+        double var = dna * dnb / 12 * ((dn + 1) - ties / (dn * (dn - 1)));
+        double dev = fabs(out->u - mean) - 0.5;
+        out->p = var > 0 ? (dev > 0 ? erfc(dev / sqrt(var) / sqrt(2.0)) : 1.0) : 1.0;
+    }
+
+    // Hodges-Lehmann 位移与置信区间
+    for (size_t i = 0; i < na; i++) {
+        for (size_t j = 0; j < nb; j++) diff[i * nb + j] = b[j] - a[i];
+    }
+    qsort(diff, m, sizeof(double), cmp_double);
+    out->shift = m % 2 ? diff[m / 2] : (diff[m / 2 - 1] + diff[m / 2]) / 2;
+    double z = normal_upper((1 - confidence) / 2);
+    double k = floor((double)m / 2 - z * sqrt(dna * dnb * (dn + 1) / 12));
+    size_t ki = k > 0 ? (size_t)k : 0;
+    if (ki > (m - 1) / 2) ki = (m - 1) / 2;
+    out->ci_low = diff[ki];
+    out->ci_high = diff[m - 1 - ki];
+    free(diff);
+    return 0;
+}
+
+// ============================================================================
+// 基线文件
+// ============================================================================
+
+void sm3_baseline_init(sm3_baseline_t* bl) {
+    memset(bl, 0, sizeof(*bl));
+}
+
+void sm3_baseline_free(sm3_baseline_t* bl) {
+    for (size_t i = 0; i < bl->count; i++) free(bl->entries[i].samples);
+    free(bl->entries);
+    memset(bl, 0, sizeof(*bl));
+}
+
+const sm3_baseline_entry_t* sm3_baseline_find(const sm3_baseline_t* bl, const char* name) {
+    for (size_t i = 0; i < bl->count; i++) {
+        if (strcmp(bl->entries[i].name, name) == 0) return &bl->entries[i];
+    }
+    return NULL;
+}
+
+int sm3_baseline_add(sm3_baseline_t* bl, const char* name, const double* samples, size_t count) {
+    size_t len = strlen(name);
+    if (len == 0 || len >= SM3_BASELINE_NAME_MAX || strpbrk(name, " \t\r\n") || count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    double* copy = malloc(count * sizeof(double));
+    if (!copy) {
+        return -1;
+    }
+    memcpy(copy, samples, count * sizeof(double));
+    sm3_baseline_entry_t* e = (sm3_baseline_entry_t*)sm3_baseline_find(bl, name);
+    if (!e) {
+        if (bl->count == bl->cap) {
+            size_t cap = bl->cap ? bl->cap * 2 : 16;
+            sm3_baseline_entry_t* p = realloc(bl->entries, cap * sizeof(*p));
+            if (!p) {
+                free(copy);
+                return -1;
+            }
+            bl->entries = p;
+            bl->cap = cap;
+        }
+        e = &bl->entries[bl->count++];
+        memcpy(e->name, name, len + 1);
+        e->samples = NULL;
+    }
+    free(e->samples);
+    e->samples = copy;
+    e->count = count;
+    return 0;
+}
+
+int sm3_baseline_load(sm3_baseline_t* bl, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    char* line = NULL;
+    size_t cap = 0;
+    double* samples = NULL;
+    int rc = 0;
+    while (rc == 0 && getline(&line, &cap, f) > 0) {
+        char* save = NULL;
+        char* name = strtok_r(line, " \t\r\n", &save);
+        if (!name || name[0] == '#') continue;
+        char* tok = strtok_r(NULL, " \t\r\n", &save);
+        char* end;
+        unsigned long long count = tok ? strtoull(tok, &end, 10) : 0;
+        if (!tok || *end || count == 0 || count > (1u << 20)) {
+            rc = -1;
+            break;
+        }
+        double* p = realloc(samples, count * sizeof(double));
+        if (!p) {
+            rc = -1;
+            break;
+        }
+        samples = p;
+        for (size_t i = 0; rc == 0 && i < count; i++) {
+            tok = strtok_r(NULL, " \t\r\n", &save);
+            if (!tok || (samples[i] = strtod(tok, &end), *end)) rc = -1;
+        }
+        if (rc == 0 && (strtok_r(NULL, " \t\r\n", &save) != NULL ||
+                        sm3_baseline_add(bl, name, samples, count) != 0)) {
+            rc = -1;
+        }
+    }
+    free(line);
+    free(samples);
+    fclose(f);
+    if (rc != 0 && errno != ENOMEM) {
+        errno = EINVAL;
+    }
+    return rc;
+}
+
+int sm3_baseline_save(const sm3_baseline_t* bl, const char* path) {
+    size_t plen = strlen(path);
+    char* tmp = malloc(plen + 5);
+    if (!tmp) {
+        return -1;
+    }
+    memcpy(tmp, path, plen);
+    memcpy(tmp + plen, ".tmp", 5);
+    FILE* f = fopen(tmp, "w");
+    if (!f) {
+        free(tmp);
+        return -1;
+    }
+    fprintf(f, "# sm3 基准基线: <名称> <样本数> <样本...>\n");
+    for (size_t i = 0; i < bl->count; i++) {
+        const sm3_baseline_entry_t* e = &bl->entries[i];
+        fprintf(f, "%s %zu", e->name, e->count);
+        for (size_t k = 0; k < e->count; k++) fprintf(f, " %.17g", e->samples[k]);
+        fputc('\n', f);
+    }
+    int rc = fflush(f) == 0 && fdatasync(fileno(f)) == 0 ? 0 : -1;
+    if (fclose(f) != 0) rc = -1;
+    if (rc == 0 && rename(tmp, path) != 0) rc = -1;
+    if (rc != 0) unlink(tmp);
+    free(tmp);
+    return rc;
+}
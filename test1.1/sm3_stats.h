@@ -0,0 +1,67 @@
+/*
+ * 基准结果的统计比较与基线文件
+ *
+ * 比较新旧两组重复测量样本（如每页耗时）时不假设正态分布，使用
+ * Mann-Whitney U 检验（秩和检验）：
+ *   - 两组都不超过20个样本且无相同值时按精确分布计算 p 值，
+ *     否则用带结校正与连续性校正的正态近似
+ *   - 位移量取 Hodges-Lehmann 估计（所有 b[j] - a[i] 的中位数），
+ *     置信区间取成对差值的对应次序统计量
+ *
+ * 基线文件为文本格式，每行一个测量项：
+ *   <名称> <样本数> <样本1> <样本2> ...
+ * 名称不含空白（如 "mb256/4096页/1线程/random=1,dup=0,seed=1"），
+ * # 开头为注释。保存时以临时文件 + rename 原子替换。
+ */
+
+#ifndef SM3_STATS_H
+#define SM3_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SM3_BASELINE_NAME_MAX 128
+
+typedef struct {
+    double u;               // 样本 a 的 U 统计量
+    double p;               // 双侧 p 值
+    int exact;              // p 值是否按精确分布计算
+    double shift;           // b 相对 a 的位移（Hodges-Lehmann 估计）
+    double ci_low;          // 位移的置信区间
+    double ci_high;
+} sm3_mwu_t;
+
+// 对 a、b 做 Mann-Whitney U 检验，confidence 为位移置信区间的置信度（如 0.95）。
+// 样本数为0或内存不足时返回 -1
+int sm3_mann_whitney(const double* a, size_t na, const double* b, size_t nb,
+                     double confidence, sm3_mwu_t* out);
+
+// 中位数（不修改输入）
+double sm3_median(const double* v, size_t n);
+
+// ============================================================================
+// 基线文件
+// ============================================================================
+
+typedef struct {
+    char name[SM3_BASELINE_NAME_MAX];
+    size_t count;
+    double* samples;
+} sm3_baseline_entry_t;
+
+typedef struct {
+    sm3_baseline_entry_t* entries;
+    size_t count;
+    size_t cap;
+} sm3_baseline_t;
+
+void sm3_baseline_init(sm3_baseline_t* bl);
+void sm3_baseline_free(sm3_baseline_t* bl);
+// 添加测量项，同名项被替换
+int sm3_baseline_add(sm3_baseline_t* bl, const char* name, const double* samples, size_t count);
+const sm3_baseline_entry_t* sm3_baseline_find(const sm3_baseline_t* bl, const char* name);
+// 读取基线文件并合并到 bl；格式错误返回 -1/EINVAL
+int sm3_baseline_load(sm3_baseline_t* bl, const char* path);
+int sm3_baseline_save(const sm3_baseline_t* bl, const char* path);
+
+#endif // SM3_STATS_H
@@ -0,0 +1,1026 @@
+/*
+ * 带完整性标签的页存储
+ *
+ * 内部结构：
+ *   - 写回缓冲区：wb_cap 个页槽 + 页号→槽位哈希表；同一页的重复写入覆盖原槽位
+ *   - 已校验页缓存：cache_cap 个页槽，CLOCK 置换；写入时失效，写回后以新内容填入
+ *   - 内嵌布局下缓存最近访问的一个标签页，连续读写同一区段时只读一次
+ *
+ * 写回顺序：数据页 → 标签 → 超级块/标签文件头（可选 fdatasync）。
+ * 写回过程中崩溃可能留下数据与标签不一致的页，读取时报告为校验失败。
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+#include "sm3_journal.h"
+#include "sm3_manifest.h"
+#include "sm3_slowlog.h"
+#include "sm3_store.h"
+#include "sm3_trace.h"
+
+#define STORE_VERSION   1
+#define NO_SLOT         UINT32_MAX
+#define NO_PAGE         UINT64_MAX
+#define PARALLEL_VERIFY 256     // 一次读取中待校验页数达到此值时经线程池并行校验
+
+// 内嵌布局的超级块（数据文件第0页）
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t digest_size;
+    uint64_t page_count;
+    uint8_t  reserved[40];
+} store_super_t;
+
+// ============================================================================
+// 页号 → 槽位哈希表（线性探测，删除时后移）
+// ============================================================================
+
+typedef struct {
+    uint64_t* keys;             // 页号+1，0 表示空
+    uint32_t* vals;
+    size_t mask;
+} page_map_t;
+
+static int map_init(page_map_t* m, uint32_t entries) {
+    size_t size = 16;
+    while (size < (size_t)entries * 2) size <<= 1;
+    m->keys = calloc(size, sizeof(uint64_t));
+    m->vals = malloc(size * sizeof(uint32_t));
+    m->mask = size - 1;
+    return m->keys && m->vals ? 0 : -1;
+}
+
+static void map_free(page_map_t* m) {
+    free(m->keys);
+    free(m->vals);
+}
+
+static inline size_t map_hash(const page_map_t* m, uint64_t page) {
+    uint64_t h = page * 0x9e3779b97f4a7c15ull;
+    return (size_t)(h ^ (h >> 29)) & m->mask;
+}
+
+static uint32_t map_find(const page_map_t* m, uint64_t page) {
+    for (size_t i = map_hash(m, page); m->keys[i]; i = (i + 1) & m->mask) {
+        if (m->keys[i] == page + 1) {
+            return m->vals[i];
+        }
+    }
+    return NO_SLOT;
+}
+
+static void map_put(page_map_t* m, uint64_t page, uint32_t slot) {
+    size_t i = map_hash(m, page);
+    while (m->keys[i] && m->keys[i] != page + 1) {
+        i = (i + 1) & m->mask;
+    }
+    m->keys[i] = page + 1;
+    m->vals[i] = slot;
+}
+
+static void map_del(page_map_t* m, uint64_t page) {
+    size_t i = map_hash(m, page);
+    while (m->keys[i] != page + 1) {
+        if (!m->keys[i]) return;
+        i = (i + 1) & m->mask;
+    }
+    // 后移删除：把探测链上后续元素搬到空位，保持查找正确
+    for (size_t j = (i + 1) & m->mask; m->keys[j]; j = (j + 1) & m->mask) {
+        size_t home = map_hash(m, m->keys[j] - 1);
+        if (((j - home) & m->mask) >= ((j - i) & m->mask)) {
+            m->keys[i] = m->keys[j];
+            m->vals[i] = m->vals[j];
+            i = j;
+        }
+    }
+    m->keys[i] = 0;
+}
+
+static void map_clear(page_map_t* m) {
+    memset(m->keys, 0, (m->mask + 1) * sizeof(uint64_t));
+}
+
+// ============================================================================
+// 存储对象
+// ============================================================================
+
+// 运行指标
+enum {
+    M_READ_SECONDS, M_WRITE_SECONDS, M_REQUEST_PAGES,
+    M_READ_PAGES, M_WRITE_PAGES, M_READ_BYTES, M_WRITE_BYTES,
+    M_VERIFIED, M_VERIFY_FAILURES, M_CACHE_HITS, M_FLUSHES, M_POOL_BUSY,
+    M_WB_PAGES, M_POOL_THREADS,
+    M_COUNT
+};
+
+static const struct {
+    int type;                   // 0 计数器，1 仪表，2 延迟直方图（记录纳秒、以秒导出），3 直方图
+    const char* name;
+    const char* help;
+} metric_defs[M_COUNT] = {
+    { 2, "sm3_store_read_seconds", "Page store read request latency" },
+    { 2, "sm3_store_write_seconds", "Page store write request latency" },
+    { 3, "sm3_store_request_pages", "Pages per read/write request" },
+    { 0, "sm3_store_read_pages_total", "Pages read" },
+    { 0, "sm3_store_write_pages_total", "Pages written" },
+    { 0, "sm3_store_read_bytes_total", "Bytes read" },
+    { 0, "sm3_store_write_bytes_total", "Bytes written" },
+    { 0, "sm3_store_verified_pages_total", "Pages whose tag was verified on read" },
+    { 0, "sm3_store_verify_failures_total", "Pages that failed tag verification" },
+    { 0, "sm3_store_cache_hits_total", "Reads served from the verified-page cache" },
+    { 0, "sm3_store_flushes_total", "Writeback buffer flushes" },
+    { 0, "sm3_pool_busy_nanoseconds_total", "Thread pool time spent running chunks" },
+    { 1, "sm3_store_writeback_pages", "Pages queued in the writeback buffer" },
+    { 1, "sm3_pool_threads", "Thread pool size" },
+};
+
+struct sm3_store {
+    int fd;
+    int layout;
+    int digest_size;
+    uint32_t per_extent;        // 内嵌布局：每个标签页覆盖的数据页数
+    uint64_t pages;             // 已持久化的逻辑页数
+    uint64_t pending;           // 含写回缓冲区扩展后的逻辑页数
+    sm3_store_opts_t opts;
+    sm3_pool_t* pool;
+    int own_pool;
+    sm3_manifest_t tags;        // SM3_STORE_TAG_FILE
+    sm3_journal_t* journal;     // 标签文件布局启用摘要日志时
+    uint8_t zero_tag[32];       // 全零页的标签（空洞页）
+
+    // 内嵌布局的标签页缓存
+    uint8_t* tag_page;
+    uint64_t tag_extent;
+    int tag_dirty;
+
+    // 写回缓冲区
+    uint8_t* wb_data;
+    uint64_t* wb_page;
+    uint8_t* wb_tags;
+    uint32_t* wb_order;
+    uint32_t wb_count;
+    uint32_t wb_cap;
+    page_map_t wb_map;
+
+    // 已校验页缓存
+    uint8_t* cache_data;
+    uint64_t* cache_page;
+    uint8_t* cache_ref;
+    uint32_t cache_cap;
+    uint32_t cache_hand;
+    page_map_t cache_map;
+
+    // 读路径暂存
+    uint32_t* miss;
+    const uint8_t** vin;
+    const uint8_t** vexp;
+    uint8_t* vtags;
+    uint8_t* vok;
+    uint32_t scratch_cap;
+
+    sm3_store_stats_t stats;
+
+    // 运行指标（opts.metrics 非 NULL 时）
+    int metric[M_COUNT];
+    uint64_t pool_busy_seen;
+};
+
+void sm3_store_opts_default(sm3_store_opts_t* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->layout = SM3_STORE_TAG_FILE;
+    opts->digest_bits = 256;
+    opts->num_threads = 1;
+    opts->cache_pages = 4096;       // 16MB
+    opts->writeback_pages = 1024;   // 4MB
+    opts->commit_interval_us = 2000;
+    opts->compact_bytes = 64ull << 20;
+}
+
+static inline uint64_t data_offset(const sm3_store_t* s, uint64_t page) {
+    if (s->layout == SM3_STORE_TAG_FILE) {
+        return page * SM3_PAGE_SIZE;
+    }
+    uint64_t e = page / s->per_extent;
+    return (1 + e * (s->per_extent + 1) + page % s->per_extent) * SM3_PAGE_SIZE;
+}
+
+static inline uint64_t tag_page_offset(const sm3_store_t* s, uint64_t extent) {
+    return (1 + extent * (s->per_extent + 1) + s->per_extent) * SM3_PAGE_SIZE;
+}
+
+// 两个相邻逻辑页在文件中是否连续
+static inline int phys_adjacent(const sm3_store_t* s, uint64_t page) {
+    return s->layout == SM3_STORE_TAG_FILE || (page + 1) % s->per_extent != 0;
+}
+
+static int pread_full(int fd, void* buf, size_t len, uint64_t off) {
+    size_t got = 0;
+    uint64_t t0 = sm3_trace_clock();
+    while (got < len) {
+        ssize_t n = pread(fd, (uint8_t*)buf + got, len - got, (off_t)(off + got));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break;
+        got += (size_t)n;
+    }
+    sm3_trace_span(SM3_TRACE_IO, "pread", t0, off, len);
+    memset((uint8_t*)buf + got, 0, len - got);    // 超出文件末尾部分为零
+    return 0;
+}
+
+static int pwritev_full(int fd, struct iovec* iov, int cnt, uint64_t off) {
+    uint64_t t0 = sm3_trace_clock(), start = off;
+    while (cnt > 0) {
+        ssize_t n = pwritev(fd, iov, cnt, (off_t)off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        off += (uint64_t)n;
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    sm3_trace_span(SM3_TRACE_IO, "pwritev", t0, start, off - start);
+    return 0;
+}
+
+// ============================================================================
+// 标签读写
+// ============================================================================
+
+static int tag_page_store(sm3_store_t* s) {
+    if (!s->tag_dirty) {
+        return 0;
+    }
+    struct iovec iov = { s->tag_page, SM3_PAGE_SIZE };
+    if (pwritev_full(s->fd, &iov, 1, tag_page_offset(s, s->tag_extent)) != 0) {
+        return -1;
+    }
+    s->tag_dirty = 0;
+    return 0;
+}
+
+static int tag_page_load(sm3_store_t* s, uint64_t extent) {
+    if (s->tag_extent == extent) {
+        return 0;
+    }
+    if (tag_page_store(s) != 0) {
+        return -1;
+    }
+    s->tag_extent = NO_PAGE;
+    if (pread_full(s->fd, s->tag_page, SM3_PAGE_SIZE, tag_page_offset(s, extent)) != 0) {
+        return -1;
+    }
+    s->tag_extent = extent;
+    return 0;
+}
+
+static const uint8_t* get_tag(sm3_store_t* s, uint64_t page) {
+    if (s->layout == SM3_STORE_TAG_FILE) {
+        return sm3_manifest_digest(&s->tags, page);
+    }
+    if (tag_page_load(s, page / s->per_extent) != 0) {
+        return NULL;
+    }
+    return s->tag_page + (page % s->per_extent) * (uint64_t)s->digest_size;
+}
+
+static int set_tag(sm3_store_t* s, uint64_t page, const uint8_t* tag) {
+    if (s->layout == SM3_STORE_TAG_FILE) {
+        memcpy(sm3_manifest_digest(&s->tags, page), tag, (size_t)s->digest_size);
+        return s->journal && sm3_journal_append(s->journal, page, tag) == 0 ? -1 : 0;
+    }
+    if (tag_page_load(s, page / s->per_extent) != 0) {
+        return -1;
+    }
+    memcpy(s->tag_page + (page % s->per_extent) * (uint64_t)s->digest_size, tag,
+           (size_t)s->digest_size);
+    s->tag_dirty = 1;
+    return 0;
+}
+
+static int write_super(sm3_store_t* s) {
+    static uint8_t page[SM3_PAGE_SIZE];
+    store_super_t* sb = (store_super_t*)page;
+    memcpy(sb->magic, SM3_STORE_MAGIC, 8);
+    sb->version = STORE_VERSION;
+    sb->digest_size = (uint32_t)s->digest_size;
+    sb->page_count = s->pages;
+    struct iovec iov = { page, SM3_PAGE_SIZE };
+    return pwritev_full(s->fd, &iov, 1, 0);
+}
+
+// ============================================================================
+// 已校验页缓存
+// ============================================================================
+
+static void cache_invalidate(sm3_store_t* s, uint64_t page) {
+    if (!s->cache_cap) {
+        return;
+    }
+    uint32_t slot = map_find(&s->cache_map, page);
+    if (slot != NO_SLOT) {
+        map_del(&s->cache_map, page);
+        s->cache_page[slot] = NO_PAGE;
+        s->cache_ref[slot] = 0;
+    }
+}
+
+static void cache_insert(sm3_store_t* s, uint64_t page, const uint8_t* data) {
+    if (!s->cache_cap) {
+        return;
+    }
+    uint32_t slot = map_find(&s->cache_map, page);
+    if (slot == NO_SLOT) {
+        // CLOCK：跳过最近被访问过的槽位（清除其访问位）
+        while (s->cache_ref[s->cache_hand]) {
+            s->cache_ref[s->cache_hand] = 0;
+            s->cache_hand = (s->cache_hand + 1) % s->cache_cap;
+        }
+        slot = s->cache_hand;
+        s->cache_hand = (s->cache_hand + 1) % s->cache_cap;
+        if (s->cache_page[slot] != NO_PAGE) {
+            map_del(&s->cache_map, s->cache_page[slot]);
+        }
+        s->cache_page[slot] = page;
+        map_put(&s->cache_map, page, slot);
+    }
+    memcpy(s->cache_data + (size_t)slot * SM3_PAGE_SIZE, data, SM3_PAGE_SIZE);
+    s->cache_ref[slot] = 1;
+}
+
+static const uint8_t* cache_lookup(sm3_store_t* s, uint64_t page) {
+    if (!s->cache_cap) {
+        return NULL;
+    }
+    uint32_t slot = map_find(&s->cache_map, page);
+    if (slot == NO_SLOT) {
+        return NULL;
+    }
+    s->cache_ref[slot] = 1;
+    return s->cache_data + (size_t)slot * SM3_PAGE_SIZE;
+}
+
+// ============================================================================
+// 打开/关闭
+// ============================================================================
+
+static char* tags_path(const char* path) {
+    size_t len = strlen(path) + sizeof(SM3_STORE_TAGS_SUFFIX);
+    char* p = malloc(len);
+    if (p) {
+        snprintf(p, len, "%s%s", path, SM3_STORE_TAGS_SUFFIX);
+    }
+    return p;
+}
+
+static int store_alloc(sm3_store_t* s) {
+    uint32_t wb = s->opts.writeback_pages ? s->opts.writeback_pages : 1;
+    s->wb_cap = wb;
+    s->wb_data = aligned_alloc(SM3_PAGE_SIZE, (size_t)wb * SM3_PAGE_SIZE);
+    s->wb_page = malloc(wb * sizeof(uint64_t));
+    s->wb_tags = malloc((size_t)wb * 32);
+    s->wb_order = malloc(wb * sizeof(uint32_t));
+    s->tag_page = aligned_alloc(SM3_PAGE_SIZE, SM3_PAGE_SIZE);
+    s->tag_extent = NO_PAGE;
+    if (!s->wb_data || !s->wb_page || !s->wb_tags || !s->wb_order || !s->tag_page ||
+        map_init(&s->wb_map, wb) != 0) {
+        return -1;
+    }
+
+    s->cache_cap = s->opts.cache_pages;
+    if (s->cache_cap) {
+        s->cache_data = aligned_alloc(SM3_PAGE_SIZE, (size_t)s->cache_cap * SM3_PAGE_SIZE);
+        s->cache_page = malloc(s->cache_cap * sizeof(uint64_t));
+        s->cache_ref = calloc(s->cache_cap, 1);
+        if (!s->cache_data || !s->cache_page || !s->cache_ref ||
+            map_init(&s->cache_map, s->cache_cap) != 0) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < s->cache_cap; i++) {
+            s->cache_page[i] = NO_PAGE;
+        }
+    }
+    return 0;
+}
+
+// ============================================================================
+// 运行指标
+// ============================================================================
+
+// 采集时把线程池繁忙时间的增量计入计数器（采集回调在指标集的锁内串行调用）
+static void collect_pool(sm3_metrics_t* m, void* ctx) {
+    sm3_store_t* s = ctx;
+    uint64_t busy = sm3_pool_busy_ns(s->pool);
+    sm3_metrics_add(m, s->metric[M_POOL_BUSY], busy - s->pool_busy_seen);
+    s->pool_busy_seen = busy;
+}
+
+static int metrics_open(sm3_store_t* s) {
+    sm3_metrics_t* m = s->opts.metrics;
+    for (int i = 0; i < M_COUNT; i++) {
+        int t = metric_defs[i].type;
+        s->metric[i] = t == 0 ? sm3_metrics_counter(m, metric_defs[i].name, metric_defs[i].help)
+                     : t == 1 ? sm3_metrics_gauge(m, metric_defs[i].name, metric_defs[i].help)
+                     : sm3_metrics_histogram(m, metric_defs[i].name, metric_defs[i].help,
+                                             t == 2 ? 1e-9 : 1.0);
+        if (s->metric[i] < 0) {
+            return -1;
+        }
+    }
+    sm3_metrics_set(m, s->metric[M_POOL_THREADS], sm3_pool_threads(s->pool));
+    s->pool_busy_seen = sm3_pool_busy_ns(s->pool);
+    return sm3_metrics_on_collect(m, collect_pool, s);
+}
+
+// 按请求前后的统计差值更新指标（刷新次数在 store_flush 中计入）
+static void metrics_update(sm3_store_t* s, const sm3_store_stats_t* before, int hist,
+                           uint64_t t0, uint32_t count) {
+    sm3_metrics_t* m = s->opts.metrics;
+    const sm3_store_stats_t* st = &s->stats;
+    sm3_metrics_record(m, s->metric[hist], sm3_now_ns() - t0);
+    sm3_metrics_record(m, s->metric[M_REQUEST_PAGES], count);
+    uint64_t rp = st->read_pages - before->read_pages;
+    uint64_t wp = st->write_pages - before->write_pages;
+    sm3_metrics_add(m, s->metric[M_READ_PAGES], rp);
+    sm3_metrics_add(m, s->metric[M_WRITE_PAGES], wp);
+    sm3_metrics_add(m, s->metric[M_READ_BYTES], rp * SM3_PAGE_SIZE);
+    sm3_metrics_add(m, s->metric[M_WRITE_BYTES], wp * SM3_PAGE_SIZE);
+    sm3_metrics_add(m, s->metric[M_VERIFIED], st->verified_pages - before->verified_pages);
+    sm3_metrics_add(m, s->metric[M_VERIFY_FAILURES], st->verify_failures - before->verify_failures);
+    sm3_metrics_add(m, s->metric[M_CACHE_HITS], st->cache_hits - before->cache_hits);
+    sm3_metrics_set(m, s->metric[M_WB_PAGES], s->wb_count);
+}
+
+// 受观测的请求（运行指标或慢请求日志）：各阶段耗时取请求前后的统计差值
+typedef struct {
+    sm3_store_stats_t before;
+    sm3_slow_req_t slow;
+    uint64_t t0;
+} request_t;
+
+static void request_begin(sm3_store_t* s, request_t* rq) {
+    rq->before = s->stats;
+    rq->t0 = s->opts.slowlog ? sm3_slowlog_begin(s->opts.slowlog, &rq->slow) : sm3_now_ns();
+}
+
+static void request_end(sm3_store_t* s, const request_t* rq, int op, uint64_t page,
+                        uint32_t count, int rc) {
+    int err = rc != 0 ? errno : 0;
+    if (s->opts.metrics && op != SM3_SLOW_FLUSH) {
+        metrics_update(s, &rq->before, op == SM3_SLOW_READ ? M_READ_SECONDS : M_WRITE_SECONDS,
+                       rq->t0, count);
+    }
+    if (s->opts.slowlog) {
+        const sm3_store_stats_t* st = &s->stats;
+        sm3_slow_entry_t e;
+        e.op = (uint32_t)op;
+        e.page = page;
+        e.pages = count;
+        e.error = err;
+        e.stage_ns[SM3_SLOW_STALL] = st->wb_stall_ns - rq->before.wb_stall_ns;
+        e.stage_ns[SM3_SLOW_IO] = st->io_ns - rq->before.io_ns;
+        e.stage_ns[SM3_SLOW_VERIFY] = st->verify_ns - rq->before.verify_ns;
+        e.stage_ns[SM3_SLOW_TAG] = st->tag_ns - rq->before.tag_ns;
+        sm3_slowlog_end(s->opts.slowlog, &rq->slow, &e);
+    }
+    if (rc != 0) {
+        errno = err;
+    }
+}
+
+static void store_free(sm3_store_t* s) {
+    if (s->fd >= 0) close(s->fd);
+    if (s->opts.metrics) sm3_metrics_remove_collect(s->opts.metrics, collect_pool, s);
+    if (s->journal) sm3_journal_close(s->journal);
+    if (s->tags.base) sm3_manifest_close(&s->tags);
+    if (s->own_pool) sm3_pool_destroy(s->pool);
+    free(s->tag_page);
+    free(s->wb_data);
+    free(s->wb_page);
+    free(s->wb_tags);
+    free(s->wb_order);
+    map_free(&s->wb_map);
+    free(s->cache_data);
+    free(s->cache_page);
+    free(s->cache_ref);
+    map_free(&s->cache_map);
+    free(s->miss);
+    free(s->vin);
+    free(s->vexp);
+    free(s->vtags);
+    free(s->vok);
+    free(s);
+}
+
+int sm3_store_open(sm3_store_t** out, const char* path, const sm3_store_opts_t* opts) {
+    *out = NULL;
+    sm3_store_t* s = calloc(1, sizeof(*s));
+    if (!s) {
+        return -1;
+    }
+    s->opts = *opts;
+    s->tags.fd = -1;
+    s->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    char* tpath = tags_path(path);
+    struct stat st;
+    if (s->fd < 0 || !tpath || fstat(s->fd, &st) != 0) {
+        goto fail;
+    }
+
+    if (access(tpath, F_OK) == 0) {
+        s->layout = SM3_STORE_TAG_FILE;
+        if (sm3_manifest_open(&s->tags, tpath, 1) != 0) {
+            goto fail;
+        }
+        s->digest_size = (int)s->tags.hdr->digest_size;
+        s->pages = s->tags.hdr->page_count;
+    } else if (st.st_size > 0) {
+        store_super_t sb;
+        if (pread_full(s->fd, &sb, sizeof(sb), 0) != 0 ||
+            memcmp(sb.magic, SM3_STORE_MAGIC, 8) != 0 || sb.version != STORE_VERSION ||
+            (sb.digest_size != 16 && sb.digest_size != 32)) {
+            errno = EINVAL;     // 既无标签文件也不是内嵌布局
+            goto fail;
+        }
+        s->layout = SM3_STORE_TAG_INLINE;
+        s->digest_size = (int)sb.digest_size;
+        s->pages = sb.page_count;
+    } else {
+        s->layout = opts->layout;
+        s->digest_size = opts->digest_bits == 128 ? 16 : 32;
+        if (s->layout == SM3_STORE_TAG_FILE) {
+            if (sm3_manifest_create(&s->tags, tpath, 0, s->digest_size) != 0) {
+                goto fail;
+            }
+        } else if (write_super(s) != 0) {
+            goto fail;
+        }
+    }
+    s->per_extent = SM3_PAGE_SIZE / (uint32_t)s->digest_size;
+    s->pending = s->pages;
+
+    static const uint8_t zero_page[SM3_PAGE_SIZE];
+    if (s->digest_size == 32) {
+        aes_sm3_integrity_256bit(zero_page, s->zero_tag);
+    } else {
+        aes_sm3_integrity_128bit(zero_page, s->zero_tag);
+    }
+
+    s->pool = opts->pool;
+    if (!s->pool) {
+        s->pool = sm3_pool_create(opts->num_threads);
+        s->own_pool = 1;
+    }
+    if (!s->pool || store_alloc(s) != 0) {
+        goto fail;
+    }
+    // 重放日志中尚未压缩进标签文件的标签（未启用日志但留有日志文件时同样重放）
+    if (s->layout == SM3_STORE_TAG_FILE) {
+        size_t len = strlen(tpath) + sizeof(SM3_JOURNAL_SUFFIX);
+        char* jpath = malloc(len);
+        if (!jpath) {
+            goto fail;
+        }
+        snprintf(jpath, len, "%s%s", tpath, SM3_JOURNAL_SUFFIX);
+        int rc = 0;
+        if (opts->journal || access(jpath, F_OK) == 0) {
+            sm3_journal_opts_t jopts;
+            sm3_journal_opts_default(&jopts);
+            jopts.commit_interval_us = opts->commit_interval_us;
+            jopts.max_batch = s->wb_cap + 1;
+            jopts.pool = s->pool;
+            rc = sm3_journal_open(&s->journal, jpath, &s->tags, &jopts);
+        }
+        free(jpath);
+        if (rc != 0) {
+            goto fail;
+        }
+        s->pages = s->pending = s->tags.hdr->page_count;
+    }
+    if (opts->metrics && metrics_open(s) != 0) {
+        goto fail;
+    }
+    free(tpath);
+    *out = s;
+    return 0;
+
+fail:
+    {
+        int err = errno ? errno : ENOMEM;
+        free(tpath);
+        store_free(s);
+        errno = err;
+    }
+    return -1;
+}
+
+int sm3_store_close(sm3_store_t* s) {
+    int rc = sm3_store_flush(s);
+    if (s->journal) {
+        if (sm3_journal_compact(s->journal) != 0) rc = -1;
+    } else if (s->tags.base && sm3_manifest_sync(&s->tags) != 0) {
+        rc = -1;
+    }
+    store_free(s);
+    return rc;
+}
+
+uint64_t sm3_store_pages(const sm3_store_t* s) {
+    return s->pending;
+}
+
+int sm3_store_digest_bits(const sm3_store_t* s) {
+    return s->digest_size * 8;
+}
+
+const sm3_store_stats_t* sm3_store_stats(const sm3_store_t* s) {
+    return &s->stats;
+}
+
+// ============================================================================
+// 写入与写回
+// ============================================================================
+
+static int store_flush(sm3_store_t* s);
+
+static int store_write(sm3_store_t* s, uint64_t page, uint32_t count, const void* buf) {
+    if (page + count < page) {
+        errno = EINVAL;
+        return -1;
+    }
+    s->stats.writes++;
+    s->stats.write_pages += count;
+    const uint8_t* src = buf;
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t p = page + i;
+        uint32_t slot = map_find(&s->wb_map, p);
+        if (slot == NO_SLOT) {
+            if (s->wb_count == s->wb_cap) {
+                uint64_t t0 = sm3_now_ns();
+                int rc = store_flush(s);
+                s->stats.wb_stall_ns += sm3_now_ns() - t0;
+                if (rc != 0) {
+                    return -1;
+                }
+            }
+            slot = s->wb_count++;
+            s->wb_page[slot] = p;
+            map_put(&s->wb_map, p, slot);
+        }
+        memcpy(s->wb_data + (size_t)slot * SM3_PAGE_SIZE, src + (size_t)i * SM3_PAGE_SIZE,
+               SM3_PAGE_SIZE);
+        cache_invalidate(s, p);
+        if (p >= s->pending) {
+            s->pending = p + 1;
+        }
+    }
+    return 0;
+}
+
+int sm3_store_write(sm3_store_t* s, uint64_t page, uint32_t count, const void* buf) {
+    if (!s->opts.metrics && !s->opts.slowlog) {
+        return store_write(s, page, count, buf);
+    }
+    request_t rq;
+    request_begin(s, &rq);
+    int rc = store_write(s, page, count, buf);
+    request_end(s, &rq, SM3_SLOW_WRITE, page, count, rc);
+    return rc;
+}
+
+static int cmp_slot(const void* a, const void* b, void* ctx) {
+    const uint64_t* pages = ctx;
+    uint64_t x = pages[*(const uint32_t*)a];
+    uint64_t y = pages[*(const uint32_t*)b];
+    return x < y ? -1 : x > y;
+}
+
+// 按页号顺序写出数据，物理连续的页合并为一次 pwritev
+static int write_data(sm3_store_t* s) {
+    enum { MAX_IOV = 1024 };
+    struct iovec iov[MAX_IOV];
+    int cnt = 0;
+    uint64_t run_off = 0, prev = 0;
+    for (uint32_t i = 0; i < s->wb_count; i++) {
+        uint32_t slot = s->wb_order[i];
+        uint64_t p = s->wb_page[slot];
+        if (cnt > 0 && (cnt == MAX_IOV || p != prev + 1 || !phys_adjacent(s, prev))) {
+            if (pwritev_full(s->fd, iov, cnt, run_off) != 0) {
+                return -1;
+            }
+            cnt = 0;
+        }
+        if (cnt == 0) {
+            run_off = data_offset(s, p);
+        }
+        iov[cnt].iov_base = s->wb_data + (size_t)slot * SM3_PAGE_SIZE;
+        iov[cnt].iov_len = SM3_PAGE_SIZE;
+        cnt++;
+        prev = p;
+    }
+    return cnt > 0 ? pwritev_full(s->fd, iov, cnt, run_off) : 0;
+}
+
+static int store_flush(sm3_store_t* s) {
+    if (s->wb_count == 0) {
+        return 0;
+    }
+    uint64_t t0 = sm3_now_ns();
+    sm3_pool_hash_pages(s->pool, s->wb_data, s->wb_count, s->wb_tags, s->digest_size);
+    s->stats.tag_ns += sm3_now_ns() - t0;
+
+    for (uint32_t i = 0; i < s->wb_count; i++) {
+        s->wb_order[i] = i;
+    }
+    qsort_r(s->wb_order, s->wb_count, sizeof(uint32_t), cmp_slot, s->wb_page);
+
+    t0 = sm3_now_ns();
+    int rc = write_data(s);
+    s->stats.io_ns += sm3_now_ns() - t0;
+    if (rc != 0) {
+        return -1;
+    }
+
+    // 标签：扩展部分先填空洞页标签，再写入本批各页标签
+    if (s->layout == SM3_STORE_TAG_FILE && s->pending != s->pages &&
+        sm3_manifest_resize(&s->tags, s->pending * SM3_PAGE_SIZE) != 0) {
+        return -1;
+    }
+    for (uint64_t p = s->pages; p < s->pending; p++) {
+        if (map_find(&s->wb_map, p) == NO_SLOT && set_tag(s, p, s->zero_tag) != 0) {
+            return -1;
+        }
+    }
+    for (uint32_t i = 0; i < s->wb_count; i++) {
+        uint32_t slot = s->wb_order[i];
+        if (set_tag(s, s->wb_page[slot], s->wb_tags + (size_t)slot * s->digest_size) != 0) {
+            return -1;
+        }
+    }
+    if (tag_page_store(s) != 0) {
+        return -1;
+    }
+
+    s->pages = s->pending;
+    if (s->layout == SM3_STORE_TAG_INLINE && write_super(s) != 0) {
+        return -1;
+    }
+    if (s->opts.sync) {
+        if (fdatasync(s->fd) != 0) {
+            return -1;
+        }
+        if (s->journal ? sm3_journal_sync(s->journal) != 0
+                       : s->tags.base && sm3_manifest_sync(&s->tags) != 0) {
+            return -1;
+        }
+    }
+    if (s->journal) {
+        sm3_journal_stats_t js;
+        sm3_journal_stats(s->journal, &js);
+        if (s->opts.compact_bytes && js.journal_bytes > s->opts.compact_bytes) {
+            if (sm3_journal_compact(s->journal) != 0) {
+                return -1;
+            }
+            js.compactions++;
+        }
+        s->stats.journal_commits = js.commits;
+        s->stats.journal_compactions = js.compactions;
+    }
+
+    // 刚写出的页内容已知正确，直接进入已校验缓存
+    for (uint32_t i = 0; i < s->wb_count; i++) {
+        cache_insert(s, s->wb_page[i], s->wb_data + (size_t)i * SM3_PAGE_SIZE);
+    }
+    s->stats.flushes++;
+    s->stats.tagged_pages += s->wb_count;
+    s->wb_count = 0;
+    map_clear(&s->wb_map);
+    if (s->opts.metrics) {
+        sm3_metrics_add(s->opts.metrics, s->metric[M_FLUSHES], 1);
+        sm3_metrics_set(s->opts.metrics, s->metric[M_WB_PAGES], 0);
+    }
+    return 0;
+}
+
+int sm3_store_flush(sm3_store_t* s) {
+    if (!s->opts.slowlog || s->wb_count == 0) {
+        return store_flush(s);
+    }
+    request_t rq;
+    request_begin(s, &rq);
+    uint32_t count = s->wb_count;
+    int rc = store_flush(s);
+    request_end(s, &rq, SM3_SLOW_FLUSH, 0, count, rc);
+    return rc;
+}
+
+// ============================================================================
+// 读取与校验
+// ============================================================================
+
+static int ensure_scratch(sm3_store_t* s, uint32_t count) {
+    if (count <= s->scratch_cap) {
+        return 0;
+    }
+    free(s->miss);
+    free(s->vin);
+    free(s->vexp);
+    free(s->vtags);
+    free(s->vok);
+    s->miss = malloc(count * sizeof(uint32_t));
+    s->vin = malloc(count * sizeof(uint8_t*));
+    s->vexp = malloc(count * sizeof(uint8_t*));
+    s->vtags = malloc((size_t)count * 32);
+    s->vok = malloc(count);
+    if (!s->miss || !s->vin || !s->vexp || !s->vtags || !s->vok) {
+        s->scratch_cap = 0;
+        return -1;
+    }
+    s->scratch_cap = count;
+    return 0;
+}
+
+typedef struct {
+    sm3_store_t* s;
+    int bits;
+} verify_job_t;
+
+static void verify_chunk(void* ctx, size_t begin, size_t end) {
+    verify_job_t* job = ctx;
+    sm3_store_t* s = job->s;
+    aes_sm3_integrity_verify_mb(s->vin + begin, s->vexp + begin, s->vok + begin,
+                                (int)(end - begin), job->bits);
+}
+
+static const uint8_t* repair_tag(void* ctx, uint64_t page) {
+    return get_tag(ctx, page);
+}
+
+static uint64_t repair_offset(void* ctx, uint64_t page) {
+    return data_offset(ctx, page);
+}
+
+// 从镜像修复本次读取中校验失败的页，修复后的内容写入 out。全部修复返回0
+static int repair_bad(sm3_store_t* s, uint64_t page, uint32_t nmiss, uint8_t* out) {
+    uint64_t* pages = malloc(nmiss * sizeof(uint64_t));
+    uint8_t** bufs = malloc(nmiss * sizeof(uint8_t*));
+    uint8_t* ok = malloc(nmiss);
+    uint32_t n = 0;
+    int rc = -1;
+    if (pages && bufs && ok) {
+        for (uint32_t k = 0; k < nmiss; k++) {
+            if (s->vok[k]) continue;
+            pages[n] = page + s->miss[k];
+            bufs[n++] = out + (size_t)s->miss[k] * SM3_PAGE_SIZE;
+        }
+        sm3_repair_target_t t = {
+            .fd = s->fd,
+            .size = s->pages * SM3_PAGE_SIZE,
+            .digest_bits = s->digest_size * 8,
+            .expected = repair_tag,
+            .offset = repair_offset,
+            .ctx = s,
+        };
+        rc = sm3_repair_pages(s->opts.repair, &t, pages, n, ok, bufs);
+        for (uint32_t k = 0; rc >= 0 && k < n; k++) {
+            if (!ok[k]) continue;
+            s->stats.repaired_pages++;
+            cache_insert(s, pages[k], bufs[k]);
+        }
+    }
+    free(pages);
+    free(bufs);
+    free(ok);
+    return rc == 0 ? 0 : -1;
+}
+
+static int store_read(sm3_store_t* s, uint64_t page, uint32_t count, void* buf) {
+    if (page + count < page || page + count > s->pending) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (ensure_scratch(s, count) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    s->stats.reads++;
+    s->stats.read_pages += count;
+
+    // 先从写回缓冲区、已校验缓存和空洞中取，其余记为待读
+    uint8_t* out = buf;
+    uint32_t nmiss = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t p = page + i;
+        uint8_t* dst = out + (size_t)i * SM3_PAGE_SIZE;
+        uint32_t slot = map_find(&s->wb_map, p);
+        const uint8_t* cached;
+        if (slot != NO_SLOT) {
+            memcpy(dst, s->wb_data + (size_t)slot * SM3_PAGE_SIZE, SM3_PAGE_SIZE);
+            s->stats.wb_hits++;
+        } else if (p >= s->pages) {
+            memset(dst, 0, SM3_PAGE_SIZE);      // 扩展中尚未写回的空洞页
+        } else if ((cached = cache_lookup(s, p)) != NULL) {
+            memcpy(dst, cached, SM3_PAGE_SIZE);
+            s->stats.cache_hits++;
+        } else {
+            s->miss[nmiss++] = i;
+        }
+    }
+    if (nmiss == 0) {
+        return 0;
+    }
+
+    // 物理连续的待读页合并读取
+    uint64_t t_io = sm3_now_ns();
+    for (uint32_t a = 0; a < nmiss; ) {
+        uint32_t b = a + 1;
+        while (b < nmiss && s->miss[b] == s->miss[b - 1] + 1 &&
+               phys_adjacent(s, page + s->miss[b - 1])) {
+            b++;
+        }
+        uint64_t p = page + s->miss[a];
+        if (pread_full(s->fd, out + (size_t)s->miss[a] * SM3_PAGE_SIZE,
+                       (size_t)(b - a) * SM3_PAGE_SIZE, data_offset(s, p)) != 0) {
+            return -1;
+        }
+        a = b;
+    }
+    s->stats.io_ns += sm3_now_ns() - t_io;
+
+    // 收集标签（内嵌布局的标签页缓存会被替换，先拷出）
+    uint64_t t0 = sm3_now_ns();
+    for (uint32_t k = 0; k < nmiss; k++) {
+        uint64_t p = page + s->miss[k];
+        const uint8_t* tag = get_tag(s, p);
+        if (!tag) {
+            return -1;
+        }
+        if (s->layout == SM3_STORE_TAG_INLINE) {
+            memcpy(s->vtags + (size_t)k * s->digest_size, tag, (size_t)s->digest_size);
+            tag = s->vtags + (size_t)k * s->digest_size;
+        }
+        s->vin[k] = out + (size_t)s->miss[k] * SM3_PAGE_SIZE;
+        s->vexp[k] = tag;
+    }
+    verify_job_t job = { s, s->digest_size * 8 };
+    if (nmiss >= PARALLEL_VERIFY) {
+        sm3_pool_run(s->pool, verify_chunk, &job, nmiss, 64);
+    } else {
+        verify_chunk(&job, 0, nmiss);
+    }
+    s->stats.verify_ns += sm3_now_ns() - t0;
+    s->stats.verified_pages += nmiss;
+
+    int bad = 0;
+    for (uint32_t k = 0; k < nmiss; k++) {
+        uint64_t p = page + s->miss[k];
+        if (!s->vok[k]) {
+            bad++;
+            s->stats.verify_failures++;
+            if (s->opts.on_bad) s->opts.on_bad(p, s->opts.bad_ctx);
+        } else {
+            cache_insert(s, p, s->vin[k]);
+        }
+    }
+    if (bad && s->opts.repair && repair_bad(s, page, nmiss, out) == 0) {
+        return 0;
+    }
+    if (bad) {
+        errno = EBADMSG;
+        return -1;
+    }
+    return 0;
+}
+
+int sm3_store_read(sm3_store_t* s, uint64_t page, uint32_t count, void* buf) {
+    if (!s->opts.metrics && !s->opts.slowlog) {
+        return store_read(s, page, count, buf);
+    }
+    request_t rq;
+    request_begin(s, &rq);
+    int rc = store_read(s, page, count, buf);
+    request_end(s, &rq, SM3_SLOW_READ, page, count, rc);
+    return rc;
+}
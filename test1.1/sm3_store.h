@@ -0,0 +1,112 @@
+/*
+ * 带完整性标签的页存储
+ *
+ * 在一个文件上提供按4KB页读写的接口：写入时为每页计算标签（页摘要），
+ * 读取时校验标签，不一致的页返回 EBADMSG。
+ *
+ * 标签布局：
+ *   SM3_STORE_TAG_FILE    标签存于独立的标签文件 "<路径>.tags"（清单格式，mmap），
+ *                         数据文件中只有数据页，与普通文件逐页对应
+ *   SM3_STORE_TAG_INLINE  数据文件首页为超级块，之后每 N 个数据页跟随一个标签页
+ *                         （N = 4096 / 标签长度），标签与数据同文件、同一次同步
+ *
+ * 写入先进入写回缓冲区，缓冲区满或调用 sm3_store_flush 时，经线程池批量
+ * 计算标签，按页号排序合并写出数据页，再写出标签。
+ * 读取时未命中缓存的页批量校验（aes_sm3_integrity_verify_mb，页数多时经
+ * 线程池并行），校验通过的页进入已校验页缓存（CLOCK置换），之后再读
+ * 直接从内存返回，直到该页被改写。
+ *
+ * 标签文件布局可启用摘要日志：标签更新追加到 "<路径>.tags.jnl" 并成批提交，
+ * sync 时只需一次日志 fdatasync，标签文件在日志压缩时才同步。
+ *
+ * 指定 metrics 时记录读写请求延迟与批大小直方图、页数/字节数/校验失败计数、
+ * 写回队列深度与线程池繁忙时间，多个存储可共用一个指标集（计数累加）。
+ * 指定 slowlog 时耗时超过阈值的请求连同阶段耗时（排队、I/O、校验、打标签）
+ * 记入慢请求日志。
+ *
+ * 指定 repair 时，读取中校验失败的页从镜像取回、按标签校验后原地写回，
+ * 读取照常成功（on_bad 仍会被调用）；镜像须按逻辑页排列（第 i 页位于
+ * 偏移 i*4096），如标签文件布局存储的数据文件副本。
+ *
+ * 存储对象本身不是线程安全的，多线程访问需由调用方串行化。
+ */
+
+#ifndef SM3_STORE_H
+#define SM3_STORE_H
+
+#include <stdint.h>
+
+#include "sm3_metrics.h"
+#include "sm3_pool.h"
+#include "sm3_repair.h"
+#include "sm3_slowlog.h"
+
+#define SM3_STORE_TAG_FILE      0
+#define SM3_STORE_TAG_INLINE    1
+
+#define SM3_STORE_MAGIC         "SM3STOR1"
+#define SM3_STORE_TAGS_SUFFIX   ".tags"
+
+typedef struct sm3_store sm3_store_t;
+
+// 读取时发现标签不一致的页
+typedef void (*sm3_store_bad_fn)(uint64_t page, void* ctx);
+
+typedef struct {
+    int layout;                 // SM3_STORE_TAG_FILE / SM3_STORE_TAG_INLINE
+    int digest_bits;            // 128 或 256（新建时使用）
+    sm3_pool_t* pool;           // 共享线程池；NULL 时按 num_threads 自建
+    int num_threads;
+    uint32_t cache_pages;       // 已校验页缓存容量（0关闭）
+    uint32_t writeback_pages;   // 写回缓冲区容量（页）
+    int sync;                   // flush 时 fdatasync 数据与标签
+    int journal;                // 标签文件布局：标签更新经摘要日志持久（见 sm3_journal.h），
+                                // 不再同步整个标签文件
+    uint32_t commit_interval_us;    // 摘要日志提交间隔
+    uint64_t compact_bytes;     // 摘要日志超过此大小时压缩进标签文件
+    sm3_store_bad_fn on_bad;
+    void* bad_ctx;
+    sm3_metrics_t* metrics;     // 非 NULL 时登记并更新 sm3_store_* 运行指标（见 sm3_metrics.h）
+    sm3_slowlog_t* slowlog;     // 非 NULL 时记录超过阈值的读/写/刷新请求（见 sm3_slowlog.h）
+    sm3_repair_t* repair;       // 非 NULL 时从镜像修复校验失败的页（见 sm3_repair.h）
+} sm3_store_opts_t;
+
+typedef struct {
+    uint64_t reads;
+    uint64_t read_pages;
+    uint64_t wb_hits;           // 读命中写回缓冲区
+    uint64_t cache_hits;        // 读命中已校验页缓存（跳过校验）
+    uint64_t verified_pages;
+    uint64_t verify_failures;
+    uint64_t writes;
+    uint64_t write_pages;
+    uint64_t flushes;
+    uint64_t tagged_pages;
+    uint64_t verify_ns;         // 读路径中标签校验耗时
+    uint64_t tag_ns;            // 写回时标签计算耗时
+    uint64_t io_ns;             // 数据页读写（pread/pwritev）耗时
+    uint64_t wb_stall_ns;       // 写入因写回缓冲区满而等待刷新的耗时
+    uint64_t journal_commits;   // 摘要日志提交次数（fdatasync 次数）
+    uint64_t journal_compactions;
+    uint64_t repaired_pages;    // 从镜像修复的页数
+} sm3_store_stats_t;
+
+void sm3_store_opts_default(sm3_store_opts_t* opts);
+
+// 打开或新建存储。已有存储的布局与标签长度以文件为准
+int sm3_store_open(sm3_store_t** out, const char* path, const sm3_store_opts_t* opts);
+// 刷新写回缓冲区并关闭
+int sm3_store_close(sm3_store_t* s);
+
+uint64_t sm3_store_pages(const sm3_store_t* s);
+int sm3_store_digest_bits(const sm3_store_t* s);
+const sm3_store_stats_t* sm3_store_stats(const sm3_store_t* s);
+
+// 读取 [page, page+count)；超出存储末尾返回 -1/EINVAL，
+// 有页校验失败（且未能从镜像修复）时返回 -1/EBADMSG（其余页仍写入 buf）
+int sm3_store_read(sm3_store_t* s, uint64_t page, uint32_t count, void* buf);
+// 写入 [page, page+count)，可越过末尾扩展存储（中间未写的页为全零页）
+int sm3_store_write(sm3_store_t* s, uint64_t page, uint32_t count, const void* buf);
+int sm3_store_flush(sm3_store_t* s);
+
+#endif // SM3_STORE_H
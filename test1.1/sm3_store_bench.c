@@ -0,0 +1,370 @@
+/*
+ * sm3_store_bench - 页存储应用级性能测试
+ *
+ * 在同一份数据、同一随机访问序列上分别运行：
+ *   1. 基准：普通文件 pread/pwrite（无完整性保护）
+ *   2. 页存储：sm3_store_read/write（写入打标签、读取校验）
+ * 报告两者的单次操作延迟（平均/P50/P99）、吞吐量，以及页存储带来的额外开销。
+ * 页存储的写回刷新耗时计入总时间。
+ *
+ * 用法:
+ *   sm3_store_bench [-s 数据MB] [-n 操作数] [-r 读比例%] [-b 每次页数] [-c 缓存页]
+ *                   [-w 写回页] [-t 线程] [-l file|inline] [-z 热点比例%] [-d 目录]
+ *                   [-y] [-j] [-T 追踪文件] [-E 抽样间隔] [-M] [-P 端口] [-L 阈值us]
+ *   -y  每次写回刷新都 fdatasync 数据与标签
+ *   -j  标签经摘要日志持久（仅 file 布局）
+ *   -T  页存储运行期间记录时间线，输出 Chrome trace-event JSON（见 sm3_trace.h）
+ *   -E  线程池每 N 个作业记录一个
+ *   -M  运行结束后输出页存储运行指标（Prometheus 文本，见 sm3_metrics.h）
+ *   -P  运行期间在 127.0.0.1:端口 提供 GET /metrics（0 自动选择端口）
+ *   -L  记录耗时超过阈值的页存储请求（含缺页统计），运行结束后输出；
+ *       运行期间 kill -USR1 可随时输出到标准错误（见 sm3_slowlog.h）
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sm3_checkpoint.h"
+#include "sm3_journal.h"
+#include "sm3_manifest.h"
+#include "sm3_metrics.h"
+#include "sm3_slowlog.h"
+#include "sm3_store.h"
+#include "sm3_trace.h"
+
+typedef struct {
+    uint64_t data_mb;
+    uint64_t ops;
+    int read_pct;
+    uint32_t batch;
+    int hot_pct;                // 90%访问集中在前 hot_pct% 的页上（0为均匀）
+    const char* dir;
+} bench_cfg_t;
+
+typedef struct {
+    uint64_t page;
+    int is_read;
+} bench_op_t;
+
+typedef struct {
+    uint64_t* read_ns;
+    uint64_t* write_ns;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t total_ns;
+} bench_result_t;
+
+static uint64_t rng_next(uint64_t* x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+static bench_op_t* make_ops(const bench_cfg_t* cfg, uint64_t pages) {
+    bench_op_t* ops = malloc(cfg->ops * sizeof(bench_op_t));
+    uint64_t rng = 0x2545f4914f6cdd1dull;
+    uint64_t span = pages - cfg->batch + 1;
+    uint64_t hot = cfg->hot_pct ? span * (uint64_t)cfg->hot_pct / 100 : 0;
+    for (uint64_t i = 0; ops && i < cfg->ops; i++) {
+        ops[i].is_read = (int)(rng_next(&rng) % 100) < cfg->read_pct;
+        if (hot && rng_next(&rng) % 10 != 0) {
+            ops[i].page = rng_next(&rng) % hot;
+        } else {
+            ops[i].page = rng_next(&rng) % span;
+        }
+    }
+    return ops;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_latency(const char* name, uint64_t* ns, uint64_t n) {
+    if (n == 0) {
+        printf("  %-6s -\n", name);
+        return;
+    }
+    qsort(ns, n, sizeof(uint64_t), cmp_u64);
+    double sum = 0;
+    for (uint64_t i = 0; i < n; i++) sum += (double)ns[i];
+    printf("  %-6s 平均 %8.2f us, P50 %8.2f us, P99 %8.2f us (%llu次)\n", name,
+           sum / (double)n / 1000, ns[n / 2] / 1000.0, ns[n * 99 / 100] / 1000.0,
+           (unsigned long long)n);
+}
+
+static double avg_us(const uint64_t* ns, uint64_t n) {
+    double sum = 0;
+    for (uint64_t i = 0; i < n; i++) sum += (double)ns[i];
+    return n ? sum / (double)n / 1000 : 0;
+}
+
+static int run_raw(const bench_cfg_t* cfg, const char* path, const bench_op_t* ops,
+                   uint8_t* buf, bench_result_t* r) {
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    size_t len = (size_t)cfg->batch * SM3_PAGE_SIZE;
+    uint64_t t_start = sm3_now_ns();
+    for (uint64_t i = 0; i < cfg->ops; i++) {
+        off_t off = (off_t)(ops[i].page * SM3_PAGE_SIZE);
+        uint64_t t0 = sm3_now_ns();
+        ssize_t n = ops[i].is_read ? pread(fd, buf, len, off) : pwrite(fd, buf, len, off);
+        uint64_t dt = sm3_now_ns() - t0;
+        if (n != (ssize_t)len) {
+            close(fd);
+            return -1;
+        }
+        if (ops[i].is_read) r->read_ns[r->reads++] = dt; else r->write_ns[r->writes++] = dt;
+    }
+    r->total_ns = sm3_now_ns() - t_start;
+    close(fd);
+    return 0;
+}
+
+static int run_store(const bench_cfg_t* cfg, sm3_store_t* st, const bench_op_t* ops,
+                     uint8_t* buf, bench_result_t* r) {
+    uint64_t t_start = sm3_now_ns();
+    for (uint64_t i = 0; i < cfg->ops; i++) {
+        uint64_t t0 = sm3_now_ns();
+        int rc = ops[i].is_read ? sm3_store_read(st, ops[i].page, cfg->batch, buf)
+                                : sm3_store_write(st, ops[i].page, cfg->batch, buf);
+        uint64_t dt = sm3_now_ns() - t0;
+        if (rc != 0) {
+            return -1;
+        }
+        if (ops[i].is_read) r->read_ns[r->reads++] = dt; else r->write_ns[r->writes++] = dt;
+    }
+    if (sm3_store_flush(st) != 0) {
+        return -1;
+    }
+    r->total_ns = sm3_now_ns() - t_start;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    bench_cfg_t cfg = { 256, 200000, 90, 1, 0, "/tmp" };
+    sm3_store_opts_t opts;
+    sm3_store_opts_default(&opts);
+    const char* trace_path = NULL;
+    sm3_trace_opts_t topts = { 0, 1 };
+    int dump_metrics = 0;
+    int metrics_port = -1;
+    long slow_us = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:r:b:c:w:t:l:z:d:yjT:E:MP:L:")) != -1) {
+        switch (opt) {
+        case 's': cfg.data_mb = strtoull(optarg, NULL, 10); break;
+        case 'n': cfg.ops = strtoull(optarg, NULL, 10); break;
+        case 'r': cfg.read_pct = atoi(optarg); break;
+        case 'b': cfg.batch = (uint32_t)atoi(optarg); break;
+        case 'c': opts.cache_pages = (uint32_t)atoi(optarg); break;
+        case 'w': opts.writeback_pages = (uint32_t)atoi(optarg); break;
+        case 't': opts.num_threads = atoi(optarg); break;
+        case 'l': opts.layout = strcmp(optarg, "inline") == 0 ? SM3_STORE_TAG_INLINE
+                                                              : SM3_STORE_TAG_FILE; break;
+        case 'z': cfg.hot_pct = atoi(optarg); break;
+        case 'd': cfg.dir = optarg; break;
+        case 'y': opts.sync = 1; break;
+        case 'j': opts.journal = 1; break;
+        case 'T': trace_path = optarg; break;
+        case 'E': topts.sample_every = (uint32_t)atoi(optarg); break;
+        case 'M': dump_metrics = 1; break;
+        case 'P': metrics_port = atoi(optarg); break;
+        case 'L': slow_us = atol(optarg); break;
+        default:
+            fprintf(stderr, "用法: %s [-s MB] [-n 操作数] [-r 读%%] [-b 页/次] [-c 缓存页] "
+                            "[-w 写回页] [-t 线程] [-l file|inline] [-z 热点%%] [-d 目录] [-y] [-j] "
+                            "[-T 追踪文件] [-E 抽样间隔] [-M] [-P 端口] [-L 阈值us]\n", argv[0]);
+            return 2;
+        }
+    }
+    uint64_t pages = cfg.data_mb * 256;
+    if (cfg.batch == 0 || pages < cfg.batch || cfg.ops == 0) {
+        fprintf(stderr, "参数无效\n");
+        return 2;
+    }
+
+    char raw_path[512], store_path[512], tags[600], journal[640];
+    snprintf(raw_path, sizeof(raw_path), "%s/sm3_bench_raw.%d", cfg.dir, getpid());
+    snprintf(store_path, sizeof(store_path), "%s/sm3_bench_store.%d", cfg.dir, getpid());
+    snprintf(tags, sizeof(tags), "%s%s", store_path, SM3_STORE_TAGS_SUFFIX);
+    snprintf(journal, sizeof(journal), "%s%s", tags, SM3_JOURNAL_SUFFIX);
+
+    // 准备数据：两边写入相同内容
+    enum { FILL = 256 };
+    uint8_t* fill = aligned_alloc(SM3_PAGE_SIZE, FILL * SM3_PAGE_SIZE);
+    uint8_t* buf = aligned_alloc(SM3_PAGE_SIZE, (size_t)cfg.batch * SM3_PAGE_SIZE);
+    uint64_t seed = 88172645463325252ull;
+    for (size_t i = 0; i < FILL * SM3_PAGE_SIZE / 8; i++) {
+        ((uint64_t*)fill)[i] = rng_next(&seed);
+    }
+    memcpy(buf, fill, (size_t)cfg.batch * SM3_PAGE_SIZE < FILL * SM3_PAGE_SIZE
+                          ? (size_t)cfg.batch * SM3_PAGE_SIZE : FILL * SM3_PAGE_SIZE);
+
+    sm3_store_t* st;
+    int fd = open(raw_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || sm3_store_open(&st, store_path, &opts) != 0) {
+        fprintf(stderr, "创建测试文件失败: %s\n", strerror(errno));
+        return 1;
+    }
+    for (uint64_t p = 0; p < pages; p += FILL) {
+        uint32_t n = pages - p < FILL ? (uint32_t)(pages - p) : FILL;
+        if (pwrite(fd, fill, (size_t)n * SM3_PAGE_SIZE, (off_t)(p * SM3_PAGE_SIZE)) < 0 ||
+            sm3_store_write(st, p, n, fill) != 0) {
+            fprintf(stderr, "写入测试数据失败\n");
+            return 1;
+        }
+    }
+    close(fd);
+    // 重新打开，缓存从空开始；只统计测试阶段的指标
+    sm3_metrics_t* metrics = NULL;
+    if (dump_metrics || metrics_port >= 0) {
+        metrics = opts.metrics = sm3_metrics_create();
+        if (!metrics) {
+            fprintf(stderr, "内存不足\n");
+            return 1;
+        }
+    }
+    sm3_slowlog_t* slowlog = NULL;
+    if (slow_us >= 0) {
+        slowlog = opts.slowlog = sm3_slowlog_create(256, (uint64_t)slow_us * 1000,
+                                                    SM3_SLOWLOG_FAULTS);
+        if (!slowlog || sm3_slowlog_dump_on_signal(slowlog, SIGUSR1, STDERR_FILENO) != 0) {
+            fprintf(stderr, "创建慢请求日志失败: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+    if (metrics_port >= 0) {
+        int port = sm3_metrics_serve(metrics, metrics_port);
+        if (port < 0) {
+            fprintf(stderr, "启动指标端点失败: %s\n", strerror(errno));
+            return 1;
+        }
+        printf("指标端点: http://127.0.0.1:%d/metrics\n", port);
+        fflush(stdout);
+    }
+    if (sm3_store_close(st) != 0 || sm3_store_open(&st, store_path, &opts) != 0) {
+        fprintf(stderr, "重新打开页存储失败: %s\n", strerror(errno));
+        return 1;
+    }
+
+    bench_op_t* ops = make_ops(&cfg, pages);
+    bench_result_t raw = { calloc(cfg.ops, 8), calloc(cfg.ops, 8), 0, 0, 0 };
+    bench_result_t tagged = { calloc(cfg.ops, 8), calloc(cfg.ops, 8), 0, 0, 0 };
+    if (!ops || !raw.read_ns || !raw.write_ns || !tagged.read_ns || !tagged.write_ns) {
+        fprintf(stderr, "内存不足\n");
+        return 1;
+    }
+
+    int rc = 0;
+    if (run_raw(&cfg, raw_path, ops, buf, &raw) != 0) {
+        rc = 1;
+    }
+    if (rc == 0 && trace_path) {
+        sm3_trace_thread_name("bench");
+        sm3_trace_start(&topts);
+    }
+    if (rc == 0 && run_store(&cfg, st, ops, buf, &tagged) != 0) {
+        rc = 1;
+    }
+    if (trace_path) {
+        sm3_trace_stop();
+    }
+    if (rc != 0) {
+        fprintf(stderr, "测试失败: %s\n", strerror(errno));
+    }
+    const sm3_store_stats_t* ss = sm3_store_stats(st);
+
+    if (rc == 0) {
+        double bytes = (double)cfg.ops * cfg.batch * SM3_PAGE_SIZE;
+        double raw_mbps = bytes / (1024.0 * 1024.0) / (raw.total_ns / 1e9);
+        double st_mbps = bytes / (1024.0 * 1024.0) / (tagged.total_ns / 1e9);
+        printf("配置: 数据 %llu MB, %llu次操作, 读 %d%%, 每次 %u 页, 布局 %s, 缓存 %u 页, "
+               "写回 %u 页, 线程 %d%s%s\n",
+               (unsigned long long)cfg.data_mb, (unsigned long long)cfg.ops, cfg.read_pct,
+               cfg.batch, opts.layout == SM3_STORE_TAG_INLINE ? "inline" : "file",
+               opts.cache_pages, opts.writeback_pages, opts.num_threads,
+               opts.sync ? ", 同步" : "", opts.journal ? ", 摘要日志" : "");
+        printf("\n基准 (pread/pwrite):\n");
+        print_latency("读", raw.read_ns, raw.reads);
+        print_latency("写", raw.write_ns, raw.writes);
+        printf("  吞吐量 %.2f MB/s\n", raw_mbps);
+        printf("\n页存储 (打标签/校验):\n");
+        print_latency("读", tagged.read_ns, tagged.reads);
+        print_latency("写", tagged.write_ns, tagged.writes);
+        printf("  吞吐量 %.2f MB/s (含写回刷新)\n", st_mbps);
+        printf("  缓存命中 %llu页, 写回缓冲命中 %llu页, 校验 %llu页 (%.3f秒), "
+               "打标签 %llu页 (%.3f秒), 刷新 %llu次\n",
+               (unsigned long long)ss->cache_hits, (unsigned long long)ss->wb_hits,
+               (unsigned long long)ss->verified_pages, ss->verify_ns / 1e9,
+               (unsigned long long)ss->tagged_pages, ss->tag_ns / 1e9,
+               (unsigned long long)ss->flushes);
+        if (opts.journal) {
+            printf("  摘要日志提交 %llu次 (每次平均 %.1f 个标签), 压缩 %llu次\n",
+                   (unsigned long long)ss->journal_commits,
+                   ss->journal_commits ? (double)ss->tagged_pages / ss->journal_commits : 0.0,
+                   (unsigned long long)ss->journal_compactions);
+        }
+
+        // print_latency 已排序，此处平均值不受影响
+        printf("\n开销: 读延迟 %+.2f us, 写延迟 %+.2f us, 吞吐量 %+.1f%%\n",
+               avg_us(tagged.read_ns, tagged.reads) - avg_us(raw.read_ns, raw.reads),
+               avg_us(tagged.write_ns, tagged.writes) - avg_us(raw.write_ns, raw.writes),
+               (st_mbps / raw_mbps - 1) * 100);
+    }
+    sm3_trace_stats_t ts;
+    if (rc == 0 && trace_path) {
+        if (sm3_trace_write(trace_path, &ts) != 0) {
+            fprintf(stderr, "写入追踪文件失败: %s\n", strerror(errno));
+            rc = 1;
+        } else {
+            printf("\n时间线: %s (%u 线程, %llu 事件, 丢弃 %llu)\n", trace_path, ts.threads,
+                   (unsigned long long)ts.events, (unsigned long long)ts.dropped);
+        }
+    }
+
+    if (rc == 0 && dump_metrics) {
+        char* text;
+        if (sm3_metrics_format(metrics, &text) < 0) {
+            fprintf(stderr, "生成运行指标失败: %s\n", strerror(errno));
+            rc = 1;
+        } else {
+            printf("\n运行指标:\n%s", text);
+            free(text);
+        }
+    }
+
+    if (rc == 0 && slowlog) {
+        printf("\n慢请求 (超过 %ld us):\n", slow_us);
+        fflush(stdout);
+        sm3_slowlog_dump(slowlog, STDOUT_FILENO);
+    }
+
+    sm3_store_close(st);
+    sm3_slowlog_dump_on_signal(NULL, SIGUSR1, STDERR_FILENO);
+    sm3_slowlog_destroy(slowlog);
+    sm3_metrics_destroy(metrics);
+    unlink(raw_path);
+    unlink(store_path);
+    unlink(tags);
+    unlink(journal);
+    free(fill);
+    free(buf);
+    free(ops);
+    free(raw.read_ns);
+    free(raw.write_ns);
+    free(tagged.read_ns);
+    free(tagged.write_ns);
+    return rc;
+}
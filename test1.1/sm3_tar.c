@@ -0,0 +1,811 @@
+/*
+ * 单遍 tar / OCI 镜像层流式摘要
+ *
+ * 读取线程、流摘要线程与解析线程共享一个块环：第 seq 块位于 ring[seq % n]，
+ * 两个消费者各自记录已处理到的块号，较慢者之前的块才可重新填充。
+ * 解析线程的已处理块号要扣除尚未算完的批次仍在引用的块。
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+#include "sm3_manifest.h"
+#include "sm3_pool.h"
+#include "sm3_tar.h"
+
+#define TAR_BLOCK       512
+#define MAX_META        (1u << 20)      // pax / GNU 长文件名条目的大小上限
+#define MB_GROUP        64
+
+void sm3_tar_opts_default(sm3_tar_opts_t* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->digest_bits = 256;
+    opts->chunk_size = 1u << 20;
+    opts->max_chunks = 16;
+    opts->batch_pages = 512;
+}
+
+// ============================================================================
+// 块环
+// ============================================================================
+
+typedef struct {
+    uint8_t* data;
+    size_t len;
+} chunk_t;
+
+typedef struct {
+    int fd;
+    chunk_t* ring;
+    uint32_t n;
+    size_t chunk_size;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint64_t produced;
+    uint64_t done_s;            // 流摘要线程已处理的块数
+    uint64_t done_p;            // 解析线程已归还的块数
+    int eof;
+    int err;                    // 读取错误（errno）
+    int abort;
+    sm3_ctx_t sm3;
+    uint64_t bytes;
+} ring_t;
+
+static void* reader_main(void* arg) {
+    ring_t* r = arg;
+    for (;;) {
+        pthread_mutex_lock(&r->lock);
+        for (;;) {
+            uint64_t low = r->done_s < r->done_p ? r->done_s : r->done_p;
+            if (r->abort || r->produced - low < r->n) break;
+            pthread_cond_wait(&r->cond, &r->lock);
+        }
+        int stop = r->abort;
+        chunk_t* c = &r->ring[r->produced % r->n];
+        pthread_mutex_unlock(&r->lock);
+        if (stop) {
+            break;
+        }
+
+        // 读满一块（最后一块除外），块边界因而总在512字节边界上
+        size_t len = 0;
+        int eof = 0, err = 0;
+        while (len < r->chunk_size) {
+            ssize_t k = read(r->fd, c->data + len, r->chunk_size - len);
+            if (k < 0 && errno == EINTR) continue;
+            if (k < 0) {
+                err = errno;
+                break;
+            }
+            if (k == 0) {
+                eof = 1;
+                break;
+            }
+            len += (size_t)k;
+        }
+        pthread_mutex_lock(&r->lock);
+        if (len > 0 && !err) {
+            c->len = len;
+            r->produced++;
+        }
+        r->eof = eof;
+        r->err = err;
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+        if (eof || err) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void* stream_main(void* arg) {
+    ring_t* r = arg;
+    for (;;) {
+        pthread_mutex_lock(&r->lock);
+        while (r->done_s == r->produced && !r->eof && !r->err && !r->abort) {
+            pthread_cond_wait(&r->cond, &r->lock);
+        }
+        if (r->done_s == r->produced || r->abort) {
+            pthread_mutex_unlock(&r->lock);
+            break;
+        }
+        chunk_t* c = &r->ring[r->done_s % r->n];
+        pthread_mutex_unlock(&r->lock);
+        sm3_update(&r->sm3, c->data, c->len);
+        r->bytes += c->len;
+        pthread_mutex_lock(&r->lock);
+        r->done_s++;
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+    }
+    return NULL;
+}
+
+// ============================================================================
+// 解析线程：游标与页批次
+// ============================================================================
+
+typedef struct {
+    ring_t* ring;
+    sm3_pool_t* pool;
+    sm3_tar_result_t* res;
+    int bits;
+    uint32_t batch_pages;
+
+    uint64_t seq;               // 当前块号
+    size_t pos;                 // 块内位置
+    int have;                   // 当前块已就绪
+
+    const uint8_t** in;
+    uint64_t* page_no;
+    uint8_t* scratch;
+    uint32_t nbatch;
+    uint32_t nscratch;
+    int inplace;                // 批次中有直接引用块内数据的页
+    uint64_t first_seq;         // 其中最早的块号
+    uint64_t next_page;
+    uint64_t digest_cap;
+} parser_t;
+
+static void release(parser_t* p) {
+    uint64_t upto = p->inplace && p->first_seq < p->seq ? p->first_seq : p->seq;
+    pthread_mutex_lock(&p->ring->lock);
+    if (upto > p->ring->done_p) {
+        p->ring->done_p = upto;
+        pthread_cond_broadcast(&p->ring->cond);
+    }
+    pthread_mutex_unlock(&p->ring->lock);
+}
+
+static void hash_chunk(void* ctx, size_t begin, size_t end) {
+    parser_t* p = ctx;
+    int ds = p->res->digest_size;
+    for (size_t b = begin; b < end; b += MB_GROUP) {
+        int m = (int)(end - b < MB_GROUP ? end - b : MB_GROUP);
+        if (ds == 16) {
+            // 一批内页号连续，128位摘要直接紧密写入
+            aes_sm3_integrity_mb_128(p->in + b, p->res->digests + p->page_no[b] * 16, m);
+            continue;
+        }
+        uint8_t* out[MB_GROUP];
+        for (int j = 0; j < m; j++) out[j] = p->res->digests + p->page_no[b + j] * (uint64_t)ds;
+        aes_sm3_integrity_mb(p->in + b, out, m, p->bits);
+    }
+}
+
+static int flush_batch(parser_t* p) {
+    if (p->nbatch == 0) {
+        return 0;
+    }
+    if (p->next_page > p->digest_cap) {
+        uint64_t cap = p->digest_cap ? p->digest_cap : 4096;
+        while (cap < p->next_page) cap *= 2;
+        uint8_t* d = realloc(p->res->digests, cap * (uint64_t)p->res->digest_size);
+        if (!d) {
+            return -1;
+        }
+        p->res->digests = d;
+        p->digest_cap = cap;
+    }
+    sm3_pool_run(p->pool, hash_chunk, p, p->nbatch, 16);
+    p->res->batches++;
+    p->nbatch = p->nscratch = 0;
+    p->inplace = 0;
+    release(p);
+    return 0;
+}
+
+// 当前块中从游标起连续可用的字节（最多 want），流结束返回0
+static size_t peek(parser_t* p, size_t want, const uint8_t** ptr) {
+    ring_t* r = p->ring;
+    for (;;) {
+        if (p->have) {
+            chunk_t* c = &r->ring[p->seq % r->n];
+            if (p->pos < c->len) {
+                *ptr = c->data + p->pos;
+                return c->len - p->pos < want ? c->len - p->pos : want;
+            }
+            p->seq++;
+            p->pos = 0;
+            p->have = 0;
+            // 批次引用的块过多时先算完，避免读取线程无块可填
+            if (p->inplace && p->seq - p->first_seq >= r->n / 2 && flush_batch(p) != 0) {
+                return 0;
+            }
+            release(p);
+        }
+        uint64_t t0 = sm3_now_ns();
+        pthread_mutex_lock(&r->lock);
+        while (r->produced <= p->seq && !r->eof && !r->err) {
+            pthread_cond_wait(&r->cond, &r->lock);
+        }
+        int ok = r->produced > p->seq;
+        pthread_mutex_unlock(&r->lock);
+        p->res->read_wait_ns += sm3_now_ns() - t0;
+        if (!ok) {
+            return 0;
+        }
+        p->have = 1;
+    }
+}
+
+static size_t take(parser_t* p, size_t want, const uint8_t** ptr) {
+    size_t n = peek(p, want, ptr);
+    p->pos += n;
+    return n;
+}
+
+static int copy_bytes(parser_t* p, uint8_t* dst, size_t len) {
+    while (len > 0) {
+        const uint8_t* src;
+        size_t n = take(p, len, &src);
+        if (n == 0) {
+            return -1;
+        }
+        if (dst) {
+            memcpy(dst, src, n);
+            dst += n;
+        }
+        len -= n;
+    }
+    return 0;
+}
+
+// 文件内容按页加入批次
+static int hash_content(parser_t* p, uint64_t size) {
+    for (uint64_t left = size; left > 0; ) {
+        if (p->nbatch == p->batch_pages && flush_batch(p) != 0) {
+            return -1;
+        }
+        size_t plen = left < SM3_PAGE_SIZE ? (size_t)left : SM3_PAGE_SIZE;
+        const uint8_t* src;
+        size_t n = peek(p, plen, &src);
+        if (n == 0) {
+            return -1;
+        }
+        if (n == SM3_PAGE_SIZE) {
+            if (!p->inplace) {
+                p->inplace = 1;
+                p->first_seq = p->seq;
+            }
+            p->in[p->nbatch] = src;
+            p->pos += n;
+        } else {
+            uint8_t* dst = p->scratch + (size_t)p->nscratch++ * SM3_PAGE_SIZE;
+            if (copy_bytes(p, dst, plen) != 0) {
+                return -1;
+            }
+            memset(dst + plen, 0, SM3_PAGE_SIZE - plen);
+            p->in[p->nbatch] = dst;
+            p->res->copied_pages++;
+        }
+        p->page_no[p->nbatch++] = p->next_page++;
+        left -= plen;
+    }
+    return 0;
+}
+
+// ============================================================================
+// tar 头
+// ============================================================================
+
+static uint64_t parse_num(const uint8_t* f, size_t n) {
+    uint64_t v = 0;
+    if (f[0] & 0x80) {
+        // base-256（GNU 大文件扩展）
+        v = f[0] & 0x3f;
+        for (size_t i = 1; i < n; i++) v = v << 8 | f[i];
+        return v;
+    }
+    size_t i = 0;
+    while (i < n && f[i] == ' ') i++;
+    for (; i < n && f[i] >= '0' && f[i] <= '7'; i++) v = v * 8 + (uint64_t)(f[i] - '0');
+    return v;
+}
+
+static int header_ok(const uint8_t* h) {
+    uint64_t sum = 0;
+    for (int i = 0; i < TAR_BLOCK; i++) sum += i >= 148 && i < 156 ? ' ' : h[i];
+    return sum == parse_num(h + 148, 8);
+}
+
+static char* field_dup(const uint8_t* f, size_t n) {
+    return strndup((const char*)f, strnlen((const char*)f, n));
+}
+
+// 去掉开头的 "/" 与 "./"、末尾的 "/"
+static char* normalize(char* s) {
+    if (!s) {
+        return NULL;
+    }
+    char* p = s;
+    for (;;) {
+        if (p[0] == '/') p++;
+        else if (p[0] == '.' && p[1] == '/') p += 2;
+        else break;
+    }
+    size_t n = strlen(p);
+    while (n > 0 && p[n - 1] == '/') p[--n] = '\0';
+    if (n == 0) {
+        p = ".";
+        n = 1;
+    }
+    memmove(s, p, n + 1);
+    return s;
+}
+
+typedef struct {
+    char* path;
+    char* link;
+    int has_size;
+    uint64_t size;
+    int has_mtime;
+    int64_t mtime;
+} pending_t;
+
+static void pending_clear(pending_t* x) {
+    free(x->path);
+    free(x->link);
+    memset(x, 0, sizeof(*x));
+}
+
+// pax 扩展头记录："长度 键=值\n"
+static void parse_pax(const char* d, size_t len, pending_t* x) {
+    size_t pos = 0;
+    while (pos < len) {
+        char* end;
+        unsigned long rlen = strtoul(d + pos, &end, 10);
+        if (rlen == 0 || pos + rlen > len || *end != ' ') {
+            break;
+        }
+        const char* kv = end + 1;
+        const char* rec_end = d + pos + rlen - 1;   // 指向 '\n'
+        const char* eq = memchr(kv, '=', (size_t)(rec_end - kv));
+        if (eq) {
+            size_t klen = (size_t)(eq - kv), vlen = (size_t)(rec_end - eq - 1);
+            if (klen == 4 && memcmp(kv, "path", 4) == 0) {
+                free(x->path);
+                x->path = strndup(eq + 1, vlen);
+            } else if (klen == 8 && memcmp(kv, "linkpath", 8) == 0) {
+                free(x->link);
+                x->link = strndup(eq + 1, vlen);
+            } else if (klen == 4 && memcmp(kv, "size", 4) == 0) {
+                x->has_size = 1;
+                x->size = strtoull(eq + 1, NULL, 10);
+            } else if (klen == 5 && memcmp(kv, "mtime", 5) == 0) {
+                x->has_mtime = 1;
+                x->mtime = strtoll(eq + 1, NULL, 10);
+            }
+        }
+        pos += rlen;
+    }
+}
+
+static int is_regular(char type) {
+    return type == '0' || type == '\0' || type == '7';
+}
+
+static int add_entry(sm3_tar_result_t* res, size_t* cap, const sm3_tar_entry_t* e) {
+    if (res->count == *cap) {
+        size_t c = *cap ? *cap * 2 : 64;
+        sm3_tar_entry_t* p = realloc(res->entries, c * sizeof(*p));
+        if (!p) {
+            return -1;
+        }
+        res->entries = p;
+        *cap = c;
+    }
+    res->entries[res->count++] = *e;
+    return 0;
+}
+
+static int parse_stream(parser_t* p) {
+    sm3_tar_result_t* res = p->res;
+    pending_t x;
+    memset(&x, 0, sizeof(x));
+    size_t cap = 0;
+    int rc = 0;
+    for (;;) {
+        const uint8_t* h;
+        size_t n = take(p, TAR_BLOCK, &h);
+        if (n == 0) {
+            break;                      // 缺少结束块：在条目边界结束也接受
+        }
+        if (n != TAR_BLOCK) {
+            rc = -1;
+            break;
+        }
+        int zero = 1;
+        for (int i = 0; i < TAR_BLOCK && zero; i++) zero = h[i] == 0;
+        if (zero) {
+            // 结束块：其后的内容只参与流摘要
+            const uint8_t* rest;
+            while (take(p, SIZE_MAX, &rest) > 0) {}
+            break;
+        }
+        if (!header_ok(h)) {
+            rc = -1;
+            break;
+        }
+        char type = (char)h[156];
+        uint64_t size = x.has_size ? x.size : parse_num(h + 124, 12);
+        uint64_t padded = (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+
+        if (type == 'x' || type == 'g' || type == 'L' || type == 'K') {
+            if (size > MAX_META) {
+                rc = -1;
+                break;
+            }
+            char* meta = malloc(padded + 1);
+            if (!meta || copy_bytes(p, (uint8_t*)meta, padded) != 0) {
+                free(meta);
+                rc = -1;
+                break;
+            }
+            meta[size] = '\0';
+            if (type == 'x') {
+                parse_pax(meta, size, &x);
+            } else if (type == 'L') {
+                free(x.path);
+                x.path = strdup(meta);
+            } else if (type == 'K') {
+                free(x.link);
+                x.link = strdup(meta);
+            }
+            free(meta);                 // 全局 pax 头（'g'）忽略
+            continue;
+        }
+
+        sm3_tar_entry_t e;
+        memset(&e, 0, sizeof(e));
+        e.type = type;
+        e.mode = (uint32_t)parse_num(h + 100, 8);
+        e.mtime = x.has_mtime ? x.mtime : (int64_t)parse_num(h + 136, 12);
+        if (x.path) {
+            e.path = x.path;
+            x.path = NULL;
+        } else if (memcmp(h + 257, "ustar", 5) == 0 && h[345]) {
+            char* prefix = field_dup(h + 345, 155);
+            char* name = field_dup(h, 100);
+            e.path = prefix && name ? malloc(strlen(prefix) + strlen(name) + 2) : NULL;
+            if (e.path) sprintf(e.path, "%s/%s", prefix, name);
+            free(prefix);
+            free(name);
+        } else {
+            e.path = field_dup(h, 100);
+        }
+        if (type == '1' || type == '2') {
+            e.link = x.link ? x.link : field_dup(h + 157, 100);
+            x.link = NULL;
+            if (!e.link) rc = -1;
+        }
+        pending_clear(&x);
+        if (!normalize(e.path) || rc != 0) {
+            free(e.path);
+            free(e.link);
+            rc = -1;
+            break;
+        }
+        if (type == '1') normalize(e.link);
+
+        if (is_regular(type)) {
+            e.size = size;
+            e.first_page = p->next_page;
+            e.pages = sm3_pages_for_size(size);
+            rc = hash_content(p, size);
+            if (rc == 0 && padded > size) rc = copy_bytes(p, NULL, padded - size);
+        } else {
+            rc = copy_bytes(p, NULL, padded);      // 其他类型的数据（通常为空）跳过
+        }
+        if (rc != 0 || add_entry(res, &cap, &e) != 0) {
+            free(e.path);
+            free(e.link);
+            rc = -1;
+            break;
+        }
+    }
+    pending_clear(&x);
+    if (rc == 0 && flush_batch(p) != 0) {
+        rc = -1;
+    }
+    return rc;
+}
+
+// ============================================================================
+// 入口
+// ============================================================================
+
+static void resolve_entries(sm3_tar_result_t* res) {
+    int ds = res->digest_size;
+    for (size_t i = 0; i < res->count; i++) {
+        sm3_tar_entry_t* e = &res->entries[i];
+        if (is_regular(e->type)) {
+            sm3_tree_file_root(res->digests + e->first_page * (uint64_t)ds, e->pages, ds, e->size, e->root);
+        } else if (e->type == '1') {
+            // 硬链接：沿用此前最近一个同名文件的摘要
+            for (size_t j = i; j-- > 0; ) {
+                const sm3_tar_entry_t* t = &res->entries[j];
+                if ((is_regular(t->type) || t->type == '1') && strcmp(t->path, e->link) == 0) {
+                    e->size = t->size;
+                    e->first_page = t->first_page;
+                    e->pages = t->pages;
+                    memcpy(e->root, t->root, 32);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+int sm3_tar_hash_fd(int fd, const sm3_tar_opts_t* opts, sm3_tar_result_t* result) {
+    sm3_tar_opts_t o;
+    sm3_tar_opts_default(&o);
+    if (opts) o = *opts;
+    memset(result, 0, sizeof(*result));
+    if ((o.digest_bits != 128 && o.digest_bits != 256) || o.chunk_size == 0 ||
+        o.chunk_size % SM3_PAGE_SIZE != 0 || o.batch_pages == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (o.max_chunks < 4) o.max_chunks = 4;
+    result->digest_size = o.digest_bits / 8;
+    result->compression = "none";
+    uint64_t t0 = sm3_now_ns();
+
+    ring_t r;
+    memset(&r, 0, sizeof(r));
+    r.fd = fd;
+    r.n = o.max_chunks;
+    r.chunk_size = o.chunk_size;
+    r.ring = calloc(r.n, sizeof(chunk_t));
+    parser_t p;
+    memset(&p, 0, sizeof(p));
+    p.ring = &r;
+    p.res = result;
+    p.bits = o.digest_bits;
+    p.batch_pages = o.batch_pages;
+    p.in = malloc(o.batch_pages * sizeof(uint8_t*));
+    p.page_no = malloc(o.batch_pages * sizeof(uint64_t));
+    p.scratch = aligned_alloc(SM3_PAGE_SIZE, (size_t)o.batch_pages * SM3_PAGE_SIZE);
+    p.pool = sm3_pool_create(o.num_threads);
+    int ok = r.ring && p.in && p.page_no && p.scratch && p.pool;
+    for (uint32_t i = 0; ok && i < r.n; i++) {
+        ok = (r.ring[i].data = malloc(r.chunk_size)) != NULL;
+    }
+    int rc = -1;
+    pthread_t rt, st;
+    if (ok) {
+        sm3_init(&r.sm3);
+        pthread_mutex_init(&r.lock, NULL);
+        pthread_cond_init(&r.cond, NULL);
+        pthread_create(&rt, NULL, reader_main, &r);
+        pthread_create(&st, NULL, stream_main, &r);
+        rc = parse_stream(&p);
+        pthread_mutex_lock(&r.lock);
+        if (rc != 0) {
+            r.abort = 1;
+        } else {
+            r.done_p = r.produced;
+        }
+        pthread_cond_broadcast(&r.cond);
+        pthread_mutex_unlock(&r.lock);
+        pthread_join(rt, NULL);
+        pthread_join(st, NULL);
+        if (rc == 0 && r.err) {
+            errno = r.err;
+            rc = -1;
+        } else if (rc != 0 && !r.err) {
+            errno = EINVAL;
+        }
+        pthread_cond_destroy(&r.cond);
+        pthread_mutex_destroy(&r.lock);
+    } else {
+        errno = ENOMEM;
+    }
+    for (uint32_t i = 0; r.ring && i < r.n; i++) free(r.ring[i].data);
+    free(r.ring);
+    free(p.in);
+    free(p.page_no);
+    free(p.scratch);
+    sm3_pool_destroy(p.pool);
+
+    if (rc != 0) {
+        int e = errno;
+        sm3_tar_result_free(result);
+        errno = e;
+        return -1;
+    }
+    sm3_final(&r.sm3, result->stream_digest);
+    result->stream_bytes = r.bytes;
+    result->pages = p.next_page;
+    resolve_entries(result);
+    result->elapsed_ns = sm3_now_ns() - t0;
+    return 0;
+}
+
+// 按魔数识别压缩格式
+static const char* detect(const uint8_t* m, size_t n) {
+    if (n >= 2 && m[0] == 0x1f && m[1] == 0x8b) return "gzip";
+    if (n >= 4 && m[0] == 0x28 && m[1] == 0xb5 && m[2] == 0x2f && m[3] == 0xfd) return "zstd";
+    if (n >= 6 && memcmp(m, "\xfd" "7zXZ\0", 6) == 0) return "xz";
+    return NULL;
+}
+
+static ssize_t read_some(int fd, uint8_t* buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t k = read(fd, buf + got, len - got);
+        if (k < 0 && errno == EINTR) continue;
+        if (k < 0) return -1;
+        if (k == 0) break;
+        got += (size_t)k;
+    }
+    return (ssize_t)got;
+}
+
+int sm3_tar_hash_file(const char* path, const sm3_tar_opts_t* opts, sm3_tar_result_t* result) {
+    int in = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return -1;
+    }
+    uint8_t magic[6];
+    ssize_t mlen = read_some(in, magic, sizeof(magic));
+    if (mlen < 0) {
+        if (in != STDIN_FILENO) close(in);
+        return -1;
+    }
+    const char* comp = detect(magic, (size_t)mlen);
+    int src = in;
+    pid_t feeder = -1, dec = -1;
+
+    if (lseek(in, 0, SEEK_SET) != 0 && mlen > 0) {
+        // 不可回退（管道）：起始字节连同其余内容由子进程写入新管道
+        int fds[2];
+        if (pipe(fds) != 0 || (feeder = fork()) < 0) {
+            if (in != STDIN_FILENO) close(in);
+            return -1;
+        }
+        if (feeder == 0) {
+            close(fds[0]);
+            uint8_t buf[65536];
+            ssize_t k = mlen;
+            memcpy(buf, magic, (size_t)mlen);
+            while (k > 0 && write(fds[1], buf, (size_t)k) == k) {
+                k = read(in, buf, sizeof(buf));
+            }
+            _exit(0);
+        }
+        close(fds[1]);
+        src = fds[0];
+    }
+    if (comp) {
+        int fds[2];
+        if (pipe(fds) != 0 || (dec = fork()) < 0) {
+            if (src != in) close(src);
+            if (in != STDIN_FILENO) close(in);
+            return -1;
+        }
+        if (dec == 0) {
+            dup2(src, STDIN_FILENO);
+            dup2(fds[1], STDOUT_FILENO);
+            close(fds[0]);
+            execlp(comp, comp, "-dc", (char*)NULL);
+            _exit(127);
+        }
+        close(fds[1]);
+        if (src != in) close(src);
+        src = fds[0];
+    }
+
+    int rc = sm3_tar_hash_fd(src, opts, result);
+    int err = errno;
+    if (src != in) close(src);
+    if (in != STDIN_FILENO) close(in);
+    int status;
+    if (feeder > 0) waitpid(feeder, &status, 0);
+    if (dec > 0 && (waitpid(dec, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) &&
+        rc == 0) {
+        // 解压失败（或解压程序不存在）
+        sm3_tar_result_free(result);
+        rc = -1;
+        err = EIO;
+    }
+    if (rc == 0) {
+        result->compression = comp ? comp : "none";
+    }
+    errno = err;
+    return rc;
+}
+
+void sm3_tar_result_free(sm3_tar_result_t* result) {
+    for (size_t i = 0; i < result->count; i++) {
+        free(result->entries[i].path);
+        free(result->entries[i].link);
+    }
+    free(result->entries);
+    free(result->digests);
+    memset(result, 0, sizeof(*result));
+}
+
+// 按路径排序，同一路径按在流中出现的先后倒序（后出现的在前）
+typedef struct {
+    const char* path;
+    size_t index;
+} path_ref_t;
+
+static int path_ref_cmp(const void* a, const void* b) {
+    const path_ref_t* x = a;
+    const path_ref_t* y = b;
+    int c = strcmp(x->path, y->path);
+    if (c) return c;
+    return x->index > y->index ? -1 : x->index < y->index;
+}
+
+// 未找到目标的硬链接根摘要保持全零
+static int resolved(const sm3_tar_entry_t* e) {
+    for (int i = 0; i < 32; i++) {
+        if (e->root[i]) return 1;
+    }
+    return 0;
+}
+
+int sm3_tar_to_tree(const sm3_tar_result_t* result, sm3_tree_result_t* tree) {
+    memset(tree, 0, sizeof(*tree));
+    tree->digest_bits = result->digest_size * 8;
+    tree->entries = calloc(result->count ? result->count : 1, sizeof(sm3_tree_entry_t));
+    if (!tree->entries) {
+        return -1;
+    }
+    path_ref_t* refs = malloc((result->count ? result->count : 1) * sizeof(path_ref_t));
+    if (!refs) {
+        sm3_tree_result_free(tree);
+        return -1;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < result->count; i++) {
+        const sm3_tar_entry_t* e = &result->entries[i];
+        if (is_regular(e->type) || (e->type == '1' && resolved(e))) {
+            refs[n].path = e->path;
+            refs[n].index = i;
+            n++;
+        }
+    }
+    // 同一路径（追加的 tar、覆盖同名文件的层）只保留流中最后出现的条目：
+    // 排序以流中位置为次键，同名条目中排在最前的即为最后出现的
+    qsort(refs, n, sizeof(path_ref_t), path_ref_cmp);
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0 && strcmp(refs[i - 1].path, refs[i].path) == 0) {
+            continue;
+        }
+        const sm3_tar_entry_t* e = &result->entries[refs[i].index];
+        sm3_tree_entry_t* t = &tree->entries[k];
+        t->path = strdup(e->path);
+        if (!t->path) {
+            tree->count = k;
+            free(refs);
+            sm3_tree_result_free(tree);
+            return -1;
+        }
+        t->size = e->size;
+        t->pages = e->pages;
+        t->mtime_ns = e->mtime * 1000000000ll;
+        memcpy(t->root, e->root, 32);
+        tree->bytes += e->size;
+        tree->pages += e->pages;
+        k++;
+    }
+    free(refs);
+    tree->count = k;
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * 单遍 tar / OCI 镜像层流式摘要
+ *
+ * 校验镜像层原先要先解包到磁盘再扫描目录树（两遍 I/O），或者串行计算整个
+ * tar 包的摘要。本模块一遍读取 tar 流（可边读边解压），同时得到：
+ *   - 整个（解压后）流的 SM3 摘要（对应 OCI 的 diff_id 位置）
+ *   - 每个条目的元数据，普通文件的各4KB页摘要与文件根摘要；文件根摘要与
+ *     解包后 sm3_scan tree 得到的相同，可直接生成树清单
+ *
+ * 流水线：
+ *   - 读取线程把输入读入固定大小的块（块数有上限，读得快时阻塞等待）
+ *   - 流摘要线程按顺序对每块做 SM3
+ *   - 调用线程解析 tar 头，文件内容按页组成批次（块内完整的页直接引用，
+ *     跨块或不足一页的页拷贝补零），整批经线程池用多缓冲区接口计算；
+ *     批次引用的块在整批算完后才归还
+ *
+ * 支持 ustar / pax（path、linkpath、size、mtime）/ GNU 长文件名，硬链接条目
+ * 沿用目标文件的摘要。gzip / zstd / xz 压缩的输入按魔数识别，由子进程解压。
+ */
+
+#ifndef SM3_TAR_H
+#define SM3_TAR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sm3_tree.h"
+
+typedef struct {
+    int num_threads;            // 页摘要线程数，<= 0 取在线CPU数
+    int digest_bits;            // 128 或 256
+    uint32_t chunk_size;        // 读取块大小（4096的倍数）
+    uint32_t max_chunks;        // 同时在内存中的块数上限
+    uint32_t batch_pages;       // 每批页数
+} sm3_tar_opts_t;
+
+typedef struct {
+    char* path;                 // 已规范化：去掉开头的 "./" 与 "/"，目录去掉末尾 "/"
+    char* link;                 // 符号链接/硬链接目标，其余为 NULL
+    char type;                  // tar 类型：'0' 普通文件，'1' 硬链接，'2' 符号链接，'5' 目录…
+    uint32_t mode;
+    int64_t mtime;              // 秒
+    uint64_t size;              // 普通文件（及解析后的硬链接）的字节数
+    uint64_t first_page;        // 页摘要在 digests 中的起始页号
+    uint64_t pages;
+    uint8_t root[32];           // 文件根摘要（普通文件与硬链接）
+} sm3_tar_entry_t;
+
+typedef struct {
+    sm3_tar_entry_t* entries;   // 按在流中出现的顺序
+    size_t count;
+    uint8_t* digests;           // 全部普通文件的页摘要，按条目顺序紧密排列
+    uint64_t pages;
+    int digest_size;
+    uint8_t stream_digest[32];  // 整个（解压后）流的 SM3
+    uint64_t stream_bytes;
+    const char* compression;    // "none" / "gzip" / "zstd" / "xz"
+    uint64_t batches;
+    uint64_t copied_pages;      // 跨块或不足一页而拷贝的页数
+    uint64_t read_wait_ns;      // 解析线程等待输入的耗时
+    uint64_t elapsed_ns;
+} sm3_tar_result_t;
+
+void sm3_tar_opts_default(sm3_tar_opts_t* opts);
+
+// 从 fd 读取未压缩的 tar 流直到 EOF。格式错误或流被截断返回 -1（EINVAL）
+int sm3_tar_hash_fd(int fd, const sm3_tar_opts_t* opts, sm3_tar_result_t* result);
+// path 为 "-" 时读标准输入；压缩格式按魔数识别
+int sm3_tar_hash_file(const char* path, const sm3_tar_opts_t* opts, sm3_tar_result_t* result);
+void sm3_tar_result_free(sm3_tar_result_t* result);
+
+// 普通文件与硬链接转为树清单（按路径排序，同一路径以后出现的为准；
+// inode 与 ctime 记为0，mtime 取自 tar 头）
+int sm3_tar_to_tree(const sm3_tar_result_t* result, sm3_tree_result_t* tree);
+
+#endif // SM3_TAR_H
@@ -0,0 +1,228 @@
+/*
+ * 并行执行时间线追踪
+ *
+ * 每个线程一个事件数组，由所属线程追加，count 以 release 语义发布；
+ * 缓冲区以无锁单链表登记，输出时遍历链表，只取属于当前会话的缓冲区。
+ * 缓冲区记录所属会话号，线程在新会话中首次记录时自行清空。
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "sm3_checkpoint.h"
+#include "sm3_trace.h"
+
+#define DEFAULT_EVENTS 65536
+#define NAME_MAX_LEN   32
+
+typedef struct {
+    uint64_t start_ns;
+    uint64_t dur_ns;
+    const char* name;
+    uint64_t arg0;
+    uint64_t arg1;
+    int cat;
+} trace_event_t;
+
+typedef struct trace_buf {
+    struct trace_buf* next;
+    int tid;
+    char name[NAME_MAX_LEN];
+    uint64_t session;
+    size_t cap;                 // 已分配的事件数
+    size_t limit;               // 本会话的事件数上限
+    atomic_size_t count;
+    atomic_uint_fast64_t dropped;
+    trace_event_t* events;
+} trace_buf_t;
+
+static const char* const cat_names[SM3_TRACE_CATS] = { "task", "idle", "io", "job" };
+
+static _Atomic(trace_buf_t*) g_bufs;
+static atomic_int g_enabled;
+static atomic_uint_fast64_t g_session;
+static atomic_uint_fast64_t g_jobs;
+static uint64_t g_start_ns;
+static size_t g_capacity = DEFAULT_EVENTS;
+static uint32_t g_sample_every = 1;
+
+static __thread trace_buf_t* t_buf;
+static __thread char t_name[NAME_MAX_LEN];
+
+int sm3_trace_start(const sm3_trace_opts_t* opts) {
+    g_capacity = opts && opts->events_per_thread ? opts->events_per_thread : DEFAULT_EVENTS;
+    g_sample_every = opts && opts->sample_every > 1 ? opts->sample_every : 1;
+    atomic_store(&g_jobs, 0);
+    g_start_ns = sm3_now_ns();
+    atomic_fetch_add(&g_session, 1);
+    atomic_store(&g_enabled, 1);
+    return 0;
+}
+
+void sm3_trace_stop(void) {
+    atomic_store(&g_enabled, 0);
+}
+
+int sm3_trace_enabled(void) {
+    return atomic_load_explicit(&g_enabled, memory_order_relaxed);
+}
+
+int sm3_trace_sample_job(void) {
+    if (!sm3_trace_enabled()) {
+        return 0;
+    }
+    return atomic_fetch_add_explicit(&g_jobs, 1, memory_order_relaxed) % g_sample_every == 0;
+}
+
+uint64_t sm3_trace_clock(void) {
+    return sm3_trace_enabled() ? sm3_now_ns() : 0;
+}
+
+void sm3_trace_thread_name(const char* name) {
+    snprintf(t_name, sizeof(t_name), "%s", name);
+    if (t_buf) {
+        memcpy(t_buf->name, t_name, sizeof(t_name));
+    }
+}
+
+// 当前线程属于本会话的缓冲区；内存不足时返回 NULL
+static trace_buf_t* thread_buf(void) {
+    uint64_t session = atomic_load(&g_session);
+    trace_buf_t* b = t_buf;
+    if (!b) {
+        b = calloc(1, sizeof(*b));
+        if (!b) {
+            return NULL;
+        }
+        b->tid = (int)syscall(SYS_gettid);
+        memcpy(b->name, t_name, sizeof(t_name));
+        trace_buf_t* head = atomic_load(&g_bufs);
+        do {
+            b->next = head;
+        } while (!atomic_compare_exchange_weak(&g_bufs, &head, b));
+        t_buf = b;
+    }
+    if (b->session != session) {
+        if (b->cap < g_capacity) {
+            trace_event_t* ev = realloc(b->events, g_capacity * sizeof(trace_event_t));
+            if (!ev) {
+                return NULL;
+            }
+            b->events = ev;
+            b->cap = g_capacity;
+        }
+        b->limit = g_capacity;
+        atomic_store(&b->count, 0);
+        atomic_store(&b->dropped, 0);
+        b->session = session;
+    }
+    return b;
+}
+
+void sm3_trace_span(int cat, const char* name, uint64_t start_ns, uint64_t arg0, uint64_t arg1) {
+    if (start_ns == 0 || !sm3_trace_enabled()) {
+        return;
+    }
+    uint64_t now = sm3_now_ns();
+    trace_buf_t* b = thread_buf();
+    if (!b) {
+        return;
+    }
+    size_t i = atomic_load_explicit(&b->count, memory_order_relaxed);
+    if (i >= b->limit) {
+        atomic_fetch_add_explicit(&b->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    trace_event_t* e = &b->events[i];
+    e->start_ns = start_ns;
+    e->dur_ns = now - start_ns;
+    e->name = name;
+    e->arg0 = arg0;
+    e->arg1 = arg1;
+    e->cat = cat;
+    atomic_store_explicit(&b->count, i + 1, memory_order_release);
+}
+
+static void write_json_string(FILE* f, const char* s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', f);
+            fputc(*s, f);
+        } else if ((unsigned char)*s >= 0x20) {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+int sm3_trace_write(const char* path, sm3_trace_stats_t* stats) {
+    size_t plen = strlen(path);
+    char* tmp = malloc(plen + 5);
+    if (!tmp) {
+        return -1;
+    }
+    memcpy(tmp, path, plen);
+    memcpy(tmp + plen, ".tmp", 5);
+    FILE* f = fopen(tmp, "w");
+    if (!f) {
+        free(tmp);
+        return -1;
+    }
+
+    uint64_t session = atomic_load(&g_session);
+    int pid = (int)getpid();
+    sm3_trace_stats_t st = { 0, 0, 0 };
+    int first = 1;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (trace_buf_t* b = atomic_load(&g_bufs); b; b = b->next) {
+        if (b->session != session) continue;
+        size_t n = atomic_load_explicit(&b->count, memory_order_acquire);
+        st.threads++;
+        st.events += n;
+        st.dropped += atomic_load(&b->dropped);
+
+        char fallback[NAME_MAX_LEN];
+        snprintf(fallback, sizeof(fallback), "thread-%d", b->tid);
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                   "\"args\":{\"name\":", first ? "" : ",\n", pid, b->tid);
+        write_json_string(f, b->name[0] ? b->name : fallback);
+        fprintf(f, "}}");
+        first = 0;
+        for (size_t i = 0; i < n; i++) {
+            const trace_event_t* e = &b->events[i];
+            // 会话开始前发起、开始后才结束的区间从会话开始处截断
+            uint64_t start = e->start_ns > g_start_ns ? e->start_ns : g_start_ns;
+            uint64_t end = e->start_ns + e->dur_ns;
+            fprintf(f, ",\n{\"name\":");
+            write_json_string(f, e->name);
+            fprintf(f, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,"
+                       "\"tid\":%d,\"args\":{\"arg0\":%llu,\"arg1\":%llu}}",
+                    cat_names[e->cat >= 0 && e->cat < SM3_TRACE_CATS ? e->cat : 0],
+                    (double)(start - g_start_ns) / 1000.0,
+                    (double)(end > start ? end - start : 0) / 1000.0, pid, b->tid,
+                    (unsigned long long)e->arg0, (unsigned long long)e->arg1);
+        }
+    }
+    fprintf(f, "\n],\"otherData\":{\"dropped_events\":%llu}}\n", (unsigned long long)st.dropped);
+
+    int rc = fflush(f) == 0 && !ferror(f) ? 0 : -1;
+    if (fclose(f) != 0) rc = -1;
+    if (rc == 0 && rename(tmp, path) != 0) rc = -1;
+    if (rc != 0) {
+        int e = errno;
+        unlink(tmp);
+        errno = e;
+    }
+    free(tmp);
+    if (rc == 0 && stats) {
+        *stats = st;
+    }
+    return rc;
+}
@@ -0,0 +1,67 @@
+/*
+ * 并行执行时间线追踪（Chrome trace-event 格式）
+ *
+ * 按需开启的轻量追踪器：各线程把时间区间写入自己的缓冲区（只有所属线程写入，
+ * 无锁），sm3_trace_write 输出 Chrome trace-event JSON，可直接在 Perfetto
+ * （ui.perfetto.dev）或 chrome://tracing 中查看，用于发现落后线程与流水线空泡。
+ *
+ * 已接入的位置：
+ *   - sm3_pool_run：调用线程的 job（整个作业）与 wait（等待落后线程），
+ *     工作线程的 wake（作业发布到开始领取的空闲时间）与 chunk（每个领取的切块，
+ *     参数为切块的起止下标）。线程池以共享计数器自调度，没有单独的窃取事件，
+ *     各线程领取的切块数即反映负载分布
+ *   - sm3_read_pages、页存储的 pread/pwritev：io（I/O 等待，参数为偏移与长度）
+ *
+ * 开销：未开启时每个埋点只是一次全局标志读取；开启后每个事件一次 clock_gettime
+ * 与一次缓冲区写入。sample_every > 1 时线程池只记录每 N 个作业中的一个，
+ * 可在生产任务中长期开启。缓冲区写满后丢弃新事件并计数。
+ *
+ * 线程缓冲区在首次记录时分配并常驻到进程退出，之后的追踪会话复用。
+ * sm3_trace_write 应在 sm3_trace_stop 之后、被追踪的作业全部结束后调用。
+ */
+
+#ifndef SM3_TRACE_H
+#define SM3_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 事件类别（对应 trace-event 的 cat 字段）
+enum {
+    SM3_TRACE_TASK = 0,     // 计算
+    SM3_TRACE_IDLE,         // 空闲/等待其他线程
+    SM3_TRACE_IO,           // I/O 等待
+    SM3_TRACE_JOB,          // 作业整体
+    SM3_TRACE_CATS
+};
+
+typedef struct {
+    size_t events_per_thread;   // 每线程缓冲区事件数，0 取默认 65536
+    uint32_t sample_every;      // 线程池每 N 个作业记录一个，0/1 表示全部记录
+} sm3_trace_opts_t;
+
+typedef struct {
+    uint64_t events;
+    uint64_t dropped;           // 缓冲区满而丢弃的事件
+    uint32_t threads;
+} sm3_trace_stats_t;
+
+// 开始新的追踪会话（清空此前记录），opts 可为 NULL
+int sm3_trace_start(const sm3_trace_opts_t* opts);
+void sm3_trace_stop(void);
+int sm3_trace_enabled(void);
+
+// 线程池作业是否记录（按 sample_every 抽样；未开启时返回 0）
+int sm3_trace_sample_job(void);
+
+// 当前时间戳；未开启时返回 0，此时对应的 sm3_trace_span 不记录
+uint64_t sm3_trace_clock(void);
+// 记录 [start_ns, 现在) 的区间，name 须为静态字符串
+void sm3_trace_span(int cat, const char* name, uint64_t start_ns, uint64_t arg0, uint64_t arg1);
+// 设置当前线程在时间线中的名称（可在开启追踪之前调用）
+void sm3_trace_thread_name(const char* name);
+
+// 输出本次会话的 trace-event JSON；stats 可为 NULL
+int sm3_trace_write(const char* path, sm3_trace_stats_t* stats);
+
+#endif // SM3_TRACE_H
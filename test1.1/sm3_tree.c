@@ -0,0 +1,951 @@
+/*
+ * 并行目录树扫描
+ *
+ * 任务队列中有两类任务：
+ *   TASK_DIR    扫描一个目录：getdents64 批量读取目录项，statx 分流
+ *   TASK_CHUNK  计算大文件的一段页区间，最后完成的线程汇总根摘要
+ * 小文件不进入队列，由发现它的线程直接读入本地批缓冲区。
+ * outstanding 计数 = 队列中 + 正在执行的任务数，归零即扫描结束。
+ *
+ * 增量模式下，statx 得到的元数据与旧清单（或扩展属性）一致的文件
+ * 在目录扫描阶段即直接完成，不打开、不读取。
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_checkpoint.h"
+#include "sm3_manifest.h"
+#include "sm3_tree.h"
+
+#define TREE_DENTS_BUF  (64 * 1024)
+#define TREE_MAX_BATCH  256
+
+struct linux_dirent64 {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+typedef struct {
+    sm3_tree_entry_t entry;
+    uint8_t* digests;               // 各页摘要（大文件）
+    char* abs_path;                 // 大文件按页区间读取时使用
+    atomic_uint_fast64_t chunks_left;
+    atomic_int chunk_failed;        // 任一区间读取失败，整个文件作废
+    int prev_known;                 // 旧清单中存在该文件
+    uint8_t prev_root[32];
+} file_job_t;
+
+// user.sm3.digest 扩展属性内容。setxattr 本身会改变 ctime，
+// 因此扩展属性只以 (inode, 大小, mtime) 判定文件未变化。
+typedef struct {
+    char magic[4];
+    uint8_t version;
+    uint8_t digest_size;
+    uint16_t reserved;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint8_t root[32];
+} tree_xattr_t;
+
+#define TREE_XATTR_MAGIC "SM3X"
+
+enum { TASK_DIR, TASK_CHUNK };
+
+typedef struct tree_task {
+    struct tree_task* next;
+    int kind;
+    char* rel_path;                 // TASK_DIR
+    file_job_t* file;               // TASK_CHUNK
+    uint64_t first_page;
+    uint64_t page_count;
+} tree_task_t;
+
+typedef struct {
+    const char* root;
+    int root_fd;
+    const sm3_tree_opts_t* opts;
+    int digest_size;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    tree_task_t* head;
+    tree_task_t* tail;
+    uint64_t outstanding;
+} tree_ctx_t;
+
+typedef struct {
+    tree_ctx_t* ctx;
+
+    // 小文件多缓冲区批
+    uint8_t* batch_buf;
+    const uint8_t* in[TREE_MAX_BATCH];
+    uint8_t* out[TREE_MAX_BATCH];
+    int batch_used;
+    file_job_t* batch_files[TREE_MAX_BATCH];
+    uint8_t* batch_digests;         // batch_pages * digest_size
+    int batch_nfiles;
+
+    uint8_t* io_buf;                // 大文件页区间读取缓冲区
+    uint8_t* dents;
+
+    // 线程本地结果，结束时合并
+    file_job_t** done;
+    size_t done_count;
+    size_t done_cap;
+
+    sm3_tree_result_t stats;
+} tree_worker_t;
+
+void sm3_tree_opts_default(sm3_tree_opts_t* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    opts->digest_bits = 256;
+    opts->small_max = 64 * 1024;
+    opts->chunk_pages = 256;
+    opts->batch_pages = 64;
+}
+
+void sm3_tree_file_root(const uint8_t* page_digests, uint64_t pages, int digest_size,
+                        uint64_t size, uint8_t* root) {
+    sm3_ctx_t ctx;
+    uint8_t le_size[8];
+    for (int i = 0; i < 8; i++) {
+        le_size[i] = (uint8_t)(size >> (i * 8));
+    }
+    sm3_init(&ctx);
+    sm3_update(&ctx, page_digests, pages * (uint64_t)digest_size);
+    sm3_update(&ctx, le_size, 8);
+    sm3_final(&ctx, root);
+}
+
+// ============================================================================
+// 任务队列
+// ============================================================================
+
+static void queue_push_list(tree_ctx_t* ctx, tree_task_t* first, tree_task_t* last, uint64_t n) {
+    if (n == 0) {
+        return;
+    }
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->tail) {
+        ctx->tail->next = first;
+    } else {
+        ctx->head = first;
+    }
+    ctx->tail = last;
+    ctx->outstanding += n;
+    pthread_cond_broadcast(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+static char* join_path(const char* dir, const char* name) {
+    size_t dl = strlen(dir), nl = strlen(name);
+    char* p = malloc(dl + nl + 2);
+    if (!p) {
+        return NULL;
+    }
+    if (dl) {
+        memcpy(p, dir, dl);
+        p[dl++] = '/';
+    }
+    memcpy(p + dl, name, nl + 1);
+    return p;
+}
+
+// ============================================================================
+// 文件完成与小文件批处理
+// ============================================================================
+
+static int64_t statx_ns(const struct statx_timestamp* ts) {
+    return (int64_t)ts->tv_sec * 1000000000ll + ts->tv_nsec;
+}
+
+static void push_done(tree_worker_t* w, file_job_t* f) {
+    free(f->digests);
+    f->digests = NULL;
+    free(f->abs_path);
+    f->abs_path = NULL;
+
+    if (w->done_count == w->done_cap) {
+        size_t cap = w->done_cap ? w->done_cap * 2 : 256;
+        file_job_t** d = realloc(w->done, cap * sizeof(*d));
+        if (!d) {
+            w->stats.errors++;
+            free(f->entry.path);
+            free(f);
+            return;
+        }
+        w->done = d;
+        w->done_cap = cap;
+    }
+    w->done[w->done_count++] = f;
+}
+
+static char* file_abs_path(tree_worker_t* w, file_job_t* f) {
+    if (!f->abs_path) {
+        f->abs_path = join_path(w->ctx->root, f->entry.path);
+    }
+    return f->abs_path;
+}
+
+static void store_xattr(tree_worker_t* w, file_job_t* f) {
+    const char* path = file_abs_path(w, f);
+    if (!path) {
+        return;
+    }
+    tree_xattr_t x;
+    memset(&x, 0, sizeof(x));
+    memcpy(x.magic, TREE_XATTR_MAGIC, 4);
+    x.version = 1;
+    x.digest_size = (uint8_t)w->ctx->digest_size;
+    x.ino = f->entry.ino;
+    x.size = f->entry.size;
+    x.mtime_ns = f->entry.mtime_ns;
+    memcpy(x.root, f->entry.root, 32);
+    if (lsetxattr(path, SM3_TREE_XATTR, &x, sizeof(x), 0) != 0) {
+        return;     // 文件系统不支持或无权限：仅依赖树清单
+    }
+    // 记录写入扩展属性之后的 ctime，下次运行才能与树清单匹配
+    struct statx stx;
+    if (statx(AT_FDCWD, path, AT_SYMLINK_NOFOLLOW, STATX_CTIME, &stx) == 0) {
+        f->entry.ctime_ns = statx_ns(&stx.stx_ctime);
+    }
+}
+
+static int load_xattr(tree_worker_t* w, file_job_t* f, uint8_t* root) {
+    const char* path = file_abs_path(w, f);
+    tree_xattr_t x;
+    if (!path || lgetxattr(path, SM3_TREE_XATTR, &x, sizeof(x)) != (ssize_t)sizeof(x)) {
+        return 0;
+    }
+    if (memcmp(x.magic, TREE_XATTR_MAGIC, 4) != 0 || x.version != 1 ||
+        x.digest_size != w->ctx->digest_size || x.ino != f->entry.ino ||
+        x.size != f->entry.size || x.mtime_ns != f->entry.mtime_ns) {
+        return 0;
+    }
+    memcpy(root, x.root, 32);
+    return 1;
+}
+
+static void finish_file(tree_worker_t* w, file_job_t* f, const uint8_t* digests) {
+    const sm3_tree_opts_t* opts = w->ctx->opts;
+    uint8_t root[32];
+    sm3_tree_file_root(digests, f->entry.pages, w->ctx->digest_size, f->entry.size, root);
+    w->stats.pages += f->entry.pages;
+    w->stats.bytes += f->entry.size;
+
+    if (f->entry.flags & SM3_TREE_SAMPLED) {
+        // 元数据未变但内容不同：保留旧摘要并标记，避免新清单掩盖损坏
+        memcpy(f->entry.root, f->prev_root, 32);
+        if (memcmp(root, f->prev_root, 32) != 0) {
+            f->entry.flags |= SM3_TREE_CORRUPT;
+            w->stats.corrupt++;
+        }
+        push_done(w, f);
+        return;
+    }
+
+    memcpy(f->entry.root, root, 32);
+    if (!f->prev_known || memcmp(root, f->prev_root, 32) != 0) {
+        if (f->prev_known) {
+            f->entry.changes++;
+        }
+        w->stats.changed++;
+    }
+    if (opts->use_xattr) {
+        store_xattr(w, f);
+    }
+    push_done(w, f);
+}
+
+// 按路径哈希与种子决定是否抽样，同一种子下结果可复现
+static int paranoid_pick(const sm3_tree_opts_t* opts, const char* path) {
+    uint64_t h = 0xcbf29ce484222325ull ^ opts->paranoid_seed;
+    for (const char* p = path; *p; p++) {
+        h = (h ^ (uint8_t)*p) * 0x100000001b3ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return (double)(h >> 11) / 9007199254740992.0 < opts->paranoid_ratio;
+}
+
+// 元数据未变化的文件直接沿用旧摘要；返回1表示已完成，无需读取
+static int try_reuse(tree_worker_t* w, file_job_t* f) {
+    const sm3_tree_opts_t* opts = w->ctx->opts;
+    const sm3_tree_entry_t* prev = NULL;
+    if (opts->previous && opts->previous->digest_bits == opts->digest_bits) {
+        prev = sm3_tree_find(opts->previous, f->entry.path);
+    }
+
+    int same = 0;
+    if (prev) {
+        f->prev_known = 1;
+        memcpy(f->prev_root, prev->root, 32);
+        f->entry.changes = prev->changes;
+        same = prev->ino == f->entry.ino && prev->size == f->entry.size &&
+               prev->mtime_ns == f->entry.mtime_ns && prev->ctime_ns == f->entry.ctime_ns;
+    }
+    if (!same && opts->use_xattr && load_xattr(w, f, f->prev_root)) {
+        f->prev_known = 1;
+        same = 1;
+        w->stats.xattr_hits++;
+    }
+    if (!same) {
+        return 0;
+    }
+
+    if (opts->paranoid_ratio > 0 && paranoid_pick(opts, f->entry.path)) {
+        f->entry.flags |= SM3_TREE_SAMPLED;
+        w->stats.sampled++;
+        return 0;
+    }
+
+    memcpy(f->entry.root, f->prev_root, 32);
+    f->entry.flags |= SM3_TREE_UNCHANGED;
+    w->stats.unchanged++;
+    push_done(w, f);
+    return 1;
+}
+
+static void flush_batch(tree_worker_t* w) {
+    if (w->batch_nfiles == 0) {
+        return;
+    }
+    if (w->batch_used > 0) {
+        aes_sm3_integrity_mb(w->in, w->out, w->batch_used, w->ctx->digest_size * 8);
+        w->stats.batches++;
+    }
+    // 批内文件的页摘要在 batch_digests 中按文件顺序连续存放
+    const uint8_t* d = w->batch_digests;
+    for (int i = 0; i < w->batch_nfiles; i++) {
+        file_job_t* f = w->batch_files[i];
+        finish_file(w, f, d);
+        d += f->entry.pages * w->ctx->digest_size;
+    }
+    w->batch_used = 0;
+    w->batch_nfiles = 0;
+}
+
+static int read_small_file(int dirfd, const char* name, uint8_t* dst, uint64_t size) {
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) {
+        return -1;
+    }
+    uint64_t got = 0;
+    while (got < size) {
+        ssize_t n = read(fd, dst + got, size - got);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += (uint64_t)n;
+    }
+    close(fd);
+    uint64_t padded = sm3_pages_for_size(size) * SM3_PAGE_SIZE;
+    memset(dst + got, 0, padded - got);
+    return 0;
+}
+
+static void drop_file(tree_worker_t* w, file_job_t* f) {
+    w->stats.errors++;
+    free(f->digests);
+    free(f->abs_path);
+    free(f->entry.path);
+    free(f);
+}
+
+static void add_small_file(tree_worker_t* w, int dirfd, const char* name, file_job_t* f) {
+    uint64_t size = f->entry.size;
+    int pages = (int)f->entry.pages;
+    if (w->batch_used + pages > (int)w->ctx->opts->batch_pages ||
+        w->batch_nfiles == TREE_MAX_BATCH) {
+        flush_batch(w);
+    }
+
+    uint8_t* dst = w->batch_buf + (size_t)w->batch_used * SM3_PAGE_SIZE;
+    if (pages > 0 && read_small_file(dirfd, name, dst, size) != 0) {
+        drop_file(w, f);
+        return;
+    }
+
+    for (int i = 0; i < pages; i++) {
+        w->in[w->batch_used + i] = dst + (size_t)i * SM3_PAGE_SIZE;
+        w->out[w->batch_used + i] = w->batch_digests +
+                                    (size_t)(w->batch_used + i) * w->ctx->digest_size;
+    }
+    w->batch_used += pages;
+    w->batch_files[w->batch_nfiles++] = f;
+    w->stats.small_files++;
+}
+
+// 大文件拆成页区间任务；区间任务先在本地建好，全部分配成功后才挂到链表。
+// 返回-1时尚未挂出任何任务，由调用方丢弃该文件
+static int add_large_file(tree_worker_t* w, file_job_t* f,
+                          tree_task_t** first, tree_task_t** last, uint64_t* n) {
+    tree_ctx_t* ctx = w->ctx;
+    uint64_t pages = f->entry.pages;
+    f->digests = malloc(pages * ctx->digest_size);
+    if (!f->digests || !file_abs_path(w, f)) {
+        return -1;
+    }
+
+    uint64_t chunk = ctx->opts->chunk_pages;
+    uint64_t chunks = (pages + chunk - 1) / chunk;
+    tree_task_t* head = NULL;
+    tree_task_t* tail = NULL;
+    for (uint64_t p = 0; p < pages; p += chunk) {
+        tree_task_t* t = calloc(1, sizeof(*t));
+        if (!t) {
+            while (head) {
+                tree_task_t* next = head->next;
+                free(head);
+                head = next;
+            }
+            return -1;
+        }
+        t->kind = TASK_CHUNK;
+        t->file = f;
+        t->first_page = p;
+        t->page_count = pages - p < chunk ? pages - p : chunk;
+        if (tail) tail->next = t; else head = t;
+        tail = t;
+    }
+
+    atomic_init(&f->chunks_left, chunks);
+    atomic_init(&f->chunk_failed, 0);
+    if (*last) {
+        (*last)->next = head;
+    } else {
+        *first = head;
+    }
+    *last = tail;
+    *n += chunks;
+    w->stats.large_files++;
+    return 0;
+}
+
+// ============================================================================
+// 任务执行
+// ============================================================================
+
+static void run_dir_task(tree_worker_t* w, const char* rel) {
+    tree_ctx_t* ctx = w->ctx;
+    const sm3_tree_opts_t* opts = ctx->opts;
+    int dirfd = openat(ctx->root_fd, rel[0] ? rel : ".",
+                       O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+    if (dirfd < 0) {
+        w->stats.errors++;
+        return;
+    }
+    w->stats.dirs++;
+
+    // 新发现的子目录与大文件区间先挂在本地链表，每批 getdents64 一次性入队
+    tree_task_t* first = NULL;
+    tree_task_t* last = NULL;
+    uint64_t n = 0;
+
+    for (;;) {
+        long nread = syscall(SYS_getdents64, dirfd, w->dents, TREE_DENTS_BUF);
+        if (nread <= 0) {
+            if (nread < 0) w->stats.errors++;
+            break;
+        }
+        for (long off = 0; off < nread; ) {
+            struct linux_dirent64* d = (struct linux_dirent64*)(w->dents + off);
+            off += d->d_reclen;
+            const char* name = d->d_name;
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+                continue;
+            }
+
+            int is_dir = d->d_type == DT_DIR;
+            struct statx stx;
+            if (!is_dir) {
+                if (d->d_type != DT_REG && d->d_type != DT_UNKNOWN) {
+                    w->stats.filtered++;
+                    continue;
+                }
+                if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                          STATX_TYPE | STATX_SIZE | STATX_INO | STATX_MTIME | STATX_CTIME,
+                          &stx) != 0) {
+                    w->stats.errors++;
+                    continue;
+                }
+                is_dir = S_ISDIR(stx.stx_mode);
+                if (!is_dir && !S_ISREG(stx.stx_mode)) {
+                    w->stats.filtered++;
+                    continue;
+                }
+            }
+
+            char* child = join_path(rel, name);
+            if (!child) {
+                w->stats.errors++;
+                continue;
+            }
+
+            if (is_dir) {
+                tree_task_t* t = calloc(1, sizeof(*t));
+                if (!t) {
+                    free(child);
+                    w->stats.errors++;
+                    continue;
+                }
+                t->kind = TASK_DIR;
+                t->rel_path = child;
+                if (last) last->next = t; else first = t;
+                last = t;
+                n++;
+                continue;
+            }
+
+            uint64_t size = stx.stx_size;
+            if (size < opts->min_size || (opts->max_size && size > opts->max_size)) {
+                free(child);
+                w->stats.filtered++;
+                continue;
+            }
+            file_job_t* f = calloc(1, sizeof(*f));
+            if (!f) {
+                free(child);
+                w->stats.errors++;
+                continue;
+            }
+            f->entry.path = child;
+            f->entry.size = size;
+            f->entry.pages = sm3_pages_for_size(size);
+            f->entry.ino = stx.stx_ino;
+            f->entry.mtime_ns = statx_ns(&stx.stx_mtime);
+            f->entry.ctime_ns = statx_ns(&stx.stx_ctime);
+            if (try_reuse(w, f)) {
+                continue;
+            }
+
+            if (size <= opts->small_max &&
+                sm3_pages_for_size(size) <= opts->batch_pages) {
+                add_small_file(w, dirfd, name, f);
+            } else {
+                if (add_large_file(w, f, &first, &last, &n) != 0) {
+                    drop_file(w, f);
+                }
+            }
+        }
+        queue_push_list(ctx, first, last, n);
+        first = last = NULL;
+        n = 0;
+    }
+    close(dirfd);
+}
+
+static void run_chunk_task(tree_worker_t* w, tree_task_t* t) {
+    tree_ctx_t* ctx = w->ctx;
+    file_job_t* f = t->file;
+    int ds = ctx->digest_size;
+
+    int fd = open(f->abs_path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    uint64_t dummy = 0;
+    if (fd < 0 || sm3_read_pages(fd, w->io_buf, t->first_page, t->page_count,
+                                f->entry.size, &dummy) != 0) {
+        // 不能用占位摘要拼出根摘要：那会写进清单和 xattr，之后被当作未变化沿用
+        atomic_store(&f->chunk_failed, 1);
+    } else {
+        const uint8_t* in[TREE_MAX_BATCH];
+        uint8_t* out[TREE_MAX_BATCH];
+        for (uint64_t done = 0; done < t->page_count; ) {
+            int k = (int)(t->page_count - done < TREE_MAX_BATCH ? t->page_count - done
+                                                               : TREE_MAX_BATCH);
+            for (int i = 0; i < k; i++) {
+                in[i] = w->io_buf + (done + i) * SM3_PAGE_SIZE;
+                out[i] = f->digests + (t->first_page + done + i) * ds;
+            }
+            aes_sm3_integrity_mb(in, out, k, ds * 8);
+            done += (uint64_t)k;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    // 最后完成的区间负责汇总；有区间失败时与读取失败的小文件一样丢弃
+    if (atomic_fetch_sub(&f->chunks_left, 1) == 1) {
+        if (atomic_load(&f->chunk_failed)) {
+            drop_file(w, f);
+        } else {
+            finish_file(w, f, f->digests);
+        }
+    }
+}
+
+// ============================================================================
+// 工作线程与结果汇总
+// ============================================================================
+
+static void* tree_worker_main(void* arg) {
+    tree_worker_t* w = arg;
+    tree_ctx_t* ctx = w->ctx;
+
+    for (;;) {
+        pthread_mutex_lock(&ctx->lock);
+        while (!ctx->head && ctx->outstanding > 0) {
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+        }
+        if (!ctx->head) {
+            pthread_mutex_unlock(&ctx->lock);
+            break;
+        }
+        tree_task_t* t = ctx->head;
+        ctx->head = t->next;
+        if (!ctx->head) {
+            ctx->tail = NULL;
+        }
+        pthread_mutex_unlock(&ctx->lock);
+
+        if (t->kind == TASK_DIR) {
+            run_dir_task(w, t->rel_path);
+            free(t->rel_path);
+        } else {
+            run_chunk_task(w, t);
+        }
+        free(t);
+
+        pthread_mutex_lock(&ctx->lock);
+        if (--ctx->outstanding == 0) {
+            pthread_cond_broadcast(&ctx->cond);
+        }
+        pthread_mutex_unlock(&ctx->lock);
+    }
+
+    flush_batch(w);
+    return NULL;
+}
+
+static int entry_cmp(const void* a, const void* b) {
+    return strcmp(((const sm3_tree_entry_t*)a)->path, ((const sm3_tree_entry_t*)b)->path);
+}
+
+int sm3_tree_scan(const char* root, const sm3_tree_opts_t* opts, sm3_tree_result_t* result) {
+    memset(result, 0, sizeof(*result));
+    uint64_t t_start = sm3_now_ns();
+
+    tree_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.root = root;
+    ctx.opts = opts;
+    ctx.digest_size = opts->digest_bits / 8;
+    ctx.root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (ctx.root_fd < 0) {
+        return -1;
+    }
+    if (opts->batch_pages == 0 || opts->batch_pages > TREE_MAX_BATCH || opts->chunk_pages == 0) {
+        close(ctx.root_fd);
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.cond, NULL);
+
+    tree_task_t* t = calloc(1, sizeof(*t));
+    if (t) {
+        t->kind = TASK_DIR;
+        t->rel_path = strdup("");
+    }
+    if (!t || !t->rel_path) {
+        free(t);
+        close(ctx.root_fd);
+        return -1;
+    }
+    queue_push_list(&ctx, t, t, 1);
+
+    int nthreads = opts->num_threads > 0 ? opts->num_threads : 1;
+    tree_worker_t* workers = calloc((size_t)nthreads, sizeof(tree_worker_t));
+    pthread_t* threads = calloc((size_t)nthreads, sizeof(pthread_t));
+    int started = 0, rc = 0;
+    for (int i = 0; workers && threads && i < nthreads; i++) {
+        tree_worker_t* w = &workers[i];
+        w->ctx = &ctx;
+        w->batch_buf = aligned_alloc(SM3_PAGE_SIZE, (size_t)opts->batch_pages * SM3_PAGE_SIZE);
+        w->batch_digests = malloc((size_t)opts->batch_pages * ctx.digest_size);
+        w->io_buf = aligned_alloc(SM3_PAGE_SIZE, (size_t)opts->chunk_pages * SM3_PAGE_SIZE);
+        w->dents = malloc(TREE_DENTS_BUF);
+        if (!w->batch_buf || !w->batch_digests || !w->io_buf || !w->dents ||
+            pthread_create(&threads[i], NULL, tree_worker_main, w) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        rc = -1;
+        // 没有线程消费队列：在当前线程完成扫描
+        if (workers && workers[0].batch_buf && workers[0].batch_digests &&
+            workers[0].io_buf && workers[0].dents) {
+            tree_worker_main(&workers[0]);
+            started = 1;
+            rc = 0;
+        }
+    } else {
+        for (int i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    // 合并各线程结果与统计
+    size_t total = 0;
+    for (int i = 0; i < started; i++) {
+        total += workers[i].done_count;
+    }
+    result->entries = calloc(total ? total : 1, sizeof(sm3_tree_entry_t));
+    result->digest_bits = opts->digest_bits;
+    for (int i = 0; workers && i < nthreads; i++) {
+        tree_worker_t* w = &workers[i];
+        for (size_t k = 0; k < w->done_count; k++) {
+            if (result->entries) {
+                result->entries[result->count++] = w->done[k]->entry;
+            } else {
+                free(w->done[k]->entry.path);
+            }
+            free(w->done[k]);
+        }
+        result->dirs += w->stats.dirs;
+        result->small_files += w->stats.small_files;
+        result->large_files += w->stats.large_files;
+        result->filtered += w->stats.filtered;
+        result->errors += w->stats.errors;
+        result->bytes += w->stats.bytes;
+        result->pages += w->stats.pages;
+        result->batches += w->stats.batches;
+        result->unchanged += w->stats.unchanged;
+        result->xattr_hits += w->stats.xattr_hits;
+        result->sampled += w->stats.sampled;
+        result->corrupt += w->stats.corrupt;
+        result->changed += w->stats.changed;
+        free(w->done);
+        free(w->batch_buf);
+        free(w->batch_digests);
+        free(w->io_buf);
+        free(w->dents);
+    }
+    if (result->entries) {
+        qsort(result->entries, result->count, sizeof(sm3_tree_entry_t), entry_cmp);
+    } else {
+        rc = -1;
+    }
+
+    free(workers);
+    free(threads);
+    pthread_mutex_destroy(&ctx.lock);
+    pthread_cond_destroy(&ctx.cond);
+    close(ctx.root_fd);
+    result->elapsed_ns = sm3_now_ns() - t_start;
+    return rc;
+}
+
+void sm3_tree_result_free(sm3_tree_result_t* result) {
+    for (size_t i = 0; i < result->count; i++) {
+        free(result->entries[i].path);
+    }
+    free(result->entries);
+    memset(result, 0, sizeof(*result));
+}
+
+// ============================================================================
+// 树清单
+// ============================================================================
+
+// 路径中的反斜杠与换行需转义，保证一行一个文件
+static void write_escaped(FILE* f, const char* s) {
+    for (; *s; s++) {
+        if (*s == '\\') {
+            fputs("\\\\", f);
+        } else if (*s == '\n') {
+            fputs("\\n", f);
+        } else {
+            fputc(*s, f);
+        }
+    }
+}
+
+int sm3_tree_write(const char* path, const sm3_tree_result_t* result) {
+    size_t plen = strlen(path);
+    char* tmp = malloc(plen + 5);
+    if (!tmp) {
+        return -1;
+    }
+    memcpy(tmp, path, plen);
+    memcpy(tmp + plen, ".tmp", 5);
+
+    FILE* f = fopen(tmp, "w");
+    if (!f) {
+        free(tmp);
+        return -1;
+    }
+    fprintf(f, "%s %d digest_bits=%d files=%zu\n", SM3_TREE_MAGIC, SM3_TREE_VERSION,
+            result->digest_bits, result->count);
+    for (size_t i = 0; i < result->count; i++) {
+        const sm3_tree_entry_t* e = &result->entries[i];
+        for (int k = 0; k < 32; k++) {
+            fprintf(f, "%02x", e->root[k]);
+        }
+        fprintf(f, " %llu %llu %lld %lld %llu ", (unsigned long long)e->size,
+                (unsigned long long)e->ino, (long long)e->mtime_ns, (long long)e->ctime_ns,
+                (unsigned long long)e->changes);
+        write_escaped(f, e->path);
+        fputc('\n', f);
+    }
+
+    int rc = 0;
+    if (fflush(f) != 0 || fdatasync(fileno(f)) != 0) {
+        rc = -1;
+    }
+    if (fclose(f) != 0) {
+        rc = -1;
+    }
+    if (rc == 0 && rename(tmp, path) != 0) {
+        rc = -1;
+    }
+    if (rc != 0) {
+        unlink(tmp);
+    }
+    free(tmp);
+    return rc;
+}
+
+static int hex_nibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static char* unescape_path(const char* s, size_t len) {
+    char* out = malloc(len + 1);
+    if (!out) {
+        return NULL;
+    }
+    size_t o = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '\\' && i + 1 < len) {
+            i++;
+            out[o++] = s[i] == 'n' ? '\n' : s[i];
+        } else {
+            out[o++] = s[i];
+        }
+    }
+    out[o] = 0;
+    return out;
+}
+
+// 读取树清单；版本1（无元数据）的条目不会与任何文件匹配，等同全量重算
+int sm3_tree_load(const char* path, sm3_tree_result_t* result) {
+    memset(result, 0, sizeof(*result));
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len = getline(&line, &cap, f);
+    int version = 0;
+    size_t expect = 0;
+    if (len <= 0 || sscanf(line, SM3_TREE_MAGIC " %d digest_bits=%d files=%zu",
+                           &version, &result->digest_bits, &expect) != 3 ||
+        version < 1 || version > SM3_TREE_VERSION) {
+        free(line);
+        fclose(f);
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t alloc = expect ? expect : 16;
+    result->entries = calloc(alloc, sizeof(sm3_tree_entry_t));
+    int rc = result->entries ? 0 : -1;
+    while (rc == 0 && (len = getline(&line, &cap, f)) > 0) {
+        if (line[len - 1] == '\n') {
+            line[--len] = 0;
+        }
+        if (len < 66) {
+            continue;
+        }
+        sm3_tree_entry_t e;
+        memset(&e, 0, sizeof(e));
+        for (int k = 0; k < 32; k++) {
+            int hi = hex_nibble(line[k * 2]), lo = hex_nibble(line[k * 2 + 1]);
+            if (hi < 0 || lo < 0) {
+                rc = -1;
+                break;
+            }
+            e.root[k] = (uint8_t)(hi << 4 | lo);
+        }
+        unsigned long long size = 0, ino = 0, changes = 0;
+        long long mtime = -1, ctime = -1;
+        int consumed = 0;
+        int fields = version >= 2
+            ? sscanf(line + 64, " %llu %llu %lld %lld %llu %n", &size, &ino, &mtime, &ctime,
+                     &changes, &consumed)
+            : sscanf(line + 64, " %llu %n", &size, &consumed);
+        if (rc != 0 || fields != (version >= 2 ? 5 : 1) || consumed == 0) {
+            rc = -1;
+            break;
+        }
+        e.size = size;
+        e.pages = sm3_pages_for_size(size);
+        e.ino = ino;
+        e.mtime_ns = mtime;
+        e.ctime_ns = ctime;
+        e.changes = changes;
+        e.path = unescape_path(line + 64 + consumed, (size_t)len - 64 - (size_t)consumed);
+        if (!e.path) {
+            rc = -1;
+            break;
+        }
+        if (result->count == alloc) {
+            alloc *= 2;
+            sm3_tree_entry_t* n = realloc(result->entries, alloc * sizeof(*n));
+            if (!n) {
+                free(e.path);
+                rc = -1;
+                break;
+            }
+            result->entries = n;
+        }
+        result->entries[result->count++] = e;
+    }
+    free(line);
+    fclose(f);
+
+    if (rc != 0) {
+        sm3_tree_result_free(result);
+        errno = EINVAL;
+        return -1;
+    }
+    qsort(result->entries, result->count, sizeof(sm3_tree_entry_t), entry_cmp);
+    return 0;
+}
+
+const sm3_tree_entry_t* sm3_tree_find(const sm3_tree_result_t* result, const char* path) {
+    sm3_tree_entry_t key;
+    key.path = (char*)path;
+    return bsearch(&key, result->entries, result->count, sizeof(sm3_tree_entry_t), entry_cmp);
+}
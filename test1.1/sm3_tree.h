@@ -0,0 +1,101 @@
+/*
+ * 并行目录树扫描
+ *
+ * 面向海量小文件：耗时主要在元数据系统调用和逐文件的准备工作，而非SM3。
+ *   - 多个工作线程从共享队列取目录，getdents64 大块读取目录项，
+ *     相对目录fd执行 statx / openat，避免重复路径解析
+ *   - statx 得到的大小用于过滤（min_size/max_size）和分流
+ *   - 小文件（<= small_max）整页读入线程本地批缓冲区，凑满后
+ *     一次调用多缓冲区接口 aes_sm3_integrity_mb
+ *   - 大文件按 chunk_pages 拆成页区间任务放回共享队列，由多个线程并行处理
+ *
+ * 文件根摘要 = sm3_hash(各页摘要依次拼接 || 文件大小(小端64位))。
+ * 结果为树清单：每个普通文件一行（根摘要、大小、inode、mtime、ctime、
+ * 变更计数、相对路径）。
+ *
+ * 增量重建：给出上一次的树清单后，(inode, 大小, mtime, ctime) 均未变化的
+ * 文件直接沿用旧摘要，不读取内容；偏执模式下按比例抽样重算这些文件，
+ * 发现"元数据未变但内容已变"的静默损坏。变更计数在每次检测到内容
+ * 变化时加一（statx 未向用户态开放内核的 change cookie）。
+ * 可选把摘要同时存入 user.sm3.digest 扩展属性，没有旧清单时也能跳过。
+ */
+
+#ifndef SM3_TREE_H
+#define SM3_TREE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SM3_TREE_MAGIC    "# sm3tree"
+#define SM3_TREE_VERSION  2
+#define SM3_TREE_XATTR    "user.sm3.digest"
+
+// 条目标志
+#define SM3_TREE_UNCHANGED  0x1     // 元数据未变，沿用旧摘要
+#define SM3_TREE_SAMPLED    0x2     // 偏执模式抽样重算
+#define SM3_TREE_CORRUPT    0x4     // 抽样重算结果与旧摘要不符
+
+typedef struct sm3_tree_result sm3_tree_result_t;
+
+typedef struct {
+    int num_threads;
+    int digest_bits;            // 128 或 256（页摘要长度）
+    uint64_t small_max;         // 不超过此大小的文件按小文件批处理
+    uint64_t min_size;          // 大小过滤：小于 min_size 的文件跳过
+    uint64_t max_size;          // 大小过滤：大于 max_size 的文件跳过（0不限）
+    uint32_t chunk_pages;       // 大文件页区间任务粒度
+    uint32_t batch_pages;       // 小文件多缓冲区批大小（页）
+    // 增量重建
+    const sm3_tree_result_t* previous;  // 上一次的树清单（按路径排序），NULL为全量
+    double paranoid_ratio;      // 偏执模式：未变化文件的抽样重算比例（0关闭）
+    uint64_t paranoid_seed;
+    int use_xattr;              // 读写 user.sm3.digest 扩展属性
+} sm3_tree_opts_t;
+
+typedef struct {
+    char* path;                 // 相对扫描根目录的路径
+    uint64_t size;
+    uint64_t pages;
+    uint64_t ino;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint64_t changes;           // 检测到内容变化的次数
+    uint32_t flags;
+    uint8_t root[32];           // 文件根摘要
+} sm3_tree_entry_t;
+
+struct sm3_tree_result {
+    sm3_tree_entry_t* entries;  // 按路径排序
+    size_t count;
+    int digest_bits;
+    // 统计
+    uint64_t dirs;
+    uint64_t small_files;
+    uint64_t large_files;
+    uint64_t filtered;          // 被大小过滤或非普通文件而跳过
+    uint64_t errors;
+    uint64_t bytes;
+    uint64_t pages;
+    uint64_t batches;           // 小文件多缓冲区批次数
+    uint64_t unchanged;         // 沿用旧摘要的文件数
+    uint64_t xattr_hits;        // 其中由扩展属性确认的文件数
+    uint64_t sampled;           // 偏执模式抽样重算的文件数
+    uint64_t corrupt;           // 抽样发现的静默损坏
+    uint64_t changed;           // 内容发生变化（或新增）的文件数
+    uint64_t elapsed_ns;
+};
+
+void sm3_tree_opts_default(sm3_tree_opts_t* opts);
+int sm3_tree_scan(const char* root, const sm3_tree_opts_t* opts, sm3_tree_result_t* result);
+void sm3_tree_result_free(sm3_tree_result_t* result);
+
+// 计算文件根摘要
+void sm3_tree_file_root(const uint8_t* page_digests, uint64_t pages, int digest_size,
+                        uint64_t size, uint8_t* root);
+
+// 树清单读写（文本格式，原子替换）
+int sm3_tree_write(const char* path, const sm3_tree_result_t* result);
+int sm3_tree_load(const char* path, sm3_tree_result_t* result);
+const sm3_tree_entry_t* sm3_tree_find(const sm3_tree_result_t* result, const char* path);
+
+#endif // SM3_TREE_H
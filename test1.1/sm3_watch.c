@@ -0,0 +1,810 @@
+/*
+ * 事件驱动的增量摘要（目录树监视）
+ *
+ * 待处理文件为相对路径的集合（开放寻址哈希表），同一文件的多次事件只保留
+ * 一项。inotify 的目录删除/移出记入另一个集合，批处理时展开为树清单中该
+ * 目录下的全部文件，逐个确认是否仍然存在。
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sm3_checkpoint.h"
+#include "sm3_manifest.h"
+#include "sm3_pool.h"
+#include "sm3_watch.h"
+
+#define EVENT_BUF       (64 * 1024)
+#define READ_PAGES      256
+#define INOTIFY_MASK    (IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE | \
+                         IN_MOVED_FROM | IN_MOVED_TO)
+#define FANOTIFY_MASK   (FAN_MODIFY | FAN_CLOSE_WRITE | FAN_CREATE | FAN_DELETE | \
+                         FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR)
+
+typedef struct {
+    char** slots;
+    size_t cap;                     // 2的幂
+    size_t count;
+} path_set_t;
+
+struct sm3_watch {
+    char* root;                     // 绝对路径
+    size_t root_len;
+    int root_fd;
+    char* manifest;
+    char* ignore[2];                // 树清单自身及其临时文件（位于树内时）
+    sm3_watch_opts_t opts;
+    int backend;
+    int fd;                         // fanotify 或 inotify 描述符
+    char** wd_dirs;                 // inotify：监视编号 → 相对目录（根为 ""）
+    int wd_cap;
+    path_set_t pending;
+    path_set_t pending_dirs;
+    uint64_t first_ns;              // 当前批次第一个事件的时刻（0 表示无）
+    int rescan;
+    sm3_tree_result_t tree;
+    sm3_pool_t* pool;
+    sm3_watch_stats_t stats;
+};
+
+// ============================================================================
+// 路径集合
+// ============================================================================
+
+static uint64_t path_hash(const char* s) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (; *s; s++) h = (h ^ (uint8_t)*s) * 0x100000001b3ull;
+    return h;
+}
+
+static int set_grow(path_set_t* s) {
+    size_t cap = s->cap ? s->cap * 2 : 64;
+    char** slots = calloc(cap, sizeof(char*));
+    if (!slots) {
+        return -1;
+    }
+    for (size_t i = 0; i < s->cap; i++) {
+        if (!s->slots[i]) continue;
+        size_t h = path_hash(s->slots[i]) & (cap - 1);
+        while (slots[h]) h = (h + 1) & (cap - 1);
+        slots[h] = s->slots[i];
+    }
+    free(s->slots);
+    s->slots = slots;
+    s->cap = cap;
+    return 0;
+}
+
+// 新加入返回1，已存在返回0
+static int set_add(path_set_t* s, const char* path) {
+    if ((s->count + 1) * 2 > s->cap && set_grow(s) != 0) {
+        return -1;
+    }
+    size_t h = path_hash(path) & (s->cap - 1);
+    while (s->slots[h]) {
+        if (strcmp(s->slots[h], path) == 0) {
+            return 0;
+        }
+        h = (h + 1) & (s->cap - 1);
+    }
+    s->slots[h] = strdup(path);
+    if (!s->slots[h]) {
+        return -1;
+    }
+    s->count++;
+    return 1;
+}
+
+// 取出全部路径（调用方释放各字符串与数组），集合清空
+static char** set_take(path_set_t* s, size_t* n) {
+    char** out = malloc((s->count ? s->count : 1) * sizeof(char*));
+    *n = 0;
+    if (!out) {
+        return NULL;
+    }
+    for (size_t i = 0; i < s->cap; i++) {
+        if (s->slots[i]) {
+            out[(*n)++] = s->slots[i];
+            s->slots[i] = NULL;
+        }
+    }
+    s->count = 0;
+    return out;
+}
+
+static void set_free(path_set_t* s) {
+    for (size_t i = 0; i < s->cap; i++) free(s->slots[i]);
+    free(s->slots);
+    memset(s, 0, sizeof(*s));
+}
+
+// ============================================================================
+// 事件
+// ============================================================================
+
+static char* join_rel(const char* dir, const char* name) {
+    size_t dl = strlen(dir), nl = strlen(name);
+    char* p = malloc(dl + nl + 2);
+    if (!p) {
+        return NULL;
+    }
+    if (dl) {
+        memcpy(p, dir, dl);
+        p[dl++] = '/';
+    }
+    memcpy(p + dl, name, nl + 1);
+    return p;
+}
+
+static void mark_pending(sm3_watch_t* w, path_set_t* set, const char* rel) {
+    for (int i = 0; i < 2; i++) {
+        if (w->ignore[i] && strcmp(rel, w->ignore[i]) == 0) return;
+    }
+    w->stats.events++;
+    if (!w->first_ns) {
+        w->first_ns = sm3_now_ns();
+    }
+    if (set_add(set, rel) < 0) {
+        w->rescan = 1;              // 内存不足时退回整树增量重扫
+    }
+}
+
+// 遍历 rel 及其全部子目录：inotify 时逐个建立监视；enqueue 时把其中的普通文件
+// 加入待处理（fanotify 按文件系统标记，只需要 enqueue）
+static int watch_tree(sm3_watch_t* w, const char* rel, int enqueue) {
+    size_t cap = 16, n = 0;
+    char** stack = malloc(cap * sizeof(char*));
+    if (!stack || !(stack[n++] = strdup(rel))) {
+        free(stack);
+        return -1;
+    }
+    int rc = 0;
+    while (n > 0) {
+        char* dir = stack[--n];
+        int dfd = openat(w->root_fd, *dir ? dir : ".", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (dfd < 0 && w->backend == SM3_WATCH_FANOTIFY) {
+            if (errno != ENOENT && errno != ENOTDIR) rc = -1;
+            free(dir);
+            if (rc != 0) break;
+            continue;
+        }
+        int wd = -1;
+        if (w->backend == SM3_WATCH_INOTIFY) {
+            char* abs = join_rel(w->root, dir);
+            wd = abs && dfd >= 0 ? inotify_add_watch(w->fd, abs, INOTIFY_MASK | IN_ONLYDIR |
+                                                     IN_DONT_FOLLOW | IN_EXCL_UNLINK) : -1;
+            free(abs);
+            if (wd < 0) {
+                // 目录已被删除时忽略；监视数达到上限等其他错误返回失败
+                if (dfd >= 0 || (errno != ENOENT && errno != ENOTDIR)) rc = -1;
+                if (dfd >= 0) close(dfd);
+                free(dir);
+                if (rc != 0) break;
+                continue;
+            }
+        }
+        if (wd >= w->wd_cap) {
+            int cap2 = w->wd_cap ? w->wd_cap : 64;
+            while (cap2 <= wd) cap2 *= 2;
+            char** p = realloc(w->wd_dirs, (size_t)cap2 * sizeof(char*));
+            if (!p) {
+                close(dfd);
+                free(dir);
+                rc = -1;
+                break;
+            }
+            memset(p + w->wd_cap, 0, (size_t)(cap2 - w->wd_cap) * sizeof(char*));
+            w->wd_dirs = p;
+            w->wd_cap = cap2;
+        }
+        if (wd >= 0) {
+            // 目录名交给监视表；fanotify 时遍历完由本函数释放
+            free(w->wd_dirs[wd]);
+            w->wd_dirs[wd] = dir;
+        }
+
+        DIR* d = fdopendir(dfd);
+        if (!d) {
+            close(dfd);
+            if (wd < 0) free(dir);
+            continue;
+        }
+        struct dirent* de;
+        while ((de = readdir(d)) != NULL) {
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+            int type = de->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+            if (type != DT_DIR && !(type == DT_REG && enqueue)) continue;
+            char* child = join_rel(dir, de->d_name);
+            if (!child) continue;
+            if (type == DT_REG) {
+                mark_pending(w, &w->pending, child);
+                free(child);
+                continue;
+            }
+            if (n == cap) {
+                char** p = realloc(stack, cap * 2 * sizeof(char*));
+                if (!p) {
+                    free(child);
+                    continue;
+                }
+                stack = p;
+                cap *= 2;
+            }
+            stack[n++] = child;
+        }
+        closedir(d);
+        if (wd < 0) free(dir);
+    }
+    while (n > 0) free(stack[--n]);
+    free(stack);
+    return rc;
+}
+
+// 由事件中的目录句柄得到树内相对目录（根为 ""）；目录已删除或不在树内返回 NULL
+static char* fanotify_dir(sm3_watch_t* w, struct file_handle* fh, char* path) {
+    int dfd = open_by_handle_at(w->root_fd, fh, O_PATH | O_CLOEXEC);
+    if (dfd < 0) {
+        return NULL;
+    }
+    char link[64];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", dfd);
+    ssize_t n = readlink(link, path, PATH_MAX - 1);
+    close(dfd);
+    if (n <= 0 || n < (ssize_t)w->root_len) {
+        return NULL;
+    }
+    path[n] = '\0';
+    if (memcmp(path, w->root, w->root_len) != 0) {
+        return NULL;
+    }
+    if ((size_t)n == w->root_len) {
+        return path + n;
+    }
+    return path[w->root_len] == '/' ? path + w->root_len + 1 : NULL;
+}
+
+static int read_fanotify(sm3_watch_t* w) {
+    static __thread char buf[EVENT_BUF] __attribute__((aligned(8)));
+    static __thread char path[PATH_MAX];
+    for (;;) {
+        ssize_t len = read(w->fd, buf, sizeof(buf));
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN ? 0 : -1;
+        }
+        struct fanotify_event_metadata* md = (struct fanotify_event_metadata*)buf;
+        for (; FAN_EVENT_OK(md, len); md = FAN_EVENT_NEXT(md, len)) {
+            if (md->vers != FANOTIFY_METADATA_VERSION) {
+                errno = EPROTO;
+                return -1;
+            }
+            if (md->mask & FAN_Q_OVERFLOW) {
+                w->rescan = 1;
+                if (!w->first_ns) w->first_ns = sm3_now_ns();
+                continue;
+            }
+            // 事件携带父目录句柄与文件名（FAN_REPORT_DFID_NAME）
+            struct fanotify_event_info_fid* fid = NULL;
+            for (char* p = (char*)md + md->metadata_len; p < (char*)md + md->event_len; ) {
+                struct fanotify_event_info_header* h = (struct fanotify_event_info_header*)p;
+                if (h->len == 0) break;
+                if (h->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+                    fid = (struct fanotify_event_info_fid*)h;
+                }
+                p += h->len;
+            }
+            if (!fid) {
+                continue;
+            }
+            struct file_handle* fh = (struct file_handle*)fid->handle;
+            const char* name = (const char*)fh->f_handle + fh->handle_bytes;
+            // 父目录已被删除：其中文件随目录的删除事件一并处理
+            char* dir = fanotify_dir(w, fh, path);
+            if (!dir || strcmp(name, ".") == 0) {
+                continue;
+            }
+            char* rel = join_rel(dir, name);
+            if (!rel) {
+                w->rescan = 1;
+                continue;
+            }
+            if (md->mask & FAN_ONDIR) {
+                if (md->mask & (FAN_CREATE | FAN_MOVED_TO)) {
+                    // 移入的目录中已有文件，逐个加入待处理
+                    if (watch_tree(w, rel, 1) != 0) w->rescan = 1;
+                } else if (md->mask & (FAN_DELETE | FAN_MOVED_FROM)) {
+                    mark_pending(w, &w->pending_dirs, rel);
+                }
+            } else {
+                mark_pending(w, &w->pending, rel);
+            }
+            free(rel);
+        }
+    }
+}
+
+static int read_inotify(sm3_watch_t* w) {
+    static __thread char buf[EVENT_BUF] __attribute__((aligned(8)));
+    for (;;) {
+        ssize_t len = read(w->fd, buf, sizeof(buf));
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN ? 0 : -1;
+        }
+        for (char* p = buf; p < buf + len; ) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            p += sizeof(*ev) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                w->rescan = 1;
+                if (!w->first_ns) w->first_ns = sm3_now_ns();
+                continue;
+            }
+            if (ev->wd < 0 || ev->wd >= w->wd_cap || !w->wd_dirs[ev->wd]) {
+                continue;
+            }
+            if (ev->mask & IN_IGNORED) {
+                free(w->wd_dirs[ev->wd]);
+                w->wd_dirs[ev->wd] = NULL;
+                continue;
+            }
+            if (!ev->len) {
+                continue;
+            }
+            char* rel = join_rel(w->wd_dirs[ev->wd], ev->name);
+            if (!rel) {
+                w->rescan = 1;
+                continue;
+            }
+            if (ev->mask & IN_ISDIR) {
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    // 新目录：建立监视之前写入的文件也要重算
+                    if (watch_tree(w, rel, 1) != 0) w->rescan = 1;
+                } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    mark_pending(w, &w->pending_dirs, rel);
+                }
+            } else {
+                mark_pending(w, &w->pending, rel);
+            }
+            free(rel);
+        }
+    }
+}
+
+// ============================================================================
+// 重算与树清单更新
+// ============================================================================
+
+typedef struct {
+    char* path;
+    int status;                     // 0 已重算，1 已不存在，-1 读取失败
+    sm3_tree_entry_t e;
+} rehash_t;
+
+typedef struct {
+    sm3_watch_t* w;
+    rehash_t* items;
+    int digest_size;
+} rehash_job_t;
+
+static int64_t ts_ns(const struct timespec* ts) {
+    return (int64_t)ts->tv_sec * 1000000000ll + ts->tv_nsec;
+}
+
+static void rehash_one(rehash_job_t* job, rehash_t* r, uint8_t* buf) {
+    int fd = openat(job->w->root_fd, r->path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        int gone = fd >= 0 || errno == ENOENT || errno == ENOTDIR || errno == ELOOP;
+        r->status = gone ? 1 : -1;
+        if (fd >= 0) close(fd);
+        return;
+    }
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t pages = sm3_pages_for_size(size);
+    uint8_t* digests = malloc(pages ? pages * (uint64_t)job->digest_size : 1);
+    uint64_t bytes = 0;
+    r->status = digests ? 0 : -1;
+    for (uint64_t p = 0; r->status == 0 && p < pages; p += READ_PAGES) {
+        uint64_t n = pages - p < READ_PAGES ? pages - p : READ_PAGES;
+        if (sm3_read_pages(fd, buf, p, n, size, &bytes) != 0) {
+            r->status = -1;
+            break;
+        }
+        sm3_hash_pages(buf, n, digests + p * (uint64_t)job->digest_size, job->digest_size, 1);
+    }
+    close(fd);
+    if (r->status == 0) {
+        r->e.size = size;
+        r->e.pages = pages;
+        r->e.ino = (uint64_t)st.st_ino;
+        r->e.mtime_ns = ts_ns(&st.st_mtim);
+        r->e.ctime_ns = ts_ns(&st.st_ctim);
+        sm3_tree_file_root(digests, pages, job->digest_size, size, r->e.root);
+    }
+    free(digests);
+}
+
+static void rehash_files(void* ctx, size_t begin, size_t end) {
+    rehash_job_t* job = ctx;
+    uint8_t* buf = aligned_alloc(SM3_PAGE_SIZE, (size_t)READ_PAGES * SM3_PAGE_SIZE);
+    for (size_t i = begin; i < end; i++) {
+        if (buf) {
+            rehash_one(job, &job->items[i], buf);
+        } else {
+            job->items[i].status = -1;
+        }
+    }
+    free(buf);
+}
+
+static int entry_cmp(const void* a, const void* b) {
+    return strcmp(((const sm3_tree_entry_t*)a)->path, ((const sm3_tree_entry_t*)b)->path);
+}
+
+// 把重算结果并入树清单（保持按路径排序）
+static int apply_results(sm3_watch_t* w, rehash_t* items, size_t n) {
+    sm3_tree_result_t* t = &w->tree;
+    uint8_t* drop = calloc(t->count ? t->count : 1, 1);
+    sm3_tree_entry_t* grown = realloc(t->entries, (t->count + n + 1) * sizeof(sm3_tree_entry_t));
+    if (!drop || !grown) {
+        free(drop);
+        return -1;
+    }
+    t->entries = grown;
+    size_t old = t->count, added = 0;
+    for (size_t i = 0; i < n; i++) {
+        rehash_t* r = &items[i];
+        sm3_tree_entry_t key;
+        key.path = r->path;
+        sm3_tree_entry_t* e = bsearch(&key, t->entries, old, sizeof(*e), entry_cmp);
+        if (r->status < 0) {
+            w->stats.errors++;
+            continue;
+        }
+        w->stats.rehashed += r->status == 0;
+        if (r->status == 1) {
+            if (e) {
+                drop[e - t->entries] = 1;
+                w->stats.removed++;
+            }
+            continue;
+        }
+        w->stats.bytes += r->e.size;
+        if (e) {
+            if (memcmp(e->root, r->e.root, 32) != 0) {
+                e->changes++;
+                w->stats.changed++;
+            }
+            r->e.path = e->path;
+            r->e.changes = e->changes;
+            r->e.flags = e->flags;
+            *e = r->e;
+            continue;
+        }
+        r->e.path = r->path;
+        r->path = NULL;             // 转交给树清单
+        t->entries[old + added++] = r->e;
+        w->stats.added++;
+        w->stats.changed++;
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < old + added; i++) {
+        if (i < old && drop[i]) {
+            free(t->entries[i].path);
+            continue;
+        }
+        t->entries[k++] = t->entries[i];
+    }
+    t->count = k;
+    free(drop);
+    if (added) {
+        qsort(t->entries, t->count, sizeof(sm3_tree_entry_t), entry_cmp);
+    }
+    return 0;
+}
+
+// 删除 ignore 中的条目（初始扫描与重扫会把树内的树清单本身也扫进去）
+static void drop_ignored(sm3_watch_t* w) {
+    for (int i = 0; i < 2; i++) {
+        if (!w->ignore[i]) continue;
+        sm3_tree_entry_t key;
+        key.path = w->ignore[i];
+        sm3_tree_entry_t* e = bsearch(&key, w->tree.entries, w->tree.count, sizeof(*e), entry_cmp);
+        if (!e) continue;
+        free(e->path);
+        size_t idx = (size_t)(e - w->tree.entries);
+        memmove(e, e + 1, (w->tree.count - idx - 1) * sizeof(*e));
+        w->tree.count--;
+    }
+}
+
+static int tree_rescan(sm3_watch_t* w, const sm3_tree_result_t* previous) {
+    sm3_tree_opts_t topts;
+    sm3_tree_opts_default(&topts);
+    if (w->opts.num_threads > 0) topts.num_threads = w->opts.num_threads;
+    topts.digest_bits = previous ? previous->digest_bits : w->opts.digest_bits;
+    topts.previous = previous;
+    sm3_tree_result_t fresh;
+    if (sm3_tree_scan(w->root, &topts, &fresh) != 0) {
+        return -1;
+    }
+    sm3_tree_result_free(&w->tree);
+    w->tree = fresh;
+    drop_ignored(w);
+    return 0;
+}
+
+int sm3_watch_flush(sm3_watch_t* w) {
+    if (!w->first_ns) {
+        return 0;
+    }
+    uint64_t t0 = sm3_now_ns();
+    w->first_ns = 0;
+    w->stats.batches++;
+    int rc = 0, done = 0;
+    if (w->rescan) {
+        // 事件可能丢失：以当前树清单为基准增量重扫
+        w->rescan = 0;
+        set_free(&w->pending);
+        set_free(&w->pending_dirs);
+        sm3_tree_result_t previous = w->tree;
+        memset(&w->tree, 0, sizeof(w->tree));
+        rc = tree_rescan(w, &previous);
+        if (rc == 0) {
+            sm3_tree_result_free(&previous);
+            w->stats.rescans++;
+            w->stats.changed += w->tree.changed;
+            done = (int)w->tree.changed;
+        } else {
+            w->tree = previous;
+        }
+    } else {
+        // 删除/移出的目录：其下已知文件逐个确认
+        size_t nd;
+        char** dirs = set_take(&w->pending_dirs, &nd);
+        for (size_t i = 0; dirs && i < nd; i++) {
+            size_t dl = strlen(dirs[i]);
+            for (size_t k = 0; k < w->tree.count; k++) {
+                const char* p = w->tree.entries[k].path;
+                if (strncmp(p, dirs[i], dl) == 0 && p[dl] == '/') set_add(&w->pending, p);
+            }
+            free(dirs[i]);
+        }
+        free(dirs);
+
+        size_t n;
+        char** paths = set_take(&w->pending, &n);
+        rehash_t* items = calloc(n ? n : 1, sizeof(rehash_t));
+        if (!paths || !items) {
+            rc = -1;
+            errno = ENOMEM;
+        } else {
+            for (size_t i = 0; i < n; i++) items[i].path = paths[i];
+            rehash_job_t job = { w, items, w->tree.digest_bits / 8 };
+            sm3_pool_run(w->pool, rehash_files, &job, n, 1);
+            rc = apply_results(w, items, n);
+            done = (int)n;
+        }
+        for (size_t i = 0; items && i < n; i++) free(items[i].path);
+        if (!items && paths) {
+            for (size_t i = 0; i < n; i++) free(paths[i]);
+        }
+        free(items);
+        free(paths);
+    }
+    if (rc == 0 && sm3_tree_write(w->manifest, &w->tree) != 0) {
+        rc = -1;
+    }
+    w->stats.hash_ns += sm3_now_ns() - t0;
+    return rc == 0 ? done : -1;
+}
+
+// ============================================================================
+// 监视器
+// ============================================================================
+
+void sm3_watch_opts_default(sm3_watch_opts_t* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->digest_bits = 256;
+    opts->window_ms = 500;
+    opts->backend = SM3_WATCH_AUTO;
+}
+
+static int open_fanotify(sm3_watch_t* w) {
+    // 标记整个文件系统并报告目录与文件名：挂载点标记收不到建立、删除与改名，
+    // 写临时文件再改名覆盖的原子保存会被漏掉。需要 Linux 5.9
+    int fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME,
+                           O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFY_MASK,
+                      AT_FDCWD, w->root) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    w->fd = fd;
+    w->backend = SM3_WATCH_FANOTIFY;
+    return 0;
+}
+
+static int open_inotify(sm3_watch_t* w) {
+    w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->fd < 0) {
+        return -1;
+    }
+    w->backend = SM3_WATCH_INOTIFY;
+    return watch_tree(w, "", 0);
+}
+
+// 树清单位于树内时记下其相对路径，忽略自身的写入
+static void set_ignore(sm3_watch_t* w, const char* manifest) {
+    const char* slash = strrchr(manifest, '/');
+    char dir[PATH_MAX], real[PATH_MAX];
+    if (slash) {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - manifest), manifest);
+    } else {
+        snprintf(dir, sizeof(dir), ".");
+    }
+    if (!realpath(*dir ? dir : "/", real)) {
+        return;
+    }
+    size_t rl = strlen(real);
+    const char* base = slash ? slash + 1 : manifest;
+    if (rl == w->root_len && memcmp(real, w->root, rl) == 0) {
+        w->ignore[0] = strdup(base);
+    } else if (rl > w->root_len && memcmp(real, w->root, w->root_len) == 0 && real[w->root_len] == '/') {
+        w->ignore[0] = join_rel(real + w->root_len + 1, base);
+    }
+    if (w->ignore[0]) {
+        w->ignore[1] = malloc(strlen(w->ignore[0]) + 5);
+        if (w->ignore[1]) sprintf(w->ignore[1], "%s.tmp", w->ignore[0]);
+    }
+}
+
+sm3_watch_t* sm3_watch_open(const char* root, const char* tree_manifest, const sm3_watch_opts_t* opts) {
+    sm3_watch_t* w = calloc(1, sizeof(*w));
+    if (!w) {
+        return NULL;
+    }
+    sm3_watch_opts_default(&w->opts);
+    if (opts) w->opts = *opts;
+    w->fd = w->root_fd = -1;
+    w->root = realpath(root, NULL);
+    w->manifest = strdup(tree_manifest);
+    if (!w->root || !w->manifest) {
+        goto fail;
+    }
+    w->root_len = strlen(w->root);
+    if (strcmp(w->root, "/") == 0) {
+        w->root_len = 0;            // 路径前缀比较时根目录视为空串
+    }
+    w->root_fd = open(w->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (w->root_fd < 0) {
+        goto fail;
+    }
+    set_ignore(w, tree_manifest);
+
+    // 先订阅，再做初始扫描，扫描期间的写入不会遗漏
+    int rc = -1;
+    if (w->opts.backend != SM3_WATCH_INOTIFY) {
+        rc = open_fanotify(w);
+    }
+    if (rc != 0 && w->opts.backend != SM3_WATCH_FANOTIFY) {
+        rc = open_inotify(w);
+    }
+    if (rc != 0) {
+        goto fail;
+    }
+
+    sm3_tree_result_t previous;
+    int have_previous = sm3_tree_load(tree_manifest, &previous) == 0;
+    rc = tree_rescan(w, have_previous ? &previous : NULL);
+    if (have_previous) {
+        sm3_tree_result_free(&previous);
+    }
+    w->pool = rc == 0 ? sm3_pool_create(w->opts.num_threads) : NULL;
+    if (!w->pool || sm3_tree_write(w->manifest, &w->tree) != 0) {
+        goto fail;
+    }
+    return w;
+
+fail:
+    {
+        int err = errno;
+        sm3_watch_close(w);
+        errno = err ? err : EINVAL;
+    }
+    return NULL;
+}
+
+void sm3_watch_close(sm3_watch_t* w) {
+    if (!w) {
+        return;
+    }
+    if (w->fd >= 0) close(w->fd);
+    if (w->root_fd >= 0) close(w->root_fd);
+    for (int i = 0; i < w->wd_cap; i++) free(w->wd_dirs[i]);
+    free(w->wd_dirs);
+    set_free(&w->pending);
+    set_free(&w->pending_dirs);
+    sm3_tree_result_free(&w->tree);
+    sm3_pool_destroy(w->pool);
+    free(w->ignore[0]);
+    free(w->ignore[1]);
+    free(w->manifest);
+    free(w->root);
+    free(w);
+}
+
+const char* sm3_watch_backend(const sm3_watch_t* w) {
+    return w->backend == SM3_WATCH_FANOTIFY ? "fanotify" : "inotify";
+}
+
+int sm3_watch_fd(const sm3_watch_t* w) {
+    return w->fd;
+}
+
+int sm3_watch_next_timeout(const sm3_watch_t* w) {
+    if (!w->first_ns) {
+        return -1;
+    }
+    uint64_t due = w->first_ns + (uint64_t)w->opts.window_ms * 1000000ull;
+    uint64_t now = sm3_now_ns();
+    return now >= due ? 0 : (int)((due - now + 999999) / 1000000);
+}
+
+int sm3_watch_process(sm3_watch_t* w) {
+    int rc = w->backend == SM3_WATCH_FANOTIFY ? read_fanotify(w) : read_inotify(w);
+    if (rc != 0) {
+        return -1;
+    }
+    return sm3_watch_next_timeout(w) == 0 ? sm3_watch_flush(w) : 0;
+}
+
+int sm3_watch_poll(sm3_watch_t* w, int timeout_ms) {
+    int next = sm3_watch_next_timeout(w);
+    if (next >= 0 && (timeout_ms < 0 || next < timeout_ms)) {
+        timeout_ms = next;
+    }
+    struct pollfd pfd = { w->fd, POLLIN, 0 };
+    if (poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR) {
+        return -1;
+    }
+    return sm3_watch_process(w);
+}
+
+int sm3_watch_run(sm3_watch_t* w, volatile sig_atomic_t* stop) {
+    while (!*stop) {
+        if (sm3_watch_poll(w, 1000) < 0) {
+            return -1;
+        }
+    }
+    return sm3_watch_flush(w) < 0 ? -1 : 0;
+}
+
+const sm3_tree_result_t* sm3_watch_tree(const sm3_watch_t* w) {
+    return &w->tree;
+}
+
+void sm3_watch_stats(const sm3_watch_t* w, sm3_watch_stats_t* out) {
+    *out = w->stats;
+}
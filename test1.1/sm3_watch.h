@@ -0,0 +1,79 @@
+/*
+ * 事件驱动的增量摘要（目录树监视）
+ *
+ * 定时全树重扫即使只比对元数据也要遍历整棵树，两次扫描之间的修改在下一次
+ * 扫描前没有有效摘要。监视器订阅文件系统的写事件，只重算被修改的文件，
+ * 开销与写入量成正比：
+ *   - fanotify（需 CAP_SYS_ADMIN，Linux 5.9+）：在根目录所在文件系统上订阅写入、
+ *     建立、删除与改名（FAN_REPORT_DFID_NAME），事件携带父目录句柄与文件名，
+ *     按路径过滤出树内文件；写临时文件再改名覆盖的原子保存由 FAN_MOVED_TO 感知
+ *   - inotify（无特权或内核不支持时的回退）：每个目录一个监视，新建/移入的目录
+ *     自动加入；同样感知删除、移出与改名覆盖
+ *   - 同一文件的多次事件在合并窗口内去重：窗口从批次的第一个事件开始计时，
+ *     到期后批次内文件由线程池并行重算，更新树清单（sm3_tree.h）并原子替换
+ *   - 重算时文件已不存在（或不再是普通文件）则从树清单删除
+ *   - 事件队列溢出时下一批改为对整棵树增量重扫（元数据未变的文件沿用摘要）
+ *
+ * 打开时先建立订阅，再以已有树清单为基准增量扫描一次，补上未监视期间的
+ * 修改；树清单不存在时全量扫描。树清单位于树内时，其自身的写入被忽略。
+ */
+
+#ifndef SM3_WATCH_H
+#define SM3_WATCH_H
+
+#include <signal.h>
+#include <stdint.h>
+
+#include "sm3_tree.h"
+
+enum {
+    SM3_WATCH_AUTO = 0,         // 先尝试 fanotify，无权限时使用 inotify
+    SM3_WATCH_FANOTIFY,
+    SM3_WATCH_INOTIFY
+};
+
+typedef struct {
+    int num_threads;            // 重算与初始扫描的线程数，<= 0 取在线CPU数
+    int digest_bits;            // 树清单不存在时使用：128 或 256
+    uint32_t window_ms;         // 合并窗口
+    int backend;
+} sm3_watch_opts_t;
+
+typedef struct {
+    uint64_t events;            // 树内文件的事件数（合并前）
+    uint64_t batches;
+    uint64_t rehashed;          // 重算的文件数
+    uint64_t changed;           // 其中内容变化的
+    uint64_t added;
+    uint64_t removed;
+    uint64_t errors;            // 读取失败（保留旧摘要）
+    uint64_t bytes;
+    uint64_t rescans;           // 事件队列溢出后的增量重扫次数
+    uint64_t hash_ns;           // 重算与写树清单耗时
+} sm3_watch_stats_t;
+
+typedef struct sm3_watch sm3_watch_t;
+
+void sm3_watch_opts_default(sm3_watch_opts_t* opts);
+// 订阅 root 下的写事件并完成初始扫描；失败返回 NULL（errno）
+sm3_watch_t* sm3_watch_open(const char* root, const char* tree_manifest, const sm3_watch_opts_t* opts);
+void sm3_watch_close(sm3_watch_t* w);
+const char* sm3_watch_backend(const sm3_watch_t* w);
+
+// 供外部事件循环使用：可读时调用 sm3_watch_process；
+// next_timeout 为距当前批次到期的毫秒数，无待处理文件时为 -1
+int sm3_watch_fd(const sm3_watch_t* w);
+int sm3_watch_next_timeout(const sm3_watch_t* w);
+// 非阻塞读取全部事件，批次到期时重算；返回本次重算的文件数，出错返回 -1
+int sm3_watch_process(sm3_watch_t* w);
+// 最多等待 timeout_ms（-1 一直等待）后处理
+int sm3_watch_poll(sm3_watch_t* w, int timeout_ms);
+// 不等窗口到期，立即重算全部待处理文件
+int sm3_watch_flush(sm3_watch_t* w);
+// 循环处理直到 *stop 非0（由信号处理函数设置）
+int sm3_watch_run(sm3_watch_t* w, volatile sig_atomic_t* stop);
+
+const sm3_tree_result_t* sm3_watch_tree(const sm3_watch_t* w);
+void sm3_watch_stats(const sm3_watch_t* w, sm3_watch_stats_t* out);
+
+#endif // SM3_WATCH_H
@@ -18,6 +18,15 @@ extern void aes_sm3_integrity_256bit(const uint8_t* input, uint8_t* output);
 extern void aes_sm3_integrity_128bit(const uint8_t* input, uint8_t* output);
 extern void sha256_4kb(const uint8_t* input, uint8_t* output);
 extern void sm3_4kb(const uint8_t* input, uint8_t* output);
+extern void aes_sm3_integrity_mb(const uint8_t* const* inputs, uint8_t* const* outputs,
+                                 int count, int output_size);
+extern int aes_sm3_integrity_verify_mb(const uint8_t* const* inputs, const uint8_t* const* expected,
+                                       uint8_t* ok, int count, int output_size);
+extern void aes_sm3_integrity_mb_128(const uint8_t* const* inputs, uint8_t* output, int count);
+extern int aes_sm3_integrity_verify_mb_128(const uint8_t* const* inputs, const uint8_t* expected,
+                                           uint8_t* ok, int count);
+extern void aes_sm3_parallel_128(const uint8_t* input, uint8_t* output, int block_count,
+                                 int num_threads);
 
 // 辅助函数：计算汉明距离
 int hamming_distance(const uint8_t* a, const uint8_t* b, int len) {
@@ -274,6 +283,97 @@ int test_comparison() {
     return 1;
 }
 
+// 测试7：多缓冲区批量接口与单页接口一致性
+int test_multi_buffer() {
+    printf("\n=== 测试7: 多缓冲区批量接口测试 ===\n");
+    
+    enum { N = 11 };
+    uint8_t* pages = malloc(N * 4096);
+    uint8_t mb_out[N][32];
+    uint8_t ref[32];
+    const uint8_t* inputs[N];
+    uint8_t* outputs[N];
+    
+    srand(2024);
+    for (int i = 0; i < N * 4096; i++) {
+        pages[i] = rand() % 256;
+    }
+    for (int i = 0; i < N; i++) {
+        inputs[i] = pages + i * 4096;
+        outputs[i] = mb_out[i];
+    }
+    
+    int ok = 1;
+    aes_sm3_integrity_mb(inputs, outputs, N, 256);
+    for (int i = 0; i < N; i++) {
+        aes_sm3_integrity_256bit(inputs[i], ref);
+        if (memcmp(ref, mb_out[i], 32) != 0) {
+            printf("✗ 第%d页256位摘要与单页接口不一致\n", i);
+            ok = 0;
+        }
+    }
+    
+    aes_sm3_integrity_mb(inputs, outputs, N, 128);
+    for (int i = 0; i < N; i++) {
+        aes_sm3_integrity_128bit(inputs[i], ref);
+        if (memcmp(ref, mb_out[i], 16) != 0) {
+            printf("✗ 第%d页128位摘要与单页接口不一致\n", i);
+            ok = 0;
+        }
+    }
+    
+    // 128位紧密输出：批量与多线程接口都按16字节连续写入，且不越界
+    uint8_t dense[N * 16 + 1], dense_par[N * 16 + 1];
+    dense[N * 16] = dense_par[N * 16] = 0xA5;
+    aes_sm3_integrity_mb_128(inputs, dense, N);
+    aes_sm3_parallel_128(pages, dense_par, N, 2);
+    for (int i = 0; i < N; i++) {
+        if (memcmp(dense + i * 16, mb_out[i], 16) != 0 || memcmp(dense_par + i * 16, mb_out[i], 16) != 0) {
+            printf("✗ 第%d页128位紧密输出与单页接口不一致\n", i);
+            ok = 0;
+        }
+    }
+    if (dense[N * 16] != 0xA5 || dense_par[N * 16] != 0xA5) {
+        printf("✗ 128位紧密输出写越界\n");
+        ok = 0;
+    }
+    
+    // 批量校验：篡改两页后应恰好报告这两页
+    const uint8_t* expected[N];
+    uint8_t page_ok[N];
+    for (int i = 0; i < N; i++) {
+        expected[i] = mb_out[i];
+    }
+    pages[2 * 4096 + 5] ^= 1;
+    pages[9 * 4096 + 4095] ^= 0x80;
+    int bad = aes_sm3_integrity_verify_mb(inputs, expected, page_ok, N, 128);
+    for (int i = 0; i < N; i++) {
+        if (page_ok[i] != (i != 2 && i != 9)) {
+            ok = 0;
+        }
+    }
+    if (bad != 2) {
+        printf("✗ 批量校验报告%d页不一致（应为2）\n", bad);
+        ok = 0;
+    }
+    bad = aes_sm3_integrity_verify_mb_128(inputs, dense, page_ok, N);
+    for (int i = 0; i < N; i++) {
+        if (page_ok[i] != (i != 2 && i != 9)) {
+            ok = 0;
+        }
+    }
+    if (bad != 2) {
+        printf("✗ 128位紧密批量校验报告%d页不一致（应为2）\n", bad);
+        ok = 0;
+    }
+    
+    free(pages);
+    if (ok) {
+        printf("✓ 多缓冲区批量接口与单页接口一致 (%d页)\n", N);
+    }
+    return ok;
+}
+
 // 主测试函数
 int main() {
     printf("\n");
@@ -281,7 +381,7 @@ int main() {
     printf("║  AES-SM3完整性校验算法 - 正确性测试套件               ║\n");
     printf("╚═══════════════════════════════════════════════════════════╝\n");
     
-    int total_tests = 6;
+    int total_tests = 7;
     int passed_tests = 0;
     
     passed_tests += test_basic_functionality();
@@ -290,6 +390,7 @@ int main() {
     passed_tests += test_boundary_conditions();
     passed_tests += test_output_sizes();
     passed_tests += test_comparison();
+    passed_tests += test_multi_buffer();
     
     printf("\n");
     printf("═══════════════════════════════════════════════════════════\n");
@@ -0,0 +1,2762 @@
+/*
+ * 扩展模块正确性测试
+ * 测试内容：
+ * 1. 清单生成与校验
+ * 2. 检查点断点续扫
+ * 3. 并行目录树扫描
+ * 4. 增量重建与偏执抽样
+ * 5. 概率抽样校验
+ * 6. LD_PRELOAD 写拦截生成旁路清单
+ * 7. 带完整性标签的页存储
+ * 8. 摘要日志（组提交、重放与压缩）
+ * 9. 边收边验流式编码
+ * 10. 基准语料生成
+ * 11. 基线比较与显著性检验
+ * 12. 时间线追踪导出
+ * 13. 运行指标导出
+ * 14. 慢请求日志
+ * 15. 服务质量调度
+ * 16. 过载自适应校验级别
+ * 17. 重复率分析
+ * 18. MinHash 相似度估计
+ * 19. 事件驱动增量摘要
+ * 20. 带完整性标签的 NBD 服务端
+ * 21. 镜像层流式摘要
+ * 22. 从镜像自动修复
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/xattr.h>
+
+#include "aes_sm3_integrity.h"
+#include "sm3_bao.h"
+#include "sm3_checkpoint.h"
+#include "sm3_corpus.h"
+#include "sm3_dedup.h"
+#include "sm3_journal.h"
+#include "sm3_manifest.h"
+#include "sm3_metrics.h"
+#include "sm3_minhash.h"
+#include "sm3_nbd.h"
+#include "sm3_overload.h"
+#include "sm3_qos.h"
+#include "sm3_repair.h"
+#include "sm3_sample.h"
+#include "sm3_slowlog.h"
+#include "sm3_stats.h"
+#include "sm3_store.h"
+#include "sm3_tar.h"
+#include "sm3_trace.h"
+#include "sm3_tree.h"
+#include "sm3_watch.h"
+
+static char tmp_dir[] = "/tmp/sm3_test_XXXXXX";
+
+static void tmp_path(char* buf, size_t len, const char* name) {
+    snprintf(buf, len, "%s/%s", tmp_dir, name);
+}
+
+// 写入 size 字节的伪随机数据
+static int write_test_file(const char* path, size_t size, unsigned seed) {
+    FILE* f = fopen(path, "wb");
+    if (!f) return -1;
+    srand(seed);
+    for (size_t i = 0; i < size; i++) {
+        fputc(rand() & 0xFF, f);
+    }
+    fclose(f);
+    return 0;
+}
+
+static int files_equal(const char* a, const char* b) {
+    FILE* fa = fopen(a, "rb");
+    FILE* fb = fopen(b, "rb");
+    int equal = fa && fb;
+    while (equal) {
+        int ca = fgetc(fa), cb = fgetc(fb);
+        if (ca != cb) equal = 0;
+        if (ca == EOF || cb == EOF) break;
+    }
+    if (fa) fclose(fa);
+    if (fb) fclose(fb);
+    return equal;
+}
+
+static void count_bad(uint64_t page, void* ctx) {
+    (void)page;
+    (*(int*)ctx)++;
+}
+
+// 测试1：清单生成与校验
+int test_manifest_roundtrip() {
+    printf("\n=== 测试1: 清单生成与校验 ===\n");
+
+    char data[256], manifest[256];
+    tmp_path(data, sizeof(data), "data.bin");
+    tmp_path(manifest, sizeof(manifest), "data.manifest");
+    write_test_file(data, 37 * 4096 + 123, 1);
+
+    sm3_scan_opts_t opts;
+    sm3_scan_opts_default(&opts);
+    opts.chunk_pages = 8;
+    sm3_scan_stats_t stats;
+
+    if (sm3_manifest_build(data, manifest, &opts, &stats) != 0 || stats.pages_total != 38) {
+        printf("✗ 清单生成失败\n");
+        return 0;
+    }
+
+    // 逐页对比清单与直接计算结果（末页补零）
+    sm3_manifest_t m;
+    sm3_manifest_open(&m, manifest, 0);
+    uint8_t page[4096], digest[32];
+    int fd = open(data, O_RDONLY);
+    int ok = 1;
+    for (uint64_t p = 0; p < 38; p++) {
+        memset(page, 0, sizeof(page));
+        pread(fd, page, 4096, (off_t)(p * 4096));
+        aes_sm3_integrity_256bit(page, digest);
+        if (memcmp(digest, sm3_manifest_digest(&m, p), 32) != 0) ok = 0;
+    }
+    close(fd);
+    sm3_manifest_close(&m);
+    if (!ok) {
+        printf("✗ 清单摘要与直接计算不一致\n");
+        return 0;
+    }
+
+    // 篡改第5页一个字节后校验
+    int bad = 0;
+    fd = open(data, O_WRONLY);
+    pwrite(fd, "X", 1, 5 * 4096 + 7);
+    close(fd);
+    sm3_manifest_verify(data, manifest, &opts, &stats, count_bad, &bad);
+    if (stats.mismatches != 1 || bad != 1) {
+        printf("✗ 篡改检测失败: %llu\n", (unsigned long long)stats.mismatches);
+        return 0;
+    }
+
+    // 页数与文件大小不符、摘要区被截断的清单都应拒绝打开，而不是越界访问
+    sm3_manifest_header_t hdr;
+    fd = open(manifest, O_RDWR);
+    pread(fd, &hdr, sizeof(hdr), 0);
+    hdr.page_count = 1ull << 60;
+    pwrite(fd, &hdr, sizeof(hdr), 0);
+    errno = 0;
+    ok = sm3_manifest_verify(data, manifest, &opts, &stats, NULL, NULL) != 0 && errno == EINVAL;
+    hdr.page_count = 38;
+    pwrite(fd, &hdr, sizeof(hdr), 0);
+    ok = ok && ftruncate(fd, SM3_MANIFEST_HEADER_SIZE + 37 * 32) == 0;
+    close(fd);
+    errno = 0;
+    ok = ok && sm3_manifest_verify(data, manifest, &opts, &stats, NULL, NULL) != 0 && errno == EINVAL;
+    if (!ok) {
+        printf("✗ 损坏的清单头未被拒绝\n");
+        return 0;
+    }
+
+    printf("✓ 清单生成与校验测试通过\n");
+    return 1;
+}
+
+// 测试2：检查点断点续扫
+int test_checkpoint_resume() {
+    printf("\n=== 测试2: 检查点断点续扫 ===\n");
+
+    char data[256], full[256], resumed[256], ckpt[256];
+    tmp_path(data, sizeof(data), "big.bin");
+    tmp_path(full, sizeof(full), "full.manifest");
+    tmp_path(resumed, sizeof(resumed), "resumed.manifest");
+    tmp_path(ckpt, sizeof(ckpt), "scan.ckpt");
+    write_test_file(data, 100 * 4096, 2);
+
+    sm3_scan_opts_t opts;
+    sm3_scan_opts_default(&opts);
+    opts.chunk_pages = 7;
+    sm3_scan_stats_t stats;
+    sm3_manifest_build(data, full, &opts, &stats);
+
+    // 分三次运行，每次最多30页，中间状态保存在检查点中
+    opts.checkpoint_path = ckpt;
+    opts.checkpoint_pages = 10;
+    opts.max_pages = 30;
+    int runs = 0, rc;
+    do {
+        rc = sm3_manifest_build(data, resumed, &opts, &stats);
+        runs++;
+        if (rc == 1 && access(ckpt, F_OK) != 0) {
+            printf("✗ 暂停后未写入检查点\n");
+            return 0;
+        }
+    } while (rc == 1 && runs < 10);
+
+    if (rc != 0 || runs != 4 || !stats.resumed || stats.pages_resumed != 90) {
+        printf("✗ 续扫状态异常: rc=%d runs=%d resumed=%llu\n", rc, runs,
+               (unsigned long long)stats.pages_resumed);
+        return 0;
+    }
+    if (access(ckpt, F_OK) == 0) {
+        printf("✗ 完成后检查点未清除\n");
+        return 0;
+    }
+    if (!files_equal(full, resumed)) {
+        printf("✗ 续扫生成的清单与一次性生成的不一致\n");
+        return 0;
+    }
+
+    // 校验任务续扫：已发现的不一致页需在恢复后保留
+    int fd = open(data, O_WRONLY);
+    pwrite(fd, "Y", 1, 3 * 4096);
+    pwrite(fd, "Z", 1, 80 * 4096);
+    close(fd);
+    sm3_manifest_build(data, full, &(sm3_scan_opts_t){ .digest_bits = 256, .chunk_pages = 16 }, &stats);
+    fd = open(data, O_WRONLY);
+    pwrite(fd, "!", 1, 3 * 4096);
+    pwrite(fd, "!", 1, 80 * 4096);
+    close(fd);
+    int bad = 0;
+    opts.max_pages = 50;
+    sm3_manifest_verify(data, full, &opts, &stats, count_bad, &bad);
+    sm3_manifest_verify(data, full, &opts, &stats, count_bad, &bad);
+    if (!stats.complete || stats.mismatches != 2 || bad != 3) {
+        printf("✗ 校验续扫结果异常: mismatches=%llu callbacks=%d\n",
+               (unsigned long long)stats.mismatches, bad);
+        return 0;
+    }
+
+    printf("✓ 检查点断点续扫测试通过 (%d次运行)\n", runs);
+    return 1;
+}
+
+// 按文件内容独立计算根摘要，作为树扫描结果的参照
+static void reference_root(const char* path, uint8_t* root) {
+    FILE* f = fopen(path, "rb");
+    uint8_t page[4096];
+    uint8_t* digests = NULL;
+    uint64_t pages = 0, size = 0;
+    size_t n;
+    while (memset(page, 0, sizeof(page)), (n = fread(page, 1, sizeof(page), f)) > 0) {
+        digests = realloc(digests, (pages + 1) * 32);
+        aes_sm3_integrity_256bit(page, digests + pages * 32);
+        pages++;
+        size += n;
+    }
+    fclose(f);
+    sm3_tree_file_root(digests, pages, 32, size, root);
+    free(digests);
+}
+
+// 测试3：并行目录树扫描
+int test_tree_scan() {
+    printf("\n=== 测试3: 并行目录树扫描 ===\n");
+
+    // 构造目录树：多级子目录 + 空文件/小文件/跨批次文件/大文件
+    char path[256];
+    static const char* dirs[] = { "tree", "tree/a", "tree/a/b", "tree/c" };
+    static const struct { const char* name; size_t size; } files[] = {
+        { "tree/empty", 0 },
+        { "tree/one", 1 },
+        { "tree/a/page", 4096 },
+        { "tree/a/b/small", 10000 },
+        { "tree/a/b/edge", 65536 },
+        { "tree/c/large", 300 * 4096 + 17 },
+        { "tree/c/huge", 1000 * 4096 },
+    };
+    enum { NFILES = sizeof(files) / sizeof(files[0]) };
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        tmp_path(path, sizeof(path), dirs[i]);
+        mkdir(path, 0755);
+    }
+    for (int i = 0; i < 40; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "tree/a/f%02d", i);
+        tmp_path(path, sizeof(path), name);
+        write_test_file(path, (size_t)(i * 997), (unsigned)(100 + i));
+    }
+    for (int i = 0; i < NFILES; i++) {
+        tmp_path(path, sizeof(path), files[i].name);
+        write_test_file(path, files[i].size, (unsigned)(10 + i));
+    }
+    tmp_path(path, sizeof(path), "tree/link");
+    symlink("a", path);
+
+    char root[256];
+    tmp_path(root, sizeof(root), "tree");
+    sm3_tree_opts_t opts;
+    sm3_tree_opts_default(&opts);
+    opts.num_threads = 4;
+    opts.chunk_pages = 64;
+
+    sm3_tree_result_t result;
+    if (sm3_tree_scan(root, &opts, &result) != 0 || result.errors != 0) {
+        printf("✗ 目录树扫描失败\n");
+        return 0;
+    }
+
+    int ok = result.count == 40 + NFILES && result.dirs == 4 && result.large_files == 2 &&
+             result.filtered == 1;
+    for (size_t i = 0; ok && i < result.count; i++) {
+        uint8_t ref[32];
+        snprintf(path, sizeof(path), "%s/%s", root, result.entries[i].path);
+        reference_root(path, ref);
+        if (memcmp(ref, result.entries[i].root, 32) != 0) {
+            printf("✗ %s 根摘要不一致\n", result.entries[i].path);
+            ok = 0;
+        }
+        if (i > 0 && strcmp(result.entries[i - 1].path, result.entries[i].path) >= 0) {
+            ok = 0;
+        }
+    }
+    sm3_tree_result_free(&result);
+
+    // 大小过滤
+    opts.min_size = 1;
+    opts.max_size = 65536;
+    sm3_tree_scan(root, &opts, &result);
+    if (result.count != 39 + 4 || result.large_files != 0) {
+        printf("✗ 大小过滤结果异常: %zu\n", result.count);
+        ok = 0;
+    }
+    sm3_tree_result_free(&result);
+
+    if (ok) {
+        printf("✓ 并行目录树扫描测试通过\n");
+    }
+    return ok;
+}
+
+// 测试4：增量重建与偏执抽样（复用测试3的目录树）
+int test_tree_incremental() {
+    printf("\n=== 测试4: 增量重建与偏执抽样 ===\n");
+
+    char root[256], tree_file[256], path[256];
+    tmp_path(root, sizeof(root), "tree");
+    tmp_path(tree_file, sizeof(tree_file), "tree.sm3");
+
+    sm3_tree_opts_t opts;
+    sm3_tree_opts_default(&opts);
+    opts.num_threads = 2;
+    opts.chunk_pages = 64;
+
+    sm3_tree_result_t first, prev, second;
+    if (sm3_tree_scan(root, &opts, &first) != 0 || sm3_tree_write(tree_file, &first) != 0 ||
+        sm3_tree_load(tree_file, &prev) != 0 || prev.count != first.count) {
+        printf("✗ 树清单写入/读取失败\n");
+        return 0;
+    }
+    int ok = 1;
+    for (size_t i = 0; i < first.count; i++) {
+        const sm3_tree_entry_t* a = &first.entries[i];
+        const sm3_tree_entry_t* b = &prev.entries[i];
+        if (strcmp(a->path, b->path) != 0 || memcmp(a->root, b->root, 32) != 0 ||
+            a->ino != b->ino || a->mtime_ns != b->mtime_ns || a->ctime_ns != b->ctime_ns) {
+            ok = 0;
+        }
+    }
+    sm3_tree_result_free(&first);
+    if (!ok) {
+        printf("✗ 树清单读回内容不一致\n");
+        sm3_tree_result_free(&prev);
+        return 0;
+    }
+
+    // 修改一个文件，其余文件应全部跳过
+    tmp_path(path, sizeof(path), "tree/a/b/small");
+    write_test_file(path, 12000, 77);
+    opts.previous = &prev;
+    sm3_tree_scan(root, &opts, &second);
+    const sm3_tree_entry_t* e = sm3_tree_find(&second, "a/b/small");
+    uint8_t ref[32];
+    reference_root(path, ref);
+    if (second.count != prev.count || second.unchanged != prev.count - 1 ||
+        second.changed != 1 || second.pages != 3 || !e || e->changes != 1 ||
+        memcmp(e->root, ref, 32) != 0) {
+        printf("✗ 增量重建结果异常: unchanged=%llu changed=%llu\n",
+               (unsigned long long)second.unchanged, (unsigned long long)second.changed);
+        ok = 0;
+    }
+    sm3_tree_result_free(&second);
+    sm3_tree_result_free(&prev);
+
+    // 偏执模式：篡改旧清单中的摘要，模拟"元数据未变但内容已变"
+    opts.previous = NULL;
+    sm3_tree_scan(root, &opts, &first);
+    sm3_tree_entry_t* victim = (sm3_tree_entry_t*)sm3_tree_find(&first, "c/large");
+    victim->root[0] ^= 1;
+    opts.previous = &first;
+    opts.paranoid_ratio = 1.0;
+    sm3_tree_scan(root, &opts, &second);
+    e = sm3_tree_find(&second, "c/large");
+    if (second.sampled != second.count || second.corrupt != 1 || !e ||
+        !(e->flags & SM3_TREE_CORRUPT) || memcmp(e->root, victim->root, 32) != 0) {
+        printf("✗ 偏执抽样未发现损坏: sampled=%llu corrupt=%llu\n",
+               (unsigned long long)second.sampled, (unsigned long long)second.corrupt);
+        ok = 0;
+    }
+    sm3_tree_result_free(&second);
+    sm3_tree_result_free(&first);
+
+    // 扩展属性：无旧清单时也能跳过（文件系统不支持时略过）
+    tmp_path(path, sizeof(path), "tree/one");
+    if (lsetxattr(path, "user.sm3.probe", "", 0, 0) == 0) {
+        opts.previous = NULL;
+        opts.paranoid_ratio = 0;
+        opts.use_xattr = 1;
+        sm3_tree_scan(root, &opts, &first);
+        sm3_tree_scan(root, &opts, &second);
+        if (second.xattr_hits != second.count || second.unchanged != second.count) {
+            printf("✗ 扩展属性未生效: hits=%llu\n", (unsigned long long)second.xattr_hits);
+            ok = 0;
+        }
+        sm3_tree_result_free(&first);
+        sm3_tree_result_free(&second);
+    } else {
+        printf("  (文件系统不支持 user 扩展属性，跳过该项)\n");
+    }
+
+    if (ok) {
+        printf("✓ 增量重建与偏执抽样测试通过\n");
+    }
+    return ok;
+}
+
+static void collect_bad(uint64_t page, void* ctx) {
+    uint8_t* hit = ctx;
+    hit[page] = 1;
+}
+
+// 测试5：概率抽样校验
+int test_sampled_verify() {
+    printf("\n=== 测试5: 概率抽样校验 ===\n");
+
+    // 置信上界：0/300 在95%下约为 3/300；1/100 的 Clopper-Pearson 上界约 0.0466
+    double b0 = sm3_sample_upper_bound(300, 0, 0.95);
+    double b1 = sm3_sample_upper_bound(100, 1, 0.95);
+    if (b0 < 0.0099 || b0 > 0.0100 || b1 < 0.0465 || b1 > 0.0467) {
+        printf("✗ 置信上界计算错误: %.5f %.5f\n", b0, b1);
+        return 0;
+    }
+
+    enum { PAGES = 400 };
+    char data[256], manifest[256], state[256];
+    tmp_path(data, sizeof(data), "cold.bin");
+    tmp_path(manifest, sizeof(manifest), "cold.manifest");
+    tmp_path(state, sizeof(state), "cold.sample");
+    write_test_file(data, PAGES * 4096, 5);
+
+    sm3_scan_opts_t scan;
+    sm3_scan_opts_default(&scan);
+    sm3_scan_stats_t scan_stats;
+    sm3_manifest_build(data, manifest, &scan, &scan_stats);
+
+    // 篡改10页
+    uint8_t corrupt[PAGES] = { 0 }, hit[PAGES] = { 0 };
+    int fd = open(data, O_WRONLY);
+    for (int i = 0; i < 10; i++) {
+        int p = i * 37 + 3;
+        corrupt[p] = 1;
+        pwrite(fd, "#", 1, (off_t)p * 4096 + 100);
+    }
+    close(fd);
+
+    sm3_sample_opts_t opts;
+    sm3_sample_opts_default(&opts);
+    opts.fraction = 0.1;
+    opts.seed = 42;
+    opts.confidence = 0.95;
+    opts.state_path = state;
+
+    sm3_sample_stats_t stats;
+    uint64_t mismatches = 0, last_covered = 0;
+    int ok = 1;
+    for (int round = 1; round <= 12 && ok; round++) {
+        if (sm3_sample_verify(data, manifest, &opts, &stats, collect_bad, hit) != 0 ||
+            stats.sampled != 40 || stats.round != (uint64_t)round ||
+            stats.covered < last_covered) {
+            printf("✗ 第%d周期状态异常\n", round);
+            ok = 0;
+        }
+        mismatches += stats.mismatches;
+        last_covered = stats.covered;
+    }
+    for (int p = 0; p < PAGES; p++) {
+        if (hit[p] && !corrupt[p]) ok = 0;
+    }
+    // 按时间加权时12个周期(480次抽样)应覆盖绝大部分页，并发现几乎全部损坏页
+    if (!ok || stats.total_sampled != 480 || stats.total_mismatches != mismatches ||
+        stats.covered < PAGES * 90 / 100 || mismatches < 9 || stats.total_bound < 0.01) {
+        printf("✗ 抽样统计异常: covered=%llu mismatches=%llu\n",
+               (unsigned long long)stats.covered, (unsigned long long)mismatches);
+        return 0;
+    }
+
+    // 均匀抽样同样的周期数覆盖率更低
+    sm3_sample_stats_t uniform;
+    char state2[256];
+    tmp_path(state2, sizeof(state2), "cold.sample.uniform");
+    opts.state_path = state2;
+    opts.weight = SM3_SAMPLE_UNIFORM;
+    for (int round = 1; round <= 12; round++) {
+        sm3_sample_verify(data, manifest, &opts, &uniform, NULL, NULL);
+    }
+    if (uniform.covered >= stats.covered) {
+        printf("✗ 时间加权未提高覆盖率: %llu vs %llu\n",
+               (unsigned long long)stats.covered, (unsigned long long)uniform.covered);
+        return 0;
+    }
+
+    printf("✓ 概率抽样校验测试通过 (覆盖率 %.1f%%, 均匀抽样 %.1f%%)\n",
+           stats.coverage * 100, uniform.coverage * 100);
+    return 1;
+}
+
+// 在 LD_PRELOAD 下运行 shell 命令
+static int run_preloaded(const char* lib, const char* cmd) {
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "LD_PRELOAD=%s sh -c '%s' 2>/dev/null", lib, cmd);
+    return system(buf);
+}
+
+static int sidecar_matches(const char* data, const char* sidecar) {
+    sm3_scan_opts_t opts;
+    sm3_scan_opts_default(&opts);
+    sm3_scan_stats_t stats;
+    return sm3_manifest_verify(data, sidecar, &opts, &stats, NULL, NULL) == 0 &&
+           stats.complete && stats.mismatches == 0;
+}
+
+// 测试6：LD_PRELOAD 写拦截生成旁路清单
+int test_preload_sidecar() {
+    printf("\n=== 测试6: LD_PRELOAD 写拦截 ===\n");
+
+    char lib[4096];
+    if (!realpath("libsm3_preload.so", lib)) {
+        printf("✗ 未找到 libsm3_preload.so（先执行 make tools）\n");
+        return 0;
+    }
+    char data[256], sidecar[256], cmd[768];
+    tmp_path(data, sizeof(data), "legacy.bin");
+    snprintf(sidecar, sizeof(sidecar), "%s.sm3m", data);
+
+    // 新文件：非页对齐的小块顺序写入
+    snprintf(cmd, sizeof(cmd), "dd if=/dev/urandom of=%s bs=1000 count=900 status=none", data);
+    if (run_preloaded(lib, cmd) != 0 || !sidecar_matches(data, sidecar)) {
+        printf("✗ 新文件旁路清单不一致\n");
+        return 0;
+    }
+
+    // 原地改写少量字节：增量更新已有清单
+    snprintf(cmd, sizeof(cmd),
+             "dd if=/dev/urandom of=%s bs=777 seek=300 count=3 conv=notrunc status=none", data);
+    if (run_preloaded(lib, cmd) != 0 || !sidecar_matches(data, sidecar)) {
+        printf("✗ 原地改写后旁路清单不一致\n");
+        return 0;
+    }
+
+    // 越过文件末尾写入（留下空洞）与追加写
+    snprintf(cmd, sizeof(cmd),
+             "dd if=/dev/urandom of=%s bs=4096 seek=400 count=2 conv=notrunc status=none && "
+             "dd if=/dev/urandom bs=100 count=7 status=none >> %s", data, data);
+    if (run_preloaded(lib, cmd) != 0 || !sidecar_matches(data, sidecar)) {
+        printf("✗ 扩展文件后旁路清单不一致\n");
+        return 0;
+    }
+
+    // dup2 替换已跟踪的fd后写入：写入应记到新指向的文件
+    if (system("command -v perl >/dev/null 2>&1") == 0) {
+        char other[256], script[256];
+        tmp_path(other, sizeof(other), "legacy_other.bin");
+        tmp_path(script, sizeof(script), "dup2.pl");
+        FILE* fp = fopen(script, "w");
+        if (!fp) {
+            return 0;
+        }
+        fputs("use POSIX; open(A, \">\", $ARGV[0]); open(B, \"+<\", $ARGV[1]);\n"
+              "syswrite(A, \"x\" x 5000); POSIX::dup2(fileno(B), fileno(A));\n"
+              "syswrite(A, \"y\" x 100);\n", fp);
+        fclose(fp);
+        snprintf(cmd, sizeof(cmd), "perl %s %s %s", script, other, data);
+        if (run_preloaded(lib, cmd) != 0 || !sidecar_matches(data, sidecar)) {
+            printf("✗ dup2 重用fd后旁路清单不一致\n");
+            return 0;
+        }
+
+        // dup 出的fd在原fd关闭后继续写入；fork 出的子进程写入新文件
+        char child[256], child_sidecar[256];
+        tmp_path(child, sizeof(child), "legacy_child.bin");
+        snprintf(child_sidecar, sizeof(child_sidecar), "%s.sm3m", child);
+        unlink(child_sidecar);
+        fp = fopen(script, "w");
+        if (!fp) {
+            return 0;
+        }
+        fputs("open(A, \">\", $ARGV[0]); syswrite(A, \"a\" x 5000);\n"
+              "open(D, \">&\", \\*A); close(A); syswrite(D, \"d\" x 3000);\n"
+              "my $pid = fork(); if ($pid == 0) { open(C, \">\", $ARGV[1]);\n"
+              "  syswrite(C, \"c\" x 9000); close(C); exit 0; }\n"
+              "waitpid($pid, 0); syswrite(D, \"f\" x 200);\n", fp);
+        fclose(fp);
+        snprintf(cmd, sizeof(cmd), "perl %s %s %s", script, data, child);
+        if (run_preloaded(lib, cmd) != 0 || !sidecar_matches(data, sidecar)) {
+            printf("✗ dup 后旁路清单不一致\n");
+            return 0;
+        }
+        if (!sidecar_matches(child, child_sidecar)) {
+            printf("✗ fork 子进程的写入未生成旁路清单\n");
+            return 0;
+        }
+    }
+
+    printf("✓ LD_PRELOAD 写拦截测试通过\n");
+    return 1;
+}
+
+static int store_check(sm3_store_t* st, uint64_t page, uint32_t count, const uint8_t* expect) {
+    uint8_t buf[8 * 4096];
+    return sm3_store_read(st, page, count, buf) == 0 &&
+           memcmp(buf, expect, (size_t)count * 4096) == 0;
+}
+
+static int store_layout_case(int layout, const char* name) {
+    enum { PAGES = 300 };
+    char path[256];
+    tmp_path(path, sizeof(path), name);
+    uint8_t* ref = calloc(PAGES, 4096);
+    for (size_t i = 0; i < (size_t)PAGES * 4096; i++) ref[i] = (uint8_t)(i * 131 + i / 4096);
+
+    sm3_store_opts_t opts;
+    sm3_store_opts_default(&opts);
+    opts.layout = layout;
+    opts.writeback_pages = 64;
+    opts.num_threads = 2;
+    sm3_store_t* st;
+    if (sm3_store_open(&st, path, &opts) != 0) {
+        free(ref);
+        return 0;
+    }
+
+    // 乱序写入，并越过末尾留下空洞（页 200..249 未写入，应读出全零）
+    memset(ref + 200 * 4096, 0, 50 * 4096);
+    int ok = 1;
+    for (int p = 250; p < PAGES && ok; p += 5) ok = sm3_store_write(st, p, 5, ref + p * 4096) == 0;
+    for (int p = 195; p >= 0 && ok; p -= 5) ok = sm3_store_write(st, p, 5, ref + p * 4096) == 0;
+    // 刷新前读取（部分来自写回缓冲区）
+    ok = ok && store_check(st, 0, 8, ref) && store_check(st, 198, 4, ref + 198 * 4096) &&
+         store_check(st, 292, 8, ref + 292 * 4096);
+    ok = ok && sm3_store_flush(st) == 0 && sm3_store_pages(st) == PAGES;
+    ok = ok && store_check(st, 100, 8, ref + 100 * 4096);
+    ok = ok && sm3_store_close(st) == 0;
+
+    // 重新打开并逐页校验
+    ok = ok && sm3_store_open(&st, path, &opts) == 0;
+    for (int p = 0; p < PAGES && ok; p += 4) ok = store_check(st, p, 4, ref + p * 4096);
+    // 第二次读取命中已校验页缓存，不再校验
+    uint64_t verified = ok ? sm3_store_stats(st)->verified_pages : 0;
+    ok = ok && verified == PAGES && store_check(st, 10, 8, ref + 10 * 4096) &&
+         sm3_store_stats(st)->verified_pages == verified && sm3_store_stats(st)->cache_hits >= 8;
+    if (ok) sm3_store_close(st);
+    if (!ok) {
+        printf("✗ %s: 读写结果不一致\n", name);
+        free(ref);
+        return 0;
+    }
+
+    // 篡改数据页（关闭缓存），读取应返回 EBADMSG 并报告该页
+    const int victim = 123;
+    uint64_t off = (uint64_t)victim * 4096 + 7;
+    if (layout == SM3_STORE_TAG_INLINE) {
+        uint64_t per = 4096 / 32;   // 默认256位标签：超级块 + 每区段一个标签页
+        off += 4096 * (1 + victim / per);
+    }
+    int fd = open(path, O_WRONLY);
+    pwrite(fd, "!", 1, (off_t)off);
+    close(fd);
+
+    uint8_t hit[PAGES] = { 0 };
+    opts.cache_pages = 0;
+    opts.on_bad = collect_bad;
+    opts.bad_ctx = hit;
+    uint8_t buf[8 * 4096];
+    st = NULL;
+    errno = 0;
+    ok = sm3_store_open(&st, path, &opts) == 0 &&
+         sm3_store_read(st, 120, 8, buf) == -1 && errno == EBADMSG && hit[victim] &&
+         memcmp(buf, ref + 120 * 4096, 3 * 4096) == 0 &&
+         sm3_store_stats(st)->verify_failures == 1 && store_check(st, 128, 8, ref + 128 * 4096);
+    if (st) sm3_store_close(st);
+    for (int p = 0; p < PAGES; p++) {
+        if (hit[p] && p != victim) ok = 0;
+    }
+    if (!ok) printf("✗ %s: 未检测到篡改页\n", name);
+    free(ref);
+    return ok;
+}
+
+// 测试7：带完整性标签的页存储
+int test_page_store() {
+    printf("\n=== 测试7: 带完整性标签的页存储 ===\n");
+    if (!store_layout_case(SM3_STORE_TAG_FILE, "store.file") ||
+        !store_layout_case(SM3_STORE_TAG_INLINE, "store.inline")) {
+        return 0;
+    }
+    printf("✓ 页存储测试通过 (标签文件 / 内嵌标签页)\n");
+    return 1;
+}
+
+typedef struct {
+    sm3_journal_t* journal;
+    int id;
+    int failed;
+} journal_writer_t;
+
+enum { JNL_PAGES = 64, JNL_WRITERS = 4, JNL_PUTS = 100 };
+
+// 第 id 个线程第 k 次写入的摘要；每页最终值由最后写入该页的线程决定
+static void journal_digest(int id, int k, uint8_t* out) {
+    for (int i = 0; i < 32; i++) out[i] = (uint8_t)(id * 31 + k * 7 + i);
+}
+
+static void* journal_writer(void* arg) {
+    journal_writer_t* w = arg;
+    uint8_t digest[32];
+    for (int k = 0; k < JNL_PUTS; k++) {
+        journal_digest(w->id, k, digest);
+        // 各线程写不相交的页集合，便于核对最终结果
+        uint64_t page = (uint64_t)(k % (JNL_PAGES / JNL_WRITERS)) * JNL_WRITERS + w->id;
+        if (sm3_journal_put(w->journal, page, digest) != 0) {
+            w->failed = 1;
+        }
+    }
+    return NULL;
+}
+
+// 测试8：摘要日志 group commit 与崩溃重放
+int test_digest_journal() {
+    printf("\n=== 测试8: 摘要日志 ===\n");
+
+    char mpath[256], jpath[256];
+    tmp_path(mpath, sizeof(mpath), "jnl.manifest");
+    tmp_path(jpath, sizeof(jpath), "jnl.manifest.jnl");
+
+    sm3_manifest_t m;
+    if (sm3_manifest_create(&m, mpath, 16 * 4096, 32) != 0) {
+        printf("✗ 创建清单失败\n");
+        return 0;
+    }
+    sm3_journal_opts_t opts;
+    sm3_journal_opts_default(&opts);
+    opts.commit_interval_us = 1000;
+    sm3_journal_t* j;
+    if (sm3_journal_open(&j, jpath, &m, &opts) != 0) {
+        printf("✗ 打开日志失败\n");
+        sm3_manifest_close(&m);
+        return 0;
+    }
+
+    // 多线程各自等待提交：同一批内的等待者共享一次 fdatasync
+    pthread_t threads[JNL_WRITERS];
+    journal_writer_t writers[JNL_WRITERS];
+    for (int i = 0; i < JNL_WRITERS; i++) {
+        writers[i] = (journal_writer_t){ j, i, 0 };
+        pthread_create(&threads[i], NULL, journal_writer, &writers[i]);
+    }
+    int ok = 1;
+    for (int i = 0; i < JNL_WRITERS; i++) {
+        pthread_join(threads[i], NULL);
+        if (writers[i].failed) ok = 0;
+    }
+    sm3_journal_stats_t st;
+    sm3_journal_stats(j, &st);
+    uint64_t total = (uint64_t)JNL_WRITERS * JNL_PUTS, commits = st.commits;
+    if (!ok || st.appended != total || st.commits == 0 || st.commits >= total) {
+        printf("✗ group commit 异常: %llu条记录 %llu次提交\n",
+               (unsigned long long)st.appended, (unsigned long long)st.commits);
+        ok = 0;
+    }
+    // 模拟崩溃：记录从未写入清单（调用方的 mmap 修改丢失），且日志尾部有半个批次
+    sm3_journal_close(j);
+    sm3_manifest_close(&m);
+    int fd = open(jpath, O_WRONLY | O_APPEND);
+    write(fd, "SBJ1 torn batch", 15);
+    close(fd);
+
+    uint8_t expect[JNL_PAGES][32];
+    for (int p = 0; p < JNL_PAGES; p++) {
+        int id = p % JNL_WRITERS, slot = p / JNL_WRITERS, last = -1;
+        for (int k = 0; k < JNL_PUTS; k++) {
+            if (k % (JNL_PAGES / JNL_WRITERS) == slot) last = k;
+        }
+        journal_digest(id, last, expect[p]);
+    }
+
+    opts.pool = sm3_pool_create(2);
+    ok = ok && sm3_manifest_open(&m, mpath, 1) == 0 && sm3_journal_open(&j, jpath, &m, &opts) == 0;
+    if (ok) {
+        sm3_journal_stats(j, &st);
+        ok = st.replayed == total && st.truncated_bytes == 15 && m.hdr->page_count == JNL_PAGES;
+        for (int p = 0; ok && p < JNL_PAGES; p++) {
+            ok = memcmp(sm3_manifest_digest(&m, p), expect[p], 32) == 0;
+        }
+        if (!ok) printf("✗ 重放结果不一致\n");
+
+        // 压缩：清单同步后日志清空，再次打开无需重放
+        ok = ok && sm3_journal_compact(j) == 0;
+        sm3_journal_close(j);
+        sm3_manifest_close(&m);
+        ok = ok && sm3_manifest_open(&m, mpath, 1) == 0 &&
+             sm3_journal_open(&j, jpath, &m, &opts) == 0;
+        if (ok) {
+            sm3_journal_stats(j, &st);
+            ok = st.replayed == 0 && st.journal_bytes == 64 &&
+                 memcmp(sm3_manifest_digest(&m, 5), expect[5], 32) == 0;
+            sm3_journal_close(j);
+            sm3_manifest_close(&m);
+        }
+        if (!ok) printf("✗ 日志压缩异常\n");
+    }
+    sm3_pool_destroy(opts.pool);
+    if (!ok) {
+        return 0;
+    }
+
+    // 页存储启用日志：子进程写入并 sync 后直接退出（不关闭、不压缩），
+    // 再清零标签文件模拟未同步的 mmap 修改丢失，重新打开后由日志恢复标签
+    char spath[256], tags[300];
+    tmp_path(spath, sizeof(spath), "jnl.store");
+    snprintf(tags, sizeof(tags), "%s%s", spath, SM3_STORE_TAGS_SUFFIX);
+    sm3_store_opts_t so;
+    sm3_store_opts_default(&so);
+    so.journal = 1;
+    so.sync = 1;
+    uint8_t page[4096], back[4096];
+    sm3_store_t* s = NULL;
+    pid_t pid = fork();
+    if (pid == 0) {
+        int rc = sm3_store_open(&s, spath, &so);
+        for (int p = 0; rc == 0 && p < 40; p++) {
+            memset(page, p, sizeof(page));
+            rc = sm3_store_write(s, p, 1, page);
+        }
+        rc = rc == 0 ? sm3_store_flush(s) : rc;
+        _exit(rc == 0 && sm3_store_stats(s)->journal_commits > 0 ? 0 : 1);
+    }
+    int status = 0;
+    sm3_manifest_t tm;
+    ok = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0 && sm3_manifest_open(&tm, tags, 1) == 0;
+    if (ok) {
+        memset(tm.digests, 0, tm.hdr->page_count * tm.hdr->digest_size);
+        sm3_manifest_sync(&tm);
+        sm3_manifest_close(&tm);
+    }
+    ok = ok && sm3_store_open(&s, spath, &so) == 0 && sm3_store_pages(s) == 40;
+    for (int p = 0; ok && p < 40; p++) {
+        memset(page, p, sizeof(page));
+        ok = sm3_store_read(s, p, 1, back) == 0 && memcmp(page, back, sizeof(page)) == 0;
+    }
+    if (s) sm3_store_close(s);
+    if (!ok) {
+        printf("✗ 页存储日志恢复失败\n");
+        return 0;
+    }
+
+    printf("✓ 摘要日志测试通过 (%llu条记录 / %llu次提交)\n",
+           (unsigned long long)total, (unsigned long long)commits);
+    return 1;
+}
+
+typedef struct {
+    uint8_t* data;
+    size_t len;
+    size_t cap;
+} byte_buf_t;
+
+static int buf_append(void* ctx, const void* data, size_t len) {
+    byte_buf_t* b = ctx;
+    if (b->len + len > b->cap) {
+        b->cap = (b->len + len) * 2;
+        b->data = realloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return 0;
+}
+
+typedef struct {
+    uint8_t* out;
+    uint64_t base;
+    uint64_t next;              // 期望的下一个交付偏移（交付必须按序连续）
+    int disorder;
+} bao_sink_t;
+
+static int bao_collect(void* ctx, uint64_t offset, const void* data, size_t len) {
+    bao_sink_t* k = ctx;
+    if (offset != k->next) k->disorder = 1;
+    memcpy(k->out + (offset - k->base), data, len);
+    k->next = offset + len;
+    return 0;
+}
+
+// 以变化的分块大小送入编码，返回 finish 结果；out 收到区间内数据
+static int bao_decode(const uint8_t* root, const byte_buf_t* enc, uint64_t offset, uint64_t len,
+                      uint8_t* out, uint64_t* delivered, int* disorder) {
+    bao_sink_t sink = { out, offset, offset, 0 };
+    sm3_bao_decoder_t* d;
+    if (sm3_bao_decoder_init(&d, root, offset, len, bao_collect, &sink) != 0) {
+        return -1;
+    }
+    int rc = 0;
+    size_t pos = 0, step = 1;
+    while (rc == 0 && pos < enc->len) {
+        size_t n = enc->len - pos < step ? enc->len - pos : step;
+        rc = sm3_bao_decoder_feed(d, enc->data + pos, n);
+        pos += n;
+        step = step * 3 + 7;
+        if (step > 20000) step = 1;
+    }
+    if (rc == 0) rc = sm3_bao_decoder_finish(d);
+    int err = errno;
+    *delivered = sm3_bao_decoder_stats(d)->bytes_out;
+    *disorder = sink.disorder;
+    sm3_bao_decoder_free(d);
+    errno = err;
+    return rc;
+}
+
+// 测试9：边收边验的流式编码
+int test_verified_stream() {
+    printf("\n=== 测试9: 边收边验流式编码 ===\n");
+
+    const uint64_t size = 37 * 4096 + 1234;     // 非2的幂页数，末页不满
+    char path[256], mpath[256];
+    tmp_path(path, sizeof(path), "stream.bin");
+    tmp_path(mpath, sizeof(mpath), "stream.manifest");
+    write_test_file(path, size, 9);
+    uint8_t* data = malloc(size);
+    uint8_t* out = malloc(size);
+    int fd = open(path, O_RDONLY);
+    if (!data || !out || fd < 0 || read(fd, data, size) != (ssize_t)size) {
+        printf("✗ 准备数据失败\n");
+        return 0;
+    }
+
+    sm3_pool_t* pool = sm3_pool_create(2);
+    sm3_bao_tree_t* tree = NULL;
+    sm3_bao_tree_t* from_manifest = NULL;
+    sm3_scan_opts_t scan;
+    sm3_scan_opts_default(&scan);
+    sm3_scan_stats_t scan_stats;
+    sm3_manifest_t m;
+    uint8_t root[32], root2[32];
+    int ok = sm3_bao_tree_build(&tree, fd, pool) == 0 &&
+             sm3_manifest_build(path, mpath, &scan, &scan_stats) == 0 &&
+             sm3_manifest_open(&m, mpath, 0) == 0;
+    if (ok) {
+        ok = sm3_bao_tree_from_manifest(&from_manifest, &m) == 0;
+        sm3_manifest_close(&m);
+    }
+    if (ok) {
+        sm3_bao_tree_root(tree, root);
+        sm3_bao_tree_root(from_manifest, root2);
+        ok = memcmp(root, root2, 32) == 0;
+    }
+    sm3_bao_tree_free(from_manifest);
+    sm3_pool_destroy(pool);
+    if (!ok) {
+        printf("✗ 建树失败或与清单建树结果不一致\n");
+        close(fd);
+        sm3_bao_tree_free(tree);
+        free(data);
+        free(out);
+        return 0;
+    }
+
+    // 完整编码与若干切片：编码长度与预计一致，解码按序交付原始数据
+    static const uint64_t ranges[][2] = {
+        { 0, SM3_BAO_ALL }, { 0, 1 }, { 4095, 2 }, { 20000, 50000 },
+        { 37 * 4096, SM3_BAO_ALL }, { size - 1, 100 }, { 8192, 4096 },
+    };
+    byte_buf_t enc = { NULL, 0, 0 };
+    for (size_t i = 0; ok && i < sizeof(ranges) / sizeof(ranges[0]); i++) {
+        uint64_t off = ranges[i][0], len = ranges[i][1];
+        uint64_t want = len > size - off ? size - off : len, got;
+        int disorder;
+        enc.len = 0;
+        ok = sm3_bao_encode(tree, fd, off, len, buf_append, &enc) == 0 &&
+             enc.len == sm3_bao_encoded_size(tree, off, len) &&
+             bao_decode(root, &enc, off, len, out, &got, &disorder) == 0 &&
+             got == want && !disorder && memcmp(out, data + off, want) == 0;
+        if (!ok) {
+            printf("✗ 区间 [%llu, +%llu) 编解码失败\n", (unsigned long long)off,
+                   (unsigned long long)len);
+        }
+    }
+
+    // 篡改：数据页与父节点中的摘要都应被发现，且失败前交付的数据正确
+    uint64_t got;
+    int disorder;
+    if (ok) {
+        enc.len = 0;
+        sm3_bao_encode(tree, fd, 0, SM3_BAO_ALL, buf_append, &enc);
+        size_t spots[] = { enc.len - 10, SM3_BAO_HEADER_SIZE + 3, enc.len / 2 };
+        for (size_t i = 0; ok && i < 3; i++) {
+            enc.data[spots[i]] ^= 0x40;
+            errno = 0;
+            ok = bao_decode(root, &enc, 0, SM3_BAO_ALL, out, &got, &disorder) == -1 &&
+                 errno == EBADMSG && memcmp(out, data, got) == 0;
+            enc.data[spots[i]] ^= 0x40;
+        }
+        // 截断的编码流：finish 报告不完整
+        enc.len -= 100;
+        ok = ok && bao_decode(root, &enc, 0, SM3_BAO_ALL, out, &got, &disorder) == -1 &&
+             errno == EPIPE;
+        // 错误的根摘要：首个节点即失败，不交付任何数据
+        root2[0] ^= 1;
+        enc.len += 100;
+        ok = ok && bao_decode(root2, &enc, 0, SM3_BAO_ALL, out, &got, &disorder) == -1 &&
+             got == 0;
+        if (!ok) printf("✗ 未检测到篡改\n");
+    }
+    close(fd);
+    sm3_bao_tree_free(tree);
+    free(enc.data);
+    free(data);
+    free(out);
+    if (!ok) {
+        return 0;
+    }
+    printf("✓ 边收边验流式编码测试通过 (完整编码 + 6个切片)\n");
+    return 1;
+}
+
+int test_bench_corpus() {
+    printf("\n=== 测试10: 基准语料生成 ===\n");
+
+    sm3_corpus_opts_t o;
+    sm3_corpus_opts_default(&o);
+    int ok = sm3_corpus_parse(&o, "zero=10,uniform=5,random=40,text=30,compressed=15,dup=20,seed=42") == 0 &&
+             o.seed == 42 && o.dup_pct == 20 && o.weight[SM3_CORPUS_TEXT] == 30;
+    sm3_corpus_opts_t bad = o;
+    ok = ok && sm3_corpus_parse(&bad, "zero=1,bogus=2") == -1 && errno == EINVAL &&
+         sm3_corpus_parse(&bad, "dup=100") == -1 && sm3_corpus_parse(&bad, "random=0") == -1 &&
+         bad.seed == 42;
+    if (!ok) {
+        printf("✗ 配置串解析错误\n");
+        return 0;
+    }
+
+    // 确定性：线程池并行、串行、逐页、分段生成结果一致
+    const uint64_t n = 4096;
+    uint8_t* a = malloc(n * 4096);
+    uint8_t* b = malloc(n * 4096);
+    sm3_pool_t* pool = sm3_pool_create(3);
+    sm3_corpus_stats_t st;
+    sm3_corpus_fill(&o, pool, 0, n, a, &st);
+    sm3_corpus_fill(&o, NULL, 0, n / 2, b, NULL);
+    sm3_corpus_fill(&o, pool, n / 2, n / 2, b + n / 2 * 4096, NULL);
+    ok = memcmp(a, b, n * 4096) == 0;
+    uint8_t page[4096];
+    for (uint64_t i = 0; ok && i < n; i += 97) {
+        sm3_corpus_page(&o, i, page);
+        ok = memcmp(page, a + i * 4096, 4096) == 0;
+    }
+    if (!ok) {
+        printf("✗ 生成结果与线程数或生成顺序有关\n");
+    }
+
+    // 类型比例与重复比例接近配置；各类型页内容符合其形态
+    static const double expect[SM3_CORPUS_KINDS] = { 10, 5, 40, 30, 15 };
+    for (int k = 0; ok && k < SM3_CORPUS_KINDS; k++) {
+        double pct = st.kind_pages[k] * 100.0 / (double)n;
+        ok = pct > expect[k] - 3 && pct < expect[k] + 3;
+    }
+    double dup_pct = st.dup_pages * 100.0 / (double)n;
+    ok = ok && st.pages == n && dup_pct > 17 && dup_pct < 23;
+    for (uint64_t i = 0; ok && i < n; i++) {
+        const uint8_t* p = a + i * 4096;
+        int dup;
+        int kind = sm3_corpus_page_kind(&o, i, &dup);
+        size_t j = 0;
+        if (kind == SM3_CORPUS_ZERO || kind == SM3_CORPUS_UNIFORM) {
+            while (j < 4096 && p[j] == p[0]) j++;
+            ok = j == 4096 && (kind == SM3_CORPUS_ZERO) == (p[0] == 0);
+        } else if (kind == SM3_CORPUS_TEXT) {
+            while (j < 4096 && (p[j] == '\n' || (p[j] >= 0x20 && p[j] < 0x7f))) j++;
+            ok = j == 4096;
+        }
+    }
+    if (!ok) {
+        printf("✗ 类型/重复比例或页内容形态不符\n");
+    }
+
+    // 每个重复页都与某个更早的页内容相同（单值页的折叠摘要相同，须直接比较内容）
+    for (uint64_t i = 0; ok && i < n; i++) {
+        int dup;
+        sm3_corpus_page_kind(&o, i, &dup);
+        if (!dup) continue;
+        uint64_t j = 0;
+        while (j < i && memcmp(a + j * 4096, a + i * 4096, 4096) != 0) j++;
+        ok = j < i;
+    }
+    if (!ok) {
+        printf("✗ 重复页没有对应的源页\n");
+    }
+
+    // 写文件：内容与内存生成一致，不同种子得到不同语料
+    char path[256];
+    tmp_path(path, sizeof(path), "corpus.img");
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ok = ok && fd >= 0 && sm3_corpus_write(&o, pool, fd, 300, NULL) == 0 &&
+         pread(fd, b, 300 * 4096, 0) == 300 * 4096 && memcmp(a, b, 300 * 4096) == 0;
+    if (fd >= 0) close(fd);
+    o.seed++;
+    sm3_corpus_fill(&o, pool, 0, 64, b, NULL);
+    ok = ok && memcmp(a, b, 64 * 4096) != 0;
+    if (!ok) {
+        printf("✗ 语料文件内容不一致或种子无效\n");
+    }
+
+    sm3_pool_destroy(pool);
+    free(a);
+    free(b);
+    if (!ok) {
+        return 0;
+    }
+    printf("✓ 基准语料生成测试通过 (4096页, 重复 %.1f%%)\n", dup_pct);
+    return 1;
+}
+
+int test_baseline_compare() {
+    printf("\n=== 测试11: 基线比较与显著性检验 ===\n");
+
+    // 精确分布：{1,2,3} 对 {4,5,6}，U = 0，双侧 p = 2/20
+    double a[40], b[40];
+    for (int i = 0; i < 3; i++) {
+        a[i] = i + 1;
+        b[i] = i + 4;
+    }
+    sm3_mwu_t t;
+    int ok = sm3_mann_whitney(a, 3, b, 3, 0.95, &t) == 0 && t.exact && t.u == 0 &&
+             fabs(t.p - 0.1) < 1e-12 && t.shift == 3;
+    // 相同样本：无差异，p = 1
+    ok = ok && sm3_mann_whitney(a, 3, a, 3, 0.95, &t) == 0 && t.p == 1 && t.shift == 0;
+    if (!ok) {
+        printf("✗ 小样本精确检验错误\n");
+        return 0;
+    }
+
+    // 带噪声的测量：3% 的真实变化应被检出且区间覆盖真值，同分布样本不应被判为显著
+    uint64_t x = 12345;
+    for (int i = 0; i < 40; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        double noise = (double)(x % 1000) / 1000.0 - 0.5;     // ±0.5%
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        double noise2 = (double)(x % 1000) / 1000.0 - 0.5;
+        a[i] = 1000 * (1 + noise / 100);
+        b[i] = 1030 * (1 + noise2 / 100);
+    }
+    ok = sm3_mann_whitney(a, 40, b, 40, 0.95, &t) == 0 && !t.exact && t.p < 1e-6 &&
+         t.ci_low < 30 && t.ci_high > 30 && t.ci_low > 0;
+    double p_shift = t.p;
+    ok = ok && sm3_mann_whitney(a, 20, a + 20, 20, 0.95, &t) == 0 && t.p > 0.05 &&
+         t.ci_low < 0 && t.ci_high > 0;
+    // 有结：走正态近似
+    double ta[] = { 1, 2, 2, 3 }, tb[] = { 2, 3, 3, 4 };
+    ok = ok && sm3_mann_whitney(ta, 4, tb, 4, 0.9, &t) == 0 && !t.exact && t.p > 0 && t.p < 1;
+    if (!ok) {
+        printf("✗ 显著性检验或置信区间错误\n");
+        return 0;
+    }
+
+    // 基线文件：保存、读取、同名替换与格式错误
+    char path[256];
+    tmp_path(path, sizeof(path), "baseline.txt");
+    sm3_baseline_t bl, back;
+    sm3_baseline_init(&bl);
+    sm3_baseline_init(&back);
+    ok = sm3_baseline_add(&bl, "mb256/p4096/t1/random=1", a, 40) == 0 &&
+         sm3_baseline_add(&bl, "sm3/p4096/t1/random=1", b, 10) == 0 &&
+         sm3_baseline_add(&bl, "mb256/p4096/t1/random=1", b, 5) == 0 && bl.count == 2 &&
+         sm3_baseline_add(&bl, "bad name", a, 1) == -1 &&
+         sm3_baseline_save(&bl, path) == 0 && sm3_baseline_load(&back, path) == 0 &&
+         back.count == 2;
+    const sm3_baseline_entry_t* e = ok ? sm3_baseline_find(&back, "mb256/p4096/t1/random=1") : NULL;
+    ok = ok && e && e->count == 5 && memcmp(e->samples, b, 5 * sizeof(double)) == 0 &&
+         sm3_baseline_find(&back, "sm3/p4096/t1/random=1") != NULL;
+    FILE* f = fopen(path, "a");
+    if (f) {
+        fputs("truncated 3 1.0 2.0\n", f);
+        fclose(f);
+    }
+    sm3_baseline_free(&back);
+    ok = ok && sm3_baseline_load(&back, path) == -1 && errno == EINVAL;
+    sm3_baseline_free(&bl);
+    sm3_baseline_free(&back);
+    if (!ok) {
+        printf("✗ 基线文件读写错误\n");
+        return 0;
+    }
+    printf("✓ 基线比较测试通过 (3%%变化 p=%.1e)\n", p_shift);
+    return 1;
+}
+
+typedef struct {
+    int jobs;
+    int chunks;
+    int wakes;
+    int names;
+    uint64_t covered;       // chunk 区间长度之和
+} trace_summary_t;
+
+static void touch_chunk(void* ctx, size_t begin, size_t end) {
+    volatile uint8_t* v = ctx;
+    for (size_t i = begin; i < end; i++) v[i]++;
+}
+
+static int read_trace(const char* path, trace_summary_t* sum) {
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    memset(sum, 0, sizeof(*sum));
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long a0, a1;
+        char* args = strstr(line, "\"args\":{\"arg0\":");
+        if (strstr(line, "\"thread_name\"")) sum->names++;
+        if (strstr(line, "{\"name\":\"job\"")) sum->jobs++;
+        if (strstr(line, "{\"name\":\"wake\"")) sum->wakes++;
+        if (strstr(line, "{\"name\":\"chunk\"") && args &&
+            sscanf(args, "\"args\":{\"arg0\":%llu,\"arg1\":%llu", &a0, &a1) == 2) {
+            sum->chunks++;
+            sum->covered += a1 - a0;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+int test_trace_export() {
+    printf("\n=== 测试12: 时间线追踪导出 ===\n");
+
+    char path[256];
+    tmp_path(path, sizeof(path), "trace.json");
+    uint8_t data[4096] = { 0 };
+    sm3_pool_t* pool = sm3_pool_create(3);
+    trace_summary_t sum;
+    sm3_trace_stats_t st;
+
+    // 全部记录：每个作业的切块恰好覆盖 [0, count)，各线程都有名称
+    sm3_trace_start(NULL);
+    for (int i = 0; i < 4; i++) sm3_pool_run(pool, touch_chunk, data, sizeof(data), 64);
+    sm3_trace_stop();
+    int ok = sm3_trace_write(path, &st) == 0 && read_trace(path, &sum) == 0 &&
+             sum.jobs == 4 && sum.covered == 4 * sizeof(data) && sum.chunks == 4 * 64 &&
+             st.dropped == 0 && st.threads >= 1 && (uint32_t)sum.names == st.threads &&
+             sum.wakes <= 4 * 2 && st.events == (uint64_t)(sum.chunks + sum.jobs * 2 + sum.wakes);
+    if (!ok) {
+        printf("✗ 事件与作业不符 (作业 %d, 切块 %d, 覆盖 %llu)\n", sum.jobs, sum.chunks,
+               (unsigned long long)sum.covered);
+    }
+
+    // 抽样：每3个作业记录1个；停止后不再记录
+    sm3_trace_opts_t opts = { 0, 3 };
+    sm3_trace_start(&opts);
+    for (int i = 0; ok && i < 7; i++) sm3_pool_run(pool, touch_chunk, data, sizeof(data), 64);
+    sm3_trace_stop();
+    sm3_pool_run(pool, touch_chunk, data, sizeof(data), 64);
+    ok = ok && sm3_trace_write(path, NULL) == 0 && read_trace(path, &sum) == 0 &&
+         sum.jobs == 3 && sum.covered == 3 * sizeof(data);
+    if (!ok) printf("✗ 作业抽样错误 (记录 %d 个作业)\n", sum.jobs);
+
+    // 缓冲区写满：丢弃并计数，输出仍为完整的 JSON
+    opts.events_per_thread = 8;
+    opts.sample_every = 1;
+    sm3_trace_start(&opts);
+    sm3_pool_run(pool, touch_chunk, data, sizeof(data), 16);
+    sm3_trace_stop();
+    ok = ok && sm3_trace_write(path, &st) == 0 && st.dropped > 0 &&
+         st.events <= 8 * (uint64_t)st.threads;
+    FILE* f = ok ? fopen(path, "r") : NULL;
+    if (f) {
+        char tail[64] = { 0 };
+        fseek(f, -40, SEEK_END);
+        size_t n = fread(tail, 1, sizeof(tail) - 1, f);
+        ok = n > 0 && strstr(tail, "dropped_events") != NULL && strstr(tail, "}}") != NULL;
+        fclose(f);
+    }
+    sm3_pool_destroy(pool);
+    for (size_t i = 0; ok && i < sizeof(data); i++) ok = data[i] == 13;
+    if (!ok) {
+        printf("✗ 缓冲区满时处理错误\n");
+        return 0;
+    }
+    printf("✓ 时间线追踪导出测试通过 (3线程, 抽样 1/3)\n");
+    return 1;
+}
+
+// ============================================================================
+// 测试13: 运行指标导出
+// ============================================================================
+
+typedef struct {
+    sm3_metrics_t* m;
+    int counter;
+    int hist;
+} metrics_worker_t;
+
+static void* metrics_worker(void* arg) {
+    metrics_worker_t* w = arg;
+    for (uint64_t v = 1; v <= 10000; v++) {
+        sm3_metrics_add(w->m, w->counter, 1);
+        sm3_metrics_record(w->m, w->hist, v * 1000);
+    }
+    return NULL;
+}
+
+// 向 127.0.0.1:port 发送 GET 请求，返回状态码，响应正文写入 body
+static int http_get(int port, const char* path, char* body, size_t len) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    char req[128];
+    int n = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", path);
+    size_t got = 0;
+    if (write(fd, req, (size_t)n) == n) {
+        ssize_t r;
+        while (got + 1 < len && (r = read(fd, body + got, len - 1 - got)) > 0) got += (size_t)r;
+    }
+    close(fd);
+    body[got] = 0;
+    int status = -1;
+    if (sscanf(body, "HTTP/1.%*d %d", &status) != 1) return -1;
+    char* p = strstr(body, "\r\n\r\n");
+    if (p) memmove(body, p + 4, strlen(p + 4) + 1);
+    return status;
+}
+
+int test_metrics_export() {
+    printf("\n=== 测试13: 运行指标导出 ===\n");
+
+    sm3_metrics_t* m = sm3_metrics_create();
+    int c = sm3_metrics_counter(m, "test_events_total", "Events");
+    int g = sm3_metrics_gauge(m, "test_depth", "Depth");
+    int h = sm3_metrics_histogram(m, "test_latency_seconds", "Latency", 1e-9);
+    int ok = m && c >= 0 && g >= 0 && h >= 0 &&
+             sm3_metrics_counter(m, "test_events_total", NULL) == c &&
+             sm3_metrics_gauge(m, "test_events_total", NULL) < 0 &&
+             sm3_metrics_counter(m, "bad-name", NULL) < 0;
+    if (!ok) printf("✗ 指标注册错误\n");
+
+    // 4个线程各记录 1..10000 微秒：分片合并后计数精确，分位数误差在分桶精度内
+    enum { THREADS = 4 };
+    pthread_t th[THREADS];
+    metrics_worker_t w = { m, c, h };
+    for (int i = 0; ok && i < THREADS; i++) pthread_create(&th[i], NULL, metrics_worker, &w);
+    for (int i = 0; ok && i < THREADS; i++) pthread_join(th[i], NULL);
+    sm3_metrics_set(m, g, -7);
+    sm3_hist_summary_t hs;
+    ok = ok && sm3_metrics_counter_value(m, c) == THREADS * 10000 &&
+         sm3_metrics_gauge_value(m, g) == -7 && sm3_metrics_hist_summary(m, h, &hs) == 0 &&
+         hs.count == THREADS * 10000 && fabs(hs.p50 / 5e-3 - 1) < 0.02 &&
+         fabs(hs.p99 / 9.9e-3 - 1) < 0.02 && fabs(hs.max / 1e-2 - 1) < 0.02 &&
+         fabs(hs.sum / (THREADS * 50005.0 * 1e-3) - 1) < 1e-9;
+    if (!ok) printf("✗ 合并或分位数错误 (P50 %.6f, P99 %.6f)\n", hs.p50, hs.p99);
+
+    char* text = NULL;
+    ok = ok && sm3_metrics_format(m, &text) > 0 &&
+         strstr(text, "# TYPE test_events_total counter\ntest_events_total 40000\n") &&
+         strstr(text, "test_depth -7\n") && strstr(text, "test_latency_seconds{quantile=\"0.99\"}") &&
+         strstr(text, "test_latency_seconds_count 40000\n") && strstr(text, "test_latency_seconds_max");
+    free(text);
+    if (!ok) printf("✗ Prometheus 文本格式错误\n");
+
+    // HTTP 端点
+    static char body[65536];
+    int port = ok ? sm3_metrics_serve(m, 0) : -1;
+    ok = ok && port > 0 && http_get(port, "/metrics", body, sizeof(body)) == 200 &&
+         strstr(body, "test_events_total 40000") != NULL &&
+         http_get(port, "/other", body, sizeof(body)) == 404;
+    if (!ok) printf("✗ HTTP 端点错误 (端口 %d)\n", port);
+
+    // 页存储：读写请求计入延迟直方图与页数计数器，损坏页计入校验失败
+    char path[256];
+    tmp_path(path, sizeof(path), "metrics.store");
+    sm3_store_opts_t opts;
+    sm3_store_opts_default(&opts);
+    opts.metrics = m;
+    opts.cache_pages = 0;
+    sm3_store_t* st = NULL;
+    uint8_t* buf = malloc(8 * SM3_PAGE_SIZE);
+    for (int i = 0; i < 8 * SM3_PAGE_SIZE; i++) buf[i] = (uint8_t)(i * 7 + i / SM3_PAGE_SIZE);
+    ok = ok && buf && sm3_store_open(&st, path, &opts) == 0 &&
+         sm3_store_write(st, 0, 8, buf) == 0 && sm3_store_flush(st) == 0 &&
+         sm3_store_read(st, 0, 8, buf) == 0 && sm3_store_read(st, 2, 1, buf) == 0;
+    if (ok) {
+        int fd = open(path, O_WRONLY);
+        ok = fd >= 0 && pwrite(fd, "x", 1, 3 * SM3_PAGE_SIZE) == 1;
+        if (fd >= 0) close(fd);
+        ok = ok && sm3_store_read(st, 3, 1, buf) != 0 && errno == EBADMSG;
+    }
+    int rs = sm3_metrics_histogram(m, "sm3_store_read_seconds", NULL, 1e-9);
+    int rp = sm3_metrics_counter(m, "sm3_store_read_pages_total", NULL);
+    int wb = sm3_metrics_counter(m, "sm3_store_write_bytes_total", NULL);
+    int vf = sm3_metrics_counter(m, "sm3_store_verify_failures_total", NULL);
+    ok = ok && sm3_metrics_hist_summary(m, rs, &hs) == 0 && hs.count == 3 && hs.max > 0 &&
+         sm3_metrics_counter_value(m, rp) == 10 &&
+         sm3_metrics_counter_value(m, wb) == 8 * SM3_PAGE_SIZE &&
+         sm3_metrics_counter_value(m, vf) == 1 &&
+         http_get(port, "/metrics", body, sizeof(body)) == 200 &&
+         strstr(body, "sm3_pool_threads 1\n") && strstr(body, "sm3_store_writeback_pages 0\n");
+    if (st) sm3_store_close(st);
+    free(buf);
+    sm3_metrics_destroy(m);
+    if (!ok) {
+        printf("✗ 页存储指标错误\n");
+        return 0;
+    }
+    printf("✓ 运行指标导出测试通过 (%d线程合并, HTTP 端口 %d)\n", THREADS, port);
+    return 1;
+}
+
+// ============================================================================
+// 测试14: 慢请求日志
+// ============================================================================
+
+static int file_contains(const char* path, const char* needle) {
+    static char text[16384];
+    FILE* f = fopen(path, "r");
+    if (!f) return 0;
+    size_t n = fread(text, 1, sizeof(text) - 1, f);
+    fclose(f);
+    text[n] = 0;
+    return strstr(text, needle) != NULL;
+}
+
+int test_slow_request_log() {
+    printf("\n=== 测试14: 慢请求日志 ===\n");
+
+    // 环形缓冲区：写满后覆盖最旧条目，快照按时间顺序
+    sm3_slowlog_t* log = sm3_slowlog_create(4, 0, 0);
+    sm3_slow_entry_t e, out[8];
+    memset(&e, 0, sizeof(e));
+    for (int i = 0; log && i < 6; i++) {
+        e.page = (uint64_t)i;
+        sm3_slowlog_record(log, &e);
+    }
+    int ok = log && sm3_slowlog_count(log) == 6 && sm3_slowlog_snapshot(log, out, 8) == 4 &&
+             out[0].page == 2 && out[3].page == 5 && sm3_slowlog_snapshot(log, out, 2) == 2 &&
+             out[0].page == 4;
+    sm3_slowlog_destroy(log);
+    if (!ok) printf("✗ 环形缓冲区错误\n");
+
+    // 阈值：未超过时不记录
+    log = sm3_slowlog_create(64, 60ull * 1000000000ull, SM3_SLOWLOG_FAULTS);
+    sm3_slow_req_t rq;
+    memset(&e, 0, sizeof(e));
+    sm3_slowlog_begin(log, &rq);
+    ok = ok && log && sm3_slowlog_end(log, &rq, &e) == 0 && sm3_slowlog_count(log) == 0;
+    if (!ok) printf("✗ 阈值判断错误\n");
+
+    // 页存储：阈值为0时每个请求都有条目，阶段耗时与错误码对应请求
+    char path[256], dump[256];
+    tmp_path(path, sizeof(path), "slowlog.store");
+    tmp_path(dump, sizeof(dump), "slowlog.txt");
+    sm3_slowlog_set_threshold(log, 0);
+    sm3_store_opts_t opts;
+    sm3_store_opts_default(&opts);
+    opts.slowlog = log;
+    opts.cache_pages = 0;
+    opts.writeback_pages = 4;
+    sm3_store_t* st = NULL;
+    uint8_t* buf = malloc(8 * SM3_PAGE_SIZE);
+    for (int i = 0; buf && i < 8 * SM3_PAGE_SIZE; i++) buf[i] = (uint8_t)(i * 13 + i / 4096);
+    ok = ok && buf && sm3_store_open(&st, path, &opts) == 0 &&
+         sm3_store_write(st, 0, 6, buf) == 0 && sm3_store_flush(st) == 0 &&
+         sm3_store_read(st, 0, 6, buf) == 0;
+    if (ok) {
+        int fd = open(path, O_WRONLY);
+        ok = fd >= 0 && pwrite(fd, "x", 1, 5 * SM3_PAGE_SIZE + 9) == 1;
+        if (fd >= 0) close(fd);
+        ok = ok && sm3_store_read(st, 5, 1, buf) != 0 && errno == EBADMSG;
+    }
+    size_t n = ok ? sm3_slowlog_snapshot(log, out, 8) : 0;
+    ok = ok && n == 4 &&
+         out[0].op == SM3_SLOW_WRITE && out[0].pages == 6 && out[0].stage_ns[SM3_SLOW_STALL] > 0 &&
+         out[0].stage_ns[SM3_SLOW_TAG] > 0 && out[0].stage_ns[SM3_SLOW_STALL] <= out[0].total_ns &&
+         out[1].op == SM3_SLOW_FLUSH && out[1].pages == 2 && out[1].stage_ns[SM3_SLOW_IO] > 0 &&
+         out[2].op == SM3_SLOW_READ && out[2].error == 0 && out[2].stage_ns[SM3_SLOW_VERIFY] > 0 &&
+         out[3].op == SM3_SLOW_READ && out[3].page == 5 && out[3].error == EBADMSG &&
+         out[3].tid > 0 && out[3].cpu_start >= 0 && out[3].time_ns > 1000000000ull * 1600000000ull;
+    if (!ok) printf("✗ 页存储请求条目错误 (%zu 条)\n", n);
+
+    // 信号触发导出
+    int fd = open(dump, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ok = ok && fd >= 0 && sm3_slowlog_dump_on_signal(log, SIGUSR2, fd) == 0 && raise(SIGUSR2) == 0;
+    sm3_slowlog_dump_on_signal(NULL, SIGUSR2, fd);
+    if (fd >= 0) close(fd);
+    ok = ok && file_contains(dump, "# slowlog: 4 recorded") &&
+         file_contains(dump, " flush page=0 pages=2 ") && file_contains(dump, " errno=74") &&
+         file_contains(dump, " verify_us=");
+    if (st) sm3_store_close(st);
+    sm3_slowlog_destroy(log);
+    free(buf);
+    if (!ok) {
+        printf("✗ 信号导出错误\n");
+        return 0;
+    }
+    printf("✓ 慢请求日志测试通过 (环形覆盖 / 阈值 / 阶段耗时 / 信号导出)\n");
+    return 1;
+}
+
+// ============================================================================
+// 测试15: 服务质量调度
+// ============================================================================
+
+// 按执行顺序记录切块所属的请求（单个工作线程，顺序确定）
+typedef struct {
+    int id;
+    int* order;
+    int* n;
+    atomic_int* gate;           // 非 NULL 时第一个切块等待放行
+} qos_probe_t;
+
+static void qos_probe_chunk(void* ctx, size_t begin, size_t end) {
+    qos_probe_t* p = ctx;
+    (void)begin;
+    (void)end;
+    if (p->gate) {
+        while (!atomic_load(p->gate)) usleep(100);
+    }
+    p->order[(*p->n)++] = p->id;
+}
+
+typedef struct {
+    sm3_qos_t* q;
+    sm3_qos_req_t req;
+} qos_submit_t;
+
+static void* qos_submit_main(void* arg) {
+    qos_submit_t* s = arg;
+    sm3_qos_run(s->q, &s->req);
+    return NULL;
+}
+
+// 等待 n 个请求进入队列
+static void qos_wait_queued(sm3_qos_t* q, uint32_t n) {
+    sm3_qos_stats_t st;
+    for (int i = 0; i < 20000; i++) {
+        sm3_qos_stats(q, &st);
+        if (st.queued >= n) return;
+        usleep(100);
+    }
+}
+
+int test_qos_scheduling() {
+    printf("\n=== 测试15: 服务质量调度 ===\n");
+
+    sm3_metrics_t* m = sm3_metrics_create();
+    sm3_qos_t* q = sm3_qos_create(1, m);
+    int gate_t = sm3_qos_tenant(q, "gate", 1);
+    int a = sm3_qos_tenant(q, "a", 3);
+    int b = sm3_qos_tenant(q, "b", 1);
+    int ok = q && gate_t == 0 && a == 1 && b == 2 && sm3_qos_tenant(q, "a", 3) == a;
+
+    // 唯一的工作线程先被一个阻塞的批量请求占住，其间提交：
+    // 租户 a（权重3）与 b（权重1）各40块的批量请求，截止时间晚/早的两个截止时间类请求
+    static int order[256];
+    int n = 0;
+    atomic_int gate = 0;
+    qos_probe_t pg = { 'G', order, &n, &gate };
+    qos_probe_t pa = { 'A', order, &n, NULL }, pb = { 'B', order, &n, NULL };
+    qos_probe_t pl = { 'L', order, &n, NULL }, pe = { 'E', order, &n, NULL };
+    uint64_t now = sm3_now_ns();
+    qos_submit_t subs[5] = {
+        { q, { qos_probe_chunk, &pg, 1, 1, gate_t, 0 } },
+        { q, { qos_probe_chunk, &pa, 40, 1, a, 0 } },
+        { q, { qos_probe_chunk, &pb, 40, 1, b, 0 } },
+        { q, { qos_probe_chunk, &pl, 2, 1, a, now + 60000000000ull } },
+        { q, { qos_probe_chunk, &pe, 2, 1, b, now + 30000000000ull } },
+    };
+    pthread_t th[5];
+    for (int i = 0; ok && i < 5; i++) {
+        pthread_create(&th[i], NULL, qos_submit_main, &subs[i]);
+        qos_wait_queued(q, i == 0 ? 0 : (uint32_t)i);
+        if (i == 0) usleep(20000);      // 工作线程已领取阻塞切块
+    }
+    atomic_store(&gate, 1);
+    for (int i = 0; ok && i < 5; i++) pthread_join(th[i], NULL);
+
+    // 截止时间类按 EDF 先于全部批量块执行；之后 a:b 按 3:1 交替，直到 a 完成
+    ok = ok && n == 85 && order[0] == 'G' && order[1] == 'E' && order[2] == 'E' &&
+         order[3] == 'L' && order[4] == 'L';
+    int na = 0, nb = 0;
+    for (int i = 5; ok && i < 5 + 40; i++) {
+        na += order[i] == 'A';
+        nb += order[i] == 'B';
+    }
+    ok = ok && na >= 29 && na <= 31 && na + nb == 40;
+    if (!ok) printf("✗ 调度顺序错误 (共 %d 块, 前40个批量块中 a %d / b %d)\n", n, na, nb);
+
+    // 空闲期间不积累额度：b 单独运行一段后，a 重新活跃时两者仍按权重分配
+    n = 0;
+    qos_submit_t solo = { q, { qos_probe_chunk, &pb, 30, 1, b, 0 } };
+    sm3_qos_run(q, &solo.req);
+    n = 0;
+    gate = 0;
+    subs[0].req.count = 1;
+    subs[1].req.count = 40;
+    subs[2].req.count = 40;
+    pthread_create(&th[0], NULL, qos_submit_main, &subs[0]);
+    usleep(20000);
+    pthread_create(&th[1], NULL, qos_submit_main, &subs[1]);
+    qos_wait_queued(q, 1);
+    pthread_create(&th[2], NULL, qos_submit_main, &subs[2]);
+    qos_wait_queued(q, 2);
+    atomic_store(&gate, 1);
+    for (int i = 0; i < 3; i++) pthread_join(th[i], NULL);
+    na = nb = 0;
+    for (int i = 1; ok && i < 1 + 40; i++) {
+        na += order[i] == 'A';
+        nb += order[i] == 'B';
+    }
+    ok = ok && na >= 29 && na <= 31;
+    if (!ok) printf("✗ 租户重新活跃后分配错误 (a %d / b %d)\n", na, nb);
+
+    // 分类统计与指标
+    sm3_qos_stats_t st;
+    sm3_qos_stats(q, &st);
+    sm3_hist_summary_t hs;
+    int dl = sm3_metrics_histogram(m, "sm3_qos_deadline_latency_seconds", NULL, 1e-9);
+    ok = ok && st.queued == 0 && st.cls[SM3_QOS_DEADLINE].requests == 2 &&
+         st.cls[SM3_QOS_DEADLINE].pages == 4 && st.cls[SM3_QOS_DEADLINE].missed == 0 &&
+         st.cls[SM3_QOS_BULK].requests == 7 && st.tenant_pages[b] == 40 + 2 + 30 + 40 &&
+         sm3_metrics_hist_summary(m, dl, &hs) == 0 && hs.count == 2;
+
+    // 页摘要与单页接口一致；参数无效
+    uint8_t* pages = malloc(100 * SM3_PAGE_SIZE);
+    uint8_t digests[100 * 32], one[32];
+    for (int i = 0; pages && i < 100 * SM3_PAGE_SIZE; i++) pages[i] = (uint8_t)(i * 31 + i / 4093);
+    sm3_qos_req_t req = { NULL, NULL, 0, 8, a, sm3_now_ns() + 1000000000ull };
+    ok = ok && pages && sm3_qos_hash_pages(q, &req, pages, 100, digests, 32) == 0;
+    for (int i = 0; ok && i < 100; i++) {
+        aes_sm3_integrity_256bit(pages + (size_t)i * SM3_PAGE_SIZE, one);
+        ok = memcmp(one, digests + i * 32, 32) == 0;
+    }
+    req.tenant = 9;
+    ok = ok && sm3_qos_hash_pages(q, &req, pages, 1, digests, 32) != 0 && errno == EINVAL;
+    free(pages);
+    sm3_qos_destroy(q);
+    sm3_metrics_destroy(m);
+    if (!ok) {
+        printf("✗ 统计或页摘要错误\n");
+        return 0;
+    }
+    printf("✓ 服务质量调度测试通过 (EDF 优先, 加权公平 3:1, 切块粒度抢占)\n");
+    return 1;
+}
+
+// ============================================================================
+// 测试16: 过载自适应校验级别
+// ============================================================================
+
+int test_overload_levels() {
+    printf("\n=== 测试16: 过载自适应校验级别 ===\n");
+
+    // CRC32C 标准校验值
+    int ok = sm3_crc32c(0, "123456789", 9) == 0xE3069283u &&
+             sm3_crc32c(sm3_crc32c(0, "1234", 4), "56789", 5) == 0xE3069283u;
+    if (!ok) {
+        printf("✗ CRC32C 结果错误\n");
+        return 0;
+    }
+
+    // 16页参考值；第3页与第4页各翻转一个比特
+    enum { N = 16 };
+    uint8_t* buf = malloc((size_t)N * SM3_PAGE_SIZE);
+    sm3_level_tag_t tag[N];
+    const uint8_t* pages[N];
+    const sm3_level_tag_t* tags[N];
+    uint8_t res[N];
+    for (int i = 0; buf && i < N * SM3_PAGE_SIZE; i++) buf[i] = (uint8_t)(i * 7 + i / 4096);
+    for (int i = 0; buf && i < N; i++) {
+        pages[i] = buf + (size_t)i * SM3_PAGE_SIZE;
+        tags[i] = &tag[i];
+        sm3_level_tag(pages[i], &tag[i]);
+    }
+    ok = buf != NULL;
+    if (ok) {
+        buf[3 * SM3_PAGE_SIZE + 100] ^= 0x10;
+        buf[4 * SM3_PAGE_SIZE + 4000] ^= 0x01;
+    }
+    sm3_level_result_t r;
+    for (int lv = SM3_LEVEL_FULL; ok && lv <= SM3_LEVEL_CRC; lv++) {
+        ok = sm3_level_verify(lv, 0, pages, tags, res, N, &r) == 2 && r.level == lv &&
+             r.verified == N && r.mismatches == 2 && !res[3] && !res[4] && res[5];
+    }
+    // 抽样级每4页校验1页：第4页被抽中，第3页未校验
+    ok = ok && sm3_level_verify(SM3_LEVEL_SAMPLED, 4, pages, tags, res, N, &r) == 1 &&
+         r.verified == 4 && res[3] && !res[4];
+    ok = ok && sm3_level_verify(SM3_LEVELS, 1, pages, tags, res, N, &r) < 0 && errno == EINVAL;
+    if (!ok) {
+        printf("✗ 各级别校验结果错误\n");
+        free(buf);
+        return 0;
+    }
+
+    // 类别0可降到抽样级，类别1最低为 XOR-SM3
+    sm3_overload_class_t cfg[2];
+    sm3_overload_class_default(&cfg[0]);
+    cfg[0].queue_high = 10;
+    cfg[0].queue_low = 2;
+    cfg[0].slo_ns = 1000000;
+    cfg[0].degrade_hold_ns = 10000000;
+    cfg[0].recover_hold_ns = 100000000;
+    cfg[0].sample_every = 4;
+    cfg[1] = cfg[0];
+    cfg[1].max_level = SM3_LEVEL_XOR;
+    sm3_overload_t* ov = sm3_overload_create(2, cfg);
+    const uint64_t MS = 1000000;
+    int trace[8], nt = 0;
+    for (uint64_t t = 1; ov && t <= 45; t++) {
+        for (int c = 0; c < 2; c++) sm3_overload_observe_at(ov, c, 20, 100000, t * MS);
+        if (t % 10 == 1) trace[nt++] = sm3_overload_level(ov, 0);
+    }
+    ok = ov && nt == 5 && trace[0] == SM3_LEVEL_FULL && trace[1] == SM3_LEVEL_XOR &&
+         trace[2] == SM3_LEVEL_CRC && trace[3] == SM3_LEVEL_SAMPLED &&
+         trace[4] == SM3_LEVEL_SAMPLED && sm3_overload_level(ov, 1) == SM3_LEVEL_XOR;
+
+    // 降级期间的校验记录实际级别；页4在抽样中被发现（轮转抽样起点为0）
+    ok = ok && sm3_overload_verify(ov, 0, pages, tags, res, N, &r) == 1 &&
+         r.level == SM3_LEVEL_SAMPLED && r.verified == 4 && !res[4];
+    ok = ok && sm3_overload_verify(ov, 1, pages, tags, res, N, &r) == 2 &&
+         r.level == SM3_LEVEL_XOR && r.verified == N;
+
+    // 滞回区间内不变；恢复条件每持续100ms升一级
+    for (uint64_t t = 50; ok && t <= 90; t++) sm3_overload_observe_at(ov, 0, 5, 100000, t * MS);
+    ok = ok && sm3_overload_level(ov, 0) == SM3_LEVEL_SAMPLED;
+    nt = 0;
+    for (uint64_t t = 100; ok && t <= 450; t++) {
+        sm3_overload_observe_at(ov, 0, 0, 100000, t * MS);
+        if (t % 100 == 50) trace[nt++] = sm3_overload_level(ov, 0);
+    }
+    ok = ok && nt == 4 && trace[0] == SM3_LEVEL_SAMPLED && trace[1] == SM3_LEVEL_CRC &&
+         trace[2] == SM3_LEVEL_XOR && trace[3] == SM3_LEVEL_FULL;
+
+    // 队列不深但延迟 EWMA 超过 SLO 也会降级
+    for (uint64_t t = 1000; ok && t < 1040; t++) sm3_overload_observe_at(ov, 0, 0, 5 * MS, t * MS);
+    sm3_overload_stats_t st = { 0 };
+    if (ov) sm3_overload_stats(ov, 0, &st);
+    ok = ok && sm3_overload_level(ov, 0) != SM3_LEVEL_FULL && st.ewma_ns > cfg[0].slo_ns &&
+         st.degrades >= 4 && st.recoveries == 3 && st.pages[SM3_LEVEL_SAMPLED] == N &&
+         st.verified[SM3_LEVEL_SAMPLED] == 4;
+    sm3_overload_destroy(ov);
+
+    // 配置无效
+    cfg[1].min_level = SM3_LEVEL_CRC;
+    ok = ok && sm3_overload_create(2, cfg) == NULL && errno == EINVAL;
+    free(buf);
+    if (!ok) {
+        printf("✗ 级别调整或统计错误\n");
+        return 0;
+    }
+    printf("✓ 过载自适应校验测试通过 (逐级降级, 滞回恢复, 级别下限, 记录实际级别)\n");
+    return 1;
+}
+
+// ============================================================================
+// 测试17: 重复率分析
+// ============================================================================
+
+static int dedup_same(const sm3_dedup_result_t* a, const sm3_dedup_result_t* b) {
+    if (a->pages != b->pages || a->unique != b->unique || a->duplicated != b->duplicated ||
+        a->top_count != b->top_count ||
+        memcmp(a->hist_digests, b->hist_digests, sizeof(a->hist_digests)) != 0 ||
+        memcmp(a->hist_pages, b->hist_pages, sizeof(a->hist_pages)) != 0) {
+        return 0;
+    }
+    for (int i = 0; i < a->top_count; i++) {
+        if (a->top[i].count != b->top[i].count || memcmp(a->top[i].digest, b->top[i].digest, 32) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int test_dedup_analyze() {
+    printf("\n=== 测试17: 重复率分析 ===\n");
+
+    // 20000个不同摘要；A 出现1000次，B0..B49 各3次；
+    // C/C' 与 D/D' 前64位相同（D 出现2次），检验前缀相同时按完整摘要区分
+    enum { N = 20000 + 1000 + 150 + 2 + 3 };
+    uint8_t* d = malloc((size_t)N * 32);
+    if (!d) {
+        printf("✗ 内存分配失败\n");
+        return 0;
+    }
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+    size_t n = 0;
+    for (int i = 0; i < 20000 + 1 + 50 + 2; i++) {
+        uint8_t rec[32];
+        for (int k = 0; k < 32; k += 8) {
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            memcpy(rec + k, &x, 8);
+        }
+        int reps = i < 20000 ? 1 : i == 20000 ? 1000 : i < 20051 ? 3 : 1;
+        for (int r = 0; r < reps; r++) memcpy(d + 32 * n++, rec, 32);
+        if (i >= 20051) {
+            rec[31] ^= 0x5a;            // C' / D'
+            memcpy(d + 32 * n++, rec, 32);
+            if (i == 20052) {
+                memcpy(d + 32 * n, d + 32 * (n - 2), 32);                  // D 第2次
+                n++;
+            }
+        }
+    }
+    for (size_t i = n - 1; i > 0; i--) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        size_t j = x % (i + 1);
+        uint8_t t[32];
+        memcpy(t, d + 32 * i, 32);
+        memcpy(d + 32 * i, d + 32 * j, 32);
+        memcpy(d + 32 * j, t, 32);
+    }
+
+    sm3_dedup_opts_t opts;
+    sm3_dedup_opts_default(&opts);
+    opts.num_threads = 3;
+    opts.top = 5;
+    sm3_dedup_result_t mem, spill;
+    int ok = n == N && sm3_dedup_analyze_digests(d, n, 32, &opts, &mem) == 0;
+    ok = ok && mem.pages == N && mem.unique == 20055 && mem.duplicated == 52 &&
+         mem.spill_bytes == 0 && mem.hist_digests[0] == 20003 && mem.hist_digests[1] == 1 &&
+         mem.hist_pages[1] == 2 && mem.hist_digests[2] == 50 && mem.hist_pages[2] == 150 &&
+         mem.hist_digests[10] == 1 && mem.hist_pages[10] == 1000 && mem.top_count == 5 &&
+         mem.top[0].count == 1000 && mem.top[1].count == 3 && mem.top[4].count == 3 &&
+         memcmp(mem.top[1].digest, mem.top[2].digest, 32) < 0 &&
+         fabs(sm3_dedup_ratio(&mem) - (1.0 - 20055.0 / N)) < 1e-12;
+    if (!ok) {
+        printf("✗ 内存模式统计错误\n");
+        free(d);
+        return 0;
+    }
+
+    // 内存上限很小时分区溢出到临时文件，结果相同
+    opts.mem_limit = 64 * 1024;
+    opts.tmp_dir = tmp_dir;
+    ok = sm3_dedup_analyze_digests(d, n, 32, &opts, &spill) == 0 && spill.spill_bytes == N * 32 &&
+         spill.partitions > 256 && dedup_same(&mem, &spill);
+    sm3_dedup_result_free(&spill);
+
+    // 多个清单合并统计；摘要长度不一致时拒绝
+    char p1[512], p2[512], p3[512];
+    tmp_path(p1, sizeof(p1), "dedup1.mani");
+    tmp_path(p2, sizeof(p2), "dedup2.mani");
+    tmp_path(p3, sizeof(p3), "dedup3.mani");
+    sm3_manifest_t m1, m2, m3;
+    size_t half = n / 2;
+    ok = ok && sm3_manifest_create(&m1, p1, half * SM3_PAGE_SIZE, 32) == 0;
+    if (ok) {
+        memcpy(m1.digests, d, half * 32);
+        sm3_manifest_close(&m1);
+    }
+    ok = ok && sm3_manifest_create(&m2, p2, (n - half) * SM3_PAGE_SIZE, 32) == 0;
+    if (ok) {
+        memcpy(m2.digests, d + half * 32, (n - half) * 32);
+        sm3_manifest_close(&m2);
+    }
+    ok = ok && sm3_manifest_create(&m3, p3, SM3_PAGE_SIZE, 16) == 0;
+    if (ok) sm3_manifest_close(&m3);
+    const char* paths[3] = { p1, p2, p3 };
+    sm3_dedup_result_t files;
+    opts.mem_limit = 0;
+    ok = ok && sm3_dedup_analyze(paths, 2, &opts, &files) == 0 && dedup_same(&mem, &files);
+    if (ok) sm3_dedup_result_free(&files);
+    ok = ok && sm3_dedup_analyze(paths, 3, &opts, &files) != 0 && errno == EINVAL;
+    sm3_dedup_result_free(&mem);
+    free(d);
+    if (!ok) {
+        printf("✗ 外存模式或多清单统计错误\n");
+        return 0;
+    }
+    printf("✓ 重复率分析测试通过 (内存/外存分区一致, 前缀相同摘要正确区分)\n");
+    return 1;
+}
+
+// ============================================================================
+// 测试18: MinHash 相似度估计
+// ============================================================================
+
+static void minhash_random(uint8_t* d, int n, uint64_t* x) {
+    for (int i = 0; i < n * 32; i += 8) {
+        *x ^= *x << 13; *x ^= *x >> 7; *x ^= *x << 17;
+        memcpy(d + i, x, 8);
+    }
+}
+
+int test_minhash_similarity() {
+    printf("\n=== 测试18: MinHash 相似度估计 ===\n");
+
+    // A: 4000个摘要；B: A 的前3000个 + 1000个新摘要（J = 0.6）；C: 无关；
+    // D: A 倒序且每个重复两次（集合与 A 相同）
+    enum { N = 4000 };
+    uint8_t* a = malloc(N * 32);
+    uint8_t* b = malloc(N * 32);
+    uint8_t* c = malloc(N * 32);
+    uint8_t* d = malloc(2 * N * 32);
+    uint64_t x = 0x2545F4914F6CDD1Dull;
+    int ok = a && b && c && d;
+    if (ok) {
+        minhash_random(a, N, &x);
+        memcpy(b, a, 3000 * 32);
+        minhash_random(b + 3000 * 32, 1000, &x);
+        minhash_random(c, N, &x);
+        for (int i = 0; i < N; i++) {
+            memcpy(d + 64 * i, a + 32 * (N - 1 - i), 32);
+            memcpy(d + 64 * i + 32, a + 32 * (N - 1 - i), 32);
+        }
+    }
+    sm3_minhash_t ma, mb, mc, md, half;
+    ok = ok && sm3_minhash_init(&ma, 130) != 0 && errno == EINVAL && sm3_minhash_init(&ma, 128) == 0;
+    sm3_minhash_init(&mb, 128);
+    sm3_minhash_init(&mc, 128);
+    sm3_minhash_init(&md, 128);
+    sm3_minhash_init(&half, 128);
+    if (ok) {
+        sm3_minhash_update(&ma, a, N, 32);
+        sm3_minhash_update(&mb, b, N, 32);
+        sm3_minhash_update(&mc, c, N, 32);
+        sm3_minhash_update(&md, d, 2 * N, 32);
+        sm3_minhash_update(&half, a + 1000 * 32, N - 1000, 32);
+    }
+    double jab = sm3_minhash_similarity(&ma, &mb);
+    ok = ok && sm3_minhash_similarity(&ma, &md) == 1.0 && fabs(jab - 0.6) < 0.15 &&
+         sm3_minhash_similarity(&ma, &mc) < 0.1;
+
+    // 前4字节相同、第5~8字节不同的摘要是不同的页
+    sm3_minhash_t mx;
+    sm3_minhash_init(&mx, 128);
+    for (int i = 0; ok && i < N; i++) {
+        memcpy(c + i * 32, a + i * 32, 32);
+        c[i * 32 + 5] ^= 0xff;
+    }
+    if (ok) sm3_minhash_update(&mx, c, N, 32);
+    ok = ok && sm3_minhash_similarity(&ma, &mx) < 0.1;
+
+    // 分段累积后合并与一次累积相同
+    sm3_minhash_t part;
+    sm3_minhash_init(&part, 128);
+    sm3_minhash_update(&part, a, 1000, 32);
+    sm3_minhash_merge(&half, &part);
+    ok = ok && memcmp(half.mins, ma.mins, 128 * sizeof(uint64_t)) == 0 && half.pages == N;
+
+    // b-bit 签名：8位时估计与完整签名接近
+    uint8_t pa[128], pb[128];
+    ok = ok && sm3_minhash_packed_size(128, 8) == 128 && sm3_minhash_packed_size(128, 3) == 48;
+    sm3_minhash_pack(&ma, 8, pa);
+    sm3_minhash_pack(&mb, 8, pb);
+    ok = ok && fabs(sm3_minhash_similarity_packed(pa, pb, 128, 8) - jab) < 0.05;
+    sm3_minhash_pack(&mc, 8, pb);
+    ok = ok && sm3_minhash_similarity_packed(pa, pb, 128, 8) < 0.1;
+    if (!ok) {
+        printf("✗ 签名或相似度估计错误 (J(A,B)=%.3f)\n", jab);
+        free(a); free(b); free(c); free(d);
+        return 0;
+    }
+
+    // LSH：32段×4行
+    sm3_lsh_t* lsh = sm3_lsh_create(128, 32);
+    ok = lsh && sm3_lsh_create(128, 30) == NULL && sm3_lsh_add(lsh, &ma) == 0 &&
+         sm3_lsh_add(lsh, &mb) == 1 && sm3_lsh_add(lsh, &mc) == 2 && sm3_lsh_add(lsh, &md) == 3;
+    uint32_t ids[8];
+    ok = ok && sm3_lsh_query(lsh, &ma, ids, 8) == 3 && ids[0] == 0 && ids[1] == 1 && ids[2] == 3;
+    sm3_lsh_pair_t* pairs = NULL;
+    size_t np = 0;
+    ok = ok && sm3_lsh_pairs(lsh, 0.5, &pairs, &np) == 0 && np == 3 &&
+         pairs[0].a == 0 && pairs[0].b == 3 && pairs[0].similarity == 1.0 &&
+         pairs[1].similarity == jab && pairs[2].similarity == jab;
+    free(pairs);
+    sm3_lsh_destroy(lsh);
+    free(a); free(b); free(c); free(d);
+
+    // 生成清单时同步累积，与由清单计算的签名一致；签名文件读写
+    char data[256], manifest[256], sig[256];
+    tmp_path(data, sizeof(data), "minhash.bin");
+    tmp_path(manifest, sizeof(manifest), "minhash.manifest");
+    tmp_path(sig, sizeof(sig), "minhash.sig");
+    write_test_file(data, 100 * 4096 + 5, 7);
+    sm3_scan_opts_t opts;
+    sm3_scan_opts_default(&opts);
+    opts.chunk_pages = 16;
+    sm3_minhash_t streamed, fromfile, loaded;
+    sm3_minhash_init(&streamed, 64);
+    opts.minhash = &streamed;
+    sm3_scan_stats_t stats;
+    ok = ok && sm3_manifest_build(data, manifest, &opts, &stats) == 0 && streamed.pages == 101 &&
+         sm3_minhash_from_manifest(&fromfile, 64, manifest) == 0 &&
+         memcmp(streamed.mins, fromfile.mins, 64 * sizeof(uint64_t)) == 0 &&
+         sm3_minhash_save(&streamed, sig) == 0 && sm3_minhash_load(&loaded, sig) == 0 &&
+         loaded.k == 64 && loaded.pages == 101 && sm3_minhash_similarity(&loaded, &fromfile) == 1.0 &&
+         sm3_minhash_load(&loaded, manifest) != 0;
+    // 签名文件为小端：k 与页数按字节比较
+    uint8_t raw[24];
+    FILE* fp = fopen(sig, "rb");
+    ok = ok && fp && fread(raw, sizeof(raw), 1, fp) == 1 && raw[8] == 64 && raw[9] == 0 &&
+         raw[16] == 101 && raw[17] == 0;
+    if (fp) fclose(fp);
+    if (!ok) {
+        printf("✗ LSH 检索或清单同步累积错误\n");
+        return 0;
+    }
+    printf("✓ MinHash 相似度测试通过 (J=0.6 估计 %.3f, LSH 候选对, 清单同步累积)\n", jab);
+    return 1;
+}
+
+// 原子保存（写临时文件后改名覆盖）与从树外移入目录：目标路径本身没有写事件
+static int watch_rename_case(int backend, const char* name) {
+    char root[256], outside[256], path[300], tmp[300], manifest[300];
+    tmp_path(root, sizeof(root), name);
+    snprintf(outside, sizeof(outside), "%s_out", root);
+    snprintf(manifest, sizeof(manifest), "%s.tree", root);
+    mkdir(root, 0755);
+    mkdir(outside, 0755);
+    snprintf(path, sizeof(path), "%s/x.bin", root);
+    write_test_file(path, 2 * 4096 + 5, 11);
+    snprintf(tmp, sizeof(tmp), "%s/y.bin", outside);
+    write_test_file(tmp, 4096, 12);
+
+    sm3_watch_opts_t opts;
+    sm3_watch_opts_default(&opts);
+    opts.backend = backend;
+    opts.num_threads = 2;
+    opts.window_ms = 0;
+    sm3_watch_t* w = sm3_watch_open(root, manifest, &opts);
+    if (!w) {
+        return backend == SM3_WATCH_FANOTIFY ? -1 : 0;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s/.x.bin.swp", root);
+    write_test_file(tmp, 2 * 4096 + 5, 13);
+    rename(tmp, path);
+    snprintf(tmp, sizeof(tmp), "%s/in", root);
+    rename(outside, tmp);
+
+    sm3_watch_poll(w, 0);
+    sm3_watch_flush(w);
+    sm3_tree_opts_t topts;
+    sm3_tree_opts_default(&topts);
+    sm3_tree_result_t fresh;
+    const sm3_tree_result_t* t = sm3_watch_tree(w);
+    int ok = sm3_tree_scan(root, &topts, &fresh) == 0 && fresh.count == 2 && t->count == 2;
+    for (size_t i = 0; ok && i < fresh.count; i++) {
+        const sm3_tree_entry_t* e = sm3_tree_find(t, fresh.entries[i].path);
+        ok = e && memcmp(e->root, fresh.entries[i].root, 32) == 0;
+    }
+    if (ok) sm3_tree_result_free(&fresh);
+    sm3_watch_close(w);
+    return ok;
+}
+
+int test_watch_incremental() {
+    printf("\n=== 测试19: 事件驱动增量摘要 ===\n");
+
+    char root[256], sub[256], moved[256], newdir[256], path[300], manifest[300];
+    tmp_path(root, sizeof(root), "watch");
+    tmp_path(moved, sizeof(moved), "watch_moved");
+    snprintf(sub, sizeof(sub), "%s/sub", root);
+    snprintf(newdir, sizeof(newdir), "%s/new", root);
+    snprintf(manifest, sizeof(manifest), "%s/tree.manifest", root);
+    mkdir(root, 0755);
+    mkdir(sub, 0755);
+    snprintf(path, sizeof(path), "%s/a.bin", root);
+    write_test_file(path, 3 * 4096 + 17, 1);
+    snprintf(path, sizeof(path), "%s/b.bin", root);
+    write_test_file(path, 4096, 2);
+    snprintf(path, sizeof(path), "%s/c.bin", sub);
+    write_test_file(path, 10000, 3);
+
+    // 树清单放在树内：其自身的写入应被忽略
+    sm3_watch_opts_t opts;
+    sm3_watch_opts_default(&opts);
+    opts.backend = SM3_WATCH_INOTIFY;
+    opts.num_threads = 2;
+    opts.window_ms = 50;
+    sm3_watch_t* w = sm3_watch_open(root, manifest, &opts);
+    if (!w || sm3_watch_tree(w)->count != 3 || sm3_watch_next_timeout(w) != -1) {
+        printf("✗ 打开监视器或初始扫描失败: %s\n", strerror(errno));
+        sm3_watch_close(w);
+        return 0;
+    }
+
+    // 修改 a、新建 d、删除 b、新建目录及其中文件、把 sub 移出树
+    snprintf(path, sizeof(path), "%s/a.bin", root);
+    write_test_file(path, 3 * 4096 + 17, 4);
+    write_test_file(path, 3 * 4096 + 17, 5);
+    snprintf(path, sizeof(path), "%s/d.bin", root);
+    write_test_file(path, 5 * 4096, 6);
+    snprintf(path, sizeof(path), "%s/b.bin", root);
+    unlink(path);
+    mkdir(newdir, 0755);
+    snprintf(path, sizeof(path), "%s/e.bin", newdir);
+    write_test_file(path, 100, 7);
+    rename(sub, moved);
+
+    int ok = sm3_watch_poll(w, 0) == 0 && sm3_watch_next_timeout(w) >= 0;
+    usleep(60 * 1000);
+    int done = ok ? sm3_watch_poll(w, 0) : -1;
+    if (done <= 0) done = sm3_watch_flush(w);
+    sm3_watch_stats_t st;
+    sm3_watch_stats(w, &st);
+    // a、d、b、e、sub/c 各处理一次（a 的多次事件已合并）
+    ok = done == 5 && st.batches == 1 && st.events > 5 && st.rehashed == 3 &&
+         st.removed == 2 && st.added == 2 && st.changed == 3 && st.errors == 0 &&
+         sm3_watch_next_timeout(w) == -1;
+    if (!ok) {
+        printf("✗ 批次统计错误: 处理%d 事件%llu 重算%llu 删除%llu 新增%llu 变化%llu\n", done,
+               (unsigned long long)st.events, (unsigned long long)st.rehashed,
+               (unsigned long long)st.removed, (unsigned long long)st.added,
+               (unsigned long long)st.changed);
+        sm3_watch_close(w);
+        return 0;
+    }
+
+    // 与重新全量扫描一致（全量扫描包含树清单文件本身）
+    sm3_tree_opts_t topts;
+    sm3_tree_opts_default(&topts);
+    sm3_tree_result_t fresh, loaded;
+    const sm3_tree_result_t* t = sm3_watch_tree(w);
+    ok = sm3_tree_scan(root, &topts, &fresh) == 0 && fresh.count == t->count + 1 &&
+         sm3_tree_load(manifest, &loaded) == 0 && loaded.count == t->count;
+    for (size_t i = 0; ok && i < t->count; i++) {
+        const sm3_tree_entry_t* f = sm3_tree_find(&fresh, t->entries[i].path);
+        ok = f && f->size == t->entries[i].size && memcmp(f->root, t->entries[i].root, 32) == 0 &&
+             strcmp(loaded.entries[i].path, t->entries[i].path) == 0 &&
+             memcmp(loaded.entries[i].root, t->entries[i].root, 32) == 0;
+    }
+    const sm3_tree_entry_t* a = sm3_tree_find(t, "a.bin");
+    ok = ok && a && a->changes == 1 && sm3_tree_find(t, "new/e.bin") && !sm3_tree_find(t, "b.bin") &&
+         !sm3_tree_find(t, "sub/c.bin");
+    if (ok) {
+        sm3_tree_result_free(&fresh);
+        sm3_tree_result_free(&loaded);
+    }
+    sm3_watch_close(w);
+    if (!ok) {
+        printf("✗ 监视器树清单与重新扫描不一致\n");
+        return 0;
+    }
+
+    int ino = watch_rename_case(SM3_WATCH_INOTIFY, "watch_ino");
+    int fan = watch_rename_case(SM3_WATCH_FANOTIFY, "watch_fan");
+    if (ino != 1 || fan == 0) {
+        printf("✗ 改名覆盖或移入目录未被感知 (%s)\n", ino != 1 ? "inotify" : "fanotify");
+        return 0;
+    }
+    printf("✓ 事件驱动增量摘要测试通过 (%llu 个事件合并为 %d 个文件, 改名覆盖%s)\n",
+           (unsigned long long)st.events, done, fan == 1 ? " inotify/fanotify" : " inotify");
+    return 1;
+}
+
+typedef struct {
+    sm3_nbd_t* nbd;
+    int fd;
+    int rc;
+} nbd_thread_t;
+
+static void* nbd_serve_thread(void* arg) {
+    nbd_thread_t* t = arg;
+    t->rc = sm3_nbd_serve_fd(t->nbd, t->fd);
+    close(t->fd);
+    return NULL;
+}
+
+// 建立一个连接并握手，返回客户端描述符
+static int nbd_test_connect(sm3_nbd_t* nbd, nbd_thread_t* t, pthread_t* tid, uint64_t* size) {
+    int sv[2];
+    uint16_t flags;
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+        return -1;
+    }
+    t->nbd = nbd;
+    t->fd = sv[0];
+    pthread_create(tid, NULL, nbd_serve_thread, t);
+    if (sm3_nbd_handshake(sv[1], size, &flags) != 0 || !(flags & (1 << 2))) {
+        close(sv[1]);
+        pthread_join(*tid, NULL);
+        return -1;
+    }
+    return sv[1];
+}
+
+int test_nbd_server() {
+    printf("\n=== 测试20: 带完整性标签的 NBD 服务端 ===\n");
+
+    enum { SIZE = 16 * 4096 + 100 };
+    char path[256], tags[300];
+    tmp_path(path, sizeof(path), "nbd.img");
+    snprintf(tags, sizeof(tags), "%s.tags", path);
+    write_test_file(path, SIZE, 20);
+    uint8_t* expect = malloc(SIZE);
+    uint8_t* got = malloc(SIZE);
+    uint8_t* wbuf = malloc(3 * 4096);
+    FILE* f = fopen(path, "rb");
+    int ok = expect && got && wbuf && f && fread(expect, 1, SIZE, f) == SIZE;
+    if (f) fclose(f);
+    for (int i = 0; ok && i < 3 * 4096; i++) wbuf[i] = (uint8_t)(i * 7 + 1);
+
+    sm3_nbd_opts_t opts;
+    sm3_nbd_opts_default(&opts);
+    opts.num_threads = 2;
+    opts.queue_depth = 8;
+    sm3_nbd_t* nbd = ok ? sm3_nbd_open(path, &opts) : NULL;
+    nbd_thread_t th;
+    pthread_t tid;
+    uint64_t size = 0;
+    int fd = nbd ? nbd_test_connect(nbd, &th, &tid, &size) : -1;
+    if (fd < 0 || size != SIZE || access(tags, F_OK) != 0) {
+        printf("✗ 打开或握手失败: %s\n", strerror(errno));
+        if (fd >= 0) close(fd);
+        sm3_nbd_close(nbd);
+        free(expect); free(got); free(wbuf);
+        return 0;
+    }
+
+    // 连续发出：整页写、跨页非对齐写、末尾不完整页写零、越界写、整体读回。
+    // 前两个写入落在同一批时第2页已被整页覆盖，只有第3页和末页需要读-改-写
+    sm3_nbd_request(fd, SM3_NBD_CMD_WRITE, 0, 1, 4096, 2 * 4096, wbuf);
+    memcpy(expect + 4096, wbuf, 2 * 4096);
+    sm3_nbd_request(fd, SM3_NBD_CMD_WRITE, SM3_NBD_CMD_FLAG_FUA, 2, 10000, 5000, wbuf + 100);
+    memcpy(expect + 10000, wbuf + 100, 5000);
+    sm3_nbd_request(fd, SM3_NBD_CMD_WRITE_ZEROES, 0, 3, 16 * 4096 + 10, 90, NULL);
+    memset(expect + 16 * 4096 + 10, 0, 90);
+    sm3_nbd_request(fd, SM3_NBD_CMD_WRITE, 0, 4, SIZE - 10, 20, wbuf);
+    sm3_nbd_request(fd, SM3_NBD_CMD_READ, 0, 5, 0, SIZE, NULL);
+    sm3_nbd_request(fd, SM3_NBD_CMD_FLUSH, 0, 6, 0, 0, NULL);
+    static const uint32_t want_err[6] = { 0, 0, 0, 28, 0, 0 };
+    for (uint64_t h = 1; ok && h <= 6; h++) {
+        uint64_t handle;
+        uint32_t error;
+        ok = sm3_nbd_reply(fd, &handle, &error) == 0 && handle == h && error == want_err[h - 1];
+        if (ok && h == 5) ok = sm3_nbd_recv_data(fd, got, SIZE) == 0 && memcmp(got, expect, SIZE) == 0;
+    }
+    sm3_nbd_request(fd, SM3_NBD_CMD_DISC, 0, 7, 0, 0, NULL);
+    pthread_join(tid, NULL);
+    close(fd);
+    sm3_nbd_stats_t st;
+    sm3_nbd_stats(nbd, &st);
+    ok = ok && th.rc == 0 && st.writes == 3 && st.errors == 1 && st.rmw_pages >= 2 && st.rmw_pages <= 3 &&
+         st.verify_failures == 0;
+
+    // 标签文件与数据一致，可离线校验
+    sm3_scan_opts_t sopts;
+    sm3_scan_opts_default(&sopts);
+    sm3_scan_stats_t sst;
+    ok = ok && sm3_manifest_verify(path, tags, &sopts, &sst, NULL, NULL) == 0 && sst.mismatches == 0;
+    if (!ok) {
+        printf("✗ 读写结果或标签错误\n");
+        sm3_nbd_close(nbd);
+        free(expect); free(got); free(wbuf);
+        return 0;
+    }
+
+    // 绕过服务端改写第2页：读该页返回 EIO，其余页正常；对该页的非整页写入被拒绝
+    int dfd = open(path, O_WRONLY);
+    uint8_t junk = 0x5a ^ expect[2 * 4096 + 7];
+    ok = dfd >= 0 && pwrite(dfd, &junk, 1, 2 * 4096 + 7) == 1;
+    if (dfd >= 0) close(dfd);
+    fd = ok ? nbd_test_connect(nbd, &th, &tid, &size) : -1;
+    ok = fd >= 0;
+    if (ok) {
+        sm3_nbd_request(fd, SM3_NBD_CMD_READ, 0, 1, 2 * 4096, 4096, NULL);
+        sm3_nbd_request(fd, SM3_NBD_CMD_READ, 0, 2, 0, 4096, NULL);
+        sm3_nbd_request(fd, SM3_NBD_CMD_WRITE, 0, 3, 2 * 4096 + 100, 10, wbuf);
+        sm3_nbd_request(fd, SM3_NBD_CMD_WRITE, 0, 4, 5 * 4096 + 100, 10, wbuf);
+        uint64_t handle;
+        uint32_t error;
+        ok = sm3_nbd_reply(fd, &handle, &error) == 0 && handle == 1 && error == 5 &&
+             sm3_nbd_reply(fd, &handle, &error) == 0 && handle == 2 && error == 0 &&
+             sm3_nbd_recv_data(fd, got, 4096) == 0 && memcmp(got, expect, 4096) == 0 &&
+             sm3_nbd_reply(fd, &handle, &error) == 0 && handle == 3 && error == 5 &&
+             sm3_nbd_reply(fd, &handle, &error) == 0 && handle == 4 && error == 0;
+        close(fd);
+        pthread_join(tid, NULL);
+    }
+    sm3_nbd_stats(nbd, &st);
+    ok = ok && st.connections == 2 && st.verify_failures >= 2;
+    sm3_nbd_close(nbd);
+    free(expect); free(got); free(wbuf);
+    if (!ok) {
+        printf("✗ 未检测到绕过服务端的改写\n");
+        return 0;
+    }
+
+    // 模拟崩溃：日志已提交第4页的新标签但数据未写入，第6页的记录与数据一致。
+    // 重新打开后只有第4页按数据重建标签，绕过服务端改写的第2页仍然不一致
+    char jpath[320];
+    snprintf(jpath, sizeof(jpath), "%s%s", tags, SM3_JOURNAL_SUFFIX);
+    sm3_manifest_t tm;
+    sm3_journal_t* j = NULL;
+    sm3_journal_opts_t jopts;
+    sm3_journal_opts_default(&jopts);
+    uint8_t page[4096], tag[32];
+    memset(page, 0x33, sizeof(page));
+    aes_sm3_integrity_256bit(page, tag);
+    ok = sm3_manifest_open(&tm, tags, 1) == 0 && sm3_journal_open(&j, jpath, &tm, &jopts) == 0 &&
+         sm3_journal_put(j, 4, tag) == 0 && sm3_journal_put(j, 6, sm3_manifest_digest(&tm, 6)) == 0;
+    if (j) sm3_journal_close(j);
+    sm3_manifest_close(&tm);
+    nbd = ok ? sm3_nbd_open(path, &opts) : NULL;
+    if (nbd) sm3_nbd_stats(nbd, &st);
+    ok = nbd && st.recovered_pages == 1;
+    sm3_nbd_close(nbd);
+    ok = ok && sm3_manifest_verify(path, tags, &sopts, &sst, NULL, NULL) == 0 && sst.mismatches == 1;
+    if (!ok) {
+        printf("✗ 崩溃恢复后标签错误\n");
+        return 0;
+    }
+    printf("✓ NBD 服务端测试通过 (流水线请求, 读-改-写, 越界拒绝, 检测到静默改写, 崩溃恢复)\n");
+    return 1;
+}
+
+// 写一个 ustar 头（name 不超过99字节）
+static void tar_header(FILE* f, const char* name, char type, uint64_t size, const char* link) {
+    uint8_t h[512];
+    memset(h, 0, sizeof(h));
+    snprintf((char*)h, 100, "%s", name);
+    snprintf((char*)h + 100, 8, "%07o", type == '5' ? 0755 : 0644);
+    snprintf((char*)h + 108, 8, "%07o", 0);
+    snprintf((char*)h + 116, 8, "%07o", 0);
+    snprintf((char*)h + 124, 12, "%011llo", (unsigned long long)size);
+    snprintf((char*)h + 136, 12, "%011o", 1700000000);
+    h[156] = (uint8_t)type;
+    if (link) snprintf((char*)h + 157, 100, "%s", link);
+    memcpy(h + 257, "ustar\0" "00", 8);
+    memset(h + 148, ' ', 8);
+    unsigned sum = 0;
+    for (int i = 0; i < 512; i++) sum += h[i];
+    snprintf((char*)h + 148, 8, "%06o", sum);
+    fwrite(h, 1, sizeof(h), f);
+}
+
+static void tar_data(FILE* f, const void* data, size_t len) {
+    static const uint8_t zero[512];
+    fwrite(data, 1, len, f);
+    fwrite(zero, 1, (512 - len % 512) % 512, f);
+}
+
+// 把 dir 下的文件 name 写入 tar（超过99字节的路径用 pax 扩展头）
+static void tar_file(FILE* f, const char* dir, const char* name) {
+    char path[600];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE* in = fopen(path, "rb");
+    fseek(in, 0, SEEK_END);
+    size_t size = (size_t)ftell(in);
+    fseek(in, 0, SEEK_SET);
+    uint8_t* buf = malloc(size + 1);
+    size_t got = fread(buf, 1, size, in);
+    fclose(in);
+    if (strlen(name) > 99) {
+        char rec[600];
+        // 记录长度含自身的十进制位数
+        int base = (int)strlen(name) + 7;           // " path=" + name + "\n"
+        int len = base + 1;
+        while (snprintf(NULL, 0, "%d", len) + base != len) len++;
+        snprintf(rec, sizeof(rec), "%d path=%s\n", len, name);
+        tar_header(f, "PaxHeaders/long", 'x', strlen(rec), NULL);
+        tar_data(f, rec, strlen(rec));
+    }
+    tar_header(f, strlen(name) > 99 ? "long.bin" : name, '0', got, NULL);
+    tar_data(f, buf, got);
+    free(buf);
+}
+
+int test_tar_stream() {
+    printf("\n=== 测试21: 镜像层流式摘要 ===\n");
+
+    char dir[256], sub[300], deep[400], path[600], tar[256], tgz[256], cmd[700];
+    tmp_path(dir, sizeof(dir), "tarsrc");
+    tmp_path(tar, sizeof(tar), "layer.tar");
+    tmp_path(tgz, sizeof(tgz), "layer.tar.gz");
+    snprintf(sub, sizeof(sub), "%s/sub", dir);
+    const char* deep_name = "sub/a_rather_long_directory_name_for_pax_headers_0123456789";
+    const char* long_name = "sub/a_rather_long_directory_name_for_pax_headers_0123456789/"
+                            "and_an_equally_long_file_name_abcdefghij.bin";
+    snprintf(deep, sizeof(deep), "%s/%s", dir, deep_name);
+    mkdir(dir, 0755);
+    mkdir(sub, 0755);
+    mkdir(deep, 0755);
+    const char* names[] = { "a.bin", "b.bin", "sub/c.bin", "sub/empty", long_name };
+    const size_t sizes[] = { 100, 4096, 10000, 0, 3 * 4096 + 5 };
+    for (int i = 0; i < 5; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        write_test_file(path, sizes[i], 30 + (unsigned)i);
+    }
+    char target[600];
+    snprintf(target, sizeof(target), "%s/b.bin", dir);
+    snprintf(path, sizeof(path), "%s/sub/hl.bin", dir);
+    link(target, path);
+
+    // 目录、"./" 前缀、pax 长路径、硬链接、符号链接
+    FILE* f = fopen(tar, "wb");
+    tar_header(f, "./", '5', 0, NULL);
+    tar_header(f, "./sub/", '5', 0, NULL);
+    tar_file(f, dir, "a.bin");
+    tar_file(f, dir, "b.bin");
+    tar_file(f, dir, "sub/c.bin");
+    tar_file(f, dir, "sub/empty");
+    tar_file(f, dir, long_name);
+    tar_header(f, "sub/hl.bin", '1', 0, "./b.bin");
+    tar_header(f, "sym", '2', 0, "a.bin");
+    static const uint8_t end[1024];
+    fwrite(end, 1, sizeof(end), f);
+    fclose(f);
+
+    // 小块与小批次：页跨块、批次提前结算
+    sm3_tar_opts_t opts;
+    sm3_tar_opts_default(&opts);
+    opts.chunk_size = 8192;
+    opts.max_chunks = 4;
+    opts.batch_pages = 2;
+    opts.num_threads = 2;
+    sm3_tar_result_t r, rz;
+    sm3_tree_result_t t, scan;
+    sm3_tree_opts_t topts;
+    sm3_tree_opts_default(&topts);
+    if (sm3_tar_hash_file(tar, &opts, &r) != 0 || sm3_tar_to_tree(&r, &t) != 0 ||
+        sm3_tree_scan(dir, &topts, &scan) != 0) {
+        printf("✗ 流式摘要失败: %s\n", strerror(errno));
+        return 0;
+    }
+    int ok = r.count == 9 && t.count == 6 && scan.count == 6 && strcmp(r.compression, "none") == 0 &&
+             r.copied_pages > 0 && r.batches > 3 && strcmp(r.entries[0].path, ".") == 0 &&
+             strcmp(r.entries[6].path, long_name) == 0 && strcmp(r.entries[7].link, "b.bin") == 0;
+    for (size_t i = 0; ok && i < t.count; i++) {
+        const sm3_tree_entry_t* e = sm3_tree_find(&scan, t.entries[i].path);
+        ok = e && e->size == t.entries[i].size && memcmp(e->root, t.entries[i].root, 32) == 0;
+    }
+    if (!ok) {
+        printf("✗ 文件根摘要与解包扫描不一致 (条目%zu 文件%zu)\n", r.count, t.count);
+        return 0;
+    }
+
+    // 流摘要即整个 tar 的 SM3
+    FILE* in = fopen(tar, "rb");
+    uint8_t* all = malloc(64 * 1024);
+    size_t len = fread(all, 1, 64 * 1024, in);
+    fclose(in);
+    uint8_t expect[32];
+    sm3_hash(all, len, expect);
+    free(all);
+    ok = r.stream_bytes == len && memcmp(expect, r.stream_digest, 32) == 0;
+
+    // gzip 压缩的同一层结果相同
+    snprintf(cmd, sizeof(cmd), "gzip -c %s > %s", tar, tgz);
+    ok = ok && system(cmd) == 0 && sm3_tar_hash_file(tgz, &opts, &rz) == 0;
+    if (ok) {
+        ok = strcmp(rz.compression, "gzip") == 0 && rz.count == r.count && rz.pages == r.pages &&
+             memcmp(rz.stream_digest, r.stream_digest, 32) == 0 &&
+             memcmp(rz.digests, r.digests, r.pages * (uint64_t)r.digest_size) == 0;
+        sm3_tar_result_free(&rz);
+    }
+    if (!ok) {
+        printf("✗ 流摘要或压缩输入结果不一致\n");
+        return 0;
+    }
+
+    // 追加写入的 tar 中同一路径多次出现：只保留流中最后一个
+    sm3_tar_result_t rd;
+    sm3_tree_result_t td;
+    f = fopen(tar, "wb");
+    uint8_t* content = calloc(1, 16 * 4096);
+    for (int v = 0; f && content && v < 12; v++) {
+        char name[32];
+        snprintf(name, sizeof(name), v % 3 ? "dup.bin" : "other%d.bin", v);
+        memset(content, 'a' + v, 16 * 4096);
+        tar_header(f, name, '0', (uint64_t)(v + 1) * 3000, NULL);
+        tar_data(f, content, (size_t)(v + 1) * 3000);
+    }
+    free(content);
+    if (f) {
+        fwrite(end, 1, sizeof(end), f);
+        fclose(f);
+    }
+    ok = sm3_tar_hash_file(tar, &opts, &rd) == 0;
+    if (ok) {
+        ok = sm3_tar_to_tree(&rd, &td) == 0;
+        const sm3_tree_entry_t* e = ok ? sm3_tree_find(&td, "dup.bin") : NULL;
+        ok = e && td.count == 5 && e->size == 12 * 3000 &&
+             memcmp(e->root, rd.entries[11].root, 32) == 0;
+        if (td.entries) sm3_tree_result_free(&td);
+        sm3_tar_result_free(&rd);
+    }
+    if (!ok) {
+        printf("✗ 重复路径未保留最后出现的条目\n");
+        return 0;
+    }
+
+    // 截断的流
+    int fd = open(tar, O_RDONLY);
+    int pfd[2];
+    ok = fd >= 0 && pipe(pfd) == 0;
+    if (ok) {
+        uint8_t buf[3000];
+        ssize_t n = pread(fd, buf, sizeof(buf), 0);
+        ok = n == (ssize_t)sizeof(buf) && write(pfd[1], buf, sizeof(buf)) == (ssize_t)sizeof(buf);
+        close(pfd[1]);
+        ok = ok && sm3_tar_hash_fd(pfd[0], &opts, &rz) == -1 && errno == EINVAL;
+        close(pfd[0]);
+    }
+    if (fd >= 0) close(fd);
+    uint64_t copied = r.copied_pages;
+    sm3_tree_result_free(&t);
+    sm3_tree_result_free(&scan);
+    sm3_tar_result_free(&r);
+    if (!ok) {
+        printf("✗ 截断的流未报错\n");
+        return 0;
+    }
+    printf("✓ 镜像层流式摘要测试通过 (pax/硬链接/压缩输入, 跨块拷贝%llu页)\n", (unsigned long long)copied);
+    return 1;
+}
+
+static int truncate_file(const char* path, uint64_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    int rc = ftruncate(fd, (off_t)size);
+    close(fd);
+    return rc;
+}
+
+static void flip_byte(const char* path, uint64_t off) {
+    int fd = open(path, O_RDWR);
+    uint8_t b = 0;
+    if (fd < 0) return;
+    if (pread(fd, &b, 1, (off_t)off) == 1) {
+        b ^= 0x5a;
+        if (pwrite(fd, &b, 1, (off_t)off) != 1) b = 0;
+    }
+    close(fd);
+}
+
+typedef struct {
+    sm3_nbd_t* nbd;
+    int lfd;
+} mirror_thread_t;
+
+static void* mirror_serve_thread(void* arg) {
+    mirror_thread_t* t = arg;
+    int fd = accept(t->lfd, NULL, NULL);
+    if (fd >= 0) {
+        sm3_nbd_serve_fd(t->nbd, fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int test_mirror_repair() {
+    printf("\n=== 测试22: 从镜像自动修复 ===\n");
+
+    // 1. 页存储读路径：坏页从副本修复后读取成功，副本也坏的页仍报错
+    enum { PAGES = 64 };
+    char store_path[256], mirror[256];
+    tmp_path(store_path, sizeof(store_path), "repair.store");
+    tmp_path(mirror, sizeof(mirror), "repair.mirror");
+    uint8_t* data = malloc(PAGES * 4096);
+    uint8_t* got = malloc(PAGES * 4096);
+    for (int i = 0; i < PAGES * 4096; i++) data[i] = (uint8_t)(i * 13 + i / 4096);
+    sm3_store_opts_t sopts;
+    sm3_store_opts_default(&sopts);
+    sm3_store_t* st = NULL;
+    int ok = sm3_store_open(&st, store_path, &sopts) == 0 &&
+             sm3_store_write(st, 0, PAGES, data) == 0 && sm3_store_close(st) == 0;
+    char cmd[600];
+    snprintf(cmd, sizeof(cmd), "cp %s %s", store_path, mirror);
+    ok = ok && system(cmd) == 0;
+    flip_byte(store_path, 3 * 4096 + 1);
+    flip_byte(store_path, 4 * 4096 + 2);
+    flip_byte(store_path, 40 * 4096 + 3);
+    flip_byte(store_path, 50 * 4096);
+    flip_byte(mirror, 50 * 4096 + 7);
+
+    sm3_repair_opts_t ropts;
+    sm3_repair_opts_default(&ropts);
+    ropts.batch_pages = 2;
+    sm3_repair_t* r = ok ? sm3_repair_open(mirror, &ropts) : NULL;
+    sopts.repair = r;
+    ok = r && sm3_store_open(&st, store_path, &sopts) == 0;
+    if (ok) {
+        int rc = sm3_store_read(st, 0, PAGES, got);
+        const sm3_store_stats_t* ss = sm3_store_stats(st);
+        const sm3_repair_stats_t* rs = sm3_repair_stats(r);
+        ok = rc == -1 && errno == EBADMSG && ss->verify_failures == 4 && ss->repaired_pages == 3 &&
+             memcmp(got, data, 50 * 4096) == 0 && rs->repaired == 3 && rs->mirror_bad == 1 &&
+             rs->batches == 2 && sm3_store_read(st, 0, 50, got) == 0 && ss->cache_hits >= 50;
+        sm3_store_close(st);
+    }
+    sm3_repair_close(r);
+    if (!ok) {
+        printf("✗ 页存储读路径修复失败\n");
+        free(data); free(got);
+        return 0;
+    }
+    printf("✓ 页存储：3页从副本修复，副本也损坏的页仍返回 EBADMSG\n");
+
+    // 2. 按清单修复文件，镜像为 NBD 导出，重复页与已一致页、不完整末页、限速
+    enum { SIZE = 20 * 4096 + 100 };
+    char file[256], manifest[256], sock[256];
+    tmp_path(file, sizeof(file), "repair.img");
+    tmp_path(manifest, sizeof(manifest), "repair.img.manifest");
+    tmp_path(mirror, sizeof(mirror), "repair.img.mirror");
+    tmp_path(sock, sizeof(sock), "repair.sock");
+    write_test_file(file, SIZE, 22);
+    write_test_file(mirror, SIZE, 22);
+    sm3_scan_opts_t mopts;
+    sm3_scan_opts_default(&mopts);
+    sm3_scan_stats_t ms;
+    ok = sm3_manifest_build(file, manifest, &mopts, &ms) == 0;
+    flip_byte(file, 0);
+    flip_byte(file, 5 * 4096 + 9);
+    flip_byte(file, 20 * 4096 + 99);
+
+    sm3_nbd_opts_t nopts;
+    sm3_nbd_opts_default(&nopts);
+    nopts.read_only = 1;
+    mirror_thread_t mt = { ok ? sm3_nbd_open(mirror, &nopts) : NULL, sm3_nbd_listen(sock) };
+    pthread_t tid;
+    ok = mt.nbd && mt.lfd >= 0 && pthread_create(&tid, NULL, mirror_serve_thread, &mt) == 0;
+    if (ok) {
+        char addr[300];
+        snprintf(addr, sizeof(addr), "nbd:%s", sock);
+        sm3_repair_opts_default(&ropts);
+        ropts.max_mbps = 1;
+        r = sm3_repair_open(addr, &ropts);
+        const uint64_t pages[] = { 5, 0, 20, 5, 7 };
+        int left = r ? sm3_repair_file(r, file, manifest, pages, 5) : -1;
+        const sm3_repair_stats_t* rs = r ? sm3_repair_stats(r) : NULL;
+        ok = left == 0 && rs->requested == 4 && rs->repaired == 3 && rs->already_ok == 1 &&
+             rs->batches == 1 && rs->throttle_ns > 0 && files_equal(file, mirror) &&
+             sm3_manifest_verify(file, manifest, &mopts, &ms, NULL, NULL) == 0 && ms.mismatches == 0;
+        sm3_repair_close(r);
+        pthread_join(tid, NULL);
+    }
+    if (mt.lfd >= 0) close(mt.lfd);
+    sm3_nbd_close(mt.nbd);
+    free(data); free(got);
+    if (!ok) {
+        printf("✗ 经 NBD 镜像修复文件失败\n");
+        return 0;
+    }
+
+    // 3. 一批中的区间数远超服务端队列深度与套接字缓冲区：全零的稀疏文件
+    //    隔页损坏，8192个单页区间（一次全部发出时双方互相等待）
+    enum { BIG = 16384 };
+    tmp_path(file, sizeof(file), "repair.big");
+    tmp_path(manifest, sizeof(manifest), "repair.big.manifest");
+    tmp_path(mirror, sizeof(mirror), "repair.big.mirror");
+    tmp_path(sock, sizeof(sock), "repair_big.sock");
+    ok = truncate_file(file, (uint64_t)BIG * 4096) == 0 &&
+         truncate_file(mirror, (uint64_t)BIG * 4096) == 0 &&
+         sm3_manifest_build(file, manifest, &mopts, &ms) == 0;
+    uint64_t* bad = malloc(BIG / 2 * sizeof(uint64_t));
+    for (int i = 0; bad && i < BIG / 2; i++) {
+        bad[i] = (uint64_t)i * 2;
+        flip_byte(file, bad[i] * 4096 + 11);
+    }
+    mt.nbd = ok && bad ? sm3_nbd_open(mirror, &nopts) : NULL;
+    mt.lfd = sm3_nbd_listen(sock);
+    ok = mt.nbd && mt.lfd >= 0 && pthread_create(&tid, NULL, mirror_serve_thread, &mt) == 0;
+    if (ok) {
+        char addr[300];
+        snprintf(addr, sizeof(addr), "nbd:%s", sock);
+        sm3_repair_opts_default(&ropts);
+        ropts.batch_pages = BIG / 2;
+        r = sm3_repair_open(addr, &ropts);
+        int left = r ? sm3_repair_file(r, file, manifest, bad, BIG / 2) : -1;
+        const sm3_repair_stats_t* rs = r ? sm3_repair_stats(r) : NULL;
+        ok = left == 0 && rs->repaired == BIG / 2 && rs->batches == 1 &&
+             sm3_manifest_verify(file, manifest, &mopts, &ms, NULL, NULL) == 0 && ms.mismatches == 0;
+        sm3_repair_close(r);
+        pthread_join(tid, NULL);
+    }
+    if (mt.lfd >= 0) close(mt.lfd);
+    sm3_nbd_close(mt.nbd);
+    free(bad);
+    if (!ok) {
+        printf("✗ 大量区间经 NBD 镜像修复失败\n");
+        return 0;
+    }
+    printf("✓ 从镜像自动修复测试通过 (页存储读路径, 清单文件经 NBD 副本)\n");
+    return 1;
+}
+
+// 主测试函数
+int main() {
+    printf("\n");
+    printf("╔═══════════════════════════════════════════════════════════╗\n");
+    printf("║  XOR-SM3扩展模块 - 正确性测试套件                      ║\n");
+    printf("╚═══════════════════════════════════════════════════════════╝\n");
+
+    if (!mkdtemp(tmp_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    int total_tests = 22;
+    int passed_tests = 0;
+
+    passed_tests += test_manifest_roundtrip();
+    passed_tests += test_checkpoint_resume();
+    passed_tests += test_tree_scan();
+    passed_tests += test_tree_incremental();
+    passed_tests += test_sampled_verify();
+    passed_tests += test_preload_sidecar();
+    passed_tests += test_page_store();
+    passed_tests += test_digest_journal();
+    passed_tests += test_verified_stream();
+    passed_tests += test_bench_corpus();
+    passed_tests += test_baseline_compare();
+    passed_tests += test_trace_export();
+    passed_tests += test_metrics_export();
+    passed_tests += test_slow_request_log();
+    passed_tests += test_qos_scheduling();
+    passed_tests += test_overload_levels();
+    passed_tests += test_dedup_analyze();
+    passed_tests += test_minhash_similarity();
+    passed_tests += test_watch_incremental();
+    passed_tests += test_nbd_server();
+    passed_tests += test_tar_stream();
+    passed_tests += test_mirror_repair();
+
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", tmp_dir);
+    if (system(cmd) != 0) {
+        printf("⚠️  临时目录清理失败: %s\n", tmp_dir);
+    }
+
+    printf("\n");
+    printf("═══════════════════════════════════════════════════════════\n");
+    printf("  测试结果: %d/%d 通过\n", passed_tests, total_tests);
+    printf("═══════════════════════════════════════════════════════════\n");
+
+    return passed_tests == total_tests ? 0 : 1;
+}